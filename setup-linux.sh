@@ -3,6 +3,6 @@ pushd "external/vcpkg"
 VCPKG_DEFAULT_TRIPLET=x64-linux
 
 ./bootstrap-vcpkg.sh
-#./vcpkg install fmt spdlog gsl-lite sdl2 imgui glbinding glm
-./vcpkg install fmt spdlog gsl-lite imgui glbinding glm
+#./vcpkg install fmt spdlog gsl-lite sdl2 imgui glbinding glm zlib
+./vcpkg install fmt spdlog gsl-lite imgui glbinding glm zlib
 popd
@@ -2,16 +2,36 @@
 #include <util/fs.hpp>
 #include <util/load_file.hpp>
 
+#include <algorithm>
+#include <map>
 #include <memory>
+#include <mutex>
 
 namespace bios {
 
-Bios::Bios(fs::path const& path) {
-  auto buf = util::load_file(path);
+BiosImage::BiosImage(const fs::path& path)
+    : m_data(util::load_file(path)),
+      m_blocks(std::make_shared<cpu::SharedBlocks>()) {}
 
-  m_data = std::make_unique<std::array<byte, memory::BIOS_SIZE>>();
+std::shared_ptr<BiosImage> BiosImage::load(const fs::path& path) {
+  static std::mutex mutex;
+  static std::map<fs::path, std::weak_ptr<BiosImage>> images;
 
-  std::copy(buf.begin(), buf.end(), m_data->begin());
+  const std::lock_guard<std::mutex> lock(mutex);
+  auto& image = images[fs::absolute(path)];
+  if (auto loaded = image.lock())
+    return loaded;
+
+  auto loaded = std::make_shared<BiosImage>(path);
+  image = loaded;
+  return loaded;
+}
+
+Bios::Bios(memory::AddressSpace& address_space, const BiosImage& image)
+    : Addressable(address_space.bios()) {
+  const auto& data = image.data();
+
+  std::copy_n(data.begin(), std::min<size_t>(data.size(), memory::BIOS_SIZE), m_data);
 }
 
 }  // namespace bios
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cpu/block_cache.hpp>
+#include <memory/address_space.hpp>
 #include <memory/addressable.hpp>
 #include <memory/map.hpp>
 #include <util/fs.hpp>
@@ -10,9 +12,28 @@
 
 namespace bios {
 
+// A BIOS file as loaded from disk, along with the blocks the CPUs running it decoded. The BIOS is
+// read-only, so emulators running in the same process share its image instead of each loading and
+// decoding it on their own.
+class BiosImage {
+ public:
+  explicit BiosImage(const fs::path& path);
+
+  // The image already loaded from path if some emulator still holds it, otherwise a new one.
+  // Thread-safe.
+  static std::shared_ptr<BiosImage> load(const fs::path& path);
+
+  const buffer& data() const { return m_data; }
+  const std::shared_ptr<cpu::SharedBlocks>& blocks() const { return m_blocks; }
+
+ private:
+  buffer m_data;
+  std::shared_ptr<cpu::SharedBlocks> m_blocks;
+};
+
 class Bios : public memory::Addressable<memory::BIOS_SIZE> {
  public:
-  explicit Bios(fs::path const& path);
+  Bios(memory::AddressSpace& address_space, const BiosImage& image);
 };
 
 }  // namespace bios
@@ -1,32 +1,58 @@
 #pragma once
 
+#include <bios/hle.hpp>
 #include <bus/bus.hpp>
 #include <cpu/cpu.hpp>
 #include <util/log.hpp>
 #include <util/types.hpp>
 
-#include <functional>
-#include <unordered_map>
+#include <array>
+#include <cstddef>
 
 namespace bios {
+
+// Called before logging the function, returns whether it should be logged
+using Callback = bool (*)(cpu::Cpu&);
+// Native implementation of the function (see bios/hle.hpp), returns false to run the BIOS code instead
+using HleHandler = bool (*)(cpu::Cpu&, u32& out_result);
+
 struct Function {
-  const char* name;
-  std::vector<const char*> args;
-  std::function<bool(cpu::Cpu&)> callback;
+  const char* name{};                 // nullptr if the function is unknown
+  std::array<const char*, 5> args{};  // Unused ones are nullptr
+  Callback callback{};
+  HleHandler hle{};
 
-  Function(const char* _name, std::vector<const char*> _args) : name(_name), args(_args) {}
-  Function(const char* _name, std::vector<const char*> _args, std::function<bool(cpu::Cpu&)> _callback)
-      : name(_name),
-        args(_args),
-        callback(_callback) {}
+  size_t arg_count() const {
+    size_t count = 0;
+    while (count < args.size() && args[count] != nullptr)
+      ++count;
+    return count;
+  }
 };
 
+// Function numbers are a byte, so each table is directly indexed by them
+constexpr size_t FUNCTION_TABLE_SIZE = 0x100;
+using FunctionTable = std::array<Function, FUNCTION_TABLE_SIZE>;
+
+struct FunctionTableEntry {
+  u8 number;
+  Function function;
+};
+
+template <size_t N>
+constexpr FunctionTable make_function_table(const FunctionTableEntry (&entries)[N]) {
+  FunctionTable table{};
+  for (size_t i = 0; i < N; ++i)
+    table[entries[i].number] = entries[i].function;
+  return table;
+}
+
 inline bool dont_log(cpu::Cpu& cpu) {
   return false;
 }
 
 inline bool dbg_output_char(cpu::Cpu& cpu) {
-  cpu.m_tty_out_log += static_cast<char>(cpu.gpr(4));
+  cpu.m_tty_out_log.append(static_cast<char>(cpu.gpr(4)));
   return false;
 }
 
@@ -34,10 +60,10 @@ inline bool dbg_output_string(cpu::Cpu& cpu) {
   for (u8 i = 0; i < 80; ++i) {
     char c = cpu.bus().read8(cpu.gpr(4) + i);
     if (c == 0) {
-      cpu.m_tty_out_log += '\n';
+      cpu.m_tty_out_log.append('\n');
       return false;
     }
-    cpu.m_tty_out_log += c;
+    cpu.m_tty_out_log.append(c);
   }
   return false;
 }
@@ -48,7 +74,7 @@ inline bool halt_system(cpu::Cpu& cpu) {
   return true;
 }
 
-const std::unordered_map<uint8_t, Function> A0 = {
+inline constexpr FunctionTable A0 = make_function_table({
   { 0x00, { "FileOpen", { "filename", "accessmode" } } },
   { 0x01, { "FileSeek", { "fd", "offset", "seektype" } } },
   { 0x02, { "FileRead", { "fd", "dst", "length" } } },
@@ -72,11 +98,11 @@ const std::unordered_map<uint8_t, Function> A0 = {
   { 0x14, { "RestoreState", { "buf,param" } } },
   { 0x15, { "strcat", { "dst", "src" } } },
   { 0x16, { "strncat", { "dst", "src", "maxlen" } } },
-  { 0x17, { "strcmp", { "str1", "str2" } } },
+  { 0x17, { "strcmp", { "str1", "str2" }, nullptr, hle_strcmp } },
   { 0x18, { "strncmp", { "str1", "str2", "maxlen" } } },
-  { 0x19, { "strcpy", { "dst", "src" } } },
+  { 0x19, { "strcpy", { "dst", "src" }, nullptr, hle_strcpy } },
   { 0x1A, { "strncpy", { "dst", "src", "maxlen" } } },
-  { 0x1B, { "strlen", { "src" } } },
+  { 0x1B, { "strlen", { "src" }, nullptr, hle_strlen } },
   { 0x1C, { "index", { "src", "char" } } },
   { 0x1D, { "rindex", { "src", "char" } } },
   { 0x1E, { "strchr", { "src", "char" } } },
@@ -89,10 +115,10 @@ const std::unordered_map<uint8_t, Function> A0 = {
   { 0x25, { "toupper", { "char" } } },
   { 0x26, { "tolower", { "char" } } },
   { 0x27, { "bcopy", { "src", "dst", "len" } } },
-  { 0x28, { "bzero", { "dst", "len" } } },
+  { 0x28, { "bzero", { "dst", "len" }, nullptr, hle_bzero } },
   { 0x29, { "bcmp", { "ptr1", "ptr2", "len" } } },
-  { 0x2A, { "memcpy", { "dst", "src", "len" } } },
-  { 0x2B, { "memset", { "dst", "fillbyte,len" } } },
+  { 0x2A, { "memcpy", { "dst", "src", "len" }, nullptr, hle_memcpy } },
+  { 0x2B, { "memset", { "dst", "fillbyte", "len" }, nullptr, hle_memset } },
   { 0x2C, { "memmove", { "dst", "src", "len" } } },
   { 0x2D, { "memcmp", { "src1", "src2", "len" } } },
   { 0x2E, { "memchr", { "src", "scanbyte", "len" } } },
@@ -174,9 +200,9 @@ const std::unordered_map<uint8_t, Function> A0 = {
   { 0x9E, { "SetCdromIrqAutoAbort", { "type", "flag" } } },
   { 0x9F, { "SetMemSize", { "megabytes" } } },
   { 0xA1, { "BootFailed", {}, halt_system } },
-};
+});
 
-const std::unordered_map<uint8_t, Function> B0 = {
+inline constexpr FunctionTable B0 = make_function_table({
   { 0x00, { "alloc_kernel_memory", { "size" } } },
   { 0x01, { "free_kernel_memory", { "buf" } } },
   { 0x02, { "init_timer", { "t", "reload", "flags" } } },
@@ -259,9 +285,9 @@ const std::unordered_map<uint8_t, Function> B0 = {
   { 0x5B, { "ChangeClearPad", { "int" } } },
   { 0x5C, { "get_card_status", { "slot" } } },
   { 0x5D, { "wait_card_status", { "slot" } } },
-};
+});
 
-const std::unordered_map<uint8_t, Function> C0 = {
+inline constexpr FunctionTable C0 = make_function_table({
   { 0x00, { "EnqueueTimerAndVblankIrqs", { "priority" } } },  // ;used with prio=1
   { 0x01, { "EnqueueSyscallHandler", { "priority" } } },      // ;used with prio=0
   { 0x02, { "SysEnqIntRP", { "priority", "struc" } } },       // ;bugged, use with care
@@ -287,6 +313,14 @@ const std::unordered_map<uint8_t, Function> C0 = {
   { 0x1B, { "KernelRedirect", { "ttyflag" } } },   // ;PS2: ttyflag=1 causes SystemError
   { 0x1C, { "AdjustA0Table", {} } },
   { 0x1D, { "get_card_find_mode", {} } },
-};
+});
+
+inline const FunctionTable& function_table(u32 vector) {
+  switch (vector) {
+    case 0xA0: return A0;
+    case 0xB0: return B0;
+    default: return C0;
+  }
+}
 
 }  // namespace bios
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <bus/bus.hpp>
+#include <cpu/cpu.hpp>
+#include <memory/map.hpp>
+#include <memory/ram.hpp>
+#include <util/types.hpp>
+
+#include <cstring>
+#include <optional>
+
+// Native versions of hot BIOS functions, run in place of the BIOS code when Settings::hle_bios is on.
+// Handlers only take over the common case: whenever the BIOS would go through an edge case (null
+// pointers, non-positive lengths, ranges outside of main RAM...) they return false without touching
+// anything, and the call is interpreted as usual. When they do run, memory and the return value end up
+// exactly as the BIOS would leave them. Scratch registers the BIOS code clobbers aren't reproduced, the
+// calling convention doesn't allow the caller to rely on them anyways.
+
+namespace bios {
+
+// Where the kernel keeps the function tables the A0/B0/C0 vectors dispatch through
+constexpr address A0_TABLE_ADDR = 0x200;
+constexpr address B0_TABLE_ADDR = 0x874;
+constexpr address C0_TABLE_ADDR = 0x674;
+
+// Whether the kernel still dispatches the function to the BIOS ROM, i.e. the game didn't patch it
+inline bool dispatches_to_rom(const bus::Bus& bus, u32 vector, u8 func_number) {
+  const address table = vector == 0xA0 ? A0_TABLE_ADDR : vector == 0xB0 ? B0_TABLE_ADDR : C0_TABLE_ADDR;
+  const address entry = bus.m_ram.read<u32>(table + func_number * 4);
+
+  address entry_rebased;
+  return memory::map::BIOS.contains(memory::mask_region(entry), entry_rebased);
+}
+
+// Offset in RAM of the guest range [addr, addr + size), if it lies in main RAM (or one of its mirrors)
+inline std::optional<address> ram_offset(address addr, u32 size) {
+  address addr_rebased;
+  if (!memory::map::RAM_MIRRORS.contains(memory::mask_region(addr), addr_rebased))
+    return std::nullopt;
+
+  addr_rebased %= memory::RAM_SIZE;
+  if (size > memory::RAM_SIZE - addr_rebased)
+    return std::nullopt;
+  return addr_rebased;
+}
+
+// Length of the NUL terminated guest string at addr, if all of it is in RAM
+inline std::optional<u32> ram_strlen(const bus::Bus& bus, address addr) {
+  const auto offset = ram_offset(addr, 1);
+  if (!offset)
+    return std::nullopt;
+
+  const byte* str = bus.m_ram.host_ptr() + *offset;
+  const void* nul = std::memchr(str, 0, memory::RAM_SIZE - *offset);
+  if (nul == nullptr)
+    return std::nullopt;
+  return static_cast<u32>(static_cast<const byte*>(nul) - str);
+}
+
+// A(1Bh) strlen(src)
+inline bool hle_strlen(cpu::Cpu& cpu, u32& out_result) {
+  const address src = cpu.gpr(4);
+  if (src == 0)
+    return false;
+
+  const auto len = ram_strlen(cpu.bus(), src);
+  if (!len)
+    return false;
+
+  out_result = *len;
+  return true;
+}
+
+// A(17h) strcmp(str1, str2)
+inline bool hle_strcmp(cpu::Cpu& cpu, u32& out_result) {
+  const address str1 = cpu.gpr(4);
+  const address str2 = cpu.gpr(5);
+  if (str1 == 0 || str2 == 0)
+    return false;
+
+  const auto len1 = ram_strlen(cpu.bus(), str1);
+  const auto len2 = ram_strlen(cpu.bus(), str2);
+  if (!len1 || !len2)
+    return false;
+
+  const byte* ram = cpu.bus().m_ram.host_ptr();
+  const byte* s1 = ram + *ram_offset(str1, 1);
+  const byte* s2 = ram + *ram_offset(str2, 1);
+
+  u32 i = 0;
+  while (s1[i] == s2[i] && s1[i] != 0)
+    ++i;
+
+  // The result is the difference of the mismatching chars, whose signedness only matters for non-ASCII
+  if ((s1[i] | s2[i]) & 0x80)
+    return false;
+
+  out_result = static_cast<u32>(s1[i] - s2[i]);
+  return true;
+}
+
+// A(19h) strcpy(dst, src)
+inline bool hle_strcpy(cpu::Cpu& cpu, u32& out_result) {
+  const address dst = cpu.gpr(4);
+  const address src = cpu.gpr(5);
+  if (dst == 0 || src == 0)
+    return false;
+
+  const auto len = ram_strlen(cpu.bus(), src);
+  if (!len)
+    return false;
+  const auto src_offset = ram_offset(src, *len + 1);
+  const auto dst_offset = ram_offset(dst, *len + 1);
+  // The BIOS copies byte by byte, overlapping strings would be read back while being written
+  if (!dst_offset || (*dst_offset < *src_offset + *len + 1 && *src_offset < *dst_offset + *len + 1))
+    return false;
+
+  bus::Bus& bus = cpu.bus();
+  std::memcpy(bus.ram_write_ptr(*dst_offset, *len + 1), bus.m_ram.host_ptr() + *src_offset, *len + 1);
+
+  out_result = dst;
+  return true;
+}
+
+// A(2Ah) memcpy(dst, src, len)
+inline bool hle_memcpy(cpu::Cpu& cpu, u32& out_result) {
+  const address dst = cpu.gpr(4);
+  const address src = cpu.gpr(5);
+  const u32 len = cpu.gpr(6);
+  if (dst == 0 || src == 0 || static_cast<s32>(len) <= 0)
+    return false;
+
+  const auto dst_offset = ram_offset(dst, len);
+  const auto src_offset = ram_offset(src, len);
+  if (!dst_offset || !src_offset)
+    return false;
+
+  bus::Bus& bus = cpu.bus();
+  byte* d = bus.ram_write_ptr(*dst_offset, len);
+  const byte* s = bus.m_ram.host_ptr() + *src_offset;
+  if (*dst_offset > *src_offset && *dst_offset < *src_offset + len) {
+    // Copying forwards into an overlapping tail repeats the start of src, like the BIOS does
+    for (u32 i = 0; i < len; ++i)
+      d[i] = s[i];
+  } else {
+    std::memmove(d, s, len);
+  }
+
+  out_result = dst;
+  return true;
+}
+
+// A(2Bh) memset(dst, fillbyte, len)
+inline bool hle_memset(cpu::Cpu& cpu, u32& out_result) {
+  const address dst = cpu.gpr(4);
+  const u8 fill = cpu.gpr(5);
+  const u32 len = cpu.gpr(6);
+  if (dst == 0 || static_cast<s32>(len) <= 0)
+    return false;
+
+  const auto dst_offset = ram_offset(dst, len);
+  if (!dst_offset)
+    return false;
+
+  std::memset(cpu.bus().ram_write_ptr(*dst_offset, len), fill, len);
+
+  out_result = dst;
+  return true;
+}
+
+// A(28h) bzero(dst, len)
+inline bool hle_bzero(cpu::Cpu& cpu, u32& out_result) {
+  const address dst = cpu.gpr(4);
+  const u32 len = cpu.gpr(5);
+  if (dst == 0 || static_cast<s32>(len) <= 0)
+    return false;
+
+  const auto dst_offset = ram_offset(dst, len);
+  if (!dst_offset)
+    return false;
+
+  std::memset(cpu.bus().ram_write_ptr(*dst_offset, len), 0, len);
+
+  out_result = dst;
+  return true;
+}
+
+}  // namespace bios
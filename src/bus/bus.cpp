@@ -5,41 +5,70 @@
 #include <io/cdrom_drive.hpp>
 #include <io/joypad.hpp>
 #include <io/timers.hpp>
+#include <mdec/mdec.hpp>
 #include <memory/dma.hpp>
 #include <memory/expansion.hpp>
 #include <memory/map.hpp>
 #include <memory/ram.hpp>
 #include <spu/spu.hpp>
 #include <util/log.hpp>
+#include <util/profiler.hpp>
+
+#include <gsl-lite.hpp>
 
 namespace bus {
 
-// TODO: refactor IO reads/writes
+// Memory (RAM and its mirrors, BIOS and expansion 1) is accessed through the page tables. Whatever isn't
+// mapped there is either the scratchpad, an I/O port, dispatched to its device through m_io_devices, or
+// a RAM page holding cached code (writes only).
+
+inline byte* Bus::scratchpad_ptr(address addr) const {
+  const address offset = addr - memory::map::SCRATCHPAD.start();
+  return offset < memory::SCRATCHPAD_SIZE ? m_scratchpad.host_ptr() + offset : nullptr;
+}
 
 u32 Bus::read32(u32 addr) const {
   addr = memory::mask_region(addr) & 0x1FFFFFFC;
+  BUS_COUNT_ACCESS(addr, Read32);
 
+  if (const byte* host = read_ptr(addr))
+    return *(const u32*)host;
+  if (const byte* host = scratchpad_ptr(addr))
+    return *(const u32*)host;
+
+  PROFILE_SCOPE(BusIo);
   address addr_rebased;
 
-  if (memory::map::RAM.contains(addr, addr_rebased))
-    return m_ram.read<u32>(addr_rebased);
-  if (memory::map::SCRATCHPAD.contains(addr, addr_rebased))
-    return m_scratchpad.read<u32>(addr_rebased);
-  if (memory::map::IRQ_CONTROL.contains(addr, addr_rebased)) {
-    auto val = m_interrupts.read<u32>(addr_rebased);
-    LOG_TRACE("{} 32-bit read of 0x{:08X}", addr_rebased == 0 ? "I_STAT" : "I_MASK", val);
-    return val;
+  switch (io_device(addr)) {
+    case IoDevice::IrqControl:
+      if (memory::map::IRQ_CONTROL.contains(addr, addr_rebased)) {
+        auto val = m_interrupts.read<u32>(addr_rebased);
+        LOG_TRACE("{} 32-bit read of 0x{:08X}", addr_rebased == 0 ? "I_STAT" : "I_MASK", val);
+        return val;
+      }
+      break;
+    case IoDevice::Dma:
+      if (memory::map::DMA.contains(addr, addr_rebased))
+        return m_dma.read<u32>(addr_rebased);
+      break;
+    case IoDevice::Gpu:
+      if (memory::map::GPU.contains(addr, addr_rebased))
+        return m_gpu.read_reg(addr_rebased);
+      break;
+    case IoDevice::Mdec:
+      if (memory::map::MDEC.contains(addr, addr_rebased))
+        return m_mdec.read_reg(addr_rebased);
+      break;
+    case IoDevice::Timers:
+      if (memory::map::TIMERS.contains(addr, addr_rebased))
+        return static_cast<u32>(m_timers.read_reg(addr_rebased));
+      break;
+    case IoDevice::Spu:
+      if (memory::map::SPU.contains(addr, addr_rebased))  // Two halfword registers at once
+        return m_spu.read_reg(addr_rebased) | static_cast<u32>(m_spu.read_reg(addr_rebased + 2)) << 16;
+      break;
+    default: break;
   }
-  if (memory::map::BIOS.contains(addr, addr_rebased))
-    return m_bios.read<u32>(addr_rebased);
-  if (memory::map::DMA.contains(addr, addr_rebased))
-    return m_dma.read<u32>(addr_rebased);
-  if (memory::map::GPU.contains(addr, addr_rebased))
-    return m_gpu.read_reg(addr_rebased);
-  if (memory::map::TIMERS.contains(addr, addr_rebased))
-    return static_cast<u32>(m_timers.read_reg(addr_rebased));
-  if (memory::map::EXPANSION_1.contains(addr, addr_rebased))
-    return m_expansion.read<u32>(addr_rebased);
 
   LOG_ERROR("Unknown 32-bit read at 0x{:08X}", addr);
   //assert(0);
@@ -48,38 +77,47 @@ u32 Bus::read32(u32 addr) const {
 
 u16 Bus::read16(u32 addr) const {
   addr = memory::mask_region(addr) & 0x1FFFFFFE;
+  BUS_COUNT_ACCESS(addr, Read16);
+
+  if (const byte* host = read_ptr(addr))
+    return *(const u16*)host;
+  if (const byte* host = scratchpad_ptr(addr))
+    return *(const u16*)host;
 
+  PROFILE_SCOPE(BusIo);
   address addr_rebased;
 
-  if (memory::map::RAM.contains(addr, addr_rebased))
-    return m_ram.read<u16>(addr_rebased);
-  if (memory::map::SCRATCHPAD.contains(addr, addr_rebased))
-    return m_scratchpad.read<u16>(addr_rebased);
-  if (memory::map::SPU.contains(addr, addr_rebased)) {
-    // NOTE: TRACE level because it's used a lot in BIOS init.
-    LOG_TRACE("Stubbed 16-bit read of SPU register at 0x{:08X}", addr);
-    return m_spu.read<u16>(addr_rebased);
-  }
-  if (memory::map::IRQ_CONTROL.contains(addr, addr_rebased)) {
-    auto val = m_interrupts.read<u16>(addr_rebased);
-    LOG_TRACE("{} 16-bit read of 0x{:04X}", addr_rebased == 0 ? "I_STAT" : "I_MASK", val);
-    return val;
-  }
-  if (memory::map::JOYPAD.contains(addr, addr_rebased)) {
-    auto val = (u16)m_joypad.read8(addr_rebased) | (u16)m_joypad.read8(addr_rebased + 1) << 8;
-    LOG_TRACE_JOYPAD("{} 16-bit read of 0x{:04X}", io::Joypad::addr_to_reg_name(addr_rebased), val);
-    return val;
+  switch (io_device(addr)) {
+    case IoDevice::Spu:
+      if (memory::map::SPU.contains(addr, addr_rebased))
+        return m_spu.read_reg(addr_rebased);
+      break;
+    case IoDevice::IrqControl:
+      if (memory::map::IRQ_CONTROL.contains(addr, addr_rebased)) {
+        auto val = m_interrupts.read<u16>(addr_rebased);
+        LOG_TRACE("{} 16-bit read of 0x{:04X}", addr_rebased == 0 ? "I_STAT" : "I_MASK", val);
+        return val;
+      }
+      break;
+    case IoDevice::Joypad:
+      if (memory::map::JOYPAD.contains(addr, addr_rebased)) {
+        auto val = (u16)m_joypad.read8(addr_rebased) | (u16)m_joypad.read8(addr_rebased + 1) << 8;
+        LOG_TRACE_JOYPAD("{} 16-bit read of 0x{:04X}", io::Joypad::addr_to_reg_name(addr_rebased), val);
+        return val;
+      }
+      break;
+    case IoDevice::Sio:
+      if (memory::map::SIO.contains(addr, addr_rebased)) {
+        LOG_WARN("Unhandled 16-bit read of SIO register at 0x{:04X}", addr);
+        return 0;
+      }
+      break;
+    case IoDevice::Timers:
+      if (memory::map::TIMERS.contains(addr, addr_rebased))
+        return m_timers.read_reg(addr_rebased);
+      break;
+    default: break;
   }
-  if (memory::map::EXPANSION_1.contains(addr, addr_rebased))
-    return m_expansion.read<u16>(addr_rebased);
-  if (memory::map::SIO.contains(addr, addr_rebased)) {
-    LOG_WARN("Unhandled 16-bit read of SIO register at 0x{:04X}", addr);
-    return 0;
-  }
-  if (memory::map::BIOS.contains(addr, addr_rebased))
-    return m_bios.read<u16>(addr_rebased);
-  if (memory::map::TIMERS.contains(addr, addr_rebased))
-    return m_timers.read_reg(addr_rebased);
 
   LOG_ERROR("Unknown 16-bit read at 0x{:08X}", addr);
   assert(0);
@@ -94,33 +132,45 @@ u8 Bus::read8(u32 addr) const {
    */
 
   addr = memory::mask_region(addr);
+  BUS_COUNT_ACCESS(addr, Read8);
 
+  if (const byte* host = read_ptr(addr))
+    return *host;
+  if (const byte* host = scratchpad_ptr(addr))
+    return *host;
+
+  PROFILE_SCOPE(BusIo);
   address addr_rebased;
 
-  if (memory::map::RAM.contains(addr, addr_rebased))
-    return m_ram.read<u8>(addr_rebased);
-  if (memory::map::SCRATCHPAD.contains(addr, addr_rebased))
-    return m_scratchpad.read<u8>(addr_rebased);
-  if (memory::map::BIOS.contains(addr, addr_rebased))
-    return m_bios.read<u8>(addr_rebased);
-  if (memory::map::JOYPAD.contains(addr, addr_rebased)) {
-    auto val = m_joypad.read8(addr_rebased);
-    LOG_TRACE_JOYPAD("{} 8-bit read of 0x{:02X}", io::Joypad::addr_to_reg_name(addr_rebased), val);
-    return val;
-  }
-  if (memory::map::EXPANSION_1.contains(addr, addr_rebased))
-    return m_expansion.read<u8>(addr_rebased);
-  if (memory::map::EXPANSION_2.contains(addr, addr_rebased)) {
-    LOG_WARN("Unhandled 8-bit read of EXPANSION_2 register at 0x{:08X}", addr);
-    return 0;
-  }
-  if (memory::map::CDROM.contains(addr, addr_rebased))
-    return m_cdrom.read_reg(addr_rebased);
-  if (memory::map::DMA.contains(addr, addr_rebased))
-    return m_dma.read<u8>(addr_rebased);
-  if (memory::map::SIO.contains(addr, addr_rebased)) {
-    LOG_WARN("Unhandled 8-bit read of SIO register at 0x{:08X}", addr);
-    return 0;
+  switch (io_device(addr)) {
+    case IoDevice::Joypad:
+      if (memory::map::JOYPAD.contains(addr, addr_rebased)) {
+        auto val = m_joypad.read8(addr_rebased);
+        LOG_TRACE_JOYPAD("{} 8-bit read of 0x{:02X}", io::Joypad::addr_to_reg_name(addr_rebased), val);
+        return val;
+      }
+      break;
+    case IoDevice::Expansion2:
+      if (memory::map::EXPANSION_2.contains(addr, addr_rebased)) {
+        LOG_WARN("Unhandled 8-bit read of EXPANSION_2 register at 0x{:08X}", addr);
+        return 0;
+      }
+      break;
+    case IoDevice::Cdrom:
+      if (memory::map::CDROM.contains(addr, addr_rebased))
+        return m_cdrom.read_reg(addr_rebased);
+      break;
+    case IoDevice::Dma:
+      if (memory::map::DMA.contains(addr, addr_rebased))
+        return m_dma.read<u8>(addr_rebased);
+      break;
+    case IoDevice::Sio:
+      if (memory::map::SIO.contains(addr, addr_rebased)) {
+        LOG_WARN("Unhandled 8-bit read of SIO register at 0x{:08X}", addr);
+        return 0;
+      }
+      break;
+    default: break;
   }
 
   LOG_ERROR("Unknown 8-bit read at 0x{:08X} ", addr);
@@ -132,61 +182,93 @@ u8 Bus::read8(u32 addr) const {
 
 void Bus::write32(u32 addr, u32 val) {
   addr = memory::mask_region(addr) & 0x1FFFFFFC;
+  BUS_COUNT_ACCESS(addr, Write32);
 
-  address addr_rebased;
-
-  if (memory::map::RAM.contains(addr, addr_rebased))
-    return m_ram.write<u32>(addr_rebased, val);
-  if (memory::map::SCRATCHPAD.contains(addr, addr_rebased))
-    return m_scratchpad.write<u32>(addr_rebased, val);
-  if (memory::map::SPU.contains(addr, addr_rebased)) {
-    LOG_WARN("Stubbed 32-bit write to SPU register: 0x{:08X} at 0x{:08X}", val, addr);
-    return m_spu.write<u32>(addr_rebased, val);
+  if (byte* host = write_ptr(addr)) {
+    *(u32*)host = val;
+    mark_ram_written(addr);
+    return;
   }
-  if (memory::map::IRQ_CONTROL.contains(addr, addr_rebased)) {
-    LOG_TRACE("{} 32-bit write of 0x{:08X}", addr_rebased == 0 ? "I_STAT" : "I_MASK", val);
-    return m_interrupts.write<u32>(addr_rebased, val);
+  if (byte* host = scratchpad_ptr(addr)) {
+    *(u32*)host = val;
+    return;
   }
-  if (memory::map::MEM_CONTROL1.contains(addr, addr_rebased)) {
-    switch (addr_rebased) {
-      case 0x0:
-        if (val != 0x1F000000)
-          LOG_CRITICAL("Unhandled EXPANSION_1 base address: 0x{:08X}", val);
-        return;
-      case 0x4:
-        if (val != 0x1F802000)
-          LOG_CRITICAL("Unhandled EXPANSION_2 base address: 0x{:08X}", val);
+
+  PROFILE_SCOPE(BusIo);
+  address addr_rebased;
+
+  switch (io_device(addr)) {
+    case IoDevice::Spu:
+      if (memory::map::SPU.contains(addr, addr_rebased)) {
+        // Two halfword registers at once
+        m_spu.write_reg(addr_rebased, static_cast<u16>(val));
+        m_spu.write_reg(addr_rebased + 2, static_cast<u16>(val >> 16));
         return;
-      case 0x8:   // Expansion 1 Delay/Size
-      case 0xC:   // Expansion 3 Delay/Size
-      case 0x10:  // BIOS ROM Delay/Size
-      case 0x14:  // SPU_DELAY Delay/Size
-      case 0x18:  // CDROM_DELAY Delay/Size
-      case 0x1C:  // Expansion 2 Delay/Size
-      case 0x20:  // COM_DELAY
-        if (val != 0)
-          LOG_DEBUG("Unhandled non-0 32-bit write to MEM_CONTROL1: 0x{:08X} at 0x{:08X}", val, addr);
-        return;//constexpr auto GAME_PATH = "data/exe/re3.bin";
-
-      default:
-        LOG_DEBUG("Unhandled 32-bit write to MEM_CONTROL1: 0x{:08X} at 0x{:08X}", val, addr);
+      }
+      break;
+    case IoDevice::IrqControl:
+      if (memory::map::IRQ_CONTROL.contains(addr, addr_rebased)) {
+        LOG_TRACE("{} 32-bit write of 0x{:08X}", addr_rebased == 0 ? "I_STAT" : "I_MASK", val);
+        return m_interrupts.write<u32>(addr_rebased, val);
+      }
+      break;
+    case IoDevice::MemControl1:
+      if (memory::map::MEM_CONTROL1.contains(addr, addr_rebased)) {
+        switch (addr_rebased) {
+          case 0x0:
+            if (val != 0x1F000000)
+              LOG_CRITICAL("Unhandled EXPANSION_1 base address: 0x{:08X}", val);
+            return;
+          case 0x4:
+            if (val != 0x1F802000)
+              LOG_CRITICAL("Unhandled EXPANSION_2 base address: 0x{:08X}", val);
+            return;
+          case 0x8:   // Expansion 1 Delay/Size
+          case 0xC:   // Expansion 3 Delay/Size
+          case 0x10:  // BIOS ROM Delay/Size
+          case 0x14:  // SPU_DELAY Delay/Size
+          case 0x18:  // CDROM_DELAY Delay/Size
+          case 0x1C:  // Expansion 2 Delay/Size
+          case 0x20:  // COM_DELAY
+            if (val != 0)
+              LOG_DEBUG("Unhandled non-0 32-bit write to MEM_CONTROL1: 0x{:08X} at 0x{:08X}", val, addr);
+            return;  //constexpr auto GAME_PATH = "data/exe/re3.bin";
+
+          default:
+            LOG_DEBUG("Unhandled 32-bit write to MEM_CONTROL1: 0x{:08X} at 0x{:08X}", val, addr);
+            return;
+        }
+      }
+      break;
+    case IoDevice::MemControl2:
+      if (memory::map::MEM_CONTROL2.contains(addr, addr_rebased)) {
+        return;  // RAM_SIZE, ignore
+      }
+      break;
+    case IoDevice::Dma:
+      if (memory::map::DMA.contains(addr, addr_rebased))
+        return m_dma.write<u32>(addr_rebased, val);
+      break;
+    case IoDevice::Gpu:
+      if (memory::map::GPU.contains(addr, addr_rebased))
+        return m_gpu.write_reg(addr_rebased, val);
+      break;
+    case IoDevice::Mdec:
+      if (memory::map::MDEC.contains(addr, addr_rebased))
+        return m_mdec.write_reg(addr_rebased, val);
+      break;
+    case IoDevice::Timers:
+      if (memory::map::TIMERS.contains(addr, addr_rebased)) {
+        m_timers.write_reg(addr_rebased, static_cast<u16>(val));
         return;
-    }
-  }
-  if (memory::map::MEM_CONTROL2.contains(addr, addr_rebased)) {
-    return;  // RAM_SIZE, ignore
+      }
+      break;
+    default: break;
   }
+
   if (memory::map::MEM_CONTROL3.contains(addr, addr_rebased)) {
     return;  // Cache Control, ignore
   }
-  if (memory::map::DMA.contains(addr, addr_rebased))
-    return m_dma.write<u32>(addr_rebased, val);
-  if (memory::map::GPU.contains(addr, addr_rebased))
-    return m_gpu.write_reg(addr_rebased, val);
-  if (memory::map::TIMERS.contains(addr, addr_rebased)) {
-    m_timers.write_reg(addr_rebased, static_cast<u16>(val));
-    return;
-  }
 
   LOG_ERROR("Unknown 32-bit write of 0x{:08X} at 0x{:08X} ", val, addr);
   //assert(0);
@@ -194,35 +276,53 @@ void Bus::write32(u32 addr, u32 val) {
 
 void Bus::write16(u32 addr, u16 val) {
   addr = memory::mask_region(addr) & 0x1FFFFFFE;
+  BUS_COUNT_ACCESS(addr, Write16);
 
-  address addr_rebased;
-
-  if (memory::map::RAM.contains(addr, addr_rebased))
-    return m_ram.write<u16>(addr_rebased, val);
-  if (memory::map::SCRATCHPAD.contains(addr, addr_rebased))
-    return m_scratchpad.write<u16>(addr_rebased, val);
-  if (memory::map::TIMERS.contains(addr, addr_rebased)) {
-    m_timers.write_reg(addr_rebased, val);
+  if (byte* host = write_ptr(addr)) {
+    *(u16*)host = val;
+    mark_ram_written(addr);
     return;
   }
-  if (memory::map::SPU.contains(addr, addr_rebased)) {
-    // NOTE: TRACE level because it's used a lot in BIOS init.
-    LOG_TRACE("Stubbed 16-bit write to SPU register: 0x{:04X} at 0x{:08X}", val, addr);
-    return m_spu.write<u16>(addr_rebased, val);
-  }
-  if (memory::map::IRQ_CONTROL.contains(addr, addr_rebased)) {
-    LOG_TRACE("{} 16-bit write of 0x{:04X}", addr_rebased == 0 ? "I_STAT" : "I_MASK", val);
-    return m_interrupts.write<u16>(addr_rebased, val);
-  }
-  if (memory::map::JOYPAD.contains(addr, addr_rebased)) {
-    LOG_TRACE_JOYPAD("16-bit write of {:04X} to {}", val, io::Joypad::addr_to_reg_name(addr_rebased));
-    m_joypad.write8(addr_rebased, val & 0xFF);
-    m_joypad.write8(addr_rebased + 1, (val >> 8) & 0xFF);
+  if (byte* host = scratchpad_ptr(addr)) {
+    *(u16*)host = val;
     return;
   }
-  if (memory::map::SIO.contains(addr, addr_rebased)) {
-    LOG_WARN("Unhandled 16-bit write to SIO register: 0x{:04X} at 0x{:08X}", val, addr);
-    return;
+
+  PROFILE_SCOPE(BusIo);
+  address addr_rebased;
+
+  switch (io_device(addr)) {
+    case IoDevice::Timers:
+      if (memory::map::TIMERS.contains(addr, addr_rebased)) {
+        m_timers.write_reg(addr_rebased, val);
+        return;
+      }
+      break;
+    case IoDevice::Spu:
+      if (memory::map::SPU.contains(addr, addr_rebased))
+        return m_spu.write_reg(addr_rebased, val);
+      break;
+    case IoDevice::IrqControl:
+      if (memory::map::IRQ_CONTROL.contains(addr, addr_rebased)) {
+        LOG_TRACE("{} 16-bit write of 0x{:04X}", addr_rebased == 0 ? "I_STAT" : "I_MASK", val);
+        return m_interrupts.write<u16>(addr_rebased, val);
+      }
+      break;
+    case IoDevice::Joypad:
+      if (memory::map::JOYPAD.contains(addr, addr_rebased)) {
+        LOG_TRACE_JOYPAD("16-bit write of {:04X} to {}", val, io::Joypad::addr_to_reg_name(addr_rebased));
+        m_joypad.write8(addr_rebased, val & 0xFF);
+        m_joypad.write8(addr_rebased + 1, (val >> 8) & 0xFF);
+        return;
+      }
+      break;
+    case IoDevice::Sio:
+      if (memory::map::SIO.contains(addr, addr_rebased)) {
+        LOG_WARN("Unhandled 16-bit write to SIO register: 0x{:04X} at 0x{:08X}", val, addr);
+        return;
+      }
+      break;
+    default: break;
   }
 
   LOG_ERROR("Unknown 16-bit write of 0x{:04X} at 0x{:08X} ", val, addr);
@@ -231,31 +331,171 @@ void Bus::write16(u32 addr, u16 val) {
 
 void Bus::write8(u32 addr, u8 val) {
   addr = memory::mask_region(addr);
+  BUS_COUNT_ACCESS(addr, Write8);
 
-  address addr_rebased;
-
-  if (memory::map::RAM.contains(addr, addr_rebased))
-    return m_ram.write<u8>(addr_rebased, val);
-  if (memory::map::SCRATCHPAD.contains(addr, addr_rebased))
-    return m_scratchpad.write<u8>(addr_rebased, val);
-  if (memory::map::JOYPAD.contains(addr, addr_rebased)) {
-    LOG_TRACE_JOYPAD("8-bit write of {:02X} to {}", val, io::Joypad::addr_to_reg_name(addr_rebased));
-    m_joypad.write8(addr_rebased, val);
+  if (byte* host = write_ptr(addr)) {
+    *host = val;
+    mark_ram_written(addr);
     return;
   }
-  if (memory::map::EXPANSION_2.contains(addr, addr_rebased)) {
-    LOG_WARN("Unhandled 8-bit write to EXPANSION_2 register: 0x{:02X} at 0x{:08X}", val, addr);
+  if (byte* host = scratchpad_ptr(addr)) {
+    *host = val;
     return;
   }
-  if (memory::map::CDROM.contains(addr, addr_rebased)) {
-    m_cdrom.write_reg(addr_rebased, val);
-    return;
+
+  PROFILE_SCOPE(BusIo);
+  address addr_rebased;
+
+  switch (io_device(addr)) {
+    case IoDevice::Joypad:
+      if (memory::map::JOYPAD.contains(addr, addr_rebased)) {
+        LOG_TRACE_JOYPAD("8-bit write of {:02X} to {}", val, io::Joypad::addr_to_reg_name(addr_rebased));
+        m_joypad.write8(addr_rebased, val);
+        return;
+      }
+      break;
+    case IoDevice::Expansion2:
+      if (memory::map::EXPANSION_2.contains(addr, addr_rebased)) {
+        LOG_WARN("Unhandled 8-bit write to EXPANSION_2 register: 0x{:02X} at 0x{:08X}", val, addr);
+        return;
+      }
+      break;
+    case IoDevice::Cdrom:
+      if (memory::map::CDROM.contains(addr, addr_rebased)) {
+        m_cdrom.write_reg(addr_rebased, val);
+        return;
+      }
+      break;
+    case IoDevice::Dma:
+      if (memory::map::DMA.contains(addr, addr_rebased))
+        return m_dma.write<u8>(addr_rebased, val);
+      break;
+    default: break;
   }
-  if (memory::map::DMA.contains(addr, addr_rebased))
-    return m_dma.write<u8>(addr_rebased, val);
 
   LOG_ERROR("Unknown 8-bit write of 0x{:02X} at 0x{:08X} ", val, addr);
   assert(0);
 }
 
+void Bus::mark_ram_written(address addr) {
+  static_assert(memory::map::RAM_MIRRORS.start() == 0);
+  if (addr < memory::map::RAM_MIRRORS.size())
+    m_ram.mark_written(addr & (memory::RAM_SIZE - 1));
+}
+
+byte* Bus::ram_write_ptr(address ram_addr, u32 size) {
+  Expects(size <= memory::RAM_SIZE && ram_addr <= memory::RAM_SIZE - size);
+
+  if (size > 0)
+    m_ram.mark_written(ram_addr, size);
+  return m_ram.host_ptr() + ram_addr;
+}
+
+const char* bus_region_name(BusRegion region) {
+  switch (region) {
+    case BusRegion::Ram: return "RAM";
+    case BusRegion::Scratchpad: return "Scratchpad";
+    case BusRegion::Bios: return "BIOS";
+    case BusRegion::Expansion1: return "Expansion 1";
+    case BusRegion::MemControl: return "Mem Control";
+    case BusRegion::Joypad: return "Joypad";
+    case BusRegion::Sio: return "SIO";
+    case BusRegion::IrqControl: return "IRQ Control";
+    case BusRegion::Dma: return "DMA";
+    case BusRegion::Timers: return "Timers";
+    case BusRegion::Cdrom: return "CD-ROM";
+    case BusRegion::Gpu: return "GPU";
+    case BusRegion::Mdec: return "MDEC";
+    case BusRegion::Spu: return "SPU";
+    case BusRegion::Expansion2: return "Expansion 2";
+    case BusRegion::Unmapped: return "Unmapped";
+    default: return "Unknown";
+  }
+}
+
+const char* bus_access_name(BusAccess access) {
+  switch (access) {
+    case BusAccess::Read8: return "read8";
+    case BusAccess::Read16: return "read16";
+    case BusAccess::Read32: return "read32";
+    case BusAccess::Write8: return "write8";
+    case BusAccess::Write16: return "write16";
+    case BusAccess::Write32: return "write32";
+    default: return "unknown";
+  }
+}
+
+BusRegion Bus::region(address addr) const {
+  address addr_rebased;
+  if (memory::map::RAM_MIRRORS.contains(addr, addr_rebased))
+    return BusRegion::Ram;
+  if (memory::map::SCRATCHPAD.contains(addr, addr_rebased))
+    return BusRegion::Scratchpad;
+  if (memory::map::BIOS.contains(addr, addr_rebased))
+    return BusRegion::Bios;
+  if (memory::map::EXPANSION_1.contains(addr, addr_rebased))
+    return BusRegion::Expansion1;
+  if (memory::map::MEM_CONTROL3.contains(addr, addr_rebased))
+    return BusRegion::MemControl;
+
+  switch (io_device(addr)) {
+    case IoDevice::MemControl1:
+    case IoDevice::MemControl2: return BusRegion::MemControl;
+    case IoDevice::Joypad: return BusRegion::Joypad;
+    case IoDevice::Sio: return BusRegion::Sio;
+    case IoDevice::IrqControl: return BusRegion::IrqControl;
+    case IoDevice::Dma: return BusRegion::Dma;
+    case IoDevice::Timers: return BusRegion::Timers;
+    case IoDevice::Cdrom: return BusRegion::Cdrom;
+    case IoDevice::Gpu: return BusRegion::Gpu;
+    case IoDevice::Mdec: return BusRegion::Mdec;
+    case IoDevice::Spu: return BusRegion::Spu;
+    case IoDevice::Expansion2: return BusRegion::Expansion2;
+    default: return BusRegion::Unmapped;
+  }
+}
+
+void Bus::init_page_tables() {
+  m_read_pages.assign(FASTMEM_PAGE_COUNT, nullptr);
+  m_write_pages.assign(FASTMEM_PAGE_COUNT, nullptr);
+
+  for (address mirror = 0; mirror < memory::map::RAM_MIRRORS.size(); mirror += memory::RAM_SIZE)
+    map_pages(memory::map::RAM_MIRRORS.start() + mirror, memory::RAM_SIZE, m_ram.host_ptr(),
+              m_ram.host_ptr());
+  map_pages(memory::map::BIOS.start(), memory::BIOS_SIZE, m_bios.host_ptr(), nullptr);
+  map_pages(memory::map::EXPANSION_1.start(), memory::EXPANSION_1_SIZE, m_expansion.host_ptr(), nullptr);
+
+  const struct {
+    memory::Range range;
+    IoDevice device;
+  } io_ranges[] = {
+    { memory::map::MEM_CONTROL1, IoDevice::MemControl1 },
+    { memory::map::MEM_CONTROL2, IoDevice::MemControl2 },
+    { memory::map::JOYPAD, IoDevice::Joypad },
+    { memory::map::SIO, IoDevice::Sio },
+    { memory::map::IRQ_CONTROL, IoDevice::IrqControl },
+    { memory::map::DMA, IoDevice::Dma },
+    { memory::map::TIMERS, IoDevice::Timers },
+    { memory::map::CDROM, IoDevice::Cdrom },
+    { memory::map::GPU, IoDevice::Gpu },
+    { memory::map::MDEC, IoDevice::Mdec },
+    { memory::map::SPU, IoDevice::Spu },
+    { memory::map::EXPANSION_2, IoDevice::Expansion2 },
+  };
+
+  for (const auto& io_range : io_ranges) {
+    const auto start = io_range.range.start();
+    for (address addr = start; addr < start + io_range.range.size(); addr += 1 << IO_SLOT_SHIFT)
+      m_io_devices[(addr - IO_BASE) >> IO_SLOT_SHIFT] = io_range.device;
+  }
+}
+
+void Bus::map_pages(address start, u32 size, const byte* read_host, byte* write_host) {
+  for (u32 offset = 0; offset < size; offset += memory::BUS_PAGE_SIZE) {
+    const auto page = (start + offset) >> memory::BUS_PAGE_SHIFT;
+    m_read_pages[page] = read_host != nullptr ? read_host + offset : nullptr;
+    m_write_pages[page] = write_host != nullptr ? write_host + offset : nullptr;
+  }
+}
+
 }  // namespace bus
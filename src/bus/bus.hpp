@@ -1,7 +1,14 @@
 #pragma once
 
+#include <memory/map.hpp>
 #include <util/types.hpp>
 
+#include <array>
+#include <vector>
+
+// Counts the accesses to each memory region by width, BUS_COUNT_ACCESS() compiles to nothing without it
+#define BUS_STATS_ENABLED false
+
 namespace bios {
 class Bios;
 }
@@ -21,6 +28,10 @@ namespace gpu {
 class Gpu;
 }
 
+namespace mdec {
+class Mdec;
+}
+
 namespace spu {
 class Spu;
 }
@@ -33,6 +44,77 @@ class Timers;
 
 namespace bus {
 
+// Page tables cover the physical address space up to here, anything above goes through the slow path
+constexpr u32 FASTMEM_LIMIT = 0x20000000;
+constexpr u32 FASTMEM_PAGE_COUNT = FASTMEM_LIMIT >> memory::BUS_PAGE_SHIFT;
+
+// I/O ports are dispatched through a table with one entry per 16 bytes
+constexpr address IO_BASE = 0x1F801000;
+constexpr u32 IO_SIZE = 0x2000;
+constexpr u32 IO_SLOT_SHIFT = 4;
+
+enum class IoDevice : u8 {
+  None,
+  MemControl1,
+  MemControl2,
+  Joypad,
+  Sio,
+  IrqControl,
+  Dma,
+  Timers,
+  Cdrom,
+  Gpu,
+  Mdec,
+  Spu,
+  Expansion2,
+};
+
+// Regions of the memory map (see memory/map.hpp) the accesses are counted by
+enum class BusRegion : u8 {
+  Ram,  // Its mirrors included
+  Scratchpad,
+  Bios,
+  Expansion1,
+  MemControl,  // MEM_CONTROL1 to 3
+  Joypad,
+  Sio,
+  IrqControl,
+  Dma,
+  Timers,
+  Cdrom,
+  Gpu,
+  Mdec,
+  Spu,
+  Expansion2,
+  Unmapped,
+
+  Count,
+};
+
+enum class BusAccess : u8 {
+  Read8,
+  Read16,
+  Read32,
+  Write8,
+  Write16,
+  Write32,
+
+  Count,
+};
+
+constexpr u32 BUS_REGION_COUNT = (u32)BusRegion::Count;
+constexpr u32 BUS_ACCESS_COUNT = (u32)BusAccess::Count;
+
+const char* bus_region_name(BusRegion region);
+const char* bus_access_name(BusAccess access);
+
+// Accesses since power on, all 0 without BUS_STATS_ENABLED
+struct BusStats {
+  std::array<std::array<u64, BUS_ACCESS_COUNT>, BUS_REGION_COUNT> accesses{};
+
+  u64 count(BusRegion region, BusAccess access) const { return accesses[(u32)region][(u32)access]; }
+};
+
 class Bus {
  public:
   explicit Bus(bios::Bios const& bios,
@@ -42,6 +124,7 @@ class Bus {
                memory::Ram& ram,
                memory::Dma& dma,
                gpu::Gpu& gpu,
+               mdec::Mdec& mdec,
                spu::Spu& spu,
                io::Joypad& joypad,
                io::CdromDrive& cdrom,
@@ -54,10 +137,13 @@ class Bus {
         m_bios(bios),
         m_dma(dma),
         m_gpu(gpu),
+        m_mdec(mdec),
         m_spu(spu),
         m_joypad(joypad),
         m_cdrom(cdrom),
-        m_timers(timers) {}
+        m_timers(timers) {
+    init_page_tables();
+  }
 
   u32 read32(u32 addr) const;
   u16 read16(u32 addr) const;
@@ -66,15 +152,59 @@ class Bus {
   void write16(u32 addr, u16 val);
   void write8(u32 addr, u8 val);
 
+  // Host pointer to the RAM range [ram_addr, ram_addr + size), for bulk writes that bypass the bus (e.g.
+  // HLE BIOS functions). The range is marked written up front, just like guest writes to it would.
+  byte* ram_write_ptr(address ram_addr, u32 size);
+
+  const BusStats& stats() const { return m_stats; }
+  io::CdromDrive& cdrom() const { return m_cdrom; }
+
   cpu::Interrupts& m_interrupts;
   memory::Ram& m_ram;
 
  private:
+  void init_page_tables();
+  void map_pages(address start, u32 size, const byte* read_host, byte* write_host);
+  // Directly mapped writes only reach RAM (at any of its mirrors, which start at 0)
+  void mark_ram_written(address addr);
+
+  // Host pointer for a physical address, nullptr if its page isn't directly mapped
+  const byte* read_ptr(address addr) const {
+    if (addr >= FASTMEM_LIMIT)
+      return nullptr;
+    const byte* page = m_read_pages[addr >> memory::BUS_PAGE_SHIFT];
+    return page != nullptr ? page + (addr & (memory::BUS_PAGE_SIZE - 1)) : nullptr;
+  }
+  byte* write_ptr(address addr) const {
+    if (addr >= FASTMEM_LIMIT)
+      return nullptr;
+    byte* page = m_write_pages[addr >> memory::BUS_PAGE_SHIFT];
+    return page != nullptr ? page + (addr & (memory::BUS_PAGE_SIZE - 1)) : nullptr;
+  }
+  // The scratchpad only fills the first SCRATCHPAD_SIZE bytes of its page, which is left out of the
+  // page tables for the rest of it to go to the unmapped handlers
+  byte* scratchpad_ptr(address addr) const;
+  IoDevice io_device(address addr) const {
+    const address io_offset = addr - IO_BASE;
+    return io_offset < IO_SIZE ? m_io_devices[io_offset >> IO_SLOT_SHIFT] : IoDevice::None;
+  }
+  // Of a physical address, only looked up to count accesses
+  BusRegion region(address addr) const;
+  void count_access(address addr, BusAccess access) const {
+    ++m_stats.accesses[(u32)region(addr)][(u32)access];
+  }
+
+  std::vector<const byte*> m_read_pages;
+  std::vector<byte*> m_write_pages;
+  std::array<IoDevice, (IO_SIZE >> IO_SLOT_SHIFT)> m_io_devices{};
+  mutable BusStats m_stats;  // Reads count too
+
   memory::Expansion& m_expansion;
   memory::Scratchpad& m_scratchpad;
   bios::Bios const& m_bios;
   memory::Dma& m_dma;
   gpu::Gpu& m_gpu;
+  mdec::Mdec& m_mdec;
   spu::Spu& m_spu;
   io::Joypad& m_joypad;
   io::CdromDrive& m_cdrom;
@@ -82,3 +212,9 @@ class Bus {
 };
 
 }  // namespace bus
+
+#if BUS_STATS_ENABLED
+#define BUS_COUNT_ACCESS(addr, access) count_access(addr, bus::BusAccess::access)
+#else
+#define BUS_COUNT_ACCESS(addr, access) ((void)0)
+#endif
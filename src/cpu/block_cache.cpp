@@ -0,0 +1,267 @@
+#include <cpu/block_cache.hpp>
+
+#include <bus/bus.hpp>
+#include <cpu/delay_analysis.hpp>
+#include <cpu/idle_loop.hpp>
+#include <cpu/opcode.hpp>
+#include <memory/ram.hpp>
+#include <util/log.hpp>
+
+#include <algorithm>
+
+namespace cpu {
+
+namespace {
+
+// Decodes the block starting at phys_addr, of at most max_length instructions whose words read_word
+// returns. Where the block is from is left to the caller.
+template <typename ReadWord>
+std::unique_ptr<BasicBlock> decode(address phys_addr, u32 max_length, ReadWord read_word) {
+  auto block = std::make_unique<BasicBlock>();
+  block->start = phys_addr;
+  block->instructions.reserve(max_length);
+
+  bool is_delay_slot = false;
+  for (u32 index = 0; index < max_length; ++index) {
+    const auto& instr = block->instructions.emplace_back(read_word(index));
+
+    if (is_delay_slot)
+      break;
+
+    bool ends_block = false;
+    switch (instr.opcode()) {
+      case Opcode::J:
+      case Opcode::JR:
+      case Opcode::JAL:
+      case Opcode::JALR:
+      case Opcode::BEQ:
+      case Opcode::BNE:
+      case Opcode::BGTZ:
+      case Opcode::BLEZ:
+      case Opcode::BCONDZ: is_delay_slot = true; break;
+      case Opcode::SYSCALL:
+      case Opcode::BREAK:
+      case Opcode::RFE:
+      case Opcode::INVALID: ends_block = true; break;
+      default: break;
+    }
+    if (ends_block)
+      break;
+  }
+
+  block->instructions.shrink_to_fit();
+  analyze_delays(*block);
+  block->idle_loop = is_idle_loop(*block) ? IdleLoopState::Idle : IdleLoopState::NotIdle;
+  return block;
+}
+
+}  // namespace
+
+SharedBlocks::SharedBlocks()
+    : m_slots(std::make_unique<std::atomic<const BasicBlock*>[]>(memory::BIOS_SIZE / 4)) {}
+
+SharedBlocks::~SharedBlocks() {
+  for (u32 slot = 0; slot < memory::BIOS_SIZE / 4; ++slot)
+    delete m_slots[slot].load(std::memory_order_relaxed);
+}
+
+const BasicBlock* SharedBlocks::publish(u32 slot, std::unique_ptr<BasicBlock> block) {
+  const BasicBlock* published = nullptr;
+  if (!m_slots[slot].compare_exchange_strong(published, block.get(), std::memory_order_acq_rel))
+    return published;  // Decoded from the same code, block is dropped
+  return block.release();
+}
+
+BlockCache::BlockCache(bus::Bus& bus, std::shared_ptr<SharedBlocks> bios_blocks)
+    : m_ram_blocks(memory::RAM_SIZE / 4),
+      m_bios_blocks(std::move(bios_blocks)),
+      m_bus(bus) {}
+
+BlockCache::~BlockCache() {
+  if (m_prepare_thread.joinable())
+    m_prepare_thread.join();
+}
+
+const Instruction* BlockCache::fetch(address pc, u8& out_delay_tracking) {
+  if (pc % 4 != 0)
+    return nullptr;  // Let the caller raise the exception
+
+  const address phys_addr = memory::mask_region(pc);
+
+  // Fast path: we're still running sequentially inside the current block
+  if (m_cur_block != nullptr && phys_addr == m_cur_addr) {
+    const auto idx = (phys_addr - m_cur_block->start) / 4;
+    if (idx < m_cur_block->instructions.size() && !is_stale(*m_cur_block)) {
+      m_cur_addr += 4;
+      out_delay_tracking = m_cur_block->delay_tracking[idx];
+      return &m_cur_block->instructions[idx];
+    }
+  }
+
+  m_cur_block = lookup(phys_addr);
+  if (m_cur_block == nullptr)
+    return nullptr;
+
+  m_cur_addr = phys_addr + 4;
+  out_delay_tracking = m_cur_block->delay_tracking[0];
+  return &m_cur_block->instructions[0];
+}
+
+const BasicBlock* BlockCache::lookup_block(address pc) {
+  if (pc % 4 != 0)
+    return nullptr;
+  return lookup(memory::mask_region(pc));
+}
+
+const u8*& BlockCache::native_code(const BasicBlock& block) {
+  // RAM blocks are owned by this cache
+  if (block.in_ram)
+    return const_cast<BasicBlock&>(block).native_code;
+
+  if (m_bios_native_code.empty())
+    m_bios_native_code.assign(memory::BIOS_SIZE / 4, nullptr);
+  return m_bios_native_code[(block.start - memory::map::BIOS.start()) / 4];
+}
+
+void BlockCache::clear() {
+  for (auto& block : m_ram_blocks)
+    block.reset();
+  std::fill(m_bios_native_code.begin(), m_bios_native_code.end(), nullptr);
+  m_cur_block = nullptr;
+}
+
+const BasicBlock* BlockCache::lookup(address phys_addr) {
+  address addr_rebased;
+  if (memory::map::BIOS.contains(phys_addr, addr_rebased)) {
+    const u32 slot = addr_rebased / 4;
+    if (const BasicBlock* block = m_bios_blocks->find(slot))
+      return block;
+    return m_bios_blocks->publish(slot, decode_block(phys_addr));
+  }
+
+  if (!memory::map::RAM.contains(phys_addr, addr_rebased))
+    return nullptr;
+  std::unique_ptr<BasicBlock>* slot = &m_ram_blocks[addr_rebased / 4];
+
+  if (*slot == nullptr || is_stale(**slot)) {
+    if (slot->get() == m_cur_block)
+      m_cur_block = nullptr;
+    std::unique_ptr<BasicBlock> prepared = *slot == nullptr ? take_prepared(phys_addr) : nullptr;
+    *slot = prepared != nullptr ? std::move(prepared) : decode_block(phys_addr);
+  }
+
+  return slot->get();
+}
+
+std::unique_ptr<BasicBlock> BlockCache::decode_block(address phys_addr) const {
+  // Blocks never cross a RAM page, so that a single dirty page covers all of their instructions
+  const address page_end = (phys_addr & ~(memory::RAM_PAGE_SIZE - 1)) + memory::RAM_PAGE_SIZE;
+  const u32 max_length = std::min((page_end - phys_addr) / 4, MAX_BASIC_BLOCK_LENGTH);
+
+  auto block =
+      decode(phys_addr, max_length, [&](u32 index) { return m_bus.read32(phys_addr + index * 4); });
+
+  address addr_rebased;
+  block->in_ram = memory::map::RAM.contains(phys_addr, addr_rebased);
+  if (block->in_ram)
+    block->ram_cursor = m_bus.m_ram.dirty_pages().cursor();
+  return block;
+}
+
+std::unique_ptr<BasicBlock> BlockCache::take_prepared(address phys_addr) {
+  if (!m_is_prepared.load(std::memory_order_acquire))
+    return nullptr;
+  const auto it = m_prepared.find(phys_addr);
+  if (it == m_prepared.end())
+    return nullptr;
+  PreparedBlock prepared = std::move(it->second);
+  m_prepared.erase(it);
+
+  // Pages are hashed again only once written to
+  auto& dirty_pages = m_bus.m_ram.dirty_pages();
+  const u32 page = phys_addr / memory::RAM_PAGE_SIZE;
+  PageHash& page_hash = m_page_hashes[page];
+  if (!page_hash.is_valid || dirty_pages.is_dirty(page_hash.cursor, page)) {
+    page_hash.cursor = dirty_pages.cursor();
+    page_hash.hash = hash_ram_page(m_bus.m_ram.data() + page * memory::RAM_PAGE_SIZE);
+    page_hash.is_valid = true;
+  }
+  if (page_hash.hash != prepared.page_hash)
+    return nullptr;
+
+  prepared.block->in_ram = true;
+  prepared.block->ram_cursor = dirty_pages.cursor();
+  return std::move(prepared.block);
+}
+
+void BlockCache::prepare(BlockProfile profile) {
+  if (m_prepare_thread.joinable())
+    return;
+
+  m_page_hashes.resize(memory::RAM_PAGE_COUNT);
+  m_prepare_thread = std::thread([this, profile = std::move(profile)]() {
+    std::unordered_map<address, PreparedBlock> prepared;
+    u32 bios_block_count = 0;
+    for (size_t i = 0; i < profile.block_count(); ++i) {
+      const ProfiledBlock& profiled = profile.block(i);
+      const u32* words = profile.words(profiled);
+      auto block = decode(profiled.start, std::min(profiled.word_count, MAX_BASIC_BLOCK_LENGTH),
+                          [&](u32 index) { return words[index]; });
+
+      address addr_rebased;
+      if (memory::map::BIOS.contains(profiled.start, addr_rebased)) {
+        // The profile is of this BIOS, so its blocks can be shared right away
+        const u32 slot = addr_rebased / 4;
+        if (m_bios_blocks->find(slot) == nullptr) {
+          m_bios_blocks->publish(slot, std::move(block));
+          ++bios_block_count;
+        }
+      } else if (memory::map::RAM.contains(profiled.start, addr_rebased)) {
+        prepared[profiled.start] = { std::move(block), profiled.page_hash };
+      }
+    }
+
+    LOG_DEBUG("Prepared {} BIOS and {} RAM blocks", bios_block_count, prepared.size());
+    m_prepared = std::move(prepared);
+    m_is_prepared.store(true, std::memory_order_release);
+  });
+}
+
+BlockProfile BlockCache::profile() const {
+  BlockProfile profile;
+  std::vector<u32> words;
+  const auto add = [&](const BasicBlock& block, u64 page_hash) {
+    words.clear();
+    for (const auto& instr : block.instructions)
+      words.push_back(instr.word());
+    profile.add(block.start, page_hash, words.data(), (u32)words.size());
+  };
+
+  for (u32 slot = 0; slot < memory::BIOS_SIZE / 4; ++slot)
+    if (const BasicBlock* block = m_bios_blocks->find(slot))
+      add(*block, 0);
+
+  // Blocks are in order, so each page is hashed once
+  const byte* ram = m_bus.m_ram.data();
+  u32 hashed_page = memory::RAM_PAGE_COUNT;
+  u64 page_hash = 0;
+  for (const auto& block : m_ram_blocks) {
+    if (block == nullptr || is_stale(*block))
+      continue;
+    const u32 page = block->start / memory::RAM_PAGE_SIZE;
+    if (page != hashed_page) {
+      page_hash = hash_ram_page(ram + page * memory::RAM_PAGE_SIZE);
+      hashed_page = page;
+    }
+    add(*block, page_hash);
+  }
+  return profile;
+}
+
+bool BlockCache::is_stale(const BasicBlock& block) const {
+  // RAM is mapped at physical address 0, so the block start is also its offset in RAM
+  return block.in_ram &&
+         m_bus.m_ram.dirty_pages().is_dirty(block.ram_cursor, block.start / memory::RAM_PAGE_SIZE);
+}
+
+}  // namespace cpu
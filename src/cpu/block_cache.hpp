@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cpu/block_profile.hpp>
+#include <cpu/instruction.hpp>
+#include <memory/map.hpp>
+#include <memory/ram.hpp>
+#include <util/types.hpp>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace bus {
+class Bus;
+}
+
+namespace cpu {
+
+constexpr u32 MAX_BASIC_BLOCK_LENGTH = 64;  // In instructions
+
+enum class IdleLoopState : u8 {
+  Idle,  // The block is a side-effect free loop branching back to its start
+  NotIdle,
+};
+
+// A run of pre-decoded instructions, ending after a branch delay slot, an exception-raising instruction
+// or at a RAM page boundary. Never changes once decoded, BIOS blocks are shared between emulators.
+struct BasicBlock {
+  address start{};          // Physical address of the first instruction
+  bool in_ram{};            // BIOS blocks never get stale
+  memory::RamDirtyPages::Cursor ram_cursor;  // Stale once its RAM page is written to past this
+  std::vector<Instruction> instructions;
+  std::vector<u8> delay_tracking;  // DelayTracking mask per instruction (see cpu/delay_analysis.hpp)
+  IdleLoopState idle_loop{ IdleLoopState::NotIdle };
+  const u8* native_code{};  // Filled in by the recompiler for RAM blocks, see BlockCache::native_code()
+};
+
+// Decoded blocks of the BIOS, shared by the block caches of every emulator running the same BIOS image
+// (see bios::BiosImage). The BIOS is read-only, so its blocks never get stale. Slots are filled in by
+// whichever thread decodes a block first, lookups take no lock.
+class SharedBlocks {
+ public:
+  SharedBlocks();
+  SharedBlocks(const SharedBlocks&) = delete;
+  SharedBlocks& operator=(const SharedBlocks&) = delete;
+  ~SharedBlocks();
+
+  // nullptr until decoded, slot is the block's offset in the BIOS, in words
+  const BasicBlock* find(u32 slot) const { return m_slots[slot].load(std::memory_order_acquire); }
+  // Keeps block unless another thread published one first, returns the block that's kept
+  const BasicBlock* publish(u32 slot, std::unique_ptr<BasicBlock> block);
+
+ private:
+  std::unique_ptr<std::atomic<const BasicBlock*>[]> m_slots;
+};
+
+// Cache of decoded basic blocks, keyed by physical PC. Only code in RAM and BIOS is cached, anything
+// else has to be fetched and decoded by the caller.
+class BlockCache {
+ public:
+  // bios_blocks must belong to the BIOS image the bus maps
+  BlockCache(bus::Bus& bus, std::shared_ptr<SharedBlocks> bios_blocks);
+  ~BlockCache();
+
+  // Returns the decoded instruction at pc, or nullptr if pc can't be served from the cache. Also returns
+  // the DelayTracking the instruction needs.
+  const Instruction* fetch(address pc, u8& out_delay_tracking);
+  // Returns the up to date block starting at pc, decoding it if needed. nullptr if pc isn't cacheable.
+  const BasicBlock* lookup_block(address pc);
+  bool is_stale(const BasicBlock& block) const;
+  // Generated code of a block of this cache, held by the block itself in RAM. Shared BIOS blocks are run
+  // by the recompilers of several emulators, each keeps its own code for them here.
+  const u8*& native_code(const BasicBlock& block);
+  // Drops the RAM blocks and the generated code, the shared BIOS blocks stay decoded
+  void clear();
+
+  // Decodes the blocks of a profile of an earlier run on a background thread, once only. BIOS blocks are
+  // shared as soon as they're decoded. RAM blocks are taken by the first lookup of their PC, if their
+  // page still hashes the same, and decoded from RAM as usual otherwise.
+  void prepare(BlockProfile profile);
+  // The blocks decoded and up to date, for a later run to prepare
+  BlockProfile profile() const;
+
+ private:
+  struct PreparedBlock {
+    std::unique_ptr<BasicBlock> block;
+    u64 page_hash;
+  };
+  // Last hash of a RAM page, taken by the lookups of prepared blocks
+  struct PageHash {
+    memory::RamDirtyPages::Cursor cursor;  // Stale once the page is written to past this
+    u64 hash{};
+    bool is_valid{};
+  };
+
+  const BasicBlock* lookup(address phys_addr);
+  std::unique_ptr<BasicBlock> decode_block(address phys_addr) const;
+  // The prepared block starting at phys_addr in RAM if its code is still there
+  std::unique_ptr<BasicBlock> take_prepared(address phys_addr);
+
+  // One slot per word, indexed by the offset of the block's first instruction
+  std::vector<std::unique_ptr<BasicBlock>> m_ram_blocks;
+  std::shared_ptr<SharedBlocks> m_bios_blocks;
+  std::vector<const u8*> m_bios_native_code;  // Allocated on the first compiled BIOS block
+
+  // Block we're currently executing, so that sequential fetches skip the lookup
+  const BasicBlock* m_cur_block{};
+  address m_cur_addr{};  // Physical address we expect the next sequential fetch at
+
+  // Left to the prepare thread until m_is_prepared, then to the lookups
+  std::thread m_prepare_thread;
+  std::atomic<bool> m_is_prepared{};
+  std::unordered_map<address, PreparedBlock> m_prepared;  // By physical PC
+  std::vector<PageHash> m_page_hashes;                    // One per RAM page, once prepared
+
+  bus::Bus& m_bus;
+};
+
+}  // namespace cpu
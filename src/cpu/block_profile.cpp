@@ -0,0 +1,120 @@
+#include <cpu/block_profile.hpp>
+
+#include <memory/ram.hpp>
+#include <util/log.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <system_error>
+#include <thread>
+
+namespace cpu {
+
+namespace {
+
+constexpr u32 PROFILE_MAGIC = 0x42544350;  // "PCTB"
+
+constexpr u64 FNV_OFFSET_BASIS = 0xCBF29CE484222325;
+constexpr u64 FNV_PRIME = 0x100000001B3;
+
+}  // namespace
+
+void BlockProfile::add(address start, u64 page_hash, const u32* words, u32 word_count) {
+  m_blocks.push_back({ start, (u32)m_words.size(), word_count, 0, page_hash });
+  m_words.insert(m_words.end(), words, words + word_count);
+}
+
+bool BlockProfile::save(const fs::path& path) const {
+  // Unique to this thread, as emulators of a farm can save the same profile
+  fs::path temp_path = path;
+  temp_path += fmt::format(".{:x}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+
+  {
+    std::ofstream file(temp_path, std::ios::binary);
+    if (!file) {
+      LOG_ERROR("Could not create block profile {}", temp_path.string());
+      return false;
+    }
+
+    const BlockProfileHeader header{ PROFILE_MAGIC, BLOCK_PROFILE_VERSION, (u32)m_blocks.size(),
+                                     (u32)m_words.size() };
+    file.write((const char*)&header, sizeof(header));
+    file.write((const char*)m_blocks.data(), m_blocks.size() * sizeof(ProfiledBlock));
+    file.write((const char*)m_words.data(), m_words.size() * sizeof(u32));
+    if (!file) {
+      LOG_ERROR("Could not write block profile {}", temp_path.string());
+      return false;
+    }
+  }
+
+  std::error_code error;
+  fs::rename(temp_path, path, error);
+  if (error) {
+    LOG_ERROR("Could not replace block profile {}: {}", path.string(), error.message());
+    return false;
+  }
+
+  LOG_INFO("Wrote a profile of {} blocks to {}", m_blocks.size(), path.string());
+  return true;
+}
+
+bool BlockProfile::load(const fs::path& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    LOG_ERROR("Could not open block profile {}", path.string());
+    return false;
+  }
+
+  BlockProfileHeader header{};
+  file.read((char*)&header, sizeof(header));
+  if (!file || header.magic != PROFILE_MAGIC || header.version != BLOCK_PROFILE_VERSION) {
+    LOG_ERROR("{} is not a block profile of version {}", path.string(), BLOCK_PROFILE_VERSION);
+    return false;
+  }
+
+  std::vector<ProfiledBlock> blocks(header.block_count);
+  std::vector<u32> words(header.word_count);
+  file.read((char*)blocks.data(), blocks.size() * sizeof(ProfiledBlock));
+  file.read((char*)words.data(), words.size() * sizeof(u32));
+  if (!file) {
+    LOG_ERROR("Block profile {} is truncated", path.string());
+    return false;
+  }
+  for (const auto& block : blocks) {
+    if ((u64)block.first_word + block.word_count > words.size()) {
+      LOG_ERROR("Block profile {} is corrupt", path.string());
+      return false;
+    }
+  }
+
+  m_blocks = std::move(blocks);
+  m_words = std::move(words);
+  LOG_INFO("Loaded a profile of {} blocks from {}", m_blocks.size(), path.string());
+  return true;
+}
+
+u64 hash_ram_page(const byte* page) {
+  u64 hash = FNV_OFFSET_BASIS;
+  for (u32 offset = 0; offset < memory::RAM_PAGE_SIZE; offset += 4) {
+    u32 word;
+    std::memcpy(&word, page + offset, sizeof(word));
+    hash = (hash ^ word) * FNV_PRIME;
+  }
+  return hash;
+}
+
+u64 hash_bytes(const byte* data, size_t size) {
+  u64 hash = FNV_OFFSET_BASIS;
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ data[i]) * FNV_PRIME;
+  return hash;
+}
+
+fs::path block_profile_path(const fs::path& dir, const buffer& bios, const buffer& exe) {
+  const u64 bios_hash = hash_bytes(bios.data(), bios.size());
+  const u64 exe_hash = hash_bytes(exe.data(), exe.size());
+  return dir / fmt::format("{:016X}-{:016X}.blocks", bios_hash, exe_hash);
+}
+
+}  // namespace cpu
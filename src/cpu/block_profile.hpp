@@ -0,0 +1,62 @@
+#pragma once
+
+#include <util/fs.hpp>
+#include <util/types.hpp>
+
+#include <vector>
+
+namespace cpu {
+
+// Bumped with any change to the layout of profile files, or to how blocks are cut (see BlockCache)
+constexpr u32 BLOCK_PROFILE_VERSION = 1;
+
+// A block of a profile, its instruction words are the profile's words from first_word on
+struct ProfiledBlock {
+  address start;  // Physical
+  u32 first_word;
+  u32 word_count;
+  u32 reserved;
+  u64 page_hash;  // Of its RAM page when profiled (see hash_ram_page()), 0 in the BIOS
+};
+static_assert(sizeof(ProfiledBlock) == 24);
+
+// File layout, in host order: this header, then block_count ProfiledBlocks, then word_count words
+struct BlockProfileHeader {
+  u32 magic;
+  u32 version;
+  u32 block_count;
+  u32 word_count;
+};
+static_assert(sizeof(BlockProfileHeader) == 16);
+
+// The code a run went through, for the next run of the same BIOS and title to decode ahead of time
+// rather than as it first reaches each block (see BlockCache::prepare()). RAM blocks keep the hash of
+// their page, so that they're only used over the very code they were decoded from.
+class BlockProfile {
+ public:
+  void add(address start, u64 page_hash, const u32* words, u32 word_count);
+
+  size_t block_count() const { return m_blocks.size(); }
+  const ProfiledBlock& block(size_t index) const { return m_blocks[index]; }
+  const u32* words(const ProfiledBlock& block) const { return m_words.data() + block.first_word; }
+
+  // Written next to path first and moved over it, so that emulators saving the same profile at once
+  // never leave a torn one
+  bool save(const fs::path& path) const;
+  // Leaves the profile as it was if path doesn't hold one
+  bool load(const fs::path& path);
+
+ private:
+  std::vector<ProfiledBlock> m_blocks;
+  std::vector<u32> m_words;
+};
+
+// FNV-1a, a word at a time, of a RAM page as the cache of decoded blocks sees it
+u64 hash_ram_page(const byte* page);
+// FNV-1a of data, to tell BIOS images and titles apart
+u64 hash_bytes(const byte* data, size_t size);
+
+// Where in dir the profile of a BIOS and title (its boot executable) goes, exe is empty without one
+fs::path block_profile_path(const fs::path& dir, const buffer& bios, const buffer& exe);
+
+}  // namespace cpu
@@ -2,12 +2,22 @@
 
 #include <bios/functions.hpp>
 #include <bus/bus.hpp>
+#include <cpu/cpu_trace.hpp>
+#include <cpu/delay_analysis.hpp>
+#include <cpu/disassembler.hpp>
+#include <cpu/idle_loop.hpp>
 #include <cpu/instruction.hpp>
 #include <cpu/interrupt.hpp>
 #include <cpu/opcode.hpp>
+#include <cpu/recompiler.hpp>
+#include <emulator/scheduler.hpp>
 #include <emulator/settings.hpp>
+#include <io/cdrom_drive.hpp>
+#include <memory/map.hpp>
 #include <memory/ram.hpp>
 #include <util/log.hpp>
+#include <util/profiler.hpp>
+#include <util/state_stream.hpp>
 
 #include <climits>
 #include <cstdio>
@@ -18,53 +28,202 @@
 #define TRACE_DISASM 1
 #define TRACE_REGS 2
 #define TRACE_PC_ONLY 3
+#define TRACE_BINARY 4  // Ring of CpuTraceRecord in CPU_TRACE_PATH, see cpu/cpu_trace.hpp
 
-#define TRACE_MODE TRACE_NONE
+// Format of the CPU trace, when enabled with Settings::log_trace_cpu
+#define TRACE_MODE TRACE_BINARY
 
+// Read back with pctation_cpu_trace (see src/main/cpu_trace.cpp)
+constexpr const char* CPU_TRACE_PATH = "pctation_cpu.trace";
+
+// Whether to arm the exe hook (see StepFeature) on startup regardless of Settings::fast_boot
 #define LOAD_EXE_HOOK 0
 
+// How execute_instruction hands decoded instructions to their per-opcode handler
+#define CPU_DISPATCH_SWITCH 0  // A switch over the opcode
+#define CPU_DISPATCH_TABLE 1   // An array of handlers indexed by opcode
+#define CPU_DISPATCH_GOTO 2    // Computed goto (GCC/Clang only, falls back to the switch otherwise)
+
+#define CPU_DISPATCH_MODE CPU_DISPATCH_SWITCH
+
+#if CPU_DISPATCH_MODE == CPU_DISPATCH_GOTO && !defined(__GNUC__)
+#undef CPU_DISPATCH_MODE
+#define CPU_DISPATCH_MODE CPU_DISPATCH_SWITCH
+#endif
+
 namespace cpu {
 
-Cpu::Cpu(bus::Bus& bus, const emulator::Settings& settings)
+Cpu::Cpu(bus::Bus& bus,
+         const emulator::Settings& settings,
+         emulator::Scheduler& scheduler,
+         std::shared_ptr<SharedBlocks> bios_blocks)
     : m_bus(bus),
       m_gte(*this),
-      m_settings(settings) {}
-
-void Cpu::step(u32 cycles_to_execute) {
-  for (u32 cycle = 0; cycle < cycles_to_execute; cycle += APPROX_CYCLES_PER_INSTRUCTION) {
-#if LOAD_EXE_HOOK
-    // mid-boot hook to load an executable
-    if (m_pc == 0x80030000) {
-      memory::PSEXELoadInfo psxexe_load_info;
-      if (m_bus.m_ram.load_executable(psxexe_load_info)) {
-        set_pc(psxexe_load_info.pc);
-        m_gpr[28] = psxexe_load_info.r28;
-        m_gpr[29] = psxexe_load_info.r29_r30;
-        m_gpr[30] = psxexe_load_info.r29_r30;
+      m_block_cache(bus, std::move(bios_blocks)),
+      m_recompiler(*this, m_block_cache),
+      m_settings(settings),
+      m_scheduler(scheduler) {
+  m_load_exe_pending = true;
+  m_block_instruction_fn = &Cpu::execute_block_instruction<0>;
+}
+
+void Cpu::serialize(util::StateStream& s) {
+  s.section("CPU ");
+  s.value(m_gpr);
+  s.value(m_pc_current);
+  s.value(m_pc);
+  s.value(m_pc_next);
+  s.value(m_hi);
+  s.value(m_lo);
+
+  s.value(m_cop0_bpc);
+  s.value(m_cop0_bda);
+  s.value(m_cop0_jumpdest);
+  s.value(m_cop0_dcic);
+  s.value(m_cop0_bad_vaddr);
+  s.value(m_cop0_bdam);
+  s.value(m_cop0_bpcm);
+  s.value(m_cop0_status);
+  s.value(m_cop0_cause);
+  s.value(m_cop0_epc);
+
+  s.value(m_slot_current);
+  s.value(m_slot_next);
+
+  s.value(m_branch_taken);
+  s.value(m_branch_taken_saved);
+  s.value(m_in_branch_delay_slot);
+  s.value(m_in_branch_delay_slot_saved);
+  s.value(m_was_branch_cycle);
+  s.value(m_in_idle_loop);
+  s.value(m_load_exe_pending);
+
+  // Cached blocks are staled by RAM being loaded (see memory::Ram::serialize()), the loop variant is
+  // picked again by the next step
+  m_uncached_instr.reset();
+  update_irq_line();
+
+  m_gte.serialize(s);
+}
+
+void Cpu::step() {
+  PROFILE_SCOPE(Cpu);
+
+  u32 features = 0;
+  if (m_settings.log_trace_cpu)
+    features |= StepTrace;
+  if (LOG_BIOS_CALLS && m_settings.log_bios_calls)
+    features |= StepBiosCalls;
+  if (m_load_exe_pending && (LOAD_EXE_HOOK || m_settings.fast_boot))
+    features |= StepExeHook;
+  if (m_settings.hle_bios)
+    features |= StepHleBios;
+
+  static constexpr std::array<void (Cpu::*)(), STEP_VARIANT_COUNT> step_variants = {
+    &Cpu::step_impl<0>,  &Cpu::step_impl<1>,  &Cpu::step_impl<2>,  &Cpu::step_impl<3>,
+    &Cpu::step_impl<4>,  &Cpu::step_impl<5>,  &Cpu::step_impl<6>,  &Cpu::step_impl<7>,
+    &Cpu::step_impl<8>,  &Cpu::step_impl<9>,  &Cpu::step_impl<10>, &Cpu::step_impl<11>,
+    &Cpu::step_impl<12>, &Cpu::step_impl<13>, &Cpu::step_impl<14>, &Cpu::step_impl<15>,
+  };
+  static constexpr std::array<BlockInstructionFunction, STEP_VARIANT_COUNT> block_variants = {
+    &Cpu::execute_block_instruction<0>,  &Cpu::execute_block_instruction<1>,
+    &Cpu::execute_block_instruction<2>,  &Cpu::execute_block_instruction<3>,
+    &Cpu::execute_block_instruction<4>,  &Cpu::execute_block_instruction<5>,
+    &Cpu::execute_block_instruction<6>,  &Cpu::execute_block_instruction<7>,
+    &Cpu::execute_block_instruction<8>,  &Cpu::execute_block_instruction<9>,
+    &Cpu::execute_block_instruction<10>, &Cpu::execute_block_instruction<11>,
+    &Cpu::execute_block_instruction<12>, &Cpu::execute_block_instruction<13>,
+    &Cpu::execute_block_instruction<14>, &Cpu::execute_block_instruction<15>,
+  };
+
+  if (features != m_step_features) {
+    // Compiled blocks have the instruction helper of the previous variant baked in
+    m_recompiler.flush();
+    m_step_features = features;
+    m_block_instruction_fn = block_variants[features];
+  }
+
+  if (m_settings.sample_guest_pc != m_is_sampling_pc) {
+    m_is_sampling_pc = m_settings.sample_guest_pc;
+    m_pc_sampler.clear();
+    m_next_pc_sample = m_is_sampling_pc ? m_instruction_count + PC_SAMPLE_INTERVAL : UINT64_MAX;
+  }
+
+#if TRACE_MODE == TRACE_BINARY
+  if (!(features & StepTrace)) {
+    m_trace.close();
+    m_trace_open_failed = false;
+  } else if (!m_trace.is_open() && !m_trace_open_failed) {
+    m_trace_open_failed = !m_trace.open(CPU_TRACE_PATH, CPU_TRACE_CAPACITY);
+  }
+#endif
+
+  (this->*step_variants[features])();
+}
+
+template <u32 Features>
+void Cpu::step_impl() {
+  const bool use_recompiler =
+      (m_settings.cpu_engine == emulator::CpuEngine::Recompiler) && m_recompiler.is_supported();
+
+  while (!m_scheduler.slice_done()) {
+    if constexpr (Features & StepExeHook) {
+      // mid-boot hook to load an executable
+      if (m_pc == 0x80030000) {
+        load_exe_hook();
+        // Let step() switch back to the variant without the hook
+        return;
       }
     }
-#endif
 
-#ifdef LOG_BIOS_CALLS
-    bool was_branch_cycle = m_branch_taken_saved;
-#endif
+    if constexpr (Features & StepHleBios) {
+      if (hle_bios_call((Features & StepBiosCalls) != 0))
+        continue;
+    }
 
-    // Store state for potential exceptions (and reset current state)
-    store_exception_state();
+    if (use_recompiler) {
+      const BasicBlock* block = m_block_cache.lookup_block(m_pc);
+      if (block != nullptr) {
+        // Cycles are accounted for by each instruction of the block
+        const auto executed_count = m_recompiler.execute(*block);
+        m_instruction_count += executed_count;
+        if (executed_count > 0) {
+          if (m_instruction_count >= m_next_pc_sample)
+            sample_pc();
+          if (m_in_idle_loop) {
+            m_in_idle_loop = false;
+            m_scheduler.end_slice();
+          }
+          continue;
+        }
+      }
+    }
+
+    m_scheduler.add_cycles(SYSTEM_CYCLES_PER_INSTRUCTION);
+    ++m_instruction_count;
 
-    // Check for interrupts and trigger an exception if any
-    // TODO: Delay by 1 cycle?
-    m_bus.m_interrupts.check_and_trigger();
+    // Fetch and decode current instruction, skipping both if it's in the block cache
+    const address fetch_pc = m_pc;
+    u8 delay_tracking = TrackAll;
+    const Instruction* cached_instr = m_block_cache.fetch(fetch_pc, delay_tracking);
 
-    // Fetch current instruction
-    u32 cur_instr;
-    if (!load32(m_pc, cur_instr)) {
-      LOG_CRITICAL("PC unaligned: {:08X}", m_pc);
-      continue;
+    begin_instruction<Features>(delay_tracking);
+
+    // An interrupt moved us to its handler
+    if (m_pc != fetch_pc) {
+      delay_tracking = TrackAll;
+      cached_instr = m_block_cache.fetch(m_pc, delay_tracking);
     }
 
-    // Decode current instruction
-    const Instruction instr(cur_instr);
+    if (cached_instr == nullptr) {
+      u32 cur_instr;
+      if (!load32(m_pc, cur_instr)) {
+        LOG_CRITICAL("PC unaligned: {:08X}", m_pc);
+        continue;
+      }
+      cached_instr = &m_uncached_instr.emplace(cur_instr);
+    }
+    const Instruction& instr = *cached_instr;
 
     // 1006862347 => 3c03800b => LUI, 2, 5, 0
     // m_pc_current=2148033372
@@ -75,52 +234,192 @@ void Cpu::step(u32 cycles_to_execute) {
     // addiu, 2, 5, 1
 
     if (instr.opcode() == Opcode::INVALID) {
-      LOG_CRITICAL("Invalid instruction {:02X}", cur_instr);
+      LOG_CRITICAL("Invalid instruction {:02X}", instr.word());
       trigger_exception(ExceptionCause::ReservedInstruction);
       return;
     }
 
-    if (m_settings.log_trace_cpu) {
+    run_instruction<Features>(instr, delay_tracking);
+    if (m_instruction_count >= m_next_pc_sample)
+      sample_pc();
+
+    // Nothing the loop does can change before the next event, so don't bother running it until then
+    if (m_in_idle_loop) {
+      m_in_idle_loop = false;
+      m_scheduler.end_slice();
+    }
+  }
+}
+
+template <u32 Features>
+void Cpu::begin_instruction(u8 delay_tracking) {
+  if constexpr (Features & StepBiosCalls)
+    m_was_branch_cycle = m_branch_taken_saved;
+
+  // Store state for potential exceptions (and reset current state)
+  if (delay_tracking & TrackBranchDelay)
+    store_exception_state();
+  else
+    m_pc_current = m_pc;  // The branch delay flags are clear and stay that way
+
+  // Take a pending interrupt, the line is only recomputed when SR, CAUSE, I_STAT or I_MASK change
+  // TODO: Delay by 1 cycle?
+  if (m_irq_asserted)
+    trigger_exception(ExceptionCause::Interrupt);
+}
+
+template <u32 Features>
+void Cpu::run_instruction(const Instruction& instr, u8 delay_tracking) {
+  [[maybe_unused]] const address pc = m_pc;
+  if constexpr (Features & StepTrace) {
 #if TRACE_MODE == TRACE_REGS  // Log all registers
-      char debug_str[512];
-      // This is ugly but much faster than a loop
-      // clang-format off
+    char debug_str[512];
+    // This is ugly but much faster than a loop
+    // clang-format off
     std::snprintf(debug_str, 512, "[%08X]: at:%X v0:%X v1:%X a0:%X a1:%X a2:%X a3:%X t0:%X t1:%X t2:%X t3:%X t4:%X t5:%X t6:%X t7:%X s0:%X s1:%X s2:%X s3:%X s4:%X s5:%X s6:%X s7:%X t8:%X t9:%X k0:%X k1:%X gp:%X ra:%X hi:%X lo:%X",
       m_pc, m_gpr[1], m_gpr[2], m_gpr[3], m_gpr[4], m_gpr[5], m_gpr[6], m_gpr[7], m_gpr[8], m_gpr[9], m_gpr[10], m_gpr[11], m_gpr[12], m_gpr[13], m_gpr[14], m_gpr[15], m_gpr[16], m_gpr[17], m_gpr[18], m_gpr[19], m_gpr[20], m_gpr[21], m_gpr[22], m_gpr[23], m_gpr[24], m_gpr[25], m_gpr[26], m_gpr[27], m_gpr[28], m_gpr[31], m_hi, m_lo);
-      // clang-format on
-      LOG_TRACE_CPU_NOFMT(debug_str);
+    // clang-format on
+    LOG_TRACE_CPU_NOFMT(debug_str);
 #elif TRACE_MODE == TRACE_DISASM   // Log instruction disassembly
-      LOG_TRACE_CPU("[{:08X}]: {:08X} {}", m_pc, cur_instr, instr.disassemble());
-      // In PC_ONLY mode we print the PC-4 for branch delay slot instructions (to match no$psx's output)
+    LOG_TRACE_CPU("[{:08X}]: {:08X} {}", m_pc, instr.word(), disassemble(instr));
+    // In PC_ONLY mode we print the PC-4 for branch delay slot instructions (to match no$psx's output)
 #elif TRACE_MODE == TRACE_PC_ONLY  // Log PC register only
-      LOG_TRACE_CPU("{:08X}", m_pc);
+    LOG_TRACE_CPU("{:08X}", m_pc);
 #endif
-    }
+  }
 
-    // Advance PC
-    set_pc(m_pc_next);
+  // Advance PC
+  set_pc(m_pc_next);
 
-    // Ensures(m_gpr[0] == 0);
-    // Execute instruction
-    execute_instruction(instr);
-    //  Ensures(m_gpr[0] == 0);
+  // Ensures(m_gpr[0] == 0);
+  // Execute instruction
+  execute_instruction(instr);
+  //  Ensures(m_gpr[0] == 0);
 
+  if (delay_tracking & TrackLoadDelay)
     do_pending_load();
 
-#ifdef LOG_BIOS_CALLS
-    if (was_branch_cycle) {
+  if (m_branch_taken && m_settings.skip_idle_loops)
+    m_in_idle_loop = is_idle_loop_branch(m_pc_current, m_pc_next);
+
+#if TRACE_MODE == TRACE_BINARY
+  if constexpr (Features & StepTrace) {
+    if (m_trace.is_open())
+      m_trace.record(pc, instr.word(), m_gpr, m_hi, m_lo);
+  }
+#endif
+
+  if constexpr (Features & StepBiosCalls) {
+    if (m_was_branch_cycle) {
       const auto masked_pc = m_pc_current & 0x1FFFFF;
 
       // If we jumped to a BIOS function
       if (masked_pc == 0xA0 || masked_pc == 0xB0 || masked_pc == 0xC0)
         on_bios_call(masked_pc);
     }
-#endif
   }
 }
 
-void Cpu::execute_instruction(const Instruction& i) {
-  switch (i.opcode()) {
+void Cpu::sample_pc() {
+  // Blocks may go past a few sampling points at once, they count as one
+  m_pc_sampler.add(memory::mask_region(m_pc_current));
+  m_next_pc_sample = m_instruction_count + PC_SAMPLE_INTERVAL;
+}
+
+void Cpu::load_exe_hook() {
+  // Only once per power on, the kernel is up and the shell is about to start
+  m_load_exe_pending = false;
+
+  // The executable given on the command line, or the one the disc boots, the BIOS goes on without either
+  memory::PSEXELoadInfo psxexe_load_info;
+  bool is_loaded = m_bus.m_ram.load_executable(psxexe_load_info);
+  buffer disc_exe;
+  if (!is_loaded && m_settings.fast_boot && m_bus.cdrom().read_boot_exe(disc_exe))
+    is_loaded = m_bus.m_ram.load_executable(disc_exe, psxexe_load_info);
+  if (!is_loaded)
+    return;
+
+  LOG_INFO("Fast booting the executable, entry point {:08X}", psxexe_load_info.pc);
+  set_pc(psxexe_load_info.pc);
+  m_gpr[28] = psxexe_load_info.r28;
+  m_gpr[29] = psxexe_load_info.r29_r30;
+  m_gpr[30] = psxexe_load_info.r29_r30;
+  m_block_cache.clear();
+}
+
+bool Cpu::hle_bios_call(bool log_call) {
+  const auto masked_pc = m_pc & 0x1FFFFF;
+  if (masked_pc != 0xA0 && masked_pc != 0xB0 && masked_pc != 0xC0)
+    return false;
+
+  // A load from the call's delay slot would only land during the first instruction of the function, keep
+  // it simple and let the BIOS deal with it
+  if (m_slot_current.is_valid())
+    return false;
+
+  const u8 func_number = gpr(9);
+  const bios::Function& function = bios::function_table(masked_pc)[func_number];
+  if (function.hle == nullptr || !bios::dispatches_to_rom(m_bus, masked_pc, func_number))
+    return false;
+
+  u32 result;
+  if (!function.hle(*this, result))
+    return false;
+
+  if (log_call)
+    on_bios_call(masked_pc);
+
+  m_scheduler.add_cycles(SYSTEM_CYCLES_PER_INSTRUCTION);
+
+  // Return to the caller
+  set_gpr(2, result);
+  set_pc(gpr(31));
+  return true;
+}
+
+bool Cpu::is_idle_loop_branch(address branch_addr, address target) {
+  // Only short backward branches can close an idle loop
+  if (target > branch_addr || branch_addr - target > (IDLE_LOOP_MAX_LENGTH - 2) * 4)
+    return false;
+
+  // The loop has to be exactly the block starting at the branch target, which ends after the delay slot
+  const BasicBlock* block = m_block_cache.lookup_block(target);
+  if (block == nullptr)
+    return false;
+  const address block_end = block->start + static_cast<u32>(block->instructions.size()) * 4;
+  if (block_end != memory::mask_region(branch_addr) + 8)
+    return false;
+  return block->idle_loop == IdleLoopState::Idle && has_side_effect_free_loads(*block, m_gpr);
+}
+
+template <u32 Features>
+u8 Cpu::execute_block_instruction(Cpu* cpu, const BasicBlock* block, u32 index) {
+  const address instr_addr = block->start + index * 4;
+
+  const u8 delay_tracking = block->delay_tracking[index];
+
+  cpu->begin_instruction<Features>(delay_tracking);
+
+  // An interrupt moved us away from the block
+  if (memory::mask_region(cpu->m_pc) != instr_addr)
+    return NotExecuted;
+
+  cpu->m_scheduler.add_cycles(SYSTEM_CYCLES_PER_INSTRUCTION);
+
+  cpu->run_instruction<Features>(block->instructions[index], delay_tracking);
+
+  // Keep going only while we're on the block's straight-line path, its code wasn't overwritten and no
+  // event is due
+  if (memory::mask_region(cpu->m_pc) != instr_addr + 4 || cpu->m_block_cache.is_stale(*block) ||
+      cpu->m_scheduler.slice_done())
+    return ExecutedAndExit;
+  return ExecutedAndContinue;
+}
+
+template <Opcode Op>
+void Cpu::execute_opcode(const Instruction& i) {
+  // Op is a constant, so this switch folds down to a single case in every instantiation
+  switch (Op) {
       // Arithmetic
     case Opcode::ADD: op_add(i); break;
     case Opcode::ADDU: set_rd(i, rs(i) + rt(i)); break;
@@ -221,8 +520,14 @@ void Cpu::execute_instruction(const Instruction& i) {
         case Cop0Register::COP0_DCIC: m_cop0_dcic = rt(i); break;
         case Cop0Register::COP0_BDAM: m_cop0_bdam = rt(i); goto unhandled_mtc;
         case Cop0Register::COP0_BPCM: m_cop0_bpcm = rt(i); goto unhandled_mtc;
-        case Cop0Register::COP0_SR: m_cop0_status.word = rt(i); break;
-        case Cop0Register::COP0_CAUSE: m_cop0_cause.word = rt(i); break;
+        case Cop0Register::COP0_SR:
+          m_cop0_status.word = rt(i);
+          update_irq_line();
+          break;
+        case Cop0Register::COP0_CAUSE:
+          m_cop0_cause.word = rt(i);
+          update_irq_line();
+          break;
         case Cop0Register::COP0_EPC:
           m_cop0_epc = rt(i);
           break;
@@ -264,25 +569,25 @@ void Cpu::execute_instruction(const Instruction& i) {
       // Co-processor 2 (Geometry Transformation Engine)
     case Opcode::MFC2: {
       auto val = m_gte.read_reg(i.rd());
-      LOG_TRACE_GTE("{:<23}      | val: 0x{:08X} | 0x{:08X} at 0x{:08X}", i.disassemble(), val, i.word(),
+      LOG_TRACE_GTE("{:<23}      | val: 0x{:08X} | 0x{:08X} at 0x{:08X}", disassemble(i), val, i.word(),
                     m_pc_current);
       issue_delayed_load(i.rt(), val);
       break;
     }
     case Opcode::CFC2: {
       const auto val = m_gte.read_reg(i.rd() + 32);  // Add 32 because it's a Control Register
-      LOG_TRACE_GTE("{:<23}      | val: 0x{:08X} | 0x{:08X} at 0x{:08X}", i.disassemble(), val, i.word(),
+      LOG_TRACE_GTE("{:<23}      | val: 0x{:08X} | 0x{:08X} at 0x{:08X}", disassemble(i), val, i.word(),
                     m_pc_current);
       issue_delayed_load(i.rt(), val);
       break;
     }
     case Opcode::MTC2:
-      LOG_TRACE_GTE("{:<23}      | val: 0x{:08X} | 0x{:08X} at 0x{:08X}", i.disassemble(), rt(i),
+      LOG_TRACE_GTE("{:<23}      | val: 0x{:08X} | 0x{:08X} at 0x{:08X}", disassemble(i), rt(i),
                     i.word(), m_pc_current);
       m_gte.write_reg(i.rd(), rt(i));
       break;
     case Opcode::CTC2:
-      LOG_TRACE_GTE("{:<23}      | val: 0x{:08X} | 0x{:08X} at 0x{:08X}", i.disassemble(), rt(i),
+      LOG_TRACE_GTE("{:<23}      | val: 0x{:08X} | 0x{:08X} at 0x{:08X}", disassemble(i), rt(i),
                     i.word(), m_pc_current);
       m_gte.write_reg(i.rd() + 32, rt(i));  // Add 32 because it's a Control Register
       break;
@@ -294,7 +599,7 @@ void Cpu::execute_instruction(const Instruction& i) {
 
       const auto val = m_bus.read32(addr);
 
-      LOG_TRACE_GTE("{:<23}    | val: 0x{:08X} | 0x{:08X} at 0x{:08X}", i.disassemble(), val, i.word(),
+      LOG_TRACE_GTE("{:<23}    | val: 0x{:08X} | 0x{:08X} at 0x{:08X}", disassemble(i), val, i.word(),
                     m_pc_current);
       m_gte.write_reg(dest_reg, val);
       break;
@@ -307,7 +612,7 @@ void Cpu::execute_instruction(const Instruction& i) {
 
       const auto val = m_gte.read_reg(dest_reg);
 
-      LOG_TRACE_GTE("{:<23}    | val: 0x{:08X} | 0x{:08X} at 0x{:08X}", i.disassemble(), val, i.word(),
+      LOG_TRACE_GTE("{:<23}    | val: 0x{:08X} | 0x{:08X} at 0x{:08X}", disassemble(i), val, i.word(),
                     m_pc_current);
       m_bus.write32(addr, val);
       break;
@@ -318,59 +623,78 @@ void Cpu::execute_instruction(const Instruction& i) {
     }
     default:
       LOG_WARN("Unimplemented instruction 0x{:08X} (op: {}) at 0x{:08X} executed, disasm: {}", i.word(),
-               opcode_to_str(i.opcode()), m_pc_current, i.disassemble());
+               opcode_to_str(i.opcode()), m_pc_current, disassemble(i));
       assert(0);
   }
 }
 
+void Cpu::execute_instruction(const Instruction& i) {
+#if CPU_DISPATCH_MODE == CPU_DISPATCH_TABLE
+  using OpcodeHandler = void (Cpu::*)(const Instruction&);
+  static constexpr OpcodeHandler handlers[] = {
+#define OPCODE(mnemonic, opcode, operand1, operand2, operand3) &Cpu::execute_opcode<Opcode::mnemonic>,
+#include <cpu/opcodes.def>
+#undef OPCODE
+    &Cpu::execute_opcode<Opcode::INVALID>,
+  };
+
+  (this->*handlers[static_cast<size_t>(i.opcode())])(i);
+#elif CPU_DISPATCH_MODE == CPU_DISPATCH_GOTO
+  static void* const labels[] = {
+#define OPCODE(mnemonic, opcode, operand1, operand2, operand3) &&op_##mnemonic,
+#include <cpu/opcodes.def>
+#undef OPCODE
+    &&op_INVALID,
+  };
+
+  goto* labels[static_cast<size_t>(i.opcode())];
+#define OPCODE(mnemonic, opcode, operand1, operand2, operand3) \
+  op_##mnemonic:                                               \
+  return execute_opcode<Opcode::mnemonic>(i);
+#include <cpu/opcodes.def>
+#undef OPCODE
+op_INVALID:
+  return execute_opcode<Opcode::INVALID>(i);
+#else
+  switch (i.opcode()) {
+#define OPCODE(mnemonic, opcode, operand1, operand2, operand3) \
+  case Opcode::mnemonic: return execute_opcode<Opcode::mnemonic>(i);
+#include <cpu/opcodes.def>
+#undef OPCODE
+    default: return execute_opcode<Opcode::INVALID>(i);
+  }
+#endif
+}
+
 void Cpu::on_bios_call(u32 masked_pc) {
-  std::unordered_map<uint8_t, bios::Function>::const_iterator function;
   const u8 func_number = gpr(9);
   const auto type = masked_pc >> 4;
-  bool is_known_func = false;
-  bool log_known_func = true;
-
-  if (masked_pc == 0xA0) {
-    if ((function = bios::A0.find(func_number)) != bios::A0.end()) {
-      is_known_func = true;
-      if (function->second.callback != nullptr)
-        log_known_func = function->second.callback(*this);
-    }
-  } else if (masked_pc == 0xB0) {
-    if ((function = bios::B0.find(func_number)) != bios::B0.end()) {
-      is_known_func = true;
-      if (function->second.callback != nullptr)
-        log_known_func = function->second.callback(*this);
-    }
-  } else {
-    if ((function = bios::C0.find(func_number)) != bios::C0.end()) {
-      is_known_func = true;
-      if (function->second.callback != nullptr)
-        log_known_func = function->second.callback(*this);
-    }
-  }
+  const bios::Function& function = bios::function_table(masked_pc)[func_number];
 
-  if (!is_known_func) {
-    m_bios_calls_log += fmt::format("[{:08X}] {:01X}({:02X})\n", gpr(31), type, func_number);
+  if (function.name == nullptr) {
+    m_bios_calls_log.append(fmt::format("[{:08X}] {:01X}({:02X})\n", gpr(31), type, func_number));
     return;
   }
 
-  if (log_known_func) {
-    const bios::Function func = function->second;
+  bool log_known_func = true;
+  if (function.callback != nullptr)
+    log_known_func = function.callback(*this);
 
-    const auto arg_count = func.args.size();
+  if (log_known_func) {
+    const auto arg_count = function.arg_count();
     // Arguments after the 4th are passed on the stack, unimplemented
     Ensures(arg_count <= 4);
 
     std::string log_text =
-        fmt::format("[{:08X}] {:01X}({:02X}): {}(", gpr(31), type, func_number, func.name);
+        fmt::format("[{:08X}] {:01X}({:02X}): {}(", gpr(31), type, func_number, function.name);
 
     for (auto i = 0; i < arg_count; ++i) {
-      log_text += fmt::format("{}=0x{:X}{}", func.args[i], gpr(4 + i), i == (arg_count - 1) ? "" : ", ");
+      log_text +=
+          fmt::format("{}=0x{:X}{}", function.args[i], gpr(4 + i), i == (arg_count - 1) ? "" : ", ");
     }
     log_text += ")\n";
 
-    m_bios_calls_log += log_text;
+    m_bios_calls_log.append(log_text);
   }
 }
 
@@ -429,10 +753,18 @@ void Cpu::trigger_exception(ExceptionCause cause) {
   if (cause == ExceptionCause::Breakpoint)
     m_cop0_dcic |= 1;
 
+  // Interrupts are disabled until the handler reenables them
+  update_irq_line();
+
   // Exceptions don't have a branch delay, jump directly to the handler
   set_pc(handler_addr);
 }
 
+void Cpu::update_irq_line() {
+  const bool are_active_interrupts = m_cop0_cause.interrupt_pending & m_cop0_status.interrupt_mask;
+  m_irq_asserted = m_cop0_status.interrupt_enable && are_active_interrupts;
+}
+
 void Cpu::trigger_load_exception(const address addr) {
   m_cop0_bad_vaddr = addr;
   trigger_exception(ExceptionCause::LoadAddressError);
@@ -526,42 +858,23 @@ void Cpu::op_swr(const Instruction& i) {
 // (2420303328 & 0b00000000'00000000'11111111'11111111) >> 0
 // LBU, 2, 5, 1
 void Cpu::op_lbu(const Instruction& i) {
-  const address addr = i.imm16_se() + rs(i);
-  //const address addr = i.imm16() + rs(i);
-  u8 val;
-  load8(addr, val);
-  issue_delayed_load(i.rt(), val);
+  load_delayed<u8>(i.imm16_se() + rs(i), i.rt());
 }
 
 void Cpu::op_lb(const Instruction& i) {
-  const address addr = i.imm16_se() + rs(i);
-  u8 val;
-  load8(addr, val);
-  issue_delayed_load(i.rt(), (s8)val);
+  load_delayed<s8>(i.imm16_se() + rs(i), i.rt());
 }
 
 void Cpu::op_lhu(const Instruction& i) {
-  const address addr = i.imm16_se() + rs(i);
-  u16 val;
-  if (!load16(addr, val))
-    return;
-  issue_delayed_load(i.rt(), val);
+  load_delayed<u16>(i.imm16_se() + rs(i), i.rt());
 }
 
 void Cpu::op_lh(const Instruction& i) {
-  const address addr = i.imm16_se() + rs(i);
-  u16 val;
-  if (!load16(addr, val))
-    return;
-  issue_delayed_load(i.rt(), (s16)val);
+  load_delayed<s16>(i.imm16_se() + rs(i), i.rt());
 }
 
 void Cpu::op_lw(const Instruction& i) {
-  const address addr = i.imm16_se() + rs(i);
-  u32 val;
-  if (!load32(addr, val))
-    return;
-  issue_delayed_load(i.rt(), val);
+  load_delayed<u32>(i.imm16_se() + rs(i), i.rt());
 }
 
 void Cpu::op_lwl(const Instruction& i) {
@@ -745,6 +1058,7 @@ void Cpu::op_rfe(const Instruction& i) {
   // Restore the mode before the exception by shifting the Interrupt Enable / User Mode stack back to its
   // original position.
   m_cop0_status.word = (m_cop0_status.word & ~0b1111u) | ((m_cop0_status.word >> 2) & 0xF);
+  update_irq_line();
 }
 
 bool Cpu::checked_add(u32 op1, u32 op2, u32& out) {
@@ -767,6 +1081,31 @@ bool Cpu::checked_sub(u32 op1, u32 op2, u32& out) {
   return true;
 }
 
+template <typename T>
+void Cpu::load_delayed(address addr, RegisterIndex reg) {
+  // Sign or zero extended to 32 bits
+  if constexpr (sizeof(T) == 1) {
+    u8 val;
+    load8(addr, val);
+    issue_delayed_load(reg, (T)val);
+  } else if constexpr (sizeof(T) == 2) {
+    u16 val;
+    if (load16(addr, val))
+      issue_delayed_load(reg, (T)val);
+  } else {
+    u32 val;
+    if (load32(addr, val))
+      issue_delayed_load(reg, val);
+  }
+}
+
+// Also called by recompiled blocks
+template void Cpu::load_delayed<s8>(address addr, RegisterIndex reg);
+template void Cpu::load_delayed<u8>(address addr, RegisterIndex reg);
+template void Cpu::load_delayed<s16>(address addr, RegisterIndex reg);
+template void Cpu::load_delayed<u16>(address addr, RegisterIndex reg);
+template void Cpu::load_delayed<u32>(address addr, RegisterIndex reg);
+
 bool Cpu::load32(u32 addr, u32& out_val) {
   if (addr % 4 != 0) {
     trigger_load_exception(addr);
@@ -1,12 +1,20 @@
 #pragma once
 
+#include <cpu/block_cache.hpp>
+#include <cpu/cpu_trace.hpp>
 #include <cpu/gte.hpp>
 #include <cpu/instruction.hpp>
+#include <cpu/pc_sampler.hpp>
+#include <cpu/recompiler.hpp>
+#include <util/line_log.hpp>
 #include <util/types.hpp>
 
 #include <gsl-lite.hpp>
 
 #include <array>
+#include <memory>
+#include <optional>
+#include <string>
 
 namespace gui {
 class Gui;
@@ -21,18 +29,38 @@ class Instruction;
 }
 
 namespace emulator {
+class Scheduler;
 struct Settings;
 }
 
+namespace util {
+class StateStream;
+}
+
 #define LOG_TTY_OUTPUT_WITH_HOOK false  // No need to enable this if LOG_BIOS_CALLS is enabled
 #define LOG_BIOS_CALLS true             // If enabled, TTY output is logged anyways
 
 namespace cpu {
 
 constexpr u32 APPROX_CYCLES_PER_INSTRUCTION = 2;
+// Estimate that the CPU effectively runs at a 1/3 of the system clock (due to memory delays etc)
+constexpr u32 SYSTEM_CYCLES_PER_INSTRUCTION = APPROX_CYCLES_PER_INSTRUCTION * 3;
 
 constexpr auto PC_RESET_ADDR = 0xBFC00000u;
 
+// Lines kept by the TTY output and BIOS calls logs, the oldest are dropped first
+constexpr size_t DEBUG_LOG_LINES = 1 << 14;
+
+// Optional instrumentation of the CPU loop. Each combination is a separate instantiation of the loop and
+// Cpu::step picks the one matching what's currently enabled, so the plain variant doesn't pay for any.
+enum StepFeature : u32 {
+  StepTrace = 1 << 0,      // Trace every instruction (Settings::log_trace_cpu, format set by TRACE_MODE)
+  StepBiosCalls = 1 << 1,  // Log BIOS function calls (Settings::log_bios_calls, needs LOG_BIOS_CALLS)
+  StepExeHook = 1 << 2,    // Load an executable once the BIOS kernel is up (Settings::fast_boot)
+  StepHleBios = 1 << 3,    // Run some BIOS functions natively (Settings::hle_bios, see bios/hle.hpp)
+};
+constexpr u32 STEP_VARIANT_COUNT = 1 << 4;
+
 // Co-processor 0 registers
 enum class Cop0Register : u32 {
   COP0_BPC = 3,        // BPC - Breakpoint on execute (R/W)
@@ -84,21 +112,54 @@ enum class ExceptionCause : u8 {
 
 class Cpu {
   friend class Interrupts;
+  friend class Recompiler;
   friend class gui::Gui;  // for debug info
 
  public:
-  explicit Cpu(bus::Bus& bus, const emulator::Settings& settings);
+  // bios_blocks may be shared with other emulators running the same BIOS (see bios::BiosImage)
+  Cpu(bus::Bus& bus,
+      const emulator::Settings& settings,
+      emulator::Scheduler& scheduler,
+      std::shared_ptr<SharedBlocks> bios_blocks);
 
-  void step(u32 cycles_to_execute);
+  // Runs until the end of the current scheduler slice, i.e. until the next event is due
+  void step();
 
   bus::Bus& bus() const { return m_bus; }
+  // Executed since power on, by either engine. HLE BIOS functions and skipped idle loops don't count.
+  u64 instruction_count() const { return m_instruction_count; }
+  const PcSampler& pc_sampler() const { return m_pc_sampler; }
+  BlockCache& block_cache() { return m_block_cache; }
+
+  // Registers, delay slots and the GTE, see util/state_stream.hpp. Only between steps.
+  void serialize(util::StateStream& s);
 
   // Debug UI fields
-  std::string m_tty_out_log;
-  std::string m_bios_calls_log;
+  util::LineLog<DEBUG_LOG_LINES> m_tty_out_log;
+  util::LineLog<DEBUG_LOG_LINES> m_bios_calls_log;
 
  private:
-  void execute_instruction(const Instruction& i);
+  using BlockInstructionFunction = u8 (*)(Cpu* cpu, const BasicBlock* block, u32 index);
+
+  // Interpreter loop pieces, shared with recompiled blocks. Features is a StepFeature mask.
+  template <u32 Features>
+  void step_impl();
+  // delay_tracking is a DelayTracking mask of the bookkeeping that can't be skipped for the instruction
+  template <u32 Features>
+  void begin_instruction(u8 delay_tracking);  // Saves exception state and takes pending interrupts
+  template <u32 Features>
+  void run_instruction(const Instruction& instr, u8 delay_tracking);  // Traces, executes, load delay
+  // Whether a taken branch from branch_addr jumps back into an idle loop (see cpu/idle_loop.hpp)
+  bool is_idle_loop_branch(address branch_addr, address target);
+  // Called from recompiled code, returns a BlockInstructionStatus
+  template <u32 Features>
+  static u8 execute_block_instruction(Cpu* cpu, const BasicBlock* block, u32 index);
+  void load_exe_hook();
+  bool hle_bios_call(bool log_call);  // Returns true if the BIOS call at PC was run natively
+
+  void execute_instruction(const Instruction& i);  // Dispatches to execute_opcode, see CPU_DISPATCH_MODE
+  template <Opcode Op>
+  void execute_opcode(const Instruction& i);
   void on_bios_call(u32 masked_pc);
 
   // Exceptions
@@ -106,6 +167,8 @@ class Cpu {
   void trigger_exception(ExceptionCause cause);
   void trigger_load_exception(const address addr);
   void trigger_store_exception(const address addr);
+  // Recomputes m_irq_asserted, after any change to SR or CAUSE
+  void update_irq_line();
 
   // Interpreter helpers
   void op_add(const Instruction& i);
@@ -138,6 +201,10 @@ class Cpu {
   bool load32(u32 addr, u32& out_val);  // Returns false on exception
   bool load16(u32 addr, u16& out_val);  // Returns false on exception
   void load8(u32 addr, u8& out_val);
+  // LB, LBU, LH, LHU and LW past their address computation, T is the loaded type. Issues the load
+  // unless it raised an exception.
+  template <typename T>
+  void load_delayed(address addr, RegisterIndex reg);
   void store32(u32 addr, u32 val);
   void store16(u32 addr, u16 val);
   void store8(u32 addr, u8 val);
@@ -238,18 +305,40 @@ class Cpu {
   bool m_branch_taken_saved{};
   bool m_in_branch_delay_slot{};
   bool m_in_branch_delay_slot_saved{};
+  bool m_irq_asserted{};  // An interrupt is pending, unmasked and enabled, see update_irq_line()
+  bool m_was_branch_cycle{};  // Used to detect BIOS function calls
+  bool m_in_idle_loop{};      // Last branch closed an idle loop, the rest of the step can be skipped
+
+  // Loop variant selection, see StepFeature
+  u32 m_step_features{};      // Features of the variant the last step ran with
+  bool m_load_exe_pending{};  // The BIOS hasn't reached the exe hook since power on
+  // What recompiled blocks call for each instruction, matches m_step_features
+  BlockInstructionFunction m_block_instruction_fn{};
+
+  u64 m_instruction_count{};
 
-  //  #ifndef NDEBUG
-  //  // For debugging
-  //  u64 instr_counter{};
-  //  #endif
+  // Guest PC sampling, m_next_pc_sample is never reached while it's off
+  void sample_pc();
+  PcSampler m_pc_sampler;
+  bool m_is_sampling_pc{};
+  u64 m_next_pc_sample{ UINT64_MAX };
+
+  // Binary trace, open while StepTrace is on (only with TRACE_MODE TRACE_BINARY, see cpu.cpp)
+  CpuTraceWriter m_trace;
+  bool m_trace_open_failed{};  // Not retried until tracing is turned off and on again
 
   cpu::gte::Gte m_gte;
 
+  // Instruction fetch/decode
+  BlockCache m_block_cache;
+  std::optional<Instruction> m_uncached_instr;  // Storage for instructions fetched outside the cache
+  Recompiler m_recompiler;
+
   // References
 
   bus::Bus& m_bus;
   const emulator::Settings& m_settings;
+  emulator::Scheduler& m_scheduler;
 };
 
 static const char* register_to_str(u8 reg_idx) {
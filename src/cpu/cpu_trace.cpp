@@ -0,0 +1,134 @@
+#include <cpu/cpu_trace.hpp>
+
+#include <util/log.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CPU_TRACE_MAPPED_SUPPORTED 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define CPU_TRACE_MAPPED_SUPPORTED 0
+#endif
+
+namespace cpu {
+
+namespace {
+
+constexpr u32 TRACE_MAGIC = 0x52544350;  // "PCTR"
+
+}  // namespace
+
+CpuTraceWriter::~CpuTraceWriter() {
+  close();
+}
+
+bool CpuTraceWriter::open(const fs::path& path, u32 capacity) {
+  close();
+
+  u32 capacity_pow2 = 1;
+  while (capacity_pow2 * 2 <= capacity && capacity_pow2 < (1u << 31))
+    capacity_pow2 *= 2;
+  const size_t size = sizeof(CpuTraceHeader) + (size_t)capacity_pow2 * sizeof(CpuTraceRecord);
+
+  void* data = nullptr;
+#if CPU_TRACE_MAPPED_SUPPORTED
+  const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG_ERROR("Could not create CPU trace {}: {}", path.string(), std::strerror(errno));
+    return false;
+  }
+  if (ftruncate(fd, (off_t)size) == 0)
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  else
+    data = MAP_FAILED;
+  // The mapping keeps its own reference to the file
+  ::close(fd);
+
+  if (data == MAP_FAILED) {
+    LOG_ERROR("Could not map CPU trace {}: {}", path.string(), std::strerror(errno));
+    return false;
+  }
+  m_mapped_size = size;
+#else
+  m_memory.assign(size, 0);
+  data = m_memory.data();
+#endif
+
+  m_path = path;
+  m_header = static_cast<CpuTraceHeader*>(data);
+  m_records = reinterpret_cast<CpuTraceRecord*>(m_header + 1);
+  m_capacity_mask = capacity_pow2 - 1;
+  *m_header = { TRACE_MAGIC, CPU_TRACE_VERSION, capacity_pow2, 0, 0, 0 };
+  m_last_regs.fill(0);
+
+  LOG_INFO("Tracing the CPU to {}, {} records at most", path.string(), capacity_pow2);
+  return true;
+}
+
+void CpuTraceWriter::close() {
+  if (m_header == nullptr)
+    return;
+
+  const u64 written = m_header->written;
+#if CPU_TRACE_MAPPED_SUPPORTED
+  munmap(m_header, m_mapped_size);
+#else
+  std::ofstream file(m_path, std::ios::binary);
+  file.write((const char*)m_memory.data(), m_memory.size());
+  if (!file)
+    LOG_ERROR("Could not write CPU trace {}", m_path.string());
+  m_memory = {};
+#endif
+  LOG_INFO("Wrote {} CPU trace records to {}", written, m_path.string());
+
+  m_header = nullptr;
+  m_records = nullptr;
+  m_mapped_size = 0;
+}
+
+bool load_cpu_trace(const fs::path& path, std::vector<CpuTraceRecord>& records) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    LOG_ERROR("Could not open CPU trace {}", path.string());
+    return false;
+  }
+
+  CpuTraceHeader header{};
+  file.read((char*)&header, sizeof(header));
+  const bool is_pow2 = header.capacity != 0 && (header.capacity & (header.capacity - 1)) == 0;
+  if (!file || header.magic != TRACE_MAGIC || header.version != CPU_TRACE_VERSION || !is_pow2) {
+    LOG_ERROR("{} is not a CPU trace of version {}", path.string(), CPU_TRACE_VERSION);
+    return false;
+  }
+
+  std::vector<CpuTraceRecord> ring(header.capacity);
+  file.read((char*)ring.data(), ring.size() * sizeof(CpuTraceRecord));
+  if (!file) {
+    LOG_ERROR("CPU trace {} is truncated", path.string());
+    return false;
+  }
+
+  // Unrolled from the oldest record
+  const u64 count = std::min<u64>(header.written, header.capacity);
+  const u64 first = header.written - count;
+  records.clear();
+  records.reserve(count);
+  for (u64 i = first; i < header.written; ++i)
+    records.push_back(ring[i & (header.capacity - 1)]);
+
+  // The ring may have been overwritten in the middle of an instruction's records
+  size_t orphans = 0;
+  if (first != 0)
+    while (orphans < records.size() && (records[orphans].flags & CPU_TRACE_CONTINUED))
+      ++orphans;
+  records.erase(records.begin(), records.begin() + orphans);
+  return true;
+}
+
+}  // namespace cpu
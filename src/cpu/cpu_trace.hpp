@@ -0,0 +1,104 @@
+#pragma once
+
+#include <util/fs.hpp>
+#include <util/types.hpp>
+
+#include <array>
+#include <vector>
+
+namespace cpu {
+
+// Bumped with any change to the layout of trace files
+constexpr u32 CPU_TRACE_VERSION = 1;
+// Records a trace file holds before the oldest ones are overwritten, 64 MB of them
+constexpr u32 CPU_TRACE_CAPACITY = 1 << 22;
+
+// Register of a record, past the 32 GPRs
+constexpr u8 CPU_TRACE_HI = 32;
+constexpr u8 CPU_TRACE_LO = 33;
+constexpr u8 CPU_TRACE_NO_REG = 0xFF;
+
+// The record holds one more register written by the instruction of the record before it
+constexpr u8 CPU_TRACE_CONTINUED = 1 << 0;
+
+// An executed instruction, and a register that changed since the previous one. Registers are compared
+// once the instruction is done, so a load shows up on the instruction after its delay slot, and writes
+// made outside of instructions (HLE BIOS calls, the exe hook) on the next one.
+struct CpuTraceRecord {
+  u32 pc;
+  u32 word;
+  u32 value;  // Of reg
+  u8 reg;     // A GPR, CPU_TRACE_HI, CPU_TRACE_LO or CPU_TRACE_NO_REG if nothing changed
+  u8 flags;
+  u16 reserved;
+};
+static_assert(sizeof(CpuTraceRecord) == 16);
+
+// File layout, in host order: this header, then capacity records. Records are written at
+// written % capacity, so once the ring is full the oldest start there.
+struct CpuTraceHeader {
+  u32 magic;
+  u32 version;
+  u32 capacity;  // A power of 2
+  u32 reserved;
+  u64 written;  // Records ever written
+  u64 reserved2;
+};
+static_assert(sizeof(CpuTraceHeader) == 32);
+
+// Writes the CPU trace straight into a shared mapping of the file, so recording an instruction is a few
+// stores and the file is complete even if the emulator crashes. Hosts without mmap keep the ring in
+// memory and write it on close().
+class CpuTraceWriter {
+ public:
+  CpuTraceWriter() = default;
+  CpuTraceWriter(const CpuTraceWriter&) = delete;
+  CpuTraceWriter& operator=(const CpuTraceWriter&) = delete;
+  ~CpuTraceWriter();
+
+  // Creates or truncates path, capacity is rounded down to a power of 2
+  bool open(const fs::path& path, u32 capacity);
+  void close();
+  bool is_open() const { return m_header != nullptr; }
+
+  void record(u32 pc, u32 word, const std::array<u32, 32>& gpr, u32 hi, u32 lo) {
+    u8 flags = 0;
+    for (u8 reg = 1; reg < 32; ++reg) {
+      if (gpr[reg] != m_last_regs[reg]) {
+        m_last_regs[reg] = gpr[reg];
+        push({ pc, word, gpr[reg], reg, flags, 0 });
+        flags = CPU_TRACE_CONTINUED;
+      }
+    }
+    if (hi != m_last_regs[CPU_TRACE_HI]) {
+      m_last_regs[CPU_TRACE_HI] = hi;
+      push({ pc, word, hi, CPU_TRACE_HI, flags, 0 });
+      flags = CPU_TRACE_CONTINUED;
+    }
+    if (lo != m_last_regs[CPU_TRACE_LO]) {
+      m_last_regs[CPU_TRACE_LO] = lo;
+      push({ pc, word, lo, CPU_TRACE_LO, flags, 0 });
+      flags = CPU_TRACE_CONTINUED;
+    }
+    if (flags == 0)
+      push({ pc, word, 0, CPU_TRACE_NO_REG, 0, 0 });
+  }
+
+ private:
+  void push(const CpuTraceRecord& record) { m_records[m_header->written++ & m_capacity_mask] = record; }
+
+  fs::path m_path;
+  CpuTraceHeader* m_header{};
+  CpuTraceRecord* m_records{};
+  u32 m_capacity_mask{};
+  size_t m_mapped_size{};
+  std::vector<u8> m_memory;  // The ring when it isn't mapped
+
+  // As of the last record, r0 stays 0
+  std::array<u32, 34> m_last_regs{};
+};
+
+// Reads a trace back, oldest record first
+bool load_cpu_trace(const fs::path& path, std::vector<CpuTraceRecord>& records);
+
+}  // namespace cpu
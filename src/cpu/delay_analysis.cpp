@@ -0,0 +1,66 @@
+#include <cpu/delay_analysis.hpp>
+
+#include <cpu/block_cache.hpp>
+#include <cpu/instruction.hpp>
+#include <cpu/opcode.hpp>
+
+namespace cpu {
+
+namespace {
+
+// Whether the instruction sets the branch delay flags
+bool is_branch(const Instruction& i) {
+  switch (i.opcode()) {
+    case Opcode::J:
+    case Opcode::JR:
+    case Opcode::JAL:
+    case Opcode::JALR:
+    case Opcode::BEQ:
+    case Opcode::BNE:
+    case Opcode::BGTZ:
+    case Opcode::BLEZ:
+    case Opcode::BCONDZ: return true;
+    default: return false;
+  }
+}
+
+// Whether the instruction may fill the next load delay slot
+bool issues_delayed_load(const Instruction& i) {
+  switch (i.opcode()) {
+    case Opcode::LB:
+    case Opcode::LBU:
+    case Opcode::LH:
+    case Opcode::LHU:
+    case Opcode::LW:
+    case Opcode::LWL:
+    case Opcode::LWR:
+    case Opcode::MFC0:
+    case Opcode::MFC2:
+    case Opcode::CFC2: return true;
+    default: return false;
+  }
+}
+
+}  // namespace
+
+void analyze_delays(BasicBlock& block) {
+  const auto& instrs = block.instructions;
+  block.delay_tracking.assign(instrs.size(), 0);
+
+  for (size_t idx = 0; idx < instrs.size(); ++idx) {
+    u8 tracking = 0;
+
+    // The saved flags are stale until two non-branch instructions ran: the one preceding the block may
+    // have been a branch, making the first one a delay slot
+    if (idx < 2 || is_branch(instrs[idx - 1]) || is_branch(instrs[idx - 2]))
+      tracking |= TrackBranchDelay;
+
+    // Whatever preceded the block may have left a load in flight
+    if (idx == 0 || issues_delayed_load(instrs[idx]) || issues_delayed_load(instrs[idx - 1]))
+      tracking |= TrackLoadDelay;
+
+    block.delay_tracking[idx] = tracking;
+  }
+}
+
+}  // namespace cpu
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <util/types.hpp>
+
+namespace cpu {
+
+struct BasicBlock;
+
+// Per-instruction state tracking the executor can't skip, as found by analyze_delays
+enum DelayTracking : u8 {
+  TrackBranchDelay = 1 << 0,  // Save and reset the branch delay flags before running the instruction
+  TrackLoadDelay = 1 << 1,    // Advance the load delay slots after running the instruction
+  TrackAll = TrackBranchDelay | TrackLoadDelay,
+};
+
+// Fills in block.delay_tracking. Inside a block, the branch delay flags are known to be clear a couple
+// of instructions past its start, and the load delay slots are empty unless the instruction or the one
+// before it issued a delayed load. Saving or advancing them is a no-op there and can be skipped.
+void analyze_delays(BasicBlock& block);
+
+}  // namespace cpu
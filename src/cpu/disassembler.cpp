@@ -0,0 +1,69 @@
+#include <cpu/disassembler.hpp>
+
+#include <cpu/cpu.hpp>
+#include <cpu/instruction.hpp>
+
+#include <spdlog/fmt/fmt.h>
+
+#include <array>
+
+namespace cpu {
+
+namespace {
+
+using Operands = std::array<u8, 3>;  // enum Operand values
+
+constexpr Operands OPCODE_OPERANDS[] = {
+#define OPCODE(mnemonic, opcode, operand1, operand2, operand3) { operand1, operand2, operand3 },
+#include <cpu/opcodes.def>
+#undef OPCODE
+  { OPERAND_NONE, OPERAND_NONE, OPERAND_NONE },  // INVALID
+};
+
+Operands operands_of(const Instruction& instr) {
+  // COP2 commands are matched manually by the decoder, so opcodes.def doesn't list their operand
+  if (instr.opcode() == Opcode::COP2)
+    return { OPERAND_IMM25, OPERAND_NONE, OPERAND_NONE };
+  return OPCODE_OPERANDS[static_cast<size_t>(instr.opcode())];
+}
+
+}  // namespace
+
+std::string disassemble(const Instruction& instr) {
+  std::string disasm_text;
+  disasm_text.reserve(32);
+
+  // Opcode
+  disasm_text = opcode_to_str(instr.opcode());
+  disasm_text += "\t";
+
+  for (const auto operand : operands_of(instr)) {
+    switch (operand) {
+      case OPERAND_NONE: break;
+      case OPERAND_RS: disasm_text += fmt::format("{}, ", register_to_str(instr.rs())); break;
+      case OPERAND_RT: disasm_text += fmt::format("{}, ", register_to_str(instr.rt())); break;
+      case OPERAND_RD: disasm_text += fmt::format("{}, ", register_to_str(instr.rd())); break;
+      case OPERAND_IMM5: disasm_text += fmt::format("0x{:X}, ", instr.imm5()); break;
+      case OPERAND_IMM16: disasm_text += fmt::format("0x{:X}, ", instr.imm16()); break;
+      case OPERAND_IMM20: disasm_text += fmt::format("0x{:X}, ", instr.imm20()); break;
+      case OPERAND_IMM25: disasm_text += fmt::format("0x{:X}, ", instr.imm25()); break;
+      case OPERAND_IMM26: disasm_text += fmt::format("0x{:X}, ", instr.imm26()); break;
+      case OPERAND_GTE_REG:  // fall-through
+      case OPERAND_GTE_GD: disasm_text += fmt::format("{}, ", gte::reg_to_str(instr.rd())); break;
+      case OPERAND_GTE_GC: disasm_text += fmt::format("{}, ", gte::reg_to_str(instr.rd() + 32)); break;
+      default: disasm_text += "<invalid_operand>";
+    }
+  }
+
+  // Erase trailing ", "
+  if (disasm_text[disasm_text.size() - 2] == ',')
+    disasm_text.erase(disasm_text.size() - 2, 2);
+
+  return disasm_text;
+}
+
+std::string disassemble(u32 word) {
+  return disassemble(Instruction(word));
+}
+
+}  // namespace cpu
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <string>
+
+namespace cpu {
+
+class Instruction;
+
+// Only used for tracing and debug UI, operands are looked up from opcodes.def on each call
+std::string disassemble(const Instruction& instr);
+std::string disassemble(u32 word);
+
+}  // namespace cpu
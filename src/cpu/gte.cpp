@@ -4,14 +4,51 @@
 #include <cpu/instruction.hpp>
 #include <util/bit_utils.hpp>
 #include <util/log.hpp>
+#include <util/state_stream.hpp>
 
 #include <algorithm>
+#include <utility>
 
 // Thanks to JaCzekanski (of Avocado) for some insights that make this code shorter/simpler
 
 namespace cpu {
 namespace gte {
 
+void Gte::serialize(util::StateStream& s) {
+  s.section("GTE ");
+  s.value(v);
+  s.value(rgbc);
+  s.value(avg_z);
+  s.value(ir);
+  s.value(s_xy);
+  s.value(s_z);
+  s.value(rgb_fifo);
+  s.value(res);
+  s.value(mac);
+  s.value(rgb_conv);
+  s.value(lzcs);
+  s.value(lzcr);
+
+  s.value(rot_mat);
+  s.value(trans_vec);
+  s.value(light_mat);
+  s.value(bg_col);
+  s.value(light_col_src_mat);
+  s.value(far_color);
+  s.value(screen_offset);
+  s.value(h);
+  s.value(dqa);
+  s.value(dqb);
+  s.value(zsf3);
+  s.value(zsf4);
+
+  // What FLAG is made of in either mode, so that states load into a build of the other one too
+  u32 flag_word = read_flag();
+  s.value(flag_word);
+  if (s.is_loading())
+    write_reg(63, flag_word);
+}
+
 u32 Gte::read_reg(u32 src_reg) {
   switch (src_reg) {
       // Data Registers
@@ -87,7 +124,7 @@ u32 Gte::read_reg(u32 src_reg) {
     case 60: return dqb;
     case 61: return (s32)(s16)zsf3;  // Sign extended on read
     case 62: return (s32)(s16)zsf4;  // Sign extended on read
-    case 63: return flag.read();
+    case 63: return read_flag();
   }
 
   // Unreachable
@@ -237,38 +274,57 @@ void Gte::write_reg(u32 dest_reg, u32 val) {
     case 60: dqb = val; break;
     case 61: zsf3 = val; break;
     case 62: zsf4 = val; break;
-    case 63: flag.word = val; break;
+    case 63:
+      reset_flag();
+      flag.word = val;
+      break;
   }
 }
 
-s32 Gte::clamp(s32 val, s32 min, s32 max, u32 flags) {
-  if (val > max) {
-    flag.word |= flags;
-    return max;
-  }
-  if (val < min) {
-    flag.word |= flags;
-    return min;
+void Gte::flag_check(FlagCheck check, s64 val, s64 min, s64 max) {
+  const FlagCheckRange& range = FLAG_CHECKS[check];
+#if GTE_LAZY_FLAG
+  // Offset by how much narrower the bounds are than the widest ones, so that only those have to be
+  // compared against when FLAG is read: val < min just when val + (range.min - min) < range.min
+  SeenRange& seen = m_seen[check];
+  seen.min = std::min(seen.min, val + (range.min - min));
+  seen.max = std::max(seen.max, val + (range.max - max));
+#else
+  if (val > max)
+    flag.word |= range.above_bits;
+  if (val < min)
+    flag.word |= range.below_bits;
+#endif
+}
+
+void Gte::reset_flag() {
+  flag.reset();
+#if GTE_LAZY_FLAG
+  m_seen.fill({});
+#endif
+}
+
+u32 Gte::read_flag() {
+#if GTE_LAZY_FLAG
+  for (u32 i = 0; i < FLAG_CHECK_COUNT; ++i) {
+    if (m_seen[i].max > FLAG_CHECKS[i].max)
+      flag.word |= FLAG_CHECKS[i].above_bits;
+    if (m_seen[i].min < FLAG_CHECKS[i].min)
+      flag.word |= FLAG_CHECKS[i].below_bits;
   }
-  return val;
+#endif
+  return flag.read();
 }
 
-template <int BitSize>
-void Gte::check_ovf_and_udf(s64 val, u32 ovf_bit, u32 udf_bit) {
-  if (val >= (1LL << BitSize))
-    flag.word |= ovf_bit;
-  if (val < -(1LL << BitSize))
-    flag.word |= udf_bit;
+s32 Gte::clamp(s32 val, s32 min, s32 max, FlagCheck check) {
+  flag_check(check, val, min, max);
+  return std::clamp(val, min, max);
 }
 
 template <s64 MacIndex>
 void Gte::check_mac_ovf_and_udf(s64 val) {
-  if (MacIndex == 1)
-    check_ovf_and_udf<43>(val, FlagRegister::MAC1_OVF_POS, FlagRegister::MAC1_OVF_NEG);
-  else if (MacIndex == 2)
-    check_ovf_and_udf<43>(val, FlagRegister::MAC2_OVF_POS, FlagRegister::MAC2_OVF_NEG);
-  else if (MacIndex == 3)
-    check_ovf_and_udf<43>(val, FlagRegister::MAC3_OVF_POS, FlagRegister::MAC3_OVF_NEG);
+  static_assert(MacIndex >= 1 && MacIndex <= 3);
+  flag_check(static_cast<FlagCheck>(CHECK_MAC1 + MacIndex - 1), val);
 }
 
 template <s64 MacIndex>
@@ -284,54 +340,37 @@ void Gte::mul_vec_vec(vec3_s16 v1, vec3_s16 v2, vec3_s16 tr) {
   set_mac_and_ir<3>(((s64)tr.z << 12) + v1.z * v2.z, m_lm);
 }
 
-template <bool Rtp>
-vec3_s64 Gte::mul_mat_vec(mat3x3_s16 mat, vec3_s16 vec, vec3_s32 tr) {
-  vec3_s64 product;
-
-  product.x = check_mac_ovf_and_extend<1>(
-      check_mac_ovf_and_extend<1>(check_mac_ovf_and_extend<1>(((s64)tr.x << 12) + mat[0][0] * vec.x) +
-                                  mat[0][1] * vec.y) +
-      mat[0][2] * vec.z);
-  product.y = check_mac_ovf_and_extend<2>(
-      check_mac_ovf_and_extend<2>(check_mac_ovf_and_extend<2>(((s64)tr.y << 12) + mat[1][0] * vec.x) +
-                                  mat[1][1] * vec.y) +
-      mat[1][2] * vec.z);
-  product.z = check_mac_ovf_and_extend<3>(
-      check_mac_ovf_and_extend<3>(check_mac_ovf_and_extend<3>(((s64)tr.z << 12) + mat[2][0] * vec.x) +
-                                  mat[2][1] * vec.y) +
-      mat[2][2] * vec.z);
+vec3_s64 Gte::mat_vec_product(const mat3x3_s16& mat, vec3_s16 vec, vec3_s32 tr) {
+  // The usual case, see gte_fits_without_overflow
+  if (gte_fits_without_overflow(tr.x, tr.y, tr.z)) {
+    return { ((s64)tr.x << 12) + mat[0][0] * vec.x + mat[0][1] * vec.y + mat[0][2] * vec.z,
+             ((s64)tr.y << 12) + mat[1][0] * vec.x + mat[1][1] * vec.y + mat[1][2] * vec.z,
+             ((s64)tr.z << 12) + mat[2][0] * vec.x + mat[2][1] * vec.y + mat[2][2] * vec.z };
+  }
 
-  set_mac_and_ir<1>(product.x, m_lm);
-  set_mac_and_ir<2>(product.y, m_lm);
-  if (!Rtp)
-    set_mac_and_ir<3>(product.z, m_lm);
-  else
-    set_mac<3>(product.z);
-  return product;
+  return { mat_row_product<1>(mat[0], vec, tr.x), mat_row_product<2>(mat[1], vec, tr.y),
+           mat_row_product<3>(mat[2], vec, tr.z) };
 }
 
-s64 Gte::mul_mat_vec_rtp(mat3x3_s16 mat, vec3_s16 vec, vec3_s32 tr) {
-  const auto product = mul_mat_vec<true>(mat, vec, tr);
-
-  // RTP calculates the IR3 saturation flag as if the lm bit is false
-  Gte::clamp((s32)(product.z >> 12), -0x8000, 0x7FFF, FlagRegister::IR3_SAT);
-
-  // But the calculation itself respects the lm bit
-  ir[3] = std::clamp(mac[3], m_lm ? 0 : -0x8000, 0x7FFF);
+template <s64 MacIndex>
+s64 Gte::mat_row_product(vec3_s16 row, vec3_s16 vec, s32 tr) {
+  s64 sum = check_mac_ovf_and_extend<MacIndex>(((s64)tr << 12) + row.x * vec.x);
+  sum = check_mac_ovf_and_extend<MacIndex>(sum + row.y * vec.y);
+  return check_mac_ovf_and_extend<MacIndex>(sum + row.z * vec.z);
+}
 
-  return product.z;
+void Gte::mul_mat_vec(const mat3x3_s16& mat, vec3_s16 vec, vec3_s32 tr) {
+  const vec3_s64 product = mat_vec_product(mat, vec, tr);
+  set_mac_and_ir<1>(product.x, m_lm);
+  set_mac_and_ir<2>(product.y, m_lm);
+  set_mac_and_ir<3>(product.z, m_lm);
 }
 
 template <s32 IrIndex>
 void Gte::set_ir(s32 val, bool lm) {
-  u32 sat_bit{};
-  if (IrIndex == 1)
-    sat_bit = FlagRegister::IR1_SAT;
-  else if (IrIndex == 2)
-    sat_bit = FlagRegister::IR2_SAT;
-  else if (IrIndex == 3)
-    sat_bit = FlagRegister::IR3_SAT;
-  ir[IrIndex] = Gte::clamp(val, lm ? 0 : -0x8000, 0x7FFF, sat_bit);
+  static_assert(IrIndex >= 1 && IrIndex <= 3);
+  const auto check = static_cast<FlagCheck>(CHECK_IR1 + IrIndex - 1);
+  ir[IrIndex] = Gte::clamp(val, lm ? 0 : -0x8000, 0x7FFF, check);
 }
 
 template <s32 MacIndex>
@@ -347,7 +386,7 @@ s64 Gte::set_mac(s64 val) {
 
 template <>
 s64 Gte::set_mac<0>(s64 val) {
-  check_ovf_and_udf<31>(val, FlagRegister::MAC0_OVF_POS, FlagRegister::MAC0_OVF_NEG);
+  flag_check(CHECK_MAC0, val);
 
   mac[0] = (s32)val;
   return val;
@@ -359,7 +398,7 @@ void Gte::set_mac_and_ir(s64 val, bool lm) {
 }
 
 void Gte::set_otz(s64 val) {
-  avg_z = (u16)Gte::clamp((s32)(val >> 12), 0, 0xFFFF, FlagRegister::SZ3_OTZ_SAT);
+  avg_z = (u16)Gte::clamp((s32)(val >> 12), 0, 0xFFFF, CHECK_SZ3_OTZ);
 }
 
 void Gte::push_screen_xy(s32 x, s32 y) {
@@ -368,8 +407,8 @@ void Gte::push_screen_xy(s32 x, s32 y) {
   s_xy[1].x = s_xy[2].x;
   s_xy[1].y = s_xy[2].y;
 
-  s_xy[2].x = clamp(x, -0x400, 0x3FF, FlagRegister::SX2_SAT);
-  s_xy[2].y = clamp(y, -0x400, 0x3FF, FlagRegister::SY2_SAT);
+  s_xy[2].x = clamp(x, -0x400, 0x3FF, CHECK_SX2);
+  s_xy[2].y = clamp(y, -0x400, 0x3FF, CHECK_SY2);
 }
 
 void Gte::push_screen_z(s32 z) {
@@ -377,7 +416,7 @@ void Gte::push_screen_z(s32 z) {
   s_z[1] = s_z[2];
   s_z[2] = s_z[3];
 
-  s_z[3] = clamp(z, 0, 0xFFFF, FlagRegister::SZ3_OTZ_SAT);
+  s_z[3] = clamp(z, 0, 0xFFFF, CHECK_SZ3_OTZ);
 }
 
 u32 Gte::recip(u16 divisor) {
@@ -415,25 +454,19 @@ void Gte::push_color(u32 r, u32 g, u32 b) {
   rgb_fifo[0] = rgb_fifo[1];
   rgb_fifo[1] = rgb_fifo[2];
 
-  rgb_fifo[2].r = Gte::clamp(r, 0, 0xFF, FlagRegister::COLOR_R_SAT);
-  rgb_fifo[2].g = Gte::clamp(g, 0, 0xFF, FlagRegister::COLOR_G_SAT);
-  rgb_fifo[2].b = Gte::clamp(b, 0, 0xFF, FlagRegister::COLOR_B_SAT);
+  rgb_fifo[2].r = Gte::clamp(r, 0, 0xFF, CHECK_COLOR_R);
+  rgb_fifo[2].g = Gte::clamp(g, 0, 0xFF, CHECK_COLOR_G);
+  rgb_fifo[2].b = Gte::clamp(b, 0, 0xFF, CHECK_COLOR_B);
   rgb_fifo[2].a = rgbc.a;
 }
 void Gte::push_color() {
   push_color(mac[1] >> 4, mac[2] >> 4, mac[3] >> 4);
 }
 
-void Gte::cmd(u32 word) {
-  gte::GteCommand cmd(word);
-
-  flag.reset();
-  m_sf = cmd.sf;
-  m_lm = cmd.lm;
-
-  LOG_DEBUG_GTE("COP2: {:<4}  | 0x{:08X} at 0x{:08X}", cmd.to_str(), word, m_cpu.current_pc());
-
-  switch (cmd.opcode()) {
+template <u32 Op>
+void Gte::execute_command(GteCommand cmd) {
+  // Op is a constant, so this switch folds down to a single case in every instantiation
+  switch (Op) {
     case GteCommand::RTPS: cmd_rtps(); break;
     case GteCommand::NCLIP: cmd_nclip(); break;
     case GteCommand::OP: cmd_op(); break;
@@ -456,13 +489,41 @@ void Gte::cmd(u32 word) {
     case GteCommand::GPF: cmd_gpf(); break;
     case GteCommand::GPL: cmd_gpl(); break;
     case GteCommand::NCCT: cmd_ncct(); break;
+    default: break;
   }
 }
 
-void Gte::cmd_rtps(u8 vec_idx, bool set_mac0) {
-  s64 mac3 = mul_mat_vec_rtp(rot_mat, v[vec_idx], trans_vec);
+template <std::size_t... Ops>
+constexpr auto Gte::command_table(std::index_sequence<Ops...>) {
+  return std::array<CommandHandler, sizeof...(Ops)>{ { &Gte::execute_command<Ops>... } };
+}
+
+void Gte::cmd(u32 word) {
+  static constexpr auto COMMAND_TABLE = command_table(std::make_index_sequence<64>());
 
-  push_screen_z((s32)(mac3 >> 12));
+  gte::GteCommand cmd(word);
+
+  reset_flag();
+  m_sf = cmd.sf;
+  m_lm = cmd.lm;
+
+  LOG_DEBUG_GTE("COP2: {:<4}  | 0x{:08X} at 0x{:08X}", cmd.to_str(), word, m_cpu.current_pc());
+
+  (this->*COMMAND_TABLE[cmd._opcode])(cmd);
+}
+
+void Gte::rtp(vec3_s64 product, bool set_mac0) {
+  set_mac_and_ir<1>(product.x, m_lm);
+  set_mac_and_ir<2>(product.y, m_lm);
+  set_mac<3>(product.z);
+
+  // RTP calculates the IR3 saturation flag as if the lm bit is false
+  flag_check(CHECK_IR3, (s32)(product.z >> 12));
+
+  // But the calculation itself respects the lm bit
+  ir[3] = std::clamp(mac[3], m_lm ? 0 : -0x8000, 0x7FFF);
+
+  push_screen_z((s32)(product.z >> 12));
   s64 h_s3z = divide_unr(h, s_z[3]);
 
   s32 x = (s32)(set_mac<0>((s64)(h_s3z * ir[1]) + screen_offset[0]) >> 16);
@@ -471,10 +532,14 @@ void Gte::cmd_rtps(u8 vec_idx, bool set_mac0) {
 
   if (set_mac0) {
     s64 mac0 = set_mac<0>(h_s3z * dqa + dqb);
-    ir[0] = Gte::clamp((s32)(mac0 >> 12), 0, 0x1000, FlagRegister::IR0_SAT);
+    ir[0] = Gte::clamp((s32)(mac0 >> 12), 0, 0x1000, CHECK_IR0);
   }
 }
 
+void Gte::cmd_rtps(u8 vec_idx, bool set_mac0) {
+  rtp(mat_vec_product(rot_mat, v[vec_idx], trans_vec), set_mac0);
+}
+
 void Gte::cmd_nclip() {
   set_mac<0>((s64)s_xy[0].x * s_xy[1].y + s_xy[1].x * s_xy[2].y + s_xy[2].x * s_xy[0].y -
              s_xy[0].x * s_xy[2].y - s_xy[1].x * s_xy[0].y - s_xy[2].x * s_xy[1].y);
@@ -502,42 +567,18 @@ void Gte::cmd_intpl() {
 }
 
 void Gte::cmd_mvmva(u32 mul_mat_idx, u32 mul_vec_idx, u32 tr_vec_idx) {
-  mat3x3_s16 mul_mat;
-  if (mul_mat_idx == 0)
-    mul_mat = rot_mat;
-  else if (mul_mat_idx == 0)
-    mul_mat = rot_mat;
-  else if (mul_mat_idx == 0)
-    mul_mat = rot_mat;
-  else {
-    mul_mat = {};
+  static const mat3x3_s16 BUGGY_MATRIX{};
+  const mat3x3_s16* matrices[] = { &rot_mat, &light_mat, &light_col_src_mat, &BUGGY_MATRIX };
+  if (mul_mat_idx == 3)
     LOG_ERROR_GTE("Buggy matrix selected");
-  }
 
-  vec3_s16 mul_vec;
-  if (mul_vec_idx == 0)
-    mul_vec = v[0];
-  else if (mul_vec_idx == 1)
-    mul_vec = v[1];
-  else if (mul_vec_idx == 2)
-    mul_vec = v[2];
-  else {
-    mul_vec.x = ir[1];
-    mul_vec.y = ir[2];
-    mul_vec.z = ir[3];
-  }
-  vec3_s32 tr_vec;
-  if (tr_vec_idx == 0)
-    tr_vec = trans_vec;
-  else if (tr_vec_idx == 1)
-    tr_vec = bg_col;
-  else if (tr_vec_idx == 2) {
-    tr_vec = {};
+  const vec3_s16 mul_vec = mul_vec_idx == 3 ? ir_to_vec() : v[mul_vec_idx];
+
+  const vec3_s32 translations[] = { trans_vec, bg_col, {}, {} };
+  if (tr_vec_idx == 2)
     LOG_ERROR_GTE("Buggy FarColor vector operation");
-  } else
-    tr_vec = {};
 
-  mul_mat_vec(mul_mat, mul_vec, tr_vec);
+  mul_mat_vec(*matrices[mul_mat_idx], mul_vec, translations[tr_vec_idx]);
 }
 
 void Gte::cmd_ncds(u8 vec_idx) {
@@ -616,9 +657,31 @@ void Gte::cmd_avsz4() {
 }
 
 void Gte::cmd_rtpt() {
-  cmd_rtps(0, false);
-  cmd_rtps(1, false);
-  cmd_rtps(2);
+  // The three vertices are transformed together, then projected one after the other
+  vec3_s64 products[RTPT_VERTICES];
+  if (gte_fits_without_overflow(trans_vec.x, trans_vec.y, trans_vec.z)) {
+    s16 mat[9];
+    s16 vertices[RTPT_VERTICES * 3];
+    for (u32 r = 0; r < 3; ++r) {
+      for (u32 c = 0; c < 3; ++c) {
+        mat[r * 3 + c] = rot_mat[r][c];
+        vertices[r * 3 + c] = v[r][c];
+      }
+    }
+    const s32 tr[3] = { trans_vec.x, trans_vec.y, trans_vec.z };
+
+    s64 out[RTPT_VERTICES * 3];
+    m_kernels.transform3(mat, vertices, tr, out);
+    for (u32 i = 0; i < RTPT_VERTICES; ++i)
+      products[i] = { out[i * 3], out[i * 3 + 1], out[i * 3 + 2] };
+  } else {
+    for (u32 i = 0; i < RTPT_VERTICES; ++i)
+      products[i] = mat_vec_product(rot_mat, v[i], trans_vec);
+  }
+
+  rtp(products[0], false);
+  rtp(products[1], false);
+  rtp(products[2], true);
 }
 
 void Gte::cmd_gpf() {
@@ -1,17 +1,28 @@
 #pragma once
 
+#include <cpu/gte_kernels.hpp>
 #include <glm/mat3x3.hpp>
 #include <glm/vec3.hpp>
 #include <gsl-lite.hpp>
 #include <util/types.hpp>
 
 #include <array>
+#include <limits>
+#include <utility>
+
+// Whether FLAG is rebuilt when it's read, from the lowest and highest value each of its checks saw
+// during the command (1), or updated by every check as it goes (0)
+#define GTE_LAZY_FLAG 1
 
 namespace cpu {
 class Cpu;
 class Instruction;
 }  // namespace cpu
 
+namespace util {
+class StateStream;
+}
+
 namespace cpu {
 namespace gte {
 
@@ -51,15 +62,97 @@ constexpr std::array<u8, UNR_COUNT> generate_unr_table() {
   return table;
 }
 
+union GteCommand {
+  enum Opcode {
+    RTPS = 0x01,
+    NCLIP = 0x06,
+    OP = 0x0C,
+    DPCS = 0x10,
+    INTPL = 0x11,
+    MVMVA = 0x12,
+    NCDS = 0x13,
+    CDP = 0x14,
+    NCDT = 0x16,
+    NCCS = 0x1B,
+    CC = 0x1C,
+    NCS = 0x1E,
+    NCT = 0x20,
+    SQR = 0x28,
+    DCPL = 0x29,
+    DPCT = 0x2A,
+    AVSZ3 = 0x2D,
+    AVSZ4 = 0x2E,
+    RTPT = 0x30,
+    GPF = 0x3D,
+    GPL = 0x3E,
+    NCCT = 0x3F,
+  };
+
+  explicit GteCommand(u32 word) : word(word) {}
+
+  u32 word;
+  struct {
+    u32 _opcode : 6;  // [0-5]    Real GTE Command Number (00h..3Fh) (used by hardware)
+    u32 : 4;          // [6-9]    Always zero                        (ignored by hardware)
+    u32 lm : 1;       // [10]     lm - Saturate IR1,IR2,IR3 result (0=To -8000h..+7FFFh, 1=To 0..+7FFFh)
+    u32 : 2;          // [11-12]  Always zero                        (ignored by hardware)
+    u32 mvmva_trans : 2;    // [13-14]  MVMVA Translation Vector (0=TR, 1=BK, 2=FC/Bugged, 3=None)
+    u32 mvmva_mul_vec : 2;  // [15-16]  MVMVA Multiply Vector    (0=V0, 1=V1, 2=V2, 3=IR/long)
+    u32 mvmva_mul_mat : 2;  // [17-18]  MVMVA Multiply Matrix    (0=Rotation. 1=Light, 2=Color,
+                            // 3=Reserved)
+    u32 sf : 1;       // [19]     sf - Shift Fraction in IR registers (0=No fraction, 1=12bit fraction)
+    u32 op_fake : 5;  // [20-24]  Fake GTE Command Number (00h..1Fh) (ignored by hardware)
+    u32 : 7;          // [31-25]  Must be 0100101b for "COP2 imm25" instructions
+  };
+
+  Opcode opcode() const { return static_cast<Opcode>(_opcode); }
+
+  const char* to_str() const {
+    switch (_opcode) {
+      case RTPS: return "RTPS";
+      case NCLIP: return "NCLIP";
+      case OP: return "OP";
+      case DPCS: return "DPCS";
+      case INTPL: return "INTPL";
+      case MVMVA: return "MVMVA";
+      case NCDS: return "NCDS";
+      case CDP: return "CDP";
+      case NCDT: return "NCDT";
+      case NCCS: return "NCCS";
+      case CC: return "CC";
+      case NCS: return "NCS";
+      case NCT: return "NCT";
+      case SQR: return "SQR";
+      case DCPL: return "DCPL";
+      case DPCT: return "DPCT";
+      case AVSZ3: return "AVSZ3";
+      case AVSZ4: return "AVSZ4";
+      case RTPT: return "RTPT";
+      case GPF: return "GPF";
+      case GPL: return "GPL";
+      case NCCT: return "NCCT";
+      default: return "<invalid>";
+    }
+  }
+};
+
 class Gte {
  public:
-  explicit Gte(cpu::Cpu& cpu) : UNR_TABLE(generate_unr_table()), m_cpu(cpu) {}
+  explicit Gte(cpu::Cpu& cpu) : UNR_TABLE(generate_unr_table()), m_kernels(gte_kernels()), m_cpu(cpu) {}
 
   u32 read_reg(u32 src_reg);
   void write_reg(u32 dest_reg, u32 val);
-  void cmd(u32 word);
+  void cmd(u32 word);  // Dispatches to execute_command through a table indexed by opcode
+  void serialize(util::StateStream& s);
 
  private:
+  using CommandHandler = void (Gte::*)(GteCommand);
+
+  template <u32 Op>
+  void execute_command(GteCommand cmd);
+  template <std::size_t... Ops>
+  static constexpr auto command_table(std::index_sequence<Ops...>);
+
   union FlagRegister {
     enum {
       IR0_SAT = 1 << 12,
@@ -118,24 +211,79 @@ class Gte {
     }
   };
 
+  // The overflow and saturation checks behind the bits of FLAG, each one a range of values
+  enum FlagCheck : u32 {
+    CHECK_MAC1,
+    CHECK_MAC2,
+    CHECK_MAC3,
+    CHECK_MAC0,
+    CHECK_IR1,
+    CHECK_IR2,
+    CHECK_IR3,
+    CHECK_IR0,
+    CHECK_SX2,
+    CHECK_SY2,
+    CHECK_SZ3_OTZ,
+    CHECK_COLOR_R,
+    CHECK_COLOR_G,
+    CHECK_COLOR_B,
+    FLAG_CHECK_COUNT
+  };
+
+  struct FlagCheckRange {
+    s64 min;  // The widest bounds the check is done with (IR1-3 are narrower with lm)
+    s64 max;
+    u32 above_bits;  // Set for values above max
+    u32 below_bits;  // Set for values below min
+  };
+
+  static constexpr FlagCheckRange FLAG_CHECKS[FLAG_CHECK_COUNT] = {
+    { -(1LL << 43), (1LL << 43) - 1, FlagRegister::MAC1_OVF_POS, FlagRegister::MAC1_OVF_NEG },
+    { -(1LL << 43), (1LL << 43) - 1, FlagRegister::MAC2_OVF_POS, FlagRegister::MAC2_OVF_NEG },
+    { -(1LL << 43), (1LL << 43) - 1, FlagRegister::MAC3_OVF_POS, FlagRegister::MAC3_OVF_NEG },
+    { -(1LL << 31), (1LL << 31) - 1, FlagRegister::MAC0_OVF_POS, FlagRegister::MAC0_OVF_NEG },
+    { -0x8000, 0x7FFF, FlagRegister::IR1_SAT, FlagRegister::IR1_SAT },
+    { -0x8000, 0x7FFF, FlagRegister::IR2_SAT, FlagRegister::IR2_SAT },
+    { -0x8000, 0x7FFF, FlagRegister::IR3_SAT, FlagRegister::IR3_SAT },
+    { 0, 0x1000, FlagRegister::IR0_SAT, FlagRegister::IR0_SAT },
+    { -0x400, 0x3FF, FlagRegister::SX2_SAT, FlagRegister::SX2_SAT },
+    { -0x400, 0x3FF, FlagRegister::SY2_SAT, FlagRegister::SY2_SAT },
+    { 0, 0xFFFF, FlagRegister::SZ3_OTZ_SAT, FlagRegister::SZ3_OTZ_SAT },
+    { 0, 0xFF, FlagRegister::COLOR_R_SAT, FlagRegister::COLOR_R_SAT },
+    { 0, 0xFF, FlagRegister::COLOR_G_SAT, FlagRegister::COLOR_G_SAT },
+    { 0, 0xFF, FlagRegister::COLOR_B_SAT, FlagRegister::COLOR_B_SAT },
+  };
+
   //
   // Command helpers
   //
 
-  s32 clamp(s32 val, s32 min, s32 max, u32 flags = 0);
+  // Checks val against [min, max], setting the bits of check in FLAG when it's outside (see
+  // GTE_LAZY_FLAG)
+  void flag_check(FlagCheck check, s64 val, s64 min, s64 max);
+  void flag_check(FlagCheck check, s64 val) {
+    flag_check(check, val, FLAG_CHECKS[check].min, FLAG_CHECKS[check].max);
+  }
+  void reset_flag();
+  u32 read_flag();
+
+  s32 clamp(s32 val, s32 min, s32 max, FlagCheck check);
 
   // Check for overflow/underflow and set appropriate bits if any
-  template <s32 BitSize>
-  void check_ovf_and_udf(s64 val, u32 ovf_bit, u32 udf_bit);
   template <s64 MacIndex>
   void check_mac_ovf_and_udf(s64 val);
   template <s64 MacIndex>
   s64 check_mac_ovf_and_extend(s64 val);
 
   void mul_vec_vec(vec3_s16 v1, vec3_s16 v2, vec3_s16 tr = {});
-  template <bool Rtp = false>
-  vec3_s64 mul_mat_vec(mat3x3_s16 mat, vec3_s16 vec, vec3_s32 tr = {});
-  s64 mul_mat_vec_rtp(mat3x3_s16 mat, vec3_s16 vec, vec3_s32 tr);
+  // mat x vec + (tr << 12), setting the overflow flags of each partial sum
+  vec3_s64 mat_vec_product(const mat3x3_s16& mat, vec3_s16 vec, vec3_s32 tr);
+  template <s64 MacIndex>
+  s64 mat_row_product(vec3_s16 row, vec3_s16 vec, s32 tr);
+  // Sets MAC1-3 and IR1-3 to mat x vec + (tr << 12)
+  void mul_mat_vec(const mat3x3_s16& mat, vec3_s16 vec, vec3_s32 tr = {});
+  // Perspective transformation of a vertex already multiplied by the rotation matrix
+  void rtp(vec3_s64 product, bool set_mac0);
 
   template <s32 IrIndex>
   void set_ir(s32 val, bool lm = false);
@@ -163,6 +311,7 @@ class Gte {
   bool m_sf{};
   bool m_lm{};
   const std::array<u8, UNR_COUNT> UNR_TABLE;
+  const GteKernels& m_kernels;
 
   //
   // Commands
@@ -226,81 +375,17 @@ class Gte {
   s16 zsf4{};                      // [30] Average Z scale factor (4)
   FlagRegister flag{};             // [31]Flag
 
-  cpu::Cpu& m_cpu;
-};
-
-union GteCommand {
-  enum Opcode {
-    RTPS = 0x01,
-    NCLIP = 0x06,
-    OP = 0x0C,
-    DPCS = 0x10,
-    INTPL = 0x11,
-    MVMVA = 0x12,
-    NCDS = 0x13,
-    CDP = 0x14,
-    NCDT = 0x16,
-    NCCS = 0x1B,
-    CC = 0x1C,
-    NCS = 0x1E,
-    NCT = 0x20,
-    SQR = 0x28,
-    DCPL = 0x29,
-    DPCT = 0x2A,
-    AVSZ3 = 0x2D,
-    AVSZ4 = 0x2E,
-    RTPT = 0x30,
-    GPF = 0x3D,
-    GPL = 0x3E,
-    NCCT = 0x3F,
+#if GTE_LAZY_FLAG
+  // Lowest and highest value each check saw since FLAG was last reset, offset from the bounds of the
+  // check by how much narrower they were than its widest ones
+  struct SeenRange {
+    s64 min = std::numeric_limits<s64>::max();
+    s64 max = std::numeric_limits<s64>::min();
   };
+  std::array<SeenRange, FLAG_CHECK_COUNT> m_seen{};
+#endif
 
-  explicit GteCommand(u32 word) : word(word) {}
-
-  u32 word;
-  struct {
-    u32 _opcode : 6;  // [0-5]    Real GTE Command Number (00h..3Fh) (used by hardware)
-    u32 : 4;          // [6-9]    Always zero                        (ignored by hardware)
-    u32 lm : 1;       // [10]     lm - Saturate IR1,IR2,IR3 result (0=To -8000h..+7FFFh, 1=To 0..+7FFFh)
-    u32 : 2;          // [11-12]  Always zero                        (ignored by hardware)
-    u32 mvmva_trans : 2;    // [13-14]  MVMVA Translation Vector (0=TR, 1=BK, 2=FC/Bugged, 3=None)
-    u32 mvmva_mul_vec : 2;  // [15-16]  MVMVA Multiply Vector    (0=V0, 1=V1, 2=V2, 3=IR/long)
-    u32 mvmva_mul_mat : 2;  // [17-18]  MVMVA Multiply Matrix    (0=Rotation. 1=Light, 2=Color,
-                            // 3=Reserved)
-    u32 sf : 1;       // [19]     sf - Shift Fraction in IR registers (0=No fraction, 1=12bit fraction)
-    u32 op_fake : 5;  // [20-24]  Fake GTE Command Number (00h..1Fh) (ignored by hardware)
-    u32 : 7;          // [31-25]  Must be 0100101b for "COP2 imm25" instructions
-  };
-
-  Opcode opcode() const { return static_cast<Opcode>(_opcode); }
-
-  const char* to_str() const {
-    switch (_opcode) {
-      case RTPS: return "RTPS";
-      case NCLIP: return "NCLIP";
-      case OP: return "OP";
-      case DPCS: return "DPCS";
-      case INTPL: return "INTPL";
-      case MVMVA: return "MVMVA";
-      case NCDS: return "NCDS";
-      case CDP: return "CDP";
-      case NCDT: return "NCDT";
-      case NCCS: return "NCCS";
-      case CC: return "CC";
-      case NCS: return "NCS";
-      case NCT: return "NCT";
-      case SQR: return "SQR";
-      case DCPL: return "DCPL";
-      case DPCT: return "DPCT";
-      case AVSZ3: return "AVSZ3";
-      case AVSZ4: return "AVSZ4";
-      case RTPT: return "RTPT";
-      case GPF: return "GPF";
-      case GPL: return "GPL";
-      case NCCT: return "NCCT";
-      default: return "<invalid>";
-    }
-  }
+  cpu::Cpu& m_cpu;
 };
 
 static const char* reg_to_str(u8 reg_idx) {
@@ -0,0 +1,45 @@
+#include <cpu/gte_kernels.hpp>
+
+#include <util/log.hpp>
+
+namespace cpu {
+namespace gte {
+
+namespace {
+
+void transform3_scalar(const s16* mat, const s16* vertices, const s32* tr, s64* out) {
+  for (u32 v = 0; v < RTPT_VERTICES; ++v) {
+    const s16* vertex = vertices + v * 3;
+    for (u32 r = 0; r < 3; ++r) {
+      const s16* row = mat + r * 3;
+      out[v * 3 + r] = ((s64)tr[r] << 12) + row[0] * vertex[0] + row[1] * vertex[1] + row[2] * vertex[2];
+    }
+  }
+}
+
+constexpr GteKernels SCALAR_KERNELS = { "scalar", transform3_scalar };
+
+const GteKernels& select_gte_kernels() {
+  const GteKernels* kernels = gte_kernels_sse41();
+  if (kernels == nullptr)
+    kernels = gte_kernels_neon();
+  if (kernels == nullptr)
+    kernels = &SCALAR_KERNELS;
+
+  LOG_INFO("Using {} GTE kernels", kernels->name);
+  return *kernels;
+}
+
+}  // namespace
+
+const GteKernels& gte_kernels() {
+  static const GteKernels& kernels = select_gte_kernels();
+  return kernels;
+}
+
+const GteKernels& gte_kernels_scalar() {
+  return SCALAR_KERNELS;
+}
+
+}  // namespace gte
+}  // namespace cpu
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <util/types.hpp>
+
+// GTE kernels run the matrix products of the hot commands. There is a scalar reference implementation,
+// and SIMD ones picked at runtime depending on what the host CPU supports, all of them bit identical.
+//
+// RTPT transforms its three vertices by the same rotation matrix: the kernels take the columns of the
+// matrix a lane per row and go through the vertices with widening multiplies, summing in 64 bits. Only
+// translations small enough that no partial sum can overflow are handed to them (see
+// gte_fits_without_overflow), so there are no flags to check along the way.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GTE_KERNELS_X86 1
+#else
+#define GTE_KERNELS_X86 0
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define GTE_KERNELS_NEON 1
+#else
+#define GTE_KERNELS_NEON 0
+#endif
+
+namespace cpu {
+namespace gte {
+
+constexpr u32 RTPT_VERTICES = 3;
+
+// MAC1-3 sums are checked against 43 bits after each term. Products of 16 bit values stay within 31
+// bits, so with translations of up to 29 bits (41 once shifted by 12) the three terms can't get there.
+inline bool gte_fits_without_overflow(s32 x, s32 y, s32 z) {
+  const auto fits = [](s32 t) { return t >= -(1 << 29) && t < (1 << 29); };
+  return fits(x) && fits(y) && fits(z);
+}
+
+struct GteKernels {
+  const char* name;
+
+  // The 3x3 matrix mat, by rows, times each of the RTPT_VERTICES vertices (x, y, z) plus tr << 12:
+  // out[v * 3 + r] = (tr[r] << 12) + mat[r * 3] * x + mat[r * 3 + 1] * y + mat[r * 3 + 2] * z
+  void (*transform3)(const s16* mat, const s16* vertices, const s32* tr, s64* out);
+};
+
+// Kernels for the best instruction set available
+const GteKernels& gte_kernels();
+
+// Per instruction set kernels, null if not built in or not supported by the host
+const GteKernels& gte_kernels_scalar();
+const GteKernels* gte_kernels_sse41();
+const GteKernels* gte_kernels_neon();
+
+}  // namespace gte
+}  // namespace cpu
@@ -0,0 +1,63 @@
+#include <cpu/gte_kernels.hpp>
+
+#if GTE_KERNELS_NEON
+
+#include <arm_neon.h>
+
+// AArch64 always has NEON, no runtime check is needed
+
+namespace cpu {
+namespace gte {
+
+namespace {
+
+// Widening multiplies of the columns by each coordinate, then widening sums into 64 bits
+void transform3_neon(const s16* mat, const s16* vertices, const s32* tr, s64* out) {
+  int16x4_t columns[3];
+  for (u32 c = 0; c < 3; ++c) {
+    const s16 column[4] = { mat[c], mat[3 + c], mat[6 + c], 0 };
+    columns[c] = vld1_s16(column);
+  }
+
+  const s64 tr_shifted[2] = { (s64)tr[0] << 12, (s64)tr[1] << 12 };
+  const int64x2_t tr_xy = vld1q_s64(tr_shifted);
+  const int64x2_t tr_z = vdupq_n_s64((s64)tr[2] << 12);
+
+  for (u32 v = 0; v < RTPT_VERTICES; ++v) {
+    const s16* vertex = vertices + v * 3;
+    int64x2_t xy = tr_xy;
+    int64x2_t z = tr_z;
+    for (u32 c = 0; c < 3; ++c) {
+      const int32x4_t products = vmull_n_s16(columns[c], vertex[c]);
+      xy = vaddw_s32(xy, vget_low_s32(products));
+      z = vaddw_s32(z, vget_high_s32(products));
+    }
+    vst1q_s64(out + v * 3, xy);
+    out[v * 3 + 2] = vgetq_lane_s64(z, 0);
+  }
+}
+
+constexpr GteKernels NEON_KERNELS = { "NEON", transform3_neon };
+
+}  // namespace
+
+const GteKernels* gte_kernels_neon() {
+  return &NEON_KERNELS;
+}
+
+}  // namespace gte
+}  // namespace cpu
+
+#else
+
+namespace cpu {
+namespace gte {
+
+const GteKernels* gte_kernels_neon() {
+  return nullptr;
+}
+
+}  // namespace gte
+}  // namespace cpu
+
+#endif
@@ -0,0 +1,63 @@
+#include <cpu/gte_kernels.hpp>
+
+#if GTE_KERNELS_X86
+
+#include <immintrin.h>
+
+// Kernels are compiled for their instruction set through function attributes, see
+// renderer/span_kernels_x86.cpp
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+
+namespace cpu {
+namespace gte {
+
+namespace {
+
+// Each product of 16 bit values fits in 32 bits, their sums are widened to 64
+TARGET_SSE41 void transform3_sse41(const s16* mat, const s16* vertices, const s32* tr, s64* out) {
+  __m128i columns[3];
+  for (u32 c = 0; c < 3; ++c)
+    columns[c] = _mm_setr_epi32(mat[c], mat[3 + c], mat[6 + c], 0);
+
+  const __m128i tr_xy = _mm_set_epi64x((s64)tr[1] << 12, (s64)tr[0] << 12);
+  const __m128i tr_z = _mm_set_epi64x(0, (s64)tr[2] << 12);
+
+  for (u32 v = 0; v < RTPT_VERTICES; ++v) {
+    const s16* vertex = vertices + v * 3;
+    __m128i xy = tr_xy;
+    __m128i z = tr_z;
+    for (u32 c = 0; c < 3; ++c) {
+      const __m128i products = _mm_mullo_epi32(columns[c], _mm_set1_epi32(vertex[c]));
+      xy = _mm_add_epi64(xy, _mm_cvtepi32_epi64(products));
+      z = _mm_add_epi64(z, _mm_cvtepi32_epi64(_mm_srli_si128(products, 8)));
+    }
+    _mm_storeu_si128((__m128i*)(out + v * 3), xy);
+    _mm_storel_epi64((__m128i*)(out + v * 3 + 2), z);
+  }
+}
+
+constexpr GteKernels SSE41_KERNELS = { "SSE4.1", transform3_sse41 };
+
+}  // namespace
+
+const GteKernels* gte_kernels_sse41() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.1") ? &SSE41_KERNELS : nullptr;
+}
+
+}  // namespace gte
+}  // namespace cpu
+
+#else
+
+namespace cpu {
+namespace gte {
+
+const GteKernels* gte_kernels_sse41() {
+  return nullptr;
+}
+
+}  // namespace gte
+}  // namespace cpu
+
+#endif
@@ -0,0 +1,186 @@
+#include <cpu/idle_loop.hpp>
+
+#include <cpu/block_cache.hpp>
+#include <cpu/instruction.hpp>
+#include <cpu/opcode.hpp>
+#include <memory/map.hpp>
+
+namespace cpu {
+
+namespace {
+
+struct RegisterUsage {
+  RegisterIndex reads[2]{};  // 0 if unused ($zero can always be read)
+  RegisterIndex write{};     // 0 if none
+  bool is_load{};            // The write only becomes visible after the load delay slot
+  bool is_allowed{};
+};
+
+RegisterUsage register_usage(const Instruction& i) {
+  switch (i.opcode()) {
+    // Loads (LWL/LWR merge with the old register value, which is carried over)
+    case Opcode::LB:
+    case Opcode::LBU:
+    case Opcode::LH:
+    case Opcode::LHU:
+    case Opcode::LW: return { { i.rs(), 0 }, i.rt(), true, true };
+    // ALU with immediate (ADDI is left out, an overflow exception isn't side-effect free)
+    case Opcode::ADDIU:
+    case Opcode::ANDI:
+    case Opcode::ORI:
+    case Opcode::XORI:
+    case Opcode::SLTI:
+    case Opcode::SLTIU: return { { i.rs(), 0 }, i.rt(), false, true };
+    case Opcode::LUI: return { { 0, 0 }, i.rt(), false, true };
+    // ALU with registers
+    case Opcode::ADDU:
+    case Opcode::SUBU:
+    case Opcode::AND:
+    case Opcode::OR:
+    case Opcode::XOR:
+    case Opcode::NOR:
+    case Opcode::SLT:
+    case Opcode::SLTU:
+    case Opcode::SLLV:
+    case Opcode::SRLV:
+    case Opcode::SRAV: return { { i.rs(), i.rt() }, i.rd(), false, true };
+    case Opcode::SLL:
+    case Opcode::SRL:
+    case Opcode::SRA: return { { i.rt(), 0 }, i.rd(), false, true };
+    // Branches (linking ones write $ra)
+    case Opcode::BEQ:
+    case Opcode::BNE: return { { i.rs(), i.rt() }, 0, false, true };
+    case Opcode::BGTZ:
+    case Opcode::BLEZ: return { { i.rs(), 0 }, 0, false, true };
+    case Opcode::BCONDZ: return { { i.rs(), 0 }, 0, false, (i.rt() & 0x1E) != 0x10 };
+    case Opcode::J: return { { 0, 0 }, 0, false, true };
+    default: return {};
+  }
+}
+
+// Value written by an ALU instruction of register_usage()
+u32 alu_result(const Instruction& i, u32 rs, u32 rt) {
+  switch (i.opcode()) {
+    case Opcode::ADDIU: return rs + (u32)i.imm16_se();
+    case Opcode::ANDI: return rs & i.imm16();
+    case Opcode::ORI: return rs | i.imm16();
+    case Opcode::XORI: return rs ^ i.imm16();
+    case Opcode::SLTI: return (s32)rs < (s32)i.imm16_se() ? 1 : 0;
+    case Opcode::SLTIU: return rs < (u32)i.imm16_se() ? 1 : 0;
+    case Opcode::LUI: return i.imm16() << 16;
+    case Opcode::ADDU: return rs + rt;
+    case Opcode::SUBU: return rs - rt;
+    case Opcode::AND: return rs & rt;
+    case Opcode::OR: return rs | rt;
+    case Opcode::XOR: return rs ^ rt;
+    case Opcode::NOR: return ~(rs | rt);
+    case Opcode::SLT: return (s32)rs < (s32)rt ? 1 : 0;
+    case Opcode::SLTU: return rs < rt ? 1 : 0;
+    case Opcode::SLLV: return rt << (rs & 0x1F);
+    case Opcode::SRLV: return rt >> (rs & 0x1F);
+    case Opcode::SRAV: return (u32)((s32)rt >> (rs & 0x1F));
+    case Opcode::SLL: return rt << i.imm5();
+    case Opcode::SRL: return rt >> i.imm5();
+    case Opcode::SRA: return (u32)((s32)rt >> i.imm5());
+    default: return 0;
+  }
+}
+
+u32 load_size(const Instruction& i) {
+  switch (i.opcode()) {
+    case Opcode::LW: return 4;
+    case Opcode::LH:
+    case Opcode::LHU: return 2;
+    default: return 1;
+  }
+}
+
+// Misaligned loads raise an exception
+bool is_side_effect_free_load(address addr, u32 size) {
+  if (addr % size != 0)
+    return false;
+
+  const address phys = memory::mask_region(addr);
+  const auto is_in = [phys](const memory::Range& range) {
+    return phys - range.start() < range.size();
+  };
+  constexpr address GPUSTAT = memory::map::GPU.start() + 4;  // GPUREAD pops the VRAM transfer
+  return is_in(memory::map::RAM_MIRRORS) || is_in(memory::map::SCRATCHPAD) ||
+         is_in(memory::map::BIOS) || is_in(memory::map::IRQ_CONTROL) ||
+         (phys >= GPUSTAT && phys < GPUSTAT + 4);
+}
+
+}  // namespace
+
+bool is_idle_loop(const BasicBlock& block) {
+  const auto length = block.instructions.size();
+  if (length < 2 || length > IDLE_LOOP_MAX_LENGTH)
+    return false;
+
+  // Registers written anywhere in the loop
+  u32 loop_writes = 0;
+  for (const auto& instr : block.instructions) {
+    const auto usage = register_usage(instr);
+    if (!usage.is_allowed)
+      return false;
+    loop_writes |= 1u << usage.write;
+  }
+  loop_writes &= ~1u;  // $zero
+
+  // A register written by the loop must be written in the current iteration before it's read, otherwise
+  // its value is carried over from the previous one
+  u32 written = 0;
+  u32 pending_load = 0;
+  for (const auto& instr : block.instructions) {
+    const auto usage = register_usage(instr);
+
+    for (const auto reg : usage.reads) {
+      const u32 mask = 1u << reg;
+      if ((loop_writes & mask) != 0 && (written & mask) == 0)
+        return false;
+    }
+
+    written |= pending_load;
+    pending_load = 0;
+    if (usage.is_load)
+      pending_load = 1u << usage.write;
+    else
+      written |= 1u << usage.write;
+  }
+
+  return true;
+}
+
+bool has_side_effect_free_loads(const BasicBlock& block, const std::array<u32, 32>& gpr) {
+  // Values of the current iteration, the ones of loaded registers aren't known
+  std::array<u32, 32> values = gpr;
+  u32 known = ~0u;
+  u32 pending_load = 0;  // Still lands after the load delay slot
+
+  for (const auto& instr : block.instructions) {
+    const auto usage = register_usage(instr);
+    const u32 read_mask = (1u << usage.reads[0]) | (1u << usage.reads[1]);
+    const bool is_known = (known & read_mask) == read_mask;
+    const u32 write_mask = 1u << usage.write;
+
+    if (usage.is_load) {
+      const address addr = values[instr.rs()] + (u32)instr.imm16_se();
+      if (!is_known || !is_side_effect_free_load(addr, load_size(instr)))
+        return false;
+      known &= ~write_mask;
+    } else if (is_known) {
+      values[usage.write] = alu_result(instr, values[instr.rs()], values[instr.rt()]);
+      known |= write_mask;
+    } else {
+      known &= ~write_mask;
+    }
+
+    known &= ~pending_load;
+    pending_load = usage.is_load ? write_mask : 0;
+    values[0] = 0;
+    known |= 1u;  // $zero
+  }
+  return true;
+}
+
+}  // namespace cpu
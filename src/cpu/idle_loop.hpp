@@ -0,0 +1,27 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <array>
+
+namespace cpu {
+
+struct BasicBlock;
+
+// Longest loop (including the branch delay slot) that is considered for idle loop detection
+constexpr u32 IDLE_LOOP_MAX_LENGTH = 8;
+
+// Whether the block, taken as a loop from its last branch back to its start, only polls memory. That is
+// the case if it doesn't store, doesn't touch COP0/COP2 and doesn't carry any register value from one
+// iteration to the next: every iteration then leaves the CPU in the same state, and running it again
+// before a device had a chance to change memory is pointless.
+bool is_idle_loop(const BasicBlock& block);
+
+// Whether the loads of an idle loop (see is_idle_loop()) read without side effects, with the registers
+// as the loop is entered. The registers a load reads its address from are either left alone by the loop
+// or computed within each iteration, so its address is known unless it depends on a loaded value. Only
+// memory and the ports that don't change by being read qualify, the CD-ROM, joypad and SIO FIFOs pop an
+// entry on every read and the timer counters move on with every cycle.
+bool has_side_effect_free_loads(const BasicBlock& block, const std::array<u32, 32>& gpr);
+
+}  // namespace cpu
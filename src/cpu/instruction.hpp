@@ -3,7 +3,7 @@
 #include <cpu/opcode.hpp>
 #include <util/types.hpp>
 
-#include <array>
+#include <type_traits>
 
 #define OPERAND_NONE 0     // No operand
 #define OPERAND_RS 1       // Register source
@@ -23,9 +23,13 @@ namespace cpu {
 using Register = u32;
 using RegisterIndex = u8;
 
+// Decoded instruction, as used by the interpreter and stored in the block cache. The register fields are
+// extracted once at decode time, immediates are a single mask of the word away. Operand information is
+// left to the disassembler (see cpu/disassembler.hpp).
 class Instruction {
  public:
-  explicit Instruction(u32 word);
+  explicit Instruction(u32 word)
+      : m_word(word), m_opcode(decode(word)), m_rs(field_rs()), m_rt(field_rt()), m_rd(field_rd()) {}
 
   // Primary opcode field [31:26]
   constexpr u8 op_prim() const { return (m_word & 0b11111100'00000000'00000000'00000000) >> 26; }
@@ -36,11 +40,11 @@ class Instruction {
   // Co-processor 0 secondary opcode field [5:0]
   constexpr u8 op_cop0_sec() const { return (m_word & 0b00000000'00000000'00000000'00111111) >> 0; }
   // Register source field [25:21]
-  constexpr RegisterIndex rs() const { return (m_word & 0b00000011'11100000'00000000'00000000) >> 21; }
+  constexpr RegisterIndex rs() const { return m_rs; }
   // Register target field [20:16]
-  constexpr RegisterIndex rt() const { return (m_word & 0b00000000'00011111'00000000'00000000) >> 16; }
+  constexpr RegisterIndex rt() const { return m_rt; }
   // Register destination field [15:11]
-  constexpr RegisterIndex rd() const { return (m_word & 0b00000000'00000000'11111000'00000000) >> 11; }
+  constexpr RegisterIndex rd() const { return m_rd; }
   // Immediate 5 field [10:6]
   constexpr u8 imm5() const { return (m_word & 0b00000000'00000000'00000111'11000000) >> 6; }
   // Immediate 16 field [16:0]
@@ -54,22 +58,36 @@ class Instruction {
   // Immediate 26 field [26:0]
   constexpr u32 imm26() const { return (m_word & 0b00000011'11111111'11111111'11111111) >> 0; }
 
-  constexpr bool is_cop2_cmd() const {
-    return (m_word & 0b11111110'00000000'00000000'00000000) >> 25 == 0b0100101;
-  }
+  constexpr bool is_cop2_cmd() const { return is_cop2_cmd(m_word); }
 
   constexpr Opcode opcode() const { return m_opcode; }
   constexpr u32 word() const { return m_word; }
 
-  std::string disassemble() const;
-
  private:
-  Opcode decode();
+  static constexpr bool is_cop2_cmd(u32 word) {
+    return (word & 0b11111110'00000000'00000000'00000000) >> 25 == 0b0100101;
+  }
+  static Opcode decode(u32 word);
+
+  constexpr RegisterIndex field_rs() const {
+    return (m_word & 0b00000011'11100000'00000000'00000000) >> 21;
+  }
+  constexpr RegisterIndex field_rt() const {
+    return (m_word & 0b00000000'00011111'00000000'00000000) >> 16;
+  }
+  constexpr RegisterIndex field_rd() const {
+    return (m_word & 0b00000000'00000000'11111000'00000000) >> 11;
+  }
 
  private:
-  const u32 m_word;
-  const Opcode m_opcode;
-  std::array<u16, 3> m_operands;  //  bitfield of enum Operand
+  u32 m_word;
+  Opcode m_opcode;
+  RegisterIndex m_rs;
+  RegisterIndex m_rt;
+  RegisterIndex m_rd;
 };
 
+static_assert(sizeof(Instruction) == 8, "Instruction should fit in a register");
+static_assert(std::is_trivially_copyable<Instruction>::value, "Instructions are copied around freely");
+
 }  // namespace cpu
@@ -3,6 +3,7 @@
 #include <cpu/cpu.hpp>
 
 #include <util/log.hpp>
+#include <util/state_stream.hpp>
 
 namespace cpu {
 
@@ -10,6 +11,7 @@ void Interrupts::update_cop0() {
   const bool is_interrupt_pending = (m_imask.word & m_istat.word);
 
   m_cpu->m_cop0_cause.interrupt_pending = is_interrupt_pending ? 0b100 : 0b0;
+  m_cpu->update_irq_line();
 }
 
 bool Interrupts::check() const {
@@ -22,15 +24,16 @@ bool Interrupts::check() const {
   return are_interrupts_enabled && are_active_interrupts;
 }
 
-void Interrupts::check_and_trigger() const {
-  if (check())
-    m_cpu->trigger_exception(ExceptionCause::Interrupt);
-}
-
 void Interrupts::trigger(IrqType irq) {
   m_istat.word |= (1 << static_cast<u16>(irq));
 
   update_cop0();
 }
 
+void Interrupts::serialize(util::StateStream& s) {
+  s.section("IRQ ");
+  s.value(m_istat);
+  s.value(m_imask);
+}
+
 }  // namespace cpu
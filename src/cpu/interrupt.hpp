@@ -3,6 +3,10 @@
 #include <memory/addressable.hpp>
 #include <util/types.hpp>
 
+namespace util {
+class StateStream;
+}
+
 namespace cpu {
 
 class Cpu;
@@ -44,9 +48,10 @@ class Interrupts {
   void init(cpu::Cpu* cpu) { m_cpu = cpu; }
 
   bool check() const;
+  // Mirrors I_STAT & I_MASK into CAUSE and the CPU's cached IRQ line
   void update_cop0();
-  void check_and_trigger() const;
   void trigger(IrqType irq);
+  void serialize(util::StateStream& s);
 
   template <typename ValueType>
   ValueType read(address addr_rebased) const {
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <util/types.hpp>
+
 namespace cpu {
 
-enum class Opcode {
+enum class Opcode : u8 {
 #define OPCODE(mnemonic, opcode, operand1, operand2, operand3) mnemonic,
 #include <cpu/opcodes.def>
 #undef OPCODE
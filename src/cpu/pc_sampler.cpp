@@ -0,0 +1,130 @@
+#include <cpu/pc_sampler.hpp>
+
+#include <bios/functions.hpp>
+#include <memory/map.hpp>
+#include <util/log.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace cpu {
+
+namespace {
+
+// Where the kernel keeps the jump table of each BIOS function call vector
+struct KernelTable {
+  const bios::FunctionTable& functions;
+  address ram_offset;
+  u32 entry_count;
+  const char* vector;
+};
+
+const KernelTable KERNEL_TABLES[] = {
+  { bios::A0, 0x200, 0xC0, "A" },
+  { bios::B0, 0x874, 0x80, "B" },
+  { bios::C0, 0x674, 0x20, "C" },
+};
+
+}  // namespace
+
+bool SymbolMap::load(const fs::path& path) {
+  std::ifstream file(path);
+  if (!file) {
+    LOG_ERROR("Could not open symbol map {}", path.string());
+    return false;
+  }
+
+  std::string line;
+  u32 symbol_count = 0;
+  for (u32 line_number = 1; std::getline(file, line); ++line_number) {
+    std::istringstream fields(line);
+    std::string addr_text, name;
+    if (!(fields >> addr_text) || addr_text[0] == '#' || addr_text[0] == ';')
+      continue;
+
+    char* end = nullptr;
+    const address addr = (address)std::strtoul(addr_text.c_str(), &end, 16);
+    std::getline(fields >> std::ws, name);
+    if (*end != '\0' || name.empty()) {
+      LOG_ERROR("Invalid symbol map line {}: {}", line_number, line);
+      return false;
+    }
+    add(addr, name);
+    ++symbol_count;
+  }
+
+  LOG_INFO("Loaded {} symbols from {}", symbol_count, path.string());
+  return true;
+}
+
+void SymbolMap::add_bios_functions(const u8* ram) {
+  for (const auto& table : KERNEL_TABLES) {
+    for (u32 number = 0; number < table.entry_count; ++number) {
+      const char* name = table.functions[number].name;
+      u32 target;
+      std::memcpy(&target, ram + table.ram_offset + number * 4, sizeof(target));
+      if (name != nullptr && target != 0)
+        add(target, fmt::format("{}({:02X}h) {}", table.vector, number, name));
+    }
+  }
+}
+
+void SymbolMap::add(address addr, std::string name) {
+  const address masked = memory::mask_region(addr);
+  const auto it = std::upper_bound(m_symbols.begin(), m_symbols.end(), masked,
+                                   [](address a, const Symbol& symbol) { return a < symbol.addr; });
+  m_symbols.insert(it, { masked, std::move(name) });
+}
+
+const Symbol* SymbolMap::lookup(address addr) const {
+  const auto it = std::upper_bound(m_symbols.begin(), m_symbols.end(), addr,
+                                   [](address a, const Symbol& symbol) { return a < symbol.addr; });
+  if (it == m_symbols.begin())
+    return nullptr;
+  const Symbol& symbol = *std::prev(it);
+  return addr - symbol.addr < MAX_SYMBOL_SIZE ? &symbol : nullptr;
+}
+
+std::vector<HotSpot> hot_spots(const PcSampler& sampler,
+                               std::initializer_list<const SymbolMap*> maps,
+                               bool by_symbol,
+                               size_t count) {
+  std::unordered_map<address, HotSpot> spots;
+  for (const auto& [pc, samples] : sampler.samples()) {
+    const Symbol* symbol = nullptr;
+    for (const SymbolMap* map : maps) {
+      const Symbol* candidate = map->lookup(pc);
+      if (candidate != nullptr && (symbol == nullptr || candidate->addr >= symbol->addr))
+        symbol = candidate;
+    }
+
+    if (by_symbol && symbol != nullptr) {
+      const HotSpot empty_spot{ symbol->addr, symbol->name, 0 };
+      spots.try_emplace(symbol->addr, empty_spot).first->second.samples += samples;
+    } else {
+      std::string name;
+      if (symbol != nullptr && pc == symbol->addr)
+        name = symbol->name;
+      else if (symbol != nullptr)
+        name = fmt::format("{}+0x{:X}", symbol->name, pc - symbol->addr);
+      spots.try_emplace(pc, HotSpot{ pc, std::move(name), samples });
+    }
+  }
+
+  std::vector<HotSpot> sorted;
+  sorted.reserve(spots.size());
+  for (auto& [addr, spot] : spots)
+    sorted.push_back(std::move(spot));
+  const auto hotter = [](const HotSpot& a, const HotSpot& b) {
+    return a.samples != b.samples ? a.samples > b.samples : a.addr < b.addr;
+  };
+  const size_t kept = std::min(count, sorted.size());
+  std::partial_sort(sorted.begin(), sorted.begin() + kept, sorted.end(), hotter);
+  sorted.resize(kept);
+  return sorted;
+}
+
+}  // namespace cpu
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <util/fs.hpp>
+#include <util/types.hpp>
+
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cpu {
+
+// Instructions between two samples of the guest PC, prime so that it doesn't keep in step with a loop
+constexpr u32 PC_SAMPLE_INTERVAL = 1009;
+// How far past its address a symbol is assumed to reach at most, the rest is left unsymbolised
+constexpr u32 MAX_SYMBOL_SIZE = 0x4000;
+
+// Histogram of where the guest spends its instructions, fed by the CPU every PC_SAMPLE_INTERVAL
+// instructions while Settings::sample_guest_pc is on. PCs are physical (see memory::mask_region()).
+class PcSampler {
+ public:
+  void add(address pc) {
+    ++m_samples[pc];
+    ++m_sample_count;
+  }
+  void clear() {
+    m_samples.clear();
+    m_sample_count = 0;
+  }
+
+  u64 sample_count() const { return m_sample_count; }
+  const std::unordered_map<address, u64>& samples() const { return m_samples; }
+
+ private:
+  std::unordered_map<address, u64> m_samples;
+  u64 m_sample_count{};
+};
+
+struct Symbol {
+  address addr;  // Physical
+  std::string name;
+};
+
+// Names of guest code, looked up by the closest symbol at or before an address
+class SymbolMap {
+ public:
+  // One "<hex address> <name>" per line, as in no$psx .sym files. Lines starting with '#' or ';' are
+  // comments. Adds to the symbols already there.
+  bool load(const fs::path& path);
+  // The BIOS functions that the kernel's A0h, B0h and C0h tables in RAM point to, all zeroes before the
+  // kernel has set them up
+  void add_bios_functions(const u8* ram);
+  void add(address addr, std::string name);
+  void clear() { m_symbols.clear(); }
+
+  size_t size() const { return m_symbols.size(); }
+  // nullptr if no symbol reaches addr
+  const Symbol* lookup(address addr) const;
+
+ private:
+  std::vector<Symbol> m_symbols;  // Sorted by address
+};
+
+struct HotSpot {
+  address addr;      // The symbol's if there is one, the PC's otherwise
+  std::string name;  // Empty without a symbol
+  u64 samples;
+};
+
+// The count most sampled symbols, or PCs where no map has a symbol, hottest first. by_symbol sums the
+// PCs under each symbol, otherwise each PC is a hot spot of its own named after its offset in the
+// symbol. The closest symbol of any map wins, the later map's on a tie.
+std::vector<HotSpot> hot_spots(const PcSampler& sampler,
+                               std::initializer_list<const SymbolMap*> maps,
+                               bool by_symbol,
+                               size_t count);
+
+}  // namespace cpu
@@ -0,0 +1,411 @@
+#include <cpu/recompiler.hpp>
+
+#include <cpu/block_cache.hpp>
+#include <cpu/cpu.hpp>
+#include <cpu/delay_analysis.hpp>
+#include <cpu/opcode.hpp>
+#include <cpu/x64_emitter.hpp>
+#include <emulator/scheduler.hpp>
+#include <util/log.hpp>
+
+#include <vector>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define RECOMPILER_SUPPORTED 1
+#include <sys/mman.h>
+#else
+#define RECOMPILER_SUPPORTED 0
+#endif
+
+namespace cpu {
+
+namespace {
+
+// Addressing of a field of the object the host register points to
+x64::Mem field_of(x64::Reg base_reg, const void* base, const void* field) {
+  return { base_reg, (s32)(static_cast<const u8*>(field) - static_cast<const u8*>(base)) };
+}
+
+}  // namespace
+
+Recompiler::Recompiler(Cpu& cpu, BlockCache& block_cache) : m_cpu(cpu), m_block_cache(block_cache) {
+#if RECOMPILER_SUPPORTED
+  void* buf = mmap(nullptr, RECOMPILER_CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED)
+    LOG_ERROR("Unable to allocate the recompiler code buffer, falling back to the interpreter");
+  else
+    m_code_buffer = static_cast<u8*>(buf);
+#endif
+}
+
+Recompiler::~Recompiler() {
+#if RECOMPILER_SUPPORTED
+  if (m_code_buffer != nullptr)
+    munmap(m_code_buffer, RECOMPILER_CODE_BUFFER_SIZE);
+#endif
+}
+
+u32 Recompiler::execute(const BasicBlock& block) {
+  const u8* native_code = m_block_cache.native_code(block);
+  if (native_code == nullptr && !compile(block))
+    return 0;
+
+  return reinterpret_cast<BlockFunction>(m_block_cache.native_code(block))(&m_cpu);
+}
+
+void Recompiler::flush() {
+  m_code_buffer_used = 0;
+  m_block_cache.clear();
+}
+
+bool Recompiler::compile(const BasicBlock& block) {
+  if (!is_supported())
+    return false;
+
+  // Stop before invalid instructions, the interpreter raises the exception for them
+  u32 instr_count = 0;
+  while (instr_count < block.instructions.size() &&
+         block.instructions[instr_count].opcode() != Opcode::INVALID)
+    ++instr_count;
+
+  if (instr_count == 0)
+    return false;
+
+  using x64::Reg;
+  x64::Emitter e(m_code_buffer + m_code_buffer_used, RECOMPILER_CODE_BUFFER_SIZE - m_code_buffer_used);
+
+  // Prologue: RBX holds the Cpu, R12 the per-instruction helper of the current step variant and R13 the
+  // scheduler. The three pushes keep the stack 16-byte aligned for the calls below.
+  e.push(Reg::RBX);
+  e.push(Reg::R12);
+  e.push(Reg::R13);
+  e.mov(Reg::RBX, Reg::RDI);
+  e.mov_imm64(Reg::R12, reinterpret_cast<u64>(m_cpu.m_block_instruction_fn));
+  e.mov_imm64(Reg::R13, reinterpret_cast<u64>(&m_cpu.m_scheduler));
+
+  // The tracing variants do more for each instruction than the native code does
+  const bool is_native_allowed = (m_cpu.m_step_features & (StepTrace | StepBiosCalls)) == 0;
+  bool is_irq_checked = false;
+
+  std::vector<u8*> exits;
+  std::vector<NativeExit> native_exits;
+  exits.reserve(instr_count);
+
+  for (u32 i = 0; i < instr_count; ++i) {
+    if (is_native_allowed && compile_native(e, block, i, is_irq_checked, native_exits))
+      continue;
+    is_irq_checked = false;
+
+    // status = execute_block_instruction(cpu, &block, i)
+    e.mov(Reg::RDI, Reg::RBX);
+    e.mov_imm64(Reg::RSI, reinterpret_cast<u64>(&block));
+    e.mov_imm32(Reg::RDX, i);
+    e.call(Reg::R12);
+
+    // Leave the block with "instructions executed so far" in EAX unless we can keep going
+    e.cmp_al_imm8(ExecutedAndContinue);
+    u8* next_instr = e.je_rel8();
+    e.movzx_eax_al();
+    e.add_eax_imm32(i);
+    exits.push_back(e.jmp_rel32());
+    e.patch_rel8(next_instr, e.cursor());
+  }
+  e.mov_imm32(Reg::RAX, instr_count);
+
+  // Epilogue
+  const u8* epilogue = e.cursor();
+  for (auto exit : exits)
+    e.patch_rel32(exit, epilogue);
+  e.pop(Reg::R13);
+  e.pop(Reg::R12);
+  e.pop(Reg::RBX);
+  e.ret();
+
+  // Out of the way of the straight-line path, the exits of the native code set EAX themselves
+  for (const auto& exit : native_exits) {
+    e.patch_rel32(exit.jump, e.cursor());
+    e.mov_imm32(Reg::RAX, exit.executed_count);
+    e.patch_rel32(e.jmp_rel32(), epilogue);
+  }
+
+  if (e.overflowed()) {
+    LOG_DEBUG("Recompiler code buffer full, flushing");
+    flush();  // Note: this frees the block, the caller has to look it up again
+    return false;
+  }
+
+  m_block_cache.native_code(block) = m_code_buffer + m_code_buffer_used;
+  m_code_buffer_used += e.size();
+  return true;
+}
+
+bool Recompiler::compile_native(x64::Emitter& e,
+                                const BasicBlock& block,
+                                u32 index,
+                                bool& is_irq_checked,
+                                std::vector<NativeExit>& exits) {
+  using x64::AluOp;
+  using x64::Cond;
+  using x64::Mem;
+  using x64::Reg;
+  using x64::ShiftOp;
+
+  // The branch delay flags are only saved and reset by the interpreter
+  const u8 delay_tracking = block.delay_tracking[index];
+  if (delay_tracking & TrackBranchDelay)
+    return false;
+
+  const Instruction& instr = block.instructions[index];
+  const Opcode op = instr.opcode();
+  const bool is_load =
+      op == Opcode::LB || op == Opcode::LBU || op == Opcode::LH || op == Opcode::LHU || op == Opcode::LW;
+  const bool is_store = op == Opcode::SB || op == Opcode::SH || op == Opcode::SW;
+
+  // Register written by the ALU ops, none for MTHI and MTLO
+  RegisterIndex dst = 0;
+  switch (op) {
+    case Opcode::ADDIU:
+    case Opcode::SLTI:
+    case Opcode::SLTIU:
+    case Opcode::ANDI:
+    case Opcode::ORI:
+    case Opcode::XORI:
+    case Opcode::LUI: dst = instr.rt(); break;
+    case Opcode::ADDU:
+    case Opcode::SUBU:
+    case Opcode::AND:
+    case Opcode::OR:
+    case Opcode::XOR:
+    case Opcode::NOR:
+    case Opcode::SLT:
+    case Opcode::SLTU:
+    case Opcode::SLL:
+    case Opcode::SRL:
+    case Opcode::SRA:
+    case Opcode::SLLV:
+    case Opcode::SRLV:
+    case Opcode::SRAV:
+    case Opcode::MFHI:
+    case Opcode::MFLO: dst = instr.rd(); break;
+    case Opcode::MTHI:
+    case Opcode::MTLO: break;
+    default:
+      if (!is_load && !is_store)
+        return false;
+      break;
+  }
+
+  const auto cpu_field = [this](const void* field) { return field_of(Reg::RBX, &m_cpu, field); };
+  const auto scheduler_field = [this](const void* field) {
+    return field_of(Reg::R13, &m_cpu.m_scheduler, field);
+  };
+  const auto gpr = [&](RegisterIndex reg) { return cpu_field(&m_cpu.m_gpr[reg]); };
+  const auto exit_if = [&](Cond cond, u32 executed_count) {
+    exits.push_back({ e.jcc_rel32(cond), executed_count });
+  };
+
+  // Cpu::begin_instruction(), a pending interrupt is left for the interpreter or the next block to take
+  if (!is_irq_checked) {
+    e.cmp8_imm(cpu_field(&m_cpu.m_irq_asserted), 0);
+    exit_if(Cond::NE, index);
+  }
+  e.load32(Reg::RAX, cpu_field(&m_cpu.m_pc));
+  e.store32(cpu_field(&m_cpu.m_pc_current), Reg::RAX);
+
+  // Cpu::set_pc(m_pc_next) and Scheduler::add_cycles()
+  e.load32(Reg::RAX, cpu_field(&m_cpu.m_pc_next));
+  e.store32(cpu_field(&m_cpu.m_pc), Reg::RAX);
+  e.alu32_imm(AluOp::Add, Reg::RAX, 4);
+  e.store32(cpu_field(&m_cpu.m_pc_next), Reg::RAX);
+  e.add64_imm(scheduler_field(&m_cpu.m_scheduler.m_slice_elapsed), SYSTEM_CYCLES_PER_INSTRUCTION);
+
+  const u32 imm_se = (u32)(s32)instr.imm16_se();
+  const ShiftOp shift_op = (op == Opcode::SLL || op == Opcode::SLLV)   ? ShiftOp::Shl
+                           : (op == Opcode::SRL || op == Opcode::SRLV) ? ShiftOp::Shr
+                                                                       : ShiftOp::Sar;
+  if (is_load || is_store) {
+    e.load32(Reg::RSI, gpr(instr.rs()));
+    e.alu32_imm(AluOp::Add, Reg::RSI, imm_se);
+    e.mov(Reg::RDI, Reg::RBX);
+    if (is_load) {
+      e.mov_imm32(Reg::RDX, instr.rt());
+      switch (op) {
+        case Opcode::LB: e.mov_imm64(Reg::RAX, reinterpret_cast<u64>(&Recompiler::load<s8>)); break;
+        case Opcode::LBU: e.mov_imm64(Reg::RAX, reinterpret_cast<u64>(&Recompiler::load<u8>)); break;
+        case Opcode::LH: e.mov_imm64(Reg::RAX, reinterpret_cast<u64>(&Recompiler::load<s16>)); break;
+        case Opcode::LHU: e.mov_imm64(Reg::RAX, reinterpret_cast<u64>(&Recompiler::load<u16>)); break;
+        default: e.mov_imm64(Reg::RAX, reinterpret_cast<u64>(&Recompiler::load<u32>)); break;
+      }
+    } else {
+      e.load32(Reg::RDX, gpr(instr.rt()));
+      e.mov_imm64(Reg::RCX, reinterpret_cast<u64>(&block));
+      switch (op) {
+        case Opcode::SB: e.mov_imm64(Reg::RAX, reinterpret_cast<u64>(&Recompiler::store<u8>)); break;
+        case Opcode::SH: e.mov_imm64(Reg::RAX, reinterpret_cast<u64>(&Recompiler::store<u16>)); break;
+        default: e.mov_imm64(Reg::RAX, reinterpret_cast<u64>(&Recompiler::store<u32>)); break;
+      }
+    }
+    e.call(Reg::RAX);
+    // Kept in EDX through the load delay update
+    e.movzx_eax_al();
+    e.mov32(Reg::RDX, Reg::RAX);
+  } else {
+    switch (op) {
+      case Opcode::ADDU:
+      case Opcode::SUBU:
+      case Opcode::AND:
+      case Opcode::OR:
+      case Opcode::XOR:
+      case Opcode::NOR:
+      case Opcode::SLT:
+      case Opcode::SLTU: {
+        static constexpr AluOp ALU_OPS[] = { AluOp::Add, AluOp::Sub, AluOp::And, AluOp::Or,
+                                             AluOp::Xor, AluOp::Or,  AluOp::Cmp, AluOp::Cmp };
+        const size_t op_index = op == Opcode::ADDU  ? 0
+                                : op == Opcode::SUBU ? 1
+                                : op == Opcode::AND  ? 2
+                                : op == Opcode::OR   ? 3
+                                : op == Opcode::XOR  ? 4
+                                : op == Opcode::NOR  ? 5
+                                : op == Opcode::SLT  ? 6
+                                                     : 7;
+        e.load32(Reg::RAX, gpr(instr.rs()));
+        e.alu32(ALU_OPS[op_index], Reg::RAX, gpr(instr.rt()));
+        if (op == Opcode::NOR)
+          e.not32(Reg::RAX);
+        else if (op == Opcode::SLT || op == Opcode::SLTU)
+          e.setcc_zx(op == Opcode::SLT ? Cond::L : Cond::B, Reg::RAX);
+        break;
+      }
+      case Opcode::SLL:
+      case Opcode::SRL:
+      case Opcode::SRA:
+        e.load32(Reg::RAX, gpr(instr.rt()));
+        e.shift32_imm(shift_op, Reg::RAX, instr.imm5());
+        break;
+      case Opcode::SLLV:
+      case Opcode::SRLV:
+      case Opcode::SRAV:
+        // x86 masks the shift amount to 5 bits too
+        e.load32(Reg::RCX, gpr(instr.rs()));
+        e.load32(Reg::RAX, gpr(instr.rt()));
+        e.shift32_cl(shift_op, Reg::RAX);
+        break;
+      case Opcode::ADDIU:
+        e.load32(Reg::RAX, gpr(instr.rs()));
+        e.alu32_imm(AluOp::Add, Reg::RAX, imm_se);
+        break;
+      case Opcode::SLTI:
+      case Opcode::SLTIU:
+        e.load32(Reg::RAX, gpr(instr.rs()));
+        e.alu32_imm(AluOp::Cmp, Reg::RAX, imm_se);
+        e.setcc_zx(op == Opcode::SLTI ? Cond::L : Cond::B, Reg::RAX);
+        break;
+      case Opcode::ANDI:
+      case Opcode::ORI:
+      case Opcode::XORI:
+        e.load32(Reg::RAX, gpr(instr.rs()));
+        e.alu32_imm(op == Opcode::ANDI ? AluOp::And
+                    : op == Opcode::ORI ? AluOp::Or
+                                        : AluOp::Xor,
+                    Reg::RAX, instr.imm16());
+        break;
+      case Opcode::LUI: e.mov_imm32(Reg::RAX, (u32)instr.imm16() << 16); break;
+      case Opcode::MFHI: e.load32(Reg::RAX, cpu_field(&m_cpu.m_hi)); break;
+      case Opcode::MFLO: e.load32(Reg::RAX, cpu_field(&m_cpu.m_lo)); break;
+      case Opcode::MTHI:
+      case Opcode::MTLO:
+        e.load32(Reg::RAX, gpr(instr.rs()));
+        e.store32(cpu_field(op == Opcode::MTHI ? &m_cpu.m_hi : &m_cpu.m_lo), Reg::RAX);
+        break;
+      default: break;
+    }
+
+    // Cpu::set_rd() and set_rt(), which also drop a pending load to the register. Writes to R0 are
+    // dropped whole, there's no load to R0 to drop.
+    if (dst != 0) {
+      e.store32(gpr(dst), Reg::RAX);
+      if (delay_tracking & TrackLoadDelay) {
+        const auto slot_reg = cpu_field(&m_cpu.m_slot_current.reg);
+        e.cmp8_imm(slot_reg, dst);
+        u8* is_other_reg = e.jcc_rel8(Cond::NE);
+        e.store8_imm(slot_reg, 0);
+        e.patch_rel8(is_other_reg, e.cursor());
+      }
+    }
+  }
+
+  if (delay_tracking & TrackLoadDelay)
+    emit_pending_load(e);
+
+  // Leave the block as execute_block_instruction() does. Only memory accesses can raise an exception,
+  // write to the block or make an interrupt pending.
+  if (is_load || is_store) {
+    e.test32(Reg::RDX, Reg::RDX);
+    exit_if(Cond::E, index + 1);
+  }
+  e.load64(Reg::RAX, scheduler_field(&m_cpu.m_scheduler.m_slice_elapsed));
+  e.cmp64(Reg::RAX, scheduler_field(&m_cpu.m_scheduler.m_slice_length));
+  exit_if(Cond::AE, index + 1);
+
+  is_irq_checked = !is_load && !is_store;
+  return true;
+}
+
+void Recompiler::emit_pending_load(x64::Emitter& e) {
+  using x64::AluOp;
+  using x64::Cond;
+  using x64::Mem;
+  using x64::Reg;
+
+  const auto cpu_field = [this](const void* field) { return field_of(Reg::RBX, &m_cpu, field); };
+  const auto& current = m_cpu.m_slot_current;
+  const auto& next = m_cpu.m_slot_next;
+  // m_gpr[RCX]
+  Mem loaded_gpr = cpu_field(&m_cpu.m_gpr[0]);
+  loaded_gpr.is_indexed = true;
+  loaded_gpr.index = Reg::RCX;
+
+  // The load only lands if the register wasn't written to meanwhile, R0 is never loaded to
+  e.load8_zx(Reg::RCX, cpu_field(&current.reg));
+  e.test32(Reg::RCX, Reg::RCX);
+  u8* is_invalid = e.jcc_rel8(Cond::E);
+  e.load32(Reg::RAX, loaded_gpr);
+  e.alu32(AluOp::Cmp, Reg::RAX, cpu_field(&current.val_prev));
+  u8* is_overwritten = e.jcc_rel8(Cond::NE);
+  e.load32(Reg::RAX, cpu_field(&current.val));
+  e.store32(loaded_gpr, Reg::RAX);
+  e.patch_rel8(is_invalid, e.cursor());
+  e.patch_rel8(is_overwritten, e.cursor());
+
+  // m_slot_current = m_slot_next, then m_slot_next.invalidate()
+  e.load8_zx(Reg::RAX, cpu_field(&next.reg));
+  e.store8(cpu_field(&current.reg), Reg::RAX);
+  e.load32(Reg::RAX, cpu_field(&next.val));
+  e.store32(cpu_field(&current.val), Reg::RAX);
+  e.load32(Reg::RAX, cpu_field(&next.val_prev));
+  e.store32(cpu_field(&current.val_prev), Reg::RAX);
+  e.store8_imm(cpu_field(&next.reg), 0);
+}
+
+template <typename T>
+bool Recompiler::load(Cpu* cpu, address addr, u32 reg) {
+  const address pc = cpu->m_pc;
+  cpu->load_delayed<T>(addr, (RegisterIndex)reg);
+  return cpu->m_pc == pc;
+}
+
+template <typename T>
+bool Recompiler::store(Cpu* cpu, address addr, u32 val, const BasicBlock* block) {
+  const address pc = cpu->m_pc;
+  if constexpr (sizeof(T) == 1)
+    cpu->store8(addr, (u8)val);
+  else if constexpr (sizeof(T) == 2)
+    cpu->store16(addr, (u16)val);
+  else
+    cpu->store32(addr, val);
+  return cpu->m_pc == pc && !cpu->m_block_cache.is_stale(*block);
+}
+
+}  // namespace cpu
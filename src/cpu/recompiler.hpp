@@ -0,0 +1,87 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace cpu {
+
+class Cpu;
+class BlockCache;
+struct BasicBlock;
+
+namespace x64 {
+class Emitter;
+}
+
+constexpr size_t RECOMPILER_CODE_BUFFER_SIZE = 32 * 1024 * 1024;
+
+// Returned by Cpu::execute_block_instruction to tell the native block how to proceed
+enum BlockInstructionStatus : u8 {
+  NotExecuted = 0,          // An interrupt was taken before the instruction could run
+  ExecutedAndExit = 1,      // Control flow left the block or its code was overwritten
+  ExecutedAndContinue = 2,  // Keep running the next instruction of the block
+};
+
+// Translates basic blocks into x86-64 code. ALU, immediate, HI/LO move and load/store instructions are
+// emitted natively, guest registers are accessed at fixed offsets from the Cpu held in RBX. Loads and
+// stores compute their address natively, the bus access itself goes through the Cpu as it may have side
+// effects or raise an exception. Every other instruction (branches, MULT/DIV, COP0, GTE...), and those
+// the branch delay state has to be tracked for, become a direct call into the interpreter's
+// per-instruction path with their decoded form baked in. Blocks call the helper of the step variant in
+// use (see StepFeature), so they're flushed whenever it changes, and the tracing variants go through it
+// for every instruction.
+//
+// x86-64 only for now, an AArch64 backend is still to be done: elsewhere is_supported() is false and the
+// interpreter runs instead. Only the pages of the code buffer that are written to are committed.
+class Recompiler {
+ public:
+  explicit Recompiler(Cpu& cpu, BlockCache& block_cache);
+  ~Recompiler();
+
+  // False if the host can't run generated code, in which case the interpreter has to be used
+  bool is_supported() const { return m_code_buffer != nullptr; }
+
+  // Runs the block, compiling it first if needed. Returns the number of guest instructions executed, 0
+  // if the block can't be run natively (the interpreter has to step it instead).
+  u32 execute(const BasicBlock& block);
+
+  // Drops all generated code, along with the decoded RAM blocks pointing at it
+  void flush();
+
+ private:
+  using BlockFunction = u32 (*)(Cpu*);
+
+  // Where native code leaves the block, with the number of instructions executed by then
+  struct NativeExit {
+    u8* jump;
+    u32 executed_count;
+  };
+
+  bool compile(const BasicBlock& block);
+  // Emits the instruction at index of block natively, false if it has to go through the interpreter.
+  // is_irq_checked tells whether an interrupt can't have become pending since the last native check.
+  bool compile_native(x64::Emitter& e,
+                      const BasicBlock& block,
+                      u32 index,
+                      bool& is_irq_checked,
+                      std::vector<NativeExit>& exits);
+  // Cpu::do_pending_load()
+  void emit_pending_load(x64::Emitter& e);
+
+  // Called by native loads and stores once their address is computed, false once the access raised an
+  // exception or, for stores, the block got stale
+  template <typename T>
+  static bool load(Cpu* cpu, address addr, u32 reg);
+  template <typename T>
+  static bool store(Cpu* cpu, address addr, u32 val, const BasicBlock* block);
+
+  u8* m_code_buffer{};
+  size_t m_code_buffer_used{};
+
+  Cpu& m_cpu;
+  BlockCache& m_block_cache;
+};
+
+}  // namespace cpu
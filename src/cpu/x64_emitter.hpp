@@ -0,0 +1,292 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <cstring>
+
+namespace cpu {
+namespace x64 {
+
+enum class Reg : u8 { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// Condition codes of Jcc and SETcc
+enum class Cond : u8 { B = 0x2, AE = 0x3, E = 0x4, NE = 0x5, L = 0xC };
+
+// Two operand integer ops, as the /digit of their immediate forms (0x81 /n)
+enum class AluOp : u8 { Add = 0, Or = 1, And = 4, Sub = 5, Xor = 6, Cmp = 7 };
+
+// As the /digit of 0xC1 /n and 0xD3 /n
+enum class ShiftOp : u8 { Shl = 4, Shr = 5, Sar = 7 };
+
+// Memory operand, [base + disp32] or [base + index * 4 + disp32]
+struct Mem {
+  Reg base;
+  s32 disp;
+  bool is_indexed = false;
+  Reg index = Reg::RAX;
+};
+
+// Minimal x86-64 machine code emitter, only covers the instructions the recompiler needs
+class Emitter {
+ public:
+  Emitter(u8* buf, size_t capacity) : m_begin(buf), m_cur(buf), m_end(buf + capacity) {}
+
+  u8* cursor() const { return m_cur; }
+  size_t size() const { return m_cur - m_begin; }
+  size_t space_left() const { return m_end - m_cur; }
+  bool overflowed() const { return m_overflowed; }
+
+  void push(Reg r) {
+    rex(false, 0, 0, idx(r));
+    emit8(0x50 + (idx(r) & 7));
+  }
+  void pop(Reg r) {
+    rex(false, 0, 0, idx(r));
+    emit8(0x58 + (idx(r) & 7));
+  }
+  void ret() { emit8(0xC3); }
+
+  // mov dst64, src64
+  void mov(Reg dst, Reg src) {
+    rex(true, idx(src), 0, idx(dst));
+    emit8(0x89);
+    modrm_reg(idx(src), idx(dst));
+  }
+  // mov dst64, imm64
+  void mov_imm64(Reg dst, u64 imm) {
+    rex(true, 0, 0, idx(dst));
+    emit8(0xB8 + (idx(dst) & 7));
+    emit64(imm);
+  }
+  // mov dst32, imm32 (zero-extends to 64 bits)
+  void mov_imm32(Reg dst, u32 imm) {
+    rex(false, 0, 0, idx(dst));
+    emit8(0xB8 + (idx(dst) & 7));
+    emit32(imm);
+  }
+  // movzx eax, al
+  void movzx_eax_al() {
+    emit8(0x0F);
+    emit8(0xB6);
+    emit8(0xC0);
+  }
+
+  // mov dst32, src32
+  void mov32(Reg dst, Reg src) {
+    rex(false, idx(src), 0, idx(dst));
+    emit8(0x89);
+    modrm_reg(idx(src), idx(dst));
+  }
+  // mov dst32, [mem] / mov [mem], src32 / mov dword [mem], imm32
+  void load32(Reg dst, const Mem& mem) { emit_mem(false, 0x8B, idx(dst), mem); }
+  void store32(const Mem& mem, Reg src) { emit_mem(false, 0x89, idx(src), mem); }
+  void store32_imm(const Mem& mem, u32 imm) {
+    emit_mem(false, 0xC7, 0, mem);
+    emit32(imm);
+  }
+  // movzx dst32, byte [mem] / mov byte [mem], src8 / mov byte [mem], imm8. Only AL, CL, DL and BL as
+  // byte registers.
+  void load8_zx(Reg dst, const Mem& mem) {
+    rex(false, idx(dst), mem_index(mem), idx(mem.base));
+    emit8(0x0F);
+    emit8(0xB6);
+    modrm_mem(idx(dst), mem);
+  }
+  void store8(const Mem& mem, Reg src) { emit_mem(false, 0x88, idx(src), mem); }
+  void store8_imm(const Mem& mem, u8 imm) {
+    emit_mem(false, 0xC6, 0, mem);
+    emit8(imm);
+  }
+  // mov dst64, [mem] / cmp src64, [mem] / add qword [mem], imm32
+  void load64(Reg dst, const Mem& mem) { emit_mem(true, 0x8B, idx(dst), mem); }
+  void cmp64(Reg src, const Mem& mem) { emit_mem(true, 0x3B, idx(src), mem); }
+  void add64_imm(const Mem& mem, s32 imm) {
+    emit_mem(true, 0x81, 0, mem);
+    emit32((u32)imm);
+  }
+  // cmp byte [mem], imm8
+  void cmp8_imm(const Mem& mem, u8 imm) {
+    emit_mem(false, 0x80, (u8)AluOp::Cmp, mem);
+    emit8(imm);
+  }
+
+  // op dst32, src32 / op dst32, [mem] / op dst32, imm32
+  void alu32(AluOp op, Reg dst, Reg src) {
+    rex(false, idx(src), 0, idx(dst));
+    emit8(alu_opcode(op));
+    modrm_reg(idx(src), idx(dst));
+  }
+  void alu32(AluOp op, Reg dst, const Mem& mem) { emit_mem(false, alu_opcode(op) + 2, idx(dst), mem); }
+  void alu32_imm(AluOp op, Reg dst, u32 imm) {
+    rex(false, 0, 0, idx(dst));
+    emit8(0x81);
+    modrm_reg((u8)op, idx(dst));
+    emit32(imm);
+  }
+  // test dst32, src32
+  void test32(Reg dst, Reg src) {
+    rex(false, idx(src), 0, idx(dst));
+    emit8(0x85);
+    modrm_reg(idx(src), idx(dst));
+  }
+  // not dst32
+  void not32(Reg dst) {
+    rex(false, 0, 0, idx(dst));
+    emit8(0xF7);
+    modrm_reg(2, idx(dst));
+  }
+  // shl/shr/sar dst32, imm8 / shl/shr/sar dst32, cl
+  void shift32_imm(ShiftOp op, Reg dst, u8 imm) {
+    rex(false, 0, 0, idx(dst));
+    emit8(0xC1);
+    modrm_reg((u8)op, idx(dst));
+    emit8(imm);
+  }
+  void shift32_cl(ShiftOp op, Reg dst) {
+    rex(false, 0, 0, idx(dst));
+    emit8(0xD3);
+    modrm_reg((u8)op, idx(dst));
+  }
+  // setcc dst8 then movzx dst32, dst8, with the same byte registers as load8_zx()
+  void setcc_zx(Cond cond, Reg dst) {
+    emit8(0x0F);
+    emit8(0x90 + (u8)cond);
+    modrm_reg(0, idx(dst));
+    emit8(0x0F);
+    emit8(0xB6);
+    modrm_reg(idx(dst), idx(dst));
+  }
+  // add eax, imm32
+  void add_eax_imm32(u32 imm) {
+    emit8(0x05);
+    emit32(imm);
+  }
+  // cmp al, imm8
+  void cmp_al_imm8(u8 imm) {
+    emit8(0x3C);
+    emit8(imm);
+  }
+  // add/sub rsp, imm8
+  void add_rsp_imm8(u8 imm) {
+    emit8(0x48);
+    emit8(0x83);
+    emit8(0xC4);
+    emit8(imm);
+  }
+  void sub_rsp_imm8(u8 imm) {
+    emit8(0x48);
+    emit8(0x83);
+    emit8(0xEC);
+    emit8(imm);
+  }
+
+  // call r64
+  void call(Reg target) {
+    rex(false, 0, 0, idx(target));
+    emit8(0xFF);
+    modrm_reg(2, idx(target));
+  }
+
+  // Jumps return the address of their displacement, which has to be filled in with patch_rel8/32
+  u8* je_rel8() {
+    emit8(0x74);
+    return emit_placeholder(1);
+  }
+  u8* jcc_rel8(Cond cond) {
+    emit8(0x70 + (u8)cond);
+    return emit_placeholder(1);
+  }
+  u8* jcc_rel32(Cond cond) {
+    emit8(0x0F);
+    emit8(0x80 + (u8)cond);
+    return emit_placeholder(4);
+  }
+  u8* jmp_rel32() {
+    emit8(0xE9);
+    return emit_placeholder(4);
+  }
+  void patch_rel8(u8* disp, const u8* target) {
+    if (disp == nullptr)
+      return;
+    *disp = (u8)(s8)(target - (disp + 1));
+  }
+  void patch_rel32(u8* disp, const u8* target) {
+    if (disp == nullptr)
+      return;
+    const s32 rel = (s32)(target - (disp + 4));
+    std::memcpy(disp, &rel, sizeof(rel));
+  }
+
+ private:
+  static u8 idx(Reg r) { return static_cast<u8>(r); }
+
+  void rex(bool w, u8 reg, u8 index, u8 base) {
+    const u8 prefix = 0x40 | (w ? 0x8 : 0) | ((reg & 8) >> 1) | ((index & 8) >> 2) | ((base & 8) >> 3);
+    if (prefix != 0x40)
+      emit8(prefix);
+  }
+  void modrm_reg(u8 reg, u8 rm) { emit8(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+  // Always with a 32-bit displacement, which also spares the special cases of RBP and R13 as base
+  void modrm_mem(u8 reg, const Mem& mem) {
+    if (mem.is_indexed) {
+      emit8(0x84 | ((reg & 7) << 3));
+      emit8(0x80 | ((idx(mem.index) & 7) << 3) | (idx(mem.base) & 7));
+    } else {
+      emit8(0x80 | ((reg & 7) << 3) | (idx(mem.base) & 7));
+      if ((idx(mem.base) & 7) == 4)
+        emit8(0x24);  // SIB byte of RSP and R12 as base
+    }
+    emit32((u32)mem.disp);
+  }
+  void emit_mem(bool w, u8 opcode, u8 reg, const Mem& mem) {
+    rex(w, reg, mem_index(mem), idx(mem.base));
+    emit8(opcode);
+    modrm_mem(reg, mem);
+  }
+  static u8 mem_index(const Mem& mem) { return mem.is_indexed ? idx(mem.index) : 0; }
+  static u8 alu_opcode(AluOp op) {
+    switch (op) {
+      case AluOp::Add: return 0x01;
+      case AluOp::Or: return 0x09;
+      case AluOp::And: return 0x21;
+      case AluOp::Sub: return 0x29;
+      case AluOp::Xor: return 0x31;
+      case AluOp::Cmp: return 0x39;
+    }
+    return 0x01;
+  }
+
+  void emit8(u8 val) {
+    if (m_cur + 1 > m_end) {
+      m_overflowed = true;
+      return;
+    }
+    *m_cur++ = val;
+  }
+  void emit32(u32 val) {
+    for (auto i = 0; i < 4; ++i)
+      emit8((u8)(val >> (i * 8)));
+  }
+  void emit64(u64 val) {
+    for (auto i = 0; i < 8; ++i)
+      emit8((u8)(val >> (i * 8)));
+  }
+  u8* emit_placeholder(size_t len) {
+    if (m_cur + len > m_end) {
+      m_overflowed = true;
+      return nullptr;
+    }
+    u8* pos = m_cur;
+    std::memset(m_cur, 0, len);
+    m_cur += len;
+    return pos;
+  }
+
+  u8* m_begin;
+  u8* m_cur;
+  u8* m_end;
+  bool m_overflowed{};
+};
+
+}  // namespace x64
+}  // namespace cpu
@@ -1,26 +1,42 @@
 #include <emulator/emulator.hpp>
 
+#include <gpu/gpu_capture.hpp>
 #include <util/fs.hpp>
+#include <util/load_file.hpp>
+#include <util/log.hpp>
+#include <util/profiler.hpp>
+#include <util/state_stream.hpp>
 
 #include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
 #include <tuple>
+#include <vector>
 
 namespace emulator {
 
 Emulator::Emulator(const fs::path& bios_path,
                    const fs::path& psx_exe_path,
                    const fs::path& bootstrap_path,
-                   const fs::path& cdrom_path)
+                   const fs::path& cdrom_path,
+                   bool is_headless)
     : m_settings(),
-      m_bios(bios_path),
-      m_expansion(bootstrap_path),
+      m_scheduler(),
+      m_address_space(),
+      m_bios_image(bios::BiosImage::load(bios_path)),
+      m_bios(m_address_space, *m_bios_image),
+      m_expansion(m_address_space, bootstrap_path),
       m_interrupts(),
-      m_ram(psx_exe_path),
+      m_scratchpad(m_address_space),
+      m_ram(m_address_space, psx_exe_path),
       m_gpu(),
+      m_mdec(),
       m_spu(),
       m_cdrom(),
       m_timers(),
-      m_dma(m_ram, m_gpu, m_interrupts, m_cdrom),
+      m_dma(m_ram, m_gpu, m_interrupts, m_cdrom, m_mdec, m_spu, m_scheduler),
       m_bus(m_bios,
             m_expansion,
             m_interrupts,
@@ -28,46 +44,389 @@ Emulator::Emulator(const fs::path& bios_path,
             m_ram,
             m_dma,
             m_gpu,
+            m_mdec,
             m_spu,
             m_joypad,
             m_cdrom,
             m_timers),
-      m_cpu(m_bus, m_settings) {
+      m_cpu(m_bus, m_settings, m_scheduler, m_bios_image->blocks()) {
   m_interrupts.init(&m_cpu);
-  m_joypad.init(&m_interrupts);
-  m_timers.init(&m_interrupts);
-  m_cdrom.init(&m_interrupts);
+  m_joypad.init(&m_interrupts, &m_scheduler);
+  m_timers.init(&m_interrupts, &m_scheduler);
+  m_cdrom.init(&m_interrupts, &m_scheduler, &m_spu.cd_audio());
+  m_spu.init(&m_interrupts, &m_scheduler);
+
+  m_scheduler.set_callback(EventType::Vblank, [this]() { on_vblank(); });
+  m_scheduler.schedule(EventType::Vblank, gpu::CPU_CYCLES_PER_FRAME);
 
   if (!cdrom_path.empty())
     m_cdrom.insert_disk_file(cdrom_path);
 
-  m_screen_renderer.set_texture_size(gpu::VRAM_WIDTH, gpu::VRAM_HEIGHT);
+  if (!is_headless) {
+    m_screen_renderer = std::make_unique<renderer::ScreenRenderer>();
+  }
 }
 
 void Emulator::advance_frame() {
-  // Run in 300 cycle chunks
-  // Estimate that the CPU effectively runs at a 1/3 of the system clock (due to memory delays etc)
-  const u32 system_cycle_quantum = 300;
-  const u32 cpu_cycle_quantum = system_cycle_quantum / 3;
-
-  while (true) {
-    m_cpu.step(cpu_cycle_quantum);
-
-    m_dma.step();
-    m_cdrom.step();
-    m_timers.step(system_cycle_quantum);
-    m_joypad.step();
-
-    if (m_gpu.step(system_cycle_quantum)) {
-      m_bus.m_interrupts.trigger(cpu::IrqType::VBLANK);
-      // Frame emulated, return to render it
-      return;
+  m_has_run_ahead_frame = false;
+  if (m_rewind && m_settings.rewinding) {
+    update_rewind();
+    return;
+  }
+
+  if (m_settings.turbo) {
+    // As many frames as the host gets through before it should present one, only the last is drawn
+    using Clock = std::chrono::steady_clock;
+    const auto present_time = Clock::now() + TURBO_PRESENT_INTERVAL;
+    for (u32 frame_count = 1;; ++frame_count) {
+      const auto frame_start = Clock::now();
+      const bool is_last =
+          frame_count == TURBO_MAX_FRAMES || frame_start + m_turbo_frame_time >= present_time;
+      emulate_frame(!is_last);
+      if (is_last)
+        break;
+      m_turbo_frame_time = Clock::now() - frame_start;
     }
+  } else {
+    // Only the last frame is presented, the skipped ones before it only draw what's read back of them
+    for (s32 skipped = m_settings.frame_skip; skipped >= 0; --skipped)
+      emulate_frame(skipped > 0);
+    // The hardware renderer's screen would be drawn over by loading the state back
+    if (m_settings.run_ahead > 0 && !m_hw_renderer)
+      run_ahead();
+  }
+  if (PROFILER_ENABLED)
+    util::g_profiler.end_frame();
+  if (auto capture = m_gpu.take_finished_capture())
+    capture->write(m_gpu_capture_path);
+
+  if (m_rewind)
+    update_rewind();
+}
+
+void Emulator::emulate_frame(bool skip_drawing) {
+  m_gpu.set_skip_drawing(skip_drawing);
+  if (!m_is_running_ahead)
+    update_input();
+
+  // The CPU runs until the next event is due, devices only run when one of their events is
+  m_frame_done = false;
+  while (!m_frame_done) {
+    m_cpu.step();
+    m_scheduler.run_events();
+  }
+}
+
+void Emulator::run_ahead() {
+  save_state(m_run_ahead_state);
+
+  m_is_running_ahead = true;
+  for (s32 ahead = m_settings.run_ahead; ahead > 0; --ahead)
+    emulate_frame(ahead > 1);
+  m_is_running_ahead = false;
+
+  capture_screen(m_run_ahead_frame);
+  m_has_run_ahead_frame = true;
+  load_state(m_run_ahead_state);
+}
+
+void Emulator::start_gpu_capture(const fs::path& path, u32 frame_count) {
+  m_gpu_capture_path = path;
+  m_gpu.start_capture(frame_count);
+}
+
+void Emulator::start_input_recording() {
+  m_input_recording = std::make_unique<io::InputMovie>();
+}
+
+bool Emulator::stop_input_recording(const fs::path& path) {
+  if (!m_input_recording) {
+    LOG_ERROR("No input recording to write to {}", path.string());
+    return false;
   }
+  const bool is_saved = m_input_recording->save(path);
+  m_input_recording.reset();
+  return is_saved;
+}
+
+void Emulator::load_block_profile(const fs::path& dir) {
+  // Titles are told apart by their boot executable, off the disc or side-loaded
+  buffer exe;
+  if (!m_cdrom.read_boot_exe(exe) && !m_ram.psxexe_path().empty() && fs::exists(m_ram.psxexe_path()))
+    exe = util::load_file(m_ram.psxexe_path());
+
+  m_block_profile_path = cpu::block_profile_path(dir, m_bios_image->data(), exe);
+  if (!fs::exists(m_block_profile_path)) {
+    LOG_INFO("No block profile at {} yet, it's written on exit", m_block_profile_path.string());
+    return;
+  }
+  cpu::BlockProfile profile;
+  if (profile.load(m_block_profile_path))
+    m_cpu.block_cache().prepare(std::move(profile));
+}
+
+bool Emulator::save_block_profile() {
+  if (m_block_profile_path.empty()) {
+    LOG_ERROR("No block profile to save");
+    return false;
+  }
+  return m_cpu.block_cache().profile().save(m_block_profile_path);
+}
+
+void Emulator::start_input_replay(io::InputMovie movie) {
+  m_input_replay = std::make_unique<io::InputMovie>(std::move(movie));
+  m_input_replay_frame = 0;
+}
+
+void Emulator::update_input() {
+  io::InputFrame input = m_joypad.take_input();
+  if (m_input_replay) {
+    if (m_input_replay_frame < m_input_replay->frame_count()) {
+      input = m_input_replay->frame(m_input_replay_frame++);
+    } else {
+      LOG_INFO("Input replay over after {} frames", m_input_replay_frame);
+      m_input_replay.reset();
+    }
+  }
+
+  m_joypad.apply_input(input);
+  if (m_input_recording)
+    m_input_recording->record(input);
+}
+
+Stats Emulator::stats() {
+  const auto raster = m_gpu.raster_stats();
+  return { m_cpu.instruction_count(), m_scheduler.now(), raster.primitives, raster.pixels,
+           m_bus.stats() };
+}
+
+void Emulator::update_rewind() {
+  if (m_settings.rewinding) {
+    // The oldest state stays on screen once there's nothing older
+    if (m_rewind->pop(m_rewind_state))
+      load_state(m_rewind_state);
+    m_frames_since_rewind_state = 0;
+    return;
+  }
+
+  if (++m_frames_since_rewind_state < REWIND_INTERVAL)
+    return;
+  m_frames_since_rewind_state = 0;
+  save_state(m_rewind_state);
+  m_rewind->push(m_rewind_state);
+}
+
+void Emulator::on_vblank() {
+  m_gpu.vblank();
+  m_bus.m_interrupts.trigger(cpu::IrqType::VBLANK);
+
+  m_spu.take_output(m_audio_samples);
+  if (m_audio_callback && !m_settings.mute_audio && !m_is_running_ahead && !m_audio_samples.empty())
+    m_audio_callback(m_audio_samples.data(), static_cast<u32>(m_audio_samples.size() / 2));
+
+  // Frame emulated, return to render it
+  m_frame_done = true;
+
+  // Relative to the deadline rather than now, so that lateness doesn't accumulate
+  const u64 next_vblank = m_scheduler.deadline(EventType::Vblank) + m_gpu.cycles_per_frame();
+  m_scheduler.schedule_at(EventType::Vblank, next_vblank);
 }
 
 void Emulator::render() {
-  m_screen_renderer.render((const void*)m_gpu.vram().data());
+  m_gpu.sync();
+  if (is_headless())
+    return;
+
+  if (m_has_run_ahead_frame)
+    present(m_run_ahead_frame, m_run_ahead_frame.dirty);
+  else if (m_hw_renderer)
+    m_screen_renderer->render_texture(m_hw_renderer->screen_texture(),
+                                      m_hw_renderer->resolution_scale(), screen_area());
+  else {
+    renderer::rasterizer::VramBlocks dirty;
+    const u16* screen = take_screen(dirty);
+    m_screen_renderer->render(screen, dirty, screen_area());
+  }
+}
+
+void Emulator::capture_frame(Frame& frame) {
+  if (m_has_run_ahead_frame)
+    frame = m_run_ahead_frame;
+  else
+    capture_screen(frame);
+}
+
+void Emulator::capture_screen(Frame& frame) {
+  m_gpu.sync();
+
+  // All of VRAM, the display area can be anywhere in it
+  frame.vram.resize(gpu::VRAM_WIDTH * gpu::VRAM_HEIGHT);
+  std::copy_n(take_screen(frame.dirty), frame.vram.size(), frame.vram.data());
+  frame.area = screen_area();
+}
+
+const u16* Emulator::take_screen(renderer::rasterizer::VramBlocks& dirty) {
+  dirty = m_gpu.take_dirty_vram();
+
+  // Only the rasterizer counts overdraw, the hardware renderer's screen is shown as is
+  const auto& overdraw = m_gpu.overdraw();
+  const bool is_heatmap = m_settings.overdraw_heatmap && !overdraw.empty() && !m_hw_renderer;
+  if (!is_heatmap) {
+    // VRAM has to be uploaded whole again once the heatmap is gone
+    if (!m_overdraw_heatmap.empty()) {
+      m_overdraw_heatmap = {};
+      dirty.set();
+    }
+    return m_gpu.vram().data();
+  }
+
+  // Black where nothing was drawn, then blue to red as pixels are drawn over more, white from 8 times on
+  static const gpu::RGB16 HEATMAP_COLORS[] = {
+    gpu::RGB16::from_RGB(0, 0, 0),       gpu::RGB16::from_RGB(0, 0, 255),
+    gpu::RGB16::from_RGB(0, 160, 255),   gpu::RGB16::from_RGB(0, 255, 96),
+    gpu::RGB16::from_RGB(160, 255, 0),   gpu::RGB16::from_RGB(255, 192, 0),
+    gpu::RGB16::from_RGB(255, 96, 0),    gpu::RGB16::from_RGB(255, 0, 0),
+    gpu::RGB16::from_RGB(255, 255, 255),
+  };
+  constexpr u8 MAX_HEATMAP_COUNT = std::size(HEATMAP_COLORS) - 1;
+
+  m_overdraw_heatmap.resize(overdraw.size());
+  for (size_t i = 0; i < overdraw.size(); ++i)
+    m_overdraw_heatmap[i] = HEATMAP_COLORS[std::min(overdraw[i], MAX_HEATMAP_COUNT)].word;
+  dirty.set();
+  return m_overdraw_heatmap.data();
+}
+
+renderer::ScreenArea Emulator::screen_area() const {
+  renderer::ScreenArea area;
+  area.width = area.visible_width = m_settings.res_width;
+  area.height = area.visible_height = m_settings.res_height;
+  if (m_settings.screen_view == View::Vram)
+    return area;
+
+  const auto visible = m_gpu.get_visible_resolution();
+  area.x = m_gpu.m_display_area.x;
+  area.y = m_gpu.m_display_area.y;
+  area.visible_width = std::min<s32>(area.width, visible.width);
+  area.visible_height = std::min<s32>(area.height, visible.height);
+  // The heatmap is in 15 bit colors whatever the display's depth
+  area.is_24bit = m_gpu.m_gpustat.disp_color_depth && m_overdraw_heatmap.empty();
+  return area;
+}
+
+void Emulator::present(const Frame& frame, const renderer::rasterizer::VramBlocks& dirty) {
+  m_screen_renderer->render(frame.vram.data(), dirty, frame.area);
+}
+
+void Emulator::start_frame_dump(const FrameDumpSettings& settings) {
+  m_frame_dumper.reset();
+  m_frame_dumper = std::make_unique<FrameDumper>(settings);
+}
+
+void Emulator::dump_frame() {
+  if (!m_frame_dumper)
+    return;
+  DisplaySnapshot* snapshot = m_frame_dumper->next_snapshot();
+  if (snapshot == nullptr)
+    return;
+
+  // The hardware renderer keeps VRAM on the host GPU, the displayed frame has to be read back first
+  m_gpu.sync();
+  if (m_hw_renderer)
+    m_hw_renderer->download();
+
+  const auto res = m_gpu.get_resolution();
+  const auto area = m_gpu.m_display_area;
+  const auto& vram = m_gpu.vram();
+  snapshot->width = res.width;
+  snapshot->height = res.height;
+  snapshot->is_24bit = m_gpu.m_gpustat.disp_color_depth;
+  snapshot->row_length = snapshot->is_24bit ? (res.width * 3 + 1) / 2 : res.width;
+  snapshot->halfwords.resize((size_t)snapshot->row_length * res.height);
+
+  // Wrapping around VRAM, like the display does
+  for (u32 row = 0; row < res.height; ++row) {
+    const u16* vram_row = &vram[((area.y + row) % gpu::VRAM_HEIGHT) * gpu::VRAM_WIDTH];
+    u16* out = &snapshot->halfwords[(size_t)row * snapshot->row_length];
+    const u32 x = area.x % gpu::VRAM_WIDTH;
+    if (x + snapshot->row_length <= gpu::VRAM_WIDTH) {
+      std::copy_n(vram_row + x, snapshot->row_length, out);
+    } else {
+      for (u32 i = 0; i < snapshot->row_length; ++i)
+        out[i] = vram_row[(x + i) % gpu::VRAM_WIDTH];
+    }
+  }
+  m_frame_dumper->push();
+}
+
+void Emulator::save_state(std::vector<byte>& state) {
+  state.clear();
+  util::StateStream s(state);
+  serialize(s);
+}
+
+bool Emulator::load_state(const std::vector<byte>& state) {
+  save_state(m_load_backup);
+
+  util::StateStream s(state.data(), state.size());
+  serialize(s);
+  if (s.ok() && s.position() == state.size())
+    return true;
+
+  LOG_WARN("Invalid save state, {} bytes", state.size());
+  util::StateStream backup(m_load_backup.data(), m_load_backup.size());
+  serialize(backup);
+  return false;
+}
+
+bool Emulator::save_state_file(const fs::path& path) {
+  std::vector<byte> state;
+  save_state(state);
+
+  std::ofstream ofs(path, std::ios::binary);
+  ofs.write((const char*)state.data(), state.size());
+  if (!ofs) {
+    LOG_ERROR("Could not save state to {}: {}", path.string(), std::strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool Emulator::load_state_file(const fs::path& path) {
+  std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+  std::vector<byte> state(ifs ? (size_t)ifs.tellg() : 0);
+  ifs.seekg(0);
+  if (!ifs.read((char*)state.data(), state.size())) {
+    LOG_ERROR("Could not load state from {}: {}", path.string(), std::strerror(errno));
+    return false;
+  }
+  return load_state(state);
+}
+
+void Emulator::serialize(util::StateStream& s) {
+  u32 version = SAVE_STATE_VERSION;
+  s.section("PCST");
+  s.value(version);
+  if (version != SAVE_STATE_VERSION) {
+    LOG_WARN("Save state version {} instead of {}", version, SAVE_STATE_VERSION);
+    s.fail();
+  }
+  if (!s.ok())
+    return;
+
+  m_scheduler.serialize(s);
+  m_cpu.serialize(s);
+  m_interrupts.serialize(s);
+  m_ram.serialize(s);
+  m_scratchpad.serialize(s);
+  m_dma.serialize(s);
+  m_gpu.serialize(s);
+  m_mdec.serialize(s);
+  m_spu.serialize(s);
+  m_cdrom.serialize(s);
+  m_timers.serialize(s);
+  m_joypad.serialize(s);
+  s.section("END ");
 }
 
 void Emulator::set_view(View view) {
@@ -83,11 +442,23 @@ void Emulator::set_view(View view) {
       m_settings.res_height = gpu::VRAM_HEIGHT;
       break;
   }
-
-  m_screen_renderer.set_texture_size(m_settings.res_width, m_settings.res_height);
+  // The screen texture is resized on the next render, which can be on another thread than this one
 }
 
 void Emulator::update_settings() {
+  // The hardware renderer draws with the GL context, which is only current on this thread
+  m_gpu.set_threaded(m_settings.threaded_gpu && !m_settings.hw_renderer);
+  // hardware_concurrency() is 0 when unknown, the rasterizer caps the count to MAX_RASTER_WORKERS
+  const u32 raster_workers = std::max(2u, std::thread::hardware_concurrency());
+  m_gpu.set_raster_workers(m_settings.parallel_raster ? raster_workers : 0);
+  update_hw_renderer();
+  m_gpu.set_gp0_recording(m_settings.record_gp0);
+  m_gpu.set_overdraw_tracking(m_settings.overdraw_heatmap);
+  if (m_settings.rewind != (m_rewind != nullptr)) {
+    m_rewind = m_settings.rewind ? std::make_unique<RewindBuffer>() : nullptr;
+    m_frames_since_rewind_state = 0;
+  }
+
   if (m_settings.window_size_changed) {
     set_view(m_settings.screen_view);
     // We leave screen_view_changed to true so that the GUI code can pick it up and change the window
@@ -95,4 +466,34 @@ void Emulator::update_settings() {
   }
 }
 
+void Emulator::update_hw_renderer() {
+  const u32 scale = m_settings.get_internal_resolution_scale();
+  const bool is_enabled = m_hw_renderer != nullptr;
+  const bool is_scale_changed = is_enabled && m_hw_renderer->resolution_scale() != scale;
+  if (m_settings.hw_renderer == is_enabled && !is_scale_changed)
+    return;
+
+  // Switching goes through the CPU copy of VRAM, so does changing the resolution
+  m_gpu.set_hw_renderer(nullptr);
+  m_hw_renderer.reset();
+
+  if (!m_settings.hw_renderer)
+    return;
+
+  if (is_headless()) {
+    LOG_ERROR("The hardware renderer needs a GL context, which headless runs don't have");
+    m_settings.hw_renderer = false;
+    return;
+  }
+
+  if (!renderer::HwRenderer::is_supported()) {
+    LOG_ERROR("The hardware renderer needs OpenGL 4.4 or ARB_buffer_storage, keeping the software one");
+    m_settings.hw_renderer = false;
+    return;
+  }
+
+  m_hw_renderer = std::make_unique<renderer::HwRenderer>(m_gpu, scale);
+  m_gpu.set_hw_renderer(m_hw_renderer.get());
+}
+
 }  // namespace emulator
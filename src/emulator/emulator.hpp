@@ -4,54 +4,172 @@
 #include <bus/bus.hpp>
 #include <cpu/cpu.hpp>
 #include <cpu/interrupt.hpp>
+#include <emulator/frame_dumper.hpp>
+#include <emulator/rewind.hpp>
+#include <emulator/scheduler.hpp>
 #include <emulator/settings.hpp>
 #include <gpu/gpu.hpp>
 #include <io/cdrom_drive.hpp>
+#include <io/input_movie.hpp>
 #include <io/joypad.hpp>
 #include <io/timers.hpp>
+#include <mdec/mdec.hpp>
+#include <memory/address_space.hpp>
 #include <memory/dma.hpp>
 #include <memory/expansion.hpp>
 #include <memory/ram.hpp>
+#include <renderer/hw_renderer.hpp>
 #include <renderer/screen_renderer.hpp>
 #include <spu/spu.hpp>
 
 #include <util/fs.hpp>
 
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
 namespace gui {
 class Gui;
 }
 
+namespace util {
+class StateStream;
+}
+
 namespace emulator {
 
+// Bumped with any change to what the components save, states of other versions aren't loaded
+constexpr u32 SAVE_STATE_VERSION = 3;
+
+// In turbo (see Settings::turbo), how long advance_frame() emulates for, about a refresh of the host's
+// display, and how many frames it emulates at most meanwhile
+constexpr std::chrono::milliseconds TURBO_PRESENT_INTERVAL{ 16 };
+constexpr u32 TURBO_MAX_FRAMES = 64;
+
+// Work done since power on, see main/bench.cpp
+struct Stats {
+  u64 instructions{};  // Executed by the CPU
+  u64 cycles{};        // Emulated, of the system clock (see emulator/scheduler.hpp)
+  u64 primitives{};
+  u64 pixels{};
+  bus::BusStats bus;  // Only counted with BUS_STATS_ENABLED
+};
+
+// The screen at the end of a frame, handed to another thread to present it (see
+// emulator/emulator_thread.hpp)
+struct Frame {
+  std::vector<u16> vram;                   // All of VRAM
+  renderer::rasterizer::VramBlocks dirty;  // Written to since the last presented frame
+  renderer::ScreenArea area;               // Shown of vram
+};
+
 class Emulator {
  public:
+  // Gets the sound of each frame as interleaved 16 bit stereo samples at spu::SAMPLE_RATE, on the
+  // emulation thread
+  using AudioCallback = std::function<void(const s16* samples, u32 frame_count)>;
+
+  // Headless emulators need no window nor GL context: nothing is presented and there's no hardware
+  // renderer, frames can only be dumped to files
   explicit Emulator(const fs::path& bios_path,
                     const fs::path& psx_exe_path,
                     const fs::path& bootstrap_path,
-                    const fs::path& cdrom_path);
+                    const fs::path& cdrom_path,
+                    bool is_headless = false);
 
-  // Advances the emulator state approximately one frame
+  // Advances the emulator state approximately one frame, plus the frames skipped before it (see
+  // Settings::frame_skip). In turbo, as many frames as the host emulates in TURBO_PRESENT_INTERVAL.
   void advance_frame();
+  // Of the frame run ahead to if there's one (see Settings::run_ahead), render() and capture_frame() too
   void render();
+  // Copies the screen out, for present() to be called from another thread while emulation goes on
+  void capture_frame(Frame& frame);
+  // Emulated by the last frame, for pacing its presentation (see FramePacer)
+  u32 frame_cycles() const { return m_gpu.cycles_per_frame(); }
+  // Only touches the screen renderer, dirty tells which blocks of the frame to upload again
+  void present(const Frame& frame, const renderer::rasterizer::VramBlocks& dirty);
   void set_view(View view);
+  // Frames are dumped on a worker thread from then on, see FrameDumper. Stopping waits for the frames
+  // still queued.
+  void start_frame_dump(const FrameDumpSettings& settings);
+  void stop_frame_dump() { m_frame_dumper.reset(); }
+  // Queues the display area for dumping, unless no dump is started or the frame is dropped
+  void dump_frame();
+
+  // Save states of the whole console, between frames. state is overwritten, reusing it from one save to
+  // the next saves without allocating. A state that doesn't load leaves the emulator as it was.
+  void save_state(std::vector<byte>& state);
+  bool load_state(const std::vector<byte>& state);
+  bool save_state_file(const fs::path& path);
+  bool load_state_file(const fs::path& path);
+  // Writes everything the GPU is told over the next frame_count frames to path once they're done, see
+  // gpu/gpu_capture.hpp
+  void start_gpu_capture(const fs::path& path, u32 frame_count);
+  // Joypad input movies, see io/input_movie.hpp. Recording keeps the input of every frame from the next
+  // one on, until stop_input_recording() writes it to path. Rewinding isn't undone in the movie.
+  void start_input_recording();
+  bool stop_input_recording(const fs::path& path);
+  // Feeds the joypad from movie from the next frame on, live input is dropped until the movie is over
+  void start_input_replay(io::InputMovie movie);
+  bool is_replaying_input() const { return m_input_replay != nullptr; }
+  // Profile-guided block decoding, see cpu/block_profile.hpp. The profile of this BIOS and title in dir
+  // is prepared if there's one, save_block_profile() writes this run's in its place. Before the first
+  // frame.
+  void load_block_profile(const fs::path& dir);
+  bool save_block_profile();
+  // Into slot 0 or 1, path is created on the first save if it doesn't exist (see io/memory_card.hpp)
+  bool insert_memory_card(u32 slot, const fs::path& path) {
+    return m_joypad.insert_memory_card(slot, path);
+  }
 
   // Getters
   const cpu::Cpu& cpu() const { return m_cpu; }
   const memory::Ram& ram() const { return m_ram; }
   const gpu::Gpu& gpu() const { return m_gpu; }
+  const bus::Bus& bus() const { return m_bus; }
   io::Joypad& joypad() { return m_joypad; }
   const io::Timers& timers() const { return m_timers; }
+  Stats stats();
   Settings& settings() { return m_settings; }
+  bool is_headless() const { return m_screen_renderer == nullptr; }
   void update_settings();
+  void set_audio_callback(AudioCallback callback) { m_audio_callback = std::move(callback); }
+
+ private:
+  void on_vblank();
+  // Drawing is skipped but for what's read back of VRAM, see Gpu::set_skip_drawing()
+  void emulate_frame(bool skip_drawing);
+  // Emulates Settings::run_ahead frames from a save state, keeps the screen of the last one and loads
+  // the state back. Input stays as it is on those frames, and their sound is dropped.
+  void run_ahead();
+  // The screen as it is now, capture_frame() unless run ahead
+  void capture_screen(Frame& frame);
+  // Steps back to the previous rewind state, or keeps one every REWIND_INTERVAL frames
+  void update_rewind();
+  // Hands the joypad the input of the frame about to run, live or replayed
+  void update_input();
+  void serialize(util::StateStream& s);
+  // Creates or destroys the hardware renderer, for it to match the settings
+  void update_hw_renderer();
+  // What the screen shows, VRAM or its overdraw heatmap (see Settings::overdraw_heatmap), and the blocks
+  // of it that changed since the last call
+  const u16* take_screen(renderer::rasterizer::VramBlocks& dirty);
+  // Where the screen of take_screen() is in it, in the view of the settings
+  renderer::ScreenArea screen_area() const;
 
  private:
   // Emulator core components
+  Scheduler m_scheduler;                 // First, as the components register their events with it
+  memory::AddressSpace m_address_space;  // Before the memories, which live in it
+  std::shared_ptr<bios::BiosImage> m_bios_image;  // Shared with the other emulators of the process
   bios::Bios m_bios;
   memory::Expansion m_expansion;
   cpu::Interrupts m_interrupts;
   memory::Scratchpad m_scratchpad;
   memory::Ram m_ram;
   gpu::Gpu m_gpu;
+  mdec::Mdec m_mdec;
   spu::Spu m_spu;
   io::Joypad m_joypad;
   io::CdromDrive m_cdrom;
@@ -61,9 +179,30 @@ class Emulator {
 
   cpu::Cpu m_cpu;
 
+  bool m_frame_done{};  // Set on VBLANK
+
  private:
   // Host fields
-  renderer::ScreenRenderer m_screen_renderer;
+  std::unique_ptr<renderer::ScreenRenderer> m_screen_renderer;  // Null when headless
+  std::unique_ptr<renderer::HwRenderer> m_hw_renderer;  // Null unless enabled in the settings
+  AudioCallback m_audio_callback;  // Sound is dropped without one
+  std::vector<s16> m_audio_samples;
+  std::vector<byte> m_load_backup;  // What a state that fails to load is rolled back to
+  fs::path m_gpu_capture_path;
+  std::unique_ptr<RewindBuffer> m_rewind;  // Null unless enabled in the settings
+  std::unique_ptr<FrameDumper> m_frame_dumper;  // Null unless dumping
+  std::vector<byte> m_rewind_state;
+  u32 m_frames_since_rewind_state{};
+  std::vector<u16> m_overdraw_heatmap;  // Shown in place of VRAM, empty when it isn't
+  std::unique_ptr<io::InputMovie> m_input_recording;  // Null unless recording
+  std::unique_ptr<io::InputMovie> m_input_replay;     // Null unless replaying
+  size_t m_input_replay_frame{};                      // Next frame of m_input_replay
+  fs::path m_block_profile_path;  // Empty unless a block profile was loaded
+  std::chrono::steady_clock::duration m_turbo_frame_time{};  // Of the last skipped frame in turbo
+  std::vector<byte> m_run_ahead_state;
+  Frame m_run_ahead_frame;
+  bool m_is_running_ahead{};
+  bool m_has_run_ahead_frame{};  // Run ahead to by the last advance_frame()
   emulator::Settings m_settings{};
 };
 
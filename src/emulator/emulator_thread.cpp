@@ -0,0 +1,138 @@
+#include <emulator/emulator_thread.hpp>
+
+namespace emulator {
+
+EmulatorThread::EmulatorThread(Emulator& emulator) : m_emulator(emulator) {
+  // Destroyed while still on the thread of the GL context
+  m_emulator.settings().hw_renderer = false;
+  m_emulator.update_settings();
+  m_settings = m_emulator.settings();
+
+  m_thread = std::thread(&EmulatorThread::run, this);
+}
+
+EmulatorThread::~EmulatorThread() {
+  {
+    std::lock_guard<std::mutex> lock(m_pause_mutex);
+    m_quit = true;
+  }
+  m_pause_changed.notify_all();
+  m_thread.join();
+
+  // The emulator continues on this thread with the settings of the GUI
+  update_settings();
+  apply_settings();
+}
+
+void EmulatorThread::update_settings() {
+  m_settings.hw_renderer = false;
+
+  std::lock_guard<std::mutex> lock(m_settings_mutex);
+  m_pending_settings = m_settings;
+  m_is_settings_pending = true;
+}
+
+void EmulatorThread::update_button(u8 button_index, bool was_pressed) {
+  while (!m_input.try_push({ button_index, was_pressed }))
+    std::this_thread::yield();
+}
+
+void EmulatorThread::render() {
+  const bool is_new = m_frames.update();
+  const Frame& frame = m_frames.front();
+  if (frame.area.height == 0)
+    return;  // None finished yet
+
+  // The emulator changes the resolution when the view changes, the window follows
+  const u32 width = frame.area.width, height = frame.area.height;
+  if (width != m_settings.res_width || height != m_settings.res_height) {
+    m_settings.res_width = width;
+    m_settings.res_height = height;
+    m_settings.window_size_changed = true;
+  }
+
+  m_emulator.present(frame, is_new ? frame.dirty : renderer::rasterizer::VramBlocks{});
+}
+
+void EmulatorThread::pause() {
+  std::unique_lock<std::mutex> lock(m_pause_mutex);
+  m_pause_requested = true;
+  m_pause_changed.wait(lock, [this]() { return m_paused; });
+}
+
+void EmulatorThread::resume() {
+  {
+    std::lock_guard<std::mutex> lock(m_pause_mutex);
+    m_pause_requested = false;
+  }
+  m_pause_changed.notify_all();
+}
+
+void EmulatorThread::run() {
+  // Without vsync to wait for, emulation is limited here
+  FramePacer pacer;
+
+  while (!m_quit) {
+    wait_while_paused();
+    apply_settings();
+    apply_input();
+
+    m_emulator.advance_frame();
+    publish_frame();
+
+    if (m_emulator.settings().limit_framerate && !m_emulator.settings().turbo)
+      pacer.wait(m_emulator.frame_cycles());
+  }
+}
+
+void EmulatorThread::wait_while_paused() {
+  std::unique_lock<std::mutex> lock(m_pause_mutex);
+  if (!m_pause_requested)
+    return;
+
+  m_paused = true;
+  m_pause_changed.notify_all();
+  m_pause_changed.wait(lock, [this]() { return !m_pause_requested || m_quit; });
+  m_paused = false;
+}
+
+void EmulatorThread::apply_settings() {
+  {
+    std::lock_guard<std::mutex> lock(m_settings_mutex);
+    if (!m_is_settings_pending)
+      return;
+    m_is_settings_pending = false;
+
+    // The resolution is the emulator's to set, the GUI only learns of it through the frames
+    Settings& settings = m_emulator.settings();
+    const u32 res_width = settings.res_width;
+    const u32 res_height = settings.res_height;
+    settings = m_pending_settings;
+    settings.res_width = res_width;
+    settings.res_height = res_height;
+  }
+  m_emulator.update_settings();
+}
+
+void EmulatorThread::apply_input() {
+  while (const ButtonEvent* event = m_input.front()) {
+    m_emulator.joypad().update_button(event->button_index, event->was_pressed);
+    m_input.pop();
+  }
+}
+
+void EmulatorThread::publish_frame() {
+  Frame& frame = m_frames.back();
+  m_emulator.capture_frame(frame);
+
+  // The blocks of a frame the GUI thread skipped were never uploaded, the next frame uploads them. When
+  // the last frame is picked up right after checking, its blocks are only uploaded twice.
+  if (m_frames.is_picked_up())
+    m_unpresented.reset();
+  m_unpresented |= frame.dirty;
+  frame.dirty = m_unpresented;
+
+  m_frames.publish();
+}
+
+}  // namespace emulator
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <emulator/emulator.hpp>
+#include <emulator/frame_pacer.hpp>
+#include <emulator/settings.hpp>
+#include <util/spsc_ring.hpp>
+#include <util/triple_buffer.hpp>
+#include <util/types.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace emulator {
+
+// Joypad events waiting for the emulation thread, many more than a frame's worth
+constexpr size_t INPUT_FIFO_SIZE = 256;
+
+// Runs the emulator on its own thread, so that presenting frames and waiting for vsync no longer take
+// emulation time. Finished frames go to the GUI thread through a triple buffer, the GUI thread presents
+// the latest one. Joypad input goes the other way through a FIFO, settings through a copy, both are
+// picked up before each frame.
+//
+// The emulator must be left alone by the GUI thread while this runs, except for present() and between
+// pause() and resume(). The hardware renderer is disabled: it needs the GL context of the GUI thread.
+class EmulatorThread {
+ public:
+  explicit EmulatorThread(Emulator& emulator);
+  ~EmulatorThread();
+
+  // GUI thread side. The GUI edits these settings, update_settings() hands them to the emulator.
+  Settings& settings() { return m_settings; }
+  void update_settings();
+  void update_button(u8 button_index, bool was_pressed);
+  // Presents the latest finished frame, the previous one again if there's no new one
+  void render();
+  // Stops the emulator between two frames, for its state to be read
+  void pause();
+  void resume();
+
+ private:
+  struct ButtonEvent {
+    u8 button_index;
+    bool was_pressed;
+  };
+
+  void run();
+  void wait_while_paused();
+  void apply_settings();
+  void apply_input();
+  void publish_frame();
+
+  Emulator& m_emulator;
+
+  Settings m_settings;          // GUI thread only
+  Settings m_pending_settings;  // Last handed over by the GUI thread, under m_settings_mutex
+  bool m_is_settings_pending{};
+  std::mutex m_settings_mutex;
+
+  util::SpscRing<ButtonEvent, INPUT_FIFO_SIZE> m_input;
+
+  util::TripleBuffer<Frame> m_frames;
+  // Written to since a frame was last picked up by the GUI thread, frames it skipped are never uploaded
+  renderer::rasterizer::VramBlocks m_unpresented;
+
+  bool m_pause_requested{};
+  bool m_paused{};
+  std::mutex m_pause_mutex;
+  std::condition_variable m_pause_changed;
+
+  std::atomic<bool> m_quit{};
+  std::thread m_thread;  // Started once the hardware renderer is out of the way
+};
+
+}  // namespace emulator
@@ -0,0 +1,84 @@
+#include <emulator/farm.hpp>
+
+#include <util/log.hpp>
+
+#include <algorithm>
+#include <chrono>
+
+namespace emulator {
+
+EmulatorFarm::EmulatorFarm(const fs::path& bios_path, u32 thread_count)
+    : m_bios_path(bios_path),
+      m_bios_image(bios::BiosImage::load(bios_path)) {
+  if (thread_count == 0)
+    thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+
+  m_workers.reserve(thread_count);
+  for (u32 i = 0; i < thread_count; ++i)
+    m_workers.emplace_back(&EmulatorFarm::run_worker, this);
+}
+
+EmulatorFarm::~EmulatorFarm() {
+  wait();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_is_stopping = true;
+  }
+  m_job_submitted.notify_all();
+  for (auto& worker : m_workers)
+    worker.join();
+}
+
+void EmulatorFarm::submit(FarmJob job) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_jobs.push_back(std::move(job));
+  }
+  m_job_submitted.notify_one();
+}
+
+void EmulatorFarm::wait() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_job_done.wait(lock, [this]() { return m_jobs.empty() && m_running_count == 0; });
+}
+
+void EmulatorFarm::run_worker() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_job_submitted.wait(lock, [this]() { return m_is_stopping || !m_jobs.empty(); });
+    if (m_jobs.empty())
+      return;  // Stopping
+
+    const FarmJob job = std::move(m_jobs.front());
+    m_jobs.pop_front();
+    ++m_running_count;
+
+    lock.unlock();
+    run_job(job);
+    lock.lock();
+
+    --m_running_count;
+    m_job_done.notify_all();
+  }
+}
+
+void EmulatorFarm::run_job(const FarmJob& job) {
+  // The expansion region boots the BIOS itself, as in main/main.cpp
+  auto emulator = std::make_unique<Emulator>(m_bios_path, job.exe_path, m_bios_path, job.cdrom_path,
+                                             true);
+  if (job.setup)
+    job.setup(*emulator);
+
+  const auto start = std::chrono::steady_clock::now();
+  for (u64 frame = 0; frame < job.frame_count; ++frame)
+    emulator->advance_frame();
+  const std::chrono::duration<f64> elapsed = std::chrono::steady_clock::now() - start;
+
+  LOG_INFO("Farm job {} done, {} frames in {:.3f}s",
+           job.cdrom_path.empty() ? job.exe_path.string() : job.cdrom_path.string(), job.frame_count,
+           elapsed.count());
+  if (job.done)
+    job.done(*emulator, elapsed.count());
+}
+
+}  // namespace emulator
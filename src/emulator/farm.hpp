@@ -0,0 +1,63 @@
+#pragma once
+
+#include <bios/bios.hpp>
+#include <emulator/emulator.hpp>
+#include <util/fs.hpp>
+#include <util/types.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace emulator {
+
+// One headless run of a farm, from power on
+struct FarmJob {
+  fs::path exe_path;    // Loaded once the BIOS has booted, unless empty
+  fs::path cdrom_path;  // Either a cue sheet or a raw CD-ROM binary file, unless empty
+  u64 frame_count{};
+  // Both called on the worker thread: setup before the first frame, e.g. to change the settings, done
+  // after the last one, with the emulation time, for the results to be read out
+  std::function<void(Emulator& emulator)> setup;
+  std::function<void(Emulator& emulator, f64 seconds)> done;
+};
+
+// Runs batches of headless emulators in parallel, each job on an emulator of its own, up to one per
+// worker thread at a time. Emulators share nothing mutable but the BIOS blocks their CPUs decoded
+// (see bios::BiosImage), which the farm keeps alive from one job to the next, and the process-wide
+// loggers, so jobs give the same results as they would on their own.
+class EmulatorFarm {
+ public:
+  // Every job runs bios_path, thread_count 0 takes one thread per host core
+  EmulatorFarm(const fs::path& bios_path, u32 thread_count);
+  // Waits for the jobs left
+  ~EmulatorFarm();
+
+  void submit(FarmJob job);
+  // Until every job submitted so far is done
+  void wait();
+
+  u32 thread_count() const { return static_cast<u32>(m_workers.size()); }
+
+ private:
+  void run_worker();
+  void run_job(const FarmJob& job);
+
+  fs::path m_bios_path;
+  std::shared_ptr<bios::BiosImage> m_bios_image;
+
+  std::deque<FarmJob> m_jobs;  // Waiting for a worker, under m_mutex
+  u32 m_running_count{};       // Jobs taken by a worker and not done yet, under m_mutex
+  bool m_is_stopping{};
+  std::mutex m_mutex;
+  std::condition_variable m_job_submitted;
+  std::condition_variable m_job_done;
+
+  std::vector<std::thread> m_workers;
+};
+
+}  // namespace emulator
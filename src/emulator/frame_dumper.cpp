@@ -0,0 +1,216 @@
+#include <emulator/frame_dumper.hpp>
+
+#include <gpu/colors.hpp>
+#include <util/log.hpp>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace emulator {
+
+namespace {
+
+const char* extension_of(FrameDumpFormat format) {
+  switch (format) {
+    case FrameDumpFormat::Ppm: return "ppm";
+    case FrameDumpFormat::Png: return "png";
+    case FrameDumpFormat::Raw: return "rgb";
+  }
+  return "";
+}
+
+// 8 bits per channel, row after row
+void to_rgb24(const DisplaySnapshot& snapshot, std::vector<u8>& rgb) {
+  rgb.resize((size_t)snapshot.width * snapshot.height * 3);
+  u8* out = rgb.data();
+  for (u32 y = 0; y < snapshot.height; ++y) {
+    const u16* row = &snapshot.halfwords[(size_t)y * snapshot.row_length];
+    if (snapshot.is_24bit) {
+      for (u32 byte_idx = 0; byte_idx < snapshot.width * 3; ++byte_idx)
+        *out++ = (u8)(row[byte_idx / 2] >> (8 * (byte_idx % 2)));
+      continue;
+    }
+    for (u32 x = 0; x < snapshot.width; ++x) {
+      const auto c16 = gpu::RGB16::from_word(row[x]);
+      *out++ = (u8)(c16.r << 3 | c16.r >> 2);
+      *out++ = (u8)(c16.g << 3 | c16.g >> 2);
+      *out++ = (u8)(c16.b << 3 | c16.b >> 2);
+    }
+  }
+}
+
+void append_be32(std::vector<u8>& out, u32 value) {
+  for (s32 shift = 24; shift >= 0; shift -= 8)
+    out.push_back((u8)(value >> shift));
+}
+
+void append_png_chunk(std::vector<u8>& out, const char* type, const u8* data, size_t size) {
+  append_be32(out, (u32)size);
+  const size_t type_pos = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data, data + size);
+  append_be32(out, (u32)crc32(0, &out[type_pos], (uInt)(size + 4)));
+}
+
+// https://www.w3.org/TR/png/, 8 bit RGB without filtering: frames are dumped for their accuracy, not
+// their size
+bool encode_png(const std::vector<u8>& rgb, u32 width, u32 height, std::vector<u8>& png) {
+  // Each row starts with its filter type, 0 for none
+  const size_t row_size = (size_t)width * 3;
+  std::vector<u8> rows(height * (row_size + 1));
+  for (u32 y = 0; y < height; ++y)
+    std::copy_n(&rgb[y * row_size], row_size, &rows[y * (row_size + 1) + 1]);
+
+  std::vector<u8> compressed(compressBound((uLong)rows.size()));
+  uLongf compressed_size = (uLongf)compressed.size();
+  const int result =
+      compress2(compressed.data(), &compressed_size, rows.data(), (uLong)rows.size(), Z_BEST_SPEED);
+  if (result != Z_OK) {
+    LOG_ERROR("Could not compress a PNG frame ({})", result);
+    return false;
+  }
+
+  static constexpr u8 SIGNATURE[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+  png.assign(std::begin(SIGNATURE), std::end(SIGNATURE));
+
+  // Width, height, bit depth, color type (RGB), compression, filter and interlace methods
+  std::vector<u8> header;
+  append_be32(header, width);
+  append_be32(header, height);
+  header.insert(header.end(), { 8, 2, 0, 0, 0 });
+  append_png_chunk(png, "IHDR", header.data(), header.size());
+  append_png_chunk(png, "IDAT", compressed.data(), compressed_size);
+  append_png_chunk(png, "IEND", nullptr, 0);
+  return true;
+}
+
+}  // namespace
+
+FrameDumper::FrameDumper(const FrameDumpSettings& settings) : m_settings(settings) {
+  if (m_settings.format == FrameDumpFormat::Raw) {
+    const fs::path path = m_settings.dir / "frames.rgb";
+    m_raw_file.open(path, std::ios::binary);
+    if (!m_raw_file)
+      LOG_ERROR("Could not create {}: {}", path.string(), std::strerror(errno));
+  }
+  m_thread = std::thread(&FrameDumper::run, this);
+}
+
+FrameDumper::~FrameDumper() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+
+  LOG_INFO("Dumped {} frames to {}, {} dropped", m_written_count, m_settings.dir.string(),
+           m_dropped_count);
+}
+
+DisplaySnapshot* FrameDumper::next_snapshot() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  const u64 number = m_frame_count++;
+  const size_t queue_depth = std::max<u32>(m_settings.queue_depth, 1);
+
+  if (m_queue.size() >= queue_depth) {
+    if (m_settings.drop_policy == FrameDropPolicy::Drop) {
+      ++m_dropped_count;
+      return nullptr;
+    }
+    m_room.wait(lock, [this, queue_depth] { return m_queue.size() < queue_depth; });
+  }
+  m_next.number = number;
+  return &m_next;
+}
+
+void FrameDumper::push() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.push_back(std::move(m_next));
+    // A buffer of an earlier snapshot, whose capacity the next one reuses
+    m_next = {};
+    if (!m_free.empty()) {
+      m_next = std::move(m_free.back());
+      m_free.pop_back();
+    }
+  }
+  m_wake.notify_one();
+}
+
+void FrameDumper::run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    // Everything queued is written before quitting
+    m_wake.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+    if (m_queue.empty())
+      return;
+
+    DisplaySnapshot snapshot = std::move(m_queue.front());
+    m_queue.erase(m_queue.begin());
+    m_room.notify_one();
+
+    lock.unlock();
+    write(snapshot);
+    lock.lock();
+
+    m_free.push_back(std::move(snapshot));
+  }
+}
+
+void FrameDumper::write(const DisplaySnapshot& snapshot) {
+  to_rgb24(snapshot, m_rgb);
+  if (m_settings.format == FrameDumpFormat::Raw) {
+    write_raw(snapshot.width, snapshot.height);
+    return;
+  }
+
+  if (m_settings.format == FrameDumpFormat::Png) {
+    if (!encode_png(m_rgb, snapshot.width, snapshot.height, m_encoded))
+      return;
+  } else {
+    const std::string header = fmt::format("P6\n{} {}\n255\n", snapshot.width, snapshot.height);
+    m_encoded.assign(header.begin(), header.end());
+    m_encoded.insert(m_encoded.end(), m_rgb.begin(), m_rgb.end());
+  }
+
+  const fs::path path = m_settings.dir / fmt::format("frame_{:06}.{}", snapshot.number,
+                                                     extension_of(m_settings.format));
+  std::ofstream file(path, std::ios::binary);
+  file.write((const char*)m_encoded.data(), m_encoded.size());
+  if (!file) {
+    LOG_ERROR("Could not dump frame to {}: {}", path.string(), std::strerror(errno));
+    return;
+  }
+  ++m_written_count;
+}
+
+void FrameDumper::write_raw(u32 width, u32 height) {
+  if (!m_raw_file)
+    return;
+  if (m_raw_width == 0) {
+    m_raw_width = width;
+    m_raw_height = height;
+    LOG_INFO("Dumping {}x{} RGB24 frames to {}", width, height,
+             (m_settings.dir / "frames.rgb").string());
+  }
+
+  // Frames of another size are cropped, or padded with black
+  const size_t row_size = (size_t)m_raw_width * 3;
+  const size_t kept_size = (size_t)std::min(width, m_raw_width) * 3;
+  m_encoded.assign(row_size * m_raw_height, 0);
+  for (u32 y = 0; y < std::min(height, m_raw_height); ++y)
+    std::copy_n(&m_rgb[y * (size_t)width * 3], kept_size, &m_encoded[y * row_size]);
+
+  m_raw_file.write((const char*)m_encoded.data(), m_encoded.size());
+  if (!m_raw_file) {
+    LOG_ERROR("Could not write frame {} to the raw stream: {}", m_written_count, std::strerror(errno));
+    return;
+  }
+  ++m_written_count;
+}
+
+}  // namespace emulator
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <util/fs.hpp>
+#include <util/types.hpp>
+
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace emulator {
+
+enum class FrameDumpFormat : u8 {
+  Ppm,  // A binary PPM image per frame
+  Png,  // A PNG image per frame
+  // Every frame in a single file of RGB24 pixels, cropped or padded to the size of the first one. For
+  // a video: ffmpeg -f rawvideo -pix_fmt rgb24 -s <width>x<height> -i frames.rgb -c:v ffv1 frames.mkv
+  Raw,
+};
+
+// What happens to a frame when the worker is behind by FrameDumpSettings::queue_depth frames
+enum class FrameDropPolicy : u8 {
+  Wait,  // Emulation waits for the worker, no frame is ever dropped
+  Drop,  // The frame isn't dumped, for emulation to keep its speed
+};
+
+struct FrameDumpSettings {
+  fs::path dir;  // Images are frame_<number>.<format>, the raw stream frames.rgb
+  FrameDumpFormat format{ FrameDumpFormat::Ppm };
+  FrameDropPolicy drop_policy{ FrameDropPolicy::Wait };
+  u32 queue_depth{ 4 };  // Frames waiting for the worker at most, at least 1
+};
+
+// The display area of VRAM at the end of a frame, as the halfwords of its rows
+struct DisplaySnapshot {
+  u64 number{};  // Frames dropped (see FrameDropPolicy) are numbered too
+  u32 width{};   // In pixels
+  u32 height{};
+  bool is_24bit{};   // Pixels are packed across halfwords
+  u32 row_length{};  // Halfwords per row, ceil(width * 3 / 2) when 24 bit
+  std::vector<u16> halfwords;
+};
+
+// Writes frames on a worker thread: the emulation thread only copies the display area of VRAM into one
+// of a few pooled snapshots, which the worker converts to RGB, encodes and writes. Only one thread may
+// take and push snapshots.
+class FrameDumper {
+ public:
+  explicit FrameDumper(const FrameDumpSettings& settings);
+  FrameDumper(const FrameDumper&) = delete;
+  FrameDumper& operator=(const FrameDumper&) = delete;
+  // Waits for the queued frames to be written
+  ~FrameDumper();
+
+  // The snapshot to fill with the current frame, then to hand to push(). Null if the frame is dropped,
+  // otherwise waits for room in the queue if needed.
+  DisplaySnapshot* next_snapshot();
+  void push();
+
+ private:
+  void run();
+  void write(const DisplaySnapshot& snapshot);
+  void write_raw(u32 width, u32 height);
+
+  const FrameDumpSettings m_settings;
+
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;  // Of the worker
+  std::condition_variable m_room;  // Of next_snapshot(), when waiting for the worker
+  bool m_quit{};
+
+  DisplaySnapshot m_next;                // Filled by the emulation thread
+  std::vector<DisplaySnapshot> m_queue;  // Pushed, oldest first
+  std::vector<DisplaySnapshot> m_free;   // Buffers to take snapshots in again
+  u64 m_frame_count{};                   // Taken or dropped
+  u64 m_dropped_count{};
+
+  // Of the worker
+  std::vector<u8> m_rgb;
+  std::vector<u8> m_encoded;
+  std::ofstream m_raw_file;
+  u32 m_raw_width{};  // Of the first frame, once it's written
+  u32 m_raw_height{};
+  u64 m_written_count{};
+};
+
+}  // namespace emulator
@@ -0,0 +1,32 @@
+#include <emulator/frame_pacer.hpp>
+
+#include <gpu/gpu.hpp>
+
+#include <thread>
+
+namespace emulator {
+
+namespace {
+
+// Left to spin at the end of a frame, more than a sleep usually oversleeps by
+constexpr auto SPIN_DURATION = std::chrono::milliseconds(2);
+
+}  // namespace
+
+void FramePacer::wait(u32 frame_cycles) {
+  m_frame_end +=
+      std::chrono::nanoseconds((u64)frame_cycles * 1'000'000'000 / gpu::CPU_CYCLES_PER_SECOND);
+
+  const auto now = Clock::now();
+  if (m_frame_end <= now) {
+    m_frame_end = now;
+    return;
+  }
+
+  if (m_frame_end - now > SPIN_DURATION)
+    std::this_thread::sleep_until(m_frame_end - SPIN_DURATION);
+  while (Clock::now() < m_frame_end)
+    std::this_thread::yield();
+}
+
+}  // namespace emulator
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <chrono>
+
+namespace emulator {
+
+// Limits emulation to the framerate of the console. Sleeps alone wake up late by up to the granularity
+// of the OS scheduler, often more than a millisecond: the pacer sleeps until shortly before the end of
+// the frame, then spins for the rest.
+class FramePacer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Waits for the end of the frame that began at the previous wait(), as long as frame_cycles of the CPU
+  // (see Emulator::frame_cycles(), NTSC and PAL frames differ). Late frames aren't caught up on, the
+  // next frame instead begins now.
+  void wait(u32 frame_cycles);
+
+ private:
+  Clock::time_point m_frame_end{};
+};
+
+}  // namespace emulator
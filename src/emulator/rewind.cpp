@@ -0,0 +1,158 @@
+#include <emulator/rewind.hpp>
+
+#include <util/log.hpp>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace emulator {
+
+namespace {
+
+// Buffers kept for push() to hand back, more only pile up while the worker lags behind
+constexpr size_t MAX_FREE_BUFFERS = 2;
+
+}  // namespace
+
+RewindBuffer::RewindBuffer() : m_thread(&RewindBuffer::run, this) {}
+
+RewindBuffer::~RewindBuffer() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+}
+
+void RewindBuffer::push(std::vector<byte>& state) {
+  std::vector<byte> spare;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_free.empty()) {
+      spare = std::move(m_free.back());
+      m_free.pop_back();
+    }
+    m_queue.push_back(std::move(state));
+  }
+  state = std::move(spare);
+  m_wake.notify_one();
+}
+
+bool RewindBuffer::pop(std::vector<byte>& state) {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  wait_until_idle(lock);
+  if (m_latest.empty())
+    return false;
+
+  state.swap(m_latest);
+  m_latest.clear();
+  if (m_deltas.empty())
+    return true;
+
+  // The state before it is the XOR of it with the delta
+  Delta& delta = m_deltas.back();
+  m_xor.resize(delta.delta_size);
+  uLongf xor_size = (uLongf)delta.delta_size;
+  const int result =
+      uncompress(m_xor.data(), &xor_size, delta.compressed.data(), (uLong)delta.compressed.size());
+  if (result != Z_OK || xor_size != delta.delta_size) {
+    LOG_ERROR("Could not decompress a rewind state ({}), dropping the older ones", result);
+    m_deltas.clear();
+    m_memory_used = 0;
+    return true;
+  }
+
+  m_latest.assign(state.begin(), state.end());
+  m_latest.resize(delta.delta_size);
+  for (size_t i = 0; i < delta.delta_size; ++i)
+    m_latest[i] ^= m_xor[i];
+  m_latest.resize(delta.state_size);
+
+  m_memory_used -= delta.compressed.size();
+  m_deltas.pop_back();
+  return true;
+}
+
+size_t RewindBuffer::size() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  wait_until_idle(lock);
+  return m_latest.empty() ? 0 : m_deltas.size() + 1;
+}
+
+size_t RewindBuffer::memory_used() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  wait_until_idle(lock);
+  return m_memory_used;
+}
+
+void RewindBuffer::run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (true) {
+    m_wake.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+    if (m_quit)
+      return;
+
+    std::vector<byte> state = std::move(m_queue.front());
+    m_queue.erase(m_queue.begin());
+    m_busy = true;
+
+    // pop() and the accessors wait for the worker to be idle, so the states are its own meanwhile
+    lock.unlock();
+    add(state);
+    lock.lock();
+
+    if (m_free.size() < MAX_FREE_BUFFERS)
+      m_free.push_back(std::move(state));
+    m_busy = false;
+    if (m_queue.empty())
+      m_idle.notify_all();
+  }
+}
+
+void RewindBuffer::add(std::vector<byte>& state) {
+  if (m_latest.empty()) {
+    m_latest.swap(state);
+    return;
+  }
+
+  // Both states padded with zeros to the longer one, the XOR then gives either from the other
+  const size_t delta_size = std::max(m_latest.size(), state.size());
+  m_xor.assign(delta_size, 0);
+  std::memcpy(m_xor.data(), m_latest.data(), m_latest.size());
+  for (size_t i = 0; i < state.size(); ++i)
+    m_xor[i] ^= state[i];
+
+  Delta delta;
+  delta.state_size = m_latest.size();
+  delta.delta_size = delta_size;
+  delta.compressed.resize(compressBound((uLong)delta_size));
+  uLongf compressed_size = (uLongf)delta.compressed.size();
+  const int result = compress2(delta.compressed.data(), &compressed_size, m_xor.data(),
+                               (uLong)delta_size, Z_BEST_SPEED);
+  if (result != Z_OK) {
+    // Older states can't be reached without this one
+    LOG_ERROR("Could not compress a rewind state ({}), dropping the older ones", result);
+    m_deltas.clear();
+    m_memory_used = 0;
+  } else {
+    delta.compressed.resize(compressed_size);
+    delta.compressed.shrink_to_fit();
+    m_memory_used += compressed_size;
+    m_deltas.push_back(std::move(delta));
+  }
+  m_latest.swap(state);
+
+  while (m_memory_used > REWIND_BUFFER_BUDGET && !m_deltas.empty()) {
+    m_memory_used -= m_deltas.front().compressed.size();
+    m_deltas.pop_front();
+  }
+}
+
+void RewindBuffer::wait_until_idle(std::unique_lock<std::mutex>& lock) {
+  m_idle.wait(lock, [this] { return m_queue.empty() && !m_busy; });
+}
+
+}  // namespace emulator
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace emulator {
+
+// Frames between two rewind snapshots
+constexpr u32 REWIND_INTERVAL = 10;
+// Compressed deltas kept at most, the oldest ones are dropped past it
+constexpr size_t REWIND_BUFFER_BUDGET = 64 * 1024 * 1024;
+
+// Ring of past save states to step back through, one every few frames. Only the latest state is kept
+// whole, each older one is stored as the XOR of it with the state after it: what a frame doesn't
+// write (most of RAM and VRAM) XORs to zeros that deflate to next to nothing. Deltas are compressed on
+// a worker thread so that pushing a state costs the emulation thread no more than a swap.
+class RewindBuffer {
+ public:
+  RewindBuffer();
+  RewindBuffer(const RewindBuffer&) = delete;
+  RewindBuffer& operator=(const RewindBuffer&) = delete;
+  ~RewindBuffer();
+
+  // Takes the state, which is swapped with a buffer of an earlier one for the next save to reuse
+  void push(std::vector<byte>& state);
+  // Takes the latest state out into state, false once there are none left
+  bool pop(std::vector<byte>& state);
+
+  // States that can be popped, and the memory taken by their deltas
+  size_t size();
+  size_t memory_used();
+
+ private:
+  // A state, as the XOR with the state pushed after it
+  struct Delta {
+    std::vector<byte> compressed;
+    size_t state_size{};  // Of the state itself
+    size_t delta_size{};  // Of the XOR before compression, as long as the longer of both states
+  };
+
+  void run();
+  // Makes state the latest one, turning the previous latest into a delta
+  void add(std::vector<byte>& state);
+  void wait_until_idle(std::unique_lock<std::mutex>& lock);
+
+  std::thread m_thread;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_idle;
+  bool m_quit{};
+  bool m_busy{};  // The worker is adding a state
+
+  std::vector<std::vector<byte>> m_queue;  // Pushed, waiting for the worker
+  std::vector<std::vector<byte>> m_free;   // Buffers to hand back to push()
+
+  std::vector<byte> m_latest;  // Whole, empty when there are no states
+  std::vector<byte> m_xor;     // Scratch of the worker
+  std::deque<Delta> m_deltas;  // Oldest first
+  size_t m_memory_used{};
+};
+
+}  // namespace emulator
@@ -0,0 +1,85 @@
+#include <emulator/scheduler.hpp>
+
+#include <util/state_stream.hpp>
+
+#include <algorithm>
+
+namespace emulator {
+
+Scheduler::Scheduler() {
+  update_slice_length();
+}
+
+void Scheduler::schedule_at(EventType type, u64 deadline) {
+  auto& ev = event(type);
+  const bool was_next = ev.pending && ev.deadline == m_next_deadline;
+  ev.deadline = deadline;
+  ev.pending = true;
+
+  if (was_next)
+    update_next_deadline();
+  else if (deadline < m_next_deadline)
+    m_next_deadline = deadline;
+  update_slice_length();  // Cut the running slice short if needed
+}
+
+void Scheduler::cancel(EventType type) {
+  auto& ev = event(type);
+  if (!ev.pending)
+    return;
+
+  ev.pending = false;
+  if (ev.deadline == m_next_deadline)
+    update_next_deadline();
+  // The current slice is left as is, ending it a bit early is harmless
+}
+
+void Scheduler::run_events() {
+  m_slice_start += m_slice_elapsed;
+  m_slice_elapsed = 0;
+
+  // Callbacks can schedule new events, possibly already due ones, so pick them one at a time
+  while (m_next_deadline <= m_slice_start) {
+    auto it = std::find_if(m_events.begin(), m_events.end(), [this](const Event& ev) {
+      return ev.pending && ev.deadline == m_next_deadline;
+    });
+    it->pending = false;
+    update_next_deadline();
+
+    if (it->callback)
+      it->callback();
+  }
+
+  update_slice_length();
+}
+
+void Scheduler::serialize(util::StateStream& s) {
+  s.section("SCHD");
+  for (auto& ev : m_events) {
+    s.value(ev.deadline);
+    s.value(ev.pending);
+  }
+  s.value(m_slice_start);
+  s.value(m_slice_elapsed);
+
+  if (s.is_loading()) {
+    update_next_deadline();
+    update_slice_length();
+  }
+}
+
+void Scheduler::update_next_deadline() {
+  m_next_deadline = std::numeric_limits<u64>::max();
+  for (const auto& ev : m_events) {
+    if (ev.pending)
+      m_next_deadline = std::min(m_next_deadline, ev.deadline);
+  }
+}
+
+void Scheduler::update_slice_length() {
+  const u64 until_next = (m_next_deadline > m_slice_start) ? m_next_deadline - m_slice_start : 0;
+  m_slice_length = std::min(until_next, m_slice_elapsed + MAX_SLICE_CYCLES);
+  m_slice_length = std::max(m_slice_length, m_slice_elapsed);  // Past deadlines end the slice right away
+}
+
+}  // namespace emulator
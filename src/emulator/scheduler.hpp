@@ -0,0 +1,95 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <array>
+#include <functional>
+#include <limits>
+
+namespace cpu {
+class Recompiler;
+}
+
+namespace util {
+class StateStream;
+}
+
+namespace emulator {
+
+// Everything that used to be polled once per emulation step. There's at most one pending event of each
+// type, scheduling it again replaces the previous deadline.
+enum class EventType : u8 {
+  Vblank,
+  Timers,       // Next timer target/overflow IRQ
+  DmaIrq,
+  CdromIrq,     // Response ready
+  CdromSector,  // Next sector read while reading/playing
+  JoypadAck,
+  Spu,          // Next batch of samples
+
+  Count,
+};
+
+// Longest the CPU runs without coming back to the scheduler, even with nothing pending
+constexpr u64 MAX_SLICE_CYCLES = 1 << 16;
+
+// Timestamped event queue, in system clock cycles. The CPU runs in slices ending at the next deadline,
+// events scheduled from the CPU side that fall before the end of the current slice cut it short.
+//
+// With this few event types a flat array with the next deadline cached beats a heap: (re)scheduling an
+// event just overwrites its slot, with no lazy deletion needed.
+class Scheduler {
+ public:
+  using Callback = std::function<void()>;
+
+  Scheduler();
+
+  void set_callback(EventType type, Callback callback) { event(type).callback = std::move(callback); }
+
+  // Schedules the event delay cycles from now
+  void schedule(EventType type, u64 delay) { schedule_at(type, now() + delay); }
+  void schedule_at(EventType type, u64 deadline);
+  void cancel(EventType type);
+
+  bool is_scheduled(EventType type) const { return event(type).pending; }
+  // Deadline of the pending or last run event, used to keep periodic events drift-free
+  u64 deadline(EventType type) const { return event(type).deadline; }
+
+  // Current time, including the part of the slice the CPU has already run
+  u64 now() const { return m_slice_start + m_slice_elapsed; }
+
+  // CPU side
+  void add_cycles(u32 cycles) { m_slice_elapsed += cycles; }
+  bool slice_done() const { return m_slice_elapsed >= m_slice_length; }
+  void end_slice() { m_slice_elapsed = m_slice_length; }  // Skips to the next event
+
+  // Makes the elapsed part of the slice permanent, runs events that are due and starts the next slice
+  void run_events();
+
+  // The time and deadlines, callbacks stay as they are. Only between slices.
+  void serialize(util::StateStream& s);
+
+ private:
+  friend class cpu::Recompiler;  // Recompiled code counts the cycles of the slice itself
+
+  struct Event {
+    u64 deadline{};
+    bool pending{};
+    Callback callback;
+  };
+
+  Event& event(EventType type) { return m_events[static_cast<size_t>(type)]; }
+  const Event& event(EventType type) const { return m_events[static_cast<size_t>(type)]; }
+
+  void update_next_deadline();
+  void update_slice_length();
+
+  std::array<Event, static_cast<size_t>(EventType::Count)> m_events{};
+  u64 m_next_deadline{ std::numeric_limits<u64>::max() };
+
+  u64 m_slice_start{};
+  u64 m_slice_elapsed{};
+  u64 m_slice_length{};
+};
+
+}  // namespace emulator
@@ -13,6 +13,14 @@ enum class View : s32 {
 
 enum class ScreenScale : s32 { x1, x1_5, x2, x3, x4 };
 
+// Of the hardware renderer, as a multiple of the VRAM resolution
+enum class InternalResolution : s32 { x1, x2, x3, x4 };
+
+enum class CpuEngine : s32 {
+  Interpreter,
+  Recompiler,  // x86-64 only for now (AArch64 to do), falls back to the interpreter elsewhere
+};
+
 struct Settings {
   View screen_view{ View::Vram };
   bool window_size_changed{ true };
@@ -28,13 +36,37 @@ struct Settings {
 
   bool limit_framerate{};
   bool limit_framerate_changed{ true };
+  s32 frame_skip{};  // Frames emulated without presenting them, for each presented frame
+  // Frames emulated on from a save state of each frame, the last one presented in its place before
+  // loading the state back. Hides as much input lag of the game, only with the software rasterizer.
+  s32 run_ahead{};
+  bool turbo{};      // Emulate uncapped, presenting a frame about once per host refresh
+  bool mute_audio{};
+
+  CpuEngine cpu_engine{ CpuEngine::Interpreter };
+  bool skip_idle_loops{ true };  // Skip the rest of a CPU step once the CPU is found polling in a loop
+  bool hle_bios{};               // Run hot BIOS functions (memcpy, strlen...) natively
+  bool fast_boot{};              // Skip the BIOS intro, boot the executable as soon as the kernel is up
+  bool threaded_gpu{};           // Run GPU commands on a separate render thread
+  bool parallel_raster{};        // Rasterize triangles on a pool of worker threads
+  bool hw_renderer{};            // Draw with OpenGL, opaque only (see HwRenderer), without threaded GPU
+  bool threaded_emulation{};     // Emulate on a thread of its own, without hardware renderer
+  InternalResolution internal_resolution{ InternalResolution::x1 };
+  bool rewind{};     // Keep a save state every REWIND_INTERVAL frames to step back through
+  bool rewinding{};  // Step back one of them each frame instead of emulating, while held in the GUI
 
   // Logging
+  bool record_gp0{};        // Keep the last GP0 commands for the GP0 Commands window
+  bool overdraw_heatmap{};  // Show how many times each pixel was drawn last frame instead of VRAM
   bool log_trace_cpu{};
+  bool sample_guest_pc{};  // Feed the Guest PC Profiler window, starts over each time it's turned on
+  bool log_bios_calls{};   // Only available with LOG_BIOS_CALLS, off to keep the CPU loop uninstrumented
 
   bool fullscreen{};
   bool fullscreen_changed{};
 
+  u32 get_internal_resolution_scale() const { return (u32)internal_resolution + 1; }
+
   f32 get_screen_scale() const {
     switch (screen_scale) {
       case ScreenScale::x1: return 1;
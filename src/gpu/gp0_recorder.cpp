@@ -0,0 +1,34 @@
+#include <gpu/gp0_recorder.hpp>
+
+namespace gpu {
+
+Gp0Recorder::Gp0Recorder() : m_words(std::make_unique<u32[]>(GP0_RECORDER_SIZE)) {}
+
+void Gp0Recorder::record(Gp0CommandType type, const renderer::rasterizer::Gp0Command& cmd, u32 frame) {
+  const u32 size = cmd.size() + 1;
+  while (m_head + size - m_tail > GP0_RECORDER_SIZE) {
+    m_tail += record_size(m_tail);
+    if (--m_frames.front().count == 0)
+      m_frames.pop_front();
+    else
+      m_frames.front().first = m_tail;
+  }
+
+  if (m_frames.empty() || m_frames.back().frame != (u16)frame)
+    m_frames.push_back({ (u16)frame, m_head, 0 });
+  ++m_frames.back().count;
+  word(m_head++) = cmd.size() | (u32)type << 8 | (frame & 0xFFFF) << 16;
+  for (const u32 cmd_word : cmd)
+    word(m_head++) = cmd_word;
+}
+
+Gp0Recorder::Record Gp0Recorder::read(u64 pos) const {
+  const u32 header = word(pos);
+
+  Record record{ (Gp0CommandType)((header >> 8) & 0xFF), (u16)(header >> 16), {} };
+  for (u32 i = 0; i < (header & 0xFF); ++i)
+    record.cmd.push_back(word(pos + 1 + i));
+  return record;
+}
+
+}  // namespace gpu
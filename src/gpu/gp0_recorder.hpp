@@ -0,0 +1,74 @@
+#pragma once
+
+#include <gpu/gpu.hpp>
+#include <renderer/rasterizer.hpp>
+#include <util/types.hpp>
+
+#include <deque>
+#include <memory>
+
+namespace gpu {
+
+// Words kept by the recorder (1 MiB), the oldest commands are dropped to make room for new ones
+constexpr u32 GP0_RECORDER_SIZE = 1 << 18;
+
+// Ring buffer of the last GP0 commands and the frames they were issued on, for debugging. Each command
+// is packed as a header word followed by the command's words, so recording one never allocates.
+class Gp0Recorder {
+ public:
+  struct Record {
+    Gp0CommandType type;
+    u16 frame;  // Low bits of the frame number
+    renderer::rasterizer::Gp0Command cmd;
+  };
+
+  class Iterator {
+   public:
+    Iterator(const Gp0Recorder& recorder, u64 pos) : m_recorder(&recorder), m_pos(pos) {}
+
+    Record operator*() const { return m_recorder->read(m_pos); }
+    Iterator& operator++() {
+      m_pos += m_recorder->record_size(m_pos);
+      return *this;
+    }
+    bool operator==(const Iterator& rhs) const { return m_pos == rhs.m_pos; }
+    bool operator!=(const Iterator& rhs) const { return m_pos != rhs.m_pos; }
+
+   private:
+    const Gp0Recorder* m_recorder;
+    u64 m_pos;
+  };
+
+  // The records of one frame, which follow one another
+  struct FrameRecords {
+    u16 frame;
+    u64 first;  // Position of the first record, see at()
+    u32 count;
+  };
+
+  Gp0Recorder();
+
+  void record(Gp0CommandType type, const renderer::rasterizer::Gp0Command& cmd, u32 frame);
+
+  // Oldest record first
+  Iterator begin() const { return { *this, m_tail }; }
+  Iterator end() const { return { *this, m_head }; }
+  Iterator at(u64 pos) const { return { *this, pos }; }
+  // Oldest frame first. Kept up to date as commands are recorded and dropped, for views of the records
+  // not to walk them all.
+  const std::deque<FrameRecords>& frames() const { return m_frames; }
+
+ private:
+  u32& word(u64 pos) const { return m_words[pos % GP0_RECORDER_SIZE]; }
+  // In words, header included
+  u32 record_size(u64 pos) const { return (word(pos) & 0xFF) + 1; }
+  Record read(u64 pos) const;
+
+  std::unique_ptr<u32[]> m_words;
+  // Positions only ever grow, they're wrapped when accessing m_words
+  u64 m_tail{};  // Header of the oldest record
+  u64 m_head{};  // Where the next record goes
+  std::deque<FrameRecords> m_frames;
+};
+
+}  // namespace gpu
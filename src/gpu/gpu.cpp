@@ -1,11 +1,18 @@
 #include <gpu/gpu.hpp>
 
+#include <gpu/gp0_recorder.hpp>
+#include <gpu/gpu_capture.hpp>
+#include <gpu/gpu_thread.hpp>
+#include <renderer/hw_renderer.hpp>
 #include <util/bit_utils.hpp>
 #include <util/log.hpp>
+#include <util/state_stream.hpp>
 
 #include <gsl-lite.hpp>
 
+#include <algorithm>
 #include <bitset>
+#include <cstring>
 #include <functional>
 #include <unordered_map>
 #include <utility>
@@ -14,13 +21,150 @@ namespace gpu {
 
 Gpu::Gpu() {
   m_vram = std::make_unique<std::array<u16, VRAM_WIDTH * VRAM_HEIGHT>>();
-  m_gp0_cmd.reserve(MAX_GP0_CMD_LEN);
+}
+
+Gpu::~Gpu() = default;
+
+void Gpu::set_threaded(bool threaded) {
+  if (threaded == is_threaded())
+    return;
+
+  // Stopping the thread runs the writes still in the FIFO first
+  if (threaded)
+    m_thread = std::make_unique<GpuThread>(*this);
+  else
+    m_thread.reset();
+}
+
+void Gpu::set_raster_workers(u32 worker_count) {
+  if (worker_count == m_rasterizer.worker_count())
+    return;
+
+  sync();
+  m_rasterizer.set_worker_count(worker_count);
+}
+
+void Gpu::set_hw_renderer(renderer::HwRenderer* hw_renderer) {
+  sync();
+
+  // Either renderer carries on from what the other one drew
+  if (m_hw_renderer) {
+    m_hw_renderer->download();
+    mark_vram_dirty({ 0, 0, VRAM_WIDTH, VRAM_HEIGHT });
+  }
+  m_hw_renderer = hw_renderer;
+  if (m_hw_renderer)
+    m_hw_renderer->upload({ 0, 0, VRAM_WIDTH, VRAM_HEIGHT });
+}
+
+void Gpu::set_gp0_recording(bool recording) {
+  if (recording == (m_gp0_recorder != nullptr))
+    return;
+
+  // The render thread records the commands it runs
+  sync();
+  if (recording)
+    m_gp0_recorder = std::make_unique<Gp0Recorder>();
+  else
+    m_gp0_recorder.reset();
+}
+
+void Gpu::set_overdraw_tracking(bool tracking) {
+  // The render thread draws
+  sync();
+  m_rasterizer.set_overdraw_tracking(tracking);
+}
+
+void Gpu::start_capture(u32 frame_count) {
+  m_capture = std::make_unique<GpuCapture>(*this, frame_count);
+}
+
+std::unique_ptr<GpuCapture> Gpu::take_finished_capture() {
+  if (m_capture && m_capture->is_done())
+    return std::move(m_capture);
+  return nullptr;
+}
+
+void Gpu::set_skip_drawing(bool skip) {
+  if (skip == m_skip_drawing)
+    return;
+  if (m_capture)
+    m_capture->skip_drawing(skip);
+
+  // The render thread decides whether to draw
+  if (m_thread)
+    m_thread->sync();
+  m_skip_drawing = skip;
+}
+
+void Gpu::sync() {
+  if (m_thread)
+    m_thread->sync();
+  m_rasterizer.flush();
+  if (m_hw_renderer)
+    m_hw_renderer->flush();
+}
+
+void Gpu::mark_vram_dirty(const renderer::rasterizer::VramRect& rect) {
+  renderer::rasterizer::TextureCache::for_each_block_of(rect,
+                                                        [this](u32 block) { m_vram_dirty.mark(block); });
+}
+
+renderer::rasterizer::VramBlocks Gpu::take_dirty_vram() {
+  return m_vram_dirty.take(m_screen_cursor);
+}
+
+void Gpu::serialize(util::StateStream& s) {
+  sync();
+  if (m_hw_renderer && !s.is_loading())
+    m_hw_renderer->download();
+
+  s.section("GPU ");
+  s.value(m_gpustat);
+  s.value(m_tex_window);
+  s.value(m_drawing_area_top_left);
+  s.value(m_drawing_area_bottom_right);
+  s.value(m_drawing_offset);
+  s.value(m_draw_mode);
+  s.value(m_display_area);
+  s.value(m_hdisplay_range);
+  s.value(m_vdisplay_range);
+  s.bytes(m_vram->data(), sizeof(*m_vram));
+
+  s.value(m_vram_transfer_x);
+  s.value(m_vram_transfer_y);
+  s.value(m_vram_transfer_x_start);
+  s.value(m_vram_transfer_y_start);
+  s.value(m_vram_transfer_width);
+  s.value(m_vram_transfer_height);
+  s.value(m_frames);
+
+  s.value(m_gp0_cmd_type);
+  s.value(m_gp0_arg_count);
+  s.value(m_gp0_arg_index);
+  s.value(m_gp0_cmd);
+
+  // Draws queued while skipping are kept queued, so that runs from the state skip the same way
+  s.vector(m_deferred_draws);
+  s.value(m_deferred_dirty);
+  s.value(m_deferred_sampled);
+
+  if (s.is_loading()) {
+    // The render thread is idle, its GPUSTAT shadow is taken from the state
+    if (m_thread)
+      m_thread->sync();
+    m_vram_dirty.mark_all();
+    if (m_hw_renderer)
+      m_hw_renderer->upload({ 0, 0, VRAM_WIDTH, VRAM_HEIGHT });
+  }
 }
 
 u32 Gpu::read_reg(u32 addr) {
   switch (addr) {
     case 0: return dma_read_vram();
-    case 4: return gpustat().word;
+    case 4:
+      // Without waiting for the render thread, GPUSTAT only depends on the commands pushed to it
+      return gpustat(m_thread ? m_thread->gpustat() : m_gpustat).word;
   }
   // Unreachable because the GPU Range only includes the above 2 registers
   return 0;
@@ -29,7 +173,14 @@ u32 Gpu::read_reg(u32 addr) {
 void Gpu::write_reg(u32 addr, u32 val) {
   switch (addr) {
     case 0: gp0(val); break;
-    case 4: gp1(val); break;
+    case 4:
+      if (m_capture)
+        m_capture->gp1(val);
+      if (m_thread)
+        m_thread->push(GpuPort::Gp1, val);
+      else
+        process_gp1(val);
+      break;
   }
 }
 
@@ -48,25 +199,28 @@ u16 Gpu::get_vram_idx(u32 vram_idx) const {
 
 void Gpu::set_vram_idx(u32 vram_idx, u16 val) {
   vram()[vram_idx] = val;
+  m_vram_dirty.mark(renderer::rasterizer::vram_block_of(vram_idx));
 }
 
-bool Gpu::step(u32 cycles_to_emulate) {
-  m_vblank_cycles_left -= cycles_to_emulate;
+void Gpu::vblank() {
+  // The frame is about to be presented, and the GP0 recorder is shared with the render thread
+  sync();
 
-  bool trigger_vblank = (m_vblank_cycles_left <= 0);
-
-  if (trigger_vblank) {
-    m_vblank_cycles_left += CPU_CYCLES_PER_FRAME;
-    ++m_frames;
-
-    if (GP0_DEBUG_RECORD) {
-      if (m_gp0_cmds_record.size() == 5000)  // Cull at 5000 records
-        m_gp0_cmds_record.clear();
-      m_gp0_cmds_record.emplace_back(std::move(m_gp0_cmds_cur_frame));
-    }
+  // Queued draws are kept over skipped frames, their output may still be displayed or sampled later on
+  if (!m_skip_drawing && !m_deferred_draws.empty()) {
+    draw_deferred();
+    sync();
   }
+  m_rasterizer.end_frame();
 
-  return trigger_vblank;
+  ++m_frames;
+  if (m_capture)
+    m_capture->vblank(hash_vram(*this));
+}
+
+u32 Gpu::cycles_per_frame() const {
+  const GpuStatus status = m_thread ? m_thread->gpustat() : m_gpustat;
+  return status.video_mode ? CPU_CYCLES_PER_FRAME_PAL : CPU_CYCLES_PER_FRAME;
 }
 
 u32 Gpu::setup_vram_transfer(u32 pos_word, u32 size_word) {
@@ -77,11 +231,18 @@ u32 Gpu::setup_vram_transfer(u32 pos_word, u32 size_word) {
   m_vram_transfer_height = ((((size_word >> 16) & 0xFFFF) - 1) & 0x1FF) + 1;
 
   m_vram_transfer_x_start = m_vram_transfer_x;
+  m_vram_transfer_y_start = m_vram_transfer_y;
 
   const auto pixel_count = (m_vram_transfer_width * m_vram_transfer_height + 1) & ~1u;
   return pixel_count;
 }
 
+renderer::rasterizer::VramRect Gpu::vram_transfer_rect() const {
+  return { m_vram_transfer_x_start, m_vram_transfer_y_start,
+           m_vram_transfer_x_start + m_vram_transfer_width,
+           m_vram_transfer_y_start + m_vram_transfer_height };
+}
+
 void Gpu::advance_vram_transfer_pos() {
   const auto rect_x = m_vram_transfer_x - m_vram_transfer_x_start;
   if (rect_x == m_vram_transfer_width - 1) {
@@ -111,7 +272,74 @@ DisplayResolution Gpu::get_resolution() const {
   return res;
 }
 
+DisplayResolution Gpu::get_visible_resolution() const {
+  const auto res = get_resolution();
+
+  // Dot clock cycles per pixel the horizontal range is counted in
+  u32 cycles_per_pixel = 7;
+  if (m_gpustat.horizontal_res_2 == 0)
+    switch (m_gpustat.horizontal_res_1) {
+      case 0: cycles_per_pixel = 10; break;
+      case 1: cycles_per_pixel = 8; break;
+      case 2: cycles_per_pixel = 5; break;
+      case 3: cycles_per_pixel = 4; break;
+    }
+
+  const u32 x1 = m_hdisplay_range.x1, x2 = m_hdisplay_range.x2;
+  const u32 y1 = m_vdisplay_range.y1, y2 = m_vdisplay_range.y2;
+  // Widths are rounded to 4 pixels, interlaced heights count the lines of both fields
+  const u32 width = x2 > x1 ? ((x2 - x1) / cycles_per_pixel + 2) & ~3u : 0;
+  const u32 height = y2 > y1 ? (y2 - y1) * (res.height / 240) : 0;
+  return { std::min(width, res.width), std::min(height, res.height) };
+}
+
 void Gpu::gp0(u32 cmd) {
+  if (m_capture)
+    m_capture->gp0(&cmd, 1);
+  if (m_thread)
+    m_thread->push(GpuPort::Gp0, cmd);
+  else
+    process_gp0(cmd);
+}
+
+void Gpu::gp0(const u32* words, u32 count) {
+  if (m_capture)
+    m_capture->gp0(words, count);
+  if (m_thread) {
+    m_thread->push(GpuPort::Gp0, words, count);
+    return;
+  }
+
+  while (count > 0) {
+    u32 consumed = 0;
+    if (m_gp0_cmd_type == Gp0CommandType::CopyCpuToVramTransferring)
+      consumed = do_cpu_to_vram_transfer(words, count);
+    else if (m_gp0_cmd_type != Gp0CommandType::None)
+      consumed = take_gp0_args(words, count);
+
+    // The opcode of a command, or its last argument, which issues it
+    if (consumed == 0) {
+      process_gp0(*words);
+      consumed = 1;
+    }
+    words += consumed;
+    count -= consumed;
+  }
+}
+
+u32 Gpu::take_gp0_args(const u32* words, u32 count) {
+  // Polylines have no fixed length, each argument has to be checked for the terminator
+  if (is_polyline())
+    return 0;
+
+  const u32 taken = std::min(count, m_gp0_arg_count - m_gp0_arg_index - 1);
+  for (u32 i = 0; i < taken; ++i)
+    m_gp0_cmd.push_back(words[i]);
+  m_gp0_arg_index += taken;
+  return taken;
+}
+
+void Gpu::process_gp0(u32 cmd) {
   if (m_gp0_cmd_type == Gp0CommandType::None) {
     m_gp0_cmd.clear();
     m_gp0_cmd.push_back(cmd);
@@ -171,30 +399,33 @@ void Gpu::gp0(u32 cmd) {
   // If it reaches here we know 'cmd' is an argument to some preceding command, or CPU -> VRAM transfer
   // image data
 
-  m_gp0_arg_index++;
-  //  LOG_TRACE("  GP0 arg: {:08X}", cmd);
-
   const bool is_transfer_data = (m_gp0_cmd_type == Gp0CommandType::CopyCpuToVramTransferring);
 
   if (is_transfer_data) {
-    do_cpu_to_vram_transfer(cmd);
+    do_cpu_to_vram_transfer(&cmd, 1);
     return;
   }
 
   // If it reaches here we know 'cmd' is an argument to some preceding command
 
-  m_gp0_cmd.push_back(cmd);
+  m_gp0_arg_index++;
+  //  LOG_TRACE("  GP0 arg: {:08X}", cmd);
 
-  bool command_issued = (m_gp0_arg_index == m_gp0_arg_count);
+  // A polyline ends with the terminator in place of the next vertex, or of its color
+  const bool is_polyline_segment = is_polyline();
+  if (is_polyline_segment && m_gp0_arg_index >= 2 &&
+      renderer::rasterizer::DrawCommand::Line::is_poly_terminator(cmd)) {
+    m_gp0_cmd_type = Gp0CommandType::None;
+    return;
+  }
+
+  m_gp0_cmd.push_back(cmd);
 
-  if (m_gp0_arg_count == MAX_GP0_CMD_LEN - 1)
-    if (!command_issued)
-      if (cmd == 0x55555555 || cmd == 0x50005000)
-        command_issued = true;
+  const bool command_issued = (m_gp0_arg_index == m_gp0_arg_count);
 
   if (command_issued) {
-    if (GP0_DEBUG_RECORD)
-      m_gp0_cmds_cur_frame.push_back({ m_gp0_cmd_type, m_gp0_cmd });
+    if (m_gp0_recorder)
+      m_gp0_recorder->record(m_gp0_cmd_type, m_gp0_cmd, m_frames);
 
     // Save temporary and reset it here instead of at the end, because following
     // handlers might change it themselves type and we wouldn't want to override that
@@ -203,50 +434,250 @@ void Gpu::gp0(u32 cmd) {
 
     // We have all the arguments, we can run the command
     switch (cmd_type) {
-      case Gp0CommandType::DrawPolygon: {
-        const u8 opcode = m_gp0_cmd[0] >> 24;
-        auto polygon = renderer::rasterizer::DrawCommand{ opcode }.polygon;
-        m_rasterizer.draw_polygon(polygon);
-        break;
-      }
-      case Gp0CommandType::DrawLine: {
-        const u8 opcode = m_gp0_cmd[0] >> 24;
-        auto line = renderer::rasterizer::DrawCommand{ opcode }.line;
-        // TODO:
-        LOG_WARN("Unimplemented rendering of {} line (op: {:02X})", line.is_poly() ? "poly" : "single",
-                 opcode);
-        break;
-      }
-      case Gp0CommandType::DrawRectangle: {
-        const u8 opcode = m_gp0_cmd[0] >> 24;
-        auto rectangle = renderer::rasterizer::DrawCommand{ opcode }.rectangle;
-        m_rasterizer.draw_rectangle(rectangle);
-        break;
-      }
+      case Gp0CommandType::DrawPolygon:
+      case Gp0CommandType::DrawLine:
+      case Gp0CommandType::DrawRectangle: draw_or_defer(cmd_type); break;
       case Gp0CommandType::FillRectangleInVram: gp0_fill_rect_in_vram(); break;
       case Gp0CommandType::CopyCpuToVram: gp0_copy_rect_cpu_to_vram(); break;
       case Gp0CommandType::CopyVramToCpu: gp0_copy_rect_vram_to_cpu(); break;
       case Gp0CommandType::CopyVramToVram: gp0_copy_rect_vram_to_vram(); break;
       case Gp0CommandType::Invalid: break;
     }
+
+    if (is_polyline_segment)
+      continue_polyline();
   }
 }
 
-void Gpu::gp0_mono_polyline_opaque(u32 cmd) {
-  LOG_TODO();
+bool Gpu::is_polyline() const {
+  return m_gp0_cmd_type == Gp0CommandType::DrawLine &&
+         renderer::rasterizer::DrawCommand{ (u8)(m_gp0_cmd[0] >> 24) }.line.is_poly();
 }
 
-void Gpu::gp0_draw_mode(u32 cmd) {
-  m_draw_mode.word = cmd;
+void Gpu::continue_polyline() {
+  // The end of the segment is the start of the next one, the command word holding its color
+  const u32 opcode = m_gp0_cmd[0] & 0xFF000000;
+  const bool is_gouraud = m_gp0_arg_count == 3;
+  const u32 color = (is_gouraud ? m_gp0_cmd[2] : m_gp0_cmd[0]) & 0xFFFFFF;
+  const u32 end = m_gp0_cmd[m_gp0_arg_count];
+
+  m_gp0_cmd.clear();
+  m_gp0_cmd.push_back(opcode | color);
+  m_gp0_cmd.push_back(end);
+  m_gp0_cmd_type = Gp0CommandType::DrawLine;
+  m_gp0_arg_index = 1;
+}
+
+void Gpu::draw_or_defer(Gp0CommandType type) {
+  if (!m_skip_drawing && m_deferred_draws.empty()) {
+    draw(type);
+    return;
+  }
+
+  const auto sampled = sampled_blocks(type);
+  const auto drawn = renderer::rasterizer::TextureCache::blocks_of(drawing_area_rect(draw_state()));
+  if (m_skip_drawing) {
+    // The queue keeps its draws in order, but what a draw samples has to be drawn already
+    if ((sampled & m_deferred_dirty).any())
+      draw_deferred();
+    m_deferred_draws.push_back({ type, sampled, draw_state(), m_gp0_cmd });
+    m_deferred_dirty |= drawn;
+    m_deferred_sampled |= sampled;
+    return;
+  }
+
+  if (((sampled | drawn) & m_deferred_dirty).any() || (drawn & m_deferred_sampled).any())
+    draw_deferred();
+  draw(type);
+}
+
+void Gpu::draw(Gp0CommandType type) {
+  switch (type) {
+    case Gp0CommandType::DrawPolygon: {
+      const u8 opcode = m_gp0_cmd[0] >> 24;
+      auto polygon = renderer::rasterizer::DrawCommand{ opcode }.polygon;
+      if (m_hw_renderer)
+        m_hw_renderer->draw_polygon(polygon);
+      else
+        m_rasterizer.draw_polygon(polygon);
+      break;
+    }
+    case Gp0CommandType::DrawLine: {
+      const u8 opcode = m_gp0_cmd[0] >> 24;
+      auto line = renderer::rasterizer::DrawCommand{ opcode }.line;
+      if (m_hw_renderer)
+        m_hw_renderer->draw_line(line);
+      else
+        m_rasterizer.draw_line(line);
+      break;
+    }
+    case Gp0CommandType::DrawRectangle: {
+      const u8 opcode = m_gp0_cmd[0] >> 24;
+      auto rectangle = renderer::rasterizer::DrawCommand{ opcode }.rectangle;
+      if (m_hw_renderer)
+        m_hw_renderer->draw_rectangle(rectangle);
+      else
+        m_rasterizer.draw_rectangle(rectangle);
+      break;
+    }
+    default: break;
+  }
+}
+
+renderer::rasterizer::VramBlocks Gpu::sampled_blocks(Gp0CommandType type) const {
+  using namespace renderer::rasterizer;
+
+  const auto draw_command = DrawCommand{ (u8)(m_gp0_cmd[0] >> 24) };
+  Position4 positions{};
+  Color4 colors{};
+  TextureInfo tex_info{};
+  if (type == Gp0CommandType::DrawPolygon && draw_command.polygon.texture_mapping) {
+    m_rasterizer.extract_draw_data_polygon(draw_command.polygon, m_gp0_cmd, positions, colors, tex_info);
+  } else if (type == Gp0CommandType::DrawRectangle && draw_command.rectangle.texture_mapping) {
+    Size size{};
+    m_rasterizer.extract_draw_data_rectangle(draw_command.rectangle, m_gp0_cmd, positions, colors,
+                                             tex_info, size);
+  } else {
+    return {};
+  }
+  return TextureCache::texture_blocks_of(tex_info.page, tex_info.palette.word);
+}
+
+renderer::rasterizer::VramRect Gpu::drawing_area_rect(const DrawState& state) {
+  // Same bounds as the renderers, the bottom right corner is exclusive
+  return { (s32)state.drawing_area_top_left.x, (s32)state.drawing_area_top_left.y,
+           (s32)state.drawing_area_bottom_right.x, (s32)state.drawing_area_bottom_right.y };
+}
+
+Gpu::DrawState Gpu::draw_state() const {
+  return { m_gpustat, m_draw_mode, m_tex_window, m_drawing_area_top_left, m_drawing_area_bottom_right,
+           m_drawing_offset };
+}
+
+void Gpu::set_draw_state(const DrawState& state) {
+  m_gpustat = state.gpustat;
+  m_draw_mode = state.draw_mode;
+  m_tex_window = state.tex_window;
+  m_drawing_area_top_left = state.drawing_area_top_left;
+  m_drawing_area_bottom_right = state.drawing_area_bottom_right;
+  m_drawing_offset = state.drawing_offset;
+}
 
+void Gpu::draw_deferred() {
+  if (m_deferred_draws.empty())
+    return;
+
+  // Each draw is drawn with the state it was issued with, the current command and state are kept
+  const auto gp0_cmd = m_gp0_cmd;
+  const auto state = draw_state();
+  for (const auto& deferred : m_deferred_draws) {
+    set_draw_state(deferred.state);
+    m_gp0_cmd = deferred.cmd;
+    draw(deferred.type);
+  }
+  set_draw_state(state);
+  m_gp0_cmd = gp0_cmd;
+
+  m_deferred_draws.clear();
+  update_deferred_blocks();
+}
+
+void Gpu::draw_deferred_before_read(const renderer::rasterizer::VramRect& rect) {
+  if (m_deferred_draws.empty())
+    return;
+  if ((renderer::rasterizer::TextureCache::blocks_of(rect) & m_deferred_dirty).any())
+    draw_deferred();
+}
+
+void Gpu::draw_deferred_before_write(const renderer::rasterizer::VramRect& rect) {
+  if (m_deferred_draws.empty())
+    return;
+  const auto blocks = renderer::rasterizer::TextureCache::blocks_of(rect);
+  if ((blocks & (m_deferred_dirty | m_deferred_sampled)).any())
+    draw_deferred();
+}
+
+void Gpu::drop_deferred_within(const renderer::rasterizer::VramRect& rect) {
+  if (m_deferred_draws.empty())
+    return;
+
+  // Draws only ever sample what the draws queued before them haven't drawn to (see draw_or_defer()), so
+  // what a dropped draw would have drawn is never needed
+  const auto is_within = [&](const DeferredDraw& draw) {
+    const auto area = drawing_area_rect(draw.state);
+    return rect.left <= area.left && area.right <= rect.right && rect.top <= area.top &&
+           area.bottom <= rect.bottom;
+  };
+  auto& draws = m_deferred_draws;
+  const auto size = draws.size();
+  draws.erase(std::remove_if(draws.begin(), draws.end(), is_within), draws.end());
+  if (draws.size() != size)
+    update_deferred_blocks();
+}
+
+void Gpu::update_deferred_blocks() {
+  m_deferred_dirty.reset();
+  m_deferred_sampled.reset();
+  for (const auto& draw : m_deferred_draws) {
+    m_deferred_dirty |= renderer::rasterizer::TextureCache::blocks_of(drawing_area_rect(draw.state));
+    m_deferred_sampled |= draw.sampled;
+  }
+}
+
+void GpuStatus::set_draw_mode(u32 cmd) {
   const u32 draw_mode_to_gpustat_mask = 0b11111111111u;
 
   // GPUSTAT.0-10 = GP0(E1).0-10
-  m_gpustat.word &= ~draw_mode_to_gpustat_mask;
-  m_gpustat.word |= cmd & draw_mode_to_gpustat_mask;
+  word &= ~draw_mode_to_gpustat_mask;
+  word |= cmd & draw_mode_to_gpustat_mask;
 
   // GPUSTAT.15 = GP0(E1).11
-  m_gpustat.tex_disable = (cmd & (1 << 11)) >> 11;
+  tex_disable = (cmd & (1 << 11)) >> 11;
+}
+
+void GpuStatus::set_mask_bit(u32 cmd) {
+  // GPUSTAT.11 = GP0(E6h).0
+  force_set_mask_bit = cmd & 1;
+  // GPUSTAT.12 = GP0(E6h).1
+  preserve_masked_bits = (cmd & 0b10) >> 1;
+}
+
+void GpuStatus::set_dma_direction(u32 cmd) {
+  dma_direction_ = cmd & 0b11;
+  u8 dma_req{};
+
+  switch (dma_direction()) {
+    case Off: dma_req = 0; break;
+    case Fifo: dma_req = 1; break;
+    case CpuToGp0: dma_req = ready_to_recv_dma_block; break;
+    case VRamToCpu: dma_req = ready_to_send_vram_to_cpu; break;
+  }
+
+  std::bitset<32> gpustat_bs(word);
+  gpustat_bs.set(26, dma_req);
+  word = gpustat_bs.to_ulong();
+}
+
+void GpuStatus::set_disp_mode(u32 cmd) {
+  const u32 disp_mode_to_gpustat_mask = 0b111111u;
+  const u32 gpustat_disp_mode_mask = 0b111111u << 17;
+
+  // GPUSTAT.17-22 = GP1(E8).0-5
+  word &= ~gpustat_disp_mode_mask;
+  word |= (cmd & disp_mode_to_gpustat_mask) << 17;
+
+  // GPUSTAT.16 = GP1(E8).6
+  horizontal_res_2 = (cmd & (1 << 6)) >> 6;
+  // GPUSTAT.14 = GP1(E8).7
+  reverse_flag = (cmd & (1 << 7)) >> 7;
+
+  // TODO: 24bit/direct mode
+  //  Ensures(disp_color_depth == 0);
+}
+
+void Gpu::gp0_draw_mode(u32 cmd) {
+  m_draw_mode.word = cmd;
+  m_gpustat.set_draw_mode(cmd);
 
   // GP0(E1).12
   m_draw_mode.rect_textured_x_flip = (cmd & (1 << 12)) >> 12;
@@ -255,10 +686,7 @@ void Gpu::gp0_draw_mode(u32 cmd) {
 }
 
 void Gpu::gp0_mask_bit(u32 cmd) {
-  // GPUSTAT.11 = GP0(E6h).0
-  m_gpustat.force_set_mask_bit = cmd & 1;
-  // GPUSTAT.12 = GP0(E6h).1
-  m_gpustat.preserve_masked_bits = cmd & 0b10 >> 1;
+  m_gpustat.set_mask_bit(cmd);
 }
 
 void Gpu::gp0_gpu_irq(u32 cmd) {
@@ -266,7 +694,6 @@ void Gpu::gp0_gpu_irq(u32 cmd) {
 }
 
 void Gpu::gp0_fill_rect_in_vram() {
-  // TODO: handle in renderer
   const auto color = renderer::rasterizer::Color::from_gp0(m_gp0_cmd[0]);
   const auto c16 = RGB16::from_RGB(color.r, color.g, color.b);
 
@@ -274,9 +701,25 @@ void Gpu::gp0_fill_rect_in_vram() {
   const auto size = renderer::rasterizer::Size::from_gp0_fill(m_gp0_cmd[2]);
   const renderer::rasterizer::Position pos_end = { pos_start.x + size.width, pos_start.y + size.height };
 
-  for (auto i_x = pos_start.x; i_x < pos_end.x; ++i_x)
-    for (auto i_y = pos_start.y; i_y < pos_end.y; ++i_y)
-      set_vram_pos<true>(i_x, i_y, c16.word);
+  // Queued draws go first, as they were issued before. The ones it fully draws over never have to be.
+  const renderer::rasterizer::VramRect rect = { pos_start.x, pos_start.y, pos_end.x, pos_end.y };
+  drop_deferred_within(rect);
+  draw_deferred_before_write(rect);
+  // TODO: handle in renderer
+  m_rasterizer.flush();
+
+  // Fills ignore the mask bit settings, rows wrap around VRAM
+  const u32 right_count = std::min<u32>(size.width, VRAM_WIDTH - pos_start.x);
+  for (auto i_y = pos_start.y; i_y < pos_end.y; ++i_y) {
+    u16* row = &vram()[(i_y % VRAM_HEIGHT) * VRAM_WIDTH];
+    std::fill_n(row + pos_start.x, right_count, c16.word);
+    std::fill_n(row, size.width - right_count, c16.word);
+  }
+  mark_vram_dirty(rect);
+
+  // The whole rectangle was written, so what was drawn to it doesn't need to be read back first
+  if (m_hw_renderer)
+    m_hw_renderer->upload(rect);
 }
 
 void Gpu::gp0_copy_rect_cpu_to_vram() {
@@ -284,6 +727,8 @@ void Gpu::gp0_copy_rect_cpu_to_vram() {
   const auto size_word = m_gp0_cmd[2];
 
   const auto pixel_count = setup_vram_transfer(pos_word, size_word);
+  draw_deferred_before_write(vram_transfer_rect());
+  m_rasterizer.flush();
 
   // Reset arg index, we are now counting transfer words, not the command's 2 arguments
   m_gp0_arg_index = 0;
@@ -302,6 +747,10 @@ void Gpu::gp0_copy_rect_vram_to_cpu() {
 
   const auto pixel_count = setup_vram_transfer(pos_word, size_word);
 
+  draw_deferred_before_read(vram_transfer_rect());
+  if (m_hw_renderer && m_hw_renderer->is_drawn(vram_transfer_rect()))
+    m_hw_renderer->download();
+
   LOG_DEBUG("Copying rect (x:{} y:{} w:{} h:{} count:{} hw) from VRAM to CPU", m_vram_transfer_x,
             m_vram_transfer_y, m_vram_transfer_width, m_vram_transfer_height, pixel_count);
 }
@@ -311,58 +760,105 @@ void Gpu::gp0_copy_rect_vram_to_vram() {
   const auto dest_pos_word = m_gp0_cmd[2];
   const auto size_word = m_gp0_cmd[3];
 
-  u16 dest_x = dest_pos_word & 0xFFFF;
-  u16 dest_y = (dest_pos_word >> 16) & 0xFFFF;
-
-  const auto dest_x_start = dest_x;
+  const u16 dest_x = dest_pos_word & 0x3FF;
+  const u16 dest_y = (dest_pos_word >> 16) & 0x1FF;
 
-  auto pixel_count = setup_vram_transfer(pos_word, size_word);
+  const auto pixel_count = setup_vram_transfer(pos_word, size_word);
 
   LOG_DEBUG("Copying rect (x:{} y:{} w:{} h:{} count:{} hw) from VRAM to VRAM, dest (x:{} y:{})",
             m_vram_transfer_x, m_vram_transfer_y, m_vram_transfer_width, m_vram_transfer_height,
             pixel_count, dest_x, dest_y);
 
-  while (pixel_count--) {
-    const auto src_word = get_vram_pos(m_vram_transfer_x, m_vram_transfer_y);
-
-    set_vram_pos<true>(dest_x, dest_y, src_word);
-
-    advance_vram_transfer_pos();
-
-    // advance dest pos
-    const auto dest_rect_x = dest_x - dest_x_start;
-    if (dest_rect_x == m_vram_transfer_width - 1) {
-      dest_x = dest_x_start;
-      dest_y++;
-    } else
-      dest_x++;
+  const renderer::rasterizer::VramRect dest_rect{ dest_x, dest_y, dest_x + m_vram_transfer_width,
+                                                  dest_y + m_vram_transfer_height };
+  draw_deferred_before_read(vram_transfer_rect());
+  draw_deferred_before_write(dest_rect);
+  m_rasterizer.flush();
+  if (m_hw_renderer && m_hw_renderer->is_drawn(vram_transfer_rect()))
+    m_hw_renderer->download();
+
+  // Copied a row at a time, in as many pieces as the source wraps around VRAM
+  for (u32 row = 0; row < m_vram_transfer_height; ++row) {
+    const u32 src_y = (m_vram_transfer_y + row) % VRAM_HEIGHT;
+    for (u32 copied = 0; copied < m_vram_transfer_width;) {
+      const u32 src_x = (m_vram_transfer_x + copied) % VRAM_WIDTH;
+      const u32 count = std::min<u32>(m_vram_transfer_width - copied, VRAM_WIDTH - src_x);
+      write_vram_row(dest_x + copied, dest_y + row, &vram()[src_y * VRAM_WIDTH + src_x], count);
+      copied += count;
+    }
   }
+  mark_vram_dirty(dest_rect);
+
+  if (m_hw_renderer)
+    m_hw_renderer->upload(dest_rect);
 
   // Transfer done, start processing new commands
   m_gp0_cmd_type = Gp0CommandType::None;
 }
 
-void Gpu::do_cpu_to_vram_transfer(u32 cmd) {
-  for (auto i = 0; i < 2; ++i) {
-    u16 src_word;
-    if (i == 0)
-      src_word = (u16)cmd;
-    else
-      src_word = (u16)(cmd >> 16);
-
-    //        LOG_TRACE("X: {:>4X} Y: {:>4X} SRC: 0x{:04X}", m_vram_transfer_x, m_vram_transfer_y,
-    //        src_word);
-
-    set_vram_pos<true>(m_vram_transfer_x, m_vram_transfer_y, src_word);
-    advance_vram_transfer_pos();
+u32 Gpu::do_cpu_to_vram_transfer(const u32* words, u32 count) {
+  const u32 word_count = std::min(count, m_gp0_arg_count - m_gp0_arg_index);
+  const u16 first_row = m_vram_transfer_y;
+  const u16 end_row = m_vram_transfer_y_start + m_vram_transfer_height;
+
+  // Halfwords come in the order they're in memory, the very last one is padding for odd sized images
+  const auto* src = reinterpret_cast<const u16*>(words);
+  u32 halfword_count = word_count * 2;
+  while (halfword_count > 0 && m_vram_transfer_y < end_row) {
+    const u32 row_x = m_vram_transfer_x - m_vram_transfer_x_start;
+    const u32 row_count = std::min<u32>(halfword_count, m_vram_transfer_width - row_x);
+    write_vram_row(m_vram_transfer_x, m_vram_transfer_y, src, row_count);
+    src += row_count;
+    halfword_count -= row_count;
+
+    if (row_x + row_count == m_vram_transfer_width) {
+      m_vram_transfer_x = m_vram_transfer_x_start;
+      m_vram_transfer_y++;
+    } else
+      m_vram_transfer_x += row_count;
   }
+  mark_vram_dirty({ m_vram_transfer_x_start, first_row, m_vram_transfer_x_start + m_vram_transfer_width,
+                    std::min<s32>(m_vram_transfer_y + 1, end_row) });
+
+  m_gp0_arg_index += word_count;
   if (m_gp0_arg_index == m_gp0_arg_count) {
+    if (m_hw_renderer)
+      m_hw_renderer->upload(vram_transfer_rect());
+
     // Transfer done, start processing new commands
     m_gp0_cmd_type = Gp0CommandType::None;
   }
+  return word_count;
+}
+
+void Gpu::write_vram_row(u32 x, u32 y, const u16* src, u32 count) {
+  const bool check_mask = m_gpustat.preserve_masked_bits;
+  const u16 set_mask = m_gpustat.force_set_mask_bit ? 0x8000 : 0;
+  u16* row = &vram()[(y % VRAM_HEIGHT) * VRAM_WIDTH];
+
+  while (count > 0) {
+    x %= VRAM_WIDTH;
+    const u32 run = std::min(count, VRAM_WIDTH - x);
+    u16* dest = row + x;
+
+    if (!check_mask && !set_mask)
+      std::memmove(dest, src, run * sizeof(u16));
+    else
+      for (u32 i = 0; i < run; ++i)
+        if (!check_mask || !(dest[i] & 0x8000))
+          dest[i] = src[i] | set_mask;
+
+    x += run;
+    src += run;
+    count -= run;
+  }
 }
 
 u32 Gpu::dma_read_vram() {
+  sync();
+  if (m_capture)
+    m_capture->vram_read(1);
+
   u32 word = get_vram_pos(m_vram_transfer_x, m_vram_transfer_y);
   advance_vram_transfer_pos();
   word |= get_vram_pos(m_vram_transfer_x, m_vram_transfer_y) << 16;
@@ -371,6 +867,20 @@ u32 Gpu::dma_read_vram() {
   return word;
 }
 
+void Gpu::dma_read_vram(u32* dest, u32 word_count) {
+  sync();
+  if (m_capture)
+    m_capture->vram_read(word_count);
+
+  for (u32 i = 0; i < word_count; ++i) {
+    u32 word = get_vram_pos(m_vram_transfer_x, m_vram_transfer_y);
+    advance_vram_transfer_pos();
+    word |= get_vram_pos(m_vram_transfer_x, m_vram_transfer_y) << 16;
+    advance_vram_transfer_pos();
+    dest[i] = word;
+  }
+}
+
 void Gpu::gp0_texture_window(u32 cmd) {
   m_tex_window.word = cmd;
 }
@@ -389,7 +899,7 @@ void Gpu::gp0_drawing_offset(u32 cmd) {
   m_drawing_offset.y = bit_utils::sign_extend<11, u32>(m_drawing_offset.y);
 }
 
-void Gpu::gp1(u32 cmd) {
+void Gpu::process_gp1(u32 cmd) {
   const auto opcode = (cmd >> 24) & 0xFF;
   const auto args = cmd & 0xFFFFFF;
 
@@ -445,36 +955,11 @@ void Gpu::gp1_disp_enable(u32 cmd) {
 }
 
 void Gpu::gp1_dma_direction(u32 cmd) {
-  m_gpustat.dma_direction_ = cmd & 0b11;
-  u8 dma_req{};
-
-  switch (m_gpustat.dma_direction()) {
-    case Off: dma_req = 0; break;
-    case Fifo: dma_req = 1; break;
-    case CpuToGp0: dma_req = m_gpustat.ready_to_recv_dma_block; break;
-    case VRamToCpu: dma_req = m_gpustat.ready_to_send_vram_to_cpu; break;
-  }
-
-  std::bitset<32> gpustat_bs(m_gpustat.word);
-  gpustat_bs.set(26, dma_req);
-  m_gpustat.word = gpustat_bs.to_ulong();
+  m_gpustat.set_dma_direction(cmd);
 }
 
 void Gpu::gp1_disp_mode(u32 cmd) {
-  const u32 disp_mode_to_gpustat_mask = 0b111111u;
-  const u32 gpustat_disp_mode_mask = 0b111111u << 17;
-
-  // GPUSTAT.17-22 = GP1(E8).0-5
-  m_gpustat.word &= ~gpustat_disp_mode_mask;
-  m_gpustat.word |= (cmd & disp_mode_to_gpustat_mask) << 17;
-
-  // GPUSTAT.16 = GP1(E8).6
-  m_gpustat.horizontal_res_2 = (cmd & (1 << 6)) >> 6;
-  // GPUSTAT.14 = GP1(E8).7
-  m_gpustat.reverse_flag = (cmd & (1 << 7)) >> 7;
-
-  // TODO: 24bit/direct mode
-  //  Ensures(m_gpustat.disp_color_depth == 0);
+  m_gpustat.set_disp_mode(cmd);
 }
 
 }  // namespace gpu
@@ -13,19 +13,31 @@ namespace gui {
 class Gui;
 }
 
+namespace renderer {
+class HwRenderer;
+}
+
+namespace util {
+class StateStream;
+}
+
 namespace gpu {
 
+class Gp0Recorder;
+class GpuCapture;
+class GpuThread;
+
 constexpr u32 CPU_CYCLES_PER_SECOND = 33'868'800;
 constexpr u32 FRAMERATE_NTSC = 60;
+constexpr u32 FRAMERATE_PAL = 50;
 constexpr u32 CPU_CYCLES_PER_FRAME = CPU_CYCLES_PER_SECOND / FRAMERATE_NTSC;
+constexpr u32 CPU_CYCLES_PER_FRAME_PAL = CPU_CYCLES_PER_SECOND / FRAMERATE_PAL;
 
 constexpr u32 MAX_GP0_CMD_LEN = 32;
 
 constexpr u32 VRAM_WIDTH = 1024;
 constexpr u32 VRAM_HEIGHT = 512;
 
-constexpr bool GP0_DEBUG_RECORD = true;  // For debugging
-
 enum DmaDirection {
   Off = 0,
   Fifo = 1,
@@ -99,7 +111,7 @@ union Gp1DisplayArea {
 
 // GP1(06h) - Horizontal Display range (on Screen)
 union Gp1HDisplayRange {
-  u32 word{};
+  u32 word{ 0xC00200 };  // 200h to C00h after a reset
 
   struct {
     u32 x1 : 12;  // X1 (260h+0)       ;12bit       ;\counted in 53.222400MHz units
@@ -109,7 +121,7 @@ union Gp1HDisplayRange {
 
 // GP1(07h) - Vertical Display range (on Screen)
 union Gp1VDisplayRange {
-  u32 word{};
+  u32 word{ 0x40010 };  // 10h to 100h after a reset
 
   struct {
     u32 y1 : 10;  // Y1 (NTSC=88h-(224/2), (PAL=A3h-(264/2))  ;\scanline numbers on screen
@@ -164,6 +176,13 @@ union GpuStatus {
 
   // methods
   DmaDirection dma_direction() const { return static_cast<DmaDirection>(dma_direction_); }
+
+  // The bits set by each command, for the render thread and the emulation thread's copy of GPUSTAT
+  // (see GpuStatusShadow) to go through the same changes
+  void set_draw_mode(u32 cmd);      // GP0(E1h)
+  void set_mask_bit(u32 cmd);       // GP0(E6h)
+  void set_dma_direction(u32 cmd);  // GP1(04h)
+  void set_disp_mode(u32 cmd);      // GP1(08h)
 };
 
 struct DisplayResolution {
@@ -173,8 +192,60 @@ struct DisplayResolution {
 
 class Gpu {
   friend class gui::Gui;  // for debug info
+  friend class GpuThread;
+  friend class GpuStatusShadow;  // Frames GP0 commands like process_gp0() does
+  friend class renderer::HwRenderer;  // Draws like the rasterizer does
  public:
   Gpu();
+  ~Gpu();
+
+  // Threaded mode runs GP0/GP1 commands on a render thread (see gpu/gpu_thread.hpp). Other than through
+  // register accesses, GPU state must only be accessed after a sync().
+  void set_threaded(bool threaded);
+  bool is_threaded() const { return m_thread != nullptr; }
+  // Triangles are rasterized by a pool of worker threads when worker_count is not 0, see
+  // renderer/raster_workers.hpp. VRAM must only be accessed after a sync() too.
+  void set_raster_workers(u32 worker_count);
+  // Draws with the host GPU instead of the rasterizer, null to go back to the rasterizer. Only without
+  // threaded mode (see renderer/hw_renderer.hpp).
+  void set_hw_renderer(renderer::HwRenderer* hw_renderer);
+  // Keeps the last GP0 commands for debugging (see gpu/gp0_recorder.hpp), off by default
+  void set_gp0_recording(bool recording);
+  const Gp0Recorder* gp0_recorder() const { return m_gp0_recorder.get(); }
+  // Records everything the GPU is told over the next frame_count frames, from its current state (see
+  // gpu/gpu_capture.hpp). VRAM is hashed as the rasterizer draws it, not the hardware renderer.
+  void start_capture(u32 frame_count);
+  // The capture once its frames have gone by, it's then no longer recorded to
+  std::unique_ptr<GpuCapture> take_finished_capture();
+  // While skipping, draws are queued instead of drawn. They're drawn once a frame is presented, or
+  // before the VRAM they draw to is read, sampled as a texture or written by other commands. Only the
+  // queued draws a VRAM fill entirely draws over are never drawn.
+  void set_skip_drawing(bool skip);
+  void sync();
+  // Of the software rasterizer, nothing is counted while the hardware renderer draws
+  renderer::rasterizer::RasterStats raster_stats() {
+    sync();
+    return m_rasterizer.stats();
+  }
+  // Also of the software rasterizer, for the last frame presented
+  const renderer::rasterizer::RasterFrameStats& frame_raster_stats() const {
+    return m_rasterizer.frame_stats();
+  }
+  // How many times each VRAM pixel was drawn over the last frame, see Rasterizer::overdraw()
+  void set_overdraw_tracking(bool tracking);
+  const std::vector<u8>& overdraw() const { return m_rasterizer.overdraw(); }
+
+  // For VRAM written without set_vram_idx(), so that the textures and the screen it holds are updated
+  void mark_vram_dirty(const renderer::rasterizer::VramRect& rect);
+  // VRAM written to since the last call, for the screen to only be uploaded where it changed. Must be
+  // called after a sync().
+  renderer::rasterizer::VramBlocks take_dirty_vram();
+  // Every write to VRAM is marked here, consumers (the texture cache, the screen) keep their own cursor
+  renderer::rasterizer::VramDirtyBlocks& vram_dirty_blocks() { return m_vram_dirty; }
+
+  // Registers, VRAM and the command being received, after running everything queued. Loading marks all
+  // of VRAM as written.
+  void serialize(util::StateStream& s);
 
   // GPUSTAT register
   GpuStatus m_gpustat{};
@@ -198,6 +269,7 @@ class Gpu {
   u16 m_vram_transfer_x{};
   u16 m_vram_transfer_y{};
   u16 m_vram_transfer_x_start{};
+  u16 m_vram_transfer_y_start{};
   u16 m_vram_transfer_width{};
   u16 m_vram_transfer_height{};
 
@@ -206,8 +278,10 @@ class Gpu {
   std::array<u16, VRAM_WIDTH * VRAM_HEIGHT> const& vram() const { return *m_vram.get(); }
   std::array<u16, VRAM_WIDTH * VRAM_HEIGHT>& vram() { return *m_vram.get(); }
 
-  GpuStatus gpustat() const {
-    auto gpustat = static_cast<u32>(m_gpustat.word);
+  GpuStatus gpustat() const { return gpustat(m_gpustat); }
+  // What reading GPUSTAT returns with status as the bits commands set
+  GpuStatus gpustat(GpuStatus status) const {
+    auto gpustat = static_cast<u32>(status.word);
 
     // Hardcode the following for now
     gpustat |= 1 << 26;  // Ready to receive command: true
@@ -217,7 +291,7 @@ class Gpu {
     gpustat |= ((m_frames % 2 == 0) ? 1 : 0) << 31;
 
     // Not sure what this is
-    Ensures(m_gpustat.reverse_flag == false);
+    Ensures(status.reverse_flag == false);
 
     return GpuStatus{ gpustat };
   }
@@ -244,25 +318,48 @@ class Gpu {
   }
   void set_vram_idx(u32 vram_idx, u16 val);
   u32 dma_read_vram();
+  // word_count words as dma_read_vram() reads them, syncing only once
+  void dma_read_vram(u32* dest, u32 word_count);
 
   DisplayResolution get_resolution() const;
+  // The part of get_resolution() the display ranges show from its top left, the rest of the screen is
+  // black
+  DisplayResolution get_visible_resolution() const;
 
  private:
   // Returns size of image in 16-bit pixels, rounded up to nearest 32-bit value
   u32 setup_vram_transfer(u32 pos_word, u32 size_word);
+  // Area of the transfer set up last, which may wrap around VRAM
+  renderer::rasterizer::VramRect vram_transfer_rect() const;
   void advance_vram_transfer_pos();
-  void do_cpu_to_vram_transfer(u32 cmd);
+  // Consumes up to count words of CPU -> VRAM transfer data, returns how many
+  u32 do_cpu_to_vram_transfer(const u32* words, u32 count);
+  // Consumes up to count arguments of the command being received, all but the last one which issues
+  // it. Returns how many.
+  u32 take_gp0_args(const u32* words, u32 count);
+  // Whether the command being received is a polyline, which is drawn a segment at a time as its
+  // vertices come in: m_gp0_cmd only ever holds one segment
+  bool is_polyline() const;
+  // Starts receiving the segment after the one just drawn
+  void continue_polyline();
+  // Writes count halfwords from src to the row y from x on, wrapping around VRAM and honoring the mask
+  // bit settings. src may be VRAM itself.
+  void write_vram_row(u32 x, u32 y, const u16* src, u32 count);
 
 public:
-  // Returns true to signals that a frame is ready for presenting (VBLANK)
-  bool step(u32 cycles_to_emualate);
+  // Called on VBLANK (every cycles_per_frame()), once the frame is ready for presenting
+  void vblank();
+  // Between VBLANKs, in the video mode the GPU was last set to
+  u32 cycles_per_frame() const;
 
-  std::vector<u32> const& gp0_cmd() const { return m_gp0_cmd; }
+  renderer::rasterizer::Gp0Command const& gp0_cmd() const { return m_gp0_cmd; }
 
   void gp0(u32 cmd);
+  // Same as writing each word to GP0, but arguments and image data are taken many at a time (for DMA)
+  void gp0(const u32* words, u32 count);
 
  private:
-  void gp0_mono_polyline_opaque(u32 cmd);
+  void process_gp0(u32 cmd);
   void gp0_draw_mode(u32 cmd);
   void gp0_mask_bit(u32 cmd);
   void gp0_gpu_irq(u32 cmd);  // rarely used
@@ -271,7 +368,40 @@ public:
   void gp0_copy_rect_vram_to_cpu();
   void gp0_copy_rect_vram_to_vram();
 
-  void gp1(u32 cmd);
+  // GPU state that draws depend on, saved with the queued ones
+  struct DrawState {
+    GpuStatus gpustat;
+    Gp0DrawMode draw_mode;
+    Gp0TextureWindow tex_window;
+    Gp0DrawingArea drawing_area_top_left;
+    Gp0DrawingArea drawing_area_bottom_right;
+    Gp0DrawingOffset drawing_offset;
+  };
+  struct DeferredDraw {
+    Gp0CommandType type;
+    renderer::rasterizer::VramBlocks sampled;  // See sampled_blocks()
+    DrawState state;
+    renderer::rasterizer::Gp0Command cmd;
+  };
+
+  // Draws the primitive in m_gp0_cmd, or queues it while skipping (see set_skip_drawing())
+  void draw_or_defer(Gp0CommandType type);
+  void draw(Gp0CommandType type);
+  // VRAM the draw in m_gp0_cmd samples its texture from
+  renderer::rasterizer::VramBlocks sampled_blocks(Gp0CommandType type) const;
+  static renderer::rasterizer::VramRect drawing_area_rect(const DrawState& state);
+  DrawState draw_state() const;
+  void set_draw_state(const DrawState& state);
+  // Draws all the queued draws, in the order they were issued
+  void draw_deferred();
+  // Same, but only if one of them may draw to rect, or also sample from it for a write to rect
+  void draw_deferred_before_read(const renderer::rasterizer::VramRect& rect);
+  void draw_deferred_before_write(const renderer::rasterizer::VramRect& rect);
+  // Drops the queued draws whose drawing area is within rect, for a write that covers all of rect
+  void drop_deferred_within(const renderer::rasterizer::VramRect& rect);
+  void update_deferred_blocks();
+
+  void process_gp1(u32 cmd);
   void gp1_soft_reset();
   void gp1_cmd_buf_reset();
   void gp1_ack_gpu_interrupt();
@@ -284,26 +414,28 @@ public:
   void gp0_drawing_offset(u32 cmd);
 
  private:
+  renderer::rasterizer::VramDirtyBlocks m_vram_dirty;  // Before the rasterizer, for its texture cache
+  renderer::rasterizer::VramDirtyBlocks::Cursor m_screen_cursor;  // Of take_dirty_vram()
   renderer::rasterizer::Rasterizer m_rasterizer = renderer::rasterizer::Rasterizer(*this);
+  std::unique_ptr<GpuThread> m_thread;    // Null unless threaded
+  renderer::HwRenderer* m_hw_renderer{};  // Null unless drawing with the host GPU
 
   // TOOD: reset all these in the method
   // GP0 command handling
   Gp0CommandType m_gp0_cmd_type = Gp0CommandType::None;
-  u32 m_gp0_arg_count{};       // Number of args
-  u32 m_gp0_arg_index{};       // Current arg index
-  std::vector<u32> m_gp0_cmd;  // All words comprising a GP0 command
+  u32 m_gp0_arg_count{};                       // Number of args
+  u32 m_gp0_arg_index{};                       // Current arg index
+  renderer::rasterizer::Gp0Command m_gp0_cmd;  // All words comprising a GP0 command
 
-  // VBLANK
-  s32 m_vblank_cycles_left{ CPU_CYCLES_PER_FRAME };
+  // Frame skipping
+  bool m_skip_drawing{};
+  std::vector<DeferredDraw> m_deferred_draws;           // In the order they were issued
+  renderer::rasterizer::VramBlocks m_deferred_dirty;    // Drawing areas of m_deferred_draws
+  renderer::rasterizer::VramBlocks m_deferred_sampled;  // Textures of m_deferred_draws
 
   // Debugging
-  struct Gp0CmdDebugRecord {
-    Gp0CommandType type;
-    std::vector<u32> cmd;
-  };
-  using Gp0CmdDebugRecordsFrame = std::vector<Gp0CmdDebugRecord>;
-  Gp0CmdDebugRecordsFrame m_gp0_cmds_cur_frame;
-  std::vector<Gp0CmdDebugRecordsFrame> m_gp0_cmds_record;
+  std::unique_ptr<Gp0Recorder> m_gp0_recorder;  // Null unless recording
+  std::unique_ptr<GpuCapture> m_capture;         // Null unless capturing
 };
 
 static const char* gp0_cmd_type_to_str(Gp0CommandType cmd_type) {
@@ -0,0 +1,216 @@
+#include <gpu/gpu_capture.hpp>
+
+#include <gpu/gpu.hpp>
+#include <util/log.hpp>
+#include <util/state_stream.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+
+namespace gpu {
+
+namespace {
+
+constexpr u32 CAPTURE_MAGIC = 0x43474350;  // "PCGC"
+constexpr u32 MAX_ENTRY_COUNT = 0xFFFFFF;
+
+u32 entry_header(GpuCaptureEntry entry, u32 count) {
+  return (u32)entry << 24 | count;
+}
+
+// Words following a header
+u32 entry_size(u32 header) {
+  const u32 count = header & MAX_ENTRY_COUNT;
+  switch ((GpuCaptureEntry)(header >> 24)) {
+    case GpuCaptureEntry::Gp0: return count;
+    case GpuCaptureEntry::Gp1: return 1;
+    case GpuCaptureEntry::Vblank: return 2;
+    default: return 0;
+  }
+}
+
+}  // namespace
+
+u64 hash_vram(const Gpu& gpu) {
+  // FNV-1a, a pixel at a time
+  u64 hash = 0xCBF29CE484222325;
+  for (const u16 pixel : gpu.vram())
+    hash = (hash ^ pixel) * 0x100000001B3;
+  return hash;
+}
+
+GpuCapture::GpuCapture(Gpu& gpu, u32 frame_count) : m_frames_left(frame_count) {
+  util::StateStream s(m_snapshot);
+  gpu.serialize(s);
+}
+
+void GpuCapture::add(GpuCaptureEntry entry, u32 count) {
+  if (m_last_header != SIZE_MAX) {
+    u32& header = m_entries[m_last_header];
+    const u32 last_count = header & MAX_ENTRY_COUNT;
+    if ((GpuCaptureEntry)(header >> 24) == entry && last_count + count <= MAX_ENTRY_COUNT) {
+      header = entry_header(entry, last_count + count);
+      return;
+    }
+  }
+  m_last_header = m_entries.size();
+  m_entries.push_back(entry_header(entry, count));
+}
+
+void GpuCapture::gp0(const u32* words, u32 count) {
+  if (is_done())
+    return;
+
+  while (count > 0) {
+    const u32 taken = std::min(count, MAX_ENTRY_COUNT);
+    add(GpuCaptureEntry::Gp0, taken);
+    m_entries.insert(m_entries.end(), words, words + taken);
+    words += taken;
+    count -= taken;
+  }
+}
+
+void GpuCapture::gp1(u32 word) {
+  if (is_done())
+    return;
+
+  m_last_header = m_entries.size();
+  m_entries.push_back(entry_header(GpuCaptureEntry::Gp1, 1));
+  m_entries.push_back(word);
+}
+
+void GpuCapture::vram_read(u32 count) {
+  if (!is_done())
+    add(GpuCaptureEntry::VramRead, count);
+}
+
+void GpuCapture::skip_drawing(bool skip) {
+  if (is_done())
+    return;
+
+  m_last_header = m_entries.size();
+  m_entries.push_back(entry_header(GpuCaptureEntry::SkipDrawing, skip ? 1 : 0));
+}
+
+void GpuCapture::vblank(u64 vram_hash) {
+  if (is_done())
+    return;
+
+  m_last_header = m_entries.size();
+  m_entries.push_back(entry_header(GpuCaptureEntry::Vblank, 0));
+  m_entries.push_back((u32)vram_hash);
+  m_entries.push_back((u32)(vram_hash >> 32));
+  --m_frames_left;
+}
+
+bool GpuCapture::write(const fs::path& path) const {
+  std::ofstream file(path, std::ios::binary);
+  if (!file) {
+    LOG_ERROR("Could not open {} to write the GPU capture", path.string());
+    return false;
+  }
+
+  const std::array<u32, 3> header = { CAPTURE_MAGIC, GPU_CAPTURE_VERSION, (u32)m_snapshot.size() };
+  std::vector<byte> snapshot = m_snapshot;
+  snapshot.resize((snapshot.size() + 3) & ~size_t(3));
+  file.write((const char*)header.data(), sizeof(header));
+  file.write((const char*)snapshot.data(), snapshot.size());
+  file.write((const char*)m_entries.data(), m_entries.size() * sizeof(u32));
+  if (!file) {
+    LOG_ERROR("Could not write the GPU capture to {}", path.string());
+    return false;
+  }
+
+  const size_t size = sizeof(header) + snapshot.size() + m_entries.size() * sizeof(u32);
+  LOG_INFO("Wrote a GPU capture of {} KB to {}", size / 1024, path.string());
+  return true;
+}
+
+bool GpuReplay::load(const fs::path& path) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file) {
+    LOG_ERROR("Could not open GPU capture {}", path.string());
+    return false;
+  }
+  const size_t file_size = (size_t)file.tellg();
+  file.seekg(0);
+
+  std::array<u32, 3> header{};
+  file.read((char*)header.data(), sizeof(header));
+  if (!file || header[0] != CAPTURE_MAGIC || header[1] != GPU_CAPTURE_VERSION) {
+    LOG_ERROR("{} is not a GPU capture of version {}", path.string(), GPU_CAPTURE_VERSION);
+    return false;
+  }
+
+  const size_t padded_snapshot_size = (header[2] + 3) & ~size_t(3);
+  if (sizeof(header) + padded_snapshot_size > file_size || (file_size - sizeof(header)) % 4 != 0) {
+    LOG_ERROR("GPU capture {} is truncated", path.string());
+    return false;
+  }
+  m_snapshot.resize(padded_snapshot_size);
+  file.read((char*)m_snapshot.data(), padded_snapshot_size);
+  m_snapshot.resize(header[2]);
+  m_entries.resize((file_size - sizeof(header) - padded_snapshot_size) / 4);
+  file.read((char*)m_entries.data(), m_entries.size() * sizeof(u32));
+  if (!file) {
+    LOG_ERROR("Could not read GPU capture {}", path.string());
+    return false;
+  }
+
+  // Every entry must fit, so that run() doesn't have to check
+  m_frame_count = 0;
+  for (size_t i = 0; i < m_entries.size(); i += 1 + entry_size(m_entries[i])) {
+    const bool is_known = (m_entries[i] >> 24) <= (u32)GpuCaptureEntry::Vblank;
+    if (!is_known || i + entry_size(m_entries[i]) >= m_entries.size()) {
+      LOG_ERROR("GPU capture {} has an invalid entry at word {}", path.string(), i);
+      return false;
+    }
+    if ((GpuCaptureEntry)(m_entries[i] >> 24) == GpuCaptureEntry::Vblank)
+      ++m_frame_count;
+  }
+  return true;
+}
+
+s32 GpuReplay::run(Gpu& gpu) const {
+  util::StateStream s(m_snapshot.data(), m_snapshot.size());
+  gpu.serialize(s);
+  if (!s.ok() || s.position() != m_snapshot.size()) {
+    LOG_ERROR("The GPU capture's snapshot doesn't load");
+    return -1;
+  }
+
+  s32 mismatches = 0;
+  u32 frame = 0;
+  std::vector<u32> read_words;
+  for (size_t i = 0; i < m_entries.size(); i += 1 + entry_size(m_entries[i])) {
+    const u32 count = m_entries[i] & MAX_ENTRY_COUNT;
+    const u32* words = m_entries.data() + i + 1;
+
+    switch ((GpuCaptureEntry)(m_entries[i] >> 24)) {
+      case GpuCaptureEntry::Gp0: gpu.gp0(words, count); break;
+      case GpuCaptureEntry::Gp1: gpu.write_reg(4, words[0]); break;
+      case GpuCaptureEntry::VramRead:
+        read_words.resize(count);
+        gpu.dma_read_vram(read_words.data(), count);
+        break;
+      case GpuCaptureEntry::SkipDrawing: gpu.set_skip_drawing(count != 0); break;
+      case GpuCaptureEntry::Vblank: {
+        gpu.vblank();
+        const u64 expected = words[0] | (u64)words[1] << 32;
+        const u64 hash = hash_vram(gpu);
+        if (hash != expected) {
+          LOG_WARN("Frame {} of the GPU capture hashes to {:016X}, captured as {:016X}", frame, hash,
+                   expected);
+          ++mismatches;
+        }
+        ++frame;
+        break;
+      }
+    }
+  }
+  return mismatches;
+}
+
+}  // namespace gpu
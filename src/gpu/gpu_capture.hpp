@@ -0,0 +1,76 @@
+#pragma once
+
+#include <util/fs.hpp>
+#include <util/types.hpp>
+
+#include <vector>
+
+namespace gpu {
+
+class Gpu;
+
+// Bumped with any change to the layout of capture files, or to what Gpu::serialize() saves
+constexpr u32 GPU_CAPTURE_VERSION = 1;
+
+// What the GPU is told over a few frames, for it to be run again without the rest of the console: a
+// snapshot of the GPU (Gpu::serialize(), so VRAM and registers), then every GP0/GP1 write, GPUREAD read
+// and frame end in the order they happened. Each frame end carries the hash of VRAM as drawn, which a
+// replay has to match.
+//
+// File layout, in host order: "PCGC", the version, the snapshot size in bytes then the snapshot padded
+// to words, and the entries until the end of the file. An entry is a header word, the GpuCaptureEntry
+// in the top 8 bits and a count in the low 24, followed by its words.
+enum class GpuCaptureEntry : u8 {
+  Gp0,          // count words written to GP0
+  Gp1,          // 1 word written to GP1
+  VramRead,     // count words read from GPUREAD
+  SkipDrawing,  // Gpu::set_skip_drawing(count != 0)
+  Vblank,       // Gpu::vblank(), then 2 words of the VRAM hash (low first)
+};
+
+// Hash of the whole of VRAM, the GPU must be synced
+u64 hash_vram(const Gpu& gpu);
+
+// Records the writes of the GPU it's handed, see Gpu::start_capture()
+class GpuCapture {
+ public:
+  // Snapshots gpu, the capture is done after frame_count frames
+  GpuCapture(Gpu& gpu, u32 frame_count);
+
+  void gp0(const u32* words, u32 count);
+  void gp1(u32 word);
+  void vram_read(u32 count);
+  void skip_drawing(bool skip);
+  void vblank(u64 vram_hash);
+
+  bool is_done() const { return m_frames_left == 0; }
+  bool write(const fs::path& path) const;
+
+ private:
+  // Appends to the last entry when it's of the same kind, and has room for count more
+  void add(GpuCaptureEntry entry, u32 count);
+
+  std::vector<byte> m_snapshot;
+  std::vector<u32> m_entries;
+  size_t m_last_header{ SIZE_MAX };  // Index of the last entry's header in m_entries
+  u32 m_frames_left;
+};
+
+// A capture loaded back, to run it on another GPU
+class GpuReplay {
+ public:
+  bool load(const fs::path& path);
+
+  // Restores the snapshot on gpu and runs the entries. Returns the number of frames whose VRAM doesn't
+  // hash as it was captured, or -1 if the capture doesn't run.
+  s32 run(Gpu& gpu) const;
+
+  u32 frame_count() const { return m_frame_count; }
+
+ private:
+  std::vector<byte> m_snapshot;
+  std::vector<u32> m_entries;
+  u32 m_frame_count{};
+};
+
+}  // namespace gpu
@@ -0,0 +1,223 @@
+#include <gpu/gpu_thread.hpp>
+
+#include <algorithm>
+
+namespace gpu {
+
+namespace {
+
+// Empty FIFO polls before the render thread goes to sleep. Writes mostly come in bursts (DMA, BIOS
+// routines), sleeping and waking up in between would cost more than the spinning.
+constexpr u32 SPIN_COUNT = 1000;
+
+}  // namespace
+
+void GpuStatusShadow::reset(const Gpu& gpu) {
+  m_gpustat = gpu.m_gpustat;
+  m_arg_index = gpu.m_gp0_arg_index;
+  m_arg_count = 0;
+  m_is_polyline = false;
+  m_is_transferring = false;
+
+  switch (gpu.m_gp0_cmd_type) {
+    case Gp0CommandType::None: break;
+    case Gp0CommandType::CopyCpuToVramTransferring:
+      m_arg_count = gpu.m_gp0_arg_count;
+      m_is_transferring = true;
+      break;
+    default:
+      m_opcode = gpu.m_gp0_cmd[0] >> 24;
+      m_arg_count = gpu.m_gp0_arg_count;
+      m_is_polyline = gpu.is_polyline();
+      break;
+  }
+}
+
+void GpuStatusShadow::gp0(const u32* words, u32 count) {
+  while (count > 0) {
+    // Transfer data is skipped at once
+    if (m_is_transferring) {
+      const u32 taken = std::min(count, m_arg_count - m_arg_index);
+      m_arg_index += taken;
+      words += taken;
+      count -= taken;
+      if (m_arg_index == m_arg_count) {
+        m_arg_count = 0;
+        m_is_transferring = false;
+      }
+      continue;
+    }
+
+    if (m_arg_count == 0)
+      start_command(*words);
+    else
+      take_arg(*words);
+    ++words;
+    --count;
+  }
+}
+
+// Same framing as Gpu::process_gp0()
+void GpuStatusShadow::start_command(u32 cmd) {
+  using renderer::rasterizer::DrawCommand;
+
+  const u8 opcode = cmd >> 24;
+  m_opcode = opcode;
+  m_arg_index = 0;
+  m_arg_count = 0;
+  m_is_polyline = false;
+
+  if (opcode == 0x02)
+    m_arg_count = 2;
+  else if (0x20 <= opcode && opcode < 0x40)
+    m_arg_count = DrawCommand{ opcode }.polygon.get_arg_count();
+  else if (0x40 <= opcode && opcode < 0x60) {
+    m_arg_count = DrawCommand{ opcode }.line.get_arg_count();
+    m_is_polyline = DrawCommand{ opcode }.line.is_poly();
+  } else if (0x60 <= opcode && opcode < 0x80)
+    m_arg_count = DrawCommand{ opcode }.rectangle.get_arg_count();
+  else if (opcode == 0x80)
+    m_arg_count = 3;
+  else if (opcode == 0xA0 || opcode == 0xC0)
+    m_arg_count = 2;
+  else if (opcode == 0x1F)
+    m_gpustat.interrupt = true;
+  else if (opcode == 0xE1)
+    m_gpustat.set_draw_mode(cmd);
+  else if (opcode == 0xE6)
+    m_gpustat.set_mask_bit(cmd);
+}
+
+void GpuStatusShadow::take_arg(u32 word) {
+  ++m_arg_index;
+  if (m_is_polyline && m_arg_index >= 2 &&
+      renderer::rasterizer::DrawCommand::Line::is_poly_terminator(word)) {
+    m_arg_count = 0;
+    return;
+  }
+  if (m_arg_index < m_arg_count)
+    return;
+
+  if (m_is_polyline) {
+    // The end of the segment is the start of the next one, see Gpu::continue_polyline()
+    m_arg_index = 1;
+  } else if (m_opcode == 0xA0) {
+    // The last argument is the size of the image, see Gpu::setup_vram_transfer()
+    const u32 width = (((word & 0xFFFF) - 1) & 0x3FF) + 1;
+    const u32 height = ((((word >> 16) & 0xFFFF) - 1) & 0x1FF) + 1;
+    m_arg_index = 0;
+    m_arg_count = ((width * height + 1) & ~1u) / 2;
+    m_is_transferring = true;
+  } else {
+    m_arg_count = 0;
+  }
+}
+
+void GpuStatusShadow::gp1(u32 cmd) {
+  switch ((cmd >> 24) & 0xFF) {
+    case 0x00:
+      m_gpustat = GpuStatus();
+      m_arg_count = 0;
+      m_is_transferring = false;
+      break;
+    case 0x01:
+      m_arg_count = 0;
+      m_is_transferring = false;
+      break;
+    case 0x02: m_gpustat.interrupt = false; break;
+    case 0x03: m_gpustat.disp_disabled = cmd & 1; break;
+    case 0x04: m_gpustat.set_dma_direction(cmd); break;
+    case 0x08: m_gpustat.set_disp_mode(cmd); break;
+    default: break;
+  }
+}
+
+GpuThread::GpuThread(Gpu& gpu) : m_gpu(gpu), m_thread(&GpuThread::run, this) {
+  // Nothing is pushed yet, the render thread doesn't touch the GPU
+  m_status.reset(m_gpu);
+}
+
+GpuThread::~GpuThread() {
+  {
+    std::lock_guard<std::mutex> lock(m_wake_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+}
+
+void GpuThread::push(GpuPort port, u32 word) {
+  if (port == GpuPort::Gp0)
+    m_status.gp0(&word, 1);
+  else
+    m_status.gp1(word);
+  while (!m_fifo.try_push({ port, word }))
+    std::this_thread::yield();
+  wake();
+}
+
+void GpuThread::push(GpuPort port, const u32* words, u32 count) {
+  if (port == GpuPort::Gp0) {
+    m_status.gp0(words, count);
+  } else {
+    for (u32 i = 0; i < count; ++i)
+      m_status.gp1(words[i]);
+  }
+  for (u32 i = 0; i < count; ++i) {
+    while (!m_fifo.try_push({ port, words[i] })) {
+      // Full, the render thread may be asleep on what was pushed so far
+      wake();
+      std::this_thread::yield();
+    }
+  }
+  wake();
+}
+
+void GpuThread::wake() {
+  // Pairs with the fence in wait_for_writes(): either the render thread sees the new write, or we see it
+  // going to sleep and wake it up
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_sleeping.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(m_wake_mutex);
+    m_wake.notify_one();
+  }
+}
+
+void GpuThread::sync() {
+  while (!m_fifo.empty())
+    std::this_thread::yield();
+  m_status.reset(m_gpu);
+}
+
+void GpuThread::run() {
+  while (true) {
+    if (const Write* write = m_fifo.front()) {
+      if (write->port == GpuPort::Gp0)
+        m_gpu.process_gp0(write->word);
+      else
+        m_gpu.process_gp1(write->word);
+      m_fifo.pop();
+      continue;
+    }
+
+    if (m_quit)
+      return;
+    wait_for_writes();
+  }
+}
+
+void GpuThread::wait_for_writes() {
+  for (u32 i = 0; i < SPIN_COUNT; ++i) {
+    if (!m_fifo.empty() || m_quit)
+      return;
+    std::this_thread::yield();
+  }
+
+  std::unique_lock<std::mutex> lock(m_wake_mutex);
+  m_sleeping.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  m_wake.wait(lock, [this]() { return !m_fifo.empty() || m_quit; });
+  m_sleeping.store(false, std::memory_order_relaxed);
+}
+
+}  // namespace gpu
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <gpu/gpu.hpp>
+#include <util/spsc_ring.hpp>
+#include <util/types.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace gpu {
+
+enum class GpuPort : u32 {
+  Gp0,
+  Gp1,
+};
+
+// Register writes waiting for the render thread. Sized for a few frames worth of display lists.
+constexpr size_t GPU_FIFO_SIZE = 1 << 16;
+
+// GPUSTAT as of the last write pushed to the render thread, kept by the emulation thread so that games
+// busy-polling the register don't wait for the render thread. GP0 words are only framed into commands as
+// far as it takes to find the ones that set GPUSTAT bits.
+class GpuStatusShadow {
+ public:
+  // Takes over from the GPU's state, once the render thread ran every write pushed to it
+  void reset(const Gpu& gpu);
+  void gp0(const u32* words, u32 count);
+  void gp1(u32 cmd);
+
+  GpuStatus gpustat() const { return m_gpustat; }
+
+ private:
+  void start_command(u32 cmd);
+  void take_arg(u32 word);
+
+  GpuStatus m_gpustat{};
+  u8 m_opcode{};             // Of the command being received
+  u32 m_arg_index{};         // Arguments, or transfer words, taken so far
+  u32 m_arg_count{};         // 0 unless a command is being received
+  bool m_is_polyline{};      // Ends with a terminator instead of after m_arg_count arguments
+  bool m_is_transferring{};  // The words are CPU -> VRAM transfer data
+};
+
+// Runs the GPU on its own thread. The emulation thread pushes GP0/GP1 writes and carries on, the render
+// thread executes them in order. Everything that reads GPU state back (GPUREAD, VRAM, presenting a
+// frame) has to sync first, which waits for the FIFO to drain, GPUSTAT is read from GpuStatusShadow.
+class GpuThread {
+ public:
+  explicit GpuThread(Gpu& gpu);
+  ~GpuThread();
+
+  void push(GpuPort port, u32 word);
+  // Same as pushing each word, waking the render thread up only once
+  void push(GpuPort port, const u32* words, u32 count);
+  // Also brings the GPUSTAT shadow back in line with the GPU's state, e.g. after loading it
+  void sync();
+  // Without waiting for the writes pushed so far to run
+  GpuStatus gpustat() const { return m_status.gpustat(); }
+
+ private:
+  struct Write {
+    GpuPort port;
+    u32 word;
+  };
+
+  void run();
+  // Wakes the render thread up if it went to sleep, after pushing
+  void wake();
+  void wait_for_writes();
+
+  Gpu& m_gpu;
+  util::SpscRing<Write, GPU_FIFO_SIZE> m_fifo;
+  GpuStatusShadow m_status;  // Of the emulation thread
+
+  // Wake up of the render thread once it has gone to sleep on an empty FIFO
+  std::atomic<bool> m_sleeping{};
+  std::atomic<bool> m_quit{};
+  std::mutex m_wake_mutex;
+  std::condition_variable m_wake;
+
+  std::thread m_thread;  // Last, it starts running as soon as it's constructed
+};
+
+}  // namespace gpu
@@ -1,13 +1,18 @@
 #include <gui/gui.hpp>
 
+#include <bus/bus.hpp>
 #include <cpu/cpu.hpp>
 #include <emulator/emulator.hpp>
+#include <emulator/emulator_thread.hpp>
 #include <emulator/settings.hpp>
+#include <gpu/gp0_recorder.hpp>
 #include <gpu/gpu.hpp>
 #include <io/timers.hpp>
 #include <renderer/rasterizer.hpp>
+#include <spu/spu.hpp>
 #include <util/fs.hpp>
 #include <util/log.hpp>
+#include <util/profiler.hpp>
 
 #pragma warning(disable : 4251)  // hide some glbinding warnings
 #include <glbinding-aux/types_to_string.h>
@@ -24,6 +29,7 @@
 #include <cassert>
 #include <chrono>
 #include <exception>
+#include <numeric>
 #include <sstream>
 #include <string>
 
@@ -33,6 +39,10 @@ using namespace gl;
 
 const auto SCREEN_SCALE = 1.5f;
 
+// Stereo sample frames the audio device plays at once, and how much sound can wait to be played
+const u16 AUDIO_DEVICE_FRAMES = 1024;
+const u32 MAX_QUEUED_AUDIO_BYTES = spu::SAMPLE_RATE / 5 * 2 * sizeof(s16);  // 200 ms
+
 const auto GUI_CLEAR_COLOR = RGBA_TO_FLOAT(46, 63, 95, 255);
 const auto GUI_COLOR_BLACK_HALF_TRANSPARENT = RGBA_TO_FLOAT(0, 0, 0, 128);
 const auto GUI_TABLE_COLUMN_TITLES_COL = ImColor(255, 255, 255);
@@ -131,7 +141,7 @@ void init_theme() {
 }
 
 void Gui::init() {
-  if (SDL_Init(SDL_INIT_VIDEO) != 0)
+  if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0)
     SDL_ERROR("Unable to initialize SDL");
 
   SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
@@ -155,6 +165,19 @@ void Gui::init() {
   if (!m_gl_context)
     SDL_ERROR("Unable to create GL context");
 
+  // Samples are queued as the emulator makes them, there's no audio callback. Running without sound is
+  // fine, the emulator doesn't wait for it.
+  SDL_AudioSpec audio_spec{};
+  audio_spec.freq = spu::SAMPLE_RATE;
+  audio_spec.format = AUDIO_S16SYS;
+  audio_spec.channels = 2;
+  audio_spec.samples = AUDIO_DEVICE_FRAMES;
+  m_audio_device = SDL_OpenAudioDevice(nullptr, 0, &audio_spec, nullptr, 0);
+  if (m_audio_device == 0)
+    LOG_WARN("Unable to open audio device: {}", SDL_GetError());
+  else
+    SDL_PauseAudioDevice(m_audio_device, 0);
+
   const glbinding::GetProcAddress get_proc_address = [](const char* name) {
     return reinterpret_cast<glbinding::ProcAddress>(SDL_GL_GetProcAddress(name));
   };
@@ -193,6 +216,10 @@ void Gui::set_joypad(io::Joypad* joypad) {
   m_joypad = joypad;
 }
 
+void Gui::set_emulator_thread(emulator::EmulatorThread* emulator_thread) {
+  m_emulator_thread = emulator_thread;
+}
+
 void Gui::set_settings(emulator::Settings* settings) {
   m_settings = settings;
 }
@@ -239,11 +266,20 @@ GuiEvent Gui::process_events() {
       default: button_index = io::BTN_INVALID;
     }
     if (button_index != io::BTN_INVALID) {
-      m_joypad->update_button(button_index, was_pressed);
+      if (m_emulator_thread)
+        m_emulator_thread->update_button(button_index, was_pressed);
+      else
+        m_joypad->update_button(button_index, was_pressed);
       return ret_event;
     }
 
     // Emulator operation events
+    if (sym == SDLK_BACKSPACE)
+      m_settings->rewinding = was_pressed;
+    if (sym == SDLK_SPACE && was_pressed != m_settings->turbo) {
+      m_settings->turbo = was_pressed;
+      m_settings->limit_framerate_changed = true;  // No vsync while in turbo
+    }
     if (m_event.type == SDL_KEYDOWN) {
       switch (sym) {
         case SDLK_TAB:
@@ -300,9 +336,12 @@ void Gui::apply_settings() const {
     SDL_SetWindowSize(m_window, static_cast<s32>(m_settings->res_width * scale),
                       static_cast<s32>(m_settings->res_height * scale));
   }
-  if (m_settings->limit_framerate_changed)
+  if (m_settings->limit_framerate_changed) {
+    m_settings->limit_framerate_changed = false;
+
     // Limit framerate via Vsync
-    SDL_GL_SetSwapInterval(m_settings->limit_framerate ? -1 : 0);
+    SDL_GL_SetSwapInterval(m_settings->limit_framerate && !m_settings->turbo ? -1 : 0);
+  }
   if (m_settings->fullscreen_changed) {
     m_settings->fullscreen_changed = false;
 
@@ -311,7 +350,16 @@ void Gui::apply_settings() const {
   }
 }
 
+void Gui::queue_audio(const s16* samples, u32 frame_count) {
+  // Emulating faster than real time, the sound that doesn't fit is dropped rather than played late
+  if (m_audio_device == 0 || SDL_GetQueuedAudioSize(m_audio_device) > MAX_QUEUED_AUDIO_BYTES)
+    return;
+  SDL_QueueAudio(m_audio_device, samples, frame_count * 2 * sizeof(s16));
+}
+
 void Gui::deinit() {
+  if (m_audio_device != 0)
+    SDL_CloseAudioDevice(m_audio_device);
   SDL_GL_DeleteContext(m_gl_context);
   SDL_Quit();
 }
@@ -388,7 +436,12 @@ void Gui::imgui_draw(const emulator::Emulator& emulator) {
         ImGui::MenuItem("GPU Registers", "Ctrl+U", &m_draw_gpu_registers);
         ImGui::MenuItem("CPU Registers", "Ctrl+C", &m_draw_cpu_registers);
         ImGui::MenuItem("Timers", "Ctrl+I", &m_draw_timers);
-        ImGui::MenuItem("GP0 Commands", "Ctrl+C", &m_draw_cpu_registers, gpu::GP0_DEBUG_RECORD);
+        ImGui::MenuItem("Profiler", nullptr, &m_draw_profiler, PROFILER_ENABLED);
+        ImGui::MenuItem("Guest PC Profiler", nullptr, &m_draw_pc_profiler);
+        ImGui::MenuItem("GP0 Commands", nullptr, &m_draw_gp0_commands);
+        ImGui::MenuItem("GPU Stats", nullptr, &m_draw_gpu_stats);
+        ImGui::MenuItem("Bus Stats", nullptr, &m_draw_bus_stats, BUS_STATS_ENABLED);
+        ImGui::MenuItem("Record GP0 Commands", nullptr, &m_settings->record_gp0);
         ImGui::EndMenu();
       }
 
@@ -401,7 +454,8 @@ void Gui::imgui_draw(const emulator::Emulator& emulator) {
         ImGui::SameLine();
         ImGui::Combo("##screen_view", (s32*)&m_settings->screen_view, items_screen_view,
                      IM_ARRAYSIZE(items_screen_view));
-        m_settings->window_size_changed = (screen_view_old != m_settings->screen_view);
+        if (screen_view_old != m_settings->screen_view)
+          m_settings->window_size_changed = true;
 
         // Screen scale
         auto screen_scale_old = m_settings->screen_scale;
@@ -413,6 +467,32 @@ void Gui::imgui_draw(const emulator::Emulator& emulator) {
         if (!m_settings->window_size_changed)
           m_settings->window_size_changed = (screen_scale_old != m_settings->screen_scale);
 
+        // CPU execution engine
+        const char* const items_cpu_engine[] = { "Interpreter", "Recompiler" };
+        ImGui::Text("CPU  ");
+        ImGui::SameLine();
+        ImGui::Combo("##cpu_engine", (s32*)&m_settings->cpu_engine, items_cpu_engine,
+                     IM_ARRAYSIZE(items_cpu_engine));
+        ImGui::MenuItem("Skip Idle Loops", nullptr, &m_settings->skip_idle_loops);
+        ImGui::MenuItem("HLE BIOS Functions", nullptr, &m_settings->hle_bios);
+        ImGui::MenuItem("Rewind", "Backspace", &m_settings->rewind);
+        ImGui::MenuItem("Threaded GPU", nullptr, &m_settings->threaded_gpu, !m_settings->hw_renderer);
+        ImGui::MenuItem("Parallel Rasterizer", nullptr, &m_settings->parallel_raster);
+        ImGui::MenuItem("Hardware Renderer", nullptr, &m_settings->hw_renderer,
+                        !m_settings->threaded_emulation);
+        if (ImGui::IsItemHovered())
+          ImGui::SetTooltip("Draws with OpenGL at the resolution below.\nNo semi-transparency, mask bit "
+                            "or dithering: semi-transparent primitives are drawn opaque.");
+        ImGui::MenuItem("Threaded Emulation", nullptr, &m_settings->threaded_emulation,
+                        !m_settings->hw_renderer);
+
+        // Internal resolution of the hardware renderer
+        const char* const items_internal_resolution[] = { "1x", "2x", "3x", "4x" };
+        ImGui::Text("Res  ");
+        ImGui::SameLine();
+        ImGui::Combo("##internal_resolution", (s32*)&m_settings->internal_resolution,
+                     items_internal_resolution, IM_ARRAYSIZE(items_internal_resolution));
+
         // Fullscreen
         auto fullscreen_old = m_settings->fullscreen;
         ImGui::MenuItem("Fullscreen", "Ctrl+S", &m_settings->fullscreen);
@@ -421,12 +501,33 @@ void Gui::imgui_draw(const emulator::Emulator& emulator) {
         auto limit_framerate_old = m_settings->limit_framerate;
         // Frame limiter
         ImGui::MenuItem("Throttle FPS", "Ctrl+F", &m_settings->limit_framerate);
-        m_settings->limit_framerate_changed = (limit_framerate_old != m_settings->limit_framerate);
+        m_settings->limit_framerate_changed |= (limit_framerate_old != m_settings->limit_framerate);
+
+        const auto turbo_old = m_settings->turbo;
+        ImGui::MenuItem("Turbo", "Space", &m_settings->turbo);
+        m_settings->limit_framerate_changed |= (turbo_old != m_settings->turbo);
+
+        ImGui::MenuItem("Mute Audio", nullptr, &m_settings->mute_audio);
+
+        // Frames skipped for each presented one
+        const char* const items_frame_skip[] = { "Off", "1", "2", "3", "4" };
+        ImGui::Text("Skip ");
+        ImGui::SameLine();
+        ImGui::Combo("##frame_skip", &m_settings->frame_skip, items_frame_skip,
+                     IM_ARRAYSIZE(items_frame_skip));
+
+        // Frames emulated ahead of each presented one, from a save state
+        const char* const items_run_ahead[] = { "Off", "1", "2", "3", "4" };
+        ImGui::Text("Run Ahead ");
+        ImGui::SameLine();
+        ImGui::Combo("##run_ahead", &m_settings->run_ahead, items_run_ahead,
+                     IM_ARRAYSIZE(items_run_ahead));
 
         // Gui visibility
         ImGui::MenuItem("Show GUI", "Ctrl+G", &m_settings->show_gui);
 
         ImGui::MenuItem("Trace CPU", "Ctrl+P", &m_settings->log_trace_cpu);
+        ImGui::MenuItem("Log BIOS Calls", nullptr, &m_settings->log_bios_calls, LOG_BIOS_CALLS);
 
         ImGui::PopItemWidth();
         ImGui::EndMenu();
@@ -435,10 +536,10 @@ void Gui::imgui_draw(const emulator::Emulator& emulator) {
     }
 
     if (m_draw_tty && (LOG_TTY_OUTPUT_WITH_HOOK || LOG_BIOS_CALLS))
-      draw_window_log("TTY Output", m_draw_tty, m_tty_autoscroll, emulator.cpu().m_tty_out_log.c_str());
+      draw_window_log("TTY Output", m_draw_tty, m_tty_autoscroll, emulator.cpu().m_tty_out_log);
     if (m_draw_bios_calls && LOG_BIOS_CALLS)
       draw_window_log("BIOS Function Calls", m_draw_bios_calls, m_bios_calls_autoscroll,
-                      emulator.cpu().m_bios_calls_log.c_str());
+                      emulator.cpu().m_bios_calls_log);
     if (m_draw_ram)
       draw_window_ram(emulator.ram().data());
     if (m_draw_gpu_registers)
@@ -447,15 +548,23 @@ void Gui::imgui_draw(const emulator::Emulator& emulator) {
       draw_window_cpu_registers(emulator.cpu());
     if (m_draw_gp0_commands)
       draw_window_gp0_commands(emulator.gpu());
+    if (m_draw_gpu_stats)
+      draw_window_gpu_stats(emulator.gpu());
+    if (m_draw_bus_stats && BUS_STATS_ENABLED)
+      draw_window_bus_stats(emulator.bus());
     if (m_draw_timers)
       draw_window_timers(emulator.timers());
+    if (m_draw_profiler && PROFILER_ENABLED)
+      draw_window_profiler();
+    if (m_draw_pc_profiler)
+      draw_window_pc_profiler(emulator.cpu(), emulator.ram().data());
   }
 }
 
 void Gui::draw_window_log(const char* title,
                           bool& should_draw,
                           bool& should_autoscroll,
-                          const char* text_contents) const {
+                          const util::LineLog<cpu::DEBUG_LOG_LINES>& log) const {
   // Window style
   ImGui::SetNextWindowSize(ImVec2(470, 300), ImGuiCond_FirstUseEver);
 
@@ -472,9 +581,17 @@ void Gui::draw_window_log(const char* title,
   ImGui::Spacing();
   ImGui::Separator();
 
-  // Text contents
+  // Text contents, only the visible lines are laid out
   ImGui::BeginChild(title, ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
-  ImGui::TextUnformatted(text_contents);
+  ImGuiListClipper clipper;
+  clipper.Begin((s32)log.size());
+  while (clipper.Step()) {
+    for (s32 i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+      const std::string& line = log[i];
+      ImGui::TextUnformatted(line.data(), line.data() + line.size());
+    }
+  }
+  clipper.End();
 
   if (should_autoscroll)
     ImGui::SetScrollHere(1.0f);
@@ -578,14 +695,13 @@ bool Gui::draw_window_cdrom_select(std::string& cdrom_path) const {
           ImGui::TreePush();
           ImGui::PushStyleColor(ImGuiCol_Text, TXT(0.62f));
           if (ImGui::Selectable(rel_dir_path.c_str())) {
-            if (search_for_ext(dir_iter_2, { ".bin", ".img", ".iso" }, false)) {  // todo: ".cue"
-
+            if (search_for_ext(dir_iter_2, { ".cue", ".bin", ".img", ".iso", ".pbp" }, false)) {
               // First look for a cue sheet
-              // selected = search_for_ext(p, { ".cue"}, true);
+              selected = search_for_ext(dir_iter_2, { ".cue" }, true);
 
               // If we found nothing, fall back to binary formats
               if (!selected)
-                selected = search_for_ext(dir_iter_2, { ".bin", ".img", ".iso" }, true);
+                selected = search_for_ext(dir_iter_2, { ".bin", ".img", ".iso", ".pbp" }, true);
 
               if (selected)
                 LOG_INFO("Opening file: {}", cdrom_path);
@@ -715,141 +831,170 @@ void Gui::draw_window_gp0_commands(const gpu::Gpu& gpu) {
     else if (m_draw_gp0_overlay_alpha == 0)
       m_draw_gp0_overlay_rising = true;
 
-    // For each frame (-1 for the latest one)
-    for (s32 cmds_i = -1; cmds_i < (s32)gpu.m_gp0_cmds_record.size(); ++cmds_i) {
-      gpu::Gpu::Gp0CmdDebugRecordsFrame const* frame_cmds{};
-      std::string frame_str;
-
-      // Before every frame show the latest one
-      if (cmds_i == -1) {
-        // Find last frame that has commands
-        for (auto cmds_it = gpu.m_gp0_cmds_record.crbegin(); cmds_it != gpu.m_gp0_cmds_record.crend();
-             ++cmds_it) {
-          if (cmds_it->size() != 0) {
-            frame_cmds = &(*cmds_it);
-            break;
-          }
+    ImGui::Checkbox("Record", &m_settings->record_gp0);
+    ImGui::SameLine();
+    ImGui::Checkbox("Follow Latest Frame", &m_gp0_follow_latest);
+
+    const auto* recorder = gpu.gp0_recorder();
+    if (recorder == nullptr || recorder->frames().empty()) {
+      ImGui::PopStyleVar(2);
+      ImGui::End();
+      return;
+    }
+
+    // Frames are told apart by their first record, found by bisecting them. A frame that was dropped
+    // gives way to the oldest one.
+    const auto& frames = recorder->frames();
+    if (m_gp0_follow_latest)
+      m_gp0_selected_frame_pos = frames.back().first;
+    const auto is_before = [](u64 pos, const gpu::Gp0Recorder::FrameRecords& records) {
+      return pos < records.first;
+    };
+    const auto selected_it =
+        std::upper_bound(frames.begin(), frames.end(), m_gp0_selected_frame_pos, is_before);
+    const size_t selected_frame = selected_it == frames.begin() ? 0 : selected_it - frames.begin() - 1;
+    const auto& frame_records = frames[selected_frame];
+    if (frame_records.first != m_gp0_selected_frame_pos) {
+      m_gp0_selected_frame_pos = frame_records.first;
+      m_gp0_selected_cmd = -1;
+    }
+
+    const auto cmd_title = [](const gpu::Gp0Recorder::Record& record) -> std::string {
+      if (record.type == gpu::Gp0CommandType::DrawPolygon) {
+        const u8 opcode = record.cmd.front() >> 24;
+        return DrawCommand{ opcode }.polygon.is_quad() ? "Draw Quad" : "Draw Triangle";
+      }
+      return gpu::gp0_cmd_type_to_str(record.type);
+    };
+
+    // Both lists only lay out their visible rows, however many frames and commands there are
+    ImGui::BeginChild("frames", ImVec2(170, GP0_COMMANDS_LIST_HEIGHT), true);
+    ImGuiListClipper frame_clipper;
+    frame_clipper.Begin((s32)frames.size());
+    while (frame_clipper.Step()) {
+      for (s32 i = frame_clipper.DisplayStart; i < frame_clipper.DisplayEnd; ++i) {
+        const auto& records = frames[i];
+        const auto frame_str = fmt::format("Frame #{:<5} ({} cmds)", records.frame, records.count);
+        ImGui::PushID(i);
+        if (ImGui::Selectable(frame_str.c_str(), (size_t)i == selected_frame)) {
+          m_gp0_follow_latest = (size_t)i + 1 == frames.size();
+          m_gp0_selected_frame_pos = records.first;
+          m_gp0_selected_cmd = -1;
         }
-        if (!frame_cmds)
-          continue;
-
-        frame_str = fmt::format("Frame [latest]");
-        ImGui::Spacing();
-      } else {
-        frame_cmds = &gpu.m_gp0_cmds_record[cmds_i];
-        frame_str = fmt::format("Frame #{:<3}", cmds_i);
+        ImGui::PopID();
+      }
+    }
+    frame_clipper.End();
+    if (m_gp0_follow_latest)
+      ImGui::SetScrollHere(1.0f);
+    ImGui::EndChild();
+
+    ImGui::SameLine();
+    ImGui::BeginChild("commands", ImVec2(0, GP0_COMMANDS_LIST_HEIGHT), true);
+    ImGuiListClipper cmd_clipper;
+    cmd_clipper.Begin((s32)frame_records.count);
+    while (cmd_clipper.Step()) {
+      // Records vary in size, skipping the ones above the view only reads their headers
+      auto record_it = recorder->at(frame_records.first);
+      for (s32 i = 0; i < cmd_clipper.DisplayStart; ++i)
+        ++record_it;
+      for (s32 i = cmd_clipper.DisplayStart; i < cmd_clipper.DisplayEnd; ++i, ++record_it) {
+        const auto cmd_string = fmt::format("Command #{}: {}", i, cmd_title(*record_it));
+        ImGui::PushID(i);
+        if (ImGui::Selectable(cmd_string.c_str(), i == m_gp0_selected_cmd))
+          m_gp0_selected_cmd = i;
+        ImGui::PopID();
       }
+    }
+    cmd_clipper.End();
+    ImGui::EndChild();
+
+    if (m_gp0_selected_cmd >= 0 && m_gp0_selected_cmd < (s32)frame_records.count) {
+      auto record_it = recorder->at(frame_records.first);
+      for (s32 i = 0; i < m_gp0_selected_cmd; ++i)
+        ++record_it;
+      const auto record = *record_it;
+      const auto cmd_type = record.type;
+      const auto& cmd_words = record.cmd;
+      const u8 opcode = cmd_words.front() >> 24;
+
+      ImGui::Separator();
+      ImGui::Text("Command #%d: %s", m_gp0_selected_cmd, cmd_title(record).c_str());
+      switch (cmd_type) {
+        case gpu::Gp0CommandType::DrawLine: break;
+        case gpu::Gp0CommandType::DrawRectangle: {
+          auto rectangle = DrawCommand{ opcode }.rectangle;
+
+          Position4 positions{};
+          Color4 colors{};
+          TextureInfo tex_info{};
+          Size size{};
+
+          gpu.m_rasterizer.extract_draw_data_rectangle(rectangle, cmd_words, positions, colors,
+                                                       tex_info, size);
+
+          // Positions
+          const auto is_quad = true;
+          draw_positions(positions, is_quad);
+
+          // Sizes
+          draw_size(size);
+
+          // Colors
+          bool is_flat = true;
+          const u32 vertex_count = 4;
+          draw_colors(colors.data(), is_flat, vertex_count);
+
+          bool is_textured = (bool)rectangle.texture_mapping;
+          if (is_textured)
+            draw_texcoords(tex_info.uv, is_quad);
+
+          // Misc
+          bool is_raw = (rectangle.texture_mode == DrawCommand::TextureMode::Raw);
+          draw_misc_flags(is_textured, is_raw, is_flat);
+
+          // Draw overlay of primitive
+          draw_poly_overlay(positions, is_quad);
 
-      const auto cmds_count = frame_cmds->size();
+          break;
+        }
+        case gpu::Gp0CommandType::DrawPolygon: {
+          auto polygon = DrawCommand{ opcode }.polygon;
 
-      // Skip frames with no commands
-      if (cmds_count == 0)
-        continue;
+          Position4 positions;
+          Color4 colors;
+          TextureInfo tex_info{};
 
-      frame_str += fmt::format(" ({} cmds)", cmds_count);
-
-      if (ImGui::TreeNode(frame_str.c_str())) {
-        // For each command
-        for (u32 cmd_i = 0; cmd_i < cmds_count; ++cmd_i) {
-          const auto& cmd = (*frame_cmds)[cmd_i];
-          const auto cmd_id = std::to_string(cmd_i);
-          const auto cmd_type = cmd.type;
-          const auto& cmd_words = cmd.cmd;
-          const auto cmd_word_first = cmd_words.front();
-          const u8 opcode = cmd_word_first >> 24;
-
-          std::string cmd_string_title;
-          if (cmd_type == gpu::Gp0CommandType::DrawPolygon) {
-            const auto is_quad = DrawCommand{ opcode }.polygon.is_quad();
-            cmd_string_title = is_quad ? "Draw Quad" : "Draw Triangle";
-          } else
-            cmd_string_title = gpu::gp0_cmd_type_to_str(cmd_type);
-
-          const auto cmd_string = fmt::format("Command #{}: {}", cmd_i, cmd_string_title);
-
-          if (ImGui::TreeNode(cmd_id.c_str(), cmd_string.c_str())) {
-            switch (cmd_type) {
-              case gpu::Gp0CommandType::DrawLine: break;
-              case gpu::Gp0CommandType::DrawRectangle: {
-                auto rectangle = DrawCommand{ opcode }.rectangle;
-
-                Position4 positions{};
-                Color4 colors{};
-                TextureInfo tex_info{};
-                Size size{};
-
-                gpu.m_rasterizer.extract_draw_data_rectangle(rectangle, cmd_words, positions, colors,
-                                                             tex_info, size);
-
-                // Positions
-                const auto is_quad = true;
-                draw_positions(positions, is_quad);
-
-                // Sizes
-                draw_size(size);
-
-                // Colors
-                bool is_flat = true;
-                const u32 vertex_count = 4;
-                draw_colors(colors.data(), is_flat, vertex_count);
-
-                bool is_textured = (bool)rectangle.texture_mapping;
-                if (is_textured)
-                  draw_texcoords(tex_info.uv, is_quad);
-
-                // Misc
-                bool is_raw = (rectangle.texture_mode == DrawCommand::TextureMode::Raw);
-                draw_misc_flags(is_textured, is_raw, is_flat);
-
-                // Draw overlay of primitive
-                draw_poly_overlay(positions, is_quad);
-
-                break;
-              }
-              case gpu::Gp0CommandType::DrawPolygon: {
-                auto polygon = DrawCommand{ opcode }.polygon;
-
-                Position4 positions;
-                Color4 colors;
-                TextureInfo tex_info{};
-
-                gpu.m_rasterizer.extract_draw_data_polygon(polygon, cmd_words, positions, colors,
-                                                           tex_info);
-
-                const auto vertex_count = polygon.get_vertex_count();
-
-                // Positions
-                const auto is_quad = polygon.is_quad();
-                draw_positions(positions, is_quad);
-
-                // Colors
-                bool is_flat = (polygon.shading == DrawCommand::Shading::Flat);
-                draw_colors(colors.data(), is_flat, vertex_count);
-
-                bool is_textured = (bool)polygon.texture_mapping;
-                if (is_textured)
-                  draw_texcoords(tex_info.uv, is_quad);
-
-                // Misc
-                bool is_raw = (polygon.texture_mode == DrawCommand::TextureMode::Raw);
-                draw_misc_flags(is_textured, is_raw, is_flat);
-
-                // Draw overlay of primitive
-                draw_poly_overlay(positions, is_quad);
-
-                break;
-              }
-              case gpu::Gp0CommandType::FillRectangleInVram: break;
-              case gpu::Gp0CommandType::CopyCpuToVram: break;
-              case gpu::Gp0CommandType::CopyCpuToVramTransferring: break;
-              case gpu::Gp0CommandType::CopyVramToCpu: break;
-            }
+          gpu.m_rasterizer.extract_draw_data_polygon(polygon, cmd_words, positions, colors,
+                                                     tex_info);
 
-            ImGui::TreePop();
-            ImGui::Separator();
-          }
+          const auto vertex_count = polygon.get_vertex_count();
+
+          // Positions
+          const auto is_quad = polygon.is_quad();
+          draw_positions(positions, is_quad);
+
+          // Colors
+          bool is_flat = (polygon.shading == DrawCommand::Shading::Flat);
+          draw_colors(colors.data(), is_flat, vertex_count);
+
+          bool is_textured = (bool)polygon.texture_mapping;
+          if (is_textured)
+            draw_texcoords(tex_info.uv, is_quad);
+
+          // Misc
+          bool is_raw = (polygon.texture_mode == DrawCommand::TextureMode::Raw);
+          draw_misc_flags(is_textured, is_raw, is_flat);
+
+          // Draw overlay of primitive
+          draw_poly_overlay(positions, is_quad);
+
+          break;
         }
-        ImGui::TreePop();
+        case gpu::Gp0CommandType::FillRectangleInVram: break;
+        case gpu::Gp0CommandType::CopyCpuToVram: break;
+        case gpu::Gp0CommandType::CopyCpuToVramTransferring: break;
+        case gpu::Gp0CommandType::CopyVramToCpu: break;
       }
     }
     ImGui::PopStyleVar(2);
@@ -931,12 +1076,227 @@ void Gui::draw_window_timers(const io::Timers& timers) {
   ImGui::End();
 }
 
-template <size_t RamSize>
-void Gui::draw_window_ram(const std::array<byte, RamSize>& ram_data) {
+void Gui::draw_window_profiler() {
+  // The capture is written out once its frames have gone by, whichever thread emulates them
+  if (m_profiler_trace_pending && !util::g_profiler.is_capturing()) {
+    m_profiler_trace_pending = false;
+    util::g_profiler.write_chrome_trace(PROFILER_TRACE_PATH);
+  }
+
+  ImGui::SetNextWindowSize(ImVec2(420, 260), ImGuiCond_FirstUseEver);
+  if (!ImGui::Begin("Profiler", &m_draw_profiler)) {
+    ImGui::End();
+    return;
+  }
+
+  util::g_profiler.history(m_profiler_frames);
+  if (m_profiler_frames.empty()) {
+    ImGui::Text("No frames emulated yet");
+    ImGui::End();
+    return;
+  }
+
+  // Averaged over the history, single frames are too noisy to read
+  util::ProfileFrame average;
+  for (const auto& frame : m_profiler_frames) {
+    for (u32 i = 0; i < util::PROFILE_ZONE_COUNT; ++i) {
+      average.ns[i] += frame.ns[i];
+      average.calls[i] += frame.calls[i];
+    }
+    average.frame_ns += frame.frame_ns;
+  }
+  const f64 frame_count = (f64)m_profiler_frames.size();
+  const f64 frame_ms = average.frame_ns / frame_count / 1e6;
+
+  std::array<f32, util::PROFILE_HISTORY_FRAMES> frame_times{};
+  for (size_t i = 0; i < m_profiler_frames.size(); ++i)
+    frame_times[i] = (f32)(m_profiler_frames[i].frame_ns / 1e6);
+  ImGui::PlotLines("##frame_times", frame_times.data(), (s32)m_profiler_frames.size(), 0,
+                   fmt::format("Frame {:.2f} ms", frame_ms).c_str(), 0.0f, 50.0f, ImVec2(0, 60));
+
+  // Zones nest (bus I/O and DMA run inside the CPU), so the bars don't add up to the frame
+  ImGui::Columns(2);
+  ImGui::SetColumnWidth(0, 120);
+  for (u32 i = 0; i < util::PROFILE_ZONE_COUNT; ++i) {
+    const f64 zone_ms = average.ns[i] / frame_count / 1e6;
+    ImGui::Text("%s", util::profile_zone_name((util::ProfileZone)i));
+    ImGui::NextColumn();
+    const auto overlay =
+        fmt::format("{:.2f} ms, {:.0f} calls", zone_ms, average.calls[i] / frame_count);
+    ImGui::ProgressBar(frame_ms > 0 ? (f32)(zone_ms / frame_ms) : 0.0f, ImVec2(-1, 0), overlay.c_str());
+    ImGui::NextColumn();
+  }
+  ImGui::Columns(1);
+
+  ImGui::Separator();
+  if (m_profiler_trace_pending) {
+    ImGui::Text("Capturing...");
+  } else if (ImGui::Button("Capture Trace")) {
+    util::g_profiler.start_capture(PROFILER_TRACE_FRAMES);
+    m_profiler_trace_pending = true;
+  }
+  ImGui::SameLine();
+  ImGui::TextDisabled("%u frames to %s", PROFILER_TRACE_FRAMES, PROFILER_TRACE_PATH);
+
+  ImGui::End();
+}
+
+void Gui::draw_window_pc_profiler(const cpu::Cpu& cpu, const byte* ram_data) {
+  ImGui::SetNextWindowSize(ImVec2(460, 420), ImGuiCond_FirstUseEver);
+  if (!ImGui::Begin("Guest PC Profiler", &m_draw_pc_profiler)) {
+    ImGui::End();
+    return;
+  }
+
+  ImGui::Checkbox("Sample", &m_settings->sample_guest_pc);
+  ImGui::SameLine();
+  bool should_refresh = ImGui::Checkbox("By Symbol", &m_pc_profiler_by_symbol);
+  ImGui::SameLine();
+  const auto& sampler = cpu.pc_sampler();
+  const auto sample_count_text = fmt::format("{} samples, 1 every {} instructions",
+                                             sampler.sample_count(), cpu::PC_SAMPLE_INTERVAL);
+  ImGui::TextDisabled("%s", sample_count_text.c_str());
+
+  ImGui::PushItemWidth(-110);
+  auto& symbols_path = m_pc_profiler_symbols_path;
+  ImGui::InputText("##symbols_path", symbols_path.data(), symbols_path.size());
+  ImGui::PopItemWidth();
+  ImGui::SameLine();
+  if (ImGui::Button("Load Symbols")) {
+    m_pc_profiler_symbols.clear();
+    m_pc_profiler_symbols.load(symbols_path.data());
+    should_refresh = true;
+  }
+  ImGui::Separator();
+
+  // Sorting many samples every frame would slow down emulation, which waits for the GUI
+  if (should_refresh || m_pc_profiler_frames_to_refresh == 0) {
+    m_pc_profiler_frames_to_refresh = PC_PROFILER_REFRESH_FRAMES;
+    // The kernel sets its tables up while booting, they're read again each time
+    cpu::SymbolMap bios_symbols;
+    bios_symbols.add_bios_functions(ram_data);
+    m_pc_profiler_spots = cpu::hot_spots(sampler, { &bios_symbols, &m_pc_profiler_symbols },
+                                         m_pc_profiler_by_symbol, PC_PROFILER_SPOT_COUNT);
+  }
+  --m_pc_profiler_frames_to_refresh;
+
+  ImGui::Columns(3, "hot spots");
+  ImGui::SetColumnWidth(0, 70);
+  ImGui::SetColumnWidth(1, 80);
+  ImGui::Text("Samples");
+  ImGui::NextColumn();
+  ImGui::Text("Address");
+  ImGui::NextColumn();
+  ImGui::Text("Symbol");
+  ImGui::NextColumn();
+  ImGui::Separator();
+  const f64 sample_count = (f64)std::max<u64>(sampler.sample_count(), 1);
+  for (const auto& spot : m_pc_profiler_spots) {
+    ImGui::Text("%5.1f%%", spot.samples * 100.0 / sample_count);
+    ImGui::NextColumn();
+    ImGui::Text("%08X", spot.addr);
+    ImGui::NextColumn();
+    ImGui::TextUnformatted(spot.name.empty() ? "?" : spot.name.c_str());
+    ImGui::NextColumn();
+  }
+  ImGui::Columns(1);
+
+  ImGui::End();
+}
+
+void Gui::draw_window_gpu_stats(const gpu::Gpu& gpu) {
+  using renderer::rasterizer::DrawCommand;
+  using renderer::rasterizer::PixelRenderType;
+
+  ImGui::SetNextWindowSize(ImVec2(300, 250), ImGuiCond_FirstUseEver);
+  if (!ImGui::Begin("GPU Stats", &m_draw_gpu_stats)) {
+    ImGui::End();
+    return;
+  }
+
+  const auto& stats = gpu.frame_raster_stats();
+  const auto text_row = [](const char* label, u64 value) {
+    ImGui::Text("%s", label);
+    ImGui::NextColumn();
+    ImGui::Text("%llu", (unsigned long long)value);
+    ImGui::NextColumn();
+  };
+
+  ImGui::TextDisabled("Last frame, of the software rasterizer only");
+  ImGui::Columns(2, "gpu stats");
+  ImGui::SetColumnWidth(0, 170);
+  text_row("Triangles", stats.primitive_count(DrawCommand::PrimitiveType::Polygon));
+  text_row("Lines", stats.primitive_count(DrawCommand::PrimitiveType::Line));
+  text_row("Rectangles", stats.primitive_count(DrawCommand::PrimitiveType::Rectangle));
+  ImGui::Separator();
+  text_row("Pixels tested", stats.pixels_tested);
+  text_row("Pixels written", stats.pixels_written);
+  ImGui::Separator();
+  text_row("Texels 4-bit", stats.texels[(size_t)PixelRenderType::TEXTURED_PALETTED_4BIT]);
+  text_row("Texels 8-bit", stats.texels[(size_t)PixelRenderType::TEXTURED_PALETTED_8BIT]);
+  text_row("Texels 16-bit", stats.texels[(size_t)PixelRenderType::TEXTURED_16BIT]);
+  ImGui::Columns(1);
+
+  ImGui::Separator();
+  ImGui::Checkbox("Overdraw Heatmap", &m_settings->overdraw_heatmap);
+  ImGui::SameLine();
+  ImGui::TextDisabled("Blue once, to red, white 8+ times");
+
+  ImGui::End();
+}
+
+void Gui::draw_window_bus_stats(const bus::Bus& bus) {
+  ImGui::SetNextWindowSize(ImVec2(560, 380), ImGuiCond_FirstUseEver);
+  if (!ImGui::Begin("Bus Stats", &m_draw_bus_stats)) {
+    ImGui::End();
+    return;
+  }
+
+  const auto& stats = bus.stats();
+  u64 total = 0;
+  for (const auto& region : stats.accesses)
+    for (const u64 count : region)
+      total += count;
+  ImGui::TextDisabled("%llu accesses since power on", (unsigned long long)total);
+
+  ImGui::Columns(2 + bus::BUS_ACCESS_COUNT, "bus stats");
+  ImGui::SetColumnWidth(0, 100);
+  ImGui::Text("Region");
+  ImGui::NextColumn();
+  for (u32 access = 0; access < bus::BUS_ACCESS_COUNT; ++access) {
+    ImGui::Text("%s", bus::bus_access_name((bus::BusAccess)access));
+    ImGui::NextColumn();
+  }
+  ImGui::Text("Share");
+  ImGui::NextColumn();
+  ImGui::Separator();
+
+  // Regions that were never accessed are left out
+  for (u32 region = 0; region < bus::BUS_REGION_COUNT; ++region) {
+    const auto& counts = stats.accesses[region];
+    const u64 region_total = std::accumulate(counts.begin(), counts.end(), u64{});
+    if (region_total == 0)
+      continue;
+
+    ImGui::Text("%s", bus::bus_region_name((bus::BusRegion)region));
+    ImGui::NextColumn();
+    for (const u64 count : counts) {
+      ImGui::Text("%llu", (unsigned long long)count);
+      ImGui::NextColumn();
+    }
+    ImGui::Text("%5.1f%%", region_total * 100.0 / total);
+    ImGui::NextColumn();
+  }
+  ImGui::Columns(1);
+
+  ImGui::End();
+}
+
+void Gui::draw_window_ram(const byte* ram_data) {
   // Window style
   ImGui::SetNextWindowSize(ImVec2(500, 411), ImGuiCond_FirstUseEver);
 
-  m_ram_memeditor.DrawWindow("RAM Contents", (MemoryEditor::u8*)ram_data.data(), RamSize, 0);
+  m_ram_memeditor.DrawWindow("RAM Contents", (MemoryEditor::u8*)ram_data, memory::RAM_SIZE, 0);
 }
 
 struct RegisterTableEntry {
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cpu/cpu.hpp>
+#include <cpu/pc_sampler.hpp>
+#include <util/profiler.hpp>
 #include <util/types.hpp>
 
 #include <SDL.h>
@@ -10,14 +13,16 @@
 #include <chrono>
 #include <string>
 #include <array>
+#include <vector>
 
 namespace emulator {
 class Emulator;
+class EmulatorThread;
 struct Settings;
 }  // namespace emulator
 
-namespace cpu {
-class Cpu;
+namespace bus {
+class Bus;
 }
 
 namespace gpu {
@@ -42,6 +47,7 @@ class Gui {
   void init();
   void set_joypad(io::Joypad* joypad);
   void set_settings(emulator::Settings* joypad);
+  void set_emulator_thread(emulator::EmulatorThread* emulator_thread);
   void set_game_title(const std::string& game_title);
   void apply_settings() const;
   bool poll_events();  // Returns true if there are any pending events
@@ -50,6 +56,8 @@ class Gui {
   void draw(const emulator::Emulator& emulator);
   void draw_file_select(gui::Gui& gui, std::string& exe_path, std::string& bin_path);
   void swap();
+  // Plays interleaved 16 bit stereo samples after the ones already queued, from any thread
+  void queue_audio(const s16* samples, u32 frame_count);
   void deinit();
   void clear() const;
 
@@ -70,19 +78,23 @@ class Gui {
   void draw_window_log(const char* title,
                        bool& should_draw,
                        bool& should_autoscroll,
-                       const char* text_contents) const;
-  template <size_t RamSize>
-  void draw_window_ram(const std::array<byte, RamSize>& data);
+                       const util::LineLog<cpu::DEBUG_LOG_LINES>& log) const;
+  void draw_window_ram(const byte* data);  // memory::RAM_SIZE bytes
   void draw_window_gpu_registers(const gpu::Gpu& gpu);
   void draw_window_cpu_registers(const cpu::Cpu& cpu);
   void draw_window_gp0_commands(const gpu::Gpu& gpu);
+  void draw_window_gpu_stats(const gpu::Gpu& gpu);
+  void draw_window_bus_stats(const bus::Bus& bus);
   void draw_window_timers(const io::Timers& timers);
+  void draw_window_profiler();
+  void draw_window_pc_profiler(const cpu::Cpu& cpu, const byte* ram_data);
 
  private:
   // SDL
   SDL_Window* m_window;
   SDL_GLContext m_gl_context;
   SDL_Event m_event;
+  SDL_AudioDeviceID m_audio_device{};  // 0 without sound
 
  private:
   // FPS counter fields
@@ -109,17 +121,45 @@ class Gui {
   bool m_draw_cpu_registers{ true };
 
   // GP0 Commands window fields
+  static constexpr f32 GP0_COMMANDS_LIST_HEIGHT = 200.0f;
   bool m_draw_gp0_commands{ true };
+  bool m_gp0_follow_latest{ true };
+  u64 m_gp0_selected_frame_pos{};  // Gp0Recorder::FrameRecords::first of the selected frame
+  s32 m_gp0_selected_cmd{ -1 };    // In the frame, none if -1
   bool m_draw_gp0_overlay_rising{ true };
   u8 m_draw_gp0_overlay_alpha{};
 
+  // GPU Stats window fields
+  bool m_draw_gpu_stats{};
+
+  // Bus Stats window fields
+  bool m_draw_bus_stats{};
+
   // Timers window fields
   bool m_draw_timers{ true };
 
+  // Profiler window fields
+  static constexpr u32 PROFILER_TRACE_FRAMES = 60;
+  static constexpr const char* PROFILER_TRACE_PATH = "pctation_trace.json";
+  bool m_draw_profiler{ true };
+  bool m_profiler_trace_pending{};  // Written once the capture is done
+  std::vector<util::ProfileFrame> m_profiler_frames;
+
+  // Guest PC Profiler window fields
+  static constexpr u32 PC_PROFILER_SPOT_COUNT = 40;
+  static constexpr u32 PC_PROFILER_REFRESH_FRAMES = 30;  // Between two sorts of the samples
+  bool m_draw_pc_profiler{};
+  bool m_pc_profiler_by_symbol{ true };
+  std::array<char, 256> m_pc_profiler_symbols_path{};
+  cpu::SymbolMap m_pc_profiler_symbols;  // Loaded from m_pc_profiler_symbols_path
+  std::vector<cpu::HotSpot> m_pc_profiler_spots;
+  u32 m_pc_profiler_frames_to_refresh{};
+
   std::string m_game_title;
 
   io::Joypad* m_joypad;
   emulator::Settings* m_settings;
+  emulator::EmulatorThread* m_emulator_thread{};  // Joypad input goes through it while it's running
 };
 
 }  // namespace gui
@@ -2,65 +2,240 @@
 
 #include <util/fs.hpp>
 #include <util/log.hpp>
+#include <util/profiler.hpp>
 
 #include <algorithm>
 #include <array>
+#include <sstream>
+#include <system_error>
 
 namespace io {
 
+namespace {
+
+// "mm:ss:ff" of a cue sheet to sectors, -1 if it isn't one
+s64 parse_msf(const std::string& msf) {
+  u32 mm{}, ss{}, ff{};
+  char sep1{}, sep2{};
+  std::istringstream stream(msf);
+  if (!(stream >> mm >> sep1 >> ss >> sep2 >> ff) || sep1 != ':' || sep2 != ':' || ss >= 60 || ff >= 75)
+    return -1;
+  return (s64)CdromPosition(mm, ss, ff).to_lba();
+}
+
+// FILE "path with spaces" BINARY, or FILE path BINARY
+std::string parse_file_path(std::istringstream& stream) {
+  std::string path;
+  stream >> std::ws;
+  if (stream.peek() == '"') {
+    stream.get();
+    std::getline(stream, path, '"');
+  } else {
+    stream >> path;
+  }
+  return path;
+}
+
+}  // namespace
+
 void CdromDisk::init_from_bin(const std::string& bin_path) {
+  clear();
   filepath = bin_path;
-  create_track_for_bin(bin_path);
 
-  m_tracks[0].file.open(bin_path, std::ios::binary | std::ios::in);
+  const auto filesize = fs::file_size(bin_path);
+  if (filesize == 0)
+    return;
+
+  CueTrack bin_track{};
+  bin_track.number = 1;  // Track number 01
+  bin_track.type = CdromTrack::DataType::Data;
+  bin_track.index1 = 0;
+  create_tracks({ { bin_path, static_cast<u32>(filesize / SECTOR_SIZE) } }, { bin_track });
 }
 
 void CdromDisk::init_from_cue(const std::string& cue_path) {
+  clear();
   std::ifstream cue_file(cue_path, std::ios::in);
+  if (!cue_file) {
+    LOG_ERROR_CDROM("Could not open cue sheet {}", cue_path);
+    return;
+  }
+  filepath = cue_path;
+
+  const auto cue_dir = fs::path(cue_path).parent_path();
+  std::vector<CueFile> files;
+  std::vector<CueTrack> cue_tracks;
+
+  std::string line;
+  while (std::getline(cue_file, line)) {
+    std::istringstream stream(line);
+    std::string command;
+    stream >> command;
+    std::transform(command.begin(), command.end(), command.begin(), ::toupper);
+
+    if (command == "FILE") {
+      const auto file_path = (cue_dir / parse_file_path(stream)).string();
+      std::string file_type;
+      stream >> file_type;
+      if (file_type != "BINARY")
+        LOG_WARN_CDROM("Cue sheet file {} is {}, reading it as BINARY", file_path, file_type);
+
+      std::error_code error;
+      const auto filesize = fs::file_size(file_path, error);
+      if (error || filesize == 0) {
+        LOG_ERROR_CDROM("Could not open {} of cue sheet {}", file_path, cue_path);
+        return;
+      }
+      files.push_back({ file_path, static_cast<u32>(filesize / SECTOR_SIZE) });
+    } else if (command == "TRACK") {
+      CueTrack cue_track{};
+      std::string mode;
+      stream >> cue_track.number >> mode;
+      if (mode == "AUDIO")
+        cue_track.type = CdromTrack::DataType::Audio;
+      else if (mode == "MODE1/2352" || mode == "MODE2/2352")
+        cue_track.type = CdromTrack::DataType::Data;
+      if (files.empty() || cue_track.type == CdromTrack::DataType::Invalid) {
+        LOG_ERROR_CDROM("Unsupported track {:02} {} of cue sheet {}", cue_track.number, mode, cue_path);
+        return;
+      }
+      cue_track.file_index = static_cast<u32>(files.size() - 1);
+      cue_tracks.push_back(cue_track);
+    } else if (command == "INDEX" && !cue_tracks.empty()) {
+      u32 index{};
+      std::string msf;
+      stream >> index >> msf;
+      if (index == 0)
+        cue_tracks.back().index0 = parse_msf(msf);
+      else if (index == 1)
+        cue_tracks.back().index1 = parse_msf(msf);
+    } else if (command == "PREGAP" && !cue_tracks.empty()) {
+      std::string msf;
+      stream >> msf;
+      cue_tracks.back().pregap = static_cast<u32>(std::max<s64>(parse_msf(msf), 0));
+    }
+    // The rest (REM, CATALOG, TITLE, FLAGS, POSTGAP...) doesn't change where the sectors are
+  }
 
-  // TODO: Cue parsing
+  create_tracks(files, cue_tracks);
 }
 
-buffer CdromDisk::read(CdromPosition pos, CdromTrack::DataType& sector_type) {
+void CdromDisk::init_from_pbp(const std::string& pbp_path) {
+  clear();
+  m_pbp = std::make_unique<PbpImage>();
+  if (!m_pbp->open(pbp_path)) {
+    m_pbp.reset();
+    return;
+  }
+  filepath = pbp_path;
+
+  // A single data track, like the BIN images of single track games
+  CueTrack pbp_track{};
+  pbp_track.number = 1;
+  pbp_track.type = CdromTrack::DataType::Data;
+  pbp_track.index1 = 0;
+  create_tracks({ { pbp_path, m_pbp->sector_count() } }, { pbp_track });
+}
+
+const u8* CdromDisk::read(CdromPosition pos, CdromTrack::DataType& sector_type, buffer& fallback) {
+  PROFILE_SCOPE(CdromRead);
+
   auto track = get_track_by_pos(pos);
 
   if (!track) {
     LOG_WARN_CDROM("Reading failed, no disk loaded");
     sector_type = CdromTrack::DataType::Invalid;
-    return {};
+    return nullptr;
   }
 
-  buffer sector_buf(SECTOR_SIZE);
+  LOG_DEBUG_CDROM("Reading {} track: {:02} pos: {}", track->type_to_str(), track->number, pos.to_str());
 
-  // Convert physical position (as on real CDROMs) to logical (as on .BIN files)
-  if (track->number == 1 && track->type == CdromTrack::DataType::Data)
-    pos.physical_to_logical();
+  sector_type = track->type;
 
-  LOG_INFO_CDROM("Reading {} track: {:02} pos: {}", track->type_to_str(), track->number, pos.to_str());
+  // Physical position (as on real CDROMs) to the sector in the file of the track
+  const s64 from_start = (s64)pos.to_lba() - track->start.to_lba();
+  if (from_start < -(s64)track->pregap_in_file) {
+    // The pregap isn't in the file, it's silence or empty sectors
+    fallback.assign(SECTOR_SIZE, 0);
+    return fallback.data();
+  }
+  const u32 sector = static_cast<u32>(track->offset + from_start);
 
-  const auto seek_pos = pos.to_lba() * SECTOR_SIZE;
-  track->file.seekg(seek_pos);
-  track->file.read((char*)sector_buf.data(), SECTOR_SIZE);
+  if (m_pbp) {
+    fallback.resize(SECTOR_SIZE);
+    if (!m_pbp->read(sector, fallback.data()))
+      std::fill(fallback.begin(), fallback.end(), 0);
+    return fallback.data();
+  }
 
-  sector_type = track->type;
-  return sector_buf;
+  m_prefetcher.prefetch(*track, sector + 1);
+
+  const size_t seek_pos = (size_t)sector * SECTOR_SIZE;
+  if (track->mapping.is_open() && seek_pos + SECTOR_SIZE <= track->mapping.size())
+    return track->mapping.data() + seek_pos;
+
+  if (!m_prefetcher.read(*track, sector, fallback)) {
+    fallback.resize(SECTOR_SIZE);
+    track->file.seekg(seek_pos);
+    track->file.read((char*)fallback.data(), SECTOR_SIZE);
+  }
+  return fallback.data();
 }
 
-void CdromDisk::create_track_for_bin(const std::string& bin_path) {
-  CdromTrack bin_track{};
+void CdromDisk::create_tracks(const std::vector<CueFile>& files, const std::vector<CueTrack>& cue_tracks) {
+  // Files follow each other on the disc, pregaps that aren't in them push everything after them back
+  u32 file_first_lba = CDROM_INDEX_1_POS.to_lba();
+  u32 generated_pregaps{};
+
+  for (size_t i = 0; i < cue_tracks.size(); ++i) {
+    const auto& cue_track = cue_tracks[i];
+    const auto& file = files[cue_track.file_index];
+    if (i > 0 && cue_track.file_index != cue_tracks[i - 1].file_index)
+      file_first_lba += files[cue_tracks[i - 1].file_index].sector_count;
+    generated_pregaps += cue_track.pregap;
+
+    // A track ends where the pregap of the next one in the same file begins, or with the file
+    s64 end = file.sector_count;
+    if (i + 1 < cue_tracks.size() && cue_tracks[i + 1].file_index == cue_track.file_index)
+      end = cue_tracks[i + 1].index0 >= 0 ? cue_tracks[i + 1].index0 : cue_tracks[i + 1].index1;
+
+    const s64 index0 = cue_track.index0 >= 0 ? cue_track.index0 : cue_track.index1;
+    if (cue_track.index1 < 0 || index0 > cue_track.index1 || cue_track.index1 > end ||
+        m_tracks.size() == 99) {
+      LOG_ERROR_CDROM("Invalid track {:02} in {}", cue_track.number, file.path);
+      m_tracks.clear();
+      m_track_first_lbas.clear();
+      return;
+    }
+
+    CdromTrack track{};
+    track.filepath = file.path;
+    track.number = cue_track.number;
+    track.type = cue_track.type;
+    track.pregap_in_file = static_cast<u32>(cue_track.index1 - index0);
+    track.pregap = CdromSize::from_lba(track.pregap_in_file + cue_track.pregap +
+                                       (i == 0 ? CDROM_INDEX_1_POS.to_lba() : 0));
+    track.start = CdromPosition::from_lba(file_first_lba + generated_pregaps + (u32)cue_track.index1);
+    track.offset = static_cast<u32>(cue_track.index1);
+    track.frame_count = static_cast<u32>(end - cue_track.index1);
+
+    m_track_first_lbas.push_back(track.start.to_lba() - track.pregap.to_lba());
+    m_tracks.emplace_back(std::move(track));
+  }
 
-  const auto filesize = fs::file_size(bin_path);
-  if (filesize == 0)
+  // Tracks of the same file each map it, files are only ever a few hundred MB
+  if (m_pbp)
     return;
+  for (auto& track : m_tracks)
+    if (!track.mapping.open(track.filepath))
+      track.file.open(track.filepath, std::ios::binary | std::ios::in);
+}
 
-  bin_track.filepath = bin_path;
-  bin_track.number = 1;  // Track number 01
-  bin_track.type = CdromTrack::DataType::Data;
-  bin_track.frame_count = static_cast<u32>(filesize) / SECTOR_SIZE;
-  // the rest of the fields are correct as default-initialized
-
+void CdromDisk::clear() {
+  m_prefetcher.clear();
+  m_pbp.reset();
   m_tracks.clear();
-  m_tracks.emplace_back(std::move(bin_track));
+  m_track_first_lbas.clear();
 }
 
 }  // namespace io
\ No newline at end of file
@@ -1,12 +1,17 @@
 #pragma once
 
+#include <io/cdrom_prefetcher.hpp>
+#include <io/pbp_image.hpp>
+#include <util/mapped_file.hpp>
 #include <util/types.hpp>
 
 #include <fmt/format.h>
 
 #include <gsl-lite.hpp>
 
+#include <algorithm>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -61,12 +66,13 @@ struct CdromTrack {
   std::string filepath;
   u32 number{};
 
-  CdromSize pregap{};
-  CdromPosition start{};
-
-  u32 offset{};  // File offset in sectors/frames
-  u32 frame_count{};
+  CdromSize pregap{};       // Before INDEX 01, the first 2 seconds of the disc are part of track 1's
+  u32 pregap_in_file{};     // The end of the pregap that is stored in the file (INDEX 00), in sectors
+  CdromPosition start{};    // Of INDEX 01
+  u32 offset{};             // File offset of INDEX 01 in sectors/frames
+  u32 frame_count{};        // From INDEX 01 to the next track
 
+  util::MappedFile mapping;  // Sectors are read through file when the image couldn't be mapped
   std::ifstream file;
 
   const char* type_to_str() const {
@@ -81,10 +87,16 @@ struct CdromTrack {
 
 class CdromDisk {
  public:
-  buffer read(CdromPosition pos, CdromTrack::DataType& sector_type);
+  // Returns the SECTOR_SIZE bytes of the sector, straight from the mapping of the image or read into
+  // fallback if it isn't mapped. The following sectors are read ahead in the background. The sector
+  // stays valid as long as the disk, or until fallback is changed. Returns nullptr if there's no sector
+  // at pos.
+  const u8* read(CdromPosition pos, CdromTrack::DataType& sector_type, buffer& fallback);
 
   void init_from_bin(const std::string& bin_path);
+  // Tracks of any number of BINARY files, with their pregaps (INDEX 00 in the files or PREGAP)
   void init_from_cue(const std::string& cue_path);
+  void init_from_pbp(const std::string& pbp_path);
 
   const CdromTrack& track(u32 track_number) const { return m_tracks[track_number]; }
   u8 get_track_count() const {
@@ -93,52 +105,60 @@ class CdromDisk {
     return static_cast<u8>(track_count);
   }
 
+  // Where the lead-out begins
   CdromSize size() const {
-    u32 sectors{};
-    for (auto& t : m_tracks)
-      sectors += t.frame_count;
-    return CdromPosition::from_lba(sectors) + CDROM_INDEX_1_POS;
+    if (m_tracks.empty())
+      return CDROM_INDEX_1_POS;
+    const auto& last = m_tracks.back();
+    return CdromPosition::from_lba(last.start.to_lba() + last.frame_count);
   }
 
+  // Of INDEX 01 of the track, track_number being 1-based. The lead-out for tracks past the last one.
   CdromPosition get_track_start(u32 track_number) const {
-    u32 start{};
-
-    const auto track_count = get_track_count();
-
-    if (track_count > 0) {
-      // Add Pregap if necessary
-      if (m_tracks[0].type == CdromTrack::DataType::Data)
-        start += PREGAP_FRAME_COUNT;
-
-      if (track_count > 1) {
-        for (u32 t = 0; t < track_number - 1; t++)
-          start += m_tracks[t].frame_count;
-      }
-    }
-
-    return CdromPosition::from_lba(start);
+    if (track_number == 0 || track_number > m_tracks.size())
+      return size();
+    return m_tracks[track_number - 1].start;
   }
 
-  // Returns nullptr if the position is out of bounds of laoded tracks
+  // Returns nullptr if the position is out of bounds of loaded tracks. Tracks include their pregap.
   CdromTrack* get_track_by_pos(CdromPosition pos) {
-    for (auto i = 0; i < m_tracks.size(); ++i) {
-      const auto pos_lba = pos.to_lba();
-      const auto start = get_track_start(i).to_lba();
-      const auto size = m_tracks[i].frame_count;
-
-      if (pos_lba >= start && pos_lba < start + size)
-        return &m_tracks[i];
-    }
-    return nullptr;
+    const u32 pos_lba = pos.to_lba();
+    if (m_tracks.empty() || pos_lba >= size().to_lba())
+      return nullptr;
+
+    const auto next = std::upper_bound(m_track_first_lbas.begin(), m_track_first_lbas.end(), pos_lba);
+    if (next == m_track_first_lbas.begin())
+      return nullptr;
+    return &m_tracks[next - m_track_first_lbas.begin() - 1];
   }
 
   bool is_empty() const { return m_tracks.empty(); }
 
  private:
-  void create_track_for_bin(const std::string& bin_path);
+  // One FILE of a cue sheet, and what its tracks say about where they are in it
+  struct CueFile {
+    std::string path;
+    u32 sector_count{};
+  };
+  struct CueTrack {
+    u32 number{};
+    CdromTrack::DataType type{ CdromTrack::DataType::Invalid };
+    u32 file_index{};
+    s64 index0{ -1 };  // In sectors from the start of the file, -1 if there's no INDEX 00
+    s64 index1{ -1 };
+    u32 pregap{};  // Not in the file (PREGAP), in sectors
+  };
+
+  // Lays the tracks out on the disc, one after the other, and opens their files. Used for every image
+  // type, BIN images are a single file with a single INDEX 01 00:00:00 track.
+  void create_tracks(const std::vector<CueFile>& files, const std::vector<CueTrack>& cue_tracks);
+  void clear();
 
   std::string filepath;
   std::vector<CdromTrack> m_tracks;
+  std::vector<u32> m_track_first_lbas;  // Sorted, where the pregap of each track begins
+  CdromPrefetcher m_prefetcher;  // After the tracks, it reads from them until destroyed
+  std::unique_ptr<PbpImage> m_pbp;  // Holds the sectors of the track instead of its file, if any
 };
 
 }  // namespace io
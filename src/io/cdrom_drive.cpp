@@ -1,11 +1,16 @@
 #include <io/cdrom_drive.hpp>
 
 #include <cpu/interrupt.hpp>
+#include <emulator/scheduler.hpp>
+#include <io/iso9660.hpp>
 #include <util/fs.hpp>
 #include <util/log.hpp>
+#include <util/state_stream.hpp>
 
 #include <gsl-lite.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <utility>
 
@@ -16,61 +21,178 @@ void CdromDrive::insert_disk_file(const fs::path& file_path) {
   std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
   if (ext == ".cue")
     m_disk.init_from_cue(file_path.string().c_str());
+  else if (ext == ".pbp")
+    m_disk.init_from_pbp(file_path.string());
   else
     m_disk.init_from_bin(file_path.string().c_str());
   m_stat_code.shell_open = false;
 }
 
-void CdromDrive::init(cpu::Interrupts* interrupts) {
+bool CdromDrive::read_boot_exe(buffer& out_exe) {
+  if (m_disk.is_empty())
+    return false;
+  return io::read_boot_exe(m_disk, out_exe);
+}
+
+void CdromDrive::init(cpu::Interrupts* interrupts,
+                      emulator::Scheduler* scheduler,
+                      spu::CdAudio* cd_audio) {
   m_interrupts = interrupts;
+  m_scheduler = scheduler;
+  m_cd_audio = cd_audio;
+
+  m_scheduler->set_callback(emulator::EventType::CdromIrq, [this]() { update_irq(); });
+  m_scheduler->set_callback(emulator::EventType::CdromSector, [this]() {
+    read_sector();
+    update_read_schedule();
+  });
+}
+
+void CdromDrive::serialize(util::StateStream& s) {
+  s.section("CDRM");
+  s.value(m_reg_status);
+  s.value(m_stat_code);
+  s.value(m_mode);
+  s.value(m_seek_sector);
+  s.value(m_read_sector);
+  s.value(m_param_fifo);
+  s.value(m_irq_fifo);
+  s.value(m_resp_fifo);
+  s.value(m_reg_int_enable);
+
+  s.value(m_read_buf_index);
+  m_read_buf_index %= SECTOR_BUFFER_COUNT;
+  serialize_sector(s, m_read_sector_data, m_sector_bufs[m_read_buf_index]);
+  serialize_sector(s, m_data_sector_data, m_sector_bufs[m_read_buf_index ^ 1]);
+  s.value(m_data_buffer_index);
+
+  s.value(m_muted);
+  s.value(m_is_adpcm_muted);
+  s.value(m_filter_file);
+  s.value(m_filter_channel);
+  s.value(m_volume);
+  s.value(m_pending_volume);
+  s.value(m_is_new_xa_stream);
 }
 
-void CdromDrive::step() {
+void CdromDrive::serialize_sector(util::StateStream& s, const u8*& data, buffer& buf) {
+  bool has_sector = data != nullptr;
+  s.value(has_sector);
+  if (!has_sector) {
+    data = nullptr;
+    return;
+  }
+
+  if (s.is_loading()) {
+    s.bytes(buf.data(), SECTOR_SIZE);
+    data = buf.data();
+  } else {
+    s.bytes(const_cast<u8*>(data), SECTOR_SIZE);  // Only read from while saving
+  }
+}
+
+void CdromDrive::update_irq() {
   m_reg_status.transmit_busy = false;
 
   if (!m_irq_fifo.empty()) {
     auto irq_triggered = m_irq_fifo.front() & 0b111;
     auto irq_mask = m_reg_int_enable & 0b111;
 
-    if (irq_triggered & irq_mask)
+    if (irq_triggered & irq_mask) {
       m_interrupts->trigger(cpu::IrqType::CDROM);
+      // The IRQ line stays up until the response is acknowledged
+      m_scheduler->schedule(emulator::EventType::CdromIrq, CDROM_STEP_CYCLES);
+    }
   }
+}
+
+void CdromDrive::schedule_irq() {
+  if (!m_scheduler->is_scheduled(emulator::EventType::CdromIrq))
+    m_scheduler->schedule(emulator::EventType::CdromIrq, CDROM_STEP_CYCLES);
+}
 
+void CdromDrive::read_sector() {
   constexpr std::array<u8, 12> SYNC_MAGIC = { { 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
                                                 0xff, 0xff, 0x00 } };
 
-  if (m_stat_code.reading || m_stat_code.playing) {
-    if (--m_steps_until_read_sect == 0) {
-      m_steps_until_read_sect = READ_SECTOR_DELAY_STEPS;
+  if (!m_stat_code.reading && !m_stat_code.playing)
+    return;
 
-      CdromTrack::DataType sector_type;
-      const auto pos_to_read = CdromPosition::from_lba(m_read_sector);
-      m_read_buf = m_disk.read(pos_to_read, sector_type);
+  CdromTrack::DataType sector_type;
+  const auto pos_to_read = CdromPosition::from_lba(m_read_sector);
+  m_read_sector_data = m_disk.read(pos_to_read, sector_type, m_sector_bufs[m_read_buf_index]);
 
-      m_read_sector++;
+  m_read_sector++;
 
-      if (sector_type == CdromTrack::DataType::Invalid)
-        return;
+  if (sector_type == CdromTrack::DataType::Invalid)
+    return;
 
-      const auto sector_has_data = (sector_type == CdromTrack::DataType::Data);
-      const auto sector_has_audio = (sector_type == CdromTrack::DataType::Audio);
+  const auto sector_has_data = (sector_type == CdromTrack::DataType::Data);
+  const auto sector_has_audio = (sector_type == CdromTrack::DataType::Audio);
 
-      auto sync_match = std::equal(SYNC_MAGIC.begin(), SYNC_MAGIC.end(), m_read_buf.begin());
+  auto sync_match = std::equal(SYNC_MAGIC.begin(), SYNC_MAGIC.end(), m_read_sector_data);
 
-      if (m_stat_code.playing && sector_has_audio) {  // Reading audio
-        if (sync_match)
-          LOG_ERROR_CDROM("Sync data found in Audio sector");
-      } else if (m_stat_code.reading && sector_has_data) {  // Reading data
-        if (!sync_match)
-          LOG_ERROR_CDROM("Sync data mismach in Data sector");
+  if (m_stat_code.playing && sector_has_audio) {  // Reading audio
+    if (sync_match)
+      LOG_ERROR_CDROM("Sync data found in Audio sector");
 
-        // ack more data
-        push_response(SecondInt1, m_stat_code.byte);
-      }
-    }
+    if (!m_muted && !m_cd_audio->push_cdda_sector(m_read_sector_data, m_volume))
+      LOG_WARN_CDROM("CD audio decoder behind, CD-DA sector dropped");
+  } else if (m_stat_code.reading && sector_has_data) {  // Reading data
+    if (!sync_match)
+      LOG_ERROR_CDROM("Sync data mismach in Data sector");
+
+    if (play_xa_sector())
+      return;
+
+    // ack more data
+    push_response(SecondInt1, m_stat_code.byte);
   }
 }
 
+bool CdromDrive::play_xa_sector() {
+  constexpr u8 MODE2 = 2;
+  constexpr u8 SUBMODE_AUDIO = 1 << 2;
+  constexpr u8 SUBMODE_FORM2 = 1 << 5;
+
+  const u8 mode = m_read_sector_data[15];
+  const u8 file = m_read_sector_data[16];
+  const u8 channel = m_read_sector_data[17];
+  const u8 submode = m_read_sector_data[18];
+
+  constexpr u8 XA_AUDIO = SUBMODE_AUDIO | SUBMODE_FORM2;
+  if (!m_mode.xa_adpcm || mode != MODE2 || (submode & XA_AUDIO) != XA_AUDIO)
+    return false;
+
+  // Sectors of the other channels of the interleave are skipped altogether
+  if (m_mode.xa_filter && (file != m_filter_file || channel != m_filter_channel))
+    return true;
+
+  const bool is_new_stream = std::exchange(m_is_new_xa_stream, false);
+  if (m_muted || m_is_adpcm_muted)
+    return true;
+  if (!m_cd_audio->push_xa_sector(m_read_sector_data, m_volume, is_new_stream))
+    LOG_WARN_CDROM("CD audio decoder behind, XA-ADPCM sector dropped");
+  return true;
+}
+
+void CdromDrive::update_read_schedule() {
+  const bool is_reading = m_stat_code.reading || m_stat_code.playing;
+
+  if (!is_reading)
+    m_scheduler->cancel(emulator::EventType::CdromSector);
+  else if (!m_scheduler->is_scheduled(emulator::EventType::CdromSector))
+    m_scheduler->schedule(emulator::EventType::CdromSector,
+                          CDROM_SECTOR_CYCLES / (m_mode.speed ? 2 : 1));
+}
+
+void CdromDrive::start_reading(CdromReadState state) {
+  m_read_sector = m_seek_sector;
+  m_is_new_xa_stream = true;
+
+  m_stat_code.set_state(state);
+}
+
 u8 CdromDrive::read_reg(address addr_rebased) {
   const u8 reg = addr_rebased;
   const u8 reg_index = m_reg_status.index;
@@ -107,7 +229,7 @@ u8 CdromDrive::read_reg(address addr_rebased) {
 }
 
 bool CdromDrive::is_data_buf_empty() {
-  if (m_data_buf.empty())
+  if (m_data_sector_data == nullptr)
     return true;
 
   const auto sector_size = m_mode.sector_size();
@@ -129,25 +251,30 @@ void CdromDrive::write_reg(address addr_rebased, u8 val) {
   } else if (reg == 1 && reg_index == 1) {  // Sound Map Data Out
   } else if (reg == 1 && reg_index == 2) {  // Sound Map Coding Info
   } else if (reg == 1 && reg_index == 3) {  // Audio Volume for Right-CD-Out to Right-SPU-Input
+    m_pending_volume.right_to_right = val;
   } else if (reg == 2 && reg_index == 0) {  // Parameter FIFO
-    Ensures(m_param_fifo.size() < MAX_FIFO_SIZE);
+    Ensures(!m_param_fifo.full());
 
     m_param_fifo.push_back(val);
     m_reg_status.param_fifo_empty = false;
-    m_reg_status.param_fifo_write_ready = (m_param_fifo.size() < MAX_FIFO_SIZE);
+    m_reg_status.param_fifo_write_ready = !m_param_fifo.full();
   } else if (reg == 2 && reg_index == 1) {  // Interrupt Enable Register
     m_reg_int_enable = val;
+    schedule_irq();
   } else if (reg == 2 && reg_index == 2) {  // Audio Volume for Left-CD-Out to Left-SPU-Input
+    m_pending_volume.left_to_left = val;
   } else if (reg == 2 && reg_index == 3) {  // Audio Volume for Right-CD-Out to Left-SPU-Input
+    m_pending_volume.right_to_left = val;
   } else if (reg == 3 && reg_index == 0) {  // Request Register
     if (val & 0x80) {                       // Want data
       if (is_data_buf_empty()) {  // Only update data buffer if everything from it has been read
-        m_data_buf = std::move(m_read_buf);
+        m_read_buf_index ^= 1;
+        m_data_sector_data = std::exchange(m_read_sector_data, nullptr);
         m_data_buffer_index = 0;
         m_reg_status.data_fifo_not_empty = true;
       }
     } else {  // Clear data buffer
-      m_data_buf.clear();
+      m_data_sector_data = nullptr;
       m_data_buffer_index = 0;
       m_reg_status.data_fifo_not_empty = false;
     }
@@ -157,10 +284,16 @@ void CdromDrive::write_reg(address addr_rebased, u8 val) {
       m_reg_status.param_fifo_empty = true;
       m_reg_status.param_fifo_write_ready = true;
     }
-    if (!m_irq_fifo.empty())
+    if (!m_irq_fifo.empty()) {
       m_irq_fifo.pop_front();
+      schedule_irq();  // Next response, if any
+    }
   } else if (reg == 3 && reg_index == 2) {  // Audio Volume for Left-CD-Out to Right-SPU-Input
+    m_pending_volume.left_to_right = val;
   } else if (reg == 3 && reg_index == 3) {  // Audio Volume Apply Changes
+    m_is_adpcm_muted = val & 0x01;
+    if (val & 0x20)
+      m_volume = m_pending_volume;
   } else {
     LOG_ERROR_CDROM("Unknown combination, CDREG{}.{} val: {:02X}", reg, reg_index, val);
   }
@@ -180,7 +313,7 @@ u8 CdromDrive::read_byte() {
 
   u32 data_offset = data_only ? 24 : 12;
 
-  u8 data = m_data_buf[data_offset + m_data_buffer_index];
+  u8 data = m_data_sector_data[data_offset + m_data_buffer_index];
   ++m_data_buffer_index;
 
   if (is_data_buf_empty())
@@ -191,13 +324,32 @@ u8 CdromDrive::read_byte() {
 
 u32 CdromDrive::read_word() {
   u32 data{};
-  data |= read_byte() << 0;
-  data |= read_byte() << 8;
-  data |= read_byte() << 16;
-  data |= read_byte() << 24;
+  read_block(&data, 1);
   return data;
 }
 
+void CdromDrive::read_block(u32* dest, u32 word_count) {
+  u8* bytes = reinterpret_cast<u8*>(dest);
+  const u32 size = word_count * 4;
+  const u32 available = is_data_buf_empty() ? 0 : m_mode.sector_size() - m_data_buffer_index;
+  const u32 copied = std::min(size, available);
+
+  if (copied > 0) {
+    const u32 data_offset = (m_mode.sector_size() == 0x800) ? 24 : 12;
+    std::memcpy(bytes, m_data_sector_data + data_offset + m_data_buffer_index, copied);
+    m_data_buffer_index += copied;
+
+    if (is_data_buf_empty())
+      m_reg_status.data_fifo_not_empty = false;
+  }
+
+  // Like read_byte() past the end of the buffer
+  if (copied < size) {
+    LOG_WARN_CDROM("Tried to read with an empty buffer");
+    std::fill(bytes + copied, bytes + size, 0);
+  }
+}
+
 void CdromDrive::execute_command(u8 cmd) {
   m_irq_fifo.clear();
   m_resp_fifo.clear();
@@ -227,9 +379,9 @@ void CdromDrive::execute_command(u8 cmd) {
     // 0Dh Setfilter  E file,channel    INT3(stat)
     case 0x0D: /* CdlSetfilter */ {
 
-      const auto file    = util::bcd_to_dec(get_param());
-      const auto channel = util::bcd_to_dec(get_param());
-      push_response(FirstInt3, { m_stat_code.byte, util::dec_to_bcd(file), util::dec_to_bcd(channel) });
+      m_filter_file = get_param();
+      m_filter_channel = get_param();
+      push_response_stat(FirstInt3);
       break;
     }
 
@@ -247,16 +399,12 @@ void CdromDrive::execute_command(u8 cmd) {
     */
     case 0x11 /*GetlocP*/: case 0x03: // Play
       Expects(m_param_fifo.empty());  // we don't handle the parameter
-      m_read_sector = m_seek_sector;
-
-      m_stat_code.set_state(CdromReadState::Playing);
+      start_reading(CdromReadState::Playing);
 
       push_response_stat(FirstInt3);
       break;
     case 0x06:  // ReadN
-      m_read_sector = m_seek_sector;
-
-      m_stat_code.set_state(CdromReadState::Reading);
+      start_reading(CdromReadState::Reading);
 
       push_response_stat(FirstInt3);
       break;
@@ -299,8 +447,8 @@ void CdromDrive::execute_command(u8 cmd) {
 
       push_response_stat(FirstInt3);
       break;
-    case 0x0F:                                                     // Getparam
-      push_response(FirstInt3, { m_stat_code.byte, 0x00, 0x00 });  // TODO: last arg is the filter
+    case 0x0F:  // Getparam
+      push_response(FirstInt3, { m_stat_code.byte, m_mode.byte, 0x00, m_filter_file, m_filter_channel });
       break;
     case 0x13: {                                  // GetTN
       const auto index = util::dec_to_bcd(0x01);  // TODO
@@ -367,9 +515,7 @@ void CdromDrive::execute_command(u8 cmd) {
       break;
     }
     case 0x1B:  // ReadS
-      m_read_sector = m_seek_sector;
-
-      m_stat_code.set_state(CdromReadState::Reading);
+      start_reading(CdromReadState::Reading);
 
       push_response_stat(FirstInt3);
       break;
@@ -419,6 +565,9 @@ void CdromDrive::execute_command(u8 cmd) {
   m_reg_status.param_fifo_empty = true;
   m_reg_status.param_fifo_write_ready = true;
   m_reg_status.adpcm_fifo_empty = false;
+
+  schedule_irq();  // Also clears the busy flag
+  update_read_schedule();
 }
 
 void CdromDrive::command_error() {
@@ -439,11 +588,15 @@ u8 CdromDrive::get_param() {
 
 void CdromDrive::push_response(CdromResponseType type, std::initializer_list<u8> bytes) {
   // First we write the type (INT value) in the Interrupt FIFO
-  m_irq_fifo.push_back(type);
+  if (!m_irq_fifo.full())
+    m_irq_fifo.push_back(type);
+  else
+    LOG_WARN_CDROM("CDROM interrupt INT{} lost, FIFO was full", static_cast<u8>(type));
+  schedule_irq();
 
   // Then we write the response's data (args) to the Response FIFO
   for (auto response_byte : bytes) {
-    if (m_resp_fifo.size() < MAX_FIFO_SIZE) {
+    if (!m_resp_fifo.full()) {
       m_resp_fifo.push_back(response_byte);
       m_reg_status.response_fifo_not_empty = true;
     } else
@@ -1,20 +1,33 @@
 #pragma once
 
 #include <io/cdrom_disk.hpp>
+#include <spu/cd_audio.hpp>
+#include <util/fixed_ring.hpp>
 #include <util/fs.hpp>
 #include <util/types.hpp>
 
-#include <deque>
+#include <array>
 #include <initializer_list>
 
 namespace cpu {
 class Interrupts;
 }
 
+namespace emulator {
+class Scheduler;
+}
+
+namespace util {
+class StateStream;
+}
+
 namespace io {
 
-constexpr auto READ_SECTOR_DELAY_STEPS = 1150;  // IRQ delay in CD-ROM steps (each one is 100 CPU cycles)
+constexpr u32 CDROM_STEP_CYCLES = 300;  // CD-ROM step length in system cycles
+// 75 sectors per second at normal speed, the rate CD-DA and XA-ADPCM sectors are played at
+constexpr u32 CDROM_SECTOR_CYCLES = 33868800 / 75;
 constexpr size_t MAX_FIFO_SIZE = 16;
+constexpr size_t SECTOR_BUFFER_COUNT = 2;  // The one being read from the disk, the one of the data FIFO
 
 enum CdromResponseType : u8 {
   NoneInt0 = 0,     // INT0: No response received (no interrupt request)
@@ -101,22 +114,36 @@ union CdromStatusCode {
 
 class CdromDrive {
  public:
-  void init(cpu::Interrupts* interrupts);
+  void init(cpu::Interrupts* interrupts, emulator::Scheduler* scheduler, spu::CdAudio* cd_audio);
   void insert_disk_file(const fs::path& file_path);
-  void step();
+  // The PS-X EXE the BIOS would boot the disk with, see io/iso9660.hpp
+  bool read_boot_exe(buffer& out_exe);
   u8 read_reg(address addr_rebased);
   void write_reg(address addr_rebased, u8 val);
   u8 read_byte();
   u32 read_word();
+  // word_count words as read_word() reads them, copying the sector data as a whole
+  void read_block(u32* dest, u32 word_count);
+  // Registers, FIFOs and the position, for the disk inserted when the state was saved
+  void serialize(util::StateStream& s);
 
  private:
   void execute_command(u8 cmd);
+  void update_irq();    // (Re)asserts the IRQ while a response is pending, called by the CdromIrq event
+  void schedule_irq();  // Makes sure a CdromIrq event is coming
+  void read_sector();
+  // True if the sector is XA-ADPCM for the SPU rather than data for the CPU
+  bool play_xa_sector();
+  void update_read_schedule();  // Starts or stops the CdromSector event depending on the read state
+  void start_reading(CdromReadState state);
   void push_response(CdromResponseType type, std::initializer_list<u8> bytes);
   void push_response(CdromResponseType type, u8 byte);
   void push_response_stat(CdromResponseType type);
   void command_error();
   u8 get_param();
   bool is_data_buf_empty();
+  // A sector as data, copied to buf on load
+  static void serialize_sector(util::StateStream& s, const u8*& data, buffer& buf);
 
   static const char* get_reg_name(u8 reg, u8 index, bool is_read);
   static const char* get_cmd_name(u8 cmd);
@@ -131,20 +158,31 @@ class CdromDrive {
   u32 m_seek_sector{};
   u32 m_read_sector{};
 
-  std::deque<u8> m_param_fifo{};
-  std::deque<CdromResponseType> m_irq_fifo{};
-  std::deque<u8> m_resp_fifo{};
+  util::FixedRing<u8, MAX_FIFO_SIZE> m_param_fifo{};
+  util::FixedRing<CdromResponseType, MAX_FIFO_SIZE> m_irq_fifo{};
+  util::FixedRing<u8, MAX_FIFO_SIZE> m_resp_fifo{};
 
   u8 m_reg_int_enable{};
-  u32 m_steps_until_read_sect{ READ_SECTOR_DELAY_STEPS };
 
-  buffer m_read_buf{};
-  buffer m_data_buf{};
+  // Sectors point into the disk image, or into their buffer of the pool when it isn't memory mapped.
+  // The buffers are allocated once and swap roles when the data FIFO takes the sector that was read.
+  const u8* m_read_sector_data{};
+  const u8* m_data_sector_data{};
+  std::array<buffer, SECTOR_BUFFER_COUNT> m_sector_bufs{ { buffer(SECTOR_SIZE), buffer(SECTOR_SIZE) } };
+  u8 m_read_buf_index{};  // Of m_sector_bufs, the data FIFO has the other one
   u32 m_data_buffer_index{};
 
   bool m_muted{ false };
+  bool m_is_adpcm_muted{};
+  u8 m_filter_file{};
+  u8 m_filter_channel{};
+  spu::CdVolume m_volume{};
+  spu::CdVolume m_pending_volume{};  // Applied by the Audio Volume Apply Changes register
+  bool m_is_new_xa_stream{};
 
   cpu::Interrupts* m_interrupts{};
+  emulator::Scheduler* m_scheduler{};
+  spu::CdAudio* m_cd_audio{};
 };
 
 }  // namespace io
@@ -0,0 +1,138 @@
+#include <io/cdrom_prefetcher.hpp>
+
+#include <io/cdrom_disk.hpp>
+
+#include <algorithm>
+
+namespace io {
+
+namespace {
+
+constexpr size_t MAPPING_PAGE_SIZE = 4096;
+
+}  // namespace
+
+CdromPrefetcher::CdromPrefetcher() : m_sector_buf(SECTOR_SIZE), m_thread(&CdromPrefetcher::run, this) {
+  for (auto& cached : m_cache)
+    cached.data.resize(SECTOR_SIZE);
+}
+
+CdromPrefetcher::~CdromPrefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+}
+
+bool CdromPrefetcher::read(const CdromTrack& track, u32 sector, buffer& dest) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  CachedSector* cached = find(&track, sector);
+  if (!cached)
+    return false;
+
+  cached->last_used = ++m_use_count;
+  dest.assign(cached->data.begin(), cached->data.end());
+  return true;
+}
+
+void CdromPrefetcher::prefetch(const CdromTrack& track, u32 sector) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // Sequential reads carry on from where the worker is, instead of going over the same sectors again
+    const bool is_sequential =
+        m_request.track == &track && m_request.next >= sector && m_request.next <= m_request.end;
+    if (m_request.track != &track) {
+      m_request.track = &track;
+      m_request.file_path = track.filepath;
+      m_request.mapped_data = track.mapping.data();
+      m_request.mapped_size = track.mapping.size();
+    }
+    if (!is_sequential)
+      m_request.next = sector;
+    m_request.end = std::min(sector + CDROM_PREFETCH_SECTOR_COUNT, track.offset + track.frame_count);
+  }
+  m_wake.notify_one();
+}
+
+void CdromPrefetcher::clear() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_request = {};
+  ++m_generation;
+  for (auto& cached : m_cache)
+    cached.last_used = 0;
+  m_fetched.wait(lock, [this]() { return !m_is_fetching; });
+}
+
+void CdromPrefetcher::run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  while (true) {
+    m_wake.wait(lock, [this]() { return m_quit || m_request.next < m_request.end; });
+    if (m_quit)
+      return;
+
+    const u32 sector = m_request.next++;
+    if (find(m_request.track, sector))
+      continue;
+
+    const Request request = m_request;
+    const u32 generation = m_generation;
+    m_is_fetching = true;
+    lock.unlock();
+
+    const bool is_fetched = fetch(request, sector);
+
+    lock.lock();
+    m_is_fetching = false;
+    m_fetched.notify_all();
+    if (is_fetched && generation == m_generation && !request.mapped_data)
+      insert(request.track, sector);
+  }
+}
+
+bool CdromPrefetcher::fetch(const Request& request, u32 sector) {
+  const size_t offset = (size_t)sector * SECTOR_SIZE;
+
+  if (request.mapped_data) {
+    if (offset + SECTOR_SIZE > request.mapped_size)
+      return false;
+
+    // Faults the pages in, a sector spans at most 2 of them
+    volatile u8 sink = 0;
+    for (size_t page = offset / MAPPING_PAGE_SIZE; page <= (offset + SECTOR_SIZE - 1) / MAPPING_PAGE_SIZE; ++page)
+      sink = sink + request.mapped_data[page * MAPPING_PAGE_SIZE];
+    return true;
+  }
+
+  if (m_file_path != request.file_path) {
+    m_file.close();
+    m_file.open(request.file_path, std::ios::binary | std::ios::in);
+    m_file_path = request.file_path;
+  }
+  m_file.clear();
+  m_file.seekg(offset);
+  return (bool)m_file.read((char*)m_sector_buf.data(), SECTOR_SIZE);
+}
+
+CdromPrefetcher::CachedSector* CdromPrefetcher::find(const CdromTrack* track, u32 sector) {
+  for (auto& cached : m_cache) {
+    if (cached.last_used != 0 && cached.track == track && cached.sector == sector)
+      return &cached;
+  }
+  return nullptr;
+}
+
+void CdromPrefetcher::insert(const CdromTrack* track, u32 sector) {
+  // Unused slots come first, as they were last used at 0
+  auto& lru = *std::min_element(m_cache.begin(), m_cache.end(), [](const auto& a, const auto& b) {
+    return a.last_used < b.last_used;
+  });
+  lru.track = track;
+  lru.sector = sector;
+  lru.last_used = ++m_use_count;
+  std::copy(m_sector_buf.begin(), m_sector_buf.end(), lru.data.begin());
+}
+
+}  // namespace io
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace io {
+
+struct CdromTrack;
+
+// Sectors read ahead of the last one read, 0.2s at double speed
+constexpr u32 CDROM_PREFETCH_SECTOR_COUNT = 32;
+// Of the sector cache, the sectors read ahead plus a few the game may seek back to
+constexpr u32 CDROM_CACHE_SECTOR_COUNT = 64;
+
+// Reads the sectors following the last one read on a thread of its own, so that emulation doesn't wait
+// on the storage of the image (network shares, spinning drives). Mapped images only get their pages
+// touched, the OS keeps them in its page cache. The others are read into a small LRU cache of sectors.
+class CdromPrefetcher {
+ public:
+  CdromPrefetcher();
+  ~CdromPrefetcher();
+
+  // Copies the sector from the cache into dest, false if it isn't cached. sector is in the track file.
+  bool read(const CdromTrack& track, u32 sector, buffer& dest);
+  // Has the sectors from sector on read in the background, replacing the previous request
+  void prefetch(const CdromTrack& track, u32 sector);
+  // Drops the cache and waits for the background read in progress, for the tracks to be replaced
+  void clear();
+
+ private:
+  struct CachedSector {
+    const CdromTrack* track{};
+    u32 sector{};
+    u64 last_used{};  // LRU order, 0 for unused slots
+    buffer data;
+  };
+
+  // What the worker reads from, copied from the track as it may be replaced in the meantime
+  struct Request {
+    const CdromTrack* track{};
+    std::string file_path;
+    const u8* mapped_data{};
+    size_t mapped_size{};
+    u32 next{};
+    u32 end{};
+  };
+
+  void run();
+  // On the worker thread, without the lock. False if the sector couldn't be read.
+  bool fetch(const Request& request, u32 sector);
+  CachedSector* find(const CdromTrack* track, u32 sector);
+  void insert(const CdromTrack* track, u32 sector);
+
+  std::array<CachedSector, CDROM_CACHE_SECTOR_COUNT> m_cache{};
+  u64 m_use_count{};
+
+  Request m_request;
+  u32 m_generation{};  // Bumped by clear(), results of older requests are dropped
+  bool m_is_fetching{};
+  bool m_quit{};
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_fetched;
+
+  // Worker only: files that aren't mapped are read through a stream of their own
+  std::ifstream m_file;
+  std::string m_file_path;
+  buffer m_sector_buf;
+
+  std::thread m_thread;  // Last, it starts running as soon as it's constructed
+};
+
+}  // namespace io
@@ -50,6 +50,7 @@ void DigitalController::update_button(u8 button_index, bool was_pressed) {
     std::bitset<16> buttons = m_buttons.word;
     buttons.set(button_index, false);
     m_buttons.word = (u16)buttons.to_ulong();
+    m_buttons_down_mask.word &= ~(1 << button_index);  // Pressed again before the release was read
   } else {
     m_buttons_down_mask.word |= 1 << button_index;
   }
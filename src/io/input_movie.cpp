@@ -0,0 +1,60 @@
+#include <io/input_movie.hpp>
+
+#include <util/log.hpp>
+
+#include <fstream>
+
+namespace io {
+
+namespace {
+
+constexpr u32 MOVIE_MAGIC = 0x4D544350;  // "PCTM"
+
+}  // namespace
+
+bool InputMovie::save(const fs::path& path) const {
+  std::ofstream file(path, std::ios::binary);
+  if (!file) {
+    LOG_ERROR("Could not create input movie {}", path.string());
+    return false;
+  }
+
+  const InputMovieHeader header{ MOVIE_MAGIC, INPUT_MOVIE_VERSION, (u32)m_frames.size(), 0 };
+  file.write((const char*)&header, sizeof(header));
+  file.write((const char*)m_frames.data(), m_frames.size() * sizeof(InputFrame));
+  if (!file) {
+    LOG_ERROR("Could not write input movie {}", path.string());
+    return false;
+  }
+
+  LOG_INFO("Wrote {} frames of input to {}", m_frames.size(), path.string());
+  return true;
+}
+
+bool InputMovie::load(const fs::path& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    LOG_ERROR("Could not open input movie {}", path.string());
+    return false;
+  }
+
+  InputMovieHeader header{};
+  file.read((char*)&header, sizeof(header));
+  if (!file || header.magic != MOVIE_MAGIC || header.version != INPUT_MOVIE_VERSION) {
+    LOG_ERROR("{} is not an input movie of version {}", path.string(), INPUT_MOVIE_VERSION);
+    return false;
+  }
+
+  std::vector<InputFrame> frames(header.frame_count);
+  file.read((char*)frames.data(), frames.size() * sizeof(InputFrame));
+  if (!file) {
+    LOG_ERROR("Input movie {} is truncated", path.string());
+    return false;
+  }
+
+  m_frames = std::move(frames);
+  LOG_INFO("Loaded {} frames of input from {}", m_frames.size(), path.string());
+  return true;
+}
+
+}  // namespace io
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <util/fs.hpp>
+#include <util/types.hpp>
+
+#include <vector>
+
+namespace io {
+
+// Bumped with any change to the layout of movie files
+constexpr u32 INPUT_MOVIE_VERSION = 2;
+
+// Joypad input applied before an emulated frame, one bit per button index (see io/joypad.hpp): the state
+// of the buttons as the frame starts, and the presses that a release in the same frame would hide
+// otherwise. A replay applies the same two masks, so it's exact whatever the order of the events was.
+struct InputFrame {
+  u16 held;
+  u16 pressed;  // At some point since the last frame, whether held or released again since
+};
+static_assert(sizeof(InputFrame) == 4);
+
+// File layout, in host order: this header, then frame_count InputFrames
+struct InputMovieHeader {
+  u32 magic;
+  u32 version;
+  u32 frame_count;
+  u32 reserved;
+};
+static_assert(sizeof(InputMovieHeader) == 16);
+
+// The joypad input of a run, frame by frame. Replayed from the same state as it was recorded in, power
+// on usually, a movie takes the guest down the same path on every run and every build.
+class InputMovie {
+ public:
+  void record(const InputFrame& frame) { m_frames.push_back(frame); }
+  void clear() { m_frames.clear(); }
+
+  size_t frame_count() const { return m_frames.size(); }
+  const InputFrame& frame(size_t index) const { return m_frames[index]; }
+
+  bool save(const fs::path& path) const;
+  // Leaves the movie as it was if path doesn't hold one
+  bool load(const fs::path& path);
+
+ private:
+  std::vector<InputFrame> m_frames;
+};
+
+}  // namespace io
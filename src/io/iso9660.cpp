@@ -0,0 +1,163 @@
+#include <io/iso9660.hpp>
+
+#include <io/cdrom_disk.hpp>
+#include <util/log.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <sstream>
+#include <string_view>
+
+namespace io {
+
+namespace {
+
+// Offsets in a directory record
+constexpr u32 DIR_RECORD_LENGTH = 0;
+constexpr u32 DIR_RECORD_EXTENT = 2;  // Little endian half of the both-endian field
+constexpr u32 DIR_RECORD_SIZE = 10;
+constexpr u32 DIR_RECORD_FLAGS = 25;
+constexpr u32 DIR_RECORD_NAME_LENGTH = 32;
+constexpr u32 DIR_RECORD_NAME = 33;
+constexpr u8 DIR_FLAG_DIRECTORY = 1 << 1;
+
+// Of the root directory record in the primary volume descriptor
+constexpr u32 PVD_ROOT_RECORD = 156;
+
+struct IsoEntry {
+  u32 extent;  // Logical sector
+  u32 size;
+  bool is_directory;
+};
+
+u32 read_u32(const u8* data) {
+  u32 value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+// Copies the user data of the logical sector, false if it isn't a data sector
+bool read_sector(CdromDisk& disk, u32 lba, u8* dest) {
+  CdromTrack::DataType type;
+  buffer fallback;
+  const u8* sector = disk.read(CdromPosition::from_lba(lba + PREGAP_FRAME_COUNT), type, fallback);
+  if (sector == nullptr || type != CdromTrack::DataType::Data)
+    return false;
+
+  // Past the sync pattern and header, and the subheader for Mode 2
+  const u8 mode = sector[15];
+  std::copy_n(sector + (mode == 2 ? 24 : 16), ISO_SECTOR_SIZE, dest);
+  return true;
+}
+
+bool read_extent(CdromDisk& disk, const IsoEntry& entry, buffer& out_data) {
+  out_data.resize((entry.size + ISO_SECTOR_SIZE - 1) / ISO_SECTOR_SIZE * ISO_SECTOR_SIZE);
+  for (u32 i = 0; i * ISO_SECTOR_SIZE < entry.size; ++i)
+    if (!read_sector(disk, entry.extent + i, out_data.data() + i * ISO_SECTOR_SIZE))
+      return false;
+  out_data.resize(entry.size);
+  return true;
+}
+
+// "SLUS_005.94;1" and "slus_005.94" are the same file
+bool is_same_name(std::string_view record_name, std::string_view name) {
+  const auto strip_version = [](std::string_view str) { return str.substr(0, str.find(';')); };
+  record_name = strip_version(record_name);
+  name = strip_version(name);
+  return record_name.size() == name.size() &&
+         std::equal(record_name.begin(), record_name.end(), name.begin(), [](char a, char b) {
+           return std::toupper((unsigned char)a) == std::toupper((unsigned char)b);
+         });
+}
+
+bool find_in_directory(CdromDisk& disk, const IsoEntry& directory, std::string_view name,
+                       IsoEntry& out_entry) {
+  buffer records;
+  if (!read_extent(disk, directory, records))
+    return false;
+
+  // Records never cross a sector, the rest of a sector is zeroes past its last record
+  for (u32 offset = 0; offset < records.size();) {
+    const u8* record = records.data() + offset;
+    const u8 length = record[DIR_RECORD_LENGTH];
+    if (length == 0) {
+      offset = (offset / ISO_SECTOR_SIZE + 1) * ISO_SECTOR_SIZE;
+      continue;
+    }
+    if (offset + length > records.size() || DIR_RECORD_NAME + record[DIR_RECORD_NAME_LENGTH] > length)
+      return false;
+
+    const std::string_view record_name((const char*)record + DIR_RECORD_NAME,
+                                       record[DIR_RECORD_NAME_LENGTH]);
+    if (is_same_name(record_name, name)) {
+      out_entry = { read_u32(record + DIR_RECORD_EXTENT), read_u32(record + DIR_RECORD_SIZE),
+                    (record[DIR_RECORD_FLAGS] & DIR_FLAG_DIRECTORY) != 0 };
+      return true;
+    }
+    offset += length;
+  }
+  return false;
+}
+
+}  // namespace
+
+bool read_iso_file(CdromDisk& disk, const std::string& path, buffer& out_data) {
+  u8 descriptor[ISO_SECTOR_SIZE];
+  if (!read_sector(disk, ISO_VOLUME_DESCRIPTOR_SECTOR, descriptor) || descriptor[0] != 1 ||
+      std::memcmp(descriptor + 1, "CD001", 5) != 0) {
+    LOG_WARN_CDROM("No ISO9660 filesystem on the disk");
+    return false;
+  }
+
+  const u8* root = descriptor + PVD_ROOT_RECORD;
+  IsoEntry entry{ read_u32(root + DIR_RECORD_EXTENT), read_u32(root + DIR_RECORD_SIZE), true };
+
+  for (size_t start = 0; start < path.size();) {
+    const size_t end = std::min(path.find_first_of("\\/", start), path.size());
+    const std::string_view name = std::string_view(path).substr(start, end - start);
+    start = end + 1;
+    if (name.empty())
+      continue;
+
+    if (!entry.is_directory || !find_in_directory(disk, entry, name, entry)) {
+      LOG_WARN_CDROM("No {} on the disk", path);
+      return false;
+    }
+  }
+
+  if (entry.is_directory || entry.size > ISO_MAX_FILE_SIZE) {
+    LOG_WARN_CDROM("{} on the disk isn't a file that can be read", path);
+    return false;
+  }
+  return read_extent(disk, entry, out_data);
+}
+
+bool read_boot_exe(CdromDisk& disk, buffer& out_exe) {
+  std::string boot_path = "PSX.EXE;1";
+
+  // BOOT = cdrom:\SLUS_005.94;1
+  buffer config;
+  if (read_iso_file(disk, "SYSTEM.CNF;1", config)) {
+    std::istringstream lines(std::string(config.begin(), config.end()));
+    std::string line;
+    while (std::getline(lines, line)) {
+      const size_t equals = line.find('=');
+      if (equals == std::string::npos || line.compare(0, 4, "BOOT") != 0)
+        continue;
+
+      std::string value = line.substr(equals + 1);
+      value.erase(0, value.find_first_not_of(" \t"));
+      value.erase(value.find_last_not_of(" \t\r") + 1);
+      if (value.compare(0, 6, "cdrom:") == 0)
+        value.erase(0, 6);
+      boot_path = value;
+      break;
+    }
+  }
+
+  LOG_INFO("Boot executable of the disk is {}", boot_path);
+  return read_iso_file(disk, boot_path, out_exe);
+}
+
+}  // namespace io
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <string>
+
+namespace io {
+
+class CdromDisk;
+
+constexpr u32 ISO_SECTOR_SIZE = 2048;             // User data of a Mode 1 or Mode 2 Form 1 sector
+constexpr u32 ISO_VOLUME_DESCRIPTOR_SECTOR = 16;  // Logical sector of the primary volume descriptor
+constexpr u32 ISO_MAX_FILE_SIZE = 16 * 1024 * 1024;  // Anything bigger can't be an executable or config
+
+// Reads the file at path, e.g. "\SYSTEM.CNF;1", off the ISO9660 filesystem of the disk. Names are
+// matched without case nor version, directories are split by '\' or '/'.
+bool read_iso_file(CdromDisk& disk, const std::string& path, buffer& out_data);
+
+// The PS-X EXE the BIOS would boot from the disk: the one BOOT names in SYSTEM.CNF, PSX.EXE on discs
+// that have none
+bool read_boot_exe(CdromDisk& disk, buffer& out_exe);
+
+}  // namespace io
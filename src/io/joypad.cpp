@@ -1,12 +1,33 @@
 #include <io/joypad.hpp>
 
 #include <cpu/interrupt.hpp>
+#include <emulator/scheduler.hpp>
 #include <util/log.hpp>
+#include <util/state_stream.hpp>
 
 namespace io {
 
-void Joypad::init(cpu::Interrupts* interrupts) {
+void Joypad::init(cpu::Interrupts* interrupts, emulator::Scheduler* scheduler) {
   m_interrupts = interrupts;
+  m_scheduler = scheduler;
+
+  m_scheduler->set_callback(emulator::EventType::JoypadAck, [this]() { update_irq(); });
+}
+
+void Joypad::serialize(util::StateStream& s) {
+  s.section("JOY ");
+  s.value(m_reg_mode);
+  s.value(m_reg_ctrl);
+  s.value(m_reg_baud);
+  s.value(m_rx_has_data);
+  s.value(m_rx_data);
+  s.value(m_irq);
+  s.value(m_ack_irq_pending);
+  s.value(m_ack);
+  s.value(m_device_selected);
+  s.value(m_digital_controllers);
+  for (auto& card : m_memory_cards)
+    card.serialize(s);
 }
 
 u8 Joypad::read8(address addr_rebased) {
@@ -70,28 +91,53 @@ void Joypad::write8(address addr_rebased, u8 val) {
         m_device_selected = Device::None;
         for (auto c : m_digital_controllers)
           c.reset();
+        for (auto& card : m_memory_cards)
+          card.deselect();
       }
     }
   } else if (JOY_BAUD.contains(addr_rebased, reg_byte))
     *((u8*)&m_reg_baud + reg_byte) = val;
 }
 
-void Joypad::step() {
-  if (m_irq_timer > 0) {
-    m_irq_timer--;
-    if (m_irq_timer == 0) {
-      m_irq = true;  // trigger IRQ
-      m_ack = false;
-    }
+void Joypad::update_irq() {
+  if (m_ack_irq_pending) {
+    m_ack_irq_pending = false;
+    m_irq = true;  // trigger IRQ
+    m_ack = false;
   }
 
-  if (m_irq)
+  if (m_irq) {
     m_interrupts->trigger(cpu::IrqType::CONTROLLER);
+    m_scheduler->schedule(emulator::EventType::JoypadAck, JOYPAD_IRQ_REPEAT);
+  }
 }
 
 void Joypad::update_button(u8 button_index, bool was_pressed) {
+  if (was_pressed) {
+    m_pending_input.held |= 1 << button_index;
+    m_pending_input.pressed |= 1 << button_index;
+  } else {
+    m_pending_input.held &= ~(1 << button_index);
+  }
+}
+
+InputFrame Joypad::take_input() {
+  const InputFrame input = m_pending_input;
+  m_pending_input.pressed = 0;
+  return input;
+}
+
+void Joypad::apply_input(const InputFrame& input) {
   // TODO: Player 2 support
-  m_digital_controllers[0].update_button(button_index, was_pressed);
+  for (u8 button_index = 0; button_index < 16; ++button_index) {
+    const bool is_held = input.held & (1 << button_index);
+    // A button pressed and released within the frame still reads as pressed once (see
+    // DigitalController::read())
+    if (is_held || (input.pressed & (1 << button_index)))
+      m_digital_controllers[0].update_button(button_index, true);
+    if (!is_held)
+      m_digital_controllers[0].update_button(button_index, false);
+  }
 }
 
 const char* Joypad::addr_to_reg_name(address addr_rebased) {
@@ -129,17 +175,24 @@ void Joypad::do_tx_transfer(u8 val) {
   if (m_device_selected == Device::Controller) {
     m_rx_data = m_digital_controllers[port].read(val);
     m_ack = m_digital_controllers[port].ack();
-    if (m_ack)
-      m_irq_timer = 5;
+    if (m_ack) {
+      m_ack_irq_pending = true;
+      m_scheduler->schedule(emulator::EventType::JoypadAck, JOYPAD_ACK_IRQ_DELAY);
+    }
     if (m_digital_controllers[port].m_read_idx == 0)
       m_device_selected = Device::None;
   }
 
   if (m_device_selected == Device::MemoryCard) {
-    LOG_WARN_JOYPAD("Requested read from Memory Card, unimplemented");
-    m_device_selected = Device::None;
-    m_rx_data = 0xFF;
-    m_ack = true;
+    // No card answers with Hi-Z and no ACK
+    m_rx_data = m_memory_cards[port].transfer(val);
+    m_ack = m_memory_cards[port].ack();
+    if (m_ack) {
+      m_ack_irq_pending = true;
+      m_scheduler->schedule(emulator::EventType::JoypadAck, JOYPAD_ACK_IRQ_DELAY);
+    }
+    if (!m_memory_cards[port].is_selected())
+      m_device_selected = Device::None;
   }
 }
 
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <io/digital_controller.hpp>
+#include <io/input_movie.hpp>
+#include <io/memory_card.hpp>
+#include <util/fs.hpp>
 #include <util/types.hpp>
 
 #include <memory/range.hpp>
@@ -9,8 +12,19 @@ namespace cpu {
 class Interrupts;
 }
 
+namespace emulator {
+class Scheduler;
+}
+
+namespace util {
+class StateStream;
+}
+
 namespace io {
 
+constexpr u32 JOYPAD_ACK_IRQ_DELAY = 1500;  // In system cycles
+constexpr u32 JOYPAD_IRQ_REPEAT = 300;      // IRQ is re-asserted at this interval until acknowledged
+
 // Addresses are off-set from Joypad base (0x1F801040)
 static constexpr memory::Range JOY_DATA{ 0x0, 4 };
 static constexpr memory::Range JOY_STAT{ 0x4, 4 };
@@ -38,17 +52,25 @@ static constexpr u8 BTN_SQUARE = 15;
 
 class Joypad {
  public:
-  void init(cpu::Interrupts* interrupts);
+  void init(cpu::Interrupts* interrupts, emulator::Scheduler* scheduler);
   u8 read8(address addr_rebased);
   void write8(address addr_rebased, u8 val);
 
-  void step();
+  // Takes effect when the next frame starts, for the input of each frame to be recorded and replayed
+  // (see Emulator::advance_frame())
   void update_button(u8 button_index, bool was_pressed);
+  // The buttons held after what update_button() was given, and the ones it pressed since the last call
+  InputFrame take_input();
+  void apply_input(const InputFrame& input);
+  // slot is 0 or 1, see MemoryCard::insert()
+  bool insert_memory_card(u32 slot, const fs::path& path) { return m_memory_cards[slot].insert(path); }
+  void serialize(util::StateStream& s);  // Along with the buttons held
 
   static const char* addr_to_reg_name(address addr_rebased);
 
  private:
   void do_tx_transfer(u8 val);
+  void update_irq();  // Called by the JoypadAck event
 
  private:
   enum class Device {
@@ -65,14 +87,17 @@ class Joypad {
   u8 m_rx_data{};
 
   bool m_irq{};
-  u8 m_irq_timer{};
+  bool m_ack_irq_pending{};  // The controller ACKed, the IRQ is raised after JOYPAD_ACK_IRQ_DELAY
   bool m_ack{};
 
   Device m_device_selected{ Device::None };
 
   DigitalController m_digital_controllers[2];
+  MemoryCard m_memory_cards[2];
+  InputFrame m_pending_input{};  // Of the host, held buttons carry over from one frame to the next
 
   cpu::Interrupts* m_interrupts;
+  emulator::Scheduler* m_scheduler{};
 };
 
 }  // namespace io
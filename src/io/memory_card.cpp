@@ -0,0 +1,326 @@
+#include <io/memory_card.hpp>
+
+#include <util/log.hpp>
+#include <util/state_stream.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <system_error>
+
+namespace io {
+
+namespace {
+
+// Frames of the filesystem, as the BIOS formats a card
+constexpr u32 HEADER_FRAME = 0;
+constexpr u32 FIRST_DIRECTORY_FRAME = 1;
+constexpr u32 FIRST_BROKEN_FRAME_LIST_FRAME = 16;
+constexpr u32 WRITE_TEST_FRAME = 63;
+constexpr u32 DIRECTORY_FRAME_COUNT = 15;
+constexpr u32 BROKEN_FRAME_LIST_COUNT = 20;
+
+constexpr u8 MEMORY_CARD_ID1 = 0x5A;
+constexpr u8 MEMORY_CARD_ID2 = 0x5D;
+constexpr u8 COMMAND_ACK1 = 0x5C;
+constexpr u8 COMMAND_ACK2 = 0x5D;
+constexpr u8 END_GOOD = 0x47;
+constexpr u8 END_BAD_CHECKSUM = 0x4E;
+constexpr u8 END_BAD_FRAME = 0xFF;
+
+constexpr u8 FLAG_ERROR = 1 << 2;
+constexpr u8 FLAG_FRESH = 1 << 3;
+
+// Every frame of the filesystem ends with the XOR of its other bytes
+void set_frame_checksum(u8* frame) {
+  u8 checksum = 0;
+  for (u32 i = 0; i < MEMORY_CARD_FRAME_SIZE - 1; ++i)
+    checksum ^= frame[i];
+  frame[MEMORY_CARD_FRAME_SIZE - 1] = checksum;
+}
+
+}  // namespace
+
+MemoryCard::~MemoryCard() {
+  eject();
+}
+
+bool MemoryCard::insert(const fs::path& path) {
+  eject();
+
+  if (fs::exists(path)) {
+    std::ifstream file(path, std::ios::binary);
+    file.read((char*)m_data.data(), m_data.size());
+    if (!file || file.peek() != std::ifstream::traits_type::eof()) {
+      LOG_ERROR("{} is not a memory card image of {} bytes", path.string(), MEMORY_CARD_SIZE);
+      return false;
+    }
+    LOG_INFO("Inserted memory card {}", path.string());
+  } else {
+    format();
+    LOG_INFO("Inserted new memory card {}, written on the first save", path.string());
+  }
+
+  m_path = path;
+  m_file_image = m_data;
+  m_dirty.reset();
+  m_is_ejecting = false;
+  m_flag = FLAG_FRESH;
+  deselect();
+  m_writer = std::thread(&MemoryCard::run_writer, this);
+  return true;
+}
+
+void MemoryCard::eject() {
+  if (!is_inserted())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_is_ejecting = true;
+  }
+  m_written.notify_one();
+  m_writer.join();
+  deselect();
+}
+
+void MemoryCard::deselect() {
+  m_state = State::Idle;
+  m_step = 0;
+  m_ack = false;
+}
+
+u8 MemoryCard::transfer(u8 val) {
+  u8 reply = 0xFF;
+  m_ack = false;
+
+  switch (m_state) {
+    case State::Idle:
+      // 81h selects the card, the reply is Hi-Z
+      if (val == 0x81 && is_inserted()) {
+        m_state = State::Command;
+        m_ack = true;
+      }
+      break;
+    case State::Command:
+      m_step = 0;
+      m_ack = true;
+      switch (val) {
+        case 'R': m_state = State::Read; break;
+        case 'W': m_state = State::Write; break;
+        case 'S': m_state = State::GetId; break;
+        default:
+          LOG_WARN_JOYPAD("Unknown memory card command {:02X}", val);
+          m_state = State::Idle;
+          m_ack = false;
+          return 0xFF;
+      }
+      reply = m_flag;
+      break;
+    case State::Read: reply = transfer_read(val); break;
+    case State::Write: reply = transfer_write(val); break;
+    case State::GetId: reply = transfer_get_id(); break;
+  }
+
+  m_previous_val = val;
+  return reply;
+}
+
+u8 MemoryCard::transfer_read(u8 val) {
+  const u32 step = m_step++;
+  m_ack = true;
+
+  switch (step) {
+    case 0: return MEMORY_CARD_ID1;
+    case 1: return MEMORY_CARD_ID2;
+    case 2: m_frame = val << 8; return 0x00;
+    case 3: m_frame |= val; return m_previous_val;
+    case 4: return COMMAND_ACK1;
+    case 5: return COMMAND_ACK2;
+    case 6:
+      // Out of range, the card answers FFFFh and gives up
+      if (m_frame >= MEMORY_CARD_FRAME_COUNT) {
+        m_flag |= FLAG_ERROR;
+        m_frame = 0xFFFF;
+        deselect();
+      }
+      m_checksum = (u8)(m_frame >> 8);
+      return (u8)(m_frame >> 8);
+    case 7: m_checksum ^= (u8)m_frame; return (u8)m_frame;
+    default: break;
+  }
+
+  const u32 data_index = step - 8;
+  if (data_index < MEMORY_CARD_FRAME_SIZE) {
+    const u8 data = m_data[m_frame * MEMORY_CARD_FRAME_SIZE + data_index];
+    m_checksum ^= data;
+    return data;
+  }
+  if (data_index == MEMORY_CARD_FRAME_SIZE)
+    return m_checksum;
+
+  m_flag &= ~FLAG_ERROR;
+  deselect();
+  return END_GOOD;
+}
+
+u8 MemoryCard::transfer_write(u8 val) {
+  const u32 step = m_step++;
+  m_ack = true;
+
+  switch (step) {
+    case 0: return MEMORY_CARD_ID1;
+    case 1: return MEMORY_CARD_ID2;
+    case 2:
+      m_frame = val << 8;
+      m_checksum = val;
+      return 0x00;
+    case 3:
+      m_frame |= val;
+      m_checksum ^= val;
+      return m_previous_val;
+    default: break;
+  }
+
+  const u32 data_index = step - 4;
+  if (data_index < MEMORY_CARD_FRAME_SIZE) {
+    m_write_buffer[data_index] = val;
+    m_checksum ^= val;
+    return m_previous_val;
+  }
+  if (data_index == MEMORY_CARD_FRAME_SIZE) {
+    m_checksum ^= val;  // Zero if it matches
+    return m_previous_val;
+  }
+  if (data_index == MEMORY_CARD_FRAME_SIZE + 1)
+    return COMMAND_ACK1;
+  if (data_index == MEMORY_CARD_FRAME_SIZE + 2)
+    return COMMAND_ACK2;
+
+  deselect();
+  if (m_frame >= MEMORY_CARD_FRAME_COUNT) {
+    m_flag |= FLAG_ERROR;
+    return END_BAD_FRAME;
+  }
+  if (m_checksum != 0) {
+    m_flag |= FLAG_ERROR;
+    return END_BAD_CHECKSUM;
+  }
+
+  std::copy(m_write_buffer.begin(), m_write_buffer.end(),
+            m_data.begin() + m_frame * MEMORY_CARD_FRAME_SIZE);
+  commit_frame(m_frame);
+  m_flag &= ~(FLAG_ERROR | FLAG_FRESH);
+  return END_GOOD;
+}
+
+u8 MemoryCard::transfer_get_id() {
+  static constexpr u8 REPLIES[] = {
+    MEMORY_CARD_ID1, MEMORY_CARD_ID2, COMMAND_ACK1, COMMAND_ACK2, 0x04, 0x00, 0x00, 0x80,
+  };
+
+  const u32 step = m_step++;
+  m_ack = step + 1 < std::size(REPLIES);
+  if (!m_ack)
+    deselect();
+  return REPLIES[step];
+}
+
+void MemoryCard::format() {
+  m_data.fill(0);
+
+  u8* header = &m_data[HEADER_FRAME * MEMORY_CARD_FRAME_SIZE];
+  header[0] = 'M';
+  header[1] = 'C';
+  set_frame_checksum(header);
+  std::copy_n(header, MEMORY_CARD_FRAME_SIZE, &m_data[WRITE_TEST_FRAME * MEMORY_CARD_FRAME_SIZE]);
+
+  // Free blocks, no next block
+  for (u32 i = 0; i < DIRECTORY_FRAME_COUNT; ++i) {
+    u8* entry = &m_data[(FIRST_DIRECTORY_FRAME + i) * MEMORY_CARD_FRAME_SIZE];
+    entry[0] = 0xA0;
+    entry[8] = 0xFF;
+    entry[9] = 0xFF;
+    set_frame_checksum(entry);
+  }
+  // No broken frames
+  for (u32 i = 0; i < BROKEN_FRAME_LIST_COUNT; ++i) {
+    u8* entry = &m_data[(FIRST_BROKEN_FRAME_LIST_FRAME + i) * MEMORY_CARD_FRAME_SIZE];
+    std::fill_n(entry, 4, 0xFF);
+    entry[8] = 0xFF;
+    entry[9] = 0xFF;
+    set_frame_checksum(entry);
+  }
+}
+
+void MemoryCard::commit_frame(u32 frame) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::copy_n(&m_data[frame * MEMORY_CARD_FRAME_SIZE], MEMORY_CARD_FRAME_SIZE,
+                &m_file_image[frame * MEMORY_CARD_FRAME_SIZE]);
+    m_dirty.set(frame);
+    m_last_write = std::chrono::steady_clock::now();
+  }
+  m_written.notify_one();
+}
+
+void MemoryCard::run_writer() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  auto image = std::make_unique<std::array<u8, MEMORY_CARD_SIZE>>();
+
+  while (true) {
+    m_written.wait(lock, [this]() { return m_is_ejecting || m_dirty.any(); });
+    if (m_dirty.none())
+      return;  // Ejecting
+
+    // Writes that come close together are one save, written once
+    while (!m_is_ejecting && std::chrono::steady_clock::now() < m_last_write + MEMORY_CARD_FLUSH_DELAY)
+      m_written.wait_until(lock, m_last_write + MEMORY_CARD_FLUSH_DELAY);
+
+    const size_t frame_count = m_dirty.count();
+    *image = m_file_image;
+    m_dirty.reset();
+
+    lock.unlock();
+    if (write_file(*image))
+      LOG_DEBUG("Wrote {} frames to memory card {}", frame_count, m_path.string());
+    lock.lock();
+  }
+}
+
+bool MemoryCard::write_file(const std::array<u8, MEMORY_CARD_SIZE>& image) const {
+  fs::path temp_path = m_path;
+  temp_path += ".tmp";
+
+  {
+    std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+    file.write((const char*)image.data(), image.size());
+    if (!file) {
+      LOG_ERROR("Could not write memory card {}", temp_path.string());
+      return false;
+    }
+  }
+
+  std::error_code error;
+  fs::rename(temp_path, m_path, error);
+  if (error) {
+    LOG_ERROR("Could not replace memory card {}: {}", m_path.string(), error.message());
+    return false;
+  }
+  return true;
+}
+
+void MemoryCard::serialize(util::StateStream& s) {
+  s.value(m_state);
+  s.value(m_step);
+  s.value(m_frame);
+  s.value(m_checksum);
+  s.value(m_previous_val);
+  s.value(m_flag);
+  s.value(m_ack);
+  s.value(m_write_buffer);
+}
+
+}  // namespace io
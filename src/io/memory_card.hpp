@@ -0,0 +1,94 @@
+#pragma once
+
+#include <util/fs.hpp>
+#include <util/types.hpp>
+
+#include <array>
+#include <bitset>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace util {
+class StateStream;
+}
+
+namespace io {
+
+constexpr u32 MEMORY_CARD_SIZE = 128 * 1024;
+constexpr u32 MEMORY_CARD_FRAME_SIZE = 128;  // What a read or write command transfers
+constexpr u32 MEMORY_CARD_FRAME_COUNT = MEMORY_CARD_SIZE / MEMORY_CARD_FRAME_SIZE;
+// Written frames are held back until the card has been left alone that long, a save being many frames
+constexpr std::chrono::milliseconds MEMORY_CARD_FLUSH_DELAY{ 500 };
+
+// A memory card in a slot, answering the SIO commands of the joypad port (read, write and get ID). The
+// image is held in memory, the frames the guest writes are copied to the file on a thread of its own:
+// the whole image goes to a temporary file which replaces the card's once complete, so that a crash
+// never leaves half a save behind and the emulation thread never waits on the disk.
+class MemoryCard {
+ public:
+  MemoryCard() = default;
+  MemoryCard(const MemoryCard&) = delete;
+  MemoryCard& operator=(const MemoryCard&) = delete;
+  // Writes the frames left
+  ~MemoryCard();
+
+  // Loads path, or starts with a formatted card if there's no such file yet. Ejects the card that was
+  // there.
+  bool insert(const fs::path& path);
+  void eject();
+  bool is_inserted() const { return m_writer.joinable(); }
+
+  // Exchanges a byte with the card, val from the console and the reply from the card
+  u8 transfer(u8 val);
+  bool ack() const { return m_ack; }  // The card wants the next byte, after the last reply
+  bool is_selected() const { return m_state != State::Idle; }
+  void deselect();
+
+  void serialize(util::StateStream& s);  // The command in progress, not the image
+
+ private:
+  enum class State : u8 {
+    Idle,
+    Command,  // Selected, the next byte is the command
+    Read,
+    Write,
+    GetId,
+  };
+
+  u8 transfer_read(u8 val);
+  u8 transfer_write(u8 val);
+  u8 transfer_get_id();
+  void format();
+  // Hands the frame to the writer thread
+  void commit_frame(u32 frame);
+  void run_writer();
+  bool write_file(const std::array<u8, MEMORY_CARD_SIZE>& image) const;
+
+  std::array<u8, MEMORY_CARD_SIZE> m_data{};
+
+  // Command in progress
+  State m_state{ State::Idle };
+  u32 m_step{};          // Bytes transferred since the command byte
+  u16 m_frame{};         // Addressed by the command
+  u8 m_checksum{};       // Of the address and data bytes
+  u8 m_previous_val{};   // Sent by the console in the previous transfer, echoed back during writes
+  u8 m_flag{ 0x08 };     // Bit 3: no write since power on, bit 2: last command failed
+  bool m_ack{};
+  std::array<u8, MEMORY_CARD_FRAME_SIZE> m_write_buffer{};
+
+  fs::path m_path;  // Only changed while there's no writer thread
+
+  // Shared with the writer thread, under m_mutex
+  std::array<u8, MEMORY_CARD_SIZE> m_file_image{};  // What the file holds, the writer's copy
+  std::bitset<MEMORY_CARD_FRAME_COUNT> m_dirty;     // Frames of m_data newer than in m_file_image
+  std::chrono::steady_clock::time_point m_last_write;
+  bool m_is_ejecting{};
+  std::mutex m_mutex;
+  std::condition_variable m_written;
+
+  std::thread m_writer;  // Running while inserted
+};
+
+}  // namespace io
@@ -0,0 +1,227 @@
+#include <io/pbp_image.hpp>
+
+#include <io/cdrom_disk.hpp>
+#include <util/log.hpp>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace io {
+
+namespace {
+
+constexpr u32 HUNK_SIZE = PBP_HUNK_SECTOR_COUNT * SECTOR_SIZE;
+
+// Of the PBP header, where DATA.PSAR begins, and of DATA.PSAR, where the parts of a disc image begin
+constexpr size_t PSAR_OFFSET_OFFSET = 0x24;
+constexpr size_t FIRST_DISC_OFFSET_OFFSET = 0x200;
+constexpr size_t HUNK_INDEX_OFFSET = 0x4000;
+constexpr size_t HUNK_DATA_OFFSET = 0x100000;
+constexpr size_t HUNK_INDEX_ENTRY_SIZE = 32;
+
+}  // namespace
+
+PbpImage::PbpImage() {
+  for (auto& cached : m_cache)
+    cached.data.resize(HUNK_SIZE);
+
+  // Enough to keep up with the read-ahead, leaving a core to emulation
+  const u32 worker_count =
+      std::clamp(std::thread::hardware_concurrency(), 2u, PBP_READ_AHEAD_HUNK_COUNT + 1) - 1;
+  for (u32 i = 0; i < worker_count; ++i)
+    m_workers.emplace_back(&PbpImage::run_worker, this);
+}
+
+PbpImage::~PbpImage() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_queued.notify_all();
+  for (auto& worker : m_workers)
+    worker.join();
+}
+
+bool PbpImage::open(const fs::path& path) {
+  if (!m_file.open(path))
+    return false;
+
+  const u8* data = m_file.data();
+  const size_t size = m_file.size();
+  const auto read_u32 = [&](size_t offset) -> u32 {
+    u32 value{};
+    if (offset + sizeof(value) <= size)
+      std::memcpy(&value, data + offset, sizeof(value));
+    return value;
+  };
+  const auto has_magic = [&](size_t offset, const char* magic) {
+    const size_t length = std::strlen(magic);
+    return offset + length <= size && std::memcmp(data + offset, magic, length) == 0;
+  };
+
+  if (size < PSAR_OFFSET_OFFSET + 4 || std::memcmp(data, "\0PBP", 4) != 0) {
+    LOG_ERROR_CDROM("{} is not a PBP file", path.string());
+    return false;
+  }
+
+  size_t disc_offset = read_u32(PSAR_OFFSET_OFFSET);
+  if (has_magic(disc_offset, "PSTITLEIMG"))
+    disc_offset += read_u32(disc_offset + FIRST_DISC_OFFSET_OFFSET);
+  if (!has_magic(disc_offset, "PSISOIMG")) {
+    LOG_ERROR_CDROM("{} holds no PlayStation disc image, or an encrypted one", path.string());
+    return false;
+  }
+
+  // The index ends with the first empty entry, or where the hunks begin
+  const size_t index_end = std::min(disc_offset + HUNK_DATA_OFFSET, size);
+  for (size_t entry = disc_offset + HUNK_INDEX_OFFSET; entry + HUNK_INDEX_ENTRY_SIZE <= index_end;
+       entry += HUNK_INDEX_ENTRY_SIZE) {
+    const u32 hunk_offset = read_u32(entry);
+    const u32 hunk_size = read_u32(entry + 4) & 0xFFFF;
+    if (hunk_size == 0)
+      break;
+    m_hunks.push_back({ disc_offset + HUNK_DATA_OFFSET + hunk_offset, hunk_size });
+  }
+
+  LOG_INFO_CDROM("Opened PBP image {}, {} sectors", path.string(), sector_count());
+  return !m_hunks.empty();
+}
+
+bool PbpImage::read(u32 sector, u8* dest) {
+  const u32 hunk_index = sector / PBP_HUNK_SECTOR_COUNT;
+  if (hunk_index >= m_hunks.size())
+    return false;
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  CachedHunk* cached = find(hunk_index);
+  if (!cached) {
+    // Not read ahead (the game seeked), decompressing it here is faster than waiting in the queue. What
+    // was read ahead for the previous position is likely of no use anymore.
+    drop_queued();
+    // Only the slots the workers are decompressing can't be claimed, there are fewer workers than slots
+    // but wait for one of them all the same
+    m_decompressed.wait(lock, [this, hunk_index, &cached]() {
+      cached = claim(hunk_index);
+      return cached != nullptr;
+    });
+    lock.unlock();
+    const bool is_valid = decompress(hunk_index, cached->data.data());
+    lock.lock();
+    cached->is_valid = is_valid;
+    cached->is_ready = true;
+  }
+  m_decompressed.wait(lock, [cached]() { return cached->is_ready; });
+  cached->last_used = ++m_use_count;
+
+  read_ahead(hunk_index);
+
+  if (!cached->is_valid)
+    return false;
+  std::copy_n(cached->data.data() + (sector % PBP_HUNK_SECTOR_COUNT) * SECTOR_SIZE, SECTOR_SIZE, dest);
+  return true;
+}
+
+void PbpImage::run_worker() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  while (true) {
+    m_queued.wait(lock, [this]() { return m_quit || !m_queue.empty(); });
+    if (m_quit)
+      return;
+
+    CachedHunk& cached = *m_queue.front();
+    m_queue.pop_front();
+    lock.unlock();
+
+    const bool is_valid = decompress((u32)cached.index, cached.data.data());
+
+    lock.lock();
+    cached.is_valid = is_valid;
+    cached.is_ready = true;
+    m_decompressed.notify_all();
+  }
+}
+
+bool PbpImage::decompress(u32 hunk_index, u8* dest) const {
+  const Hunk& hunk = m_hunks[hunk_index];
+  if (hunk.offset + hunk.size > m_file.size()) {
+    LOG_ERROR_CDROM("PBP hunk {} is past the end of the file", hunk_index);
+    return false;
+  }
+
+  const u8* src = m_file.data() + hunk.offset;
+  if (hunk.size == HUNK_SIZE) {
+    std::copy_n(src, HUNK_SIZE, dest);
+    return true;
+  }
+
+  // Raw deflate, without zlib header
+  z_stream stream{};
+  if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+    return false;
+  stream.next_in = const_cast<Bytef*>(src);
+  stream.avail_in = hunk.size;
+  stream.next_out = dest;
+  stream.avail_out = HUNK_SIZE;
+  const int result = inflate(&stream, Z_FINISH);
+  const u32 decompressed_size = HUNK_SIZE - stream.avail_out;
+  inflateEnd(&stream);
+
+  if (result != Z_STREAM_END) {
+    LOG_ERROR_CDROM("Could not decompress PBP hunk {}: {}", hunk_index, result);
+    return false;
+  }
+  // The end of the last hunk may be left out
+  std::fill(dest + decompressed_size, dest + HUNK_SIZE, 0);
+  return true;
+}
+
+PbpImage::CachedHunk* PbpImage::find(s64 hunk_index) {
+  for (auto& cached : m_cache) {
+    if (cached.index == hunk_index)
+      return &cached;
+  }
+  return nullptr;
+}
+
+PbpImage::CachedHunk* PbpImage::claim(s64 hunk_index) {
+  CachedHunk* lru = nullptr;
+  for (auto& cached : m_cache) {
+    if (cached.is_ready && (!lru || cached.last_used < lru->last_used))
+      lru = &cached;
+  }
+  if (!lru)
+    return nullptr;
+
+  lru->index = hunk_index;
+  lru->last_used = ++m_use_count;
+  lru->is_ready = false;
+  lru->is_valid = false;
+  return lru;
+}
+
+void PbpImage::drop_queued() {
+  for (CachedHunk* cached : m_queue) {
+    cached->index = -1;
+    cached->is_ready = true;
+    cached->is_valid = false;
+  }
+  m_queue.clear();
+}
+
+void PbpImage::read_ahead(u32 hunk_index) {
+  const u32 end = std::min<u32>(hunk_index + 1 + PBP_READ_AHEAD_HUNK_COUNT, (u32)m_hunks.size());
+  for (u32 ahead = hunk_index + 1; ahead < end; ++ahead) {
+    if (find(ahead))
+      continue;
+    CachedHunk* cached = claim(ahead);
+    if (!cached)
+      break;  // The rest is read ahead by the next reads
+    m_queue.push_back(cached);
+    m_queued.notify_one();
+  }
+}
+
+}  // namespace io
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <util/fs.hpp>
+#include <util/mapped_file.hpp>
+#include <util/types.hpp>
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace io {
+
+// Sectors per hunk of a PBP image, each hunk is deflated on its own
+constexpr u32 PBP_HUNK_SECTOR_COUNT = 16;
+// Hunks decompressed ahead of the one being read
+constexpr u32 PBP_READ_AHEAD_HUNK_COUNT = 4;
+// Of the decompressed hunk cache, the hunks read ahead plus a few the game may seek back to
+constexpr u32 PBP_CACHE_HUNK_COUNT = 12;
+
+// Disc image compressed into a PlayStation Portable EBOOT.PBP (as made by popstation), about half the
+// size of the raw image. Hunks are decompressed on a pool of threads ahead of the one being read, into a
+// small cache, so that reads rarely wait for decompression. Multi-disc images only give their first
+// disc, images encrypted for the PSN store aren't supported. Needs util::MappedFile, the hunks are read
+// from the mapping of the file by all threads at once.
+class PbpImage {
+ public:
+  PbpImage();
+  ~PbpImage();
+
+  // Returns false if the file isn't a PBP image
+  bool open(const fs::path& path);
+  u32 sector_count() const { return (u32)m_hunks.size() * PBP_HUNK_SECTOR_COUNT; }
+  // Copies the SECTOR_SIZE bytes of the sector to dest, false if it couldn't be decompressed
+  bool read(u32 sector, u8* dest);
+
+ private:
+  struct Hunk {
+    u64 offset;  // In the file
+    u32 size;    // Compressed, hunks of the full decompressed size are stored as is
+  };
+
+  struct CachedHunk {
+    s64 index{ -1 };
+    bool is_ready{ true };  // Slots that aren't are being decompressed, they can't be replaced
+    bool is_valid{};  // Whether decompressing worked
+    u64 last_used{};
+    buffer data;
+  };
+
+  void run_worker();
+  // Without the lock, from any thread
+  bool decompress(u32 hunk_index, u8* dest) const;
+  CachedHunk* find(s64 hunk_index);
+  // Claims the least recently used slot that isn't being decompressed, nullptr if they all are
+  CachedHunk* claim(s64 hunk_index);
+  // Frees the slots still waiting for a worker
+  void drop_queued();
+  void read_ahead(u32 hunk_index);
+
+  util::MappedFile m_file;
+  std::vector<Hunk> m_hunks;
+
+  std::array<CachedHunk, PBP_CACHE_HUNK_COUNT> m_cache{};
+  u64 m_use_count{};
+  std::deque<CachedHunk*> m_queue;  // Claimed slots waiting for a worker
+  bool m_quit{};
+  std::mutex m_mutex;
+  std::condition_variable m_queued;
+  std::condition_variable m_decompressed;
+
+  std::vector<std::thread> m_workers;
+};
+
+}  // namespace io
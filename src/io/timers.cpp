@@ -1,59 +1,147 @@
 #include <cpu/interrupt.hpp>
+#include <emulator/scheduler.hpp>
 #include <gsl-lite.hpp>
 #include <io/timers.hpp>
 #include <util/log.hpp>
+#include <util/state_stream.hpp>
+
+#include <algorithm>
 
 namespace io {
 
 static cpu::IrqType timer_index_to_irq(TimerIndex i);
 
-void Timers::init(cpu::Interrupts* interrupts) {
+// The GPU video clock is 11/7 of the system clock. Dots take 8 video cycles at the 320 pixels wide
+// resolution most games use, scanlines 3413 (NTSC).
+constexpr u32 VIDEO_CLOCK_NUM = 11;
+constexpr u32 VIDEO_CLOCK_DEN = 7;
+constexpr u32 VIDEO_CYCLES_PER_DOT = 8;
+constexpr u32 VIDEO_CYCLES_PER_SCANLINE = 3413;
+
+void Timers::init(cpu::Interrupts* interrupts, emulator::Scheduler* scheduler) {
   m_interrupts = interrupts;
+  m_scheduler = scheduler;
+
+  m_scheduler->set_callback(emulator::EventType::Timers, [this]() {
+    sync();
+    schedule_next_irq();
+  });
 }
 
-void Timers::step(u32 cycles) {
-  const u16 timer_increment[3] = { source0() ? cycles : cycles,  // TODO
-                                   source1() ? cycles : cycles,  // TODO
-                                   source2() ? cycles / 8 : cycles };
+void Timers::serialize(util::StateStream& s) {
+  s.section("TMRS");
+  s.value(m_last_sync);
+  s.value(m_timer_value);
+  s.value(m_timer_clock_frac);
+  s.value(m_timer_mode);
+  s.value(m_timer_target);
+  s.value(m_timer_irq_occured);
+  s.value(m_timer_paused);
+}
+
+void Timers::sync() {
+  const u64 now = m_scheduler->now();
+  const u64 elapsed = now - m_last_sync;
+  m_last_sync = now;
+  if (elapsed == 0)
+    return;
 
   for (auto i = Timer0; i < TimerMax; i = (TimerIndex)((u16)i + 1)) {
     if (m_timer_paused[i])
       continue;
 
-    // Shorthands
-    auto& value = m_timer_value[i];
-    auto& mode = m_timer_mode[i];
-    auto& target = m_timer_target[i];
+    const auto clk = clock(i);
+    const u64 scaled = elapsed * clk.num + m_timer_clock_frac[i];
+    m_timer_clock_frac[i] = static_cast<u32>(scaled % clk.den);
+    advance(i, scaled / clk.den);
+  }
+}
 
-    value += timer_increment[i];
+void Timers::advance(TimerIndex i, u64 ticks) {
+  // Shorthands
+  auto& value = m_timer_value[i];
+  auto& mode = m_timer_mode[i];
+  const u32 target = m_timer_target[i];
+
+  bool could_irq = false;
 
-    bool could_irq = false;
+  // Goes from one point where the counter goes past its target or wraps to the next, whole laps at once
+  while (ticks > 0) {
+    const u64 to_target = value <= target ? target - value + 1 : UINT64_MAX;
+    const u64 to_max = 0x10000 - value;
+    const u64 to_event = std::min(to_target, to_max);
+    if (ticks < to_event) {
+      value = static_cast<u16>(value + ticks);
+      break;
+    }
+    ticks -= to_event;
 
-    if (value > target) {
+    if (to_event == to_target) {
       mode.reached_target = true;
       if (mode.irq_on_target)
         could_irq = true;
-      if (mode.reset_on_target)
-        value = 0;  // if reset on target
     }
-
-    if (value > 0xFFFF) {
+    if (to_event == to_max) {
       mode.reached_max = true;
       if (mode.irq_on_max)
         could_irq = true;
-      if (!mode.reset_on_target)
-        value = 0;  // if reset on max
     }
 
-    if (could_irq)
-      step_irq(i);
+    if (mode.reset_on_target && to_event == to_target) {
+      value = 0;
+      ticks %= target + 1;  // Further laps only go past the target again
+    } else {
+      value = static_cast<u16>(value + to_event);
+      if (!mode.reset_on_target && ticks >= 0x10000) {  // Further laps go past both again
+        mode.reached_target = mode.reached_max = true;
+        if (mode.irq_on_target || mode.irq_on_max)
+          could_irq = true;
+        ticks &= 0xFFFF;
+      }
+    }
+  }
+
+  if (could_irq)
+    step_irq(i);
+}
 
-    // Handle possible overflow (we use u32 but counter value is u16)
-    value = static_cast<u16>(value);
+void Timers::schedule_next_irq() {
+  u64 next_irq = UINT64_MAX;
+
+  for (auto i = Timer0; i < TimerMax; i = (TimerIndex)((u16)i + 1)) {
+    const auto& mode = m_timer_mode[i];
+    const bool irq_done = mode.irq_repeat_mode() == TimerMode::RepeatMode::Once && m_timer_irq_occured[i];
+    if (m_timer_paused[i] || irq_done)
+      continue;
+
+    // Counter increments left until the IRQ conditions checked in advance() become true
+    const u32 value = m_timer_value[i];
+    u32 ticks = UINT32_MAX;
+    if (mode.irq_on_target) {
+      // Past the target, the counter only reaches it again after wrapping
+      const u32 target = m_timer_target[i];
+      ticks = value <= target ? target - value + 1 : (0x10000 - value) + target + 1;
+    }
+    if (mode.irq_on_max)
+      ticks = std::min<u32>(ticks, 0x10000 - value);
+    if (ticks == UINT32_MAX)
+      continue;
+
+    // Rounded up, to the cycle the last tick happens on
+    const auto clk = clock(i);
+    const u64 cycles = ((u64)ticks * clk.den - m_timer_clock_frac[i] + clk.num - 1) / clk.num;
+    next_irq = std::min(next_irq, cycles);
   }
+
+  if (next_irq == UINT64_MAX)
+    m_scheduler->cancel(emulator::EventType::Timers);
+  else
+    m_scheduler->schedule(emulator::EventType::Timers, next_irq);
 }
 
 u16 Timers::read_reg(address addr) {
+  sync();
+
   u8 timer_select = timer_from_addr(addr);
   u8 reg = addr & 0xF;
 
@@ -69,6 +157,8 @@ u16 Timers::read_reg(address addr) {
 }
 
 void Timers::write_reg(address addr, u16 val) {
+  sync();
+
   u8 timer_select = timer_from_addr(addr);
   u8 reg = addr & 0xF;
 
@@ -79,7 +169,7 @@ void Timers::write_reg(address addr, u16 val) {
 
   switch (reg) {
     case 0:  // Current Counter Value
-      value = static_cast<u16>(val);
+      value = val;
       break;
     case 4:  // Counter Mode
       mode.word = val;
@@ -89,6 +179,7 @@ void Timers::write_reg(address addr, u16 val) {
       m_timer_irq_occured[timer_select] = false;  // Reset one-shot IRQ tracker
 
       value = 0;
+      m_timer_clock_frac[timer_select] = 0;  // The clock source may have changed
 
       if (mode.sync_enable) {
         if (timer_select == 2) {  // TODO: other sync modes
@@ -102,6 +193,8 @@ void Timers::write_reg(address addr, u16 val) {
       break;
     default: LOG_ERROR("Invalid Timer register access"); break;
   }
+
+  schedule_next_irq();
 }
 
 void Timers::step_irq(TimerIndex i) {
@@ -128,12 +221,25 @@ u8 Timers::timer_from_addr(address addr) {
   return timer_select;
 }
 
+Timers::TimerClock Timers::clock(TimerIndex i) const {
+  if (i == Timer0 && source0())
+    return { VIDEO_CLOCK_NUM, VIDEO_CLOCK_DEN * VIDEO_CYCLES_PER_DOT };
+  if (i == Timer1 && source1())
+    return { VIDEO_CLOCK_NUM, VIDEO_CLOCK_DEN * VIDEO_CYCLES_PER_SCANLINE };
+  if (i == Timer2 && source2())
+    return { 1, 8 };
+  return { 1, 1 };
+}
+
+// Dotclock for 1 and 3, system clock for 0 and 2
 bool Timers::source0() const {
-  return m_timer_mode[0].clock_source & 0b10;
+  return m_timer_mode[0].clock_source & 0b01;
 }
+// Hblank for 1 and 3, system clock for 0 and 2
 bool Timers::source1() const {
-  return m_timer_mode[1].clock_source & 0b10;
+  return m_timer_mode[1].clock_source & 0b01;
 }
+// System clock / 8 for 2 and 3, system clock for 0 and 1
 bool Timers::source2() const {
   return m_timer_mode[2].clock_source >= 2;
 }
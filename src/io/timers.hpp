@@ -6,10 +6,18 @@ namespace cpu {
 class Interrupts;
 }
 
+namespace emulator {
+class Scheduler;
+}
+
 namespace gui {
 class Gui;
 }
 
+namespace util {
+class StateStream;
+}
+
 namespace io {
 
 union TimerMode {
@@ -62,24 +70,38 @@ class Timers {
   friend class gui::Gui;  // for debug info
 
  public:
-  void init(cpu::Interrupts* interrupts);
-  void step(u32 cpu_cycles);
+  void init(cpu::Interrupts* interrupts, emulator::Scheduler* scheduler);
 
   u16 read_reg(address addr);
   void write_reg(address addr, u16 val);
+  void serialize(util::StateStream& s);
 
  private:
-  void step_irq(TimerIndex i);  // Returns whether an IRQ should occur
+  // A clock source counts num ticks every den system cycles
+  struct TimerClock {
+    u32 num;
+    u32 den;
+  };
+
+  // Timers are only brought up to date when they're accessed or when one of them is due to IRQ
+  void sync();
+  void advance(TimerIndex i, u64 ticks);  // Moves the counter on by that many ticks at once
+  void schedule_next_irq();
+  void step_irq(TimerIndex i);  // Triggers the IRQ of the timer, as its mode allows
   static u8 timer_from_addr(address addr);
 
+  TimerClock clock(TimerIndex i) const;
   bool source0() const;
   bool source1() const;
   bool source2() const;
 
  private:
   cpu::Interrupts* m_interrupts{};
+  emulator::Scheduler* m_scheduler{};
+  u64 m_last_sync{};  // Scheduler time the timers were last brought up to date
 
-  u32 m_timer_value[3]{};  // Use u32 instead of u16 to handle u16 overflow
+  u16 m_timer_value[3]{};
+  u32 m_timer_clock_frac[3]{};  // Cycles times clock num not yet making a tick, below clock den
   TimerMode m_timer_mode[3]{};
   u16 m_timer_target[3]{};
 
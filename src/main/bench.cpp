@@ -0,0 +1,237 @@
+#include <bus/bus.hpp>
+#include <emulator/emulator.hpp>
+#include <io/joypad.hpp>
+#include <util/fs.hpp>
+#include <util/log.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Headless benchmark: boots a BIOS with a disc or an executable, emulates a fixed number of frames with
+// scripted joypad input and reports how fast it went. Nothing but the host timing varies between runs,
+// so results of different builds on the same host can be compared.
+
+namespace {
+
+// pctation_bench --bios <file> [--exe <file>] [--frames <count>] [--input <file>] [--movie <file>]
+//                [--output <file>] [--recompiler] [--fast-boot] [--block-profile <dir>] [cdrom_path]
+struct Options {
+  std::string bios_path;
+  std::string exe_path;    // Loaded once the BIOS has booted, unless empty
+  std::string cdrom_path;  // Either a cue sheet or a raw CD-ROM binary file
+  u64 frame_count{ 3600 };
+  std::string input_path;   // Joypad script, see InputEvent
+  std::string movie_path;   // Input movie replayed from power on, wins over the input script
+  std::string output_path;  // Results as JSON, unless empty
+  bool use_recompiler{};
+  bool fast_boot{};  // See Settings::fast_boot
+  std::string block_profile_dir;  // See cpu/block_profile.hpp, rewritten once the frames have run
+};
+
+// One line of the input script: "<frame> <button> <press|release>", '#' starts a comment. Buttons are
+// named as in io/joypad.hpp (select, start, up, cross, l1...), events apply before their frame runs.
+struct InputEvent {
+  u64 frame;
+  u8 button_index;
+  bool is_pressed;
+};
+
+Options parse_options(s32 argc, char** argv) {
+  Options options;
+
+  for (s32 i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+
+    if (arg == "--bios" && has_value)
+      options.bios_path = argv[++i];
+    else if (arg == "--exe" && has_value)
+      options.exe_path = argv[++i];
+    else if (arg == "--frames" && has_value)
+      options.frame_count = std::strtoull(argv[++i], nullptr, 10);
+    else if (arg == "--input" && has_value)
+      options.input_path = argv[++i];
+    else if (arg == "--movie" && has_value)
+      options.movie_path = argv[++i];
+    else if (arg == "--output" && has_value)
+      options.output_path = argv[++i];
+    else if (arg == "--recompiler")
+      options.use_recompiler = true;
+    else if (arg == "--fast-boot")
+      options.fast_boot = true;
+    else if (arg == "--block-profile" && has_value)
+      options.block_profile_dir = argv[++i];
+    else if (arg.rfind("--", 0) == 0)
+      LOG_WARN("Ignoring unknown or incomplete option {}", arg);
+    else
+      options.cdrom_path = arg;
+  }
+  return options;
+}
+
+u8 button_from_name(const std::string& name) {
+  static const std::pair<const char*, u8> BUTTONS[] = {
+    { "select", io::BTN_SELECT },     { "l3", io::BTN_L3 },
+    { "r3", io::BTN_R3 },             { "start", io::BTN_START },
+    { "up", io::BTN_PAD_UP },         { "right", io::BTN_PAD_RIGHT },
+    { "down", io::BTN_PAD_DOWN },     { "left", io::BTN_PAD_LEFT },
+    { "l2", io::BTN_L2 },             { "r2", io::BTN_R2 },
+    { "l1", io::BTN_L1 },             { "r1", io::BTN_R1 },
+    { "triangle", io::BTN_TRIANGLE }, { "circle", io::BTN_CIRCLE },
+    { "cross", io::BTN_CROSS },       { "square", io::BTN_SQUARE },
+  };
+  for (const auto& [button_name, index] : BUTTONS)
+    if (name == button_name)
+      return index;
+  return io::BTN_INVALID;
+}
+
+bool load_input_script(const fs::path& path, std::vector<InputEvent>& events) {
+  std::ifstream file(path);
+  if (!file) {
+    LOG_ERROR("Could not open input script {}", path.string());
+    return false;
+  }
+
+  std::string line;
+  for (u32 line_number = 1; std::getline(file, line); ++line_number) {
+    line = line.substr(0, line.find('#'));
+    std::istringstream fields(line);
+    u64 frame;
+    std::string button_name, action;
+    if (!(fields >> frame))
+      continue;  // Blank
+
+    fields >> button_name >> action;
+    const u8 button_index = button_from_name(button_name);
+    if (button_index == io::BTN_INVALID || (action != "press" && action != "release")) {
+      LOG_ERROR("Invalid input script line {}: {}", line_number, line);
+      return false;
+    }
+    events.push_back({ frame, button_index, action == "press" });
+  }
+
+  std::stable_sort(events.begin(), events.end(),
+                   [](const InputEvent& a, const InputEvent& b) { return a.frame < b.frame; });
+  return true;
+}
+
+// Accesses by region then width, e.g. "RAM": { "read8": 12, ... }
+std::string json_bus_stats(const bus::BusStats& stats) {
+  std::string json = "{\n";
+  for (u32 region = 0; region < bus::BUS_REGION_COUNT; ++region) {
+    json += fmt::format("    \"{}\": {{ ", bus::bus_region_name((bus::BusRegion)region));
+    for (u32 access = 0; access < bus::BUS_ACCESS_COUNT; ++access) {
+      const char* separator = access + 1 < bus::BUS_ACCESS_COUNT ? ", " : "";
+      json += fmt::format("\"{}\": {}{}", bus::bus_access_name((bus::BusAccess)access),
+                          stats.accesses[region][access], separator);
+    }
+    json += region + 1 < bus::BUS_REGION_COUNT ? " },\n" : " }\n";
+  }
+  return json + "  }";
+}
+
+// Paths may hold backslashes on Windows
+std::string json_string(const std::string& str) {
+  std::string escaped = "\"";
+  for (const char c : str) {
+    if (c == '"' || c == '\\')
+      escaped += '\\';
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+
+}  // namespace
+
+s32 main(s32 argc, char** argv) {
+  logging::init();
+
+  const Options options = parse_options(argc, argv);
+  if (options.bios_path.empty()) {
+    LOG_ERROR("No BIOS given, see --bios");
+    return 1;
+  }
+  std::vector<InputEvent> input;
+  if (!options.input_path.empty() && !load_input_script(options.input_path, input))
+    return 1;
+  io::InputMovie movie;
+  if (!options.movie_path.empty() && !movie.load(options.movie_path))
+    return 1;
+
+  // The expansion region boots the BIOS itself, as in main/main.cpp
+  auto emulator = std::make_unique<emulator::Emulator>(options.bios_path, options.exe_path,
+                                                       options.bios_path, options.cdrom_path, true);
+  // Nothing that runs on other threads, their timing would leak into the results
+  auto& settings = emulator->settings();
+  settings.cpu_engine =
+      options.use_recompiler ? emulator::CpuEngine::Recompiler : emulator::CpuEngine::Interpreter;
+  settings.log_bios_calls = false;
+  settings.fast_boot = options.fast_boot;
+  emulator->update_settings();
+  if (!options.movie_path.empty())
+    emulator->start_input_replay(std::move(movie));
+  // Its blocks are decoded on another thread, which is the point of comparing runs with and without one
+  if (!options.block_profile_dir.empty()) {
+    fs::create_directories(options.block_profile_dir);
+    emulator->load_block_profile(options.block_profile_dir);
+  }
+
+  auto next_input = input.begin();
+  const auto start = std::chrono::steady_clock::now();
+  for (u64 frame = 0; frame < options.frame_count; ++frame) {
+    for (; next_input != input.end() && next_input->frame <= frame; ++next_input)
+      emulator->joypad().update_button(next_input->button_index, next_input->is_pressed);
+    emulator->advance_frame();
+  }
+  const emulator::Stats stats = emulator->stats();
+  const std::chrono::duration<f64> elapsed = std::chrono::steady_clock::now() - start;
+  const f64 seconds = std::max(elapsed.count(), 1e-9);
+
+  const f64 fps = options.frame_count / seconds;
+  const f64 mips = stats.instructions / seconds / 1e6;
+  const f64 primitives_per_second = stats.primitives / seconds;
+  const f64 pixels_per_second = stats.pixels / seconds;
+
+  fmt::print("{} frames in {:.3f}s: {:.1f} FPS, {:.2f} MIPS, {:.0f} primitives/s, {:.0f} pixels/s\n",
+             options.frame_count, seconds, fps, mips, primitives_per_second, pixels_per_second);
+  if (!options.block_profile_dir.empty() && !emulator->save_block_profile())
+    return 1;
+
+  if (options.output_path.empty())
+    return 0;
+  std::ofstream file(options.output_path);
+  if (!file) {
+    LOG_ERROR("Could not open {} to write the results", options.output_path);
+    return 1;
+  }
+  const char* cpu_engine = options.use_recompiler ? "recompiler" : "interpreter";
+  file << "{\n"
+       << fmt::format("  \"bios\": {},\n", json_string(options.bios_path))
+       << fmt::format("  \"exe\": {},\n", json_string(options.exe_path))
+       << fmt::format("  \"cdrom\": {},\n", json_string(options.cdrom_path))
+       << fmt::format("  \"movie\": {},\n", json_string(options.movie_path))
+       << fmt::format("  \"cpu_engine\": \"{}\",\n", cpu_engine)
+       << fmt::format("  \"fast_boot\": {},\n", options.fast_boot)
+       << fmt::format("  \"block_profile\": {},\n", json_string(options.block_profile_dir))
+       << fmt::format("  \"frames\": {},\n", options.frame_count)
+       << fmt::format("  \"seconds\": {:.6f},\n", seconds)
+       << fmt::format("  \"fps\": {:.3f},\n", fps)
+       << fmt::format("  \"guest_mips\": {:.3f},\n", mips)
+       << fmt::format("  \"primitives_per_second\": {:.1f},\n", primitives_per_second)
+       << fmt::format("  \"pixels_per_second\": {:.1f},\n", pixels_per_second)
+       << fmt::format("  \"instructions\": {},\n", stats.instructions)
+       << fmt::format("  \"cycles\": {},\n", stats.cycles)
+       << fmt::format("  \"primitives\": {},\n", stats.primitives)
+       << fmt::format("  \"pixels\": {}", stats.pixels);
+  if (BUS_STATS_ENABLED)
+    file << fmt::format(",\n  \"bus_accesses\": {}", json_bus_stats(stats.bus));
+  file << "\n}\n";
+  return file ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+#include <cpu/cpu_trace.hpp>
+#include <cpu/disassembler.hpp>
+#include <util/fs.hpp>
+#include <util/log.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// Reads back the binary CPU traces of TRACE_MODE TRACE_BINARY (see cpu/cpu_trace.hpp): dumps one as
+// text in the format of TRACE_DISASM, or finds where it diverges from another trace. The other trace is
+// either binary too, or text with a hex PC starting each line (TRACE_PC_ONLY, TRACE_DISASM or no$psx
+// logs), which only PCs are compared against.
+
+namespace {
+
+// pctation_cpu_trace [--regs] [--diff <other>] [--context <count>] <trace>
+struct Options {
+  std::string trace_path;
+  std::string diff_path;  // Dumps the trace unless set
+  bool dump_regs{};       // Registers written by each instruction, after its disassembly
+  u32 context{ 16 };      // Matching instructions shown before a divergence
+};
+
+struct TracedInstruction {
+  u32 pc;
+  u32 word;
+  std::vector<std::pair<u8, u32>> writes;  // Registers as in CpuTraceRecord::reg, and their values
+  bool has_word;                           // Text traces only hold PCs
+};
+
+const char* const REGISTER_NAMES[] = {
+  "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3", "t0", "t1", "t2", "t3",
+  "t4",   "t5", "t6", "t7", "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+  "t8",   "t9", "k0", "k1", "gp", "sp", "fp", "ra", "hi", "lo",
+};
+
+Options parse_options(s32 argc, char** argv) {
+  Options options;
+
+  for (s32 i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+
+    if (arg == "--regs")
+      options.dump_regs = true;
+    else if (arg == "--diff" && has_value)
+      options.diff_path = argv[++i];
+    else if (arg == "--context" && has_value)
+      options.context = (u32)std::strtoul(argv[++i], nullptr, 10);
+    else if (arg.rfind("--", 0) == 0)
+      LOG_WARN("Ignoring unknown or incomplete option {}", arg);
+    else
+      options.trace_path = arg;
+  }
+  return options;
+}
+
+bool is_binary_trace(const fs::path& path) {
+  std::ifstream file(path, std::ios::binary);
+  char magic[4]{};
+  file.read(magic, sizeof(magic));
+  return file && std::equal(magic, magic + 4, "PCTR");
+}
+
+bool load_binary_trace(const fs::path& path, std::vector<TracedInstruction>& instructions) {
+  std::vector<cpu::CpuTraceRecord> records;
+  if (!cpu::load_cpu_trace(path, records))
+    return false;
+
+  for (const auto& record : records) {
+    if (!(record.flags & cpu::CPU_TRACE_CONTINUED) || instructions.empty())
+      instructions.push_back({ record.pc, record.word, {}, true });
+    if (record.reg != cpu::CPU_TRACE_NO_REG)
+      instructions.back().writes.emplace_back(record.reg, record.value);
+  }
+  return true;
+}
+
+bool load_text_trace(const fs::path& path, std::vector<TracedInstruction>& instructions) {
+  std::ifstream file(path);
+  if (!file) {
+    LOG_ERROR("Could not open trace {}", path.string());
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(file, line)) {
+    const size_t start = line.find_first_not_of(" \t[");
+    if (start == std::string::npos)
+      continue;
+    char* end = nullptr;
+    const u32 pc = (u32)std::strtoul(line.c_str() + start, &end, 16);
+    if (end != line.c_str() + start)  // Anything else isn't an instruction
+      instructions.push_back({ pc, 0, {}, false });
+  }
+  return true;
+}
+
+bool load_trace(const fs::path& path, std::vector<TracedInstruction>& instructions) {
+  return is_binary_trace(path) ? load_binary_trace(path, instructions)
+                               : load_text_trace(path, instructions);
+}
+
+std::string format_instruction(const TracedInstruction& instr, bool with_regs) {
+  if (!instr.has_word)
+    return fmt::format("{:08X}", instr.pc);
+
+  std::string text =
+      fmt::format("[{:08X}]: {:08X} {}", instr.pc, instr.word, cpu::disassemble(instr.word));
+  if (with_regs) {
+    for (const auto& [reg, value] : instr.writes) {
+      const char* name = reg < std::size(REGISTER_NAMES) ? REGISTER_NAMES[reg] : "?";
+      text += fmt::format(" {}={:08X}", name, value);
+    }
+  }
+  return text;
+}
+
+bool is_same(const TracedInstruction& a, const TracedInstruction& b) {
+  if (a.pc != b.pc)
+    return false;
+  if (!a.has_word || !b.has_word)
+    return true;
+  return a.word == b.word && a.writes == b.writes;
+}
+
+s32 diff(const std::vector<TracedInstruction>& trace, const std::vector<TracedInstruction>& other,
+         u32 context) {
+  const size_t count = std::min(trace.size(), other.size());
+  const auto mismatch = std::mismatch(trace.begin(), trace.begin() + count, other.begin(), is_same);
+  const size_t index = mismatch.first - trace.begin();
+
+  if (index == count) {
+    fmt::print("Traces match over the {} instructions they both hold ({} and {})\n", count, trace.size(),
+               other.size());
+    return 0;
+  }
+
+  fmt::print("Traces diverge at instruction {}\n", index);
+  for (size_t i = index - std::min<size_t>(index, context); i < index; ++i)
+    fmt::print("  {}\n", format_instruction(trace[i], true));
+  fmt::print("- {}\n", format_instruction(trace[index], true));
+  fmt::print("+ {}\n", format_instruction(other[index], true));
+  return 1;
+}
+
+}  // namespace
+
+s32 main(s32 argc, char** argv) {
+  logging::init();
+
+  const Options options = parse_options(argc, argv);
+  if (options.trace_path.empty()) {
+    LOG_ERROR("No CPU trace given");
+    return 1;
+  }
+  std::vector<TracedInstruction> trace;
+  if (!load_binary_trace(options.trace_path, trace))
+    return 1;
+
+  if (!options.diff_path.empty()) {
+    std::vector<TracedInstruction> other;
+    if (!load_trace(options.diff_path, other))
+      return 1;
+    return diff(trace, other, options.context);
+  }
+
+  for (const auto& instr : trace)
+    fmt::print("{}\n", format_instruction(instr, options.dump_regs));
+  return 0;
+}
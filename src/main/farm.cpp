@@ -0,0 +1,176 @@
+#include <emulator/farm.hpp>
+#include <gpu/gpu_capture.hpp>
+#include <util/fs.hpp>
+#include <util/log.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Headless batch runner: boots one BIOS with each of a list of discs or executables, every one on an
+// emulator of its own, several at a time, and reports how each run went. Runs are as deterministic as
+// those of main/bench.cpp, the VRAM hash at the end of each tells whether two builds rendered the same.
+
+namespace {
+
+// pctation_farm --bios <file> [--threads <count>] [--frames <count>] [--output <file>] [--recompiler]
+//               [--fast-boot] [--block-profile <dir>] <job>...
+// Jobs ending in .exe are executables, the others discs
+struct Options {
+  std::string bios_path;
+  std::vector<std::string> job_paths;
+  u32 thread_count{};  // One per host core if 0
+  u64 frame_count{ 3600 };
+  std::string output_path;  // Results as JSON, unless empty
+  bool use_recompiler{};
+  bool fast_boot{};  // See Settings::fast_boot
+  std::string block_profile_dir;  // See cpu/block_profile.hpp, rewritten by each job once done
+};
+
+struct JobResult {
+  std::string path;
+  f64 seconds{};
+  emulator::Stats stats;
+  u64 vram_hash{};
+};
+
+Options parse_options(s32 argc, char** argv) {
+  Options options;
+
+  for (s32 i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+
+    if (arg == "--bios" && has_value)
+      options.bios_path = argv[++i];
+    else if (arg == "--threads" && has_value)
+      options.thread_count = (u32)std::strtoul(argv[++i], nullptr, 10);
+    else if (arg == "--frames" && has_value)
+      options.frame_count = std::strtoull(argv[++i], nullptr, 10);
+    else if (arg == "--output" && has_value)
+      options.output_path = argv[++i];
+    else if (arg == "--recompiler")
+      options.use_recompiler = true;
+    else if (arg == "--fast-boot")
+      options.fast_boot = true;
+    else if (arg == "--block-profile" && has_value)
+      options.block_profile_dir = argv[++i];
+    else if (arg.rfind("--", 0) == 0)
+      LOG_WARN("Ignoring unknown or incomplete option {}", arg);
+    else
+      options.job_paths.push_back(arg);
+  }
+  return options;
+}
+
+bool is_exe(const fs::path& path) {
+  std::string extension = path.extension().string();
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 [](char c) { return (char)std::tolower((unsigned char)c); });
+  return extension == ".exe";
+}
+
+// Paths may hold backslashes on Windows
+std::string json_string(const std::string& str) {
+  std::string escaped = "\"";
+  for (const char c : str) {
+    if (c == '"' || c == '\\')
+      escaped += '\\';
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+
+bool write_results(const Options& options, const std::vector<JobResult>& results) {
+  std::ofstream file(options.output_path);
+  if (!file) {
+    LOG_ERROR("Could not open {} to write the results", options.output_path);
+    return false;
+  }
+  const char* cpu_engine = options.use_recompiler ? "recompiler" : "interpreter";
+  file << "{\n"
+       << fmt::format("  \"bios\": {},\n", json_string(options.bios_path))
+       << fmt::format("  \"cpu_engine\": \"{}\",\n", cpu_engine)
+       << fmt::format("  \"fast_boot\": {},\n", options.fast_boot)
+       << fmt::format("  \"block_profile\": {},\n", json_string(options.block_profile_dir))
+       << fmt::format("  \"frames\": {},\n", options.frame_count)
+       << "  \"jobs\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const JobResult& result = results[i];
+    file << "    {\n"
+         << fmt::format("      \"path\": {},\n", json_string(result.path))
+         << fmt::format("      \"seconds\": {:.6f},\n", result.seconds)
+         << fmt::format("      \"fps\": {:.3f},\n", options.frame_count / result.seconds)
+         << fmt::format("      \"instructions\": {},\n", result.stats.instructions)
+         << fmt::format("      \"cycles\": {},\n", result.stats.cycles)
+         << fmt::format("      \"primitives\": {},\n", result.stats.primitives)
+         << fmt::format("      \"pixels\": {},\n", result.stats.pixels)
+         << fmt::format("      \"vram_hash\": \"{:016X}\"\n", result.vram_hash)
+         << (i + 1 < results.size() ? "    },\n" : "    }\n");
+  }
+  file << "  ]\n}\n";
+  return !file.fail();
+}
+
+}  // namespace
+
+s32 main(s32 argc, char** argv) {
+  logging::init();
+
+  const Options options = parse_options(argc, argv);
+  if (options.bios_path.empty()) {
+    LOG_ERROR("No BIOS given, see --bios");
+    return 1;
+  }
+  if (options.job_paths.empty()) {
+    LOG_ERROR("No disc nor executable given");
+    return 1;
+  }
+
+  if (!options.block_profile_dir.empty())
+    fs::create_directories(options.block_profile_dir);
+
+  // Filled in by the workers, in the order of the jobs
+  std::vector<JobResult> results(options.job_paths.size());
+  std::mutex print_mutex;
+  {
+    emulator::EmulatorFarm farm(options.bios_path, options.thread_count);
+    fmt::print("Running {} jobs of {} frames on {} threads\n", options.job_paths.size(),
+               options.frame_count, farm.thread_count());
+
+    for (size_t i = 0; i < options.job_paths.size(); ++i) {
+      const std::string& path = options.job_paths[i];
+      emulator::FarmJob job;
+      (is_exe(path) ? job.exe_path : job.cdrom_path) = path;
+      job.frame_count = options.frame_count;
+      job.setup = [&options](emulator::Emulator& emulator) {
+        auto& settings = emulator.settings();
+        settings.cpu_engine = options.use_recompiler ? emulator::CpuEngine::Recompiler
+                                                     : emulator::CpuEngine::Interpreter;
+        settings.log_bios_calls = false;
+        settings.fast_boot = options.fast_boot;
+        emulator.update_settings();
+        if (!options.block_profile_dir.empty())
+          emulator.load_block_profile(options.block_profile_dir);
+      };
+      job.done = [&result = results[i], &path, &print_mutex, &options](emulator::Emulator& emulator,
+                                                                         f64 seconds) {
+        result = { path, std::max(seconds, 1e-9), emulator.stats(), gpu::hash_vram(emulator.gpu()) };
+        if (!options.block_profile_dir.empty())
+          emulator.save_block_profile();
+
+        const std::lock_guard<std::mutex> lock(print_mutex);
+        fmt::print("{}: {:.3f}s, {:.2f} MIPS, VRAM {:016X}\n", path, result.seconds,
+                   result.stats.instructions / result.seconds / 1e6, result.vram_hash);
+      };
+      farm.submit(std::move(job));
+    }
+  }
+
+  if (options.output_path.empty())
+    return 0;
+  return write_results(options, results) ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#include <gpu/gpu.hpp>
+#include <gpu/gpu_capture.hpp>
+#include <util/fs.hpp>
+#include <util/log.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+// Runs a GPU capture (see gpu/gpu_capture.hpp) on a GPU of its own, without the rest of the console,
+// and checks that every frame draws the VRAM it was captured with. Repeating it makes a rasterizer
+// benchmark that nothing but the GPU code can change.
+
+namespace {
+
+// pctation_gpu_replay [--repeat <count>] [--parallel-raster] [--threaded-gpu] <capture>
+struct Options {
+  std::string capture_path;
+  u32 repeat_count{ 1 };
+  bool parallel_raster{};
+  bool threaded_gpu{};
+};
+
+Options parse_options(s32 argc, char** argv) {
+  Options options;
+
+  for (s32 i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+
+    if (arg == "--repeat" && has_value)
+      options.repeat_count = std::max(1u, (u32)std::strtoul(argv[++i], nullptr, 10));
+    else if (arg == "--parallel-raster")
+      options.parallel_raster = true;
+    else if (arg == "--threaded-gpu")
+      options.threaded_gpu = true;
+    else if (arg.rfind("--", 0) == 0)
+      LOG_WARN("Ignoring unknown or incomplete option {}", arg);
+    else
+      options.capture_path = arg;
+  }
+  return options;
+}
+
+}  // namespace
+
+s32 main(s32 argc, char** argv) {
+  logging::init();
+
+  const Options options = parse_options(argc, argv);
+  gpu::GpuReplay replay;
+  if (options.capture_path.empty() || !replay.load(options.capture_path)) {
+    LOG_ERROR("No GPU capture to replay");
+    return 1;
+  }
+
+  auto gpu = std::make_unique<gpu::Gpu>();
+  gpu->set_threaded(options.threaded_gpu);
+  const u32 raster_workers = std::max(2u, std::thread::hardware_concurrency());
+  gpu->set_raster_workers(options.parallel_raster ? raster_workers : 0);
+
+  s32 mismatches = 0;
+  f64 best_seconds = 0;
+  for (u32 run = 0; run < options.repeat_count; ++run) {
+    const auto start = std::chrono::steady_clock::now();
+    const s32 run_mismatches = replay.run(*gpu);
+    gpu->sync();
+    const std::chrono::duration<f64> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (run_mismatches < 0)
+      return 1;
+    mismatches = std::max(mismatches, run_mismatches);
+    best_seconds = run == 0 ? elapsed.count() : std::min(best_seconds, elapsed.count());
+  }
+
+  // Counted over every run
+  const auto stats = gpu->raster_stats();
+  const u32 frame_count = replay.frame_count();
+  const f64 seconds = std::max(best_seconds, 1e-9);
+  const f64 runs = options.repeat_count;
+  fmt::print("{} frames in {:.3f} ms, best of {} runs: {:.3f} ms/frame, {:.0f} primitives/s, "
+             "{:.0f} pixels/s\n",
+             frame_count, seconds * 1e3, options.repeat_count, seconds * 1e3 / std::max(frame_count, 1u),
+             stats.primitives / runs / seconds, stats.pixels / runs / seconds);
+
+  if (mismatches > 0) {
+    fmt::print("{} of {} frames don't match the capture\n", mismatches, frame_count);
+    return 1;
+  }
+  fmt::print("All frames match the capture\n");
+  return 0;
+}
@@ -1,11 +1,16 @@
 #include <emulator/emulator.hpp>
+#include <emulator/emulator_thread.hpp>
+#include <emulator/frame_pacer.hpp>
 
 #include <gui/gui.hpp>
 #include <util/log.hpp>
 
 #include <cassert>
+#include <chrono>
+#include <cstdlib>
 #include <exception>
 #include <memory>
+#include <string>
 #include <tuple>
 
 //constexpr auto NOCASH_BIOS_2_0_PATH = "data/bios/no$psx_bios/NO$PSX_BIOS_2.0_2x.ROM";
@@ -16,21 +21,171 @@ constexpr auto BIOS_PATH = "/home/user/pctation/data/bios/SCPH1001.BIN";
 
 // tasti: Z, S, G
 
+namespace {
+
+// pctation [--headless] [--frames <count>] [--dump-frames <dir>] [--dump-format ppm|png|raw]
+//          [--dump-queue <count>] [--dump-drop] [--load-state <file>]
+//          [--save-state <file>] [--capture-gpu <file>] [--capture-frames <count>]
+//          [--log-levels <spec>] [--record-input <file>] [--replay-input <file>] [--fast-boot]
+//          [--memcard <file>] [--memcard2 <file>] [--block-profile <dir>] [cdrom_path]
+struct Options {
+  std::string cdrom_path;  // Either a cue sheet or a raw CD-ROM binary file
+  bool is_headless{};      // No window nor GL context, frames are emulated as fast as possible
+  u64 frame_count{};       // Headless runs stop after as many frames, never if 0
+  emulator::FrameDumpSettings frame_dump;  // Headless runs dump every frame to its dir, unless empty
+  std::string load_state_path;  // Headless runs start from that save state, unless empty
+  std::string save_state_path;  // Headless runs save their state there once done, unless empty
+  std::string capture_gpu_path;  // Headless runs capture the GPU there from the start, unless empty
+  u32 capture_frame_count{ 60 };  // Frames captured
+  std::string log_levels;         // See logging::set_levels(), unless empty
+  std::string record_input_path;  // The joypad input is written there as a movie on exit, unless empty
+  std::string replay_input_path;  // Movie the joypad is fed from, from power on, unless empty
+  bool fast_boot{};               // See Settings::fast_boot
+  std::string memory_card_paths[2];  // Of the cards in each slot, no card if empty
+  std::string block_profile_dir;     // See cpu/block_profile.hpp, no profile if empty
+};
+
+Options parse_options(s32 argc, char** argv) {
+  Options options;
+
+  for (s32 i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+
+    if (arg == "--headless")
+      options.is_headless = true;
+    else if (arg == "--frames" && has_value)
+      options.frame_count = std::strtoull(argv[++i], nullptr, 10);
+    else if (arg == "--dump-frames" && has_value)
+      options.frame_dump.dir = argv[++i];
+    else if (arg == "--dump-format" && has_value) {
+      const std::string format = argv[++i];
+      if (format == "ppm")
+        options.frame_dump.format = emulator::FrameDumpFormat::Ppm;
+      else if (format == "png")
+        options.frame_dump.format = emulator::FrameDumpFormat::Png;
+      else if (format == "raw")
+        options.frame_dump.format = emulator::FrameDumpFormat::Raw;
+      else
+        LOG_WARN("Ignoring unknown frame dump format {}", format);
+    } else if (arg == "--dump-queue" && has_value)
+      options.frame_dump.queue_depth = (u32)std::strtoul(argv[++i], nullptr, 10);
+    else if (arg == "--dump-drop")
+      options.frame_dump.drop_policy = emulator::FrameDropPolicy::Drop;
+    else if (arg == "--load-state" && has_value)
+      options.load_state_path = argv[++i];
+    else if (arg == "--save-state" && has_value)
+      options.save_state_path = argv[++i];
+    else if (arg == "--capture-gpu" && has_value)
+      options.capture_gpu_path = argv[++i];
+    else if (arg == "--capture-frames" && has_value)
+      options.capture_frame_count = (u32)std::strtoul(argv[++i], nullptr, 10);
+    else if (arg == "--log-levels" && has_value)
+      options.log_levels = argv[++i];
+    else if (arg == "--record-input" && has_value)
+      options.record_input_path = argv[++i];
+    else if (arg == "--replay-input" && has_value)
+      options.replay_input_path = argv[++i];
+    else if (arg == "--fast-boot")
+      options.fast_boot = true;
+    else if (arg == "--memcard" && has_value)
+      options.memory_card_paths[0] = argv[++i];
+    else if (arg == "--memcard2" && has_value)
+      options.memory_card_paths[1] = argv[++i];
+    else if (arg == "--block-profile" && has_value)
+      options.block_profile_dir = argv[++i];
+    else if (arg.rfind("--", 0) == 0)
+      LOG_WARN("Ignoring unknown or incomplete option {}", arg);
+    else
+      options.cdrom_path = arg;
+  }
+  return options;
+}
+
+// Inserts the memory cards, starts the input movies and loads the block profile of the options, before
+// the first frame
+bool prepare_emulator(const Options& options, emulator::Emulator& emulator) {
+  for (u32 slot = 0; slot < 2; ++slot) {
+    const auto& path = options.memory_card_paths[slot];
+    if (!path.empty() && !emulator.insert_memory_card(slot, path))
+      return false;
+  }
+
+  if (!options.replay_input_path.empty()) {
+    io::InputMovie movie;
+    if (!movie.load(options.replay_input_path))
+      return false;
+    emulator.start_input_replay(std::move(movie));
+  }
+  if (!options.record_input_path.empty())
+    emulator.start_input_recording();
+  if (!options.block_profile_dir.empty()) {
+    fs::create_directories(options.block_profile_dir);
+    emulator.load_block_profile(options.block_profile_dir);
+  }
+  return true;
+}
+
+s32 run_headless(const Options& options, const std::string& bootstrap_path) {
+  const std::string exe_path;
+  auto emulator = std::make_unique<emulator::Emulator>(BIOS_PATH, exe_path, bootstrap_path,
+                                                       options.cdrom_path, true);
+  emulator->settings().fast_boot = options.fast_boot;
+  emulator->update_settings();
+  if (!prepare_emulator(options, *emulator))
+    return 1;
+
+  if (!options.frame_dump.dir.empty()) {
+    fs::create_directories(options.frame_dump.dir);
+    emulator->start_frame_dump(options.frame_dump);
+  }
+  if (!options.load_state_path.empty() && !emulator->load_state_file(options.load_state_path))
+    return 1;
+  if (!options.capture_gpu_path.empty())
+    emulator->start_gpu_capture(options.capture_gpu_path, options.capture_frame_count);
+
+  const auto start = std::chrono::steady_clock::now();
+  u64 frame = 0;
+  while (options.frame_count == 0 || frame < options.frame_count) {
+    emulator->advance_frame();
+    emulator->render();
+    emulator->dump_frame();
+    ++frame;
+  }
+  emulator->stop_frame_dump();
+
+  const std::chrono::duration<f64> elapsed = std::chrono::steady_clock::now() - start;
+  LOG_INFO("Emulated {} frames in {:.2f}s, {:.1f} FPS", frame, elapsed.count(),
+           frame / elapsed.count());
+
+  if (!options.save_state_path.empty() && !emulator->save_state_file(options.save_state_path))
+    return 1;
+  if (!options.record_input_path.empty() && !emulator->stop_input_recording(options.record_input_path))
+    return 1;
+  if (!options.block_profile_dir.empty() && !emulator->save_block_profile())
+    return 1;
+  return 0;
+}
+
+}  // namespace
+
 // Entry point
 s32 main(s32 argc, char** argv) {
   gui::Gui gui;
+  bool is_gui_init = false;
 
   try {
     logging::init();
 
     std::string bootstrap_path = BIOS_PATH;
     std::string exe_path;
-    std::string cdrom_path;  // Either a cue sheet or a raw CD-ROM binary file
-
-    // TODO: do this properly
 
-    if (argc > 1)
-      cdrom_path = argv[1];
+    const Options options = parse_options(argc, argv);
+    if (!options.log_levels.empty() && !logging::set_levels(options.log_levels))
+      return 1;
+    std::string cdrom_path = options.cdrom_path;
+    if (options.is_headless)
+      return run_headless(options, bootstrap_path);
 
 //    if (argc > 2)
 //      exe_path = argv[2];
@@ -39,6 +194,7 @@ s32 main(s32 argc, char** argv) {
 //      bootstrap_path = argv[3];
 
     gui.init();
+    is_gui_init = true;
 
     // If no executable was specified in cmd args, show Executable Select screen
     if (exe_path.empty() && cdrom_path.empty())
@@ -46,6 +202,9 @@ s32 main(s32 argc, char** argv) {
 
     // Init emulator
     auto emulator = std::make_unique<emulator::Emulator>(BIOS_PATH, exe_path, bootstrap_path, cdrom_path);
+    emulator->settings().fast_boot = options.fast_boot;
+    if (!prepare_emulator(options, *emulator))
+      return 1;
 
     // Update window with exe/game title
     if (!cdrom_path.empty())
@@ -56,6 +215,14 @@ s32 main(s32 argc, char** argv) {
     // Link GUI with Emulator
     gui.set_joypad(&emulator->joypad());
     gui.set_settings(&emulator->settings());
+    emulator->set_audio_callback([&gui](const s16* samples, u32 frame_count) {
+      gui.queue_audio(samples, frame_count);
+    });
+
+    // When enabled in the settings, see emulator/emulator_thread.hpp
+    std::unique_ptr<emulator::EmulatorThread> emulator_thread;
+    // Vsync limits the framerate to the one of the monitor, which may well be above the console's
+    emulator::FramePacer pacer;
 
     // Main loop
     auto event = gui::GuiEvent::None;
@@ -64,9 +231,47 @@ s32 main(s32 argc, char** argv) {
       while (gui.poll_events()) {
         event = gui.process_events();
 
-        if (event == gui::GuiEvent::Exit)
+        if (event == gui::GuiEvent::Exit) {
+          // The emulation thread has to be done with the movie before it's written
+          emulator_thread.reset();
+          if (!options.record_input_path.empty())
+            emulator->stop_input_recording(options.record_input_path);
+          if (!options.block_profile_dir.empty())
+            emulator->save_block_profile();
           return 0;
+        }
+      }
+
+      // The GUI edits the settings of the emulator thread while it runs
+      const auto& settings = emulator_thread ? emulator_thread->settings() : emulator->settings();
+      if (settings.threaded_emulation && !emulator_thread) {
+        emulator_thread = std::make_unique<emulator::EmulatorThread>(*emulator);
+        gui.set_settings(&emulator_thread->settings());
+        gui.set_emulator_thread(emulator_thread.get());
+      } else if (!settings.threaded_emulation && emulator_thread) {
+        gui.set_emulator_thread(nullptr);
+        emulator_thread.reset();
+        gui.set_settings(&emulator->settings());
+      }
+
+      if (emulator_thread) {
+        emulator_thread->update_settings();
+        gui.apply_settings();
+
+        gui.clear();
+        emulator_thread->render();
+        // The debug windows read the emulator state, emulation waits for them
+        const bool is_gui_shown = emulator_thread->settings().show_gui;
+        if (is_gui_shown)
+          emulator_thread->pause();
+        gui.draw(*emulator);
+        if (is_gui_shown)
+          emulator_thread->resume();
+
+        gui.swap();
+        continue;
       }
+
       emulator->update_settings();
       gui.apply_settings();
 
@@ -77,10 +282,13 @@ s32 main(s32 argc, char** argv) {
       gui.draw(*emulator);
 
       gui.swap();
+      if (emulator->settings().limit_framerate && !emulator->settings().turbo)
+        pacer.wait(emulator->frame_cycles());
     }
   } catch (const std::exception& e) {
     LOG_CRITICAL("Exception: {}", e.what());
-    gui.deinit();
+    if (is_gui_init)
+      gui.deinit();
     assert(0);
   }
 
@@ -0,0 +1,318 @@
+#include <mdec/mdec.hpp>
+
+#include <util/log.hpp>
+#include <util/state_stream.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace mdec {
+
+namespace {
+
+constexpr u16 END_OF_BLOCK = 0xFE00;  // Also padding between blocks
+constexpr u32 WORDS_PER_MACROBLOCK[4] = {
+  BLOCK_SIZE / 8,                // 4 bit, one block of 8x8 pixels
+  BLOCK_SIZE / 4,                // 8 bit
+  MACROBLOCK_PIXELS * 3 / 4,     // 24 bit, 16x16 pixels
+  MACROBLOCK_PIXELS / 2,         // 15 bit
+};
+
+// Position in the block of each coefficient, in the zigzag order they come in
+constexpr std::array<u8, BLOCK_SIZE> ZIGZAG = { 0,  1,  5,  6,  14, 15, 27, 28, 2,  4,  7,  13, 16,
+                                                26, 29, 42, 3,  8,  12, 17, 25, 30, 41, 43, 9,  11,
+                                                18, 24, 31, 40, 44, 53, 10, 19, 23, 32, 39, 45, 52,
+                                                54, 20, 22, 33, 38, 46, 51, 55, 60, 21, 34, 37, 47,
+                                                50, 56, 59, 61, 35, 36, 48, 49, 57, 58, 62, 63 };
+
+constexpr std::array<u8, BLOCK_SIZE> make_zagzig() {
+  std::array<u8, BLOCK_SIZE> zagzig{};
+  for (u32 i = 0; i < BLOCK_SIZE; ++i)
+    zagzig[ZIGZAG[i]] = (u8)i;
+  return zagzig;
+}
+
+constexpr std::array<u8, BLOCK_SIZE> ZAGZIG = make_zagzig();
+
+s32 signed10(u16 value) {
+  return (s32)((u32)value << 22) >> 22;
+}
+
+// Run-length decodes and dequantizes the block at pos, moving pos past it. Without out the block is
+// only skipped over. False if the data ends first.
+bool decode_block(const u16* data, u32 size, u32& pos, const u8* quant, s16* out) {
+  while (pos < size && data[pos] == END_OF_BLOCK)
+    ++pos;
+  if (pos >= size)
+    return false;
+
+  const u16 dc = data[pos++];
+  const s32 q_scale = dc >> 10;
+  // Without a quantization scale the coefficients are taken as they are, in raster order
+  const auto store = [out, q_scale](u32 k, s32 value) {
+    out[q_scale > 0 ? ZAGZIG[k] : k] = (s16)std::clamp(value, -0x400, 0x3FF);
+  };
+
+  if (out) {
+    std::fill_n(out, BLOCK_SIZE, 0);
+    store(0, q_scale > 0 ? signed10(dc) * quant[0] : signed10(dc) * 2);
+  }
+
+  for (u32 k = 0; pos < size;) {
+    const u16 n = data[pos++];
+    k += (n >> 10) + 1;
+    if (out && k < BLOCK_SIZE)
+      store(k, q_scale > 0 ? (signed10(n) * quant[k] * q_scale + 4) / 8 : signed10(n) * 2);
+    if (k >= BLOCK_SIZE - 1)
+      return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+Mdec::Mdec()
+    : m_kernels(mdec_kernels()),
+      m_workers(std::clamp(std::thread::hardware_concurrency(), 2u, MAX_MDEC_WORKERS + 1) - 1) {}
+
+u32 Mdec::read_reg(address addr_rebased) {
+  if (addr_rebased == 0)  // Data/Response
+    return read_word();
+  return status();
+}
+
+void Mdec::write_reg(address addr_rebased, u32 val) {
+  if (addr_rebased == 0) {  // Command/Parameters
+    write_word(val);
+    return;
+  }
+
+  // Control
+  if (val & (1u << 31))
+    reset();
+  m_is_in_request_enabled = val & (1 << 30);
+  m_is_out_request_enabled = val & (1 << 29);
+}
+
+void Mdec::dma_write(const u32* words, u32 word_count) {
+  // Parameters go in as a whole, commands would only be found by themselves word by word
+  while (word_count > 0) {
+    if (m_remaining_params == 0) {
+      write_word(*words++);
+      --word_count;
+      continue;
+    }
+
+    const u32 count = std::min(word_count, m_remaining_params);
+    m_params.insert(m_params.end(), words, words + count);
+    words += count;
+    word_count -= count;
+    m_remaining_params -= count;
+    if (m_remaining_params == 0)
+      finish_command();
+  }
+}
+
+void Mdec::dma_read(u32* words, u32 word_count) {
+  wait_for_decode();
+
+  const u32 count = std::min<u32>(word_count, (u32)m_output.size() - m_output_pos);
+  std::memcpy(words, m_output.data() + m_output_pos, count * sizeof(u32));
+  m_output_pos += count;
+  if (count < word_count) {
+    LOG_WARN("MDEC-Out read of {} words past the end of the decoded data", word_count - count);
+    std::fill(words + count, words + word_count, 0);
+  }
+}
+
+void Mdec::write_word(u32 word) {
+  if (m_remaining_params == 0) {
+    start_command(word);
+    return;
+  }
+
+  m_params.push_back(word);
+  if (--m_remaining_params == 0)
+    finish_command();
+}
+
+void Mdec::start_command(u32 word) {
+  m_command.word = word;
+  m_params.clear();
+
+  switch (m_command.type) {
+    case 1: m_remaining_params = m_command.param_count; break;  // Decode macroblocks
+    case 2: m_remaining_params = (word & 1) ? 32 : 16; break;    // Set quant tables, color one too
+    case 3: m_remaining_params = 32; break;                      // Set scale table
+    default:
+      LOG_WARN("Unknown MDEC command 0x{:08X}", word);
+      m_remaining_params = 0;
+      break;
+  }
+
+  if (m_remaining_params == 0)
+    finish_command();
+}
+
+void Mdec::finish_command() {
+  switch (m_command.type) {
+    case 1: start_decode(); break;
+    case 2: {
+      const u8* bytes = reinterpret_cast<const u8*>(m_params.data());
+      std::copy_n(bytes, BLOCK_SIZE, m_luma_quant.begin());
+      if (m_params.size() == 32)
+        std::copy_n(bytes + BLOCK_SIZE, BLOCK_SIZE, m_color_quant.begin());
+      break;
+    }
+    case 3:
+      std::memcpy(m_scale.data(), m_params.data(), sizeof(m_scale));
+      for (u32 y = 0; y < 8; ++y)
+        for (u32 x = 0; x < 8; ++x)
+          m_scale_t[x * 8 + y] = m_scale[y * 8 + x];
+      break;
+    default: break;
+  }
+}
+
+void Mdec::start_decode() {
+  wait_for_decode();  // Its jobs read the previous data
+
+  m_decode = m_command;
+  m_decode_data.resize(m_params.size() * 2);
+  std::memcpy(m_decode_data.data(), m_params.data(), m_params.size() * sizeof(u32));
+
+  // Only block boundaries are found here, the blocks themselves are decoded by the workers
+  const u32 block_count = m_decode.is_color() ? MACROBLOCK_BLOCKS : 1;
+  const u32 size = (u32)m_decode_data.size();
+  m_macroblocks.clear();
+  for (u32 pos = 0; pos < size;) {
+    const u32 start = pos;
+    bool is_complete = true;
+    for (u32 b = 0; b < block_count && is_complete; ++b)
+      is_complete = decode_block(m_decode_data.data(), size, pos, nullptr, nullptr);
+    if (!is_complete)
+      break;  // The padding at the end
+    m_macroblocks.push_back(start);
+  }
+
+  const u32 macroblock_words = WORDS_PER_MACROBLOCK[m_decode.depth];
+  m_output.assign(m_macroblocks.size() * macroblock_words, 0);
+  m_output_pos = 0;
+
+  m_is_decoding = true;
+  m_workers.start((u32)m_macroblocks.size(), [this](u32 index) { decode_macroblock(index); });
+}
+
+void Mdec::decode_macroblock(u32 index) {
+  const u16* data = m_decode_data.data();
+  const u32 size = (u32)m_decode_data.size();
+  u32 pos = m_macroblocks[index];
+
+  const u32 macroblock_words = WORDS_PER_MACROBLOCK[m_decode.depth];
+  u8* out = reinterpret_cast<u8*>(m_output.data() + index * macroblock_words);
+  const u8 sign = m_decode.is_signed ? 0 : 0x80;
+
+  if (!m_decode.is_color()) {
+    alignas(16) std::array<s16, BLOCK_SIZE> block;
+    decode_block(data, size, pos, m_luma_quant.data(), block.data());
+    m_kernels.idct(block.data(), m_scale.data(), m_scale_t.data());
+
+    if (m_decode.output_depth() == OutputDepth::Bit8) {
+      for (u32 i = 0; i < BLOCK_SIZE; ++i)
+        out[i] = (u8)block[i] ^ sign;
+    } else {
+      for (u32 i = 0; i < BLOCK_SIZE; i += 2)
+        out[i / 2] = (((u8)block[i] ^ sign) >> 4) | (((u8)block[i + 1] ^ sign) & 0xF0);
+    }
+    return;
+  }
+
+  alignas(16) std::array<s16, MACROBLOCK_BLOCKS * BLOCK_SIZE> blocks;
+  for (u32 b = 0; b < MACROBLOCK_BLOCKS; ++b) {
+    s16* block = &blocks[b * BLOCK_SIZE];
+    decode_block(data, size, pos, b < 2 ? m_color_quant.data() : m_luma_quant.data(), block);
+    m_kernels.idct(block, m_scale.data(), m_scale_t.data());
+  }
+
+  std::array<u32, MACROBLOCK_PIXELS> pixels;
+  m_kernels.yuv_to_rgb(blocks.data(), m_decode.is_signed, pixels.data());
+
+  if (m_decode.output_depth() == OutputDepth::Bit24) {
+    for (u32 i = 0; i < MACROBLOCK_PIXELS; ++i)
+      std::memcpy(out + i * 3, &pixels[i], 3);
+  } else {
+    const u16 bit15 = m_decode.set_bit15 ? 0x8000 : 0;
+    for (u32 i = 0; i < MACROBLOCK_PIXELS; ++i) {
+      const u32 pixel = pixels[i];
+      const u16 rgb15 =
+          ((pixel >> 3) & 0x1F) | ((pixel >> 11) & 0x1F) << 5 | ((pixel >> 19) & 0x1F) << 10 | bit15;
+      std::memcpy(out + i * 2, &rgb15, 2);
+    }
+  }
+}
+
+void Mdec::wait_for_decode() {
+  if (m_is_decoding) {
+    m_workers.finish();
+    m_is_decoding = false;
+  }
+}
+
+u32 Mdec::read_word() {
+  if (!has_output()) {
+    LOG_WARN("MDEC data read with nothing to read");
+    return 0;
+  }
+
+  u32 word;
+  dma_read(&word, 1);
+  return word;
+}
+
+u32 Mdec::status() const {
+  u32 stat = 0;
+  if (!has_output())
+    stat |= 1u << 31;  // Data-Out FIFO empty
+  if (m_remaining_params > 0 || has_output())
+    stat |= 1 << 29;  // Command busy
+  if (m_is_in_request_enabled && m_remaining_params > 0)
+    stat |= 1 << 28;  // Data-In request
+  if (m_is_out_request_enabled && has_output())
+    stat |= 1 << 27;  // Data-Out request
+  stat |= ((m_command.word >> 25) & 0xF) << 23;  // Depth, signedness and bit 15 of the output
+  stat |= 4 << 16;  // Current block, Y of monochrome or Cr of color macroblocks as each one starts
+  stat |= (m_remaining_params - 1) & 0xFFFF;
+  return stat;
+}
+
+void Mdec::serialize(util::StateStream& s) {
+  wait_for_decode();
+
+  s.section("MDEC");
+  s.value(m_command);
+  s.value(m_remaining_params);
+  s.vector(m_params);
+  s.value(m_luma_quant);
+  s.value(m_color_quant);
+  s.value(m_scale);
+  s.value(m_scale_t);
+  s.value(m_is_in_request_enabled);
+  s.value(m_is_out_request_enabled);
+  s.value(m_decode);
+  s.vector(m_decode_data);
+  s.vector(m_macroblocks);
+  s.vector(m_output);
+  s.value(m_output_pos);
+}
+
+void Mdec::reset() {
+  wait_for_decode();
+  m_command = {};
+  m_remaining_params = 0;
+  m_params.clear();
+  m_output.clear();
+  m_output_pos = 0;
+}
+
+}  // namespace mdec
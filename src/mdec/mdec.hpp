@@ -0,0 +1,96 @@
+#pragma once
+
+#include <mdec/mdec_kernels.hpp>
+#include <mdec/mdec_workers.hpp>
+#include <util/types.hpp>
+
+#include <array>
+#include <vector>
+
+namespace util {
+class StateStream;
+}
+
+namespace mdec {
+
+enum class OutputDepth : u8 {
+  Bit4 = 0,   // Monochrome
+  Bit8 = 1,   // Monochrome
+  Bit24 = 2,
+  Bit15 = 3,
+};
+
+union MdecCommand {
+  u32 word{};
+
+  struct {
+    u32 param_count : 16;  // Parameter words of a decode command
+    u32 : 9;
+    u32 set_bit15 : 1;  // Of 15 bit pixels
+    u32 is_signed : 1;
+    u32 depth : 2;  // OutputDepth
+    u32 type : 3;   // 1=Decode macroblocks, 2=Set quant tables, 3=Set scale table
+  };
+
+  OutputDepth output_depth() const { return static_cast<OutputDepth>(depth); }
+  bool is_color() const { return depth >= 2; }
+};
+
+// Macroblock decoder, turning the run-length coded DCT coefficients of FMV frames into pixels. The
+// compressed data of a decode command is taken as a whole, the macroblocks are found in it and then
+// decoded in parallel: run-length decoding and dequantization, the inverse DCT and the conversion to
+// RGB with SIMD kernels (see mdec/mdec_kernels.hpp). The output is only waited for when it's read.
+// https://psx-spx.consoledev.net/macroblockdecodermdec/
+class Mdec {
+ public:
+  Mdec();
+
+  u32 read_reg(address addr_rebased);
+  void write_reg(address addr_rebased, u32 val);
+
+  // DMA to MDEC-In and from MDEC-Out, word_count words at once
+  void dma_write(const u32* words, u32 word_count);
+  void dma_read(u32* words, u32 word_count);
+  // Has output left to read, for MDEC-Out transfers
+  bool has_output() const { return m_output_pos < m_output.size(); }
+
+  // Waits for the macroblocks being decoded first
+  void serialize(util::StateStream& s);
+
+ private:
+  void write_word(u32 word);
+  void start_command(u32 word);
+  void finish_command();  // Once all the parameter words are in
+  void start_decode();
+  void decode_macroblock(u32 index);
+  void wait_for_decode();
+  u32 read_word();
+  u32 status() const;
+  void reset();
+
+ private:
+  const MdecKernels& m_kernels;
+  MdecWorkers m_workers;
+
+  MdecCommand m_command{};
+  u32 m_remaining_params{};  // Parameter words still expected by the current command
+  std::vector<u32> m_params;
+
+  std::array<u8, BLOCK_SIZE> m_luma_quant{};
+  std::array<u8, BLOCK_SIZE> m_color_quant{};
+  std::array<s16, BLOCK_SIZE> m_scale{};
+  std::array<s16, BLOCK_SIZE> m_scale_t{};  // Transposed
+
+  bool m_is_in_request_enabled{};
+  bool m_is_out_request_enabled{};
+
+  // Decode in progress, or done
+  MdecCommand m_decode{};           // The command, m_command may have moved on
+  std::vector<u16> m_decode_data;   // Its compressed data, as halfwords
+  std::vector<u32> m_macroblocks;   // Where each macroblock starts in it
+  bool m_is_decoding{};             // Its batch isn't finished yet
+  std::vector<u32> m_output;
+  u32 m_output_pos{};
+};
+
+}  // namespace mdec
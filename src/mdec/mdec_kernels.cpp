@@ -0,0 +1,75 @@
+#include <mdec/mdec_kernels.hpp>
+
+#include <util/log.hpp>
+
+#include <algorithm>
+
+namespace mdec {
+
+namespace {
+
+// out = c x m, sums rounded and shifted right, saturated to 16 bits
+void mat_mul_scalar(const s16* c, const s16* m, u32 shift, s16* out) {
+  for (u32 y = 0; y < 8; ++y) {
+    for (u32 x = 0; x < 8; ++x) {
+      u32 sum = 1u << (shift - 1);
+      for (u32 u = 0; u < 8; ++u)
+        sum += (u32)((s32)c[y * 8 + u] * m[u * 8 + x]);
+      out[y * 8 + x] = (s16)std::clamp((s32)sum >> shift, -0x8000, 0x7FFF);
+    }
+  }
+}
+
+void idct_scalar(s16* block, const s16* scale, const s16* scale_t) {
+  std::array<s16, BLOCK_SIZE> temp;
+  mat_mul_scalar(scale_t, block, IDCT_FIRST_SHIFT, temp.data());
+  mat_mul_scalar(temp.data(), scale, IDCT_SECOND_SHIFT, block);
+  for (u32 i = 0; i < BLOCK_SIZE; ++i)
+    block[i] = idct_pixel(block[i]);
+}
+
+void yuv_to_rgb_scalar(const s16* blocks, bool is_signed, u32* out) {
+  const s16* cr = blocks;
+  const s16* cb = blocks + BLOCK_SIZE;
+  const auto channel = [](s32 value) { return (u32)(u8)std::clamp(value, -128, 127); };
+
+  for (u32 py = 0; py < 16; ++py) {
+    for (u32 px = 0; px < 16; ++px) {
+      const s16* luma = blocks + (2 + (py / 8) * 2 + px / 8) * BLOCK_SIZE;
+      const s32 y = luma[(py % 8) * 8 + px % 8];
+      const u32 c = (py / 2) * 8 + px / 2;
+
+      const u32 r = channel(y + ((CR_TO_R * cr[c]) >> 8));
+      const u32 g = channel(y + ((CB_TO_G * cb[c] + CR_TO_G * cr[c]) >> 8));
+      const u32 b = channel(y + ((CB_TO_B * cb[c]) >> 8));
+      const u32 pixel = r | g << 8 | b << 16;
+      out[py * 16 + px] = is_signed ? pixel : pixel ^ 0x808080;
+    }
+  }
+}
+
+constexpr MdecKernels SCALAR_KERNELS = { "scalar", idct_scalar, yuv_to_rgb_scalar };
+
+const MdecKernels& select_mdec_kernels() {
+  const MdecKernels* kernels = mdec_kernels_sse41();
+  if (kernels == nullptr)
+    kernels = mdec_kernels_neon();
+  if (kernels == nullptr)
+    kernels = &SCALAR_KERNELS;
+
+  LOG_INFO("Using {} MDEC kernels", kernels->name);
+  return *kernels;
+}
+
+}  // namespace
+
+const MdecKernels& mdec_kernels() {
+  static const MdecKernels& kernels = select_mdec_kernels();
+  return kernels;
+}
+
+const MdecKernels& mdec_kernels_scalar() {
+  return SCALAR_KERNELS;
+}
+
+}  // namespace mdec
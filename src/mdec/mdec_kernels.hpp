@@ -0,0 +1,71 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <array>
+
+// MDEC kernels turn the coefficients of decoded blocks into pixels: the inverse DCT of each 8x8 block,
+// then the conversion of a macroblock from YUV to RGB. There is a scalar reference implementation, and
+// SIMD ones picked at runtime depending on what the host CPU supports, all of them bit identical.
+//
+// The inverse DCT is two 8x8 matrix products with the scale table, in 16 bit fixed point with 32 bit
+// sums: the multiply-adds of pairs of 16 bit lanes most instruction sets have. Sums wrap around and
+// the first product is rounded and saturated back to 16 bits, the way the SIMD kernels do it.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MDEC_KERNELS_X86 1
+#else
+#define MDEC_KERNELS_X86 0
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define MDEC_KERNELS_NEON 1
+#else
+#define MDEC_KERNELS_NEON 0
+#endif
+
+namespace mdec {
+
+constexpr u32 BLOCK_SIZE = 64;  // 8x8 coefficients, or pixels
+// Cr, Cb, then Y of the top left, top right, bottom left and bottom right 8x8 pixels
+constexpr u32 MACROBLOCK_BLOCKS = 6;
+constexpr u32 MACROBLOCK_PIXELS = 16 * 16;
+
+// Bits dropped after each of the two products of the inverse DCT, 32 in all for the two factors of the
+// scale table
+constexpr u32 IDCT_FIRST_SHIFT = 15;
+constexpr u32 IDCT_SECOND_SHIFT = 17;
+
+// YUV to RGB, 8.8 fixed point: R = Y + 1.402 Cr, G = Y - 0.3437 Cb - 0.7143 Cr, B = Y + 1.772 Cb
+// https://psx-spx.consoledev.net/macroblockdecodermdec/#mdec-decompression
+constexpr s32 CR_TO_R = 359;
+constexpr s32 CB_TO_G = -88;
+constexpr s32 CR_TO_G = -183;
+constexpr s32 CB_TO_B = 454;
+
+// Pixels of the inverse DCT are signed 9 bit, saturated to 8
+inline s16 idct_pixel(s16 value) {
+  const s16 extended = (s16)((u16)value << 7) >> 7;
+  return extended < -128 ? -128 : (extended > 127 ? 127 : extended);
+}
+
+struct MdecKernels {
+  const char* name;
+
+  // The 64 coefficients of block into signed 8 bit pixels in place: scale^T x block x scale.
+  // scale_t is the transposed scale table.
+  void (*idct)(s16* block, const s16* scale, const s16* scale_t);
+  // The MACROBLOCK_PIXELS pixels of a macroblock from its 6 blocks, as 0x00BBGGRR in rows of 16.
+  // Unsigned pixels have 128 added to each channel.
+  void (*yuv_to_rgb)(const s16* blocks, bool is_signed, u32* out);
+};
+
+// Kernels for the best instruction set available
+const MdecKernels& mdec_kernels();
+
+// Per instruction set kernels, null if not built in or not supported by the host
+const MdecKernels& mdec_kernels_scalar();
+const MdecKernels* mdec_kernels_sse41();
+const MdecKernels* mdec_kernels_neon();
+
+}  // namespace mdec
@@ -0,0 +1,94 @@
+#include <mdec/mdec_kernels.hpp>
+
+#if MDEC_KERNELS_NEON
+
+#include <arm_neon.h>
+
+// AArch64 always has NEON, no runtime check is needed
+
+namespace mdec {
+
+namespace {
+
+// out = c x m: each row of out sums the rows of m scaled by the coefficients of the row of c
+void mat_mul_neon(const s16* c, const s16* m, u32 shift, s16* out) {
+  int16x8_t rows[8];
+  for (u32 u = 0; u < 8; ++u)
+    rows[u] = vld1q_s16(m + u * 8);
+
+  const int32x4_t round = vdupq_n_s32(1 << (shift - 1));
+  const int32x4_t count = vdupq_n_s32(-(s32)shift);
+  for (u32 y = 0; y < 8; ++y) {
+    int32x4_t low = round;
+    int32x4_t high = round;
+    for (u32 u = 0; u < 8; ++u) {
+      low = vmlal_n_s16(low, vget_low_s16(rows[u]), c[y * 8 + u]);
+      high = vmlal_n_s16(high, vget_high_s16(rows[u]), c[y * 8 + u]);
+    }
+    const int16x4_t row_low = vqmovn_s32(vshlq_s32(low, count));
+    const int16x4_t row_high = vqmovn_s32(vshlq_s32(high, count));
+    vst1q_s16(out + y * 8, vcombine_s16(row_low, row_high));
+  }
+}
+
+void idct_neon(s16* block, const s16* scale, const s16* scale_t) {
+  s16 temp[BLOCK_SIZE];
+  mat_mul_neon(scale_t, block, IDCT_FIRST_SHIFT, temp);
+  mat_mul_neon(temp, scale, IDCT_SECOND_SHIFT, block);
+
+  for (u32 i = 0; i < BLOCK_SIZE; i += 8) {
+    const int16x8_t row = vshrq_n_s16(vshlq_n_s16(vld1q_s16(block + i), 7), 7);
+    vst1q_s16(block + i, vmaxq_s16(vminq_s16(row, vdupq_n_s16(127)), vdupq_n_s16(-128)));
+  }
+}
+
+// 8 pixels of a channel, saturated to signed 8 bits. The 4 chroma samples are duplicated for both
+// pixels sharing them.
+int8x8_t rgb_channel(int16x8_t y, int16x4_t cb, int16x4_t cr, s16 cb_coef, s16 cr_coef) {
+  const int32x4_t sum = vmlal_n_s16(vmull_n_s16(cb, cb_coef), cr, cr_coef);
+  const int16x4_t term = vmovn_s32(vshrq_n_s32(sum, 8));
+  const int16x4x2_t doubled = vzip_s16(term, term);
+  return vqmovn_s16(vaddq_s16(y, vcombine_s16(doubled.val[0], doubled.val[1])));
+}
+
+void yuv_to_rgb_neon(const s16* blocks, bool is_signed, u32* out) {
+  const uint8x8_t sign = vdup_n_u8(is_signed ? 0 : 0x80);
+
+  for (u32 py = 0; py < 16; ++py) {
+    const s16* chroma = blocks + (py / 2) * 8;
+    for (u32 h = 0; h < 2; ++h) {
+      const int16x4_t cr = vld1_s16(chroma + h * 4);
+      const int16x4_t cb = vld1_s16(chroma + BLOCK_SIZE + h * 4);
+      const int16x8_t y = vld1q_s16(blocks + (2 + (py / 8) * 2 + h) * BLOCK_SIZE + (py % 8) * 8);
+
+      uint8x8x4_t pixels;
+      pixels.val[0] = veor_u8(vreinterpret_u8_s8(rgb_channel(y, cb, cr, 0, CR_TO_R)), sign);
+      pixels.val[1] = veor_u8(vreinterpret_u8_s8(rgb_channel(y, cb, cr, CB_TO_G, CR_TO_G)), sign);
+      pixels.val[2] = veor_u8(vreinterpret_u8_s8(rgb_channel(y, cb, cr, CB_TO_B, 0)), sign);
+      pixels.val[3] = vdup_n_u8(0);
+      vst4_u8((u8*)(out + py * 16 + h * 8), pixels);
+    }
+  }
+}
+
+constexpr MdecKernels NEON_KERNELS = { "NEON", idct_neon, yuv_to_rgb_neon };
+
+}  // namespace
+
+const MdecKernels* mdec_kernels_neon() {
+  return &NEON_KERNELS;
+}
+
+}  // namespace mdec
+
+#else
+
+namespace mdec {
+
+const MdecKernels* mdec_kernels_neon() {
+  return nullptr;
+}
+
+}  // namespace mdec
+
+#endif
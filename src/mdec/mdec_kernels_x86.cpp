@@ -0,0 +1,121 @@
+#include <mdec/mdec_kernels.hpp>
+
+#if MDEC_KERNELS_X86
+
+#include <immintrin.h>
+
+#include <cstring>
+
+// Kernels are compiled for their instruction set through function attributes, see
+// renderer/span_kernels_x86.cpp
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+
+namespace mdec {
+
+namespace {
+
+// out = c x m: each row of out sums the rows of m scaled by the coefficients of the row of c, two rows
+// of m at a time with multiply-adds of interleaved pairs
+TARGET_SSE41 void mat_mul_sse41(const s16* c, const s16* m, u32 shift, s16* out) {
+  __m128i pairs[4][2];
+  for (u32 p = 0; p < 4; ++p) {
+    const __m128i first = _mm_loadu_si128((const __m128i*)(m + p * 16));
+    const __m128i second = _mm_loadu_si128((const __m128i*)(m + p * 16 + 8));
+    pairs[p][0] = _mm_unpacklo_epi16(first, second);
+    pairs[p][1] = _mm_unpackhi_epi16(first, second);
+  }
+
+  const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+  const __m128i count = _mm_cvtsi32_si128((s32)shift);
+  for (u32 y = 0; y < 8; ++y) {
+    __m128i low = round;
+    __m128i high = round;
+    for (u32 p = 0; p < 4; ++p) {
+      s32 coefs;
+      std::memcpy(&coefs, c + y * 8 + p * 2, sizeof(coefs));
+      const __m128i coef = _mm_set1_epi32(coefs);
+      low = _mm_add_epi32(low, _mm_madd_epi16(pairs[p][0], coef));
+      high = _mm_add_epi32(high, _mm_madd_epi16(pairs[p][1], coef));
+    }
+    const __m128i row = _mm_packs_epi32(_mm_sra_epi32(low, count), _mm_sra_epi32(high, count));
+    _mm_storeu_si128((__m128i*)(out + y * 8), row);
+  }
+}
+
+TARGET_SSE41 void idct_sse41(s16* block, const s16* scale, const s16* scale_t) {
+  alignas(16) s16 temp[BLOCK_SIZE];
+  mat_mul_sse41(scale_t, block, IDCT_FIRST_SHIFT, temp);
+  mat_mul_sse41(temp, scale, IDCT_SECOND_SHIFT, block);
+
+  const __m128i min = _mm_set1_epi16(-128);
+  const __m128i max = _mm_set1_epi16(127);
+  for (u32 i = 0; i < BLOCK_SIZE; i += 8) {
+    __m128i row = _mm_loadu_si128((const __m128i*)(block + i));
+    row = _mm_srai_epi16(_mm_slli_epi16(row, 7), 7);
+    _mm_storeu_si128((__m128i*)(block + i), _mm_max_epi16(_mm_min_epi16(row, max), min));
+  }
+}
+
+// Chroma term of 4 pixel pairs, from interleaved (Cb, Cr) samples, each duplicated for both pixels
+TARGET_SSE41 __m128i chroma_term(__m128i pairs, s32 cb_coef, s32 cr_coef) {
+  const __m128i coefs = _mm_set1_epi32((s32)(u16)cb_coef | cr_coef * 0x10000);
+  const __m128i term = _mm_srai_epi32(_mm_madd_epi16(pairs, coefs), 8);
+  const __m128i packed = _mm_packs_epi32(term, term);
+  return _mm_unpacklo_epi16(packed, packed);
+}
+
+// 8 pixels of a channel as bytes, saturated to signed 8 bits by the packing
+TARGET_SSE41 __m128i rgb_channel(__m128i y, __m128i pairs, s32 cb_coef, s32 cr_coef, __m128i sign) {
+  const __m128i sum = _mm_add_epi16(y, chroma_term(pairs, cb_coef, cr_coef));
+  return _mm_xor_si128(_mm_packs_epi16(sum, _mm_setzero_si128()), sign);
+}
+
+TARGET_SSE41 void yuv_to_rgb_sse41(const s16* blocks, bool is_signed, u32* out) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i sign = _mm_set1_epi8(is_signed ? 0 : (char)0x80);
+
+  for (u32 py = 0; py < 16; ++py) {
+    const s16* chroma = blocks + (py / 2) * 8;
+    const __m128i cr = _mm_loadu_si128((const __m128i*)chroma);
+    const __m128i cb = _mm_loadu_si128((const __m128i*)(chroma + BLOCK_SIZE));
+    const __m128i halves[2] = { _mm_unpacklo_epi16(cb, cr), _mm_unpackhi_epi16(cb, cr) };
+
+    for (u32 h = 0; h < 2; ++h) {
+      const s16* luma = blocks + (2 + (py / 8) * 2 + h) * BLOCK_SIZE + (py % 8) * 8;
+      const __m128i y = _mm_loadu_si128((const __m128i*)luma);
+
+      const __m128i r = rgb_channel(y, halves[h], 0, CR_TO_R, sign);
+      const __m128i g = rgb_channel(y, halves[h], CB_TO_G, CR_TO_G, sign);
+      const __m128i b = rgb_channel(y, halves[h], CB_TO_B, 0, sign);
+
+      const __m128i rg = _mm_unpacklo_epi8(r, g);
+      const __m128i b0 = _mm_unpacklo_epi8(b, zero);
+      u32* dest = out + py * 16 + h * 8;
+      _mm_storeu_si128((__m128i*)dest, _mm_unpacklo_epi16(rg, b0));
+      _mm_storeu_si128((__m128i*)(dest + 4), _mm_unpackhi_epi16(rg, b0));
+    }
+  }
+}
+
+constexpr MdecKernels SSE41_KERNELS = { "SSE4.1", idct_sse41, yuv_to_rgb_sse41 };
+
+}  // namespace
+
+const MdecKernels* mdec_kernels_sse41() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.1") ? &SSE41_KERNELS : nullptr;
+}
+
+}  // namespace mdec
+
+#else
+
+namespace mdec {
+
+const MdecKernels* mdec_kernels_sse41() {
+  return nullptr;
+}
+
+}  // namespace mdec
+
+#endif
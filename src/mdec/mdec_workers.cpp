@@ -0,0 +1,69 @@
+#include <mdec/mdec_workers.hpp>
+
+namespace mdec {
+
+MdecWorkers::MdecWorkers(u32 worker_count) {
+  for (u32 i = 0; i < worker_count; ++i)
+    m_threads.emplace_back(&MdecWorkers::run, this);
+}
+
+MdecWorkers::~MdecWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+
+  for (auto& thread : m_threads)
+    thread.join();
+}
+
+void MdecWorkers::start(u32 count, std::function<void(u32)> job) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // A worker that woke up late for the previous batch may still be finding out there's nothing left.
+    // None can start going through it while the lock is held.
+    while (m_active.load(std::memory_order_acquire) != 0)
+      std::this_thread::yield();
+
+    m_job = std::move(job);
+    m_count = count;
+    m_next.store(0, std::memory_order_relaxed);
+    m_done.store(0, std::memory_order_relaxed);
+    ++m_generation;
+  }
+  m_wake.notify_all();
+}
+
+void MdecWorkers::finish() {
+  work();
+  while (m_done.load(std::memory_order_acquire) != m_count)
+    std::this_thread::yield();
+}
+
+void MdecWorkers::run() {
+  u32 generation = 0;
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  while (true) {
+    m_wake.wait(lock, [this, generation]() { return m_quit || m_generation != generation; });
+    if (m_quit)
+      return;
+    generation = m_generation;
+
+    m_active.fetch_add(1, std::memory_order_relaxed);
+    lock.unlock();
+    work();
+    m_active.fetch_sub(1, std::memory_order_release);
+    lock.lock();
+  }
+}
+
+void MdecWorkers::work() {
+  for (u32 i = m_next.fetch_add(1); i < m_count; i = m_next.fetch_add(1)) {
+    m_job(i);
+    m_done.fetch_add(1, std::memory_order_release);
+  }
+}
+
+}  // namespace mdec
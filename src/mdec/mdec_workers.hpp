@@ -0,0 +1,48 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mdec {
+
+constexpr u32 MAX_MDEC_WORKERS = 4;
+
+// Runs the jobs of a batch, each one a macroblock, on a pool of threads. They are handed out one at a
+// time through an atomic counter, and the thread waiting for the batch takes its share of them too, so
+// a batch always gets done even when the workers are busy elsewhere.
+class MdecWorkers {
+ public:
+  explicit MdecWorkers(u32 worker_count);
+  ~MdecWorkers();
+
+  // Starts job(i) for each i below count, the previous batch must be finished
+  void start(u32 count, std::function<void(u32)> job);
+  // Runs what's left of the batch on the calling thread, then waits for the jobs still running
+  void finish();
+
+ private:
+  void run();
+  // Runs jobs until there are none left to start
+  void work();
+
+  std::vector<std::thread> m_threads;
+
+  std::function<void(u32)> m_job;
+  u32 m_count{};
+  std::atomic<u32> m_next{};
+  std::atomic<u32> m_done{};
+  std::atomic<u32> m_active{};  // Workers going through the batch
+
+  u32 m_generation{};  // Bumped by start()
+  bool m_quit{};
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+};
+
+}  // namespace mdec
@@ -0,0 +1,136 @@
+#include <memory/address_space.hpp>
+
+#include <util/log.hpp>
+
+#include <cerrno>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ADDRESS_SPACE_ARENA_SUPPORTED 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <string>
+#else
+#define ADDRESS_SPACE_ARENA_SUPPORTED 0
+#endif
+
+namespace memory {
+
+namespace {
+
+#if ADDRESS_SPACE_ARENA_SUPPORTED
+
+// Anonymous shared memory, the file descriptor is all that refers to it
+int create_shared_memory() {
+#if defined(__linux__)
+  return memfd_create("pctation-memory", MFD_CLOEXEC);
+#else
+  const std::string name = "/pctation-memory-" + std::to_string(getpid());
+  const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd >= 0)
+    shm_unlink(name.c_str());
+  return fd;
+#endif
+}
+
+#endif
+
+}  // namespace
+
+AddressSpace::AddressSpace() {
+  if (map_arena()) {
+    LOG_INFO("Guest memory mapped in a {} MB arena", ADDRESS_SPACE_SIZE / (1024 * 1024));
+    return;
+  }
+
+  LOG_INFO("Guest memory allocated separately, without an arena");
+  m_fallback_storage = std::make_unique<byte[]>(STORAGE_SIZE);
+  m_ram = m_fallback_storage.get() + RAM_OFFSET;
+  m_scratchpad = m_fallback_storage.get() + SCRATCHPAD_OFFSET;
+  m_bios = m_fallback_storage.get() + BIOS_OFFSET;
+  m_expansion1 = m_fallback_storage.get() + EXPANSION_1_OFFSET;
+}
+
+AddressSpace::~AddressSpace() {
+  unmap_arena();
+}
+
+bool AddressSpace::map_arena() {
+#if ADDRESS_SPACE_ARENA_SUPPORTED
+  // Each memory has to start and end on host pages, and the scratchpad page has the I/O ports right
+  // after it
+  const long host_page_size = sysconf(_SC_PAGESIZE);
+  if (host_page_size <= 0 || host_page_size > (long)BUS_PAGE_SIZE)
+    return false;
+
+  const int fd = create_shared_memory();
+  if (fd < 0) {
+    LOG_WARN("Could not create the guest memory: {}", std::strerror(errno));
+    return false;
+  }
+  if (ftruncate(fd, STORAGE_SIZE) != 0) {
+    LOG_WARN("Could not size the guest memory: {}", std::strerror(errno));
+    close(fd);
+    return false;
+  }
+
+  void* reserved =
+      mmap(nullptr, ADDRESS_SPACE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserved == MAP_FAILED) {
+    LOG_WARN("Could not reserve the guest address space: {}", std::strerror(errno));
+    close(fd);
+    return false;
+  }
+  m_base = static_cast<byte*>(reserved);
+
+  const struct {
+    address start;
+    u32 size;
+    size_t offset;
+  } views[] = {
+    { map::RAM_MIRRORS.start() + 0 * RAM_SIZE, RAM_SIZE, RAM_OFFSET },
+    { map::RAM_MIRRORS.start() + 1 * RAM_SIZE, RAM_SIZE, RAM_OFFSET },
+    { map::RAM_MIRRORS.start() + 2 * RAM_SIZE, RAM_SIZE, RAM_OFFSET },
+    { map::RAM_MIRRORS.start() + 3 * RAM_SIZE, RAM_SIZE, RAM_OFFSET },
+    { map::SCRATCHPAD.start(), BUS_PAGE_SIZE, SCRATCHPAD_OFFSET },
+    { map::BIOS.start(), BIOS_SIZE, BIOS_OFFSET },
+    { map::EXPANSION_1.start(), EXPANSION_1_SIZE, EXPANSION_1_OFFSET },
+  };
+  static_assert(map::RAM_MIRRORS.size() == 4 * RAM_SIZE);
+
+  for (const auto& view : views) {
+    void* mapped = mmap(m_base + view.start, view.size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                        fd, (off_t)view.offset);
+    if (mapped == MAP_FAILED) {
+      LOG_WARN("Could not map guest memory at 0x{:08X}: {}", view.start, std::strerror(errno));
+      close(fd);
+      unmap_arena();
+      return false;
+    }
+  }
+
+  // The views keep their own reference to the memory
+  close(fd);
+
+  m_ram = m_base + map::RAM.start();
+  m_scratchpad = m_base + map::SCRATCHPAD.start();
+  m_bios = m_base + map::BIOS.start();
+  m_expansion1 = m_base + map::EXPANSION_1.start();
+  return true;
+#else
+  return false;
+#endif
+}
+
+void AddressSpace::unmap_arena() {
+#if ADDRESS_SPACE_ARENA_SUPPORTED
+  // Takes the views along with the reservation
+  if (m_base != nullptr)
+    munmap(m_base, ADDRESS_SPACE_SIZE);
+#endif
+  m_base = nullptr;
+}
+
+}  // namespace memory
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <memory/map.hpp>
+#include <util/types.hpp>
+
+#include <cstddef>
+#include <memory>
+
+namespace memory {
+
+// The physical address space covered by the arena, everything past it is I/O or unused
+constexpr u32 ADDRESS_SPACE_SIZE = 0x20000000;
+
+// Host storage of the guest's memories, one contiguous reservation of ADDRESS_SPACE_SIZE bytes of the
+// host address space where each memory lives at its physical address: RAM (mapped at each of its 4
+// mirrors as views of the same shared memory), the scratchpad, the BIOS and expansion 1. The rest of
+// the range stays inaccessible, so reaching an I/O port through base() faults instead of silently
+// hitting memory, and code with a single base pointer (e.g. generated code) can access any of it.
+//
+// Only on POSIX hosts with pages of at most BUS_PAGE_SIZE bytes, elsewhere (or if the host runs out of
+// address space) each memory gets a separate allocation and base() is null. The bus maps pages the same
+// way in both cases.
+class AddressSpace {
+ public:
+  AddressSpace();
+  AddressSpace(const AddressSpace&) = delete;
+  AddressSpace& operator=(const AddressSpace&) = delete;
+  ~AddressSpace();
+
+  // Start of the arena, host address of physical address 0. Null if memories are allocated separately.
+  byte* base() const { return m_base; }
+  bool is_arena() const { return m_base != nullptr; }
+
+  // Zeroed storage of each memory
+  byte* ram() const { return m_ram; }
+  // A whole bus page for the arena to map it, only the first SCRATCHPAD_SIZE bytes of it are used
+  byte* scratchpad() const { return m_scratchpad; }
+  byte* bios() const { return m_bios; }
+  byte* expansion1() const { return m_expansion1; }
+
+ private:
+  // Layout of the shared memory behind the arena, or of the fallback allocation
+  static constexpr size_t RAM_OFFSET = 0;
+  static constexpr size_t SCRATCHPAD_OFFSET = RAM_OFFSET + RAM_SIZE;
+  static constexpr size_t BIOS_OFFSET = SCRATCHPAD_OFFSET + BUS_PAGE_SIZE;
+  static constexpr size_t EXPANSION_1_OFFSET = BIOS_OFFSET + BIOS_SIZE;
+  static constexpr size_t STORAGE_SIZE = EXPANSION_1_OFFSET + EXPANSION_1_SIZE;
+
+  // Reserves the range and maps the memories in it, false (with nothing left mapped) on failure
+  bool map_arena();
+  void unmap_arena();
+
+  byte* m_base{};
+  std::unique_ptr<byte[]> m_fallback_storage;
+
+  byte* m_ram{};
+  byte* m_scratchpad{};
+  byte* m_bios{};
+  byte* m_expansion1{};
+};
+
+}  // namespace memory
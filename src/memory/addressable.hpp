@@ -2,32 +2,33 @@
 
 #include <util/types.hpp>
 
-#include <algorithm>
-#include <array>
-#include <memory>
+#include <cstddef>
 
 namespace memory {
 
+// A memory of MemorySize bytes, its storage is owned by the AddressSpace (see
+// memory/address_space.hpp)
 template <size_t MemorySize>
 class Addressable {
  public:
-  Addressable() {
-    m_data = std::make_unique<std::array<byte, MemorySize>>();
-    std::fill(m_data->begin(), m_data->end(), 0xDE);
-  }
+  explicit Addressable(byte* data) : m_data(data) {}
 
   template <typename ValueType>
   ValueType read(address addr) const {
-    return *(ValueType*)(m_data.get()->data() + addr);
+    return *(ValueType*)(m_data + addr);
   }
 
   template <typename ValueType>
   void write(address addr, ValueType val) {
-    *(ValueType*)(m_data.get()->data() + addr) = val;
+    *(ValueType*)(m_data + addr) = val;
   }
 
+  // Raw backing storage, used by the bus to map pages directly
+  byte* host_ptr() { return m_data; }
+  const byte* host_ptr() const { return m_data; }
+
  protected:
-  std::unique_ptr<std::array<byte, MemorySize>> m_data;
+  byte* const m_data;
 };
 
 }  // namespace memory
@@ -1,18 +1,58 @@
 #include <memory/dma.hpp>
 
 #include <cpu/interrupt.hpp>
+#include <emulator/scheduler.hpp>
 #include <gpu/gpu.hpp>
 #include <io/cdrom_drive.hpp>
+#include <mdec/mdec.hpp>
 #include <memory/dma_channel.hpp>
 #include <memory/ram.hpp>
+#include <spu/spu.hpp>
 #include <util/log.hpp>
+#include <util/profiler.hpp>
+#include <util/state_stream.hpp>
 
 #include <gsl-lite.hpp>
 
+#include <algorithm>
+
 namespace memory {
 
 constexpr u32 RAM_ADDR_MASK = 0x1FFFFC;
 
+namespace {
+
+// Calls span(addr, count) for the contiguous pieces of word_count words of RAM from addr on, addresses
+// wrap around at the end of RAM
+template <typename Span>
+void for_each_ram_span(address addr, u32 word_count, Span span) {
+  while (word_count > 0) {
+    const u32 count = std::min(word_count, (RAM_ADDR_MASK + 4 - addr) / 4);
+    span(addr, count);
+    addr = (addr + count * 4) & RAM_ADDR_MASK;
+    word_count -= count;
+  }
+}
+
+}  // namespace
+
+Dma::Dma(memory::Ram& ram,
+         gpu::Gpu& gpu,
+         cpu::Interrupts& interrupts,
+         io::CdromDrive& cdrom,
+         mdec::Mdec& mdec,
+         spu::Spu& spu,
+         emulator::Scheduler& scheduler)
+    : m_ram(ram),
+      m_gpu(gpu),
+      m_interrupts(interrupts),
+      m_cdrom(cdrom),
+      m_mdec(mdec),
+      m_spu(spu),
+      m_scheduler(scheduler) {
+  m_scheduler.set_callback(emulator::EventType::DmaIrq, [this]() { raise_pending_irq(); });
+}
+
 DmaChannel const& Dma::channel_control(DmaPort port) const {
   const auto port_index = (u32)port;
   Expects(port_index < 7);
@@ -25,7 +65,15 @@ DmaChannel& Dma::channel_control(DmaPort port) {
   return m_channels[port_index];
 }
 
-void Dma::step() {
+void Dma::serialize(util::StateStream& s) {
+  s.section("DMA ");
+  s.value(m_reg_control);
+  s.value(m_reg_interrupt);
+  s.value(m_irq_pending);
+  s.value(m_channels);
+}
+
+void Dma::raise_pending_irq() {
   if (m_irq_pending) {
     m_irq_pending = false;
     m_interrupts.trigger(cpu::IrqType::DMA);
@@ -33,6 +81,7 @@ void Dma::step() {
 }
 
 void Dma::do_transfer(DmaPort port) {
+  PROFILE_SCOPE(Dma);
   auto& channel = channel_control(port);
 
   switch (channel.sync_mode()) {
@@ -51,12 +100,21 @@ void Dma::do_block_transfer(DmaPort port) {
 
   address addr = channel.m_base_addr;
 
+  // Waits for the MDEC to have something to output, the transfer is carried out once MDEC-In has fed it
+  if (port == DmaPort::MdecOut && !m_mdec.has_output())
+    return;
+
   u32 transfer_word_count = channel.transfer_word_count();
 
   LOG_DEBUG("Starting DMA block transfer: {} {} RAM, sync mode: {}", dma_port_to_str(port),
             channel.to_ram() ? "to" : "from", channel.sync_mode_str());
 
-  // TODO: optimize for the few combinations that are actually used
+  // The few combinations that are actually used go over RAM as a whole, the rest word by word below
+  const bool is_forward = addr_step > 0;
+  if (do_bulk_transfer(port, channel.to_ram(), is_forward, addr & RAM_ADDR_MASK, transfer_word_count)) {
+    block_transfer_finished(channel, port);
+    return;
+  }
 
   while (transfer_word_count > 0) {
     const auto addr_cur = addr & RAM_ADDR_MASK;
@@ -66,10 +124,7 @@ void Dma::do_block_transfer(DmaPort port) {
         u32 src_word{};
 
         switch (port) {
-          case DmaPort::MdecOut:
-            // TODO
-            LOG_INFO("DMA transfer of word 0x{:08X} to MDEC-Out port", src_word);
-            break;
+          case DmaPort::MdecOut: m_mdec.dma_read(&src_word, 1); break;
           // Not supposed to read from anywhere for OTC, values are specific and depend on the address
           case DmaPort::Otc:
             if (transfer_word_count == 1)
@@ -83,6 +138,7 @@ void Dma::do_block_transfer(DmaPort port) {
             src_word = m_gpu.dma_read_vram();
             break;
           case DmaPort::Cdrom: src_word = m_cdrom.read_word(); break;
+          case DmaPort::Spu: m_spu.dma_read(&src_word, 1); break;
           default: LOG_WARN("DMA transfer to unimplemented port {} requested", static_cast<u8>(port));
         }
         m_ram.write<u32>(addr_cur, src_word);
@@ -92,18 +148,12 @@ void Dma::do_block_transfer(DmaPort port) {
         u32 src_word = m_ram.read<u32>(addr_cur);
 
         switch (port) {
-          case DmaPort::MdecIn:
-            // TODO
-            LOG_INFO("DMA transfer of word 0x{:08X} to MDEC-In port", src_word);
-            break;
+          case DmaPort::MdecIn: m_mdec.dma_write(&src_word, 1); break;
           case DmaPort::Gpu:
             // Send packet (which is part of a GP0 command, likely data) to the GPU
             m_gpu.gp0(src_word);
             break;
-          case DmaPort::Spu:
-            // TODO
-            LOG_INFO("DMA transfer of word 0x{:08X} to SPU port", src_word);
-            break;
+          case DmaPort::Spu: m_spu.dma_write(&src_word, 1); break;
           default:
             LOG_WARN("DMA transfer of word 0x{:08X} to unimplemented port {} requested", src_word,
                      static_cast<u8>(port));
@@ -116,7 +166,71 @@ void Dma::do_block_transfer(DmaPort port) {
     transfer_word_count -= 1;
   }
 
+  block_transfer_finished(channel, port);
+}
+
+void Dma::block_transfer_finished(DmaChannel& channel, DmaPort port) {
   transfer_finished(channel, port);
+
+  // The macroblocks just fed in are what a waiting MDEC-Out transfer is for
+  if (port == DmaPort::MdecIn && channel_control(DmaPort::MdecOut).active())
+    do_transfer(DmaPort::MdecOut);
+}
+
+bool Dma::do_bulk_transfer(DmaPort port, bool to_ram, bool is_forward, address addr, u32 word_count) {
+  if (port == DmaPort::Otc && to_ram && !is_forward) {
+    clear_ordering_table(addr, word_count);
+  } else if (port == DmaPort::Gpu && !to_ram && is_forward) {
+    // Mostly images being uploaded, which the GPU takes as a whole rather than word by word
+    send_to_gpu(addr, word_count);
+  } else if (port == DmaPort::Gpu && to_ram && is_forward) {
+    for_each_ram_span(addr, word_count, [this](address span_addr, u32 count) {
+      m_gpu.dma_read_vram(ram_words_for_write(span_addr, count), count);
+    });
+  } else if (port == DmaPort::Cdrom && to_ram && is_forward) {
+    for_each_ram_span(addr, word_count, [this](address span_addr, u32 count) {
+      m_cdrom.read_block(ram_words_for_write(span_addr, count), count);
+    });
+  } else if (port == DmaPort::MdecIn && !to_ram && is_forward) {
+    for_each_ram_span(addr, word_count, [this](address span_addr, u32 count) {
+      m_mdec.dma_write(reinterpret_cast<const u32*>(m_ram.host_ptr() + span_addr), count);
+    });
+  } else if (port == DmaPort::MdecOut && to_ram && is_forward) {
+    for_each_ram_span(addr, word_count, [this](address span_addr, u32 count) {
+      m_mdec.dma_read(ram_words_for_write(span_addr, count), count);
+    });
+  } else if (port == DmaPort::Spu && !to_ram && is_forward) {
+    for_each_ram_span(addr, word_count, [this](address span_addr, u32 count) {
+      m_spu.dma_write(reinterpret_cast<const u32*>(m_ram.host_ptr() + span_addr), count);
+    });
+  } else if (port == DmaPort::Spu && to_ram && is_forward) {
+    for_each_ram_span(addr, word_count, [this](address span_addr, u32 count) {
+      m_spu.dma_read(ram_words_for_write(span_addr, count), count);
+    });
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void Dma::clear_ordering_table(address addr, u32 word_count) {
+  if (word_count == 0)
+    return;
+
+  // Going backwards from addr, each entry points to the previous one. The same as going forwards from
+  // the last entry, which holds the "End of table" marker instead.
+  const address last = (addr - (word_count - 1) * 4) & RAM_ADDR_MASK;
+  for_each_ram_span(last, word_count, [this](address span_addr, u32 count) {
+    u32* entries = ram_words_for_write(span_addr, count);
+    for (u32 i = 0; i < count; ++i)
+      entries[i] = (span_addr + i * 4 - 4) & RAM_ADDR_MASK;
+  });
+  *ram_words_for_write(last, 1) = 0xFFFFFF;
+}
+
+u32* Dma::ram_words_for_write(address addr, u32 word_count) {
+  m_ram.mark_written(addr, word_count * 4);
+  return reinterpret_cast<u32*>(m_ram.host_ptr() + addr);
 }
 
 void Dma::do_linked_list_transfer(DmaPort port) {
@@ -129,32 +243,48 @@ void Dma::do_linked_list_transfer(DmaPort port) {
 
   LOG_DEBUG("Starting DMA linked list transfer: RAM to GPU");
 
+  // A corrupt list can loop back on itself, which would hang the console. Loops are found with Brent's
+  // algorithm: a packet is remembered every power of 2 packets, a loop comes back to it once the power of
+  // 2 exceeds its length. Packets of the loop are sent at most a few times before that.
+  address remembered_addr = addr;
+  u32 steps_since_remembered = 0;
+  u32 steps_to_next_remembered = 1;
+
   while (true) {  // for each packet in the linked list
     const u32 packet_header = m_ram.read<u32>(addr);
-    auto packet_word_count = packet_header >> 24;
+    const auto packet_word_count = packet_header >> 24;
 
     if (packet_word_count > 0)
       LOG_DEBUG("GPU packet at {:08X} (words: {})", addr, packet_word_count);
 
-    while (packet_word_count > 0) {
-      addr = (addr + 4) & RAM_ADDR_MASK;
-      const u32 packet_data = m_ram.read<u32>(addr);
-
-      // Send packet (which is a GP0 command) to the GPU
-      m_gpu.gp0(packet_data);
-
-      packet_word_count -= 1;
-    }
+    // Send packet (which is a GP0 command) to the GPU
+    send_to_gpu((addr + 4) & RAM_ADDR_MASK, packet_word_count);
 
     // Only check the top bit instead of the whole marker, that's what the hardware does
     if ((packet_header & 0x800000) != 0)
       break;
 
     addr = packet_header & RAM_ADDR_MASK;
+
+    if (addr == remembered_addr) {
+      LOG_WARN("DMA linked list loops back to {:08X}, ending the transfer", addr);
+      break;
+    }
+    if (++steps_since_remembered == steps_to_next_remembered) {
+      remembered_addr = addr;
+      steps_since_remembered = 0;
+      steps_to_next_remembered *= 2;
+    }
   }
   transfer_finished(channel, port);
 }
 
+void Dma::send_to_gpu(address addr, u32 word_count) {
+  for_each_ram_span(addr, word_count, [this](address span_addr, u32 count) {
+    m_gpu.gp0(reinterpret_cast<const u32*>(m_ram.host_ptr() + span_addr), count);
+  });
+}
+
 void Dma::transfer_finished(DmaChannel& channel, DmaPort port) {
   channel.transfer_finished();
 
@@ -163,6 +293,8 @@ void Dma::transfer_finished(DmaChannel& channel, DmaPort port) {
   if (is_enabled) {
     m_reg_interrupt.set_port_flags(port, true);
     m_irq_pending = m_reg_interrupt.get_irq_master_flag();
+    if (m_irq_pending)
+      m_scheduler.schedule(emulator::EventType::DmaIrq, 0);  // Transfers are instant, so is their IRQ
   }
 }
 
@@ -23,6 +23,22 @@ namespace io {
 class CdromDrive;
 }
 
+namespace mdec {
+class Mdec;
+}
+
+namespace spu {
+class Spu;
+}
+
+namespace emulator {
+class Scheduler;
+}
+
+namespace util {
+class StateStream;
+}
+
 namespace memory {
 
 enum class DmaPort {
@@ -90,11 +106,13 @@ union DmaInterruptRegister {
 
 class Dma {
  public:
-  explicit Dma(memory::Ram& ram, gpu::Gpu& gpu, cpu::Interrupts& interrupts, io::CdromDrive& cdrom)
-      : m_ram(ram),
-        m_gpu(gpu),
-        m_interrupts(interrupts),
-        m_cdrom(cdrom) {}
+  explicit Dma(memory::Ram& ram,
+               gpu::Gpu& gpu,
+               cpu::Interrupts& interrupts,
+               io::CdromDrive& cdrom,
+               mdec::Mdec& mdec,
+               spu::Spu& spu,
+               emulator::Scheduler& scheduler);
 
   template <typename ValueType>
   ValueType read(address addr_rebased) const {
@@ -190,13 +208,24 @@ class Dma {
 
   DmaChannel const& channel_control(DmaPort port) const;
   DmaChannel& channel_control(DmaPort port);
-  void step();
+
+  void serialize(util::StateStream& s);
 
  private:
   void do_transfer(DmaPort port);
   void do_block_transfer(DmaPort port);
+  // Transfers of the few combinations actually used, over contiguous RAM. addr is masked already.
+  // Returns false for the other combinations, which go word by word instead.
+  bool do_bulk_transfer(DmaPort port, bool to_ram, bool is_forward, address addr, u32 word_count);
+  void clear_ordering_table(address addr, u32 word_count);
+  // Host pointer to word_count words of RAM at addr, not wrapping around, after staling code in them
+  u32* ram_words_for_write(address addr, u32 word_count);
   void transfer_finished(DmaChannel& channel, DmaPort port);
+  void block_transfer_finished(DmaChannel& channel, DmaPort port);  // Then starts what waited for it
   void do_linked_list_transfer(DmaPort port);
+  // Writes word_count words from RAM at addr to GP0, wrapping around RAM
+  void send_to_gpu(address addr, u32 word_count);
+  void raise_pending_irq();  // Called by the DmaIrq event
 
  private:
   u32 m_reg_control{ 0x07654321 };
@@ -209,6 +238,9 @@ class Dma {
   gpu::Gpu& m_gpu;
   cpu::Interrupts& m_interrupts;
   io::CdromDrive& m_cdrom;
+  mdec::Mdec& m_mdec;
+  spu::Spu& m_spu;
+  emulator::Scheduler& m_scheduler;
 };
 
 }  // namespace memory
@@ -10,20 +10,20 @@
 
 namespace memory {
 
-Expansion::Expansion(fs::path const& bootstrap_path) {
+Expansion::Expansion(AddressSpace& address_space, fs::path const& bootstrap_path)
+    : Addressable(address_space.expansion1()) {
   // Init Expansion memory with 0xFF
-  m_data = std::make_unique<std::array<byte, memory::EXPANSION_1_SIZE>>();
-  std::fill(m_data->begin(), m_data->end(), 0);
+  std::fill_n(m_data, memory::EXPANSION_1_SIZE, 0);
 
   // Load bootstrap
   if (!bootstrap_path.empty()) {
     auto buf = util::load_file(bootstrap_path);
     Ensures(buf.size() <= memory::EXPANSION_1_SIZE);
-    std::copy(buf.begin(), buf.end(), m_data->begin());
+    std::copy(buf.begin(), buf.end(), m_data);
   }
 
   // Set cheat (Action Replay) switch to ON
-  (*m_data.get())[0x20018] = 1;
+  m_data[0x20018] = 1;
 }
 
 }  // namespace memory
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory/address_space.hpp>
 #include <memory/addressable.hpp>
 #include <memory/map.hpp>
 #include <util/fs.hpp>
@@ -12,7 +13,7 @@ namespace memory {
 
 class Expansion : public memory::Addressable<memory::EXPANSION_1_SIZE> {
  public:
-  explicit Expansion(fs::path const& path);
+  Expansion(AddressSpace& address_space, fs::path const& path);
 };
 
 }  // namespace memory
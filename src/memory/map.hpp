@@ -11,10 +11,15 @@ static constexpr u32 SCRATCHPAD_SIZE = 1    * 1024;      // Scratch pad, 1KB
 static constexpr u32 SPU_SIZE        = 0x280;
 static constexpr u32 EXPANSION_1_SIZE = 1024 * 1024;
 
+// Granularity of the bus page tables
+static constexpr u32 BUS_PAGE_SHIFT = 12;
+static constexpr u32 BUS_PAGE_SIZE = 1 << BUS_PAGE_SHIFT;
+
 namespace map {
 
 // Memory map (physical addresses)
 static constexpr Range RAM{ 0x00000000, RAM_SIZE };
+static constexpr Range RAM_MIRRORS{ 0x00000000, RAM_SIZE * 4 };  // RAM is mirrored in the first 8MB
 static constexpr Range BIOS{ 0x1FC00000, BIOS_SIZE };
 static constexpr Range SPU{ 0x1F801C00, SPU_SIZE };
 static constexpr Range MEM_CONTROL1{ 0x1F801000, 0x24 };
@@ -26,6 +31,7 @@ static constexpr Range IRQ_CONTROL{ 0x1F801070, 8 };
 static constexpr Range TIMERS{ 0x1F801100, 0x2C };
 static constexpr Range DMA{ 0x1F801080, 0x80 };
 static constexpr Range GPU{ 0x1F801810, 8 };
+static constexpr Range MDEC{ 0x1F801820, 8 };
 static constexpr Range SCRATCHPAD{ 0x1F800000, SCRATCHPAD_SIZE };
 static constexpr Range JOYPAD{ 0x1F801040, 0x10 };
 static constexpr Range SIO{ 0x1F801050, 0x10 };
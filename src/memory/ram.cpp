@@ -2,19 +2,22 @@
 
 #include <util/load_file.hpp>
 #include <util/log.hpp>
+#include <util/state_stream.hpp>
 
 #include <gsl-lite.hpp>
 
 #include <algorithm>
 #include <array>
+#include <cstring>
 
 namespace memory {
 
-Ram::Ram(fs::path psxexe_path) : m_psxexe_path(psxexe_path) {
-  std::fill(m_data->begin(), m_data->end(), 0);
+Ram::Ram(AddressSpace& address_space, fs::path psxexe_path)
+    : Addressable(address_space.ram()), m_psxexe_path(psxexe_path) {
+  std::fill_n(m_data, RAM_SIZE, 0);
 }
 
-bool Ram::load_executable(PSEXELoadInfo& out_psx_load_info) const {
+bool Ram::load_executable(PSEXELoadInfo& out_psx_load_info) {
   if (m_psxexe_path.empty())
     return false;
 
@@ -23,6 +26,10 @@ bool Ram::load_executable(PSEXELoadInfo& out_psx_load_info) const {
   if (psx_exe_buf.empty())
     return false;
 
+  return load_executable(psx_exe_buf, out_psx_load_info);
+}
+
+bool Ram::load_executable(const buffer& psx_exe_buf, PSEXELoadInfo& out_psx_load_info) {
   struct PSXEXEHeader {
     char magic[8];  // "PS-X EXE"
     u8 pad0[8];
@@ -38,34 +45,60 @@ bool Ram::load_executable(PSEXELoadInfo& out_psx_load_info) const {
     // etc, we don't care about anything else
   };
 
+  constexpr auto PSXEXE_HEADER_SIZE = 0x800;
+
   const auto psx_exe = (PSXEXEHeader*)psx_exe_buf.data();
 
-  if (std::strcmp(&psx_exe->magic[0], "PS-X EXE")) {
+  if (psx_exe_buf.size() < PSXEXE_HEADER_SIZE || std::memcmp(&psx_exe->magic[0], "PS-X EXE", 8)) {
     LOG_ERROR("Not a valid PS-X EXE file!");
     return false;
   }
 
-  // We don't support memfill
-  Ensures(psx_exe->memfill_start == 0);
-  Ensures(psx_exe->memfill_size == 0);
+  const auto copy_dest_offset = psx_exe->load_addr & (RAM_SIZE - 1);
+  const auto memfill_offset = psx_exe->memfill_start & (RAM_SIZE - 1);
+  if (psx_exe_buf.size() - PSXEXE_HEADER_SIZE < psx_exe->filesize ||
+      copy_dest_offset + psx_exe->filesize > RAM_SIZE ||
+      memfill_offset + psx_exe->memfill_size > RAM_SIZE) {
+    LOG_ERROR("PS-X EXE doesn't fit in RAM");
+    return false;
+  }
 
   out_psx_load_info.pc = psx_exe->pc;
   out_psx_load_info.r28 = psx_exe->r28;
   out_psx_load_info.r29_r30 = psx_exe->r29_r30 + psx_exe->r29_r30_offset;
 
-  constexpr auto PSXEXE_HEADER_SIZE = 0x800;
-
   const auto copy_src_begin = psx_exe_buf.data() + PSXEXE_HEADER_SIZE;
   const auto copy_src_end = copy_src_begin + psx_exe->filesize;
-  const auto copy_dest_begin = m_data->data() + (psx_exe->load_addr & 0x7FFFFFFF);
+  const auto copy_dest_begin = m_data + copy_dest_offset;
 
   std::copy(copy_src_begin, copy_src_end, copy_dest_begin);
 
+  // Zeroed as the BIOS would, usually the executable's BSS
+  std::fill_n(m_data + memfill_offset, psx_exe->memfill_size, 0);
+
+  // Stales any cached code the executable was copied over
+  if (psx_exe->filesize > 0)
+    mark_written(copy_dest_offset, psx_exe->filesize);
+  if (psx_exe->memfill_size > 0)
+    mark_written(memfill_offset, psx_exe->memfill_size);
+
   return true;
 }
 
-Scratchpad::Scratchpad() {
-  std::fill(m_data->begin(), m_data->end(), 0);
+void Ram::serialize(util::StateStream& s) {
+  s.section("RAM ");
+  s.bytes(m_data, RAM_SIZE);
+  if (s.is_loading())
+    m_dirty_pages.mark_all();
+}
+
+Scratchpad::Scratchpad(AddressSpace& address_space) : Addressable(address_space.scratchpad()) {
+  std::fill_n(m_data, SCRATCHPAD_SIZE, 0);
+}
+
+void Scratchpad::serialize(util::StateStream& s) {
+  s.section("SPAD");
+  s.bytes(m_data, SCRATCHPAD_SIZE);
 }
 
 }  // namespace memory
@@ -1,15 +1,28 @@
 #pragma once
 
+#include <memory/address_space.hpp>
 #include <memory/addressable.hpp>
 #include <memory/map.hpp>
+#include <util/dirty_pages.hpp>
 #include <util/fs.hpp>
 #include <util/types.hpp>
 
 #include <array>
 #include <memory>
 
+namespace util {
+class StateStream;
+}
+
 namespace memory {
 
+// Granularity of the tracking of written RAM (see util::DirtyPages), which among others the CPU block
+// cache relies on to spot self-modifying code
+static constexpr u32 RAM_PAGE_SIZE = BUS_PAGE_SIZE;
+static constexpr u32 RAM_PAGE_COUNT = RAM_SIZE / RAM_PAGE_SIZE;
+
+using RamDirtyPages = util::DirtyPages<RAM_PAGE_COUNT>;
+
 struct PSEXELoadInfo {
   u32 pc;
   u32 r28;
@@ -18,17 +31,43 @@ struct PSEXELoadInfo {
 
 class Ram : public Addressable<memory::RAM_SIZE> {
  public:
-  explicit Ram(fs::path psxexe_path);
-  bool load_executable(PSEXELoadInfo& out_psx_load_info) const;  // Returns true on successful load
-  const std::array<byte, RAM_SIZE>& data() const { return *m_data; }
+  Ram(AddressSpace& address_space, fs::path psxexe_path);
+  bool load_executable(PSEXELoadInfo& out_psx_load_info);  // Returns true on successful load
+  // Same, from an executable already in memory (e.g. read off a disc)
+  bool load_executable(const buffer& psx_exe_buf, PSEXELoadInfo& out_psx_load_info);
+  const byte* data() const { return m_data; }  // RAM_SIZE bytes
+  const fs::path& psxexe_path() const { return m_psxexe_path; }  // Empty without one
+
+  template <typename ValueType>
+  void write(address addr, ValueType val) {
+    m_dirty_pages.mark(addr / RAM_PAGE_SIZE);
+    Addressable::write<ValueType>(addr, val);
+  }
+
+  // Every write to RAM has to end up here or in write(), this one for writes done without the latter
+  void mark_written(address addr) { m_dirty_pages.mark(addr / RAM_PAGE_SIZE); }
+  // Same for the size bytes from addr on, without wrapping around
+  void mark_written(address addr, u32 size) {
+    m_dirty_pages.mark(addr / RAM_PAGE_SIZE, (addr + size - 1) / RAM_PAGE_SIZE);
+  }
+  RamDirtyPages& dirty_pages() { return m_dirty_pages; }
+  const RamDirtyPages& dirty_pages() const { return m_dirty_pages; }
+
+  // Loading marks all of RAM as written
+  void serialize(util::StateStream& s);
 
  private:
   fs::path m_psxexe_path;
+
+  RamDirtyPages m_dirty_pages;
 };
 
+// Only SCRATCHPAD_SIZE bytes, the rest of its bus page is unmapped
 class Scratchpad : public Addressable<memory::SCRATCHPAD_SIZE> {
  public:
-  explicit Scratchpad();
+  explicit Scratchpad(AddressSpace& address_space);
+
+  void serialize(util::StateStream& s);
 };
 
 }  // namespace memory
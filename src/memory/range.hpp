@@ -10,6 +10,9 @@ class Range {
 
   bool contains(address addr, address& out_addr_rebased) const;
 
+  constexpr address start() const { return m_start; }
+  constexpr u32 size() const { return m_size; }
+
  private:
   u32 m_start;
   u32 m_size;
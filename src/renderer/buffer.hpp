@@ -23,7 +23,8 @@ class PersistentMappedBuffer {
     glGenBuffers(1, &m_object);
     bind();
 
-    const auto access = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT;
+    // Coherent, so that written elements are seen by draws issued afterwards without explicit flushes
+    const auto access = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
 
     // Allocate buffer memory
     glBufferStorage(GLenum::GL_ARRAY_BUFFER, buffer_size, nullptr, access);
@@ -36,7 +37,7 @@ class PersistentMappedBuffer {
   }
 
   void set(u32 index, T val) {
-    if (index > Size)
+    if (index >= Size)
       throw std::runtime_error("gl buffer overflow");
 
     m_memory[index] = val;
@@ -53,8 +54,8 @@ class PersistentMappedBuffer {
   }
 
  private:
-  GLuint m_object;
-  T* m_memory;
+  GLuint m_object{};
+  T* m_memory{};
 };
 
 }  // namespace renderer
@@ -0,0 +1,453 @@
+#include <renderer/hw_renderer.hpp>
+
+#include <gpu/gpu.hpp>
+#include <renderer/shader.hpp>
+
+#include <glbinding/gl/gl.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+using namespace gl;
+
+namespace renderer {
+
+using rasterizer::Color;
+using rasterizer::Color2;
+using rasterizer::DrawCommand;
+using rasterizer::Position;
+using rasterizer::Position2;
+using rasterizer::TextureCache;
+using rasterizer::VramBlocks;
+using rasterizer::VramRect;
+
+namespace {
+
+const GLuint ATTRIB_INDEX_POSITION = 0;
+const GLuint ATTRIB_INDEX_COLOR = 1;
+const GLuint ATTRIB_INDEX_TEXCOORD = 2;
+const GLuint ATTRIB_INDEX_TEXINFO = 3;
+
+constexpr s32 VRAM_WIDTH = gpu::VRAM_WIDTH;
+constexpr s32 VRAM_HEIGHT = gpu::VRAM_HEIGHT;
+
+// How long to wait for the GPU at once when the vertex buffer wraps around, in nanoseconds
+constexpr GLuint64 FENCE_WAIT_TIMEOUT = 1'000'000;
+
+HwVertex make_vertex(f32 x,
+                     f32 y,
+                     Color color,
+                     rasterizer::Texcoord uv,
+                     u16 texpage,
+                     u16 clut,
+                     u16 flags) {
+  return { x, y, color.r, color.g, color.b, 0, (u16)uv.x, (u16)uv.y, texpage, clut, flags, 0 };
+}
+
+GLuint create_texture(GLenum internal_format, GLenum format, GLenum type, s32 width, s32 height) {
+  GLuint texture{};
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_2D, texture);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, nullptr);
+  return texture;
+}
+
+GLuint create_framebuffer(GLuint texture) {
+  GLuint framebuffer{};
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    throw std::runtime_error("Incomplete hardware renderer framebuffer");
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  return framebuffer;
+}
+
+bool is_same_state(const VramRect& a, const VramRect& b) {
+  return a.left == b.left && a.top == b.top && a.right == b.right && a.bottom == b.bottom;
+}
+
+bool is_same_state(const rasterizer::TexelWindow& a, const rasterizer::TexelWindow& b) {
+  return a.and_x == b.and_x && a.or_x == b.or_x && a.and_y == b.and_y && a.or_y == b.or_y;
+}
+
+}  // namespace
+
+HwRenderer::HwRenderer(gpu::Gpu& gpu, u32 resolution_scale) : m_gpu(gpu), m_scale(resolution_scale) {
+  // Load and compile shaders
+  m_program = renderer::load_shaders("hw");
+
+  if (!m_program)
+    throw std::runtime_error("Couldn't compile hardware renderer shader");
+
+  glUseProgram(m_program);
+  glUniform1i(glGetUniformLocation(m_program, "u_vram"), 0);
+
+  // Scaling down to the native resolution picks the middle subpixel, see download()
+  const f32 sample_offset = (f32)(m_scale / 2 * 2 + 1) / (f32)(m_scale * 2);
+  glUniform1f(glGetUniformLocation(m_program, "u_sample_offset"), sample_offset);
+  m_u_tex_window = glGetUniformLocation(m_program, "u_tex_window");
+
+  // Generate VAO, the vertices are read right from the mapped buffer
+  glGenVertexArrays(1, &m_vao);
+  glBindVertexArray(m_vao);
+  m_vertices.init();
+
+  const auto vertex_stride = sizeof(HwVertex);
+
+  glEnableVertexAttribArray(ATTRIB_INDEX_POSITION);
+  glVertexAttribPointer(ATTRIB_INDEX_POSITION, 2, GL_FLOAT, GL_FALSE, vertex_stride,
+                        (const void*)offsetof(HwVertex, x));
+
+  glEnableVertexAttribArray(ATTRIB_INDEX_COLOR);
+  glVertexAttribPointer(ATTRIB_INDEX_COLOR, 3, GL_UNSIGNED_BYTE, GL_FALSE, vertex_stride,
+                        (const void*)offsetof(HwVertex, r));
+
+  glEnableVertexAttribArray(ATTRIB_INDEX_TEXCOORD);
+  glVertexAttribPointer(ATTRIB_INDEX_TEXCOORD, 2, GL_UNSIGNED_SHORT, GL_FALSE, vertex_stride,
+                        (const void*)offsetof(HwVertex, u));
+
+  glEnableVertexAttribArray(ATTRIB_INDEX_TEXINFO);
+  glVertexAttribIPointer(ATTRIB_INDEX_TEXINFO, 3, GL_UNSIGNED_SHORT, vertex_stride,
+                         (const void*)offsetof(HwVertex, texpage));
+
+  glBindVertexArray(0);
+
+  // Generate VRAM textures and the framebuffers around them
+  m_tex_vram = create_texture(GL_R16UI, GL_RED_INTEGER, GL_UNSIGNED_SHORT, VRAM_WIDTH, VRAM_HEIGHT);
+  m_tex_native =
+      create_texture(GL_RGB5_A1, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, VRAM_WIDTH, VRAM_HEIGHT);
+  m_tex_scaled = create_texture(GL_RGB5_A1, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, VRAM_WIDTH * m_scale,
+                                VRAM_HEIGHT * m_scale);
+
+  m_fbo_native = create_framebuffer(m_tex_native);
+  m_fbo_scaled = create_framebuffer(m_tex_scaled);
+}
+
+HwRenderer::~HwRenderer() {
+  if (m_fence)
+    glDeleteSync(m_fence);
+  glDeleteFramebuffers(1, &m_fbo_scaled);
+  glDeleteFramebuffers(1, &m_fbo_native);
+  glDeleteTextures(1, &m_tex_scaled);
+  glDeleteTextures(1, &m_tex_native);
+  glDeleteTextures(1, &m_tex_vram);
+  glDeleteVertexArrays(1, &m_vao);
+  glDeleteProgram(m_program);
+}
+
+bool HwRenderer::is_supported() {
+  GLint major{};
+  GLint minor{};
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  if (major > 4 || (major == 4 && minor >= 4))
+    return true;
+
+  GLint extension_count{};
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extension_count);
+  for (GLint i = 0; i < extension_count; ++i) {
+    const auto name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+    if (std::strcmp(name, "GL_ARB_buffer_storage") == 0)
+      return true;
+  }
+  return false;
+}
+
+void HwRenderer::draw_polygon(const DrawCommand::Polygon& polygon) {
+  rasterizer::Position4 positions{};
+  rasterizer::Color4 colors{};
+  rasterizer::TextureInfo tex_info{};
+
+  m_gpu.m_rasterizer.extract_draw_data_polygon(polygon, m_gpu.gp0_cmd(), positions, colors, tex_info);
+
+  const bool is_gouraud = polygon.shading == DrawCommand::Shading::Gouraud;
+  const auto draw_flags = *(DrawCommand::Flags*)&polygon;
+  push_polygon(positions, colors, tex_info, polygon.is_quad(), is_gouraud, draw_flags);
+}
+
+void HwRenderer::draw_rectangle(const DrawCommand::Rectangle& rectangle) {
+  rasterizer::Position4 positions{};
+  rasterizer::Color4 colors{};
+  rasterizer::TextureInfo tex_info{};
+  rasterizer::Size size{};
+
+  m_gpu.m_rasterizer.extract_draw_data_rectangle(rectangle, m_gpu.gp0_cmd(), positions, colors, tex_info,
+                                                 size);
+
+  // The flags' shading bit is part of the rectangle size
+  const bool is_gouraud = false;
+  push_polygon(positions, colors, tex_info, true, is_gouraud, *(DrawCommand::Flags*)&rectangle);
+}
+
+void HwRenderer::draw_line(const DrawCommand::Line& line) {
+  // Polylines are drawn a segment at a time, see gpu::Gpu::is_polyline()
+  Position2 positions{};
+  Color2 colors{};
+  m_gpu.m_rasterizer.extract_draw_data_line(line, m_gpu.gp0_cmd(), positions, colors);
+  push_line(positions[0], positions[1], colors[0], colors[1], line.semi_transparency);
+}
+
+void HwRenderer::flush() {
+  const u32 count = m_vertex_count - m_batch_start;
+  if (count == 0)
+    return;
+
+  // Restored afterwards for the screen and GUI rendering
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  const s32 scale = m_scale;
+  const auto& area = m_batch_state.draw_area;
+  const auto& window = m_batch_state.tex_window;
+
+  // Bind needed state
+  glBindFramebuffer(GL_FRAMEBUFFER, m_fbo_scaled);
+  glViewport(0, 0, VRAM_WIDTH * scale, VRAM_HEIGHT * scale);
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(area.left * scale, area.top * scale, (area.right - area.left) * scale,
+            (area.bottom - area.top) * scale);
+
+  glUseProgram(m_program);
+  glUniform4i(m_u_tex_window, window.and_x, window.or_x, window.and_y, window.or_y);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_tex_vram);
+
+  // Draw batch
+  glBindVertexArray(m_vao);
+  glDrawArrays(GL_TRIANGLES, m_batch_start, count);
+  glBindVertexArray(0);
+
+  if (m_fence)
+    glDeleteSync(m_fence);
+  m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, UnusedMask::GL_NONE_BIT);
+  m_batch_start = m_vertex_count;
+
+  glDisable(GL_SCISSOR_TEST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void HwRenderer::download() {
+  flush();
+
+  if (m_drawn.none())
+    return;
+
+  // Bounding rectangle of the drawn blocks
+  VramRect rect{ VRAM_WIDTH, VRAM_HEIGHT, 0, 0 };
+  for (u32 i = 0; i < m_drawn.size(); ++i) {
+    if (!m_drawn[i])
+      continue;
+    const s32 left = (i % rasterizer::VRAM_BLOCK_COLUMNS) << rasterizer::VRAM_BLOCK_WIDTH_SHIFT;
+    const s32 top = (i / rasterizer::VRAM_BLOCK_COLUMNS) << rasterizer::VRAM_BLOCK_HEIGHT_SHIFT;
+    rect.left = std::min(rect.left, left);
+    rect.top = std::min(rect.top, top);
+    rect.right = std::max<s32>(rect.right, left + (1 << rasterizer::VRAM_BLOCK_WIDTH_SHIFT));
+    rect.bottom = std::max<s32>(rect.bottom, top + (1 << rasterizer::VRAM_BLOCK_HEIGHT_SHIFT));
+  }
+  m_drawn.reset();
+
+  const s32 scale = m_scale;
+  const s32 width = rect.right - rect.left;
+  const s32 height = rect.bottom - rect.top;
+  u16* pixels = &m_gpu.vram()[rect.top * VRAM_WIDTH + rect.left];
+
+  // Down to the native resolution, pixels being their middle subpixel (rounding down), then to the
+  // CPU copy
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo_scaled);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo_native);
+  glBlitFramebuffer(rect.left * scale, rect.top * scale, rect.right * scale, rect.bottom * scale,
+                    rect.left, rect.top, rect.right, rect.bottom, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo_native);
+  glPixelStorei(GL_PACK_ROW_LENGTH, VRAM_WIDTH);
+  glReadPixels(rect.left, rect.top, width, height, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV, pixels);
+  glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  // Textures are sampled from what was drawn from now on
+  glBindTexture(GL_TEXTURE_2D, m_tex_vram);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, VRAM_WIDTH);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, rect.left, rect.top, width, height, GL_RED_INTEGER,
+                  GL_UNSIGNED_SHORT, pixels);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
+
+bool HwRenderer::is_drawn(const VramRect& rect) const {
+  return (TextureCache::blocks_of(rect) & m_drawn).any();
+}
+
+void HwRenderer::upload(const VramRect& rect) {
+  // Split where the rect wraps around VRAM
+  for (s32 wrap_y : { 0, VRAM_HEIGHT }) {
+    for (s32 wrap_x : { 0, VRAM_WIDTH }) {
+      upload_clamped({ std::max(rect.left - wrap_x, 0), std::max(rect.top - wrap_y, 0),
+                       std::min(rect.right - wrap_x, VRAM_WIDTH),
+                       std::min(rect.bottom - wrap_y, VRAM_HEIGHT) });
+    }
+  }
+}
+
+void HwRenderer::upload_clamped(const VramRect& rect) {
+  if (rect.is_empty())
+    return;
+
+  // Primitives batched until now are drawn below the uploaded pixels
+  flush();
+
+  const s32 scale = m_scale;
+  const s32 width = rect.right - rect.left;
+  const s32 height = rect.bottom - rect.top;
+  const u16* pixels = &m_gpu.vram()[rect.top * VRAM_WIDTH + rect.left];
+
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, VRAM_WIDTH);
+  glBindTexture(GL_TEXTURE_2D, m_tex_vram);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, rect.left, rect.top, width, height, GL_RED_INTEGER,
+                  GL_UNSIGNED_SHORT, pixels);
+  glBindTexture(GL_TEXTURE_2D, m_tex_native);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, rect.left, rect.top, width, height, GL_RGBA,
+                  GL_UNSIGNED_SHORT_1_5_5_5_REV, pixels);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+  // Up to the drawn resolution
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo_native);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo_scaled);
+  glBlitFramebuffer(rect.left, rect.top, rect.right, rect.bottom, rect.left * scale, rect.top * scale,
+                    rect.right * scale, rect.bottom * scale, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+HwRenderer::BatchState HwRenderer::batch_state() const {
+  // Same bounds as the software rasterizer, the bottom right corner is exclusive
+  const VramRect draw_area{ (s32)m_gpu.m_drawing_area_top_left.x, (s32)m_gpu.m_drawing_area_top_left.y,
+                            (s32)m_gpu.m_drawing_area_bottom_right.x,
+                            (s32)m_gpu.m_drawing_area_bottom_right.y };
+
+  const auto tex_win = m_gpu.m_tex_window;
+  const auto tex_window = rasterizer::TexelWindow::from_gp0(
+      tex_win.tex_window_mask_x, tex_win.tex_window_off_x, tex_win.tex_window_mask_y,
+      tex_win.tex_window_off_y);
+  return { draw_area, tex_window };
+}
+
+void HwRenderer::push_polygon(const rasterizer::Position4& positions,
+                              const rasterizer::Color4& colors,
+                              const rasterizer::TextureInfo& tex_info,
+                              bool is_quad,
+                              bool is_gouraud,
+                              DrawCommand::Flags draw_flags) {
+  const auto drawing_offset = m_gpu.m_drawing_offset;
+
+  u16 flags = 0;
+  VramBlocks sampled;
+  if (draw_flags.texture_mapped) {
+    flags |= HW_VERTEX_TEXTURED;
+    if (draw_flags.texture_mode == DrawCommand::TextureMode::Raw)
+      flags |= HW_VERTEX_RAW_TEXTURE;
+    sampled = TextureCache::texture_blocks_of(tex_info.page, tex_info.palette.word);
+  }
+  if (draw_flags.semi_transparency)
+    flags |= HW_VERTEX_SEMI_TRANSPARENT;
+
+  std::array<HwVertex, 4> vertices;
+  for (u32 i = 0; i < vertices.size(); ++i) {
+    // Offset like the software rasterizer does it
+    const auto x = (s16)(positions[i].x + drawing_offset.x);
+    const auto y = (s16)(positions[i].y + drawing_offset.y);
+    const auto color = is_gouraud ? colors[i] : colors[0];
+    vertices[i] = make_vertex(x, y, color, tex_info.uv[i], tex_info.page, tex_info.palette.word, flags);
+  }
+
+  push_triangle({ vertices[0], vertices[1], vertices[2] }, sampled);
+  if (is_quad)
+    push_triangle({ vertices[1], vertices[2], vertices[3] }, sampled);
+}
+
+void HwRenderer::push_line(Position a,
+                           Position b,
+                           Color color_a,
+                           Color color_b,
+                           bool is_semi_transparent) {
+  const auto drawing_offset = m_gpu.m_drawing_offset;
+  a = { (s16)(a.x + drawing_offset.x), (s16)(a.y + drawing_offset.y) };
+  b = { (s16)(b.x + drawing_offset.x), (s16)(b.y + drawing_offset.y) };
+
+  // Lines are drawn as quads a pixel wide across their major axis, from a to b so that they span both
+  // end points
+  const s32 dx = b.x - a.x;
+  const s32 dy = b.y - a.y;
+  const bool is_x_major = std::abs(dx) >= std::abs(dy);
+  if ((is_x_major ? dx : dy) < 0) {
+    std::swap(a, b);
+    std::swap(color_a, color_b);
+  }
+
+  const u16 flags = is_semi_transparent ? HW_VERTEX_SEMI_TRANSPARENT : 0;
+  const auto corner = [flags](Position pos, f32 dx, f32 dy, Color color) {
+    return make_vertex(pos.x + dx, pos.y + dy, color, {}, 0, 0, flags);
+  };
+
+  std::array<HwVertex, 4> vertices;
+  if (is_x_major)
+    vertices = { corner(a, -0.5f, -0.5f, color_a), corner(a, -0.5f, 0.5f, color_a),
+                 corner(b, 0.5f, -0.5f, color_b), corner(b, 0.5f, 0.5f, color_b) };
+  else
+    vertices = { corner(a, -0.5f, -0.5f, color_a), corner(a, 0.5f, -0.5f, color_a),
+                 corner(b, -0.5f, 0.5f, color_b), corner(b, 0.5f, 0.5f, color_b) };
+
+  push_triangle({ vertices[0], vertices[1], vertices[2] }, {});
+  push_triangle({ vertices[1], vertices[2], vertices[3] }, {});
+}
+
+void HwRenderer::push_triangle(const std::array<HwVertex, 3>& vertices, const VramBlocks& sampled) {
+  const BatchState state = batch_state();
+  const auto& area = state.draw_area;
+
+  // Bounding box of the pixels that may be drawn, clipped like the software rasterizer does it
+  const auto [min_x, max_x] = std::minmax({ vertices[0].x, vertices[1].x, vertices[2].x });
+  const auto [min_y, max_y] = std::minmax({ vertices[0].y, vertices[1].y, vertices[2].y });
+  const VramRect bbox{ std::max({ (s32)std::floor(min_x), area.left, 0 }),
+                       std::max({ (s32)std::floor(min_y), area.top, 0 }),
+                       std::min({ (s32)std::ceil(max_x) + 1, area.right, VRAM_WIDTH }),
+                       std::min({ (s32)std::ceil(max_y) + 1, area.bottom, VRAM_HEIGHT }) };
+  if (bbox.is_empty())
+    return;
+
+  // Textures drawn to are sampled from the CPU copy of VRAM
+  if ((sampled & m_drawn).any())
+    download();
+
+  if (m_vertex_count != m_batch_start &&
+      (!is_same_state(state.draw_area, m_batch_state.draw_area) ||
+       !is_same_state(state.tex_window, m_batch_state.tex_window)))
+    flush();
+  m_batch_state = state;
+
+  if (m_vertex_count + vertices.size() > HW_VERTEX_BUFFER_SIZE) {
+    flush();
+
+    // The GPU may still be reading the start of the buffer
+    if (m_fence) {
+      auto status = GL_TIMEOUT_EXPIRED;
+      while (status == GL_TIMEOUT_EXPIRED)
+        status = glClientWaitSync(m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_WAIT_TIMEOUT);
+    }
+    m_vertex_count = 0;
+    m_batch_start = 0;
+  }
+
+  for (const auto& vertex : vertices)
+    m_vertices.set(m_vertex_count++, vertex);
+  m_drawn |= TextureCache::blocks_of(bbox);
+}
+
+}  // namespace renderer
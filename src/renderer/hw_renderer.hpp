@@ -0,0 +1,125 @@
+#pragma once
+
+#include <renderer/buffer.hpp>
+#include <renderer/rasterizer.hpp>
+#include <renderer/texture_cache.hpp>
+#include <util/types.hpp>
+
+#include <glbinding/gl/types.h>
+
+#include <array>
+
+namespace gpu {
+class Gpu;
+}
+
+namespace renderer {
+
+// Vertices the batches are written to, it's used as a ring: once full, the GPU is waited for before
+// writing from its start again
+constexpr u32 HW_VERTEX_BUFFER_SIZE = 3 * 16384;
+
+// Bits of HwVertex::flags, see shaders/hw.fs.glsl
+constexpr u16 HW_VERTEX_TEXTURED = 1 << 0;
+constexpr u16 HW_VERTEX_RAW_TEXTURE = 1 << 1;
+constexpr u16 HW_VERTEX_SEMI_TRANSPARENT = 1 << 2;
+
+// Vertex of a primitive drawn by the host GPU, see shaders/hw.vs.glsl
+struct HwVertex {
+  f32 x;  // VRAM coordinates, drawing offset applied
+  f32 y;
+  u8 r;
+  u8 g;
+  u8 b;
+  u8 _pad;
+  u16 u;  // Texel coordinates, relative to the texture page
+  u16 v;
+  u16 texpage;  // Texpage attribute, see gpu::Gp0DrawMode
+  u16 clut;     // CLUT attribute, see rasterizer::Palette
+  u16 flags;
+  u16 _pad2;
+};
+
+// Draws polygons, rectangles and lines with OpenGL, at a multiple of the VRAM resolution. Primitives are
+// batched in a persistently mapped vertex buffer, and the batch is drawn once the drawing area or the
+// texture window changes, before VRAM is read back, and once per frame.
+//
+// The CPU copy of VRAM (gpu::Gpu::vram()) stays valid everywhere but where primitives were drawn since
+// it was last downloaded. Textures are sampled from a native resolution copy of it, primitives sampling
+// drawn VRAM download it first. Must be used on the thread the GL context is current on.
+//
+// Unlike the software rasterizer, drawn pixels are written as they are: semi-transparent primitives are
+// drawn opaque, GPUSTAT.11 and 12 (set and check the mask bit) are ignored and nothing is dithered.
+class HwRenderer {
+ public:
+  HwRenderer(gpu::Gpu& gpu, u32 resolution_scale);
+  ~HwRenderer();
+
+  // Whether the GL context supports persistently mapped buffers (GL 4.4 or ARB_buffer_storage)
+  static bool is_supported();
+
+  void draw_polygon(const rasterizer::DrawCommand::Polygon& polygon);
+  void draw_rectangle(const rasterizer::DrawCommand::Rectangle& rectangle);
+  void draw_line(const rasterizer::DrawCommand::Line& line);
+
+  // Draws the batched primitives
+  void flush();
+  // Reads what was drawn back to the CPU copy of VRAM, before VRAM it may have drawn to is read
+  void download();
+  // Whether download() needs to be called before reading the VRAM in rect
+  bool is_drawn(const rasterizer::VramRect& rect) const;
+  // Copies VRAM written to by the CPU to the GPU, rect may wrap around VRAM
+  void upload(const rasterizer::VramRect& rect);
+
+  gl::GLuint screen_texture() const { return m_tex_scaled; }
+  u32 resolution_scale() const { return m_scale; }
+
+ private:
+  struct BatchState {
+    rasterizer::VramRect draw_area;
+    rasterizer::TexelWindow tex_window;
+  };
+
+  // Current GPU state that primitives depend on
+  BatchState batch_state() const;
+  void push_polygon(const rasterizer::Position4& positions,
+                    const rasterizer::Color4& colors,
+                    const rasterizer::TextureInfo& tex_info,
+                    bool is_quad,
+                    bool is_gouraud,
+                    rasterizer::DrawCommand::Flags draw_flags);
+  void push_line(rasterizer::Position a,
+                 rasterizer::Position b,
+                 rasterizer::Color color_a,
+                 rasterizer::Color color_b,
+                 bool is_semi_transparent);
+  // Adds a triangle to the batch, sampled being the VRAM blocks its texture is sampled from
+  void push_triangle(const std::array<HwVertex, 3>& vertices, const rasterizer::VramBlocks& sampled);
+  void upload_clamped(const rasterizer::VramRect& rect);
+
+ private:
+  gpu::Gpu& m_gpu;
+  const u32 m_scale;
+
+  PersistentMappedBuffer<HwVertex, HW_VERTEX_BUFFER_SIZE> m_vertices;
+  u32 m_vertex_count{};  // Written to the buffer so far
+  u32 m_batch_start{};   // First vertex of the batch, the ones before it were drawn
+  BatchState m_batch_state{};
+  gl::GLsync m_fence{};  // Signaled once the last batch is drawn
+
+  rasterizer::VramBlocks m_drawn;  // Drawn to since the last download
+
+  // Shaders
+  gl::GLuint m_program{};
+  gl::GLint m_u_tex_window{};
+
+  // Other OpenGL objects
+  gl::GLuint m_vao{};
+  gl::GLuint m_tex_vram{};    // Native resolution, 16 bit words to sample textures from
+  gl::GLuint m_tex_native{};  // Native resolution colors, to read back and upload through
+  gl::GLuint m_tex_scaled{};  // Drawn to, at resolution_scale
+  gl::GLuint m_fbo_native{};
+  gl::GLuint m_fbo_scaled{};
+};
+
+}  // namespace renderer
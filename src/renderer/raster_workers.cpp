@@ -0,0 +1,128 @@
+#include <renderer/raster_workers.hpp>
+
+#include <gsl-lite.hpp>
+
+#include <algorithm>
+
+namespace renderer {
+namespace rasterizer {
+
+namespace {
+
+// Empty queue polls before a worker goes to sleep, triangles usually come in bursts
+constexpr u32 SPIN_COUNT = 1000;
+
+}  // namespace
+
+RasterWorkers::RasterWorkers(const Rasterizer& rasterizer, u32 worker_count)
+    : m_rasterizer(rasterizer),
+      m_worker_count(worker_count),
+      m_queue(RASTER_QUEUE_SIZE),
+      m_workers(std::make_unique<Worker[]>(worker_count)) {
+  Expects(worker_count > 0 && worker_count <= MAX_RASTER_WORKERS);
+
+  for (u32 i = 0; i < m_worker_count; ++i)
+    m_workers[i].thread = std::thread(&RasterWorkers::run, this, i);
+}
+
+RasterWorkers::~RasterWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(m_wake_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+
+  for (u32 i = 0; i < m_worker_count; ++i)
+    m_workers[i].thread.join();
+}
+
+void RasterWorkers::push(const TriangleJob& job) {
+  const u64 index = m_pushed.load(std::memory_order_relaxed);
+
+  // Wait for the slot to be free, i.e. every worker to be past the triangle that used it last
+  while (index - slowest_worker() >= RASTER_QUEUE_SIZE)
+    std::this_thread::yield();
+
+  // Binning: which workers own the bands the triangle touches
+  u32 worker_mask = 0;
+  const s32 first_band = job.bbox_min.y / RASTER_BAND_HEIGHT;
+  const s32 last_band = (job.bbox_max.y - 1) / RASTER_BAND_HEIGHT;
+  for (s32 band = first_band; band <= last_band && band < first_band + (s32)m_worker_count; ++band)
+    worker_mask |= 1 << worker_of_band(band);
+
+  m_queue[index % RASTER_QUEUE_SIZE] = { job, worker_mask };
+  m_pushed.store(index + 1, std::memory_order_release);
+
+  // Pairs with the fence in wait_for_jobs(), see GpuThread::push
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_sleeping.load(std::memory_order_relaxed) > 0) {
+    std::lock_guard<std::mutex> lock(m_wake_mutex);
+    m_wake.notify_all();
+  }
+}
+
+void RasterWorkers::flush() {
+  const u64 pushed = m_pushed.load(std::memory_order_relaxed);
+  while (slowest_worker() != pushed)
+    std::this_thread::yield();
+}
+
+u64 RasterWorkers::slowest_worker() const {
+  u64 done = m_workers[0].done.load(std::memory_order_acquire);
+  for (u32 i = 1; i < m_worker_count; ++i)
+    done = std::min(done, m_workers[i].done.load(std::memory_order_acquire));
+  return done;
+}
+
+void RasterWorkers::run(u32 worker_index) {
+  Worker& worker = m_workers[worker_index];
+  u64 done = 0;
+
+  while (true) {
+    const u64 pushed = m_pushed.load(std::memory_order_acquire);
+    if (done == pushed) {
+      if (m_quit)
+        return;
+      wait_for_jobs(done);
+      continue;
+    }
+
+    for (; done < pushed; ++done) {
+      const QueuedJob& queued = m_queue[done % RASTER_QUEUE_SIZE];
+
+      if (queued.worker_mask & (1 << worker_index)) {
+        const TriangleJob& job = queued.job;
+        const s32 first_band = job.bbox_min.y / RASTER_BAND_HEIGHT;
+        const s32 last_band = (job.bbox_max.y - 1) / RASTER_BAND_HEIGHT;
+
+        // First band of ours, then every worker_count-th one
+        const u32 offset = (worker_index + m_worker_count - worker_of_band(first_band)) % m_worker_count;
+        s32 band = first_band + (s32)offset;
+        for (; band <= last_band; band += m_worker_count) {
+          const s32 band_top = band * RASTER_BAND_HEIGHT;
+          m_rasterizer.rasterize(job, band_top, band_top + RASTER_BAND_HEIGHT);
+        }
+      }
+
+      worker.done.store(done + 1, std::memory_order_release);
+    }
+  }
+}
+
+void RasterWorkers::wait_for_jobs(u64 done) {
+  for (u32 i = 0; i < SPIN_COUNT; ++i) {
+    if (m_pushed.load(std::memory_order_acquire) != done || m_quit)
+      return;
+    std::this_thread::yield();
+  }
+
+  std::unique_lock<std::mutex> lock(m_wake_mutex);
+  m_sleeping.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  m_wake.wait(lock,
+              [this, done]() { return m_pushed.load(std::memory_order_acquire) != done || m_quit; });
+  m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+}
+
+}  // namespace rasterizer
+}  // namespace renderer
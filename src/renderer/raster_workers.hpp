@@ -0,0 +1,66 @@
+#pragma once
+
+#include <renderer/rasterizer.hpp>
+#include <util/types.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace renderer {
+namespace rasterizer {
+
+// VRAM is split in bands of rows, dealt out to the workers round robin so that the drawing buffers are
+// spread over all of them
+constexpr s32 RASTER_BAND_HEIGHT = 32;
+// Triangles in flight, the submitting thread waits for the workers when it's full
+constexpr size_t RASTER_QUEUE_SIZE = 1 << 12;
+constexpr u32 MAX_RASTER_WORKERS = 8;
+
+// Rasterizes queued triangles on a pool of threads. Each worker goes through the whole queue in order,
+// drawing the rows of the triangles that fall in its own bands: every pixel is only ever written by a
+// single worker, in submission order, so the result is the same as rasterizing serially.
+class RasterWorkers {
+ public:
+  RasterWorkers(const Rasterizer& rasterizer, u32 worker_count);
+  ~RasterWorkers();
+
+  void push(const TriangleJob& job);
+  // Waits for all pushed triangles to be rasterized
+  void flush();
+
+ private:
+  struct QueuedJob {
+    TriangleJob job;
+    u32 worker_mask;  // Workers owning one of the bands the triangle touches
+  };
+
+  struct Worker {
+    std::thread thread;
+    alignas(64) std::atomic<u64> done{};  // Queue position the worker is at
+  };
+
+  void run(u32 worker_index);
+  void wait_for_jobs(u64 done);
+  u64 slowest_worker() const;
+  u32 worker_of_band(s32 band) const { return band % m_worker_count; }
+
+  const Rasterizer& m_rasterizer;
+  const u32 m_worker_count;
+
+  std::vector<QueuedJob> m_queue;
+  alignas(64) std::atomic<u64> m_pushed{};
+  std::unique_ptr<Worker[]> m_workers;
+
+  // Wake up of workers that went to sleep on an empty queue
+  std::atomic<u32> m_sleeping{};
+  std::atomic<bool> m_quit{};
+  std::mutex m_wake_mutex;
+  std::condition_variable m_wake;
+};
+
+}  // namespace rasterizer
+}  // namespace renderer
@@ -1,11 +1,14 @@
 #include <renderer/rasterizer.hpp>
 
 #include <gpu/gpu.hpp>
+#include <renderer/raster_workers.hpp>
+#include <renderer/span_kernels.hpp>
+#include <util/profiler.hpp>
 
-#include <glm/vec3.hpp>
 #include <gsl-lite.hpp>
 
 #include <algorithm>
+#include <bitset>
 #include <cassert>
 #include <numeric>
 #include <string>
@@ -15,232 +18,663 @@ namespace rasterizer {
 
 PixelRenderType tex_page_col_to_render_type(u8 tex_page_colors);
 
-template <PixelRenderType RenderType>
-void Rasterizer::draw_pixel(Position pos,
-                            const Color3* col,
-                            const TextureInfo* tex_info,
-                            BarycentricCoords bar,
-                            s32 area,
-                            DrawCommand::Flags draw_flags) const {
-  // Texture stuff, unused for SHADED render type
-  TexelPos texel{};
+namespace {
 
-  constexpr bool is_textured = RenderType != PixelRenderType::SHADED;
+// Side length of the tiles triangles are rasterized in
+constexpr s32 RASTER_TILE_SIZE = 8;
 
-  if (is_textured)
-    texel = calculate_texel_pos(bar, area, tex_info->uv_active);
+// Determine orientation of 3 points in 2D space
+s32 orient_2d(Position a, Position b, Position c) {
+  return ((s32)b.x - a.x) * ((s32)c.y - a.y) - ((s32)b.y - a.y) * ((s32)c.x - a.x);
+}
 
-  gpu::RGB16 out_color;
+// orient_2d(a, b, p) for pixels p relative to an origin, which is linear in p
+struct EdgeFunction {
+  EdgeFunction(Position a, Position b, Position origin)
+      : step_x((s32)a.y - b.y), step_y((s32)b.x - a.x), origin_value(orient_2d(a, b, origin)) {}
 
-  switch (RenderType) {
-    case PixelRenderType::SHADED: {
-      out_color = calculate_pixel_shaded(*col, bar);
-      break;
-    }
-    case PixelRenderType::TEXTURED_PALETTED_4BIT:
-      out_color = calculate_pixel_tex_4bit(*tex_info, texel);
-      break;
-    case PixelRenderType::TEXTURED_PALETTED_8BIT:
-      out_color = calculate_pixel_tex_8bit(*tex_info, texel);
-      break;
-    case PixelRenderType::TEXTURED_16BIT: out_color = calculate_pixel_tex_16bit(*tex_info, texel); break;
-    default: assert(0);
+  s32 at(s32 dx, s32 dy) const { return origin_value + dx * step_x + dy * step_y; }
+
+  // Extremes over a w*h tile, given the value at its top left pixel
+  s32 min_in_tile(s32 value, s32 w, s32 h) const {
+    return value + std::min(step_x, 0) * (w - 1) + std::min(step_y, 0) * (h - 1);
+  }
+  s32 max_in_tile(s32 value, s32 w, s32 h) const {
+    return value + std::max(step_x, 0) * (w - 1) + std::max(step_y, 0) * (h - 1);
+  }
+
+  const s32 step_x;  // Change per pixel to the right
+  const s32 step_y;  // Change per pixel down
+  const s32 origin_value;
+};
+
+// Modulating by the neutral color (128, 128, 128) leaves texels as they are
+constexpr bool is_neutral_modulation_exact() {
+  for (u32 texel = 0; texel < 32; ++texel)
+    if (modulate_channel(texel, 128) != texel)
+      return false;
+  return true;
+}
+static_assert(is_neutral_modulation_exact(), "Neutral color modulation changes texels");
+
+}  // namespace
+
+Rasterizer::Rasterizer(gpu::Gpu& gpu) : m_gpu(gpu), m_texture_cache(gpu, gpu.vram_dirty_blocks()) {}
+
+Rasterizer::~Rasterizer() = default;
+
+void Rasterizer::set_worker_count(u32 worker_count) {
+  flush();
+  m_workers.reset();
+  m_worker_count = std::min(worker_count, MAX_RASTER_WORKERS);
+  if (m_worker_count > 0)
+    m_workers = std::make_unique<RasterWorkers>(*this, m_worker_count);
+}
+
+void Rasterizer::flush() {
+  if (m_workers)
+    m_workers->flush();
+}
+
+void Rasterizer::end_frame() {
+  m_last_frame.primitives = std::exchange(m_frame_primitives, {});
+  m_last_frame.pixels_tested = m_frame_pixels_tested.exchange(0, std::memory_order_relaxed);
+  m_last_frame.pixels_written = m_frame_pixels_written.exchange(0, std::memory_order_relaxed);
+  for (size_t i = 0; i < m_frame_texels.size(); ++i)
+    m_last_frame.texels[i] = m_frame_texels[i].exchange(0, std::memory_order_relaxed);
+
+  if (!m_overdraw.empty()) {
+    std::swap(m_overdraw, m_last_overdraw);
+    std::fill(m_overdraw.begin(), m_overdraw.end(), 0);
   }
+}
 
-  // Don't write to VRAM if drawing a texture, or if (TODO) the semi-transparency bit is enabled
-  if ((is_textured || draw_flags.semi_transparency) && out_color.word == 0x0000)
+void Rasterizer::set_overdraw_tracking(bool enabled) {
+  if (enabled == !m_overdraw.empty())
     return;
 
-  const auto is_raw = draw_flags.texture_mode == DrawCommand::TextureMode::Raw;
-
-  // Apply texture color or shading
-  if (is_textured && !is_raw) {
-    glm::vec3 brightness;
-    if (draw_flags.shading == DrawCommand::Shading::Flat) {
-      brightness = gpu::RGB32::from_word(tex_info->color.word()).to_vec();
-    } else if (draw_flags.shading == DrawCommand::Shading::Gouraud) {
-      const auto c = *col;
-      brightness = glm::vec3(bar.a * c[0].r + bar.b * c[1].r + bar.c * c[2].r,
-                             bar.a * c[0].g + bar.b * c[1].g + bar.c * c[2].g,
-                             bar.a * c[0].b + bar.b * c[1].b + bar.c * c[2].b) /
-                   (255.f * area);
+  flush();
+  m_overdraw.assign(enabled ? gpu::VRAM_WIDTH * gpu::VRAM_HEIGHT : 0, 0);
+  m_last_overdraw = m_overdraw;
+}
+
+u32 Rasterizer::count_written(const PixelOutput& output, u32 vram_idx, u32 count, u32 write_mask) const {
+  if (output.check_mask) {
+    const u16* row = &m_gpu.vram()[vram_idx];
+    for (u32 i = 0; i < count; ++i)
+      if (row[i] & 0x8000)
+        write_mask &= ~(1 << i);
+  }
+  if (!m_overdraw.empty()) {
+    for (u32 i = 0; i < count; ++i) {
+      u8& overdraw = m_overdraw[vram_idx + i];
+      if ((write_mask & (1 << i)) && overdraw != 0xFF)
+        ++overdraw;
     }
-    out_color *= brightness * 2.f;
   }
-
-  m_gpu.set_vram_pos<false>(pos.x, pos.y, out_color.word);
+  return (u32)std::bitset<MAX_SPAN_LENGTH>(write_mask).count();
 }
 
-gpu::RGB16 Rasterizer::calculate_pixel_shaded(Color3 colors, BarycentricCoords bar) {
-  // https://codeplea.com/triangular-interpolation
+void Rasterizer::add_overdraw(u32 vram_idx, u32 count) const {
+  if (m_overdraw.empty())
+    return;
+  for (u32 i = 0; i < count; ++i) {
+    u8& overdraw = m_overdraw[vram_idx + i];
+    if (overdraw != 0xFF)
+      ++overdraw;
+  }
+}
 
-  const auto w = (float)(bar.a + bar.b + bar.c);
-  const u8 r = (u8)((colors[0].r * bar.a + colors[1].r * bar.b + colors[2].r * bar.c) / w);
-  const u8 g = (u8)((colors[0].g * bar.a + colors[1].g * bar.b + colors[2].g * bar.c) / w);
-  const u8 b = (u8)((colors[0].b * bar.a + colors[1].b * bar.b + colors[2].b * bar.c) / w);
+void Rasterizer::rasterize(const TriangleJob& job, s32 clip_top, s32 clip_bottom) const {
+  PixelCounts pixels{};
+  if (job.is_line) {
+    pixels = draw_line_rows(job, clip_top, clip_bottom);
+  } else if (job.is_rectangle) {
+    pixels = draw_rectangle_rows(job, clip_top, clip_bottom);
+  } else {
+    switch (job.render_type) {
+      case PixelRenderType::SHADED:
+        pixels = draw_triangle<PixelRenderType::SHADED>(job, clip_top, clip_bottom);
+        break;
+      case PixelRenderType::TEXTURED_PALETTED_4BIT:
+        pixels = draw_triangle<PixelRenderType::TEXTURED_PALETTED_4BIT>(job, clip_top, clip_bottom);
+        break;
+      case PixelRenderType::TEXTURED_PALETTED_8BIT:
+        pixels = draw_triangle<PixelRenderType::TEXTURED_PALETTED_8BIT>(job, clip_top, clip_bottom);
+        break;
+      case PixelRenderType::TEXTURED_16BIT:
+        pixels = draw_triangle<PixelRenderType::TEXTURED_16BIT>(job, clip_top, clip_bottom);
+        break;
+    }
+  }
+  m_pixel_count.fetch_add(pixels.tested, std::memory_order_relaxed);
 
-  return gpu::RGB16::from_RGB(r, g, b);
+  m_frame_pixels_tested.fetch_add(pixels.tested, std::memory_order_relaxed);
+  m_frame_pixels_written.fetch_add(pixels.written, std::memory_order_relaxed);
+  // Every pixel samples a texel, rectangle rows copied from the page included
+  if (job.render_type != PixelRenderType::SHADED)
+    m_frame_texels[(size_t)job.render_type].fetch_add(pixels.tested, std::memory_order_relaxed);
 }
 
-gpu::RGB16 Rasterizer::calculate_pixel_tex_4bit(TextureInfo tex_info, TexelPos texel_pos) const {
-  const auto texpage = gpu::Gp0DrawMode{ tex_info.page };
+template <PixelRenderType RenderType>
+u32 Rasterizer::draw_span(const TriangleJob& job,
+                          Position pos,
+                          u32 count,
+                          const SpanWeights& bar,
+                          const TexelPlanes& uv_planes) const {
+  const SpanKernels& kernels = span_kernels();
+  const TextureInfo* tex_info = &job.tex_info;
+  const DrawCommand::Flags draw_flags = job.draw_flags;
+  const DitherOffsets& dither = job.is_dithered ? dither_offsets(pos.x, pos.y) : no_dither_offsets();
 
-  const auto index_x = texel_pos.x / 4 + texpage.tex_base_x();
-  const auto index_y = texel_pos.y + texpage.tex_base_y();
+  constexpr bool is_textured = RenderType != PixelRenderType::SHADED;
+
+  std::array<u16, MAX_SPAN_LENGTH> out_colors;
+  u32 write_mask = (1 << count) - 1;
 
-  const u16 index = m_gpu.get_vram_pos(index_x, index_y);
+  if constexpr (is_textured) {
+    std::array<s32, MAX_SPAN_LENGTH> texel_x;
+    std::array<s32, MAX_SPAN_LENGTH> texel_y;
 
-  const auto index_shift = (texel_pos.x & 0b11) * 4;
-  const u16 entry = (index >> index_shift) & 0xF;
+    kernels.texel_coords(span_texcoords(uv_planes, pos), job.tex_window, count, texel_x.data(),
+                         texel_y.data());
 
-  const auto clut_x = tex_info.palette.x() + entry;
-  const auto clut_y = tex_info.palette.y();
+    for (u32 i = 0; i < count; ++i) {
+      // Coordinates are already wrapped, the mask only keeps the load inside of the page
+      const u32 texel_idx = texel_index(texel_x[i] & 0xFF, texel_y[i] & 0xFF);
+      const auto texel_color = gpu::RGB16::from_word(job.texels[texel_idx]);
+      out_colors[i] = texel_color.word;
+
+      // Don't write to VRAM if drawing a texture
+      if (texel_color.word == 0x0000)
+        write_mask &= ~(1 << i);
+    }
 
-  const u16 color = m_gpu.get_vram_pos(clut_x, clut_y);
+    // Apply texture color or shading
+    if (draw_flags.texture_mode != DrawCommand::TextureMode::Raw) {
+      const bool is_gouraud = draw_flags.shading == DrawCommand::Shading::Gouraud;
+      const SpanColors colors = is_gouraud ? span_colors(bar, job.colors, job.area_recip, count)
+                                           : flat_span_colors(tex_info->color);
+      kernels.modulate(colors, dither, count, out_colors.data());
+    }
+  } else {
+    kernels.shade(span_colors(bar, job.colors, job.area_recip, count), dither, count,
+                  out_colors.data());
+  }
 
-  return gpu::RGB16::from_word(color);
+  // Written VRAM is marked dirty for the whole triangle when it's submitted, workers can't do it
+  const u32 vram_idx = pos.y * gpu::VRAM_WIDTH + pos.x;
+  const u32 written = count_written(job.output, vram_idx, count, write_mask);
+  u16* row = &m_gpu.vram()[vram_idx];
+  if (job.output.is_opaque()) {
+    for (u32 i = 0; i < count; ++i)
+      if (write_mask & (1 << i))
+        row[i] = out_colors[i];
+  } else
+    kernels.write(job.output, count, write_mask, out_colors.data(), row);
+  return written;
 }
 
-gpu::RGB16 Rasterizer::calculate_pixel_tex_8bit(TextureInfo tex_info, TexelPos texel_pos) const {
-  const auto texpage = gpu::Gp0DrawMode{ tex_info.page };
+void Rasterizer::submit_triangle(Position3 pos,
+                                 const Color3* col,
+                                 const TextureInfo* tex_info,
+                                 DrawCommand::Flags draw_flags,
+                                 PixelRenderType render_type) {
+  TriangleJob job{};
 
-  const auto index_x = texel_pos.x / 2 + texpage.tex_base_x();
-  const auto index_y = texel_pos.y + texpage.tex_base_y();
+  // Apply drawing offset
+  const auto drawing_offset = m_gpu.m_drawing_offset;
 
-  const u16 index = m_gpu.get_vram_pos(index_x, index_y);
+  for (auto i = 0; i < 3; ++i) {
+    pos[i].x += drawing_offset.x;
+    pos[i].y += drawing_offset.y;
+  }
 
-  const auto index_shift = (texel_pos.x & 0b01) * 8;
-  const u16 entry = (index >> index_shift) & 0xFF;
+  const s32 area = orient_2d(pos[0], pos[1], pos[2]);
+  if (area == 0)  // TODO: Is this needed?
+    return;
 
-  const auto clut_x = tex_info.palette.x() + entry;
-  const auto clut_y = tex_info.palette.y();
+  // Triangle bounding box, clipped by submit_job()
+  const auto [v0, v1, v2] = pos;
+  job.bbox_min = { std::min({ v0.x, v1.x, v2.x }), std::min({ v0.y, v1.y, v2.y }) };
+  job.bbox_max = { std::max({ v0.x, v1.x, v2.x }), std::max({ v0.y, v1.y, v2.y }) };
+
+  job.pos = pos;
+  job.colors = *col;
+  job.tex_info = tex_info != nullptr ? *tex_info : TextureInfo{};
+  job.draw_flags = draw_flags;
+  job.render_type = render_type;
+  job.area_recip = area_reciprocal(std::abs(area));
+  if (render_type != PixelRenderType::SHADED)
+    job.texel_recip = texel_reciprocal(std::abs(area));
+  submit_job(job);
+}
 
-  const u16 color = m_gpu.get_vram_pos(clut_x, clut_y);
+void Rasterizer::submit_rectangle(Position pos,
+                                  Size size,
+                                  const TextureInfo& tex_info,
+                                  DrawCommand::Flags draw_flags,
+                                  PixelRenderType render_type) {
+  TriangleJob job{};
 
-  return gpu::RGB16::from_word(color);
+  const auto drawing_offset = m_gpu.m_drawing_offset;
+  pos.x += drawing_offset.x;
+  pos.y += drawing_offset.y;
+
+  job.bbox_min = pos;
+  job.bbox_max = { (s16)(pos.x + size.width), (s16)(pos.y + size.height) };
+
+  job.pos = { pos, pos, pos };
+  job.tex_info = tex_info;
+  job.draw_flags = draw_flags;
+  job.render_type = render_type;
+  job.is_rectangle = true;
+  job.flip_x = m_gpu.m_draw_mode.rect_textured_x_flip;
+  job.flip_y = m_gpu.m_draw_mode.rect_textured_y_flip;
+  submit_job(job);
 }
 
-gpu::RGB16 Rasterizer::calculate_pixel_tex_16bit(TextureInfo tex_info, TexelPos texel_pos) const {
-  const auto texpage = gpu::Gp0DrawMode{ tex_info.page };
+void Rasterizer::submit_line(Position2 pos, const Color2& colors, DrawCommand::Flags draw_flags) {
+  TriangleJob job{};
 
-  const auto color_x = texel_pos.x + texpage.tex_base_x();
-  const auto color_y = texel_pos.y + texpage.tex_base_y();
+  const auto drawing_offset = m_gpu.m_drawing_offset;
+  for (auto& p : pos) {
+    p.x += drawing_offset.x;
+    p.y += drawing_offset.y;
+  }
 
-  u16 color = m_gpu.get_vram_pos(color_x, color_y);
+  // Like the GPU does, lines too long to be drawn are dropped
+  const s32 dx = pos[1].x - pos[0].x;
+  const s32 dy = pos[1].y - pos[0].y;
+  if (std::abs(dx) >= 1024 || std::abs(dy) >= 512)
+    return;
 
-  return gpu::RGB16::from_word(color);
+  // Stepped from the end with the lower major coordinate, for the pixels of a row to be in order
+  const bool is_reversed = (std::abs(dx) >= std::abs(dy) ? dx : dy) < 0;
+  const Position start = pos[is_reversed];
+  const Position end = pos[!is_reversed];
+  job.pos = { start, end, end };
+  job.colors = { colors[is_reversed], colors[!is_reversed], colors[!is_reversed] };
+
+  // Both end points are drawn, the maximum is exclusive
+  job.bbox_min = { std::min(start.x, end.x), std::min(start.y, end.y) };
+  job.bbox_max = { (s16)(std::max(start.x, end.x) + 1), (s16)(std::max(start.y, end.y) + 1) };
+
+  job.tex_info = TextureInfo{};
+  job.draw_flags = draw_flags;
+  job.render_type = PixelRenderType::SHADED;
+  job.is_line = true;
+  submit_job(job);
 }
 
-TexelPos Rasterizer::calculate_texel_pos(BarycentricCoords bar, s32 area, Texcoord3 uv) const {
-  TexelPos texel;
+void Rasterizer::submit_job(TriangleJob& job) {
+  ++m_primitive_count;
+  auto type = DrawCommand::PrimitiveType::Polygon;
+  if (job.is_rectangle)
+    type = DrawCommand::PrimitiveType::Rectangle;
+  else if (job.is_line)
+    type = DrawCommand::PrimitiveType::Line;
+  ++m_frame_primitives[(u8)type - 1];
 
-  texel.x = (s32)(bar.a * uv[0].x + bar.b * uv[1].x + bar.c * uv[2].x) / area;
-  texel.y = (s32)(bar.a * uv[0].y + bar.b * uv[1].y + bar.c * uv[2].y) / area;
+  // Clip the bounding box against drawing area bounds
+  const auto da_left = m_gpu.m_drawing_area_top_left.x;
+  const auto da_top = m_gpu.m_drawing_area_top_left.y;
+  const auto da_right = m_gpu.m_drawing_area_bottom_right.x;
+  const auto da_bottom = m_gpu.m_drawing_area_bottom_right.y;
+  job.bbox_min.x = std::max((s16)da_left, std::max((s16)0, job.bbox_min.x));
+  job.bbox_min.y = std::max((s16)da_top, std::max((s16)0, job.bbox_min.y));
+  job.bbox_max.x = std::min((s16)da_right, std::min((s16)gpu::VRAM_WIDTH, job.bbox_max.x));
+  job.bbox_max.y = std::min((s16)da_bottom, std::min((s16)gpu::VRAM_HEIGHT, job.bbox_max.y));
 
-  // Texture repeats
-  texel.x %= 256;
-  texel.y %= 256;
+  const VramRect bbox{ job.bbox_min.x, job.bbox_min.y, job.bbox_max.x, job.bbox_max.y };
+  if (bbox.is_empty())
+    return;
 
-  // Texture mask
   const auto tex_win = m_gpu.m_tex_window;
-  texel.x = (texel.x & ~(tex_win.tex_window_mask_x * 8)) |
-            ((tex_win.tex_window_off_x & tex_win.tex_window_mask_x) * 8);
-  texel.y = (texel.y & ~(tex_win.tex_window_mask_y * 8)) |
-            ((tex_win.tex_window_off_y & tex_win.tex_window_mask_y) * 8);
+  job.tex_window = TexelWindow::from_gp0(tex_win.tex_window_mask_x, tex_win.tex_window_off_x,
+                                         tex_win.tex_window_mask_y, tex_win.tex_window_off_y);
+
+  // Textured draws blend as their texture page says, which is the draw mode for rectangles
+  const auto gpustat = m_gpu.m_gpustat;
+  const bool is_textured = job.render_type != PixelRenderType::SHADED;
+  const auto blend_mode = is_textured ? gpu::GpuStatus{ job.tex_info.page }.semi_transparency
+                                      : gpustat.semi_transparency;
+  job.output = { job.draw_flags.semi_transparency != 0, is_textured, (BlendMode)blend_mode,
+                 gpustat.preserve_masked_bits != 0, (u16)(gpustat.force_set_mask_bit ? 0x8000 : 0) };
+
+  // Only colors computed per pixel are dithered
+  const bool is_gouraud = job.draw_flags.shading == DrawCommand::Shading::Gouraud;
+  const bool is_modulated = is_textured && job.draw_flags.texture_mode != DrawCommand::TextureMode::Raw;
+  job.is_dithered = gpustat.dither_en && !job.is_rectangle && (is_gouraud || is_modulated);
+
+  if (is_textured) {
+    job.texels = m_texture_cache.find(job.tex_info.page, job.tex_info.palette.word);
+    if (job.texels == nullptr) {
+      // Queued triangles may be sampling the cached page about to be replaced
+      flush();
+      job.texels = m_texture_cache.decode(job.tex_info.page, job.tex_info.palette.word);
+    }
+  }
+  m_gpu.mark_vram_dirty(bbox);
 
-  return texel;
+  if (m_workers)
+    m_workers->push(job);
+  else
+    rasterize(job, job.bbox_min.y, job.bbox_max.y);
 }
 
 template <PixelRenderType RenderType>
-void Rasterizer::draw_triangle(Position3 pos,
-                               const Color3* col,
-                               const TextureInfo* tex_info,
-                               DrawCommand::Flags draw_flags) {
-  // Algorithm from https://fgiesen.wordpress.com/2013/02/08/triangle-rasterization-in-practice/
-  // TODO: optimize
-
-  // Determine orientation of 3 points in 2D space
-  auto orient_2d = [](Position a, Position b, Position c) -> s32 {
-    return ((s32)b.x - a.x) * ((s32)c.y - a.y) - ((s32)b.y - a.y) * ((s32)c.x - a.x);
-  };
-
-  // Apply drawing offset
-  const auto drawing_offset = m_gpu.m_drawing_offset;
+Rasterizer::PixelCounts Rasterizer::draw_triangle(const TriangleJob& job,
+                                                  s32 clip_top,
+                                                  s32 clip_bottom) const {
+  PROFILE_SCOPE(Rasterizer);
 
-  for (auto i = 0; i < 3; ++i) {
-    pos[i].x += drawing_offset.x;
-    pos[i].y += drawing_offset.y;
-  }
+  // Algorithm from https://fgiesen.wordpress.com/2013/02/08/triangle-rasterization-in-practice/
+  // The edge functions are stepped incrementally and the bounding box is walked in tiles: tiles outside
+  // of an edge are skipped, and tiles inside of all edges are filled without any per-pixel test.
 
   // Short-hands
-  const auto v0 = pos[0];
-  auto v1 = pos[1];
-  auto v2 = pos[2];
+  const auto v0 = job.pos[0];
+  auto v1 = job.pos[1];
+  auto v2 = job.pos[2];
 
   // If CCW order, swap vertices (and tex coords) to make it CW
   const auto area = orient_2d(v0, v1, v2);
-  if (area == 0)  // TODO: Is this needed?
-    return;
   const auto is_ccw = area < 0;
 
   if (is_ccw)
     std::swap(v1, v2);
 
-  // Compute triangle bounding box and clip against drawing area bounds
-  const auto da_left = m_gpu.m_drawing_area_top_left.x;
-  const auto da_top = m_gpu.m_drawing_area_top_left.y;
-  const auto da_right = m_gpu.m_drawing_area_bottom_right.x;
-  const auto da_bottom = m_gpu.m_drawing_area_bottom_right.y;
-  const s16 min_x = std::max((s16)da_left, std::max((s16)0, std::min({ v0.x, v1.x, v2.x })));
-  const s16 min_y = std::max((s16)da_top, std::max((s16)0, std::min({ v0.y, v1.y, v2.y })));
-  const s16 max_x =
-      std::min((s16)da_right, std::min((s16)gpu::VRAM_WIDTH, std::max({ v0.x, v1.x, v2.x })));
-  const s16 max_y =
-      std::min((s16)da_bottom, std::min((s16)gpu::VRAM_HEIGHT, std::max({ v0.y, v1.y, v2.y })));
+  const s16 min_x = job.bbox_min.x;
+  const s16 min_y = std::max<s16>(job.bbox_min.y, clip_top);
+  const s16 max_x = job.bbox_max.x;
+  const s16 max_y = std::min<s16>(job.bbox_max.y, clip_bottom);
+
+  // Barycentric coordinates of the bounding box origin
+  const Position origin{ min_x, min_y };
+  const EdgeFunction e0(v1, v2, origin);
+  const EdgeFunction e1(v2, v0, origin);
+  const EdgeFunction e2(v0, v1, origin);
+
+  // UV planes, each vertex UV weighted by its edge function (undoing the vertex swap)
+  TexelPlanes uv_planes{ origin, {}, {}, {} };
+  if constexpr (RenderType != PixelRenderType::SHADED) {
+    const Texcoord3& uv = job.tex_info.uv_active;
+    const std::array<const EdgeFunction*, 3> edges{ &e0, is_ccw ? &e2 : &e1, is_ccw ? &e1 : &e2 };
+    for (u32 axis = 0; axis < 2; ++axis) {
+      s64 at_origin = 0, step_x = 0, step_y = 0;
+      for (u32 i = 0; i < 3; ++i) {
+        const s32 value = axis == 0 ? uv[i].x : uv[i].y;
+        at_origin += (s64)edges[i]->origin_value * value;
+        step_x += (s64)edges[i]->step_x * value;
+        step_y += (s64)edges[i]->step_y * value;
+      }
+      uv_planes.at_origin[axis] = (u64)at_origin * job.texel_recip;
+      uv_planes.step_x[axis] = (u64)step_x * job.texel_recip;
+      uv_planes.step_y[axis] = (u64)step_y * job.texel_recip;
+    }
+  }
+
+  PixelCounts pixels{};
 
   // Rasterize
-  Position p_iter;
-  for (p_iter.y = min_y; p_iter.y < max_y; p_iter.y++)
-    for (p_iter.x = min_x; p_iter.x < max_x; p_iter.x++) {
-      // Determine barycentric coordinates
-      const auto w0 = orient_2d(v1, v2, p_iter);
-      auto w1 = orient_2d(v2, v0, p_iter);
-      auto w2 = orient_2d(v0, v1, p_iter);
-
-      // If p is on or inside all edges, render pixel
-      if (w0 >= 0 && w1 >= 0 && w2 >= 0) {
-        if (is_ccw)
-          std::swap(w1, w2);
-        const auto area_abs = std::abs(area);
-        const auto bar = BarycentricCoords{ w0, w1, w2 };
-        draw_pixel<RenderType>(p_iter, col, tex_info, bar, area_abs, draw_flags);
+  for (s32 tile_y = min_y; tile_y < max_y; tile_y += RASTER_TILE_SIZE) {
+    const s32 tile_h = std::min<s32>(RASTER_TILE_SIZE, max_y - tile_y);
+
+    for (s32 tile_x = min_x; tile_x < max_x; tile_x += RASTER_TILE_SIZE) {
+      const s32 tile_w = std::min<s32>(RASTER_TILE_SIZE, max_x - tile_x);
+
+      // Barycentric coordinates of the tile's top left pixel
+      const s32 tile_w0 = e0.at(tile_x - min_x, tile_y - min_y);
+      const s32 tile_w1 = e1.at(tile_x - min_x, tile_y - min_y);
+      const s32 tile_w2 = e2.at(tile_x - min_x, tile_y - min_y);
+
+      // The whole tile is outside of an edge
+      if (e0.max_in_tile(tile_w0, tile_w, tile_h) < 0 || e1.max_in_tile(tile_w1, tile_w, tile_h) < 0 ||
+          e2.max_in_tile(tile_w2, tile_w, tile_h) < 0)
+        continue;
+
+      // The whole tile is inside of all edges
+      const bool is_covered = e0.min_in_tile(tile_w0, tile_w, tile_h) >= 0 &&
+                              e1.min_in_tile(tile_w1, tile_w, tile_h) >= 0 &&
+                              e2.min_in_tile(tile_w2, tile_w, tile_h) >= 0;
+
+      s32 row_w0 = tile_w0;
+      s32 row_w1 = tile_w1;
+      s32 row_w2 = tile_w2;
+
+      for (s32 y = tile_y; y < tile_y + tile_h; y++) {
+        s32 w0 = row_w0;
+        s32 w1 = row_w1;
+        s32 w2 = row_w2;
+
+        // Pixels on or inside all edges (none of the signs is set) are collected in runs, and each run
+        // is handed to the span kernels at once
+        s32 span_x = tile_x;
+        SpanWeights span_bar{};
+        for (s32 x = tile_x; x <= tile_x + tile_w; x++) {
+          const bool is_inside = x < tile_x + tile_w && (is_covered || (w0 | w1 | w2) >= 0);
+
+          if (is_inside && span_x == x) {
+            // Undo the vertex swap
+            span_bar = is_ccw ? SpanWeights{ { w0, w2, w1 }, { e0.step_x, e2.step_x, e1.step_x } }
+                              : SpanWeights{ { w0, w1, w2 }, { e0.step_x, e1.step_x, e2.step_x } };
+          } else if (!is_inside) {
+            if (span_x < x) {
+              const Position span_pos{ (s16)span_x, (s16)y };
+              pixels.written += draw_span<RenderType>(job, span_pos, x - span_x, span_bar, uv_planes);
+              pixels.tested += x - span_x;
+            }
+            span_x = x + 1;
+          }
+
+          w0 += e0.step_x;
+          w1 += e1.step_x;
+          w2 += e2.step_x;
+        }
+
+        row_w0 += e0.step_y;
+        row_w1 += e1.step_y;
+        row_w2 += e2.step_y;
       }
     }
+  }
+  return pixels;
 }
 
-void Rasterizer::draw_triangle_textured(Position3 tri_positions,
-                                        const Color3* col,
-                                        TextureInfo tex_info,
-                                        DrawCommand::Flags draw_flags,
-                                        PixelRenderType pixel_render_type) {
-  switch (pixel_render_type) {
-    case PixelRenderType::TEXTURED_PALETTED_4BIT:
-      draw_triangle<PixelRenderType::TEXTURED_PALETTED_4BIT>(tri_positions, col, &tex_info, draw_flags);
-      break;
-    case PixelRenderType::TEXTURED_PALETTED_8BIT:
-      draw_triangle<PixelRenderType::TEXTURED_PALETTED_8BIT>(tri_positions, col, &tex_info, draw_flags);
-      break;
-    case PixelRenderType::TEXTURED_16BIT:
-      draw_triangle<PixelRenderType::TEXTURED_16BIT>(tri_positions, col, &tex_info, draw_flags);
-      break;
-    case PixelRenderType::SHADED:
-    default: LOG_ERROR("Invalid textured PixelRenderType"); break;
+Rasterizer::PixelCounts Rasterizer::draw_rectangle_rows(const TriangleJob& job,
+                                                        s32 clip_top,
+                                                        s32 clip_bottom) const {
+  const s32 left = job.bbox_min.x;
+  const s32 top = std::max<s32>(job.bbox_min.y, clip_top);
+  const s32 bottom = std::min<s32>(job.bbox_max.y, clip_bottom);
+  const u32 width = job.bbox_max.x - left;
+  PixelCounts pixels{ top < bottom ? width * (bottom - top) : 0, 0 };
+  const DrawCommand::Flags draw_flags = job.draw_flags;
+  const PixelOutput output = job.output;
+  const SpanKernels& kernels = span_kernels();
+
+  if (job.render_type == PixelRenderType::SHADED) {
+    const Color color = job.tex_info.color;
+    const u16 c16 = gpu::RGB16::from_RGB(color.r, color.g, color.b).word;
+
+    if (output.is_opaque()) {
+      for (s32 y = top; y < bottom; ++y) {
+        add_overdraw(y * gpu::VRAM_WIDTH + left, width);
+        std::fill_n(&m_gpu.vram()[y * gpu::VRAM_WIDTH + left], width, c16);
+      }
+      pixels.written = pixels.tested;
+      return pixels;
+    }
+
+    std::array<u16, MAX_SPAN_LENGTH> fill_colors;
+    fill_colors.fill(c16);
+    for (s32 y = top; y < bottom; ++y) {
+      u16* row = &m_gpu.vram()[y * gpu::VRAM_WIDTH + left];
+      for (u32 x = 0; x < width; x += MAX_SPAN_LENGTH) {
+        const u32 count = std::min<u32>(MAX_SPAN_LENGTH, width - x);
+        const u32 write_mask = (1 << count) - 1;
+        pixels.written += count_written(output, y * gpu::VRAM_WIDTH + left + x, count, write_mask);
+        kernels.write(output, count, write_mask, fill_colors.data(), row + x);
+      }
+    }
+    return pixels;
   }
+
+  const TextureInfo& tex_info = job.tex_info;
+  const TexelWindow window = job.tex_window;
+  const s32 u_step = job.flip_x ? -1 : 1;
+  const s32 v_step = job.flip_y ? -1 : 1;
+  // Texel coordinates of the leftmost pixel drawn, before wrapping around the page
+  const s32 u_left = tex_info.uv[0].x + (left - job.pos[0].x) * u_step;
+
+  // The neutral color leaves texels as they are, a row can then be copied from the texture page
+  const Color color = tex_info.color;
+  const bool is_raw = draw_flags.texture_mode == DrawCommand::TextureMode::Raw ||
+                      (color.r == 128 && color.g == 128 && color.b == 128);
+  const bool is_row_copied =
+      is_raw && output.is_opaque() && u_step == 1 && window.and_x == ~0 && window.or_x == 0;
+  const SpanColors colors = flat_span_colors(color);
+
+  for (s32 y = top; y < bottom; ++y) {
+    const s32 v = ((tex_info.uv[0].y + (y - job.pos[0].y) * v_step) & 0xFF & window.and_y) | window.or_y;
+    // Texels of the row are at texel_index(u, 0) from its first one
+    const u16* texel_row = &job.texels[texel_index(0, v & 0xFF)];
+    u16* row = &m_gpu.vram()[y * gpu::VRAM_WIDTH + left];
+
+    if (is_row_copied) {
+      // In as many pieces as the row wraps around the page, transparent (0x0000) texels aren't written
+      for (u32 x = 0; x < width;) {
+        const u32 u = (u_left + x) & 0xFF;
+        const u32 count = std::min<u32>(width - x, TEXTURE_PAGE_SIZE - u);
+        for (u32 i = 0; i < count; ++i) {
+          const u16 texel = texel_row[texel_index(u + i, 0)];
+          if (texel != 0x0000) {
+            row[x + i] = texel;
+            ++pixels.written;
+            add_overdraw(y * gpu::VRAM_WIDTH + left + x + i, 1);
+          }
+        }
+        x += count;
+      }
+      continue;
+    }
+
+    // Otherwise in spans, for the kernels to modulate them
+    std::array<u16, MAX_SPAN_LENGTH> out_colors;
+    for (u32 x = 0; x < width; x += MAX_SPAN_LENGTH) {
+      const u32 count = std::min<u32>(MAX_SPAN_LENGTH, width - x);
+      u32 write_mask = (1 << count) - 1;
+      for (u32 i = 0; i < count; ++i) {
+        const s32 u = ((u_left + (s32)(x + i) * u_step) & 0xFF & window.and_x) | window.or_x;
+        out_colors[i] = texel_row[texel_index(u & 0xFF, 0)];
+        if (out_colors[i] == 0x0000)
+          write_mask &= ~(1 << i);
+      }
+
+      if (!is_raw)
+        kernels.modulate(colors, no_dither_offsets(), count, out_colors.data());
+
+      pixels.written += count_written(output, y * gpu::VRAM_WIDTH + left + x, count, write_mask);
+      if (output.is_opaque()) {
+        for (u32 i = 0; i < count; ++i)
+          if (write_mask & (1 << i))
+            row[x + i] = out_colors[i];
+      } else
+        kernels.write(output, count, write_mask, out_colors.data(), row + x);
+    }
+  }
+  return pixels;
 }
 
-void Rasterizer::draw_polygon_impl(Position4 positions,
-                                   Color4 colors,
-                                   TextureInfo tex_info,
+Rasterizer::PixelCounts Rasterizer::draw_line_rows(const TriangleJob& job,
+                                                   s32 clip_top,
+                                                   s32 clip_bottom) const {
+  const SpanKernels& kernels = span_kernels();
+  const PixelOutput output = job.output;
+  const s32 left = job.bbox_min.x;
+  const s32 right = job.bbox_max.x;
+  const s32 top = std::max<s32>(job.bbox_min.y, clip_top);
+  const s32 bottom = std::min<s32>(job.bbox_max.y, clip_bottom);
+
+  // DDA along the major axis, see submit_line() for the direction. The minor coordinate and the colors
+  // are stepped in 16.16 fixed point, from the middle of the first pixel: both end up exactly at the
+  // end point, the rounding error of each step being under 2^-16 and lines under 1024 pixels long.
+  const Position start = job.pos[0];
+  const s32 dx = job.pos[1].x - start.x;
+  const s32 dy = job.pos[1].y - start.y;
+  const bool is_x_major = std::abs(dx) >= std::abs(dy);
+  const s32 steps = std::max(std::abs(dx), std::abs(dy));
+  const auto fixed_step = [steps](s32 delta) { return steps > 0 ? delta * (1 << 16) / steps : 0; };
+
+  const s32 minor_start = (is_x_major ? start.y : start.x) * (1 << 16) + 0x8000;
+  const s32 minor_step = fixed_step(is_x_major ? dy : dx);
+
+  // Flat lines have the same color at both ends
+  const Color from = job.colors[0];
+  const Color to = job.colors[1];
+  const std::array<s32, 3> from_channels{ from.r, from.g, from.b };
+  const std::array<s32, 3> to_channels{ to.r, to.g, to.b };
+  SpanColors colors{};
+  for (u32 channel = 0; channel < 3; ++channel) {
+    colors.start[channel] = from_channels[channel] * (1 << 16) + 0x8000;
+    colors.step[channel] = fixed_step(to_channels[channel] - from_channels[channel]);
+  }
+
+  // Consecutive pixels of a row are collected in runs, each drawn as a span like triangles are. Runs of
+  // y-major lines are a single pixel.
+  PixelCounts pixels{};
+  std::array<u16, MAX_SPAN_LENGTH> out_colors;
+  Position run{};
+  s32 run_step = 0;
+  u32 run_length = 0;
+  const auto draw_run = [&]() {
+    if (run_length == 0)
+      return;
+
+    SpanColors run_colors = colors;
+    for (u32 channel = 0; channel < 3; ++channel)
+      run_colors.start[channel] += colors.step[channel] * run_step;
+    const DitherOffsets& dither = job.is_dithered ? dither_offsets(run.x, run.y) : no_dither_offsets();
+    kernels.shade(run_colors, dither, run_length, out_colors.data());
+
+    const u32 vram_idx = run.y * gpu::VRAM_WIDTH + run.x;
+    const u32 write_mask = (1 << run_length) - 1;
+    pixels.written += count_written(output, vram_idx, run_length, write_mask);
+    pixels.tested += run_length;
+    u16* row = &m_gpu.vram()[vram_idx];
+    if (output.is_opaque())
+      std::copy_n(out_colors.data(), run_length, row);
+    else
+      kernels.write(output, run_length, write_mask, out_colors.data(), row);
+    run_length = 0;
+  };
+
+  for (s32 i = 0; i <= steps; ++i) {
+    const s32 minor = (minor_start + minor_step * i) >> 16;
+    const s32 x = is_x_major ? start.x + i : minor;
+    const s32 y = is_x_major ? minor : start.y + i;
+
+    if (x < left || x >= right || y < top || y >= bottom) {
+      draw_run();
+      continue;
+    }
+    if (run_length > 0 && run_length < MAX_SPAN_LENGTH && y == run.y && x == run.x + (s32)run_length) {
+      ++run_length;
+      continue;
+    }
+    draw_run();
+    run = { (s16)x, (s16)y };
+    run_step = i;
+    run_length = 1;
+  }
+  draw_run();
+  return pixels;
+}
+
+void Rasterizer::draw_polygon_impl(const Position4& positions,
+                                   const Color4& colors,
+                                   TextureInfo& tex_info,
                                    bool is_quad,
                                    DrawCommand::Flags draw_flags) {
   // Consolidate args data and call appropriate drawing functions
@@ -266,13 +700,13 @@ void Rasterizer::draw_polygon_impl(Position4 positions,
         tri_positions = tri_positions_second;
       tex_info.update_active_triangle(tri_idx);
 
-      draw_triangle_textured(tri_positions, &tri_colors, tex_info, draw_flags, pixel_render_type);
+      submit_triangle(tri_positions, &tri_colors, &tex_info, draw_flags, pixel_render_type);
     } else {                                       // Non-textured
       if (tri_idx == QuadTriangleIndex::Second) {  // rendering second triangle
         tri_positions = tri_positions_second;
         tri_colors = tri_colors_second;
       }
-      draw_triangle<PixelRenderType::SHADED>(tri_positions, &tri_colors, nullptr, draw_flags);
+      submit_triangle(tri_positions, &tri_colors, nullptr, draw_flags, PixelRenderType::SHADED);
     }
 
     tri_idx = (QuadTriangleIndex)((u32)tri_idx + 1);
@@ -280,7 +714,7 @@ void Rasterizer::draw_polygon_impl(Position4 positions,
 }
 
 void Rasterizer::extract_draw_data_polygon(const DrawCommand::Polygon& polygon,
-                                           const std::vector<u32>& gp0_cmd,
+                                           const Gp0Command& gp0_cmd,
                                            Position4& positions,
                                            Color4& colors,
                                            TextureInfo& tex_info) const {
@@ -306,25 +740,20 @@ void Rasterizer::extract_draw_data_polygon(const DrawCommand::Polygon& polygon,
   }
   tex_info.color = colors[0];
 
-  // TODO: semi transparency
-  // TODO: raw textures
-  // TODO: dithering
 }
 
 void Rasterizer::draw_polygon(const DrawCommand::Polygon& polygon) {
-  const auto gp0_cmd = m_gpu.gp0_cmd();
-
   Position4 positions{};
   Color4 colors{};
   TextureInfo tex_info{};
 
-  extract_draw_data_polygon(polygon, gp0_cmd, positions, colors, tex_info);
+  extract_draw_data_polygon(polygon, m_gpu.gp0_cmd(), positions, colors, tex_info);
 
   draw_polygon_impl(positions, colors, tex_info, polygon.is_quad(), *(DrawCommand::Flags*)&polygon);
 }
 
 void Rasterizer::extract_draw_data_rectangle(const DrawCommand::Rectangle& rectangle,
-                                             const std::vector<u32>& gp0_cmd,
+                                             const Gp0Command& gp0_cmd,
                                              Position4& positions,
                                              Color4& colors,
                                              TextureInfo& tex_info,
@@ -367,10 +796,35 @@ void Rasterizer::draw_rectangle(const DrawCommand::Rectangle& rectangle) {
   Size size{};
 
   extract_draw_data_rectangle(rectangle, m_gpu.gp0_cmd(), positions, colors, tex_info, size);
-  // TODO: semi transparency
-  // TODO: raw textures
-  const auto is_quad = true;
-  draw_polygon_impl(positions, colors, tex_info, is_quad, *(DrawCommand::Flags*)&rectangle);
+
+  // Drawn as is rather than split in triangles, untextured ones with tex_info.color only
+  auto render_type = PixelRenderType::SHADED;
+  if (rectangle.texture_mapping)
+    render_type = tex_page_col_to_render_type(gpu::Gp0DrawMode{ tex_info.page }.tex_page_colors);
+  else
+    tex_info.color = colors[0];
+  submit_rectangle(positions[0], size, tex_info, *(DrawCommand::Flags*)&rectangle, render_type);
+}
+
+void Rasterizer::extract_draw_data_line(const DrawCommand::Line& line,
+                                        const Gp0Command& gp0_cmd,
+                                        Position2& positions,
+                                        Color2& colors) const {
+  const bool is_gouraud = line.shading == DrawCommand::Shading::Gouraud;
+
+  colors[0] = Color::from_gp0(gp0_cmd[0]);
+  positions[0] = Position::from_gp0(gp0_cmd[1]);
+  colors[1] = is_gouraud ? Color::from_gp0(gp0_cmd[2]) : colors[0];
+  positions[1] = Position::from_gp0(gp0_cmd[is_gouraud ? 3 : 2]);
+}
+
+void Rasterizer::draw_line(const DrawCommand::Line& line) {
+  Position2 positions{};
+  Color2 colors{};
+
+  extract_draw_data_line(line, m_gpu.gp0_cmd(), positions, colors);
+
+  submit_line(positions, colors, *(DrawCommand::Flags*)&line);
 }
 
 PixelRenderType tex_page_col_to_render_type(u8 tex_page_colors) {
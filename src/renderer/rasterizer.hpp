@@ -2,8 +2,13 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <vector>
 #include <gpu/colors.hpp>
 #include <renderer/buffer.hpp>
+#include <renderer/texture_cache.hpp>
 #include <util/bit_utils.hpp>
 #include <util/log.hpp>
 #include <util/types.hpp>
@@ -17,6 +22,26 @@ namespace rasterizer {
 
 constexpr u32 MAX_GP0_CMD_LEN = 32;
 
+// Words of a GP0 command, stored inline so that assembling and copying one never allocates
+class Gp0Command {
+ public:
+  void clear() { m_size = 0; }
+  void push_back(u32 word) {
+    assert(m_size < MAX_GP0_CMD_LEN);
+    m_words[m_size++] = word;
+  }
+
+  u32 operator[](u32 idx) const { return m_words[idx]; }
+  u32 front() const { return m_words[0]; }
+  u32 size() const { return m_size; }
+  const u32* begin() const { return m_words.data(); }
+  const u32* end() const { return m_words.data() + m_size; }
+
+ private:
+  std::array<u32, MAX_GP0_CMD_LEN> m_words{};
+  u32 m_size{};
+};
+
 enum class QuadTriangleIndex {
   None,
   First,
@@ -26,9 +51,13 @@ enum class QuadTriangleIndex {
 struct Color;
 struct Position;
 struct Texcoord;
+struct SpanWeights;
+struct TexelPlanes;
 
+using Color2 = std::array<Color, 2>;
 using Color3 = std::array<Color, 3>;
 using Color4 = std::array<Color, 4>;
+using Position2 = std::array<Position, 2>;
 using Position3 = std::array<Position, 3>;
 using Position4 = std::array<Position, 4>;
 using Texcoord3 = std::array<Texcoord, 3>;
@@ -144,15 +173,38 @@ enum class PixelRenderType {
   TEXTURED_16BIT,
 };
 
-struct BarycentricCoords {
-  s32 a;
-  s32 b;
-  s32 c;
+// Texture window, as masks applied to wrapped texel coordinates
+struct TexelWindow {
+  s32 and_x;
+  s32 or_x;
+  s32 and_y;
+  s32 or_y;
+
+  // From the GP0(E2h) fields, which are in 8 pixel steps
+  static TexelWindow from_gp0(u32 mask_x, u32 offset_x, u32 mask_y, u32 offset_y) {
+    return { ~(s32)(mask_x * 8), (s32)((offset_x & mask_x) * 8), ~(s32)(mask_y * 8),
+             (s32)((offset_y & mask_y) * 8) };
+  }
+};
+
+// GPUSTAT.5-6 "Semi Transparency", B being the VRAM pixel and F the drawn one
+enum class BlendMode : u8 {
+  Average = 0,     // B/2+F/2
+  Add = 1,         // B+F
+  Subtract = 2,    // B-F
+  AddQuarter = 3,  // B+F/4
 };
 
-struct TexelPos {
-  s32 x;
-  s32 y;
+// How drawn pixels are written to VRAM
+struct PixelOutput {
+  bool is_blended;       // Semi-transparent drawing
+  bool is_textured;      // Only the texels with their bit 15 set are then blended
+  BlendMode blend_mode;  // Of the GPUSTAT, or the texture page of textured polygons
+  bool check_mask;       // GPUSTAT.12, pixels with their bit 15 set aren't drawn over
+  u16 set_mask;          // GPUSTAT.11, ORed into the drawn pixels
+
+  // Pixels can be written as they are
+  bool is_opaque() const { return !is_blended && !check_mask && set_mask == 0; }
 };
 
 // First byte of GP0 draw commands
@@ -196,11 +248,11 @@ union DrawCommand {
     u8 : 3;
 
     bool is_poly() const { return line_count == LineCount::Poly; }
-    u8 get_arg_count() const {
-      if (is_poly())
-        return MAX_GP0_CMD_LEN - 1;
-      return 2 + (shading == Shading::Gouraud ? 1 : 0);
-    }
+    // Of a single line, or of each segment of a polyline: a polyline goes on until the terminator comes
+    // in place of its next vertex or color, and is issued a segment at a time (see
+    // gpu::Gpu::is_polyline())
+    u8 get_arg_count() const { return 2 + (shading == Shading::Gouraud ? 1 : 0); }
+    static bool is_poly_terminator(u32 word) { return (word & 0xF000F000) == 0x50005000; }
 
   } line;
 
@@ -264,60 +316,163 @@ union DrawCommand {
   } flags;
 };
 
+// Everything needed to rasterize a triangle, or a rectangle, captured from the GPU state when it's
+// submitted
+struct TriangleJob {
+  Position3 pos;  // Drawing offset applied
+  Color3 colors;
+  TextureInfo tex_info;
+  DrawCommand::Flags draw_flags;
+  PixelRenderType render_type;
+  TexelWindow tex_window;
+  PixelOutput output;
+  bool is_dithered;   // GPUSTAT.9, only for shaded or modulated triangles
+  u64 area_recip;     // See area_reciprocal() in renderer/span_kernels.hpp
+  u64 texel_recip;    // See texel_reciprocal(), only set if textured
+  const u16* texels;  // Decoded texture page (see TextureCache), null if not textured
+  // Bounding box, clipped to the drawing area and VRAM (max exclusive)
+  Position bbox_min;
+  Position bbox_max;
+  // Rectangles are the whole bounding box, textured from tex_info.uv[0] at pos[0] on
+  bool is_rectangle;
+  bool flip_x;  // Texels of rectangles are stepped right to left
+  bool flip_y;  // Or bottom to top
+  // Lines are from pos[0] to pos[1] included, colored from colors[0] to colors[1]
+  bool is_line;
+};
+
+class RasterWorkers;
+
+// Work done since the rasterizer was created
+struct RasterStats {
+  u64 primitives{};  // Triangles, rectangles and lines, a quad counts as 2 triangles
+  u64 pixels{};      // Inside of them and the drawing area, written or not
+};
+
+// Work done over the last frame, to tell fill-rate bound scenes apart
+struct RasterFrameStats {
+  std::array<u32, 3> primitives{};  // By DrawCommand::PrimitiveType, see primitive_count()
+  u64 pixels_tested{};              // As in RasterStats::pixels
+  u64 pixels_written{};             // Of those, the ones neither transparent nor masked (GPUSTAT.12)
+  std::array<u64, 4> texels{};      // Fetched, by PixelRenderType
+
+  u32 primitive_count(DrawCommand::PrimitiveType type) const { return primitives[(u8)type - 1]; }
+};
+
 class Rasterizer {
  public:
-  explicit Rasterizer(gpu::Gpu& gpu) : m_gpu(gpu) {}
+  explicit Rasterizer(gpu::Gpu& gpu);
+  ~Rasterizer();
+
+  // With workers, triangles are queued and rasterized in parallel (see renderer/raster_workers.hpp),
+  // otherwise right away. 0 workers rasterizes on the calling thread.
+  void set_worker_count(u32 worker_count);
+  u32 worker_count() const { return m_worker_count; }
+  // Waits for queued triangles, must be called before VRAM is accessed by anything but the rasterizer
+  void flush();
+  // Only complete once flushed
+  RasterStats stats() const {
+    return { m_primitive_count, m_pixel_count.load(std::memory_order_relaxed) };
+  }
 
-  template <PixelRenderType RenderType>
-  void draw_pixel(Position pos,
-                  const Color3* col,
-                  const TextureInfo* tex_info,
-                  BarycentricCoords bar,
-                  s32 area,
-                  DrawCommand::Flags draw_flags) const;
+  // Starts the next frame's stats and overdraw, must be flushed
+  void end_frame();
+  const RasterFrameStats& frame_stats() const { return m_last_frame; }
+  // Counts how many times each VRAM pixel is written over a frame, off by default
+  void set_overdraw_tracking(bool enabled);
+  // Of the last frame, saturating at 255, empty unless tracking
+  const std::vector<u8>& overdraw() const { return m_last_overdraw; }
 
-  template <PixelRenderType RenderType>
-  void draw_triangle(Position3 pos,
-                     const Color3* col,
-                     const TextureInfo* tex_info,
-                     DrawCommand::Flags draw_flags);
+  // Rasterizes the rows [clip_top, clip_bottom) of the triangle
+  void rasterize(const TriangleJob& job, s32 clip_top, s32 clip_bottom) const;
 
   void draw_polygon(const DrawCommand::Polygon& polygon);
   void draw_rectangle(const DrawCommand::Rectangle& polygon);
+  // A single line, or a segment of a polyline
+  void draw_line(const DrawCommand::Line& line);
 
   void extract_draw_data_polygon(const DrawCommand::Polygon& polygon,
-                                 const std::vector<u32>& gp0_cmd,
+                                 const Gp0Command& gp0_cmd,
                                  Position4& positions,
                                  Color4& colors,
                                  TextureInfo& tex_info) const;
   void extract_draw_data_rectangle(const DrawCommand::Rectangle& rectangle,
-                                   const std::vector<u32>& gp0_cmd,
+                                   const Gp0Command& gp0_cmd,
                                    Position4& positions,
                                    Color4& colors,
                                    TextureInfo& tex_info,
                                    Size& size) const;
+  void extract_draw_data_line(const DrawCommand::Line& line,
+                              const Gp0Command& gp0_cmd,
+                              Position2& positions,
+                              Color2& colors) const;
 
  private:
-  void draw_polygon_impl(Position4 positions,
-                         Color4 colors,
-                         TextureInfo tex_info,
+  void draw_polygon_impl(const Position4& positions,
+                         const Color4& colors,
+                         TextureInfo& tex_info,
                          bool is_quad,
                          DrawCommand::Flags draw_flags);
-  void draw_triangle_textured(Position3 tri_positions,
-                              const Color3* col,
-                              TextureInfo tex_info,
-                              DrawCommand::Flags draw_flags,
-                              PixelRenderType pixel_render_type);
-
-  TexelPos calculate_texel_pos(BarycentricCoords bar, s32 area, Texcoord3 uv) const;
-  static gpu::RGB16 calculate_pixel_shaded(Color3 colors, BarycentricCoords bar);
-  gpu::RGB16 calculate_pixel_tex_4bit(TextureInfo tex_info, TexelPos texel_pos) const;
-  gpu::RGB16 calculate_pixel_tex_8bit(TextureInfo tex_info, TexelPos texel_pos) const;
-  gpu::RGB16 calculate_pixel_tex_16bit(TextureInfo tex_info, TexelPos texel_pos) const;
+  void submit_triangle(Position3 pos,
+                       const Color3* col,
+                       const TextureInfo* tex_info,
+                       DrawCommand::Flags draw_flags,
+                       PixelRenderType render_type);
+  void submit_rectangle(Position pos,
+                        Size size,
+                        const TextureInfo& tex_info,
+                        DrawCommand::Flags draw_flags,
+                        PixelRenderType render_type);
+  void submit_line(Position2 pos, const Color2& colors, DrawCommand::Flags draw_flags);
+  // Clips the job's bounding box, and rasterizes it or queues it for the workers
+  void submit_job(TriangleJob& job);
+
+  struct PixelCounts {
+    u32 tested;
+    u32 written;
+  };
+
+  // Both return how many pixels they covered, and wrote
+  template <PixelRenderType RenderType>
+  PixelCounts draw_triangle(const TriangleJob& job, s32 clip_top, s32 clip_bottom) const;
+  // Rectangles are drawn a row at a time, texels being stepped along the row without any interpolation
+  PixelCounts draw_rectangle_rows(const TriangleJob& job, s32 clip_top, s32 clip_bottom) const;
+  // Lines are stepped along their major axis, the pixels of a row being drawn in spans
+  PixelCounts draw_line_rows(const TriangleJob& job, s32 clip_top, s32 clip_bottom) const;
+  // Draws count pixels to the right of pos, see renderer/span_kernels.hpp. Returns how many it wrote.
+  template <PixelRenderType RenderType>
+  u32 draw_span(const TriangleJob& job,
+                Position pos,
+                u32 count,
+                const SpanWeights& bar,
+                const TexelPlanes& uv_planes) const;
+  // Called before write_mask's pixels of the count at vram_idx are written: drops the mask bits of the
+  // masked ones, counts the others in the overdraw and returns how many there are
+  u32 count_written(const PixelOutput& output, u32 vram_idx, u32 count, u32 write_mask) const;
+  // Counts count pixels at vram_idx in the overdraw, when tracking
+  void add_overdraw(u32 vram_idx, u32 count) const;
 
  private:
   // GPU reference
   gpu::Gpu& m_gpu;
+
+  std::unique_ptr<RasterWorkers> m_workers;  // Null without workers
+  u32 m_worker_count{};
+  TextureCache m_texture_cache;
+
+  u64 m_primitive_count{};
+  mutable std::atomic<u64> m_pixel_count{};  // Added to once per job, by whichever thread rasterizes it
+
+  // This frame's RasterFrameStats, the pixel ones are added to once per job as m_pixel_count
+  std::array<u32, 3> m_frame_primitives{};
+  mutable std::atomic<u64> m_frame_pixels_tested{};
+  mutable std::atomic<u64> m_frame_pixels_written{};
+  mutable std::array<std::atomic<u64>, 4> m_frame_texels{};
+  RasterFrameStats m_last_frame;
+
+  // Workers own every pixel of their bands, so the counts of a pixel are only written by one thread
+  mutable std::vector<u8> m_overdraw;  // This frame's, empty unless tracking
+  std::vector<u8> m_last_overdraw;
 };
 
 }  // namespace rasterizer
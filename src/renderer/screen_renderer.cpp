@@ -1,9 +1,12 @@
 #include <renderer/screen_renderer.hpp>
 
 #include <renderer/shader.hpp>
+#include <util/profiler.hpp>
 
 #include <glbinding/gl/gl.h>
 
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
 using namespace gl;
@@ -13,6 +16,10 @@ namespace renderer {
 const GLuint ATTRIB_INDEX_POSITION = 0;
 const GLuint ATTRIB_INDEX_TEXCOORD = 1;
 
+// Pixel buffers are laid out like VRAM, with only the uploaded rectangles written to
+const s32 PBO_ROW_LENGTH = 1024;
+const GLsizeiptr PBO_SIZE = PBO_ROW_LENGTH * 512 * sizeof(u16);
+
 ScreenRenderer::ScreenRenderer() {
   // Load and compile shaders
   m_shader_program_screen = renderer::load_shaders("screen");
@@ -55,49 +62,144 @@ ScreenRenderer::ScreenRenderer() {
   glVertexAttribPointer(ATTRIB_INDEX_TEXCOORD, 2, GL_FLOAT, GL_FALSE, vertex_stride,
                         (const void*)texcoord_offset);
 
-  // Generate and configure screen texture
+  // Generate and configure screen texture, the shader picks the pixels out itself
   glGenTextures(1, &m_tex_screen);
   bind_screen_texture();
 
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, PBO_ROW_LENGTH, 512, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT,
+               nullptr);
+
+  // Generate pixel buffers
+  glGenBuffers((GLsizei)m_pbos.size(), m_pbos.data());
+  for (const auto pbo : m_pbos) {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, PBO_SIZE, nullptr, GL_STREAM_DRAW);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-  // Get uniforms
-  m_u_tex_size = glGetUniformLocation(m_shader_program_screen, "u_tex_size");
+  // Get uniforms, the scaled texture of render_texture() is bound next to VRAM
+  glUniform1i(glGetUniformLocation(m_shader_program_screen, "u_vram"), 0);
+  glUniform1i(glGetUniformLocation(m_shader_program_screen, "u_scaled"), 1);
+  m_u_origin = glGetUniformLocation(m_shader_program_screen, "u_origin");
+  m_u_size = glGetUniformLocation(m_shader_program_screen, "u_size");
+  m_u_visible_size = glGetUniformLocation(m_shader_program_screen, "u_visible_size");
+  m_u_is_24bit = glGetUniformLocation(m_shader_program_screen, "u_is_24bit");
+  m_u_scale = glGetUniformLocation(m_shader_program_screen, "u_scale");
 
   glBindVertexArray(0);
 }
 
-void ScreenRenderer::render(const void* vram_data) const {
+void ScreenRenderer::render(const u16* vram,
+                            const rasterizer::VramBlocks& dirty,
+                            const ScreenArea& area) {
+  PROFILE_SCOPE(ScreenRenderer);
+
   // Bind needed state
   glBindVertexArray(m_vao);
   glUseProgram(m_shader_program_screen);
   bind_screen_texture();
 
   // Upload screen texture
-  glPixelStorei(GL_UNPACK_ROW_LENGTH, 1024);
-  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_screen_width, m_screen_height, GL_RGBA,
-                  GL_UNSIGNED_SHORT_1_5_5_5_REV, vram_data);
-  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  upload(vram, dirty);
 
-  // Set uniforms
-  glUniform2f(m_u_tex_size, (f32)m_screen_width, (f32)m_screen_height);
+  // Set uniforms, a scale of 0 samples VRAM only
+  set_uniforms(area, 0);
 
   // Draw screen
   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
 
-void ScreenRenderer::set_texture_size(s32 width, s32 height) {
+void ScreenRenderer::render_texture(GLuint texture, u32 scale, const ScreenArea& area) const {
+  // Bind needed state
+  glBindVertexArray(m_vao);
+  glUseProgram(m_shader_program_screen);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, texture);
   bind_screen_texture();
 
-  // If screen texture dimensions changed
-  if (width != m_screen_width || height != m_screen_height) {
-    // Configure texture
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_SHORT_1_5_5_5_REV,
-                 nullptr);
-    m_screen_width = width;
-    m_screen_height = height;
+  // Set uniforms
+  set_uniforms(area, scale);
+
+  // Draw screen
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+void ScreenRenderer::set_uniforms(const ScreenArea& area, u32 scale) const {
+  glUniform2i(m_u_origin, area.x, area.y);
+  glUniform2i(m_u_size, area.width, area.height);
+  glUniform2i(m_u_visible_size, area.visible_width, area.visible_height);
+  glUniform1i(m_u_is_24bit, area.is_24bit);
+  glUniform1i(m_u_scale, (GLint)scale);
+}
+
+void ScreenRenderer::upload(const u16* vram, rasterizer::VramBlocks dirty) {
+  using namespace rasterizer;
+
+  if (m_is_texture_stale) {
+    dirty.set();
+    m_is_texture_stale = false;
+  }
+  if (dirty.none())
+    return;
+
+  // Runs of dirty blocks are uploaded as one rectangle, merged with the one above of the same width
+  m_upload_rects.clear();
+  for (u32 row = 0; row < VRAM_BLOCK_ROWS; ++row) {
+    for (u32 column = 0; column < VRAM_BLOCK_COLUMNS;) {
+      if (!dirty[row * VRAM_BLOCK_COLUMNS + column]) {
+        ++column;
+        continue;
+      }
+      const u32 first_column = column;
+      while (column < VRAM_BLOCK_COLUMNS && dirty[row * VRAM_BLOCK_COLUMNS + column])
+        ++column;
+
+      const VramRect rect{ (s32)(first_column << VRAM_BLOCK_WIDTH_SHIFT),
+                           (s32)(row << VRAM_BLOCK_HEIGHT_SHIFT),
+                           (s32)(column << VRAM_BLOCK_WIDTH_SHIFT),
+                           (s32)((row + 1) << VRAM_BLOCK_HEIGHT_SHIFT) };
+      const auto above =
+          std::find_if(m_upload_rects.begin(), m_upload_rects.end(), [&](const VramRect& r) {
+            return r.left == rect.left && r.right == rect.right && r.bottom == rect.top;
+          });
+      if (above != m_upload_rects.end())
+        above->bottom = rect.bottom;
+      else
+        m_upload_rects.push_back(rect);
+    }
   }
+
+  // Alternate between the pixel buffers so that the previous frame's upload is never waited for
+  m_pbo_index = (m_pbo_index + 1) % m_pbos.size();
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbos[m_pbo_index]);
+  auto* staging = static_cast<u16*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, PBO_SIZE,
+                                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+  if (staging) {
+    for (const auto& rect : m_upload_rects)
+      for (s32 y = rect.top; y < rect.bottom; ++y) {
+        const s32 offset = y * PBO_ROW_LENGTH + rect.left;
+        std::memcpy(staging + offset, vram + offset, (rect.right - rect.left) * sizeof(u16));
+      }
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  } else {
+    // Upload straight from VRAM then
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, PBO_ROW_LENGTH);
+  for (const auto& rect : m_upload_rects) {
+    const s32 offset = rect.top * PBO_ROW_LENGTH + rect.left;
+    // With a pixel buffer bound, the pointer is an offset in it
+    const void* pixels = staging ? reinterpret_cast<const void*>(offset * sizeof(u16)) : vram + offset;
+    glTexSubImage2D(GL_TEXTURE_2D, 0, rect.left, rect.top, rect.right - rect.left,
+                    rect.bottom - rect.top, GL_RED_INTEGER, GL_UNSIGNED_SHORT, pixels);
+  }
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
 void ScreenRenderer::bind_screen_texture() const {
@@ -107,6 +209,7 @@ void ScreenRenderer::bind_screen_texture() const {
 
 ScreenRenderer::~ScreenRenderer() {
   glDeleteTextures(1, &m_tex_screen);
+  glDeleteBuffers((GLsizei)m_pbos.size(), m_pbos.data());
   glDeleteBuffers(1, &m_vbo);
   glDeleteVertexArrays(1, &m_vao);
   glDeleteProgram(m_shader_program_screen);
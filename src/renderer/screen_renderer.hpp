@@ -1,23 +1,48 @@
 #pragma once
 
+#include <renderer/texture_cache.hpp>
+#include <util/types.hpp>
+
 #include <glbinding/gl/types.h>
 
-#include <util/types.hpp>
+#include <array>
+#include <vector>
 
 namespace renderer {
 
+// The part of VRAM shown on screen, see the GP1(05h) to GP1(08h) display registers in gpu/gpu.hpp
+struct ScreenArea {
+  s32 x{};  // Top left in VRAM, wrapping around it
+  s32 y{};
+  s32 width{};  // Of the screen, in pixels
+  s32 height{};
+  s32 visible_width{};  // Shown by the display ranges from the top left, the rest is black
+  s32 visible_height{};
+  bool is_24bit{};  // Pixels are 3 bytes packed across VRAM halfwords rather than 15 bit colors
+};
+
 class ScreenRenderer {
  public:
   explicit ScreenRenderer();
   ~ScreenRenderer();
 
-  void render(const void* vram_data) const;
+  // Only the blocks of vram written to since the last call (see gpu::Gpu::take_dirty_vram()) are
+  // uploaded, through the pixel buffer the previous frame didn't use so that they're copied
+  // asynchronously. VRAM is uploaded as is, the shader decodes the area shown.
+  void render(const u16* vram, const rasterizer::VramBlocks& dirty, const ScreenArea& area);
+  // Renders from a texture of all of VRAM at scale times its resolution, see renderer/hw_renderer.hpp.
+  // 24 bit areas are decoded from the native resolution pixels.
+  void render_texture(gl::GLuint texture, u32 scale, const ScreenArea& area) const;
   void bind_screen_texture() const;
-  void set_texture_size(s32 width, s32 height);
 
  private:
-  s32 m_screen_width{};
-  s32 m_screen_height{};
+  void upload(const u16* vram, rasterizer::VramBlocks dirty);
+  void set_uniforms(const ScreenArea& area, u32 scale) const;
+
+ private:
+  bool m_is_texture_stale{ true };  // Not uploaded since it was allocated, dirty or not
+  // Rectangles of the screen upload() uploads, kept to not be allocated every frame
+  std::vector<rasterizer::VramRect> m_upload_rects;
 
   // Shaders
   gl::GLuint m_shader_program_screen{};
@@ -25,8 +50,14 @@ class ScreenRenderer {
   // Other OpenGL objects
   gl::GLuint m_vao{};
   gl::GLuint m_vbo{};
-  gl::GLuint m_tex_screen{};
-  gl::GLuint m_u_tex_size{};
+  gl::GLuint m_tex_screen{};  // All of VRAM, as 16 bit words
+  std::array<gl::GLuint, 2> m_pbos{};  // Pixel unpack buffers the screen is uploaded through
+  u32 m_pbo_index{};                   // Last one used
+  gl::GLuint m_u_origin{};
+  gl::GLuint m_u_size{};
+  gl::GLuint m_u_visible_size{};
+  gl::GLuint m_u_is_24bit{};
+  gl::GLuint m_u_scale{};
 };
 
 }  // namespace renderer
\ No newline at end of file
@@ -0,0 +1,79 @@
+#version 330 core
+
+// Same texturing and shading as the software rasterizer (see renderer/rasterizer.cpp), but written as
+// is: no blending, mask bit check or dithering
+
+uniform usampler2D u_vram;   // Native resolution VRAM, as 16 bit words
+uniform ivec4 u_tex_window;  // AND x, OR x, AND y, OR y masks
+
+in vec3 v_color;
+in vec2 v_texcoord;
+flat in uvec3 v_texinfo;
+
+out vec4 o_color;
+
+// See HwVertex flags in renderer/hw_renderer.hpp
+const uint FLAG_TEXTURED = 1u;
+const uint FLAG_RAW_TEXTURE = 2u;
+const uint FLAG_SEMI_TRANSPARENT = 4u;
+
+// Interpolated values are floored, these keep values meant to be exact integers from rounding down
+const float COLOR_BIAS = 1.0 / 256.0;
+const float TEXCOORD_BIAS = 1.0 / 1024.0;
+
+uint vram_at(int x, int y) {
+    return texelFetch(u_vram, ivec2(x & 1023, y & 511), 0).r;
+}
+
+uint texel_at(ivec2 uv, uint texpage, uint clut) {
+    int page_x = int(texpage & 0xFu) * 64;
+    int page_y = int((texpage >> 4) & 1u) * 256;
+    int clut_x = int(clut & 0x3Fu) * 16;
+    int clut_y = int((clut >> 6) & 0x1FFu);
+
+    switch ((texpage >> 7) & 3u) {
+        case 0u: {
+            uint index = (vram_at(page_x + uv.x / 4, page_y + uv.y) >> ((uv.x & 3) * 4)) & 0xFu;
+            return vram_at(clut_x + int(index), clut_y);
+        }
+        case 1u: {
+            uint index = (vram_at(page_x + uv.x / 2, page_y + uv.y) >> ((uv.x & 1) * 8)) & 0xFFu;
+            return vram_at(clut_x + int(index), clut_y);
+        }
+        default: return vram_at(page_x + uv.x, page_y + uv.y);
+    }
+}
+
+// texel * color * 2 / 255 per channel, saturated. The mask bit is kept.
+uint modulate(uint texel, uvec3 color) {
+    uvec3 channels = uvec3(texel, texel >> 5, texel >> 10) & 31u;
+    channels = min(channels * color * 2u / 255u, uvec3(31u));
+    return channels.r | channels.g << 5 | channels.b << 10 | (texel & 0x8000u);
+}
+
+void main() {
+    uint flags = v_texinfo.z;
+    uvec3 color = uvec3(clamp(v_color + COLOR_BIAS, 0.0, 255.0));
+    uint pixel;
+
+    if ((flags & FLAG_TEXTURED) != 0u) {
+        ivec2 uv = ivec2(v_texcoord + TEXCOORD_BIAS) & 0xFF;
+        uv = (uv & u_tex_window.xz) | u_tex_window.yw;
+
+        uint texel = texel_at(uv, v_texinfo.x, v_texinfo.y);
+        // Fully transparent texels aren't drawn
+        if (texel == 0u)
+            discard;
+        pixel = (flags & FLAG_RAW_TEXTURE) != 0u ? texel : modulate(texel, color);
+    } else {
+        pixel = (color.r >> 3) | (color.g >> 3) << 5 | (color.b >> 3) << 10;
+        // Semi-transparency isn't emulated (see HwRenderer). Only black pixels are skipped, they leave
+        // VRAM as it is in all blend modes but B/2+F/2.
+        if ((flags & FLAG_SEMI_TRANSPARENT) != 0u && pixel == 0u)
+            discard;
+    }
+
+    // The framebuffer is RGB5_A1, alpha holds the mask bit
+    vec3 rgb = vec3(uvec3(pixel, pixel >> 5, pixel >> 10) & 31u) / 31.0;
+    o_color = vec4(rgb, float(pixel >> 15));
+}
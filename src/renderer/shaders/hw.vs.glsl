@@ -0,0 +1,24 @@
+#version 330 core
+
+layout(location = 0) in vec2 a_position;  // In VRAM pixels
+layout(location = 1) in vec3 a_color;     // 0-255
+layout(location = 2) in vec2 a_texcoord;  // In texels, relative to the texture page
+layout(location = 3) in uvec3 a_texinfo;  // Texpage attribute, CLUT attribute, flags
+
+uniform float u_sample_offset;
+
+out vec3 v_color;
+out vec2 v_texcoord;
+flat out uvec3 v_texinfo;
+
+void main() {
+    // The host GPU samples pixels at their centers, the PlayStation at their top left corners: the
+    // offset moves the (sub)pixel picked when scaling down to a PlayStation pixel's corner. VRAM row 0
+    // is the first row of the framebuffer texture, so there is no flip.
+    vec2 position = (a_position + u_sample_offset) / vec2(1024.0, 512.0) * 2.0 - 1.0;
+
+    v_color = a_color;
+    v_texcoord = a_texcoord;
+    v_texinfo = a_texinfo;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
@@ -1,15 +1,59 @@
 #version 330 core
 
-uniform sampler2D u_vram;
-uniform vec2 u_tex_size;
+// Picks the screen out of VRAM, see ScreenArea in renderer/screen_renderer.hpp
+
+uniform usampler2D u_vram;    // Native resolution VRAM, as 16 bit words
+uniform sampler2D u_scaled;   // VRAM colors at u_scale times the resolution, when u_scale isn't 0
+uniform ivec2 u_origin;       // In VRAM
+uniform ivec2 u_size;         // Of the screen
+uniform ivec2 u_visible_size; // Of the screen's top left shown by the display ranges
+uniform bool u_is_24bit;
+uniform int u_scale;
 
 in vec2 v_texcoord;
 
 out vec4 o_color;
 
+// Wrapping around VRAM, like the display does
+uint vram_at(int x, int y) {
+    ivec2 pos = ivec2(x & 1023, y & 511);
+    if (u_scale == 0)
+        return texelFetch(u_vram, pos, 0).r;
+
+    // Back to the 16 bit word from the middle subpixel of the scaled colors
+    vec4 color = texelFetch(u_scaled, pos * u_scale + u_scale / 2, 0);
+    uvec4 channels = uvec4(round(color * vec4(31.0, 31.0, 31.0, 1.0)));
+    return channels.r | channels.g << 5 | channels.b << 10 | channels.a << 15;
+}
+
+vec3 rgb15(uint word) {
+    return vec3(uvec3(word, word >> 5, word >> 10) & 31u) / 31.0;
+}
+
 void main() {
-    vec2 vram_texcoord = v_texcoord * vec2(u_tex_size.x, u_tex_size.y);
-    vec3 vram_value = texelFetch(u_vram, ivec2(vram_texcoord), 0).rgb;
+    vec2 screen_pos = v_texcoord * vec2(u_size);
+    ivec2 pixel = ivec2(screen_pos);
+    if (pixel.x >= u_visible_size.x || pixel.y >= u_visible_size.y) {
+        o_color = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    int y = u_origin.y + pixel.y;
+    vec3 color;
+    if (u_is_24bit) {
+        // Pixels are 3 bytes packed across halfwords, odd ones start in the upper byte of one
+        int x = u_origin.x + pixel.x * 3 / 2;
+        uint pair = vram_at(x, y) | vram_at(x + 1, y) << 16;
+        uint rgb = (pixel.x & 1) == 0 ? pair : pair >> 8;
+        color = vec3(uvec3(rgb, rgb >> 8, rgb >> 16) & 255u) / 255.0;
+    } else if (u_scale == 0) {
+        color = rgb15(vram_at(u_origin.x + pixel.x, y));
+    } else {
+        // Sampled at the scaled resolution rather than through vram_at() to keep its detail
+        ivec2 scaled_origin = ivec2(u_origin.x & 1023, u_origin.y & 511) * u_scale;
+        ivec2 pos = (scaled_origin + ivec2(screen_pos * float(u_scale))) % (ivec2(1024, 512) * u_scale);
+        color = texelFetch(u_scaled, pos, 0).rgb;
+    }
 
-    o_color = vec4(vram_value, 1.0);
+    o_color = vec4(color, 1.0);
 }
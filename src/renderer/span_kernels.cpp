@@ -0,0 +1,187 @@
+#include <renderer/span_kernels.hpp>
+
+#include <gpu/colors.hpp>
+#include <util/log.hpp>
+
+namespace renderer {
+namespace rasterizer {
+
+namespace {
+
+// MODULATION_LUT[color][texel], see modulate_channel_fine()
+using ModulationLut = std::array<std::array<u16, 32>, 256>;
+
+constexpr ModulationLut make_modulation_lut() {
+  ModulationLut lut{};
+  for (u32 color = 0; color < 256; ++color)
+    for (u32 texel = 0; texel < 32; ++texel)
+      lut[color][texel] = (u16)modulate_channel_fine(texel, color);
+  return lut;
+}
+
+constexpr ModulationLut MODULATION_LUT = make_modulation_lut();
+
+constexpr bool is_modulation_exact() {
+  for (u32 color = 0; color < 256; ++color)
+    for (u32 texel = 0; texel < 32; ++texel)
+      if (MODULATION_LUT[color][texel] != texel * color * 16 / 255 ||
+          modulate_channel(texel, color) != std::min<u32>(texel * color * 2 / 255, 31))
+        return false;
+  return true;
+}
+static_assert(is_modulation_exact(), "Shift based division by 255 is off");
+
+// https://psx-spx.consoledev.net/graphicsprocessingunitgpu/#dithering
+constexpr s32 DITHER_MATRIX[4][4] = {
+  { -4, +0, -3, +1 },
+  { +2, -2, +3, -1 },
+  { -3, +1, -4, +0 },
+  { +3, -1, +2, -2 },
+};
+
+// DITHER_SPANS[y % 4][x % 4], offsets of the span starting at (x, y)
+using DitherSpans = std::array<std::array<DitherOffsets, 4>, 4>;
+
+constexpr DitherSpans make_dither_spans() {
+  DitherSpans spans{};
+  for (u32 y = 0; y < 4; ++y)
+    for (u32 x = 0; x < 4; ++x)
+      for (u32 i = 0; i < MAX_SPAN_LENGTH; ++i)
+        spans[y][x][i] = DITHER_MATRIX[y][(x + i) % 4];
+  return spans;
+}
+
+constexpr DitherSpans DITHER_SPANS = make_dither_spans();
+constexpr DitherOffsets NO_DITHER_OFFSETS{};
+
+// B/2+F/2, B+F, B-F or B+F/4 of one 5 bit channel
+constexpr u32 blend_channel(BlendMode mode, s32 back, s32 front) {
+  switch (mode) {
+    case BlendMode::Average: return (u32)(back + front) >> 1;
+    case BlendMode::Add: return (u32)std::min(back + front, 31);
+    case BlendMode::Subtract: return (u32)std::max(back - front, 0);
+    case BlendMode::AddQuarter: return (u32)std::min(back + (front >> 2), 31);
+  }
+  return (u32)front;
+}
+
+// Fixed point value of sum / area, sum being up to 255 times the area
+s32 fixed_quotient(s32 sum, u64 area_recip) {
+  return (s32)(((s64)sum * (s64)area_recip) >> 32);
+}
+
+void shade_scalar(const SpanColors& colors, const DitherOffsets& dither, u32 count, u16* out) {
+  for (u32 i = 0; i < count; ++i) {
+    gpu::RGB16 pixel{};
+    pixel.r = dither_channel(span_color_channel(colors, 0, i), dither[i]);
+    pixel.g = dither_channel(span_color_channel(colors, 1, i), dither[i]);
+    pixel.b = dither_channel(span_color_channel(colors, 2, i), dither[i]);
+    out[i] = pixel.word;
+  }
+}
+
+void texel_coords_scalar(const SpanTexcoords& uv,
+                         TexelWindow window,
+                         u32 count,
+                         s32* out_x,
+                         s32* out_y) {
+  for (u32 i = 0; i < count; ++i) {
+    out_x[i] = (span_texcoord(uv, 0, i) & window.and_x) | window.or_x;
+    out_y[i] = (span_texcoord(uv, 1, i) & window.and_y) | window.or_y;
+  }
+}
+
+void modulate_scalar(const SpanColors& colors, const DitherOffsets& dither, u32 count, u16* texels) {
+  for (u32 i = 0; i < count; ++i) {
+    auto texel = gpu::RGB16::from_word(texels[i]);
+    texel.r = dither_channel(MODULATION_LUT[span_color_channel(colors, 0, i)][texel.r], dither[i]);
+    texel.g = dither_channel(MODULATION_LUT[span_color_channel(colors, 1, i)][texel.g], dither[i]);
+    texel.b = dither_channel(MODULATION_LUT[span_color_channel(colors, 2, i)][texel.b], dither[i]);
+    texels[i] = texel.word;
+  }
+}
+
+void write_scalar(const PixelOutput& output, u32 count, u32 write_mask, const u16* pixels, u16* dest) {
+  for (u32 i = 0; i < count; ++i) {
+    if (!(write_mask & (1 << i)) || (output.check_mask && (dest[i] & 0x8000)))
+      continue;
+
+    auto pixel = gpu::RGB16::from_word(pixels[i]);
+    if (output.is_blended && (!output.is_textured || pixel.mask)) {
+      const auto back = gpu::RGB16::from_word(dest[i]);
+      pixel.r = blend_channel(output.blend_mode, back.r, pixel.r);
+      pixel.g = blend_channel(output.blend_mode, back.g, pixel.g);
+      pixel.b = blend_channel(output.blend_mode, back.b, pixel.b);
+    }
+    dest[i] = pixel.word | output.set_mask;
+  }
+}
+
+constexpr SpanKernels SCALAR_KERNELS{ "scalar", shade_scalar, texel_coords_scalar, modulate_scalar,
+                                      write_scalar };
+
+const SpanKernels& select_span_kernels() {
+  const SpanKernels* kernels = span_kernels_avx2();
+  if (kernels == nullptr)
+    kernels = span_kernels_sse41();
+  if (kernels == nullptr)
+    kernels = span_kernels_neon();
+  if (kernels == nullptr)
+    kernels = &SCALAR_KERNELS;
+
+  LOG_INFO("Using {} span kernels", kernels->name);
+  return *kernels;
+}
+
+}  // namespace
+
+SpanColors span_colors(const SpanWeights& bar, const Color3& colors, u64 area_recip, u32 count) {
+  // https://codeplea.com/triangular-interpolation
+  // The weights of a pixel always sum up to the triangle area
+  const auto [a, b, c] = bar.w;
+  const auto [step_a, step_b, step_c] = bar.step;
+
+  const s32 sum_r = colors[0].r * a + colors[1].r * b + colors[2].r * c;
+  const s32 sum_g = colors[0].g * a + colors[1].g * b + colors[2].g * c;
+  const s32 sum_b = colors[0].b * a + colors[1].b * b + colors[2].b * c;
+
+  SpanColors span{ { fixed_quotient(sum_r, area_recip), fixed_quotient(sum_g, area_recip),
+                     fixed_quotient(sum_b, area_recip) },
+                   {} };
+
+  // A single pixel span can be part of a sliver too thin for the change per pixel to be a sensible
+  // color delta, and it isn't used anyway. Otherwise it's at most 255: the next pixel is inside too.
+  if (count > 1) {
+    span.step = { fixed_quotient(colors[0].r * step_a + colors[1].r * step_b + colors[2].r * step_c,
+                                 area_recip),
+                  fixed_quotient(colors[0].g * step_a + colors[1].g * step_b + colors[2].g * step_c,
+                                 area_recip),
+                  fixed_quotient(colors[0].b * step_a + colors[1].b * step_b + colors[2].b * step_c,
+                                 area_recip) };
+  }
+  return span;
+}
+
+SpanColors flat_span_colors(Color color) {
+  return { { color.r << 16, color.g << 16, color.b << 16 }, {} };
+}
+
+const DitherOffsets& dither_offsets(s32 x, s32 y) {
+  return DITHER_SPANS[y & 3][x & 3];
+}
+
+const DitherOffsets& no_dither_offsets() {
+  return NO_DITHER_OFFSETS;
+}
+
+const SpanKernels& span_kernels() {
+  static const SpanKernels& kernels = select_span_kernels();
+  return kernels;
+}
+
+const SpanKernels& span_kernels_scalar() {
+  return SCALAR_KERNELS;
+}
+
+}  // namespace rasterizer
+}  // namespace renderer
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <renderer/rasterizer.hpp>
+#include <util/types.hpp>
+
+#include <algorithm>
+#include <array>
+
+// Span kernels shade a horizontal run of up to MAX_SPAN_LENGTH pixels of a triangle at once. There is a
+// scalar reference implementation, and SIMD ones picked at runtime depending on what the host CPU
+// supports. All of them produce bit identical results: the SIMD kernels perform the very same integer
+// and float operations as the scalar code, lane by lane.
+//
+// Colors are interpolated in fixed point: the division by the triangle area is a multiplication by a
+// reciprocal computed once per triangle, done once per span rather than per pixel. Texel coordinates
+// are planes set up once per triangle too, which pixels only add steps to (see TexelPlanes). Colors
+// are dithered while still 8 bits per channel, and the resulting pixels are then written to VRAM a whole
+// span at a time: blended with what's already there when semi-transparent, and checked against its
+// mask bit.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPAN_KERNELS_X86 1
+#else
+#define SPAN_KERNELS_X86 0
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define SPAN_KERNELS_NEON 1
+#else
+#define SPAN_KERNELS_NEON 0
+#endif
+
+namespace renderer {
+namespace rasterizer {
+
+// Spans never cross a raster tile, see Rasterizer::draw_triangle
+constexpr u32 MAX_SPAN_LENGTH = 8;
+
+// Barycentric coordinates at the first pixel of a span, and their change per pixel to the right
+struct SpanWeights {
+  std::array<s32, 3> w;
+  std::array<s32, 3> step;
+};
+
+// Vertex colors interpolated over a span, per channel (r, g, b) in 8.16 fixed point
+struct SpanColors {
+  std::array<s32, 3> start;  // At the first pixel
+  std::array<s32, 3> step;   // Change per pixel to the right
+};
+
+// 2^48 / area, rounded up so that exact quotients stay exact when multiplying by it
+inline u64 area_reciprocal(s32 area) {
+  return ((1ull << 48) + (u64)area - 1) / (u64)area;
+}
+
+// Fraction bits of texel coordinates, whose integer part is the 8 bits that are left in a u64
+constexpr u32 TEXEL_FRACTION_BITS = 56;
+
+// 2^56 / area, rounded up. Interpolated coordinates are at most 255 * area over the area, and the area
+// of 11 bit vertices is under 2^22: 255 * area^2 < 2^56, so multiplying by it truncates to the same
+// coordinates as dividing.
+inline u64 texel_reciprocal(s32 area) {
+  return ((1ull << TEXEL_FRACTION_BITS) + (u64)area - 1) / (u64)area;
+}
+
+// U and V over a triangle, barycentric interpolation of its vertex UVs multiplied by texel_reciprocal().
+// Arithmetic wraps around: values outside of the triangle are meaningless, but those of its pixels are
+// exact, and the wrap is the texture repeat (x % 256, the coordinates of pixels being never negative).
+struct TexelPlanes {
+  Position origin;               // Pixel of the at_origin values
+  std::array<u64, 2> at_origin;  // (u, v)
+  std::array<u64, 2> step_x;     // Change per pixel to the right
+  std::array<u64, 2> step_y;     // Change per pixel down
+};
+
+// U and V over a span
+struct SpanTexcoords {
+  std::array<u64, 2> start;  // At the first pixel
+  std::array<u64, 2> step;   // Change per pixel to the right
+};
+
+// From the planes of the triangle, for the span starting at pos
+inline SpanTexcoords span_texcoords(const TexelPlanes& planes, Position pos) {
+  const u64 dx = (u64)(pos.x - planes.origin.x);
+  const u64 dy = (u64)(pos.y - planes.origin.y);
+  SpanTexcoords uv{};
+  for (u32 axis = 0; axis < 2; ++axis) {
+    uv.start[axis] = planes.at_origin[axis] + dx * planes.step_x[axis] + dy * planes.step_y[axis];
+    uv.step[axis] = planes.step_x[axis];
+  }
+  return uv;
+}
+
+// Texel coordinate of the i-th pixel of a span, repeated but not masked by the texture window yet
+inline s32 span_texcoord(const SpanTexcoords& uv, u32 axis, u32 i) {
+  return (s32)((uv.start[axis] + uv.step[axis] * i) >> TEXEL_FRACTION_BITS);
+}
+
+// Interpolated colors of a span, from the reciprocal of the triangle area
+SpanColors span_colors(const SpanWeights& bar, const Color3& colors, u64 area_recip, u32 count);
+// The same color all over the span
+SpanColors flat_span_colors(Color color);
+
+// Fixed point color of the i-th pixel of a span, as an 8 bit channel
+inline s32 span_color_channel(const SpanColors& colors, u32 channel, u32 i) {
+  return std::clamp((colors.start[channel] + colors.step[channel] * (s32)i) >> 16, 0, 255);
+}
+
+// x / 255 for x up to 2^17, written with shifts as SIMD kernels do it
+constexpr u32 divide_by_255(u32 x) {
+  const u32 rounded = x + 1;
+  return (rounded + (rounded >> 8) + (rounded >> 16)) >> 8;
+}
+
+// A 5 bit texel channel modulated by an 8 bit color channel: texel * color * 16 / 255, as an 8 bit
+// channel. It's only saturated once dithered, see dither_channel().
+constexpr u32 modulate_channel_fine(u32 texel, u32 color) {
+  return divide_by_255(texel * color * 16);
+}
+
+// The same as a 5 bit channel, that is texel * color * 2 / 255 saturated
+constexpr u32 modulate_channel(u32 texel, u32 color) {
+  return std::min<u32>(modulate_channel_fine(texel, color) >> 3, 31);
+}
+
+// An 8 bit channel (possibly over 255, see modulate_channel_fine()) dithered into a 5 bit one
+constexpr u32 dither_channel(s32 channel, s32 dither_offset) {
+  return (u32)std::clamp(channel + dither_offset, 0, 255) >> 3;
+}
+
+// Offsets added to the 8 bit channels of the pixels of a span before they're reduced to 5 bits
+using DitherOffsets = std::array<s32, MAX_SPAN_LENGTH>;
+
+// From the 4x4 dither matrix, for the span starting at (x, y)
+const DitherOffsets& dither_offsets(s32 x, s32 y);
+// All 0, when dithering is off
+const DitherOffsets& no_dither_offsets();
+
+// Output arrays must have room for MAX_SPAN_LENGTH values, kernels may write past count
+struct SpanKernels {
+  const char* name;
+
+  // Colors into RGB16 pixels
+  void (*shade)(const SpanColors& colors, const DitherOffsets& dither, u32 count, u16* out);
+  // Texel coordinates, stepped along the span and masked by the texture window
+  void (*texel_coords)(const SpanTexcoords& uv, TexelWindow window, u32 count, s32* out_x, s32* out_y);
+  // Texture pixels modulated in place by the colors, see modulate_channel_fine()
+  void (*modulate)(const SpanColors& colors, const DitherOffsets& dither, u32 count, u16* texels);
+  // Pixels written over the count VRAM pixels at dest: blended with them, and with the mask bit
+  // checked and set as output says. Only the pixels whose bit is set in write_mask are drawn. Unlike
+  // output arrays, nothing is written past count.
+  void (*write)(const PixelOutput& output, u32 count, u32 write_mask, const u16* pixels, u16* dest);
+};
+
+// Kernels for the best instruction set available
+const SpanKernels& span_kernels();
+
+// Per instruction set kernels, null if not built in or not supported by the host
+const SpanKernels& span_kernels_scalar();
+const SpanKernels* span_kernels_sse41();
+const SpanKernels* span_kernels_avx2();
+const SpanKernels* span_kernels_neon();
+
+}  // namespace rasterizer
+}  // namespace renderer
@@ -0,0 +1,179 @@
+#include <renderer/span_kernels.hpp>
+
+#if SPAN_KERNELS_NEON
+
+#include <arm_neon.h>
+
+#include <algorithm>
+
+// AArch64 always has NEON: no runtime check is needed. 4 pixels per iteration.
+
+namespace renderer {
+namespace rasterizer {
+
+namespace {
+
+// Texel coordinates of 4 pixels from the first one, masked by the texture window: the 64 bit lanes
+// shifted down to their integer part, and narrowed
+inline int32x4_t texel_coord_neon(u64 start, u64 step, u32 first, s32 window_and, s32 window_or) {
+  const u64 at = start + step * first;
+  const uint64x2_t lo = vcombine_u64(vcreate_u64(at), vcreate_u64(at + step));
+  const uint64x2_t hi = vaddq_u64(lo, vdupq_n_u64(step * 2));
+  const uint32x4_t coord = vcombine_u32(vmovn_u64(vshrq_n_u64(lo, TEXEL_FRACTION_BITS)),
+                                        vmovn_u64(vshrq_n_u64(hi, TEXEL_FRACTION_BITS)));
+  const int32x4_t masked = vandq_s32(vreinterpretq_s32_u32(coord), vdupq_n_s32(window_and));
+  return vorrq_s32(masked, vdupq_n_s32(window_or));
+}
+
+inline int32x4_t pack_rgb16_neon(int32x4_t r, int32x4_t g, int32x4_t b) {
+  return vorrq_s32(r, vorrq_s32(vshlq_n_s32(g, 5), vshlq_n_s32(b, 10)));
+}
+
+inline void store_u16_neon(u16* out, int32x4_t v) {
+  vst1_u16(out, vmovn_u32(vreinterpretq_u32_s32(v)));
+}
+
+// Channel of the span colors as 8 bits, see span_color_channel()
+inline int32x4_t color_channel_neon(const SpanColors& colors, u32 channel, u32 first) {
+  static constexpr s32 LANES[4] = { 0, 1, 2, 3 };
+  const int32x4_t start = vdupq_n_s32(colors.start[channel] + colors.step[channel] * (s32)first);
+  const int32x4_t value = vshrq_n_s32(vmlaq_n_s32(start, vld1q_s32(LANES), colors.step[channel]), 16);
+  return vminq_s32(vmaxq_s32(value, vdupq_n_s32(0)), vdupq_n_s32(255));
+}
+
+// See modulate_channel_fine()
+inline int32x4_t modulate_channel_neon(int32x4_t texel, int32x4_t color) {
+  const int32x4_t product = vshlq_n_s32(vmulq_s32(texel, color), 4);
+  const int32x4_t rounded = vaddq_s32(product, vdupq_n_s32(1));
+  const int32x4_t sum = vaddq_s32(vaddq_s32(rounded, vshrq_n_s32(rounded, 8)), vshrq_n_s32(rounded, 16));
+  return vshrq_n_s32(sum, 8);
+}
+
+// See dither_channel()
+inline int32x4_t dither_channel_neon(int32x4_t channel, const DitherOffsets& dither, u32 first) {
+  const int32x4_t value = vaddq_s32(channel, vld1q_s32(dither.data() + first));
+  return vshrq_n_s32(vminq_s32(vmaxq_s32(value, vdupq_n_s32(0)), vdupq_n_s32(255)), 3);
+}
+
+void shade_neon(const SpanColors& colors, const DitherOffsets& dither, u32 count, u16* out) {
+  for (u32 i = 0; i < count; i += 4) {
+    const int32x4_t r = dither_channel_neon(color_channel_neon(colors, 0, i), dither, i);
+    const int32x4_t g = dither_channel_neon(color_channel_neon(colors, 1, i), dither, i);
+    const int32x4_t b = dither_channel_neon(color_channel_neon(colors, 2, i), dither, i);
+    store_u16_neon(out + i, pack_rgb16_neon(r, g, b));
+  }
+}
+
+void texel_coords_neon(const SpanTexcoords& uv,
+                       TexelWindow window,
+                       u32 count,
+                       s32* out_x,
+                       s32* out_y) {
+  for (u32 i = 0; i < count; i += 4) {
+    vst1q_s32(out_x + i, texel_coord_neon(uv.start[0], uv.step[0], i, window.and_x, window.or_x));
+    vst1q_s32(out_y + i, texel_coord_neon(uv.start[1], uv.step[1], i, window.and_y, window.or_y));
+  }
+}
+
+void modulate_neon(const SpanColors& colors, const DitherOffsets& dither, u32 count, u16* texels) {
+  const int32x4_t channel_mask = vdupq_n_s32(0x1F);
+
+  for (u32 i = 0; i < count; i += 4) {
+    const int32x4_t t = vreinterpretq_s32_u32(vmovl_u16(vld1_u16(texels + i)));
+
+    const int32x4_t tr = vandq_s32(t, channel_mask);
+    const int32x4_t tg = vandq_s32(vshrq_n_s32(t, 5), channel_mask);
+    const int32x4_t tb = vandq_s32(vshrq_n_s32(t, 10), channel_mask);
+    const int32x4_t r = modulate_channel_neon(tr, color_channel_neon(colors, 0, i));
+    const int32x4_t g = modulate_channel_neon(tg, color_channel_neon(colors, 1, i));
+    const int32x4_t b = modulate_channel_neon(tb, color_channel_neon(colors, 2, i));
+    const int32x4_t mask_bit = vandq_s32(t, vdupq_n_s32(0x8000));
+
+    const int32x4_t pixels =
+        pack_rgb16_neon(dither_channel_neon(r, dither, i), dither_channel_neon(g, dither, i),
+                        dither_channel_neon(b, dither, i));
+    store_u16_neon(texels + i, vorrq_s32(pixels, mask_bit));
+  }
+}
+
+// See blend_channel() in renderer/span_kernels.cpp, 8 channels of 5 bits in 16 bit lanes
+inline uint16x8_t blend_channel_neon(BlendMode mode, uint16x8_t back, uint16x8_t front) {
+  const uint16x8_t max = vdupq_n_u16(31);
+  switch (mode) {
+    case BlendMode::Average: return vshrq_n_u16(vaddq_u16(back, front), 1);
+    case BlendMode::Add: return vminq_u16(vaddq_u16(back, front), max);
+    case BlendMode::Subtract: return vqsubq_u16(back, front);
+    case BlendMode::AddQuarter: return vminq_u16(vaddq_u16(back, vshrq_n_u16(front, 2)), max);
+  }
+  return front;
+}
+
+// Front pixels blended over back ones, keeping the mask bit of the front ones
+inline uint16x8_t blend_neon(BlendMode mode, uint16x8_t back, uint16x8_t front) {
+  const uint16x8_t channel_mask = vdupq_n_u16(0x1F);
+  const uint16x8_t r = blend_channel_neon(mode, vandq_u16(back, channel_mask),
+                                          vandq_u16(front, channel_mask));
+  const uint16x8_t g = blend_channel_neon(mode, vandq_u16(vshrq_n_u16(back, 5), channel_mask),
+                                          vandq_u16(vshrq_n_u16(front, 5), channel_mask));
+  const uint16x8_t b = blend_channel_neon(mode, vandq_u16(vshrq_n_u16(back, 10), channel_mask),
+                                          vandq_u16(vshrq_n_u16(front, 10), channel_mask));
+  const uint16x8_t mask_bit = vandq_u16(front, vdupq_n_u16(0x8000));
+  return vorrq_u16(vorrq_u16(r, vshlq_n_u16(g, 5)), vorrq_u16(vshlq_n_u16(b, 10), mask_bit));
+}
+
+// A whole span of 8 pixels at once: spans shorter than that go through a copy, for VRAM past count
+// not to be touched
+void write_neon(const PixelOutput& output, u32 count, u32 write_mask, const u16* pixels, u16* dest) {
+  static_assert(MAX_SPAN_LENGTH == 8, "A span is a vector of 16 bit lanes");
+  std::array<u16, MAX_SPAN_LENGTH> partial{};
+  u16* target = dest;
+  if (count < MAX_SPAN_LENGTH) {
+    std::copy_n(dest, count, partial.data());
+    target = partial.data();
+  }
+
+  const uint16x8_t back = vld1q_u16(target);
+  const uint16x8_t front = vld1q_u16(pixels);
+  const uint16x8_t mask_bit = vdupq_n_u16(0x8000);
+
+  static constexpr u16 LANES[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+  uint16x8_t is_written = vtstq_u16(vdupq_n_u16((u16)write_mask), vld1q_u16(LANES));
+  if (output.check_mask)
+    is_written = vbicq_u16(is_written, vtstq_u16(back, mask_bit));
+
+  uint16x8_t drawn = front;
+  if (output.is_blended) {
+    const uint16x8_t is_blended = output.is_textured ? vtstq_u16(front, mask_bit) : vdupq_n_u16(0xFFFF);
+    drawn = vbslq_u16(is_blended, blend_neon(output.blend_mode, back, front), front);
+  }
+  drawn = vorrq_u16(drawn, vdupq_n_u16(output.set_mask));
+  vst1q_u16(target, vbslq_u16(is_written, drawn, back));
+
+  if (count < MAX_SPAN_LENGTH)
+    std::copy_n(partial.data(), count, dest);
+}
+
+constexpr SpanKernels NEON_KERNELS{ "NEON", shade_neon, texel_coords_neon, modulate_neon, write_neon };
+
+}  // namespace
+
+const SpanKernels* span_kernels_neon() {
+  return &NEON_KERNELS;
+}
+
+}  // namespace rasterizer
+}  // namespace renderer
+
+#else
+
+namespace renderer {
+namespace rasterizer {
+
+const SpanKernels* span_kernels_neon() {
+  return nullptr;
+}
+
+}  // namespace rasterizer
+}  // namespace renderer
+
+#endif
@@ -0,0 +1,335 @@
+#include <renderer/span_kernels.hpp>
+
+#if SPAN_KERNELS_X86
+
+#include <immintrin.h>
+
+#include <algorithm>
+
+// Kernels are compiled for their instruction set through function attributes, so the rest of the build
+// doesn't depend on it and they're only called once the host CPU is known to support it
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+namespace renderer {
+namespace rasterizer {
+
+namespace {
+
+//
+// SSE4.1, 4 pixels per iteration
+//
+
+// Texel coordinates of 4 pixels from the first one, masked by the texture window. The 64 bit lanes
+// are shifted down to their integer part, and their low halves packed together.
+TARGET_SSE41 inline __m128i texel_coord_sse41(u64 start,
+                                              u64 step,
+                                              u32 first,
+                                              s32 window_and,
+                                              s32 window_or) {
+  const u64 at = start + step * first;
+  const __m128i lo = _mm_set_epi64x((s64)(at + step), (s64)at);
+  const __m128i hi = _mm_set_epi64x((s64)(at + step * 3), (s64)(at + step * 2));
+  const __m128 packed = _mm_shuffle_ps(_mm_castsi128_ps(_mm_srli_epi64(lo, TEXEL_FRACTION_BITS)),
+                                       _mm_castsi128_ps(_mm_srli_epi64(hi, TEXEL_FRACTION_BITS)),
+                                       _MM_SHUFFLE(2, 0, 2, 0));
+  const __m128i coord = _mm_castps_si128(packed);
+  return _mm_or_si128(_mm_and_si128(coord, _mm_set1_epi32(window_and)), _mm_set1_epi32(window_or));
+}
+
+TARGET_SSE41 inline __m128i pack_rgb16_sse41(__m128i r, __m128i g, __m128i b) {
+  const __m128i gb = _mm_or_si128(_mm_slli_epi32(g, 5), _mm_slli_epi32(b, 10));
+  return _mm_or_si128(r, gb);
+}
+
+TARGET_SSE41 inline void store_u16_sse41(u16* out, __m128i v) {
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi32(v, v));
+}
+
+// Channel of the span colors as 8 bits, see span_color_channel()
+TARGET_SSE41 inline __m128i color_channel_sse41(const SpanColors& colors, u32 channel, u32 first) {
+  const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+  const __m128i step = _mm_set1_epi32(colors.step[channel]);
+  const __m128i start = _mm_set1_epi32(colors.start[channel] + colors.step[channel] * (s32)first);
+  const __m128i value = _mm_srai_epi32(_mm_add_epi32(start, _mm_mullo_epi32(step, lanes)), 16);
+  return _mm_min_epi32(_mm_max_epi32(value, _mm_setzero_si128()), _mm_set1_epi32(255));
+}
+
+// See modulate_channel_fine()
+TARGET_SSE41 inline __m128i modulate_channel_sse41(__m128i texel, __m128i color) {
+  const __m128i product = _mm_slli_epi32(_mm_mullo_epi32(texel, color), 4);
+  const __m128i rounded = _mm_add_epi32(product, _mm_set1_epi32(1));
+  const __m128i sum =
+      _mm_add_epi32(_mm_add_epi32(rounded, _mm_srli_epi32(rounded, 8)), _mm_srli_epi32(rounded, 16));
+  return _mm_srli_epi32(sum, 8);
+}
+
+// See dither_channel()
+TARGET_SSE41 inline __m128i dither_channel_sse41(__m128i channel,
+                                                 const DitherOffsets& dither,
+                                                 u32 first) {
+  const __m128i offsets = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dither.data() + first));
+  const __m128i value = _mm_add_epi32(channel, offsets);
+  const __m128i clamped = _mm_min_epi32(_mm_max_epi32(value, _mm_setzero_si128()), _mm_set1_epi32(255));
+  return _mm_srli_epi32(clamped, 3);
+}
+
+TARGET_SSE41 void shade_sse41(const SpanColors& colors,
+                              const DitherOffsets& dither,
+                              u32 count,
+                              u16* out) {
+  for (u32 i = 0; i < count; i += 4) {
+    const __m128i r = dither_channel_sse41(color_channel_sse41(colors, 0, i), dither, i);
+    const __m128i g = dither_channel_sse41(color_channel_sse41(colors, 1, i), dither, i);
+    const __m128i b = dither_channel_sse41(color_channel_sse41(colors, 2, i), dither, i);
+    store_u16_sse41(out + i, pack_rgb16_sse41(r, g, b));
+  }
+}
+
+TARGET_SSE41 void texel_coords_sse41(const SpanTexcoords& uv,
+                                     TexelWindow window,
+                                     u32 count,
+                                     s32* out_x,
+                                     s32* out_y) {
+  for (u32 i = 0; i < count; i += 4) {
+    const __m128i x = texel_coord_sse41(uv.start[0], uv.step[0], i, window.and_x, window.or_x);
+    const __m128i y = texel_coord_sse41(uv.start[1], uv.step[1], i, window.and_y, window.or_y);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out_x + i), x);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out_y + i), y);
+  }
+}
+
+TARGET_SSE41 void modulate_sse41(const SpanColors& colors,
+                                 const DitherOffsets& dither,
+                                 u32 count,
+                                 u16* texels) {
+  const __m128i channel_mask = _mm_set1_epi32(0x1F);
+
+  for (u32 i = 0; i < count; i += 4) {
+    const __m128i t = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(texels + i)));
+
+    const __m128i tr = _mm_and_si128(t, channel_mask);
+    const __m128i tg = _mm_and_si128(_mm_srli_epi32(t, 5), channel_mask);
+    const __m128i tb = _mm_and_si128(_mm_srli_epi32(t, 10), channel_mask);
+    const __m128i r = modulate_channel_sse41(tr, color_channel_sse41(colors, 0, i));
+    const __m128i g = modulate_channel_sse41(tg, color_channel_sse41(colors, 1, i));
+    const __m128i b = modulate_channel_sse41(tb, color_channel_sse41(colors, 2, i));
+    const __m128i mask_bit = _mm_and_si128(t, _mm_set1_epi32(0x8000));
+
+    const __m128i pixels = pack_rgb16_sse41(dither_channel_sse41(r, dither, i),
+                                            dither_channel_sse41(g, dither, i),
+                                            dither_channel_sse41(b, dither, i));
+    store_u16_sse41(texels + i, _mm_or_si128(pixels, mask_bit));
+  }
+}
+
+// See blend_channel() in renderer/span_kernels.cpp, 8 channels of 5 bits in 16 bit lanes
+TARGET_SSE41 inline __m128i blend_channel_sse41(BlendMode mode, __m128i back, __m128i front) {
+  const __m128i max = _mm_set1_epi16(31);
+  switch (mode) {
+    case BlendMode::Average: return _mm_srli_epi16(_mm_add_epi16(back, front), 1);
+    case BlendMode::Add: return _mm_min_epi16(_mm_add_epi16(back, front), max);
+    case BlendMode::Subtract: return _mm_max_epi16(_mm_sub_epi16(back, front), _mm_setzero_si128());
+    case BlendMode::AddQuarter: return _mm_min_epi16(_mm_add_epi16(back, _mm_srli_epi16(front, 2)), max);
+  }
+  return front;
+}
+
+// 5 bit channel of 8 pixels
+TARGET_SSE41 inline __m128i pixel_channel_sse41(__m128i pixels, int shift) {
+  return _mm_and_si128(_mm_srli_epi16(pixels, shift), _mm_set1_epi16(0x1F));
+}
+
+// Front pixels blended over back ones, keeping the mask bit of the front ones
+TARGET_SSE41 inline __m128i blend_sse41(BlendMode mode, __m128i back, __m128i front) {
+  const __m128i r =
+      blend_channel_sse41(mode, pixel_channel_sse41(back, 0), pixel_channel_sse41(front, 0));
+  const __m128i g =
+      blend_channel_sse41(mode, pixel_channel_sse41(back, 5), pixel_channel_sse41(front, 5));
+  const __m128i b =
+      blend_channel_sse41(mode, pixel_channel_sse41(back, 10), pixel_channel_sse41(front, 10));
+  const __m128i mask_bit = _mm_and_si128(front, _mm_set1_epi16((s16)0x8000));
+  return _mm_or_si128(_mm_or_si128(r, _mm_slli_epi16(g, 5)),
+                      _mm_or_si128(_mm_slli_epi16(b, 10), mask_bit));
+}
+
+// A whole span of 8 pixels per iteration: spans shorter than that go through a copy, for VRAM past
+// count not to be touched
+TARGET_SSE41 void write_sse41(const PixelOutput& output,
+                              u32 count,
+                              u32 write_mask,
+                              const u16* pixels,
+                              u16* dest) {
+  static_assert(MAX_SPAN_LENGTH == 8, "A span is a vector of 16 bit lanes");
+  std::array<u16, MAX_SPAN_LENGTH> partial{};
+  u16* target = dest;
+  if (count < MAX_SPAN_LENGTH) {
+    std::copy_n(dest, count, partial.data());
+    target = partial.data();
+  }
+
+  const __m128i back = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target));
+  const __m128i front = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels));
+
+  const __m128i lanes = _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+  __m128i is_written = _mm_cmpeq_epi16(_mm_and_si128(_mm_set1_epi16((s16)write_mask), lanes), lanes);
+  if (output.check_mask)
+    is_written = _mm_andnot_si128(_mm_srai_epi16(back, 15), is_written);
+
+  __m128i drawn = front;
+  if (output.is_blended) {
+    const __m128i is_blended = output.is_textured ? _mm_srai_epi16(front, 15) : _mm_set1_epi16(-1);
+    drawn = _mm_blendv_epi8(front, blend_sse41(output.blend_mode, back, front), is_blended);
+  }
+  drawn = _mm_or_si128(drawn, _mm_set1_epi16((s16)output.set_mask));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(target), _mm_blendv_epi8(back, drawn, is_written));
+
+  if (count < MAX_SPAN_LENGTH)
+    std::copy_n(partial.data(), count, dest);
+}
+
+//
+// AVX2, 8 pixels per iteration
+//
+
+// See texel_coord_sse41, 8 pixels
+TARGET_AVX2 inline __m256i texel_coord_avx2(u64 start,
+                                            u64 step,
+                                            u32 first,
+                                            s32 window_and,
+                                            s32 window_or) {
+  const u64 at = start + step * first;
+  const __m256i lo = _mm256_setr_epi64x((s64)at, (s64)(at + step), (s64)(at + step * 2),
+                                        (s64)(at + step * 3));
+  const __m256i hi = _mm256_add_epi64(lo, _mm256_set1_epi64x((s64)(step * 4)));
+
+  // Low halves of the shifted lanes, into the low 128 bits of each
+  const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+  const __m256i lo_coords =
+      _mm256_permutevar8x32_epi32(_mm256_srli_epi64(lo, TEXEL_FRACTION_BITS), even);
+  const __m256i hi_coords =
+      _mm256_permutevar8x32_epi32(_mm256_srli_epi64(hi, TEXEL_FRACTION_BITS), even);
+  const __m256i coord = _mm256_inserti128_si256(lo_coords, _mm256_castsi256_si128(hi_coords), 1);
+  const __m256i masked = _mm256_and_si256(coord, _mm256_set1_epi32(window_and));
+  return _mm256_or_si256(masked, _mm256_set1_epi32(window_or));
+}
+
+TARGET_AVX2 inline __m256i pack_rgb16_avx2(__m256i r, __m256i g, __m256i b) {
+  const __m256i gb = _mm256_or_si256(_mm256_slli_epi32(g, 5), _mm256_slli_epi32(b, 10));
+  return _mm256_or_si256(r, gb);
+}
+
+TARGET_AVX2 inline void store_u16_avx2(u16* out, __m256i v) {
+  // Packing works within 128 bit lanes, gather both halves in the low one
+  const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0b1000);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(packed));
+}
+
+TARGET_AVX2 inline __m256i color_channel_avx2(const SpanColors& colors, u32 channel, u32 first) {
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i step = _mm256_set1_epi32(colors.step[channel]);
+  const __m256i start = _mm256_set1_epi32(colors.start[channel] + colors.step[channel] * (s32)first);
+  const __m256i value = _mm256_srai_epi32(_mm256_add_epi32(start, _mm256_mullo_epi32(step, lanes)), 16);
+  return _mm256_min_epi32(_mm256_max_epi32(value, _mm256_setzero_si256()), _mm256_set1_epi32(255));
+}
+
+TARGET_AVX2 inline __m256i modulate_channel_avx2(__m256i texel, __m256i color) {
+  const __m256i product = _mm256_slli_epi32(_mm256_mullo_epi32(texel, color), 4);
+  const __m256i rounded = _mm256_add_epi32(product, _mm256_set1_epi32(1));
+  const __m256i sum = _mm256_add_epi32(_mm256_add_epi32(rounded, _mm256_srli_epi32(rounded, 8)),
+                                       _mm256_srli_epi32(rounded, 16));
+  return _mm256_srli_epi32(sum, 8);
+}
+
+TARGET_AVX2 inline __m256i dither_channel_avx2(__m256i channel, const DitherOffsets& dither, u32 first) {
+  const __m256i offsets = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dither.data() + first));
+  const __m256i value = _mm256_add_epi32(channel, offsets);
+  const __m256i clamped =
+      _mm256_min_epi32(_mm256_max_epi32(value, _mm256_setzero_si256()), _mm256_set1_epi32(255));
+  return _mm256_srli_epi32(clamped, 3);
+}
+
+TARGET_AVX2 void shade_avx2(const SpanColors& colors, const DitherOffsets& dither, u32 count, u16* out) {
+  for (u32 i = 0; i < count; i += 8) {
+    const __m256i r = dither_channel_avx2(color_channel_avx2(colors, 0, i), dither, i);
+    const __m256i g = dither_channel_avx2(color_channel_avx2(colors, 1, i), dither, i);
+    const __m256i b = dither_channel_avx2(color_channel_avx2(colors, 2, i), dither, i);
+    store_u16_avx2(out + i, pack_rgb16_avx2(r, g, b));
+  }
+}
+
+TARGET_AVX2 void texel_coords_avx2(const SpanTexcoords& uv,
+                                   TexelWindow window,
+                                   u32 count,
+                                   s32* out_x,
+                                   s32* out_y) {
+  for (u32 i = 0; i < count; i += 8) {
+    const __m256i x = texel_coord_avx2(uv.start[0], uv.step[0], i, window.and_x, window.or_x);
+    const __m256i y = texel_coord_avx2(uv.start[1], uv.step[1], i, window.and_y, window.or_y);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out_x + i), x);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out_y + i), y);
+  }
+}
+
+TARGET_AVX2 void modulate_avx2(const SpanColors& colors,
+                               const DitherOffsets& dither,
+                               u32 count,
+                               u16* texels) {
+  const __m256i channel_mask = _mm256_set1_epi32(0x1F);
+
+  for (u32 i = 0; i < count; i += 8) {
+    const __m128i texels16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(texels + i));
+    const __m256i t = _mm256_cvtepu16_epi32(texels16);
+
+    const __m256i tr = _mm256_and_si256(t, channel_mask);
+    const __m256i tg = _mm256_and_si256(_mm256_srli_epi32(t, 5), channel_mask);
+    const __m256i tb = _mm256_and_si256(_mm256_srli_epi32(t, 10), channel_mask);
+    const __m256i r = modulate_channel_avx2(tr, color_channel_avx2(colors, 0, i));
+    const __m256i g = modulate_channel_avx2(tg, color_channel_avx2(colors, 1, i));
+    const __m256i b = modulate_channel_avx2(tb, color_channel_avx2(colors, 2, i));
+    const __m256i mask_bit = _mm256_and_si256(t, _mm256_set1_epi32(0x8000));
+
+    const __m256i pixels = pack_rgb16_avx2(dither_channel_avx2(r, dither, i),
+                                           dither_channel_avx2(g, dither, i),
+                                           dither_channel_avx2(b, dither, i));
+    store_u16_avx2(texels + i, _mm256_or_si256(pixels, mask_bit));
+  }
+}
+
+constexpr SpanKernels SSE41_KERNELS{ "SSE4.1", shade_sse41, texel_coords_sse41, modulate_sse41,
+                                     write_sse41 };
+// A span of 16 bit pixels already fits in 128 bits, the writes of SSE4.1 are kept
+constexpr SpanKernels AVX2_KERNELS{ "AVX2", shade_avx2, texel_coords_avx2, modulate_avx2, write_sse41 };
+
+}  // namespace
+
+const SpanKernels* span_kernels_sse41() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.1") ? &SSE41_KERNELS : nullptr;
+}
+
+const SpanKernels* span_kernels_avx2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? &AVX2_KERNELS : nullptr;
+}
+
+}  // namespace rasterizer
+}  // namespace renderer
+
+#else
+
+namespace renderer {
+namespace rasterizer {
+
+const SpanKernels* span_kernels_sse41() {
+  return nullptr;
+}
+
+const SpanKernels* span_kernels_avx2() {
+  return nullptr;
+}
+
+}  // namespace rasterizer
+}  // namespace renderer
+
+#endif
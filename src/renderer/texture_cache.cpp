@@ -0,0 +1,150 @@
+#include <renderer/texture_cache.hpp>
+
+#include <gpu/gpu.hpp>
+
+#include <algorithm>
+
+namespace renderer {
+namespace rasterizer {
+
+namespace {
+
+static_assert(gpu::VRAM_WIDTH == 1024 && gpu::VRAM_HEIGHT == 512, "VRAM blocks don't cover VRAM");
+
+// Texpage attribute bits selecting the page and its color depth
+constexpr u16 PAGE_KEY_MASK = 0x19F;
+
+bool is_paletted(gpu::Gp0DrawMode page) {
+  return page.tex_page_colors < 2;
+}
+
+// Texture page and CLUT as they're laid out in VRAM, x is wrapped around when decoding
+struct TextureSource {
+  VramRect page;
+  VramRect clut;
+};
+
+TextureSource source_of(u16 page_attr, u16 clut_attr) {
+  const auto page = gpu::Gp0DrawMode{ page_attr };
+  const s32 page_x = page.tex_base_x();
+  const s32 page_y = page.tex_base_y();
+  const s32 clut_x = (clut_attr & 0x3F) * 16;
+  const s32 clut_y = (clut_attr >> 6) & 0x1FF;
+
+  switch (page.tex_page_colors) {
+    case 0:
+      return { { page_x, page_y, page_x + 64, page_y + 256 },
+               { clut_x, clut_y, clut_x + 16, clut_y + 1 } };
+    case 1:
+      return { { page_x, page_y, page_x + 128, page_y + 256 },
+               { clut_x, clut_y, clut_x + 256, clut_y + 1 } };
+    default: return { { page_x, page_y, page_x + 256, page_y + 256 }, {} };
+  }
+}
+
+u16 vram_at(const gpu::Gpu& gpu, s32 x, s32 y) {
+  return gpu.vram()[y * gpu::VRAM_WIDTH + (x % gpu::VRAM_WIDTH)];
+}
+
+template <u32 Bits>
+void decode_paletted(const gpu::Gpu& gpu, const TextureSource& source, DecodedTexture& texels) {
+  constexpr u32 TEXELS_PER_WORD = 16 / Bits;
+  constexpr u16 INDEX_MASK = (1 << Bits) - 1;
+
+  std::array<u16, 1 << Bits> clut;
+  for (u32 i = 0; i < clut.size(); ++i)
+    clut[i] = vram_at(gpu, source.clut.left + i, source.clut.top);
+
+  // The texels of a word never cross a tile
+  static_assert(TEXELS_PER_WORD <= TEXEL_TILE_MASK + 1, "Paletted texels cross tiles");
+  for (u32 y = 0; y < TEXTURE_PAGE_SIZE; ++y) {
+    u16* row = &texels[texel_index(0, y)];
+    for (u32 x = 0; x < TEXTURE_PAGE_SIZE; x += TEXELS_PER_WORD) {
+      const u16 word = vram_at(gpu, source.page.left + x / TEXELS_PER_WORD, source.page.top + y);
+      u16* out = &row[texel_index(x, 0)];
+      for (u32 i = 0; i < TEXELS_PER_WORD; ++i)
+        out[i] = clut[(word >> (i * Bits)) & INDEX_MASK];
+    }
+  }
+}
+
+void decode_direct(const gpu::Gpu& gpu, const TextureSource& source, DecodedTexture& texels) {
+  for (u32 y = 0; y < TEXTURE_PAGE_SIZE; ++y) {
+    u16* row = &texels[texel_index(0, y)];
+    for (u32 x = 0; x < TEXTURE_PAGE_SIZE; ++x)
+      row[texel_index(x, 0)] = vram_at(gpu, source.page.left + x, source.page.top + y);
+  }
+}
+
+}  // namespace
+
+TextureCache::TextureCache(const gpu::Gpu& gpu, VramDirtyBlocks& vram_dirty)
+    : m_gpu(gpu), m_vram_dirty(vram_dirty), m_entries(TEXTURE_CACHE_SIZE) {}
+
+TextureCache::~TextureCache() = default;
+
+const u16* TextureCache::find(u16 page, u16 clut) {
+  invalidate_dirty();
+
+  const u32 key = key_of(page, clut);
+  for (auto& entry : m_entries) {
+    if (entry.is_valid && entry.key == key) {
+      entry.last_use = ++m_use_counter;
+      return entry.texels->data();
+    }
+  }
+  return nullptr;
+}
+
+const u16* TextureCache::decode(u16 page, u16 clut) {
+  invalidate_dirty();
+
+  // Replace an invalid page, or the least recently used one
+  auto entry = std::min_element(m_entries.begin(), m_entries.end(), [](const Entry& a, const Entry& b) {
+    return std::make_pair(a.is_valid, a.last_use) < std::make_pair(b.is_valid, b.last_use);
+  });
+  if (!entry->texels)
+    entry->texels = std::make_unique<DecodedTexture>();
+
+  const TextureSource source = source_of(page, clut);
+  switch (gpu::Gp0DrawMode{ page }.tex_page_colors) {
+    case 0: decode_paletted<4>(m_gpu, source, *entry->texels); break;
+    case 1: decode_paletted<8>(m_gpu, source, *entry->texels); break;
+    default: decode_direct(m_gpu, source, *entry->texels); break;
+  }
+
+  entry->key = key_of(page, clut);
+  entry->is_valid = true;
+  entry->last_use = ++m_use_counter;
+  entry->sources = texture_blocks_of(page, clut);
+  return entry->texels->data();
+}
+
+u32 TextureCache::key_of(u16 page, u16 clut) {
+  const bool paletted = is_paletted(gpu::Gp0DrawMode{ page });
+  return (page & PAGE_KEY_MASK) | (paletted ? clut : 0) << 16;
+}
+
+VramBlocks TextureCache::blocks_of(const VramRect& rect) {
+  VramBlocks blocks;
+  for_each_block_of(rect, [&blocks](u32 block) { blocks.set(block); });
+  return blocks;
+}
+
+VramBlocks TextureCache::texture_blocks_of(u16 page, u16 clut) {
+  const TextureSource source = source_of(page, clut);
+  return blocks_of(source.page) | blocks_of(source.clut);
+}
+
+void TextureCache::invalidate_dirty() {
+  if (!m_vram_dirty.any_dirty(m_cursor))
+    return;
+
+  const VramBlocks dirty = m_vram_dirty.take(m_cursor);
+  for (auto& entry : m_entries)
+    if ((entry.sources & dirty).any())
+      entry.is_valid = false;
+}
+
+}  // namespace rasterizer
+}  // namespace renderer
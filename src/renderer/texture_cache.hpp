@@ -0,0 +1,120 @@
+#pragma once
+
+#include <util/dirty_pages.hpp>
+#include <util/types.hpp>
+
+#include <array>
+#include <memory>
+#include <vector>
+
+namespace gpu {
+class Gpu;
+}
+
+namespace renderer {
+namespace rasterizer {
+
+// Half-open rectangle of VRAM
+struct VramRect {
+  s32 left{};
+  s32 top{};
+  s32 right{};
+  s32 bottom{};
+
+  bool is_empty() const { return left >= right || top >= bottom; }
+};
+
+// Written VRAM is tracked in blocks of 64x32 halfwords: a 4 bit texture page is one column of blocks,
+// and CLUTs tend to have rows of their own apart from the drawing buffers
+constexpr u32 VRAM_BLOCK_WIDTH_SHIFT = 6;
+constexpr u32 VRAM_BLOCK_HEIGHT_SHIFT = 5;
+constexpr u32 VRAM_BLOCK_COLUMNS = 1024 >> VRAM_BLOCK_WIDTH_SHIFT;
+constexpr u32 VRAM_BLOCK_ROWS = 512 >> VRAM_BLOCK_HEIGHT_SHIFT;
+using VramDirtyBlocks = util::DirtyPages<VRAM_BLOCK_COLUMNS * VRAM_BLOCK_ROWS>;
+using VramBlocks = VramDirtyBlocks::Pages;
+
+// Index in VramBlocks of the block holding the halfword at vram_idx
+inline u32 vram_block_of(u32 vram_idx) {
+  const u32 x = vram_idx % 1024;
+  const u32 y = vram_idx / 1024;
+  return (y >> VRAM_BLOCK_HEIGHT_SHIFT) * VRAM_BLOCK_COLUMNS + (x >> VRAM_BLOCK_WIDTH_SHIFT);
+}
+
+constexpr u32 TEXTURE_PAGE_SIZE = 256;
+constexpr u32 TEXTURE_CACHE_SIZE = 64;  // Decoded pages, 128 KiB each
+
+using DecodedTexture = std::array<u16, TEXTURE_PAGE_SIZE * TEXTURE_PAGE_SIZE>;
+
+// Decoded pages are stored in tiles of 8x8 texels (128 bytes), row after row in each tile, so that
+// sampling down a page stays within a few cache lines instead of striding a whole row per texel
+constexpr u32 TEXEL_TILE_SHIFT = 3;
+constexpr u32 TEXEL_TILE_MASK = (1 << TEXEL_TILE_SHIFT) - 1;
+
+// Index of the texel (x, y) in a DecodedTexture. It's the sum of texel_index(x, 0) and
+// texel_index(0, y), so a row can be walked from the index of its first texel.
+constexpr u32 texel_index(u32 x, u32 y) {
+  constexpr u32 TILE_SIZE = 1 << (2 * TEXEL_TILE_SHIFT);
+  constexpr u32 TILES_PER_ROW = TEXTURE_PAGE_SIZE >> TEXEL_TILE_SHIFT;
+  const u32 tile = (y >> TEXEL_TILE_SHIFT) * TILES_PER_ROW + (x >> TEXEL_TILE_SHIFT);
+  return tile * TILE_SIZE + ((y & TEXEL_TILE_MASK) << TEXEL_TILE_SHIFT) + (x & TEXEL_TILE_MASK);
+}
+
+// Texture pages decoded to 16 bit texels with their color depth and CLUT, so that sampling is a single
+// load. A page is decoded again once VRAM it was decoded from is written to, as told by the blocks the
+// GPU marks. Only to be used by the thread processing GPU commands.
+class TextureCache {
+ public:
+  TextureCache(const gpu::Gpu& gpu, VramDirtyBlocks& vram_dirty);
+  ~TextureCache();
+
+  // page is a texpage attribute (see gpu::Gp0DrawMode), clut a CLUT one, ignored by 16 bit textures. The
+  // texel (x, y) is at texel_index(x, y).
+  // Null if the page isn't cached: it must be decoded then, replacing one of the cached pages.
+  const u16* find(u16 page, u16 clut);
+  const u16* decode(u16 page, u16 clut);
+
+  static VramBlocks blocks_of(const VramRect& rect);
+  // Calls fn with the index of each block of rect, without building a VramBlocks
+  template <typename Fn>
+  static void for_each_block_of(const VramRect& rect, Fn&& fn);
+  // Blocks a texture page is sampled from, along with its CLUT
+  static VramBlocks texture_blocks_of(u16 page, u16 clut);
+
+ private:
+  struct Entry {
+    u32 key{};
+    bool is_valid{};
+    u64 last_use{};
+    VramBlocks sources;  // Blocks the texels were decoded from
+    std::unique_ptr<DecodedTexture> texels;
+  };
+
+  static u32 key_of(u16 page, u16 clut);
+
+  // Drops the pages decoded from VRAM written to since the last call
+  void invalidate_dirty();
+
+  const gpu::Gpu& m_gpu;
+  VramDirtyBlocks& m_vram_dirty;
+  VramDirtyBlocks::Cursor m_cursor;
+  std::vector<Entry> m_entries;
+  u64 m_use_counter{};
+};
+
+template <typename Fn>
+void TextureCache::for_each_block_of(const VramRect& rect, Fn&& fn) {
+  if (rect.is_empty())
+    return;
+
+  // Columns and rows wrap around like VRAM addressing does
+  const s32 first_column = rect.left >> VRAM_BLOCK_WIDTH_SHIFT;
+  const s32 last_column = (rect.right - 1) >> VRAM_BLOCK_WIDTH_SHIFT;
+  const s32 first_row = rect.top >> VRAM_BLOCK_HEIGHT_SHIFT;
+  const s32 last_row = (rect.bottom - 1) >> VRAM_BLOCK_HEIGHT_SHIFT;
+  for (s32 row = first_row; row <= last_row; ++row)
+    for (s32 column = first_column; column <= last_column; ++column)
+      fn(row % VRAM_BLOCK_ROWS * VRAM_BLOCK_COLUMNS + column % VRAM_BLOCK_COLUMNS);
+}
+
+}  // namespace rasterizer
+}  // namespace renderer
@@ -0,0 +1,178 @@
+#include <spu/cd_audio.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace spu {
+
+namespace {
+
+constexpr u32 XA_SUBHEADER_OFFSET = 16;  // File, channel, submode, coding info
+constexpr u32 XA_DATA_OFFSET = 24;
+constexpr u32 XA_GROUP_COUNT = 18;
+constexpr u32 XA_GROUP_SIZE = 128;  // 16 bytes of block headers, then 28 words of interleaved samples
+constexpr u32 XA_GROUP_HEADERS_OFFSET = 4;  // The headers of every block, after a copy of the first four
+constexpr u32 XA_GROUP_WORDS_OFFSET = 16;
+constexpr u32 OUTPUT_RATE = 441;  // In units of 100 Hz
+
+s32 clamp16(s32 value) {
+  return std::clamp(value, -0x8000, 0x7FFF);
+}
+
+}  // namespace
+
+CdAudio::CdAudio() : m_kernels(spu_kernels()), m_thread(&CdAudio::run, this) {}
+
+CdAudio::~CdAudio() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+}
+
+bool CdAudio::push_xa_sector(const u8* sector, const CdVolume& volume, bool is_new_stream) {
+  return push(sector, volume, true, is_new_stream);
+}
+
+bool CdAudio::push_cdda_sector(const u8* sector, const CdVolume& volume) {
+  return push(sector, volume, false, false);
+}
+
+bool CdAudio::push(const u8* sector, const CdVolume& volume, bool is_xa, bool is_new_stream) {
+  Sector item;
+  std::memcpy(item.data.data(), sector, CD_SECTOR_SIZE);
+  item.volume = volume;
+  item.is_xa = is_xa;
+  item.is_new_stream = is_new_stream;
+  if (!m_sectors.try_push(item))
+    return false;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_has_work = true;
+  }
+  m_wake.notify_one();
+  return true;
+}
+
+void CdAudio::pull(u32 count, s32* left, s32* right) {
+  u32 i = 0;
+  for (; i < count; ++i) {
+    const Frame* frame = m_frames.front();
+    if (!frame)
+      break;
+    left[i] = (*frame)[0];
+    right[i] = (*frame)[1];
+    m_frames.pop();
+  }
+  std::fill(left + i, left + count, 0);
+  std::fill(right + i, right + count, 0);
+}
+
+void CdAudio::run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  while (true) {
+    m_wake.wait(lock, [this]() { return m_quit || m_has_work; });
+    if (m_quit)
+      return;
+    m_has_work = false;
+
+    lock.unlock();
+    while (const Sector* sector = m_sectors.front()) {
+      if (sector->is_xa)
+        decode_xa(*sector);
+      else
+        decode_cdda(*sector);
+      m_sectors.pop();
+    }
+    lock.lock();
+  }
+}
+
+void CdAudio::decode_xa(const Sector& sector) {
+  const u8 coding = sector.data[XA_SUBHEADER_OFFSET + 3];
+  const bool is_stereo = (coding & 0b11) == 1;
+  const u32 rate = ((coding >> 2) & 0b11) == 1 ? 189 : 378;
+  const bool is_8bit = ((coding >> 4) & 0b11) == 1;
+  const u32 block_count = is_8bit ? 4 : 8;
+
+  if (sector.is_new_stream) {
+    m_xa_history = {};
+    m_resample_prev = m_resample_cur = {};
+    m_resample_phase = 0;
+  }
+
+  for (u32 g = 0; g < XA_GROUP_COUNT; ++g) {
+    const u8* group = &sector.data[XA_DATA_OFFSET + g * XA_GROUP_SIZE];
+    const u8* words = group + XA_GROUP_WORDS_OFFSET;
+
+    // The blocks in order, stereo ones alternating left and right
+    std::array<std::array<s16, 32>, 8> blocks;
+    for (u32 b = 0; b < block_count; ++b) {
+      const u8 header = group[XA_GROUP_HEADERS_OFFSET + b];
+      auto& history = m_xa_history[is_stereo ? b % 2 : 0];
+
+      if (is_8bit) {
+        const u32 shift = header & 0xF;
+        for (u32 i = 0; i < ADPCM_BLOCK_SAMPLES; ++i)
+          blocks[b][i] = (s16)((u16)words[i * 4 + b] << 8) >> (shift > 8 ? 8 : shift);
+        filter_adpcm_block((header >> 4) & 0b11, history, blocks[b].data());
+        continue;
+      }
+
+      // Gathered into an SPU block, which has the same nibbles and header with a filter of up to 4
+      std::array<u8, ADPCM_BLOCK_SIZE> spu_block{};
+      spu_block[0] = header & 0x3F;
+      for (u32 i = 0; i < ADPCM_BLOCK_SAMPLES; ++i) {
+        const u8 nibble = (words[i * 4 + b / 2] >> ((b % 2) * 4)) & 0xF;
+        spu_block[2 + i / 2] |= nibble << ((i % 2) * 4);
+      }
+      m_kernels.decode_block(spu_block.data(), history, blocks[b].data());
+    }
+
+    if (is_stereo) {
+      for (u32 b = 0; b < block_count; b += 2)
+        for (u32 i = 0; i < ADPCM_BLOCK_SAMPLES; ++i)
+          resample(blocks[b][i], blocks[b + 1][i], rate, sector.volume);
+    } else {
+      for (u32 b = 0; b < block_count; ++b)
+        for (u32 i = 0; i < ADPCM_BLOCK_SAMPLES; ++i)
+          resample(blocks[b][i], blocks[b][i], rate, sector.volume);
+    }
+  }
+}
+
+void CdAudio::decode_cdda(const Sector& sector) {
+  // 16 bit stereo at 44.1 kHz already
+  for (u32 i = 0; i < CD_SECTOR_SIZE; i += 4) {
+    s16 left, right;
+    std::memcpy(&left, &sector.data[i], 2);
+    std::memcpy(&right, &sector.data[i + 2], 2);
+    output(left, right, sector.volume);
+  }
+}
+
+void CdAudio::resample(s32 left, s32 right, u32 rate, const CdVolume& volume) {
+  // Linear interpolation, the output stepping through the input rate/441th of a frame at a time
+  m_resample_prev = m_resample_cur;
+  m_resample_cur = { left, right };
+  const auto lerp = [this](u32 c) {
+    const s32 delta = m_resample_cur[c] - m_resample_prev[c];
+    return m_resample_prev[c] + delta * (s32)m_resample_phase / (s32)OUTPUT_RATE;
+  };
+  for (; m_resample_phase < OUTPUT_RATE; m_resample_phase += rate)
+    output(lerp(0), lerp(1), volume);
+  m_resample_phase -= OUTPUT_RATE;
+}
+
+void CdAudio::output(s32 left, s32 right, const CdVolume& volume) {
+  const s32 out_left = clamp16((left * volume.left_to_left + right * volume.right_to_left) >> 7);
+  const s32 out_right = clamp16((right * volume.right_to_right + left * volume.left_to_right) >> 7);
+  // Dropped when the SPU is behind, rather than holding up the sectors that follow
+  m_frames.try_push({ (s16)out_left, (s16)out_right });
+}
+
+}  // namespace spu
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <spu/spu_kernels.hpp>
+#include <util/spsc_ring.hpp>
+#include <util/types.hpp>
+
+#include <array>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace spu {
+
+constexpr u32 CD_SECTOR_SIZE = 2352;
+constexpr size_t CD_SECTOR_QUEUE_SIZE = 16;
+// 0.37s, more than the 9408 frames of an 18.9 kHz mono sector
+constexpr size_t CD_FRAME_QUEUE_SIZE = 16384;
+
+// CD-ROM output to SPU input volumes, 0x80 being 100%
+struct CdVolume {
+  u8 left_to_left{ 0x80 };
+  u8 left_to_right{};
+  u8 right_to_right{ 0x80 };
+  u8 right_to_left{};
+};
+
+// The CD audio input of the SPU. The CD-ROM drive queues whole XA-ADPCM and CD-DA sectors, a thread of
+// its own decodes them, resamples XA from 37.8 or 18.9 kHz to the 44.1 kHz of the SPU and queues the
+// stereo frames for it to mix in. Both queues are lock-free, the emulation thread only copies sectors
+// in and frames out.
+// https://psx-spx.consoledev.net/cdromdrive/#cdrom-xa-audio-adpcm-compression
+class CdAudio {
+ public:
+  CdAudio();
+  ~CdAudio();
+
+  // CD-ROM side. False if the decoder is too far behind and the sector is dropped. is_new_stream drops
+  // the ADPCM and resampling state of the previous sectors, after a seek.
+  bool push_xa_sector(const u8* sector, const CdVolume& volume, bool is_new_stream);
+  bool push_cdda_sector(const u8* sector, const CdVolume& volume);
+
+  // SPU side, count frames of what was decoded so far and silence past that
+  void pull(u32 count, s32* left, s32* right);
+
+ private:
+  using Frame = std::array<s16, 2>;
+
+  struct Sector {
+    std::array<u8, CD_SECTOR_SIZE> data;
+    CdVolume volume;
+    bool is_xa;
+    bool is_new_stream;
+  };
+
+  bool push(const u8* sector, const CdVolume& volume, bool is_xa, bool is_new_stream);
+
+  void run();
+  // On the worker thread
+  void decode_xa(const Sector& sector);
+  void decode_cdda(const Sector& sector);
+  void resample(s32 left, s32 right, u32 rate, const CdVolume& volume);  // rate in units of 100 Hz
+  void output(s32 left, s32 right, const CdVolume& volume);
+
+  util::SpscRing<Sector, CD_SECTOR_QUEUE_SIZE> m_sectors;
+  util::SpscRing<Frame, CD_FRAME_QUEUE_SIZE> m_frames;
+
+  // Worker only
+  const SpuKernels& m_kernels;
+  std::array<AdpcmHistory, 2> m_xa_history{};  // Left (or mono), right
+  std::array<s32, 2> m_resample_prev{};
+  std::array<s32, 2> m_resample_cur{};
+  u32 m_resample_phase{};  // Between the previous and the current input frame, in 1/441th
+
+  bool m_has_work{};
+  bool m_quit{};
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+
+  std::thread m_thread;  // Last, it starts running as soon as it's constructed
+};
+
+}  // namespace spu
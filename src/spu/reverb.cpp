@@ -0,0 +1,92 @@
+#include <spu/reverb.hpp>
+
+#include <util/state_stream.hpp>
+
+#include <algorithm>
+
+namespace spu {
+
+namespace {
+
+constexpr u32 SOUND_RAM_HALFWORDS = 0x40000;
+
+s32 clamp16(s32 value) {
+  return std::clamp(value, -0x8000, 0x7FFF);
+}
+
+// Both signed 1.15 fixed point
+s32 mul(s32 value, s32 volume) {
+  return (value * volume) >> 15;
+}
+
+}  // namespace
+
+void Reverb::step(u16* sound_ram,
+                  const u16* regs,
+                  u32 base,
+                  bool is_write_enabled,
+                  s32 in_left,
+                  s32 in_right) {
+  m_is_odd = !m_is_odd;
+  if (!m_is_odd)
+    return;  // The output of the previous sample is held
+
+  const u32 base_hw = base / 2;
+  const s64 size = SOUND_RAM_HALFWORDS - base_hw;
+
+  // Halfword of the work area at the address of reg (plus extra halfwords), relative to the current
+  // position and wrapping around the work area
+  const auto at = [&](ReverbReg reg, s32 extra) -> u16& {
+    const s64 offset = ((s64)m_addr + (s64)regs[reg] * 4 + extra) % size;
+    return sound_ram[base_hw + (offset < 0 ? offset + size : offset)];
+  };
+  const auto read = [&](ReverbReg reg, s32 extra = 0) -> s32 { return (s16)at(reg, extra); };
+  const auto write = [&](ReverbReg reg, s32 value) {
+    if (is_write_enabled)
+      at(reg, 0) = (u16)clamp16(value);
+  };
+  const auto vol = [&](ReverbReg reg) -> s32 { return (s16)regs[reg]; };
+
+  const s32 lin = mul(in_left, vol(vLIN));
+  const s32 rin = mul(in_right, vol(vRIN));
+
+  // Reflections off the walls, same side then the other side
+  const s32 l_same = read(mLSAME, -1);
+  write(mLSAME, mul(lin + mul(read(dLSAME), vol(vWALL)) - l_same, vol(vIIR)) + l_same);
+  const s32 r_same = read(mRSAME, -1);
+  write(mRSAME, mul(rin + mul(read(dRSAME), vol(vWALL)) - r_same, vol(vIIR)) + r_same);
+  const s32 l_diff = read(mLDIFF, -1);
+  write(mLDIFF, mul(lin + mul(read(dRDIFF), vol(vWALL)) - l_diff, vol(vIIR)) + l_diff);
+  const s32 r_diff = read(mRDIFF, -1);
+  write(mRDIFF, mul(rin + mul(read(dLDIFF), vol(vWALL)) - r_diff, vol(vIIR)) + r_diff);
+
+  // Early echo, then two all pass filters
+  s32 lout = mul(read(mLCOMB1), vol(vCOMB1)) + mul(read(mLCOMB2), vol(vCOMB2)) +
+             mul(read(mLCOMB3), vol(vCOMB3)) + mul(read(mLCOMB4), vol(vCOMB4));
+  s32 rout = mul(read(mRCOMB1), vol(vCOMB1)) + mul(read(mRCOMB2), vol(vCOMB2)) +
+             mul(read(mRCOMB3), vol(vCOMB3)) + mul(read(mRCOMB4), vol(vCOMB4));
+
+  const auto all_pass = [&](s32 out, ReverbReg m, ReverbReg d, ReverbReg v) {
+    const s32 delayed = read(m, -(s32)regs[d] * 4);
+    out = clamp16(out - mul(delayed, vol(v)));
+    write(m, out);
+    return mul(out, vol(v)) + delayed;
+  };
+  lout = all_pass(lout, mLAPF1, dAPF1, vAPF1);
+  rout = all_pass(rout, mRAPF1, dAPF1, vAPF1);
+  lout = all_pass(lout, mLAPF2, dAPF2, vAPF2);
+  rout = all_pass(rout, mRAPF2, dAPF2, vAPF2);
+
+  m_out_left = clamp16(lout);
+  m_out_right = clamp16(rout);
+  m_addr = (u32)(((s64)m_addr + 1) % size);
+}
+
+void Reverb::serialize(util::StateStream& s) {
+  s.value(m_addr);
+  s.value(m_is_odd);
+  s.value(m_out_left);
+  s.value(m_out_right);
+}
+
+}  // namespace spu
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <util/types.hpp>
+
+namespace util {
+class StateStream;
+}
+
+namespace spu {
+
+constexpr u32 REVERB_REG_COUNT = 32;
+
+// The reverb configuration registers at 0x1DC0, in order. Addresses are in 8 byte units, relative to the
+// current position in the work area, volumes are signed 1.15 fixed point.
+enum ReverbReg : u8 {
+  dAPF1, dAPF2, vIIR, vCOMB1, vCOMB2, vCOMB3, vCOMB4, vWALL, vAPF1, vAPF2,
+  mLSAME, mRSAME, mLCOMB1, mRCOMB1, mLCOMB2, mRCOMB2, dLSAME, dRSAME, mLDIFF, mRDIFF,
+  mLCOMB3, mRCOMB3, mLCOMB4, mRCOMB4, dLDIFF, dRDIFF, mLAPF1, mRAPF1, mLAPF2, mRAPF2,
+  vLIN, vRIN,
+};
+
+// Echoes of the voices with reverb enabled, in a work area at the end of sound RAM. The hardware runs it
+// at half the sample rate, every other sample: the output is held for the next one.
+// https://psx-spx.consoledev.net/soundprocessingunitspu/#spu-reverb-formula
+class Reverb {
+ public:
+  // One sample, the work area being from base (in bytes) to the end of sound RAM. It is only written to
+  // when writes are enabled (SPUCNT bit 7), the echoes of what's there are still heard.
+  void step(u16* sound_ram,
+            const u16* regs,  // The REVERB_REG_COUNT registers
+            u32 base,
+            bool is_write_enabled,
+            s32 in_left,
+            s32 in_right);
+
+  s32 out_left() const { return m_out_left; }
+  s32 out_right() const { return m_out_right; }
+
+  void serialize(util::StateStream& s);
+
+ private:
+  u32 m_addr{};  // Current position in the work area, in halfwords
+  bool m_is_odd{};
+  s32 m_out_left{};
+  s32 m_out_right{};
+};
+
+}  // namespace spu
@@ -1,14 +1,445 @@
 #include <spu/spu.hpp>
 
-#include <util/types.hpp>
+#include <cpu/interrupt.hpp>
+#include <emulator/scheduler.hpp>
+#include <util/log.hpp>
+#include <util/state_stream.hpp>
 
 #include <algorithm>
+#include <cstdlib>
 
 namespace spu {
-Spu::Spu() {
-  std::fill(m_data->begin(), m_data->end(), 0);
 
-  write<u16>(0x1AA, 0x8000);  // hard-code SPUCNT
-  //  write<u16>(0x1AE, 0x10);  // hard-code SPUCNT
+namespace {
+
+constexpr u32 SOUND_RAM_MASK = SOUND_RAM_SIZE - 1;
+constexpr u32 REVERB_REGS_ADDR = 0x1C0;
+constexpr u32 CD_VOLUME_ADDR = 0x1B0;  // Left then right
+constexpr u32 VOICE_VOLUMES_ADDR = 0x200;  // Current volumes of the voices, left then right
+constexpr u32 MAX_PITCH_STEP = 0x4000;
+constexpr s32 MAX_LEVEL = 0x7FFF;
+
+s32 clamp16(s32 value) {
+  return std::clamp(value, -0x8000, 0x7FFF);
+}
+
+// Both signed 1.15 fixed point
+s32 mul(s32 value, s32 volume) {
+  return (value * volume) >> 15;
+}
+
+// Volume of a volume register: fixed, or swept by an envelope for sample_count samples
+s32 sweep_volume(u16 reg, Envelope& sweep, u32 sample_count) {
+  if (!(reg & 0x8000)) {
+    const s32 volume = (s16)(reg << 1);
+    sweep.level = std::min(std::abs(volume), MAX_LEVEL);  // Sweeps start from there
+    return volume;
+  }
+
+  const bool is_exponential = reg & (1 << 14);
+  const bool is_decreasing = reg & (1 << 13);
+  const bool is_negative = reg & (1 << 12);
+  const u32 shift = (reg >> 2) & 0x1F;
+  const s32 step = is_decreasing ? -8 + (reg & 0b11) : 7 - (reg & 0b11);
+  for (u32 i = 0; i < sample_count; ++i)
+    sweep.tick(is_exponential, is_decreasing, shift, step);
+  return is_negative ? -sweep.level : sweep.level;
+}
+
+void tick_adsr(Voice& voice) {
+  auto& env = voice.adsr_envelope;
+  const auto& adsr = voice.adsr;
+
+  switch (voice.phase) {
+    case AdsrPhase::Off: break;
+    case AdsrPhase::Attack:
+      env.tick(adsr.attack_exponential, false, adsr.attack_shift, 7 - (s32)adsr.attack_step);
+      if (env.level == MAX_LEVEL) {
+        voice.phase = AdsrPhase::Decay;
+        env.wait = 0;
+      }
+      break;
+    case AdsrPhase::Decay:
+      env.tick(true, true, adsr.decay_shift, -8);
+      if (env.level <= (s32)(adsr.sustain_level + 1) * 0x800) {
+        voice.phase = AdsrPhase::Sustain;
+        env.wait = 0;
+      }
+      break;
+    case AdsrPhase::Sustain: {
+      const s32 step = adsr.sustain_decreasing ? -8 + (s32)adsr.sustain_step : 7 - (s32)adsr.sustain_step;
+      env.tick(adsr.sustain_exponential, adsr.sustain_decreasing, adsr.sustain_shift, step);
+      break;
+    }
+    case AdsrPhase::Release:
+      env.tick(adsr.release_exponential, true, adsr.release_shift, -8);
+      if (env.level == 0)
+        voice.phase = AdsrPhase::Off;
+      break;
+  }
+}
+
+}  // namespace
+
+void Envelope::tick(bool is_exponential, bool is_decreasing, u32 shift, s32 step) {
+  if (wait > 0) {
+    --wait;
+    return;
+  }
+
+  u32 cycles = 1u << std::max<s32>(0, (s32)shift - 11);
+  s32 change = step << std::max<s32>(0, 11 - (s32)shift);
+  if (is_exponential && !is_decreasing && level > 0x6000)
+    cycles *= 4;
+  if (is_exponential && is_decreasing)
+    change = (change * level) >> 15;
+
+  level = std::clamp(level + change, 0, MAX_LEVEL);
+  wait = cycles - 1;
+}
+
+Spu::Spu() : m_kernels(spu_kernels()), m_ram(std::make_unique<std::array<u16, SOUND_RAM_SIZE / 2>>()) {}
+
+void Spu::init(cpu::Interrupts* interrupts, emulator::Scheduler* scheduler) {
+  m_interrupts = interrupts;
+  m_scheduler = scheduler;
+
+  constexpr u64 BATCH_CYCLES = BATCH_SAMPLES * CPU_CYCLES_PER_SAMPLE;
+  m_scheduler->set_callback(emulator::EventType::Spu, [this]() {
+    run_batch();
+    // Relative to the deadline, for the sample rate not to drift
+    m_scheduler->schedule_at(emulator::EventType::Spu,
+                             m_scheduler->deadline(emulator::EventType::Spu) + BATCH_CYCLES);
+  });
+  m_scheduler->schedule(emulator::EventType::Spu, BATCH_CYCLES);
+}
+
+u16 Spu::read_reg(address addr_rebased) {
+  const u32 addr = addr_rebased & ~1u;
+
+  if (addr < VOICE_COUNT * 0x10) {
+    const auto& voice = m_voices[addr / 0x10];
+    switch (addr % 0x10) {
+      case 0xC: return (u16)voice.adsr_envelope.level;
+      case 0xE: return (u16)(voice.repeat_addr / 8);
+      default: return m_regs[addr / 2];
+    }
+  }
+
+  if (addr >= VOICE_VOLUMES_ADDR && addr < VOICE_VOLUMES_ADDR + VOICE_COUNT * 4) {
+    const auto& voice = m_voices[(addr - VOICE_VOLUMES_ADDR) / 4];
+    return (u16)(addr % 4 == 0 ? voice.sweep_left.level : voice.sweep_right.level);
+  }
+
+  switch (addr) {
+    case 0x19C: return (u16)m_end_flags;
+    case 0x19E: return (u16)(m_end_flags >> 16);
+    case 0x1AA: return m_control.word;
+    case 0x1AE: {  // SPUSTAT
+      u16 stat = m_control.word & 0x3F;  // The current mode, applied right away
+      if (m_irq_flag)
+        stat |= 1 << 6;
+      if (m_control.transfer_mode >= 2)
+        stat |= 1 << 7;  // DMA request
+      if (m_control.transfer_mode == 2)
+        stat |= 1 << 8;
+      if (m_control.transfer_mode == 3)
+        stat |= 1 << 9;
+      return stat;
+    }
+    case 0x1B8: return (u16)m_main_sweep_left.level;
+    case 0x1BA: return (u16)m_main_sweep_right.level;
+    default: return m_regs[addr / 2];
+  }
+}
+
+void Spu::write_reg(address addr_rebased, u16 val) {
+  const u32 addr = addr_rebased & ~1u;
+  m_regs[addr / 2] = val;
+
+  if (addr < VOICE_COUNT * 0x10) {
+    write_voice_reg(addr / 0x10, addr % 0x10, val);
+    return;
+  }
+
+  // The 32 bit voice masks, written a halfword at a time
+  const auto set_half = [addr](u32& mask, u16 half) {
+    mask = (addr & 2) ? (mask & 0xFFFF) | (u32)half << 16 : (mask & 0xFFFF0000) | half;
+  };
+
+  switch (addr) {
+    case 0x180: m_main_volume_left = val; break;
+    case 0x182: m_main_volume_right = val; break;
+    case 0x184: m_reverb_volume_left = (s16)val; break;
+    case 0x186: m_reverb_volume_right = (s16)val; break;
+    case 0x188: key_on(val); break;
+    case 0x18A: key_on((u32)val << 16); break;
+    case 0x18C: key_off(val); break;
+    case 0x18E: key_off((u32)val << 16); break;
+    case 0x190:
+    case 0x192: set_half(m_pitch_mod, val); break;
+    case 0x194:
+    case 0x196: set_half(m_noise_on, val); break;
+    case 0x198:
+    case 0x19A: set_half(m_reverb_on, val); break;
+    case 0x1A2: m_reverb_base = (u32)val * 8; break;
+    case 0x1A4: m_irq_addr = (u32)val * 8; break;
+    case 0x1A6: m_transfer_addr = (u32)val * 8; break;
+    case 0x1A8: write_ram(val); break;  // Data FIFO, written through right away
+    case 0x1AA:
+      m_control.word = val;
+      if (!m_control.irq_enable)
+        m_irq_flag = false;  // Acknowledged
+      break;
+    default: break;  // Read back as written
+  }
+}
+
+void Spu::write_voice_reg(u32 v, u32 reg, u16 val) {
+  auto& voice = m_voices[v];
+  switch (reg) {
+    case 0x0: voice.volume_left = val; break;
+    case 0x2: voice.volume_right = val; break;
+    case 0x4: voice.pitch = val; break;
+    case 0x6: voice.start_addr = (u32)val * 8; break;
+    case 0x8: voice.adsr.word = (voice.adsr.word & 0xFFFF0000) | val; break;
+    case 0xA: voice.adsr.word = (voice.adsr.word & 0xFFFF) | (u32)val << 16; break;
+    case 0xC: voice.adsr_envelope.level = std::min<s32>((s16)val, MAX_LEVEL); break;
+    case 0xE:
+      voice.repeat_addr = (u32)val * 8;
+      voice.is_repeat_addr_written = true;
+      break;
+    default: break;
+  }
+}
+
+void Spu::dma_write(const u32* words, u32 word_count) {
+  for (u32 i = 0; i < word_count; ++i) {
+    write_ram((u16)words[i]);
+    write_ram((u16)(words[i] >> 16));
+  }
+}
+
+void Spu::dma_read(u32* words, u32 word_count) {
+  auto& ram = *m_ram;
+  for (u32 i = 0; i < word_count; ++i) {
+    check_irq(m_transfer_addr, 4);
+    const u32 lo = ram[m_transfer_addr / 2];
+    const u32 hi = ram[((m_transfer_addr + 2) & SOUND_RAM_MASK) / 2];
+    words[i] = lo | hi << 16;
+    m_transfer_addr = (m_transfer_addr + 4) & SOUND_RAM_MASK;
+  }
+}
+
+void Spu::take_output(std::vector<s16>& dest) {
+  dest.clear();
+  std::swap(dest, m_output);
 }
+
+void Spu::serialize(util::StateStream& s) {
+  s.section("SPU ");
+  s.value(*m_ram);
+  s.value(m_voices);
+  s.value(m_control);
+  s.value(m_irq_flag);
+  s.value(m_main_volume_left);
+  s.value(m_main_volume_right);
+  s.value(m_main_sweep_left);
+  s.value(m_main_sweep_right);
+  s.value(m_reverb_volume_left);
+  s.value(m_reverb_volume_right);
+  s.value(m_pitch_mod);
+  s.value(m_noise_on);
+  s.value(m_reverb_on);
+  s.value(m_end_flags);
+  s.value(m_reverb_base);
+  s.value(m_irq_addr);
+  s.value(m_transfer_addr);
+  s.value(m_regs);
+  m_reverb.serialize(s);
+  s.value(m_noise_timer);
+  s.value(m_noise_level);
+  s.vector(m_output);
+}
+
+void Spu::write_ram(u16 val) {
+  check_irq(m_transfer_addr, 2);
+  (*m_ram)[m_transfer_addr / 2] = val;
+  m_transfer_addr = (m_transfer_addr + 2) & SOUND_RAM_MASK;
+}
+
+void Spu::check_irq(u32 addr, u32 size) {
+  if (!m_control.irq_enable || m_irq_flag || m_irq_addr < addr || m_irq_addr >= addr + size)
+    return;
+  m_irq_flag = true;
+  m_interrupts->trigger(cpu::IrqType::SPU);
+}
+
+void Spu::key_on(u32 voices) {
+  for (u32 v = 0; v < VOICE_COUNT; ++v) {
+    if (!(voices & (1 << v)))
+      continue;
+
+    auto& voice = m_voices[v];
+    voice.current_addr = voice.start_addr;
+    voice.pitch_counter = 0;
+    voice.samples.fill(0);
+    voice.history = {};
+    voice.is_repeat_addr_written = false;
+    voice.phase = AdsrPhase::Attack;
+    voice.adsr_envelope = {};
+    m_end_flags &= ~(1 << v);
+    fetch_block(voice);
+  }
+}
+
+void Spu::key_off(u32 voices) {
+  for (u32 v = 0; v < VOICE_COUNT; ++v) {
+    auto& voice = m_voices[v];
+    if (!(voices & (1 << v)) || voice.phase == AdsrPhase::Off)
+      continue;
+    voice.phase = AdsrPhase::Release;
+    voice.adsr_envelope.wait = 0;
+  }
+}
+
+void Spu::fetch_block(Voice& voice) {
+  const u8* block = reinterpret_cast<const u8*>(m_ram->data()) + voice.current_addr;
+  check_irq(voice.current_addr, ADPCM_BLOCK_SIZE);
+
+  voice.block_flags = block[1];
+  if ((voice.block_flags & 0b100) && !voice.is_repeat_addr_written)
+    voice.repeat_addr = voice.current_addr;  // Loop start
+
+  // The last samples of the previous block stay around for interpolation
+  std::copy_n(voice.samples.begin() + ADPCM_BLOCK_SAMPLES, 3, voice.samples.begin());
+  m_kernels.decode_block(block, voice.history, voice.samples.data() + 3);
+}
+
+void Spu::next_block(u32 v) {
+  auto& voice = m_voices[v];
+
+  if (voice.block_flags & 0b001) {  // Loop end
+    m_end_flags |= 1 << v;
+    voice.current_addr = voice.repeat_addr;
+    if (!(voice.block_flags & 0b010)) {  // Without repeat, the voice is muted
+      voice.phase = AdsrPhase::Off;
+      voice.adsr_envelope.level = 0;
+    }
+  } else {
+    voice.current_addr = (voice.current_addr + ADPCM_BLOCK_SIZE) & SOUND_RAM_MASK;
+  }
+  fetch_block(voice);
+}
+
+void Spu::run_noise(s32* out) {
+  // https://psx-spx.consoledev.net/soundprocessingunitspu/#spu-noise-generator
+  const s32 step = m_control.noise_step + 4;
+  const s32 reload = 0x20000 >> m_control.noise_shift;
+  for (u32 i = 0; i < BATCH_SAMPLES; ++i) {
+    m_noise_timer -= step;
+    if (m_noise_timer < 0) {
+      const u32 level = m_noise_level;
+      const u32 parity = ((level >> 15) ^ (level >> 12) ^ (level >> 11) ^ (level >> 10) ^ 1) & 1;
+      m_noise_level = (u16)(level * 2 + parity);
+      m_noise_timer += reload;
+      if (m_noise_timer < 0)
+        m_noise_timer += reload;
+    }
+    out[i] = (s16)m_noise_level;
+  }
+}
+
+bool Spu::render_voice(u32 v, const s32* noise, const s32* prev_out, s32* out) {
+  auto& voice = m_voices[v];
+  if (voice.phase == AdsrPhase::Off && voice.adsr_envelope.level == 0) {
+    std::fill_n(out, BATCH_SAMPLES, 0);
+    return false;
+  }
+
+  const bool is_noise = m_noise_on & (1 << v);
+  const bool is_pitch_modulated = v > 0 && (m_pitch_mod & (1 << v));
+
+  for (u32 i = 0; i < BATCH_SAMPLES; ++i) {
+    // Linear interpolation between the samples around the counter, rather than the 4 point gaussian
+    // one of the hardware
+    const u32 index = voice.pitch_counter >> 12;
+    const s32 frac = voice.pitch_counter & 0xFFF;
+    const s32 adpcm = (voice.samples[index + 2] * (0x1000 - frac) + voice.samples[index + 3] * frac) >> 12;
+
+    const s32 sample = is_noise ? noise[i] : adpcm;
+    out[i] = mul(sample, voice.adsr_envelope.level);
+    tick_adsr(voice);
+
+    // https://psx-spx.consoledev.net/soundprocessingunitspu/#pitch-modulation
+    u32 step = voice.pitch;
+    if (is_pitch_modulated) {
+      const s32 factor = prev_out[i] + 0x8000;
+      step = (u32)(((s32)(s16)step * factor) >> 15) & 0xFFFF;
+    }
+    voice.pitch_counter += std::min(step, MAX_PITCH_STEP);
+
+    while ((voice.pitch_counter >> 12) >= ADPCM_BLOCK_SAMPLES) {
+      voice.pitch_counter -= ADPCM_BLOCK_SAMPLES << 12;
+      next_block(v);
+    }
+  }
+  return true;
+}
+
+void Spu::run_batch() {
+  std::array<s32, BATCH_SAMPLES> mix_left{}, mix_right{}, reverb_left{}, reverb_right{};
+  std::array<s32, BATCH_SAMPLES> noise, voice_out, prev_out{};
+
+  run_noise(noise.data());
+
+  // Taken even when disabled, the CD keeps playing
+  std::array<s32, BATCH_SAMPLES> cd_left, cd_right;
+  m_cd_audio.pull(BATCH_SAMPLES, cd_left.data(), cd_right.data());
+  if (m_control.cd_audio_enable) {
+    const s32 cd_volume_left = (s16)m_regs[CD_VOLUME_ADDR / 2];
+    const s32 cd_volume_right = (s16)m_regs[CD_VOLUME_ADDR / 2 + 1];
+    m_kernels.mix(cd_left.data(), cd_volume_left, 0, BATCH_SAMPLES, mix_left.data(), mix_right.data());
+    m_kernels.mix(cd_right.data(), 0, cd_volume_right, BATCH_SAMPLES, mix_left.data(), mix_right.data());
+    if (m_control.cd_audio_reverb) {
+      m_kernels.mix(cd_left.data(), cd_volume_left, 0, BATCH_SAMPLES, reverb_left.data(), reverb_right.data());
+      m_kernels.mix(cd_right.data(), 0, cd_volume_right, BATCH_SAMPLES, reverb_left.data(),
+                    reverb_right.data());
+    }
+  }
+
+  for (u32 v = 0; v < VOICE_COUNT; ++v) {
+    auto& voice = m_voices[v];
+    const bool is_audible = render_voice(v, noise.data(), prev_out.data(), voice_out.data());
+    const s32 volume_left = sweep_volume(voice.volume_left, voice.sweep_left, BATCH_SAMPLES);
+    const s32 volume_right = sweep_volume(voice.volume_right, voice.sweep_right, BATCH_SAMPLES);
+
+    if (is_audible) {
+      m_kernels.mix(voice_out.data(), volume_left, volume_right, BATCH_SAMPLES, mix_left.data(),
+                    mix_right.data());
+      if (m_reverb_on & (1 << v))
+        m_kernels.mix(voice_out.data(), volume_left, volume_right, BATCH_SAMPLES, reverb_left.data(),
+                      reverb_right.data());
+    }
+    std::swap(prev_out, voice_out);
+  }
+
+  const s32 main_left = sweep_volume(m_main_volume_left, m_main_sweep_left, BATCH_SAMPLES);
+  const s32 main_right = sweep_volume(m_main_volume_right, m_main_sweep_right, BATCH_SAMPLES);
+  const bool is_muted = !m_control.enable || !m_control.unmute;
+  const u16* reverb_regs = &m_regs[REVERB_REGS_ADDR / 2];
+
+  const size_t first = m_output.size();
+  m_output.resize(first + BATCH_SAMPLES * 2);
+  for (u32 i = 0; i < BATCH_SAMPLES; ++i) {
+    m_reverb.step(m_ram->data(), reverb_regs, m_reverb_base, m_control.reverb_enable,
+                  clamp16(reverb_left[i]), clamp16(reverb_right[i]));
+
+    const s32 left = clamp16(mix_left[i]) + mul(m_reverb.out_left(), m_reverb_volume_left);
+    const s32 right = clamp16(mix_right[i]) + mul(m_reverb.out_right(), m_reverb_volume_right);
+    m_output[first + i * 2] = is_muted ? 0 : (s16)clamp16(mul(clamp16(left), main_left));
+    m_output[first + i * 2 + 1] = is_muted ? 0 : (s16)clamp16(mul(clamp16(right), main_right));
+  }
+}
+
 }  // namespace spu
@@ -1,15 +1,194 @@
 #pragma once
 
-#include <memory/addressable.hpp>
 #include <memory/map.hpp>
+#include <spu/cd_audio.hpp>
+#include <spu/reverb.hpp>
+#include <spu/spu_kernels.hpp>
+#include <util/types.hpp>
+
+#include <array>
+#include <memory>
+#include <vector>
+
+namespace cpu {
+class Interrupts;
+}
+
+namespace emulator {
+class Scheduler;
+}
+
+namespace util {
+class StateStream;
+}
 
 namespace spu {
 
-class Spu : public memory::Addressable<memory::SPU_SIZE> {
+constexpr u32 SOUND_RAM_SIZE = 512 * 1024;
+constexpr u32 VOICE_COUNT = 24;
+constexpr u32 SAMPLE_RATE = 44100;
+constexpr u32 CPU_CYCLES_PER_SAMPLE = 768;  // 33.8688 MHz / 44100 Hz
+constexpr u32 BATCH_SAMPLES = 32;           // Generated at once, by each Spu event
+
+union SpuControl {
+  u16 word{};
+
+  struct {
+    u16 cd_audio_enable : 1;
+    u16 ext_audio_enable : 1;
+    u16 cd_audio_reverb : 1;
+    u16 ext_audio_reverb : 1;
+    u16 transfer_mode : 2;  // 0=Stop, 1=Manual write, 2=DMA write, 3=DMA read
+    u16 irq_enable : 1;
+    u16 reverb_enable : 1;  // Writes to the reverb work area, it's still heard without
+    u16 noise_step : 2;
+    u16 noise_shift : 4;
+    u16 unmute : 1;
+    u16 enable : 1;
+  };
+};
+
+// The two ADSR registers of a voice, low halfword first
+union AdsrConfig {
+  u32 word{};
+
+  struct {
+    u32 sustain_level : 4;  // Level at which decay turns to sustain, (N+1)*0x800
+    u32 decay_shift : 4;
+    u32 attack_step : 2;  // +7, +6, +5 or +4
+    u32 attack_shift : 5;
+    u32 attack_exponential : 1;
+    u32 release_shift : 5;
+    u32 release_exponential : 1;
+    u32 sustain_step : 2;  // +7, +6, +5, +4 increasing, -8, -7, -6, -5 decreasing
+    u32 sustain_shift : 5;
+    u32 : 1;
+    u32 sustain_decreasing : 1;
+    u32 sustain_exponential : 1;
+  };
+};
+
+enum class AdsrPhase : u8 {
+  Off,
+  Attack,
+  Decay,
+  Sustain,
+  Release,
+};
+
+// A level stepped by envelope rules, for ADSR and volume sweeps
+struct Envelope {
+  s32 level{};  // 0 to 0x7FFF
+  u32 wait{};   // Samples until the next change
+
+  // One sample of the envelope going up or down by step every so often, see
+  // https://psx-spx.consoledev.net/soundprocessingunitspu/#spu-volume-and-adsr-generator
+  void tick(bool is_exponential, bool is_decreasing, u32 shift, s32 step);
+};
+
+struct Voice {
+  // Registers
+  u16 volume_left{};
+  u16 volume_right{};
+  u16 pitch{};
+  u32 start_addr{};  // In bytes
+  AdsrConfig adsr{};
+  u32 repeat_addr{};  // In bytes, set by loop start flags unless written to since the key on
+
+  // State
+  u32 current_addr{};  // Of the block being played
+  u32 pitch_counter{};  // 4.12 fixed point index into the block
+  // The samples of the block being played, after the last 3 of the previous block
+  std::array<s16, 3 + 32> samples{};
+  AdpcmHistory history{};
+  u8 block_flags{};
+  bool is_repeat_addr_written{};
+
+  AdsrPhase phase{ AdsrPhase::Off };
+  Envelope adsr_envelope;
+  Envelope sweep_left;
+  Envelope sweep_right;
+
+};
+
+// Sound processing unit with its 512 KB of sound RAM and 24 ADPCM voices. It runs in batches of
+// BATCH_SAMPLES samples scheduled on the system clock, each voice is generated for the whole batch at
+// once and then mixed in with SIMD kernels (see spu/spu_kernels.hpp). The output piles up as 16 bit
+// stereo samples until taken.
+class Spu {
  public:
   Spu();
-  // TODO
+
+  void init(cpu::Interrupts* interrupts, emulator::Scheduler* scheduler);
+
+  u16 read_reg(address addr_rebased);
+  void write_reg(address addr_rebased, u16 val);
+
+  // Sound RAM transfers, at the transfer address
+  void dma_write(const u32* words, u32 word_count);
+  void dma_read(u32* words, u32 word_count);
+
+  // Interleaved stereo samples generated since the last call, dest is swapped with them
+  void take_output(std::vector<s16>& dest);
+
+  // Sound RAM, voices and reverb. What the CD audio decoder still has queued isn't part of it, a few
+  // sectors it keeps playing after a load.
+  void serialize(util::StateStream& s);
+
+  // Where the CD-ROM drive sends its audio
+  CdAudio& cd_audio() { return m_cd_audio; }
+
  private:
+  void run_batch();
+  void run_noise(s32* out);
+  // BATCH_SAMPLES samples of the voice, after its ADSR envelope. prev_out is what the previous voice
+  // rendered, for pitch modulation.
+  bool render_voice(u32 v, const s32* noise, const s32* prev_out, s32* out);  // False if silent
+  void next_block(u32 v);
+  void fetch_block(Voice& voice);
+  void key_on(u32 voices);
+  void key_off(u32 voices);
+  void write_ram(u16 val);
+  void check_irq(u32 addr, u32 size);
+
+  void write_voice_reg(u32 v, u32 reg, u16 val);
+
+ private:
+  cpu::Interrupts* m_interrupts{};
+  emulator::Scheduler* m_scheduler{};
+  const SpuKernels& m_kernels;
+
+  std::unique_ptr<std::array<u16, SOUND_RAM_SIZE / 2>> m_ram;
+  std::array<Voice, VOICE_COUNT> m_voices{};
+
+  SpuControl m_control{};
+  bool m_irq_flag{};
+  u16 m_main_volume_left{};
+  u16 m_main_volume_right{};
+  Envelope m_main_sweep_left;
+  Envelope m_main_sweep_right;
+  s16 m_reverb_volume_left{};
+  s16 m_reverb_volume_right{};
+
+  u32 m_pitch_mod{};
+  u32 m_noise_on{};
+  u32 m_reverb_on{};
+  u32 m_end_flags{};  // ENDX, which voices went past a loop end block since their key on
+
+  u32 m_reverb_base{};  // In bytes
+  u32 m_irq_addr{};     // In bytes
+  u32 m_transfer_addr{};  // Current, in bytes
+
+  // Last written value of every register, which is what reads return unless the SPU changes it
+  std::array<u16, memory::SPU_SIZE / 2> m_regs{};
+
+  Reverb m_reverb;
+  CdAudio m_cd_audio;
+
+  s32 m_noise_timer{};
+  u16 m_noise_level{ 1 };
+
+  std::vector<s16> m_output;
 };
 
 }  // namespace spu
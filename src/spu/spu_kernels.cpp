@@ -0,0 +1,49 @@
+#include <spu/spu_kernels.hpp>
+
+#include <util/log.hpp>
+
+namespace spu {
+
+namespace {
+
+void decode_block_scalar(const u8* block, AdpcmHistory& history, s16* out) {
+  const u32 shift = adpcm_shift(block);
+  for (u32 i = 0; i < ADPCM_BLOCK_SAMPLES; ++i) {
+    const u32 nibble = (block[2 + i / 2] >> ((i % 2) * 4)) & 0xF;
+    out[i] = (s16)((s16)(nibble << 12) >> shift);
+  }
+  filter_adpcm_block(adpcm_filter(block), history, out);
+}
+
+void mix_scalar(const s32* samples, s32 volume_left, s32 volume_right, u32 count, s32* out_left, s32* out_right) {
+  for (u32 i = 0; i < count; ++i) {
+    out_left[i] += (samples[i] * volume_left) >> 15;
+    out_right[i] += (samples[i] * volume_right) >> 15;
+  }
+}
+
+constexpr SpuKernels SCALAR_KERNELS = { "scalar", decode_block_scalar, mix_scalar };
+
+const SpuKernels& select_spu_kernels() {
+  const SpuKernels* kernels = spu_kernels_sse41();
+  if (kernels == nullptr)
+    kernels = spu_kernels_neon();
+  if (kernels == nullptr)
+    kernels = &SCALAR_KERNELS;
+
+  LOG_INFO("Using {} SPU kernels", kernels->name);
+  return *kernels;
+}
+
+}  // namespace
+
+const SpuKernels& spu_kernels() {
+  static const SpuKernels& kernels = select_spu_kernels();
+  return kernels;
+}
+
+const SpuKernels& spu_kernels_scalar() {
+  return SCALAR_KERNELS;
+}
+
+}  // namespace spu
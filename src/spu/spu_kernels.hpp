@@ -0,0 +1,81 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <array>
+
+// SPU kernels decode ADPCM blocks and mix voices a batch of samples at a time. There is a scalar
+// reference implementation, and SIMD ones picked at runtime depending on what the host CPU supports,
+// all of them bit identical.
+//
+// The ADPCM filter of a block feeds each sample into the next one, only the nibbles are expanded into
+// samples in parallel. Mixing has no such dependency: each voice is scaled by its volume and summed
+// into the output, many samples per iteration.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPU_KERNELS_X86 1
+#else
+#define SPU_KERNELS_X86 0
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define SPU_KERNELS_NEON 1
+#else
+#define SPU_KERNELS_NEON 0
+#endif
+
+namespace spu {
+
+constexpr u32 ADPCM_BLOCK_SIZE = 16;     // 2 header bytes, then 2 samples per byte
+constexpr u32 ADPCM_BLOCK_SAMPLES = 28;
+
+// The two last decoded samples, the filter of the next block starts from them
+using AdpcmHistory = std::array<s16, 2>;  // { last, the one before }
+
+// https://psx-spx.consoledev.net/soundprocessingunitspu/#spu-adpcm-samples
+constexpr s32 ADPCM_FILTER_POS[5] = { 0, 60, 115, 98, 122 };
+constexpr s32 ADPCM_FILTER_NEG[5] = { 0, 0, -52, -55, -60 };
+
+inline u32 adpcm_shift(const u8* block) {
+  const u32 shift = block[0] & 0xF;
+  return shift > 12 ? 9 : shift;  // 13 to 15 act like 9
+}
+inline u32 adpcm_filter(const u8* block) {
+  const u32 filter = (block[0] >> 4) & 0x7;
+  return filter > 4 ? 4 : filter;
+}
+
+// Runs the filter of the block over its expanded samples in place
+inline void filter_adpcm_block(u32 filter, AdpcmHistory& history, s16* samples) {
+  const s32 pos = ADPCM_FILTER_POS[filter];
+  const s32 neg = ADPCM_FILTER_NEG[filter];
+  s32 last = history[0];
+  s32 before = history[1];
+  for (u32 i = 0; i < ADPCM_BLOCK_SAMPLES; ++i) {
+    s32 sample = samples[i] + ((last * pos + before * neg + 32) >> 6);
+    sample = sample < -0x8000 ? -0x8000 : (sample > 0x7FFF ? 0x7FFF : sample);
+    samples[i] = (s16)sample;
+    before = last;
+    last = sample;
+  }
+  history = { (s16)last, (s16)before };
+}
+
+struct SpuKernels {
+  const char* name;
+
+  // The 28 samples of a block. out must have room for 32 samples, kernels may write past 28.
+  void (*decode_block)(const u8* block, AdpcmHistory& history, s16* out);
+  // out[i] += (samples[i] * volume) >> 15 for both sides, volumes being signed 1.15 fixed point
+  void (*mix)(const s32* samples, s32 volume_left, s32 volume_right, u32 count, s32* out_left, s32* out_right);
+};
+
+// Kernels for the best instruction set available
+const SpuKernels& spu_kernels();
+
+// Per instruction set kernels, null if not built in or not supported by the host
+const SpuKernels& spu_kernels_scalar();
+const SpuKernels* spu_kernels_sse41();
+const SpuKernels* spu_kernels_neon();
+
+}  // namespace spu
@@ -0,0 +1,72 @@
+#include <spu/spu_kernels.hpp>
+
+#if SPU_KERNELS_NEON
+
+#include <arm_neon.h>
+
+// AArch64 always has NEON, no runtime check is needed
+
+namespace spu {
+
+namespace {
+
+void decode_block_neon(const u8* block, AdpcmHistory& history, s16* out) {
+  // The 14 sample bytes, the last 2 of the 16 loaded only make samples past the end of the block
+  u8 data[16] = {};
+  for (u32 i = 0; i < ADPCM_BLOCK_SIZE - 2; ++i)
+    data[i] = block[2 + i];
+  const uint8x16_t bytes = vld1q_u8(data);
+  const uint8x16_t low = vandq_u8(bytes, vdupq_n_u8(0x0F));
+  const uint8x16_t high = vshrq_n_u8(bytes, 4);
+
+  // Samples in order, moved into the top 4 bits of each 16 bit lane and shifted back down with their
+  // sign
+  const uint8x16x2_t samples = vzipq_u8(low, high);
+  const int16x8_t shift = vdupq_n_s16(-(s16)adpcm_shift(block));
+  for (u32 half = 0; half < 2; ++half) {
+    const uint8x16_t nibbles = samples.val[half];
+    const int16x8_t lo = vreinterpretq_s16_u16(vshll_n_u8(vget_low_u8(nibbles), 8));
+    const int16x8_t hi = vreinterpretq_s16_u16(vshll_n_u8(vget_high_u8(nibbles), 8));
+    vst1q_s16(out + half * 16, vshlq_s16(vshlq_n_s16(lo, 4), shift));
+    vst1q_s16(out + half * 16 + 8, vshlq_s16(vshlq_n_s16(hi, 4), shift));
+  }
+
+  filter_adpcm_block(adpcm_filter(block), history, out);
+}
+
+void mix_neon(const s32* samples, s32 volume_left, s32 volume_right, u32 count, s32* out_left, s32* out_right) {
+  u32 i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const int32x4_t s = vld1q_s32(samples + i);
+    const int32x4_t l = vshrq_n_s32(vmulq_n_s32(s, volume_left), 15);
+    const int32x4_t r = vshrq_n_s32(vmulq_n_s32(s, volume_right), 15);
+    vst1q_s32(out_left + i, vaddq_s32(vld1q_s32(out_left + i), l));
+    vst1q_s32(out_right + i, vaddq_s32(vld1q_s32(out_right + i), r));
+  }
+  for (; i < count; ++i) {
+    out_left[i] += (samples[i] * volume_left) >> 15;
+    out_right[i] += (samples[i] * volume_right) >> 15;
+  }
+}
+
+constexpr SpuKernels NEON_KERNELS = { "NEON", decode_block_neon, mix_neon };
+
+}  // namespace
+
+const SpuKernels* spu_kernels_neon() {
+  return &NEON_KERNELS;
+}
+
+}  // namespace spu
+
+#else
+
+namespace spu {
+
+const SpuKernels* spu_kernels_neon() {
+  return nullptr;
+}
+
+}  // namespace spu
+
+#endif
@@ -0,0 +1,80 @@
+#include <spu/spu_kernels.hpp>
+
+#if SPU_KERNELS_X86
+
+#include <immintrin.h>
+
+// Kernels are compiled for their instruction set through function attributes, see
+// renderer/span_kernels_x86.cpp
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+
+namespace spu {
+
+namespace {
+
+TARGET_SSE41 void decode_block_sse41(const u8* block, AdpcmHistory& history, s16* out) {
+  // The 14 sample bytes, then 2 zero bytes that only make samples past the end of the block
+  const __m128i bytes = _mm_srli_si128(_mm_loadu_si128((const __m128i*)block), 2);
+  const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+  const __m128i low = _mm_and_si128(bytes, nibble_mask);
+  const __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble_mask);
+
+  // Samples in order as bytes, moved into the top 4 bits of each 16 bit lane and shifted back down
+  // with their sign
+  const __m128i shift = _mm_cvtsi32_si128((s32)adpcm_shift(block));
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i first = _mm_slli_epi16(_mm_unpacklo_epi8(low, high), 4);
+  const __m128i second = _mm_slli_epi16(_mm_unpackhi_epi8(low, high), 4);
+  _mm_storeu_si128((__m128i*)out, _mm_sra_epi16(_mm_unpacklo_epi8(zero, first), shift));
+  _mm_storeu_si128((__m128i*)(out + 8), _mm_sra_epi16(_mm_unpackhi_epi8(zero, first), shift));
+  _mm_storeu_si128((__m128i*)(out + 16), _mm_sra_epi16(_mm_unpacklo_epi8(zero, second), shift));
+  _mm_storeu_si128((__m128i*)(out + 24), _mm_sra_epi16(_mm_unpackhi_epi8(zero, second), shift));
+
+  filter_adpcm_block(adpcm_filter(block), history, out);
+}
+
+TARGET_SSE41 void mix_sse41(const s32* samples,
+                            s32 volume_left,
+                            s32 volume_right,
+                            u32 count,
+                            s32* out_left,
+                            s32* out_right) {
+  const __m128i vol_l = _mm_set1_epi32(volume_left);
+  const __m128i vol_r = _mm_set1_epi32(volume_right);
+
+  u32 i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i s = _mm_loadu_si128((const __m128i*)(samples + i));
+    const __m128i l = _mm_srai_epi32(_mm_mullo_epi32(s, vol_l), 15);
+    const __m128i r = _mm_srai_epi32(_mm_mullo_epi32(s, vol_r), 15);
+    _mm_storeu_si128((__m128i*)(out_left + i), _mm_add_epi32(_mm_loadu_si128((__m128i*)(out_left + i)), l));
+    _mm_storeu_si128((__m128i*)(out_right + i), _mm_add_epi32(_mm_loadu_si128((__m128i*)(out_right + i)), r));
+  }
+  for (; i < count; ++i) {
+    out_left[i] += (samples[i] * volume_left) >> 15;
+    out_right[i] += (samples[i] * volume_right) >> 15;
+  }
+}
+
+constexpr SpuKernels SSE41_KERNELS = { "SSE4.1", decode_block_sse41, mix_sse41 };
+
+}  // namespace
+
+const SpuKernels* spu_kernels_sse41() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.1") ? &SSE41_KERNELS : nullptr;
+}
+
+}  // namespace spu
+
+#else
+
+namespace spu {
+
+const SpuKernels* spu_kernels_sse41() {
+  return nullptr;
+}
+
+}  // namespace spu
+
+#endif
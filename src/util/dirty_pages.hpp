@@ -0,0 +1,76 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+
+namespace util {
+
+// Which pages of a memory were written to, for any number of consumers looking at it at their own pace
+// (code invalidation, texture caches, uploads, snapshots). A write stamps its page with the current
+// epoch, a store or two. Each consumer keeps a Cursor, the epoch from which writes are new to it:
+// taking the dirty pages moves the cursor on to a fresh epoch, so consumers never reset anything for
+// each other.
+template <size_t PageCount>
+class DirtyPages {
+ public:
+  using Pages = std::bitset<PageCount>;
+
+  // Where a consumer is at. A new one sees every page as dirty.
+  struct Cursor {
+    u32 epoch{};
+  };
+
+  void mark(size_t page) {
+    m_stamps[page] = m_epoch;
+    m_last_mark = m_epoch;
+  }
+  void mark(size_t first_page, size_t last_page) {
+    for (size_t page = first_page; page <= last_page; ++page)
+      m_stamps[page] = m_epoch;
+    m_last_mark = m_epoch;
+  }
+  void mark(const Pages& pages) {
+    for (size_t page = 0; page < PageCount; ++page)
+      if (pages[page])
+        m_stamps[page] = m_epoch;
+    m_last_mark = m_epoch;
+  }
+  void mark_all() {
+    m_stamps.fill(m_epoch);
+    m_last_mark = m_epoch;
+  }
+
+  // Written to since the cursor was last moved on
+  bool any_dirty(const Cursor& cursor) const { return m_last_mark >= cursor.epoch; }
+  bool is_dirty(const Cursor& cursor, size_t page) const { return m_stamps[page] >= cursor.epoch; }
+  Pages dirty(const Cursor& cursor) const {
+    Pages pages;
+    for (size_t page = 0; page < PageCount; ++page)
+      pages[page] = m_stamps[page] >= cursor.epoch;
+    return pages;
+  }
+
+  // Moves the cursor on, only writes from now on are dirty to it
+  void advance(Cursor& cursor) { cursor.epoch = ++m_epoch; }
+  Cursor cursor() {
+    Cursor cursor;
+    advance(cursor);
+    return cursor;
+  }
+  // The pages dirty to the cursor, which is then moved on
+  Pages take(Cursor& cursor) {
+    const Pages pages = dirty(cursor);
+    advance(cursor);
+    return pages;
+  }
+
+ private:
+  std::array<u32, PageCount> m_stamps{};
+  u32 m_epoch{ 1 };  // Stamped by writes
+  u32 m_last_mark{};  // Epoch of the latest write, so that clean cursors are told apart in one compare
+};
+
+}  // namespace util
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <array>
+#include <cstddef>
+#include <iterator>
+
+namespace util {
+
+// FIFO of at most Capacity items in place, for the small FIFOs of the hardware. Pushing to a full ring is
+// the caller's to prevent. Indices only ever increase and are wrapped when indexing.
+template <typename T, size_t Capacity>
+class FixedRing {
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+ public:
+  class const_iterator {
+   public:
+    // For fmt::join() and the standard algorithms
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T*;
+    using reference = const T&;
+
+    const_iterator(const FixedRing* ring, size_t index) : m_ring(ring), m_index(index) {}
+    const T& operator*() const { return m_ring->m_items[m_index & (Capacity - 1)]; }
+    const_iterator& operator++() {
+      ++m_index;
+      return *this;
+    }
+    bool operator==(const const_iterator& other) const { return m_index == other.m_index; }
+    bool operator!=(const const_iterator& other) const { return m_index != other.m_index; }
+
+   private:
+    const FixedRing* m_ring;
+    size_t m_index;
+  };
+
+  void push_back(const T& item) { m_items[m_write++ & (Capacity - 1)] = item; }
+  void pop_front() { ++m_read; }
+  const T& front() const { return m_items[m_read & (Capacity - 1)]; }
+  void clear() { m_read = m_write; }
+
+  size_t size() const { return m_write - m_read; }
+  bool empty() const { return m_read == m_write; }
+  bool full() const { return size() == Capacity; }
+
+  const_iterator begin() const { return { this, m_read }; }
+  const_iterator end() const { return { this, m_write }; }
+
+ private:
+  std::array<T, Capacity> m_items{};
+  size_t m_read{};
+  size_t m_write{};
+};
+
+}  // namespace util
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace util {
+
+// Text log of at most Capacity lines, the oldest are dropped to make room for new ones. Lines are kept
+// apart so that a view of the log only needs the ones it shows, and their strings are reused once the
+// log is full. The line being written is the last line until it ends with '\n'.
+template <size_t Capacity>
+class LineLog {
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+ public:
+  void append(char c) {
+    if (c == '\n')
+      m_has_partial = false;
+    else
+      partial_line() += c;
+  }
+  void append(std::string_view text) {
+    for (size_t start = 0; start < text.size();) {
+      const size_t end = std::min(text.find('\n', start), text.size());
+      partial_line().append(text, start, end - start);
+      if (end < text.size())
+        m_has_partial = false;
+      start = end + 1;
+    }
+  }
+  void clear() {
+    m_first = m_next;
+    m_has_partial = false;
+  }
+
+  // Oldest first
+  size_t size() const { return m_next - m_first; }
+  bool empty() const { return size() == 0; }
+  const std::string& operator[](size_t index) const {
+    return m_lines[(m_first + index) & (Capacity - 1)];
+  }
+
+ private:
+  // The last line, started if the previous one has ended
+  std::string& partial_line() {
+    if (!m_has_partial) {
+      if (size() == Capacity)
+        ++m_first;
+      m_lines[m_next++ & (Capacity - 1)].clear();
+      m_has_partial = true;
+    }
+    return m_lines[(m_next - 1) & (Capacity - 1)];
+  }
+
+  std::array<std::string, Capacity> m_lines;
+  // Indices only ever increase and are wrapped when indexing
+  size_t m_first{};
+  size_t m_next{};
+  bool m_has_partial{};  // The last line hasn't ended yet
+};
+
+}  // namespace util
@@ -1,11 +1,13 @@
 #include <util/log.hpp>
 
+#include <spdlog/async.h>
 #include <spdlog/sinks/basic_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
 #include <chrono>
 #include <initializer_list>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -25,14 +27,30 @@ static constexpr auto LOG_CPU_FILENAME = "pctation_cpu.log";
 
 static constexpr auto DEFAULT_LOG_PATTERN = "%^[--%L--] %16s:%-3# %v%$";
 
+// Messages queued for the logging thread, allocated once by init()
+static constexpr size_t LOG_QUEUE_SIZE = 8192;
+
+// Queued, so that logging from the emulation or GPU threads never waits on a sink
+static std::shared_ptr<spdlog::logger> make_async_logger(const std::string& name,
+                                                         std::initializer_list<spdlog::sink_ptr> sinks) {
+  auto logger = std::make_shared<spdlog::async_logger>(name, sinks, spdlog::thread_pool(),
+                                                       spdlog::async_overflow_policy::overrun_oldest);
+  // Each flush is a message of its own, the logging thread flushes often enough otherwise
+  logger->flush_on(spdlog::level::err);
+  return logger;
+}
+
 void init() {
-  // Set up sinks
-  spdlog::sink_ptr cmd_sink = std::make_shared<spdlog::sinks::stdout_color_sink_st>();
+  spdlog::init_thread_pool(LOG_QUEUE_SIZE, 1);
+  spdlog::flush_every(std::chrono::seconds(1));
+
+  // Set up sinks, the main ones are shared with the GPU render thread
+  spdlog::sink_ptr cmd_sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
 
   spdlog::sink_ptr file_sink_main =
-      std::make_shared<spdlog::sinks::basic_file_sink_st>(LOG_FILENAME, true);
+      std::make_shared<spdlog::sinks::basic_file_sink_mt>(LOG_FILENAME, true);
   spdlog::sink_ptr file_sink_cpu =
-      std::make_shared<spdlog::sinks::basic_file_sink_st>(LOG_CPU_FILENAME, true);
+      std::make_shared<spdlog::sinks::basic_file_sink_mt>(LOG_CPU_FILENAME, true);
 
 
   std::initializer_list<spdlog::sink_ptr> main_sinks{
@@ -49,40 +67,74 @@ void init() {
   */
 
   // Set up default logger
-  auto default_logger = std::make_shared<spdlog::logger>("main", main_sinks);
+  auto default_logger = make_async_logger("main", main_sinks);
   default_logger->set_level(spdlog::level::warn);
-  default_logger->flush_on(spdlog::level::trace);
   default_logger->set_pattern(DEFAULT_LOG_PATTERN);
   spdlog::register_logger(default_logger);
 
-  // Set up CPU logger
+  // Set up CPU logger, synchronous as a trace mustn't drop any line. Locked, for the emulators of a farm
+  // (see emulator/farm.hpp) to share it.
   g_cpu_logger = std::make_shared<spdlog::logger>("cpu", file_sink_cpu);
   g_cpu_logger->set_level(spdlog::level::trace);
   g_cpu_logger->flush_on(spdlog::level::trace);
   g_cpu_logger->set_pattern("%v");
 
   // Set up GTE logger
-  g_gte_logger = std::make_shared<spdlog::logger>("gte", main_sinks);
+  g_gte_logger = make_async_logger("gte", main_sinks);
   g_gte_logger->set_level(spdlog::level::warn);
-  g_gte_logger->flush_on(spdlog::level::trace);
   g_gte_logger->set_pattern(DEFAULT_LOG_PATTERN);
 
 
 
   // Set up CDROM logger
-  g_cdrom_logger = std::make_shared<spdlog::logger>("cdrom", main_sinks);
+  g_cdrom_logger = make_async_logger("cdrom", main_sinks);
   g_cdrom_logger->set_level(spdlog::level::warn);
-  g_cdrom_logger->flush_on(spdlog::level::trace);
   g_cdrom_logger->set_pattern(DEFAULT_LOG_PATTERN);
 
   // Set up Joypad logger
-  g_joypad_logger = std::make_shared<spdlog::logger>("joypad", main_sinks);
+  g_joypad_logger = make_async_logger("joypad", main_sinks);
   g_joypad_logger->set_level(spdlog::level::info);
-  g_joypad_logger->flush_on(spdlog::level::trace);
   g_joypad_logger->set_pattern(DEFAULT_LOG_PATTERN);
 
   // Configure spdlog
   spdlog::set_default_logger(default_logger);
 }
 
+bool set_levels(const std::string& spec) {
+  const std::pair<const char*, spdlog::logger*> loggers[] = {
+    { "main", spdlog::default_logger_raw() }, { "cpu", g_cpu_logger.get() },
+    { "gte", g_gte_logger.get() },            { "cdrom", g_cdrom_logger.get() },
+    { "joypad", g_joypad_logger.get() },
+  };
+
+  // Parsed whole before any level is set
+  std::vector<std::pair<spdlog::logger*, spdlog::level::level_enum>> levels;
+  std::istringstream entries(spec);
+  std::string entry;
+  while (std::getline(entries, entry, ',')) {
+    const size_t equals = entry.find('=');
+    const std::string name = equals == std::string::npos ? "" : entry.substr(0, equals);
+    const std::string level_name = equals == std::string::npos ? entry : entry.substr(equals + 1);
+
+    // from_str() falls back to off for anything it doesn't know
+    const auto level = spdlog::level::from_str(level_name);
+    const bool is_known = level != spdlog::level::off || level_name == "off";
+    bool is_matched = false;
+    for (const auto& [logger_name, logger] : loggers) {
+      if (name.empty() || name == logger_name) {
+        levels.emplace_back(logger, level);
+        is_matched = true;
+      }
+    }
+    if (!is_known || !is_matched) {
+      LOG_ERROR("Invalid log level {}, expected <level> or <logger>=<level>", entry);
+      return false;
+    }
+  }
+
+  for (const auto& [logger, level] : levels)
+    logger->set_level(level);
+  return true;
+}
+
 }  // namespace logging
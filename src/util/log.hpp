@@ -3,41 +3,73 @@
 #include <spdlog/sinks/basic_file_sink.h>
 #include <spdlog/spdlog.h>
 
-#define LOG_TRACE SPDLOG_TRACE
-#define LOG_DEBUG SPDLOG_DEBUG
-#define LOG_INFO SPDLOG_INFO
-#define LOG_WARN SPDLOG_WARN
-#define LOG_ERROR SPDLOG_ERROR
-#define LOG_CRITICAL SPDLOG_CRITICAL
+#include <string>
+
+// Lowest level of each category that's compiled in, calls below it compile to nothing whatever the
+// runtime level (see logging::set_levels()). Release builds drop the trace and debug calls of the hot
+// paths: bus I/O, CD-ROM reads, GTE transfers...
+#if defined(NDEBUG)
+#define LOG_LEVEL_MAIN SPDLOG_LEVEL_INFO
+#define LOG_LEVEL_GTE SPDLOG_LEVEL_INFO
+#define LOG_LEVEL_CDROM SPDLOG_LEVEL_INFO
+#define LOG_LEVEL_JOYPAD SPDLOG_LEVEL_INFO
+#else
+#define LOG_LEVEL_MAIN SPDLOG_LEVEL_TRACE
+#define LOG_LEVEL_GTE SPDLOG_LEVEL_TRACE
+#define LOG_LEVEL_CDROM SPDLOG_LEVEL_TRACE
+#define LOG_LEVEL_JOYPAD SPDLOG_LEVEL_TRACE
+#endif
+// Only ever reached with Settings::log_trace_cpu on
+#define LOG_LEVEL_CPU SPDLOG_LEVEL_TRACE
+
+// The arguments of a call that's compiled out are still checked, but never evaluated
+#define LOG_AT(category_level, msg_level, logger, ...)                                \
+  do {                                                                                \
+    if constexpr ((msg_level) >= (category_level))                                    \
+      SPDLOG_LOGGER_CALL(logger, (spdlog::level::level_enum)(msg_level), __VA_ARGS__); \
+  } while (0)
+
+#define LOG_MAIN_AT(level, ...) LOG_AT(LOG_LEVEL_MAIN, level, spdlog::default_logger_raw(), __VA_ARGS__)
+#define LOG_CPU_AT(level, ...) LOG_AT(LOG_LEVEL_CPU, level, logging::g_cpu_logger, __VA_ARGS__)
+#define LOG_GTE_AT(level, ...) LOG_AT(LOG_LEVEL_GTE, level, logging::g_gte_logger, __VA_ARGS__)
+#define LOG_CDROM_AT(level, ...) LOG_AT(LOG_LEVEL_CDROM, level, logging::g_cdrom_logger, __VA_ARGS__)
+#define LOG_JOYPAD_AT(level, ...) LOG_AT(LOG_LEVEL_JOYPAD, level, logging::g_joypad_logger, __VA_ARGS__)
+
+#define LOG_TRACE(...) LOG_MAIN_AT(SPDLOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_MAIN_AT(SPDLOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...) LOG_MAIN_AT(SPDLOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...) LOG_MAIN_AT(SPDLOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_MAIN_AT(SPDLOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_CRITICAL(...) LOG_MAIN_AT(SPDLOG_LEVEL_CRITICAL, __VA_ARGS__)
 
 //#define LOG_TODO() LOG_WARN(__FUNCTION__, ": TODO")
 //#define LOG_TODO() LOG_WARN("TODO")
 //#define LOG_TODO()
 #define LOG_TODO() LOG_WARN(__FUNCTION__, ": TODO")
 
-#define LOG_TRACE_CPU(...) SPDLOG_LOGGER_TRACE(logging::g_cpu_logger, __VA_ARGS__)
+#define LOG_TRACE_CPU(...) LOG_CPU_AT(SPDLOG_LEVEL_TRACE, __VA_ARGS__)
 #define LOG_TRACE_CPU_NOFMT(msg) logging::g_cpu_logger->trace(msg)
 
-#define LOG_TRACE_GTE(...) SPDLOG_LOGGER_TRACE(logging::g_gte_logger, __VA_ARGS__)
-#define LOG_DEBUG_GTE(...) SPDLOG_LOGGER_DEBUG(logging::g_gte_logger, __VA_ARGS__)
-#define LOG_INFO_GTE(...) SPDLOG_LOGGER_INFO(logging::g_gte_logger, __VA_ARGS__)
-#define LOG_WARN_GTE(...) SPDLOG_LOGGER_WARN(logging::g_gte_logger, __VA_ARGS__)
-#define LOG_ERROR_GTE(...) SPDLOG_LOGGER_ERROR(logging::g_gte_logger, __VA_ARGS__)
-#define LOG_CRITICAL_GTE(...) SPDLOG_LOGGER_CRITICAL(logging::g_gte_logger, __VA_ARGS__)
-
-#define LOG_TRACE_CDROM(...) SPDLOG_LOGGER_TRACE(logging::g_cdrom_logger, __VA_ARGS__)
-#define LOG_DEBUG_CDROM(...) SPDLOG_LOGGER_DEBUG(logging::g_cdrom_logger, __VA_ARGS__)
-#define LOG_INFO_CDROM(...) SPDLOG_LOGGER_INFO(logging::g_cdrom_logger, __VA_ARGS__)
-#define LOG_WARN_CDROM(...) SPDLOG_LOGGER_WARN(logging::g_cdrom_logger, __VA_ARGS__)
-#define LOG_ERROR_CDROM(...) SPDLOG_LOGGER_ERROR(logging::g_cdrom_logger, __VA_ARGS__)
-#define LOG_CRITICAL_CDROM(...) SPDLOG_LOGGER_CRITICAL(logging::g_cdrom_logger, __VA_ARGS__)
-
-#define LOG_TRACE_JOYPAD(...) SPDLOG_LOGGER_TRACE(logging::g_joypad_logger, __VA_ARGS__)
-#define LOG_DEBUG_JOYPAD(...) SPDLOG_LOGGER_DEBUG(logging::g_joypad_logger, __VA_ARGS__)
-#define LOG_INFO_JOYPAD(...) SPDLOG_LOGGER_INFO(logging::g_joypad_logger, __VA_ARGS__)
-#define LOG_WARN_JOYPAD(...) SPDLOG_LOGGER_WARN(logging::g_joypad_logger, __VA_ARGS__)
-#define LOG_ERROR_JOYPAD(...) SPDLOG_LOGGER_ERROR(logging::g_joypad_logger, __VA_ARGS__)
-#define LOG_CRITICAL_JOYPAD(...) SPDLOG_LOGGER_CRITICAL(logging::g_joypad_logger, __VA_ARGS__)
+#define LOG_TRACE_GTE(...) LOG_GTE_AT(SPDLOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG_GTE(...) LOG_GTE_AT(SPDLOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO_GTE(...) LOG_GTE_AT(SPDLOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN_GTE(...) LOG_GTE_AT(SPDLOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR_GTE(...) LOG_GTE_AT(SPDLOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_CRITICAL_GTE(...) LOG_GTE_AT(SPDLOG_LEVEL_CRITICAL, __VA_ARGS__)
+
+#define LOG_TRACE_CDROM(...) LOG_CDROM_AT(SPDLOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG_CDROM(...) LOG_CDROM_AT(SPDLOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO_CDROM(...) LOG_CDROM_AT(SPDLOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN_CDROM(...) LOG_CDROM_AT(SPDLOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR_CDROM(...) LOG_CDROM_AT(SPDLOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_CRITICAL_CDROM(...) LOG_CDROM_AT(SPDLOG_LEVEL_CRITICAL, __VA_ARGS__)
+
+#define LOG_TRACE_JOYPAD(...) LOG_JOYPAD_AT(SPDLOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG_JOYPAD(...) LOG_JOYPAD_AT(SPDLOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO_JOYPAD(...) LOG_JOYPAD_AT(SPDLOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN_JOYPAD(...) LOG_JOYPAD_AT(SPDLOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR_JOYPAD(...) LOG_JOYPAD_AT(SPDLOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_CRITICAL_JOYPAD(...) LOG_JOYPAD_AT(SPDLOG_LEVEL_CRITICAL, __VA_ARGS__)
 
 namespace logging {
 
@@ -46,6 +78,14 @@ extern std::shared_ptr<spdlog::logger> g_gte_logger;
 extern std::shared_ptr<spdlog::logger> g_cdrom_logger;
 extern std::shared_ptr<spdlog::logger> g_joypad_logger;
 
+// Sets up the loggers, once per process. They're shared by every emulator in it and can be logged to
+// from any thread. All but the CPU trace log through a queue drained by a thread of their own, dropping
+// the oldest messages rather than blocking when it's full.
 void init();
 
+// Runtime levels, as "<level>" for every logger or "<logger>=<level>,..." for some of them. Loggers are
+// main, cpu, gte, cdrom and joypad, levels as in spdlog (trace, debug, info, warn, err, critical, off).
+// Returns false, changing nothing, if spec doesn't parse.
+bool set_levels(const std::string& spec);
+
 }  // namespace logging
@@ -0,0 +1,76 @@
+#include <util/mapped_file.hpp>
+
+#include <util/log.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPED_FILE_SUPPORTED 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define MAPPED_FILE_SUPPORTED 0
+#endif
+
+namespace util {
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+    : m_data(std::exchange(other.m_data, nullptr)),
+      m_size(std::exchange(other.m_size, 0)) {}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+  if (this != &other) {
+    close();
+    m_data = std::exchange(other.m_data, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+  }
+  return *this;
+}
+
+MappedFile::~MappedFile() {
+  close();
+}
+
+bool MappedFile::open(const fs::path& path) {
+  close();
+#if MAPPED_FILE_SUPPORTED
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    LOG_WARN("Could not open {} for mapping: {}", path.string(), std::strerror(errno));
+    return false;
+  }
+
+  struct stat file_stat {};
+  void* data = MAP_FAILED;
+  if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+    data = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps its own reference to the file
+  ::close(fd);
+
+  if (data == MAP_FAILED) {
+    LOG_WARN("Could not map {}: {}", path.string(), std::strerror(errno));
+    return false;
+  }
+
+  m_data = static_cast<const u8*>(data);
+  m_size = (size_t)file_stat.st_size;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void MappedFile::close() {
+#if MAPPED_FILE_SUPPORTED
+  if (m_data != nullptr)
+    munmap(const_cast<u8*>(m_data), m_size);
+#endif
+  m_data = nullptr;
+  m_size = 0;
+}
+
+}  // namespace util
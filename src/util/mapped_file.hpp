@@ -0,0 +1,34 @@
+#pragma once
+
+#include <util/fs.hpp>
+#include <util/types.hpp>
+
+#include <cstddef>
+
+namespace util {
+
+// Read-only memory mapping of a whole file, pages are read on demand by the OS and stay cached by it.
+// Only on POSIX hosts, open() fails elsewhere and callers go through regular reads instead.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  ~MappedFile();
+
+  // Returns false if the file couldn't be mapped, which leaves it closed
+  bool open(const fs::path& path);
+  void close();
+
+  bool is_open() const { return m_data != nullptr; }
+  const u8* data() const { return m_data; }
+  size_t size() const { return m_size; }
+
+ private:
+  const u8* m_data{};
+  size_t m_size{};
+};
+
+}  // namespace util
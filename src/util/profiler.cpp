@@ -0,0 +1,114 @@
+#include <util/profiler.hpp>
+
+#include <util/log.hpp>
+
+#include <algorithm>
+#include <fstream>
+
+namespace util {
+
+Profiler g_profiler;
+
+namespace {
+
+// Threads are told apart in traces by the order they first ran a zone in
+u32 thread_index() {
+  static std::atomic<u32> s_next_index{};
+  thread_local const u32 t_index = s_next_index.fetch_add(1, std::memory_order_relaxed);
+  return t_index;
+}
+
+}  // namespace
+
+const char* profile_zone_name(ProfileZone zone) {
+  switch (zone) {
+    case ProfileZone::Cpu: return "CPU";
+    case ProfileZone::BusIo: return "Bus I/O";
+    case ProfileZone::Dma: return "DMA";
+    case ProfileZone::Rasterizer: return "Rasterizer";
+    case ProfileZone::CdromRead: return "CD-ROM Read";
+    case ProfileZone::ScreenRenderer: return "Screen Renderer";
+    default: return "Unknown";
+  }
+}
+
+Profiler::Profiler() : m_epoch(std::chrono::steady_clock::now()) {}
+
+void Profiler::add(ProfileZone zone, u64 start_ns, u64 duration_ns) {
+  m_ns[(u32)zone].fetch_add(duration_ns, std::memory_order_relaxed);
+  m_calls[(u32)zone].fetch_add(1, std::memory_order_relaxed);
+
+  if (!is_capturing())
+    return;
+  std::lock_guard<std::mutex> lock(m_trace_mutex);
+  if (m_trace.size() < MAX_PROFILE_TRACE_EVENTS)
+    m_trace.push_back({ zone, thread_index(), start_ns, duration_ns });
+}
+
+void Profiler::end_frame() {
+  ProfileFrame frame;
+  for (u32 i = 0; i < PROFILE_ZONE_COUNT; ++i) {
+    frame.ns[i] = m_ns[i].exchange(0, std::memory_order_relaxed);
+    frame.calls[i] = m_calls[i].exchange(0, std::memory_order_relaxed);
+  }
+  const u64 now = now_ns();
+  frame.frame_ns = now - m_frame_start_ns;
+  m_frame_start_ns = now;
+
+  {
+    std::lock_guard<std::mutex> lock(m_history_mutex);
+    m_history[m_history_next] = frame;
+    m_history_next = (m_history_next + 1) % PROFILE_HISTORY_FRAMES;
+    m_history_size = std::min(m_history_size + 1, PROFILE_HISTORY_FRAMES);
+  }
+
+  const u32 capture_frames = m_capture_frames.load(std::memory_order_relaxed);
+  if (capture_frames != 0) {
+    m_capture_frames.store(capture_frames - 1, std::memory_order_relaxed);
+    if (capture_frames == 1) {
+      std::lock_guard<std::mutex> lock(m_trace_mutex);
+      LOG_INFO("Profiler trace captured, {} zones", m_trace.size());
+    }
+  }
+}
+
+void Profiler::history(std::vector<ProfileFrame>& frames) const {
+  std::lock_guard<std::mutex> lock(m_history_mutex);
+  frames.clear();
+  const u32 oldest = (m_history_next + PROFILE_HISTORY_FRAMES - m_history_size) % PROFILE_HISTORY_FRAMES;
+  for (u32 i = 0; i < m_history_size; ++i)
+    frames.push_back(m_history[(oldest + i) % PROFILE_HISTORY_FRAMES]);
+}
+
+void Profiler::start_capture(u32 frame_count) {
+  {
+    std::lock_guard<std::mutex> lock(m_trace_mutex);
+    m_trace.clear();
+  }
+  m_capture_frames.store(frame_count, std::memory_order_relaxed);
+}
+
+bool Profiler::write_chrome_trace(const fs::path& path) const {
+  std::ofstream file(path);
+  if (!file) {
+    LOG_ERROR("Could not open {} to write the profiler trace", path.string());
+    return false;
+  }
+
+  // Complete events with timestamps and durations in microseconds
+  std::lock_guard<std::mutex> lock(m_trace_mutex);
+  file << "{\"traceEvents\":[\n";
+  for (size_t i = 0; i < m_trace.size(); ++i) {
+    const TraceEvent& event = m_trace[i];
+    file << fmt::format(R"({{"name":"{}","ph":"X","pid":0,"tid":{},"ts":{:.3f},"dur":{:.3f}}}{})",
+                        profile_zone_name(event.zone), event.thread, event.start_ns / 1000.0,
+                        event.duration_ns / 1000.0, i + 1 < m_trace.size() ? "," : "")
+         << '\n';
+  }
+  file << "]}\n";
+
+  LOG_INFO("Wrote a profiler trace of {} zones to {}", m_trace.size(), path.string());
+  return bool(file);
+}
+
+}  // namespace util
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <util/fs.hpp>
+#include <util/types.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+// Times the hot paths of each subsystem, PROFILE_SCOPE() compiles to nothing without it
+#define PROFILER_ENABLED false
+
+namespace util {
+
+enum class ProfileZone : u32 {
+  Cpu,             // Cpu::step, everything it reaches through the bus included
+  BusIo,           // I/O ports dispatched by the bus, the ports' devices included
+  Dma,             // Dma::do_transfer
+  Rasterizer,      // Each drawn triangle, on whichever thread draws it
+  CdromRead,       // CdromDisk::read
+  ScreenRenderer,  // ScreenRenderer::render
+
+  Count,
+};
+
+constexpr u32 PROFILE_ZONE_COUNT = (u32)ProfileZone::Count;
+// Frames of history kept for the GUI
+constexpr u32 PROFILE_HISTORY_FRAMES = 120;
+// Zones recorded at most by a trace capture, the rest of the capture is dropped
+constexpr size_t MAX_PROFILE_TRACE_EVENTS = 1 << 20;
+
+const char* profile_zone_name(ProfileZone zone);
+
+// Time spent in each zone over a frame, zones nest so a zone's time includes the zones run under it
+struct ProfileFrame {
+  std::array<u64, PROFILE_ZONE_COUNT> ns{};
+  std::array<u32, PROFILE_ZONE_COUNT> calls{};
+  u64 frame_ns{};  // Between the ends of this frame and the previous one
+};
+
+// Where the zones add their time, from any thread. Each zone is two clock reads and two relaxed atomic
+// adds, a trace capture sends each zone through a mutex too so it's only taken for a few frames.
+class Profiler {
+ public:
+  Profiler();
+
+  void add(ProfileZone zone, u64 start_ns, u64 duration_ns);
+  // Sums the zones into a new frame of history, on the emulation thread
+  void end_frame();
+
+  // The latest frames, oldest first
+  void history(std::vector<ProfileFrame>& frames) const;
+
+  // Records each zone over the next frame_count frames, for write_chrome_trace()
+  void start_capture(u32 frame_count);
+  bool is_capturing() const { return m_capture_frames.load(std::memory_order_relaxed) != 0; }
+  // The last capture as a JSON trace for chrome://tracing or Perfetto
+  bool write_chrome_trace(const fs::path& path) const;
+
+  // Since the profiler was created
+  u64 now_ns() const {
+    const auto elapsed = std::chrono::steady_clock::now() - m_epoch;
+    return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  }
+
+ private:
+  struct TraceEvent {
+    ProfileZone zone;
+    u32 thread;
+    u64 start_ns;
+    u64 duration_ns;
+  };
+
+  std::chrono::steady_clock::time_point m_epoch;
+
+  std::array<std::atomic<u64>, PROFILE_ZONE_COUNT> m_ns{};
+  std::array<std::atomic<u32>, PROFILE_ZONE_COUNT> m_calls{};
+  u64 m_frame_start_ns{};
+
+  mutable std::mutex m_history_mutex;
+  std::array<ProfileFrame, PROFILE_HISTORY_FRAMES> m_history{};
+  u32 m_history_next{};  // Oldest frame, overwritten by the next one
+  u32 m_history_size{};
+
+  std::atomic<u32> m_capture_frames{};  // Left to capture
+  mutable std::mutex m_trace_mutex;
+  std::vector<TraceEvent> m_trace;
+};
+
+extern Profiler g_profiler;
+
+// Adds the time from its construction to its destruction to a zone
+class ProfileScope {
+ public:
+  explicit ProfileScope(ProfileZone zone) : m_zone(zone), m_start_ns(g_profiler.now_ns()) {}
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+  ~ProfileScope() { g_profiler.add(m_zone, m_start_ns, g_profiler.now_ns() - m_start_ns); }
+
+ private:
+  ProfileZone m_zone;
+  u64 m_start_ns;
+};
+
+}  // namespace util
+
+#define PROFILE_SCOPE_NAME_(line) profile_scope_##line
+#define PROFILE_SCOPE_NAME(line) PROFILE_SCOPE_NAME_(line)
+
+#if PROFILER_ENABLED
+#define PROFILE_SCOPE(zone) const util::ProfileScope PROFILE_SCOPE_NAME(__LINE__)(util::ProfileZone::zone)
+#else
+#define PROFILE_SCOPE(zone) ((void)0)
+#endif
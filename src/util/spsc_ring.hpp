@@ -0,0 +1,60 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace util {
+
+// Lock-free ring buffer between exactly one producer thread and one consumer thread. The consumer works
+// on items in place (front(), then pop() once done with it), so empty() also means the consumer went
+// through everything that was pushed. Indices only ever increase and are wrapped when indexing.
+template <typename T, size_t Capacity>
+class SpscRing {
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+ public:
+  // Producer side, false if the ring is full
+  bool try_push(const T& item) {
+    const size_t write = m_write.load(std::memory_order_relaxed);
+    if (write - m_read_cached == Capacity) {
+      m_read_cached = m_read.load(std::memory_order_acquire);
+      if (write - m_read_cached == Capacity)
+        return false;
+    }
+
+    m_items[write & (Capacity - 1)] = item;
+    m_write.store(write + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side, nullptr if the ring is empty
+  const T* front() {
+    const size_t read = m_read.load(std::memory_order_relaxed);
+    if (read == m_write_cached) {
+      m_write_cached = m_write.load(std::memory_order_acquire);
+      if (read == m_write_cached)
+        return nullptr;
+    }
+    return &m_items[read & (Capacity - 1)];
+  }
+  void pop() { m_read.store(m_read.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+  // Either side
+  bool empty() const {
+    return m_read.load(std::memory_order_acquire) == m_write.load(std::memory_order_acquire);
+  }
+
+ private:
+  std::array<T, Capacity> m_items{};
+
+  // Each side's index on its own cache line, along with its cached copy of the other side's
+  alignas(64) std::atomic<size_t> m_write{};
+  size_t m_read_cached{};
+  alignas(64) std::atomic<size_t> m_read{};
+  size_t m_write_cached{};
+};
+
+}  // namespace util
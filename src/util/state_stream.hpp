@@ -0,0 +1,86 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace util {
+
+// Binary save state of the emulator, written and read back by the same serialize() of each component
+// so that both directions can't drift apart. Values are copied as raw bytes with nothing describing
+// them: a state is only meant to be loaded by the build that saved it, on the same kind of host.
+class StateStream {
+ public:
+  // Appends to buffer, which keeps its capacity from one save to the next so that saving doesn't
+  // allocate once it's grown
+  explicit StateStream(std::vector<byte>& buffer) : m_buffer(&buffer) {}
+  // Reads size bytes from data
+  StateStream(const byte* data, size_t size) : m_data(data), m_size(size) {}
+
+  bool is_loading() const { return m_buffer == nullptr; }
+  // False once a load ran past the end of the data or into the wrong section, nothing is read after that
+  bool ok() const { return m_ok; }
+  // For what the stream can't tell by itself, e.g. an unknown version
+  void fail() { m_ok = false; }
+  // Bytes written or read so far
+  size_t position() const { return is_loading() ? m_pos : m_buffer->size(); }
+
+  void bytes(void* data, size_t size) {
+    if (!is_loading()) {
+      const auto* src = static_cast<const byte*>(data);
+      m_buffer->insert(m_buffer->end(), src, src + size);
+      return;
+    }
+    if (!m_ok || size > m_size - m_pos) {
+      m_ok = false;
+      return;
+    }
+    std::memcpy(data, m_data + m_pos, size);
+    m_pos += size;
+  }
+
+  template <typename T>
+  void value(T& val) {
+    static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be copied as bytes");
+    bytes(&val, sizeof(T));
+  }
+
+  // The size first, then the items
+  template <typename T>
+  void vector(std::vector<T>& vec) {
+    static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be copied as bytes");
+    u32 size = static_cast<u32>(vec.size());
+    value(size);
+    if (is_loading()) {
+      if (!m_ok || size > (m_size - m_pos) / sizeof(T)) {
+        m_ok = false;
+        return;
+      }
+      vec.resize(size);
+    }
+    bytes(vec.data(), size * sizeof(T));
+  }
+
+  // Tags the start of a component's state with 4 characters, a load fails if they don't match
+  void section(const char (&tag)[5]) {
+    u32 word;
+    std::memcpy(&word, tag, sizeof(word));
+    const u32 expected = word;
+    value(word);
+    if (is_loading() && word != expected)
+      m_ok = false;
+  }
+
+ private:
+  std::vector<byte>* m_buffer{};  // Null when loading
+
+  const byte* m_data{};
+  size_t m_size{};
+  size_t m_pos{};
+  bool m_ok{ true };
+};
+
+}  // namespace util
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <util/types.hpp>
+
+#include <array>
+#include <atomic>
+
+namespace util {
+
+// Lock-free handoff of the latest item from exactly one producer thread to one consumer thread, neither
+// side ever waits for the other. The producer fills back() and publishes it, the consumer picks the last
+// published item up as front() with update(). Items published faster than the consumer picks them up
+// are replaced: the consumer only sees the latest one.
+template <typename T>
+class TripleBuffer {
+ public:
+  // Producer side
+  T& back() { return m_items[m_back]; }
+  void publish() {
+    const u8 middle = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel);
+    m_back = middle & INDEX_MASK;
+  }
+  // Whether the consumer picked up the last published item. Can turn true right after returning false.
+  bool is_picked_up() const { return !(m_middle.load(std::memory_order_acquire) & FRESH); }
+
+  // Consumer side, true if front() changed to a newly published item
+  bool update() {
+    if (!(m_middle.load(std::memory_order_relaxed) & FRESH))
+      return false;
+
+    const u8 middle = m_middle.exchange(m_front, std::memory_order_acq_rel);
+    m_front = middle & INDEX_MASK;
+    return true;
+  }
+  const T& front() const { return m_items[m_front]; }
+
+ private:
+  // The index of the middle item, along with whether it was published since the consumer last swapped
+  static constexpr u8 INDEX_MASK = 0b11;
+  static constexpr u8 FRESH = 0b100;
+
+  std::array<T, 3> m_items{};
+
+  // Each side's index on its own cache line, the middle one is swapped with either
+  alignas(64) u8 m_back{ 0 };
+  alignas(64) std::atomic<u8> m_middle{ 1 };
+  alignas(64) u8 m_front{ 2 };
+};
+
+}  // namespace util